@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <random>
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QVector>
+
+#include "corpus.h"
+
+namespace labelbuddy {
+
+namespace {
+
+/// Generates the documents of a corpus one after the other
+class CorpusGenerator {
+public:
+  explicit CorpusGenerator(const CorpusParams& params)
+      : params_{params}, engine_{params.seed} {}
+
+  /// Next document as a JSON object with "text" and "labels"
+  QJsonObject next_document() {
+    auto code_points = next_code_points();
+    QJsonObject doc{};
+    doc["text"] = QString::fromUcs4(code_points.constData(),
+                                    code_points.size());
+    doc["labels"] = make_annotations(code_points.size());
+    return doc;
+  }
+
+private:
+  QVector<uint> next_code_points() {
+    std::uniform_int_distribution<int> word_length(1, 10);
+    std::uniform_int_distribution<uint> letter(uint{'a'}, uint{'z'});
+    // emoticons block, outside of the BMP
+    std::uniform_int_distribution<uint> wide_char(0x1f600, 0x1f64f);
+    std::uniform_real_distribution<double> uniform(0., 1.);
+    QVector<uint> code_points{};
+    code_points.reserve(params_.doc_length);
+    int n_words{};
+    while (code_points.size() < params_.doc_length) {
+      auto length = word_length(engine_);
+      for (int i = 0; i != length && code_points.size() < params_.doc_length;
+           ++i) {
+        code_points << (uniform(engine_) < params_.surrogate_density
+                            ? wide_char(engine_)
+                            : letter(engine_));
+      }
+      if (code_points.size() < params_.doc_length) {
+        code_points << (++n_words % 12 == 0 ? uint{'\n'} : uint{' '});
+      }
+    }
+    return code_points;
+  }
+
+  QJsonArray make_annotations(int n_code_points) {
+    QJsonArray annotations{};
+    if (n_code_points < 2) {
+      return annotations;
+    }
+    auto n_annotations = static_cast<int>(params_.annotation_density *
+                                          n_code_points / 1000.);
+    std::uniform_int_distribution<int> start_char(0, n_code_points - 2);
+    std::uniform_int_distribution<int> annotation_length(1, 30);
+    std::uniform_int_distribution<int> label(0,
+                                             std::max(params_.n_labels, 1) - 1);
+    for (int i = 0; i != n_annotations; ++i) {
+      auto start = start_char(engine_);
+      auto end = std::min(n_code_points, start + annotation_length(engine_));
+      annotations.append(QJsonArray{start, end,
+                                    QString("label %0").arg(label(engine_))});
+    }
+    return annotations;
+  }
+
+  CorpusParams params_;
+  std::mt19937 engine_;
+};
+
+} // namespace
+
+bool write_corpus_jsonl(const CorpusParams& params, const QString& file_path) {
+  QFile file(file_path);
+  if (!file.open(QIODevice::WriteOnly)) {
+    return false;
+  }
+  CorpusGenerator generator(params);
+  for (int i = 0; i != params.n_docs; ++i) {
+    file.write(QJsonDocument(generator.next_document())
+                   .toJson(QJsonDocument::Compact));
+    file.write("\n");
+  }
+  return true;
+}
+
+bool write_corpus_txt(const CorpusParams& params, const QString& file_path) {
+  QFile file(file_path);
+  if (!file.open(QIODevice::WriteOnly)) {
+    return false;
+  }
+  CorpusGenerator generator(params);
+  for (int i = 0; i != params.n_docs; ++i) {
+    auto text = generator.next_document()["text"].toString();
+    text.replace('\n', ' ');
+    file.write(text.toUtf8());
+    file.write("\n");
+  }
+  return true;
+}
+
+} // namespace labelbuddy
@@ -0,0 +1,40 @@
+#ifndef LABELBUDDY_BENCH_CORPUS_H
+#define LABELBUDDY_BENCH_CORPUS_H
+
+#include <QString>
+
+/// \file
+/// Synthetic documents for the benchmarks.
+
+namespace labelbuddy {
+
+/// Shape of a generated corpus
+struct CorpusParams {
+  int n_docs = 1000;
+  /// number of unicode code points in each document
+  int doc_length = 5000;
+  /// annotations per 1000 code points
+  double annotation_density = 5.;
+  /// fraction of the characters that are outside of the Basic Multilingual
+  /// Plane, ie represented by a surrogate pair in a QString
+  double surrogate_density = 0.01;
+  int n_labels = 10;
+  unsigned int seed = 0;
+};
+
+/// Write a corpus in the JSONLines format accepted by `import_documents`.
+
+/// Documents contain random words, with a line break every few words, and
+/// annotations with random positions and labels named "label 0", "label
+/// 1", ... Returns `false` if the file could not be written.
+bool write_corpus_jsonl(const CorpusParams& params, const QString& file_path);
+
+/// Write the same documents as `write_corpus_jsonl`, as a text file.
+
+/// Each document is one line (its line breaks are replaced by spaces), and
+/// there are no annotations.
+bool write_corpus_txt(const CorpusParams& params, const QString& file_path);
+
+} // namespace labelbuddy
+
+#endif
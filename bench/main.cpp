@@ -0,0 +1,371 @@
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <memory>
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPlainTextEdit>
+#include <QScrollBar>
+#include <QStringList>
+#include <QTemporaryDir>
+
+#include "annotations_model.h"
+#include "annotator.h"
+#include "corpus.h"
+#include "database.h"
+#include "doc_list_model.h"
+#include "label_list_model.h"
+#include "searchable_text.h"
+#include "utils.h"
+
+/// \file
+/// Benchmarks of imports, exports, navigation and painting annotations on a
+/// synthetic corpus. Results are printed as JSON.
+
+namespace labelbuddy {
+
+namespace {
+
+/// Time `body` `n_repeats` times; `setup`, not timed, runs before each repeat
+QJsonObject run_benchmark(const QString& name, int n_repeats, int n_items,
+                          const std::function<void()>& setup,
+                          const std::function<void()>& body) {
+  QList<double> seconds{};
+  for (int i = 0; i != n_repeats; ++i) {
+    if (setup) {
+      setup();
+    }
+    QElapsedTimer timer{};
+    timer.start();
+    body();
+    seconds << static_cast<double>(timer.nsecsElapsed()) / 1e9;
+  }
+  auto sorted = seconds;
+  std::sort(sorted.begin(), sorted.end());
+  auto median = sorted[sorted.size() / 2];
+  QJsonArray all_seconds{};
+  double total{};
+  for (auto s : seconds) {
+    all_seconds << s;
+    total += s;
+  }
+  QJsonObject result{};
+  result["name"] = name;
+  result["n_items"] = n_items;
+  result["seconds"] = all_seconds;
+  result["min_seconds"] = sorted.front();
+  result["median_seconds"] = median;
+  result["mean_seconds"] = total / seconds.size();
+  result["items_per_second"] = median > 0. ? n_items / median : 0.;
+  std::cerr << name.toStdString() << ": " << median << " s" << std::endl;
+  return result;
+}
+
+QJsonObject params_to_json(const CorpusParams& params, int n_repeats) {
+  QJsonObject json{};
+  json["n_docs"] = params.n_docs;
+  json["doc_length"] = params.doc_length;
+  json["annotation_density"] = params.annotation_density;
+  json["surrogate_density"] = params.surrogate_density;
+  json["n_labels"] = params.n_labels;
+  json["seed"] = static_cast<double>(params.seed);
+  json["n_repeats"] = n_repeats;
+  return json;
+}
+
+class Benchmarks {
+public:
+  Benchmarks(const CorpusParams& params, int n_repeats, int n_visits)
+      : params_{params}, n_repeats_{n_repeats},
+        n_visits_{std::min(n_visits, params.n_docs - 1)} {}
+
+  /// Run all benchmarks; returns `false` if the corpus could not be prepared
+  bool run(QJsonArray& results) {
+    if (!prepare()) {
+      return false;
+    }
+    bench_imports(results);
+    bench_exports(results);
+    bench_doc_list(results);
+    bench_navigation(results);
+    bench_annotator(results);
+    return true;
+  }
+
+private:
+  QString path(const QString& name) const { return tmp_dir_.filePath(name); }
+
+  /// Write the corpus, import it in the reference database and export it in
+  /// the other formats so they can be imported too.
+  bool prepare() {
+    if (!tmp_dir_.isValid() ||
+        !write_corpus_jsonl(params_, path("corpus.jsonl")) ||
+        !write_corpus_txt(params_, path("corpus.txt"))) {
+      return false;
+    }
+    catalog_.open_database(path("reference.sqlite"));
+    auto imported = catalog_.import_documents(path("corpus.jsonl"));
+    if (imported.error_code != ErrorCode::NoError) {
+      return false;
+    }
+    for (const auto& format : QStringList{"json", "xml", "csv"}) {
+      auto res = catalog_.export_documents(
+          path(QString("corpus.%0").arg(format)), false, true, true, "");
+      if (res.error_code != ErrorCode::NoError) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void bench_imports(QJsonArray& results) {
+    std::unique_ptr<DatabaseCatalog> catalog{};
+    int n_databases{};
+    for (const auto& format :
+         QStringList{"jsonl", "json", "xml", "csv", "txt"}) {
+      auto file_path = path(QString("corpus.%0").arg(format));
+      auto setup = [&]() {
+        catalog.reset(new DatabaseCatalog);
+        catalog->open_database(
+            path(QString("import_%0.sqlite").arg(n_databases++)));
+      };
+      results << run_benchmark(
+          QString("import_%0").arg(format), n_repeats_, params_.n_docs, setup,
+          [&]() { catalog->import_documents(file_path); });
+    }
+    catalog.reset();
+  }
+
+  void bench_exports(QJsonArray& results) {
+    for (const auto& format : QStringList{"jsonl", "json", "xml", "csv"}) {
+      auto file_path = path(QString("export.%0").arg(format));
+      results << run_benchmark(
+          QString("export_%0").arg(format), n_repeats_, params_.n_docs,
+          nullptr, [&]() {
+            catalog_.export_documents(file_path, false, true, true, "");
+          });
+    }
+  }
+
+  void bench_doc_list(QJsonArray& results) {
+    DocListModel model{};
+    model.set_database(catalog_.get_current_database());
+    const int page_size{100};
+    auto n_pages = (params_.n_docs + page_size - 1) / page_size;
+    auto page_through = [&](DocListModel::DocFilter filter) {
+      model.adjust_query(filter, -1, page_size, 0);
+      for (int i = 1; i != n_pages; ++i) {
+        model.adjust_query(filter, -1, page_size, i * page_size);
+      }
+    };
+    results << run_benchmark("doc_list_pages_all", n_repeats_, n_pages,
+                             nullptr, [&]() {
+                               page_through(DocListModel::DocFilter::all);
+                             });
+    results << run_benchmark("doc_list_pages_labelled", n_repeats_, n_pages,
+                             nullptr, [&]() {
+                               page_through(DocListModel::DocFilter::labelled);
+                             });
+    // jumping to the last page then back to the first one
+    results << run_benchmark(
+        "doc_list_jump_last_first", n_repeats_, 2, nullptr, [&]() {
+          model.adjust_query(DocListModel::DocFilter::all, -1, page_size,
+                             (n_pages - 1) * page_size);
+          model.adjust_query(DocListModel::DocFilter::all, -1, page_size, 0);
+        });
+    // one page with all the documents, fetched as when scrolling to the end
+    results << run_benchmark(
+        "doc_list_scroll_all", n_repeats_, params_.n_docs, nullptr, [&]() {
+          model.adjust_query(DocListModel::DocFilter::all, -1, 0, 0);
+          while (model.canFetchMore(QModelIndex())) {
+            model.fetchMore(QModelIndex());
+          }
+        });
+  }
+
+  void bench_navigation(QJsonArray& results) {
+    AnnotationsModel model{};
+    model.set_database(catalog_.get_current_database());
+    auto first = [&]() { model.visit_first_doc(); };
+    results << run_benchmark("visit_next", n_repeats_, n_visits_, first, [&]() {
+      for (int i = 0; i != n_visits_; ++i) {
+        model.visit_next();
+      }
+    });
+    results << run_benchmark("visit_next_labelled", n_repeats_, n_visits_,
+                             first, [&]() {
+                               for (int i = 0; i != n_visits_; ++i) {
+                                 model.visit_next_labelled();
+                               }
+                             });
+    results << run_benchmark("visit_next_unlabelled", n_repeats_, n_visits_,
+                             first, [&]() {
+                               for (int i = 0; i != n_visits_; ++i) {
+                                 model.visit_next_unlabelled();
+                               }
+                             });
+  }
+
+  void bench_annotator(QJsonArray& results) {
+    AnnotationsModel annotations_model{};
+    annotations_model.set_database(catalog_.get_current_database());
+    LabelListModel labels_model{};
+    labels_model.set_database(catalog_.get_current_database());
+    Annotator annotator{};
+    annotator.set_annotations_model(&annotations_model);
+    annotator.set_label_list_model(&labels_model);
+    annotator.resize(1000, 800);
+    annotator.show();
+    QApplication::processEvents();
+    auto first = [&]() {
+      annotations_model.visit_first_doc();
+      QApplication::processEvents();
+    };
+    // fetching the annotations and painting them for each new document
+    results << run_benchmark("annotator_visit_next", n_repeats_, n_visits_,
+                             first, [&]() {
+                               for (int i = 0; i != n_visits_; ++i) {
+                                 annotations_model.visit_next();
+                                 QApplication::processEvents();
+                               }
+                             });
+    // `update_annotations` fetches and paints the annotations again
+    results << run_benchmark("annotator_update_annotations", n_repeats_,
+                             n_visits_, first, [&]() {
+                               for (int i = 0; i != n_visits_; ++i) {
+                                 annotator.update_annotations();
+                               }
+                             });
+    // scrolling repaints the annotations that become visible
+    auto scroll_bar = annotator.findChild<SearchableText*>()
+                          ->get_text_edit()
+                          ->verticalScrollBar();
+    auto n_steps = std::max(1, scroll_bar->maximum() / scroll_bar->pageStep());
+    results << run_benchmark(
+        "annotator_scroll", n_repeats_, n_steps,
+        [&]() {
+          scroll_bar->setValue(0);
+          QApplication::processEvents();
+        },
+        [&]() {
+          for (int i = 1; i <= n_steps; ++i) {
+            scroll_bar->setValue(i * scroll_bar->pageStep());
+            QApplication::processEvents();
+          }
+        });
+  }
+
+  CorpusParams params_;
+  int n_repeats_;
+  int n_visits_;
+  QTemporaryDir tmp_dir_{};
+  DatabaseCatalog catalog_{};
+};
+
+int positive_int_option(const QCommandLineParser& parser, const QString& name,
+                        bool& ok) {
+  bool is_int{};
+  auto value = parser.value(name).toInt(&is_int);
+  if (!is_int || value < 1) {
+    std::cerr << "--" << name.toStdString() << " must be a positive integer"
+              << std::endl;
+    ok = false;
+  }
+  return value;
+}
+
+double fraction_option(const QCommandLineParser& parser, const QString& name,
+                       bool& ok) {
+  bool is_double{};
+  auto value = parser.value(name).toDouble(&is_double);
+  if (!is_double || value < 0.) {
+    std::cerr << "--" << name.toStdString()
+              << " must be a non-negative number" << std::endl;
+    ok = false;
+  }
+  return value;
+}
+
+} // namespace
+
+} // namespace labelbuddy
+
+int main(int argc, char* argv[]) {
+  // the annotator is shown, but it does not need a display
+  if (qgetenv("QT_QPA_PLATFORM").isEmpty()) {
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+  }
+  QApplication app(argc, argv);
+  QApplication::setApplicationName("labelbuddy_bench");
+
+  QCommandLineParser parser{};
+  parser.setApplicationDescription(
+      "Benchmarks of labelbuddy on a synthetic corpus; results are printed "
+      "as JSON.");
+  parser.addHelpOption();
+  parser.addOption({"n-docs", "Number of documents.", "n", "1000"});
+  parser.addOption(
+      {"doc-length", "Number of characters in each document.", "n", "5000"});
+  parser.addOption({"annotation-density",
+                    "Number of annotations per 1000 characters.", "x", "5"});
+  parser.addOption(
+      {"surrogate-density",
+       "Fraction of characters outside of the Basic Multilingual Plane.", "x",
+       "0.01"});
+  parser.addOption({"n-labels", "Number of labels.", "n", "10"});
+  parser.addOption({"seed", "Seed of the random corpus.", "n", "0"});
+  parser.addOption({"repeat", "Number of times each benchmark is run.", "n",
+                    "3"});
+  parser.addOption({"visits",
+                    "Number of documents visited by navigation benchmarks.",
+                    "n", "200"});
+  parser.addOption(
+      {"output", "Write the results to this file rather than stdout.", "file"});
+  parser.process(app);
+
+  labelbuddy::CorpusParams params{};
+  bool ok{true};
+  params.n_docs = labelbuddy::positive_int_option(parser, "n-docs", ok);
+  params.doc_length = labelbuddy::positive_int_option(parser, "doc-length", ok);
+  params.annotation_density =
+      labelbuddy::fraction_option(parser, "annotation-density", ok);
+  params.surrogate_density =
+      labelbuddy::fraction_option(parser, "surrogate-density", ok);
+  params.n_labels = labelbuddy::positive_int_option(parser, "n-labels", ok);
+  params.seed = parser.value("seed").toUInt();
+  auto n_repeats = labelbuddy::positive_int_option(parser, "repeat", ok);
+  auto n_visits = labelbuddy::positive_int_option(parser, "visits", ok);
+  if (!ok) {
+    return 1;
+  }
+
+  QJsonArray results{};
+  labelbuddy::Benchmarks benchmarks(params, n_repeats, n_visits);
+  if (!benchmarks.run(results)) {
+    std::cerr << "Could not prepare the corpus" << std::endl;
+    return 1;
+  }
+  QJsonObject report{};
+  report["labelbuddy_version"] = labelbuddy::get_version();
+  report["qt_version"] = QString(qVersion());
+  report["params"] = labelbuddy::params_to_json(params, n_repeats);
+  report["results"] = results;
+  auto json = QJsonDocument(report).toJson();
+  if (parser.isSet("output")) {
+    QFile file(parser.value("output"));
+    if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size()) {
+      std::cerr << "Could not write " << parser.value("output").toStdString()
+                << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+  std::cout << json.toStdString();
+  return 0;
+}
@@ -5,6 +5,7 @@ src/doc_list.h \
 src/doc_list_model.h \
 src/label_list.h \
 src/label_list_model.h \
+src/label_cache.h \
 src/dataset_menu.h \
 src/user_roles.h \
 src/main_window.h \
@@ -17,6 +18,24 @@ src/import_export_menu.h \
 src/utils.h \
 src/csv.h \
 src/compat.h \
+src/compressed_file.h \
+src/document_loader.h \
+src/text_search.h \
+src/doc_deletion.h \
+src/batch_stats.h \
+src/tracing.h \
+src/document_id_index.h \
+src/batch_labeling.h \
+src/arrow_writer.h \
+src/label_stats.h \
+src/label_stats_model.h \
+src/label_filter_model.h \
+src/worker_connection.h \
+src/utf8_writer.h \
+src/pre_annotation.h \
+src/doc_counts.h \
+src/summary_backfill.h \
+src/pending_writes.h \
 
 
 SOURCES += \
@@ -25,6 +44,7 @@ src/doc_list.cpp \
 src/doc_list_model.cpp \
 src/label_list.cpp \
 src/label_list_model.cpp \
+src/label_cache.cpp \
 src/dataset_menu.cpp \
 src/main_window.cpp \
 src/annotator.cpp \
@@ -36,8 +56,34 @@ src/import_export_menu.cpp \
 src/utils.cpp \
 src/csv.cpp \
 src/compat.cpp \
+src/compressed_file.cpp \
+src/document_loader.cpp \
+src/text_search.cpp \
+src/doc_deletion.cpp \
+src/batch_stats.cpp \
+src/tracing.cpp \
+src/document_id_index.cpp \
+src/batch_labeling.cpp \
+src/arrow_writer.cpp \
+src/label_stats.cpp \
+src/label_stats_model.cpp \
+src/label_filter_model.cpp \
+src/worker_connection.cpp \
+src/utf8_writer.cpp \
+src/pre_annotation.cpp \
+src/doc_counts.cpp \
+src/summary_backfill.cpp \
+src/pending_writes.cpp \
 
 QT += widgets sql
+CONFIG += thread
+LIBS += -lz
+
+# build with `qmake CONFIG+=zstd` to read and write .zst files
+zstd {
+DEFINES += LABELBUDDY_USE_ZSTD
+LIBS += -lzstd
+}
 RESOURCES = resources.qrc
 
 test {
@@ -70,6 +116,16 @@ test/test_utils.h \
 test/test_label_list.h \
 test/test_import_export_menu.h \
 test/test_csv.h \
+test/test_label_cache.h \
+test/test_compressed_file.h \
+test/test_tracing.h \
+test/test_batch_labeling.h \
+test/test_arrow_writer.h \
+test/test_label_stats.h \
+test/test_label_filter_model.h \
+test/test_worker_connection.h \
+test/test_utf8_writer.h \
+test/test_pre_annotation.h \
 
 SOURCES += \
 test/main.cpp \
@@ -87,6 +143,16 @@ test/test_utils.cpp \
 test/test_label_list.cpp \
 test/test_import_export_menu.cpp \
 test/test_csv.cpp \
+test/test_label_cache.cpp \
+test/test_compressed_file.cpp \
+test/test_tracing.cpp \
+test/test_batch_labeling.cpp \
+test/test_arrow_writer.cpp \
+test/test_label_stats.cpp \
+test/test_label_filter_model.cpp \
+test/test_worker_connection.cpp \
+test/test_utf8_writer.cpp \
+test/test_pre_annotation.cpp \
 
 SOURCES -= src/main.cpp
 }
@@ -1,24 +1,89 @@
 #include <cassert>
+#include <initializer_list>
+#include <utility>
 
 #include <QObject>
 #include <QSqlDatabase>
+#include <QSqlError>
 #include <QVariant>
 
 #include "annotations_model.h"
+#include "pending_writes.h"
+#include "tracing.h"
+#include "worker_connection.h"
 
 namespace labelbuddy {
 
-AnnotationsModel::AnnotationsModel(QObject* parent) : QObject(parent) {}
+AnnotationsModel::AnnotationsModel(QObject* parent) : QObject(parent) {
+  QObject::connect(this, &AnnotationsModel::document_loaded, this,
+                   &AnnotationsModel::show_loaded_document,
+                   Qt::QueuedConnection);
+  QObject::connect(this, &AnnotationsModel::documents_prefetched, this,
+                   &AnnotationsModel::store_prefetched_documents,
+                   Qt::QueuedConnection);
+  commit_timer_.setSingleShot(true);
+  commit_timer_.setInterval(commit_delay_ms_);
+  QObject::connect(&commit_timer_, &QTimer::timeout, this,
+                   &AnnotationsModel::commit_pending_writes);
+}
+
+AnnotationsModel::~AnnotationsModel() {
+  if (write_pending_ && QSqlDatabase::contains(write_database_)) {
+    commit_pending_writes();
+  }
+  if (write_pending_) {
+    clear_pending_writes(write_database_);
+  }
+}
 
 QSqlQuery AnnotationsModel::get_query() const {
   return QSqlQuery(QSqlDatabase::database(database_name));
 }
 
+void AnnotationsModel::set_label_cache(LabelCache* cache) {
+  assert(cache != nullptr);
+  label_cache_ = cache;
+}
+
+void AnnotationsModel::set_asynchronous_loading(bool asynchronous) {
+  asynchronous_loading_ = asynchronous;
+  reset_loader();
+}
+
+bool AnnotationsModel::is_cached(int doc_id) const {
+  return cache_.contains(doc_id);
+}
+
+void AnnotationsModel::reset_loader() {
+  // results of requests made to the previous loader are ignored
+  ++last_request_id_;
+  loader_.reset();
+  cache_.clear();
+  if (!asynchronous_loading_ || database_name == "") {
+    return;
+  }
+  auto database_path = worker_database_path(database_name);
+  if (database_path == "") {
+    return;
+  }
+  auto on_loaded = [this](int request_id) { emit document_loaded(request_id); };
+  auto on_prefetched = [this]() { emit documents_prefetched(); };
+  loader_.reset(
+      new DocumentLoadingThread(database_path, on_loaded, on_prefetched));
+}
+
 void AnnotationsModel::set_database(const QString& new_database_name) {
   assert(QSqlDatabase::contains(new_database_name));
+  commit_pending_writes();
+  undo_log_.clear();
+  redo_log_.clear();
   database_name = new_database_name;
+  doc_ids_.clear();
+  navigation_state_valid_ = false;
+  reset_loader();
+  label_cache_->set_database(database_name);
   auto query = get_query();
-  query.exec("select last_visited_doc from app_state;");
+  traced_exec(query, "select last_visited_doc from app_state;");
   query.next();
   if (query.value(0) == QVariant()) {
     visit_first_doc();
@@ -27,7 +92,7 @@ void AnnotationsModel::set_database(const QString& new_database_name) {
   auto last_visited = query.value(0).toInt();
   query.prepare("select count(*) from document where id = :doc;");
   query.bindValue(":doc", last_visited);
-  query.exec();
+  traced_exec(query);
   query.next();
   auto exists = query.value(0).toInt();
   if (exists) {
@@ -37,195 +102,338 @@ void AnnotationsModel::set_database(const QString& new_database_name) {
   }
 }
 
-QString AnnotationsModel::get_title() const {
-  auto query = get_query();
-  query.prepare("select coalesce(short_title, '') "
-                "as title from document where id = :docid ;");
-  query.bindValue(":docid", current_doc_id);
-  query.exec();
-  if (query.next()) {
-    return query.value(0).toString();
-  } else {
-    return QString("");
-  }
-}
+QString AnnotationsModel::get_title() const { return current_title_; }
 
-QString AnnotationsModel::get_content() const {
-  auto query = get_query();
-  query.prepare("select content from document where id = :docid ;");
-  query.bindValue(":docid", current_doc_id);
-  query.exec();
-  if (query.next()) {
-    return query.value(0).toString();
-  } else {
-    return QString("");
-  }
-}
-
-void AnnotationsModel::fill_index_converters(const QString& text) {
-  surrogate_indices_in_qstring_.clear();
-  surrogate_indices_in_unicode_string_.clear();
-  int q_pos{};
-  int u_pos{};
-  for (auto qchar : text) {
-    if (!qchar.isSurrogate()) {
-      ++q_pos;
-      ++u_pos;
-    } else if (qchar.isHighSurrogate()) {
-      surrogate_indices_in_qstring_ << q_pos;
-      ++q_pos;
-      surrogate_indices_in_unicode_string_ << u_pos;
-      ++u_pos;
-    } else {
-      assert(qchar.isLowSurrogate());
-      ++q_pos;
-    }
-  }
-}
+QString AnnotationsModel::get_content() const { return current_content_; }
 
 int AnnotationsModel::code_point_idx_to_utf16_idx(int cp_idx) const {
-  assert(cp_idx >= 0);
-  int utf_idx = cp_idx;
-  auto it = surrogate_indices_in_unicode_string_.cbegin();
-  while (it != surrogate_indices_in_unicode_string_.cend() && *it < cp_idx) {
-    ++utf_idx;
-    ++it;
-  }
-  return utf_idx;
+  return labelbuddy::code_point_idx_to_utf16_idx(
+      surrogate_indices_in_unicode_string_, cp_idx);
 }
 
 int AnnotationsModel::utf16_idx_to_code_point_idx(int utf_idx) const {
-  assert(utf_idx >= 0);
-  int cp_idx = utf_idx;
-  auto it = surrogate_indices_in_qstring_.cbegin();
-  while (it != surrogate_indices_in_qstring_.cend() && *it < utf_idx) {
-    --cp_idx;
-    ++it;
-  }
-  assert(utf_idx >= 0);
-  return cp_idx;
+  return labelbuddy::utf16_idx_to_code_point_idx(surrogate_indices_in_qstring_,
+                                                 utf_idx);
 }
 
 QMap<int, LabelInfo> AnnotationsModel::get_labels_info() const {
-  auto query = get_query();
-  query.prepare("select id, color, name from sorted_label;");
-  query.exec();
   QMap<int, LabelInfo> result{};
-  while (query.next()) {
-    result[query.value(0).toInt()] =
-        LabelInfo{query.value(0).toInt(), query.value(1).toString(),
-                  query.value(2).toString()};
+  for (const auto& label : label_cache_->sorted_labels()) {
+    result[label.id] = LabelInfo{label.id, label.color, label.name};
   }
   return result;
 }
 
 QMap<int, AnnotationInfo> AnnotationsModel::get_annotations_info() const {
+  return current_annotations_;
+}
+
+void AnnotationsModel::reload_current_annotations() {
+  LoadedDocument doc{};
+  doc.doc_id = current_doc_id;
+  doc.surrogate_indices_in_unicode_string =
+      surrogate_indices_in_unicode_string_;
   auto query = get_query();
-  query.prepare("select rowid, label_id, start_char, end_char, extra_data from "
-                "annotation where doc_id = :doc order by rowid;");
-  query.bindValue(":doc", current_doc_id);
-  query.exec();
-  QMap<int, AnnotationInfo> result{};
-  while (query.next()) {
-    result[query.value(0).toInt()] =
-        AnnotationInfo{query.value(0).toInt(), query.value(1).toInt(),
-                       code_point_idx_to_utf16_idx(query.value(2).toInt()),
-                       code_point_idx_to_utf16_idx(query.value(3).toInt()),
-                       query.value(4).toString()};
+  load_annotations(query, doc);
+  current_annotations_ = doc.annotations;
+  count_current_labels();
+  update_cached_annotations();
+}
+
+void AnnotationsModel::count_current_labels() {
+  current_label_counts_.clear();
+  for (const auto& annotation : current_annotations_) {
+    ++current_label_counts_[annotation.label_id];
   }
-  return result;
 }
 
-int AnnotationsModel::add_annotation(int label_id, int start_char,
-                                     int end_char) {
+void AnnotationsModel::update_cached_annotations() {
+  if (!cache_.contains(current_doc_id)) {
+    return;
+  }
+  // the content and index tables are implicitly shared, so this is cheap
+  LoadedDocument cached{};
+  cache_.get(current_doc_id, cached);
+  cached.annotations = current_annotations_;
+  cache_.insert(cached);
+}
+
+void AnnotationsModel::invalidate_cache() {
+  invalidate_navigation_state();
+  cache_.clear();
+  reload_current_annotations();
+  if (loader_ == nullptr) {
+    return;
+  }
+  // documents being prefetched may have been read before the change
+  loader_->prefetch({});
+  if (target_doc_id_ != current_doc_id) {
+    visit_doc(target_doc_id_);
+  }
+  prefetch_neighbours();
+}
+
+void AnnotationsModel::begin_write() {
+  if (write_pending_) {
+    return;
+  }
+  auto query = get_query();
+  // fails if another transaction is open: the changes are then part of it
+  write_pending_ = traced_exec(query, "begin deferred transaction;");
+  if (write_pending_) {
+    write_database_ = database_name;
+    // committed first by whatever else needs a transaction
+    set_pending_writes(write_database_, [this]() { commit_pending_writes(); });
+    commit_timer_.start();
+  }
+}
+
+void AnnotationsModel::commit_pending_writes() {
+  if (!write_pending_) {
+    return;
+  }
+  commit_timer_.stop();
+  QSqlQuery query(QSqlDatabase::database(write_database_));
+  if (!traced_exec(query, "commit transaction;") &&
+      query.lastError().nativeErrorCode() == "5") {
+    // SQLITE_BUSY: another connection is reading the database
+    commit_timer_.start();
+    return;
+  }
+  // if it failed otherwise, the transaction has been ended by someone else
+  write_pending_ = false;
+  clear_pending_writes(write_database_);
+}
+
+int AnnotationsModel::insert_annotation(const AnnotationInfo& annotation) {
+  begin_write();
   auto query = get_query();
   query.prepare("insert into annotation (doc_id, label_id, start_char, "
-                "end_char) values (:doc, :label, :start, :end);");
+                "end_char, extra_data) values (:doc, :label, :start, :end, "
+                ":extra);");
   query.bindValue(":doc", current_doc_id);
-  query.bindValue(":label", label_id);
-  query.bindValue(":start", utf16_idx_to_code_point_idx(start_char));
-  query.bindValue(":end", utf16_idx_to_code_point_idx(end_char));
-  if (!query.exec()) {
+  query.bindValue(":label", annotation.label_id);
+  auto start = utf16_idx_to_code_point_idx(annotation.start_char);
+  auto end = utf16_idx_to_code_point_idx(annotation.end_char);
+  query.bindValue(":start", start);
+  query.bindValue(":end", end);
+  query.bindValue(":extra", annotation.extra_data == ""
+                                ? QVariant()
+                                : annotation.extra_data);
+  if (!traced_exec(query)) {
     // fails eg if annotation is a duplicate of one already in db
     return -1;
   }
   auto new_annotation_id = query.lastInsertId().toInt();
-  query.prepare("select count(*) from annotation where doc_id = :doc;");
-  query.bindValue(":doc", current_doc_id);
-  query.exec();
-  query.next();
-  if (query.value(0).toInt() == 1) {
+  current_annotations_[new_annotation_id] =
+      AnnotationInfo{new_annotation_id, annotation.label_id,
+                     annotation.start_char, annotation.end_char,
+                     annotation.extra_data};
+  update_cached_annotations();
+  auto n_with_label = ++current_label_counts_[annotation.label_id];
+  if (current_annotations_.size() == 1) {
+    navigation_state_valid_ = false;
     emit document_status_changed(DocumentStatus::Labelled);
-    emit document_gained_label(label_id, current_doc_id);
-  } else {
-    query.prepare("select count(*) from annotation where doc_id = :doc and "
-                  "label_id = :label;");
-    query.bindValue(":doc", current_doc_id);
-    query.bindValue(":label", label_id);
-    query.exec();
-    query.next();
-    if (query.value(0).toInt() == 1) {
-      emit document_gained_label(label_id, current_doc_id);
-    }
+  }
+  emit annotation_added(annotation.label_id, end - start);
+  if (n_with_label == 1) {
+    emit document_gained_label(annotation.label_id, current_doc_id);
   }
   return new_annotation_id;
 }
 
-int AnnotationsModel::delete_annotation(int annotation_id) {
+bool AnnotationsModel::remove_annotation(int annotation_id) {
+  auto annotation = current_annotations_.find(annotation_id);
+  if (annotation == current_annotations_.end()) {
+    return false;
+  }
+  auto label_id = annotation.value().label_id;
+  auto length = utf16_idx_to_code_point_idx(annotation.value().end_char) -
+                utf16_idx_to_code_point_idx(annotation.value().start_char);
+  begin_write();
   auto query = get_query();
-  query.prepare("select label_id from annotation where rowid = :id;");
-  query.bindValue(":id", annotation_id);
-  query.exec();
-  query.next();
-  auto label_id = query.value(0).toInt();
   query.prepare("delete from annotation where rowid = :id;");
   query.bindValue(":id", annotation_id);
-  query.exec();
-  auto n_deleted = query.numRowsAffected();
-  assert(n_deleted == 1);
+  traced_exec(query);
   // -1 if query is not active
-  if (n_deleted <= 0) {
-    return 0;
+  if (query.numRowsAffected() <= 0) {
+    return false;
   }
-  query.prepare("select count(*) from annotation where doc_id = :doc;");
-  query.bindValue(":doc", current_doc_id);
-  query.exec();
-  query.next();
-  if (query.value(0).toInt() == 0) {
+  current_annotations_.erase(annotation);
+  update_cached_annotations();
+  auto n_with_label = --current_label_counts_[label_id];
+  if (n_with_label <= 0) {
+    current_label_counts_.remove(label_id);
+  }
+  if (current_annotations_.isEmpty()) {
+    navigation_state_valid_ = false;
     emit document_status_changed(DocumentStatus::Unlabelled);
+  }
+  emit annotation_removed(label_id, length);
+  if (n_with_label <= 0) {
     emit document_lost_label(label_id, current_doc_id);
-  } else {
-    query.prepare("select count(*) from annotation where doc_id = :doc and "
-                  "label_id = :label;");
-    query.bindValue(":doc", current_doc_id);
-    query.bindValue(":label", label_id);
-    query.exec();
-    query.next();
-    if (query.value(0).toInt() == 0) {
-      emit document_lost_label(label_id, current_doc_id);
-    }
   }
-  return n_deleted;
+  return true;
 }
 
-bool AnnotationsModel::update_annotation_extra_data(int annotation_id,
-                                                    const QString& new_data) {
+bool AnnotationsModel::write_extra_data(int annotation_id,
+                                        const QString& new_data) {
+  begin_write();
   auto query = get_query();
   query.prepare("update annotation set extra_data = :data where rowid = :id;");
   query.bindValue(":data", new_data == "" ? QVariant() : new_data);
   query.bindValue(":id", annotation_id);
-  return query.exec();
+  if (!traced_exec(query)) {
+    return false;
+  }
+  auto annotation = current_annotations_.find(annotation_id);
+  if (annotation != current_annotations_.end()) {
+    annotation.value().extra_data = new_data;
+    update_cached_annotations();
+  }
+  return true;
+}
+
+int AnnotationsModel::add_annotation(int label_id, int start_char,
+                                     int end_char) {
+  AnnotationInfo annotation{-1, label_id, start_char, end_char, QString()};
+  annotation.id = insert_annotation(annotation);
+  if (annotation.id != -1) {
+    record_edit(AnnotationEdit{AnnotationEdit::Kind::Add, annotation,
+                               QString(), false});
+  }
+  return annotation.id;
+}
+
+int AnnotationsModel::delete_annotation(int annotation_id) {
+  auto annotation = current_annotations_.value(annotation_id);
+  auto deleted = remove_annotation(annotation_id);
+  assert(deleted);
+  if (!deleted) {
+    return 0;
+  }
+  record_edit(AnnotationEdit{AnnotationEdit::Kind::Delete, annotation,
+                             QString(), false});
+  return 1;
+}
+
+int AnnotationsModel::relabel_annotation(int annotation_id, int label_id) {
+  auto annotation = current_annotations_.find(annotation_id);
+  if (annotation == current_annotations_.end()) {
+    return -1;
+  }
+  auto start_char = annotation.value().start_char;
+  auto end_char = annotation.value().end_char;
+  auto new_id = add_annotation(label_id, start_char, end_char);
+  if (new_id == -1) {
+    return -1;
+  }
+  if (delete_annotation(annotation_id) == 1) {
+    undo_log_.last().continues_previous = true;
+  }
+  return new_id;
+}
+
+bool AnnotationsModel::update_annotation_extra_data(int annotation_id,
+                                                    const QString& new_data) {
+  auto annotation = current_annotations_.find(annotation_id);
+  auto in_current_doc = annotation != current_annotations_.end();
+  auto previous_data =
+      in_current_doc ? annotation.value().extra_data : QString();
+  if (!write_extra_data(annotation_id, new_data)) {
+    return false;
+  }
+  if (in_current_doc && previous_data != new_data) {
+    record_edit(AnnotationEdit{AnnotationEdit::Kind::SetExtraData,
+                               current_annotations_[annotation_id],
+                               previous_data, false});
+  }
+  return true;
+}
+
+void AnnotationsModel::record_edit(const AnnotationEdit& edit) {
+  undo_log_ << edit;
+  if (undo_log_.size() > max_undo_log_size_) {
+    undo_log_.removeFirst();
+    // not the second half of a step whose first half was dropped
+    undo_log_.first().continues_previous = false;
+  }
+  redo_log_.clear();
 }
 
+bool AnnotationsModel::apply_edit(AnnotationEdit& edit, bool reverse) {
+  if (edit.kind == AnnotationEdit::Kind::SetExtraData) {
+    return write_extra_data(edit.annotation.id,
+                            reverse ? edit.previous_extra_data
+                                    : edit.annotation.extra_data);
+  }
+  auto adding = (edit.kind == AnnotationEdit::Kind::Add) != reverse;
+  if (!adding) {
+    return remove_annotation(edit.annotation.id);
+  }
+  auto new_id = insert_annotation(edit.annotation);
+  if (new_id == -1) {
+    return false;
+  }
+  // later edits of the same annotation refer to its new rowid
+  auto old_id = edit.annotation.id;
+  for (auto* log : {&undo_log_, &redo_log_}) {
+    for (auto& logged : *log) {
+      if (logged.annotation.id == old_id) {
+        logged.annotation.id = new_id;
+      }
+    }
+  }
+  edit.annotation.id = new_id;
+  return true;
+}
+
+bool AnnotationsModel::replay_edit(QVector<AnnotationEdit>& from,
+                                   QVector<AnnotationEdit>& to, bool reverse) {
+  if (from.isEmpty()) {
+    return false;
+  }
+  // the edits of a step are undone from the last, and redone from the first
+  bool step_continues{true};
+  while (step_continues) {
+    auto edit = from.takeLast();
+    if (!apply_edit(edit, reverse)) {
+      return false;
+    }
+    to << edit;
+    step_continues =
+        !from.isEmpty() &&
+        (reverse ? edit.continues_previous : from.last().continues_previous);
+  }
+  return true;
+}
+
+bool AnnotationsModel::undo() {
+  return replay_edit(undo_log_, redo_log_, true);
+}
+
+bool AnnotationsModel::redo() {
+  return replay_edit(redo_log_, undo_log_, false);
+}
+
+bool AnnotationsModel::can_undo() const { return !undo_log_.isEmpty(); }
+
+bool AnnotationsModel::can_redo() const { return !redo_log_.isEmpty(); }
+
 void AnnotationsModel::check_current_doc() {
+  invalidate_navigation_state();
   auto query = get_query();
   query.prepare("select count(*) from document where id = :doc;");
   query.bindValue(":doc", current_doc_id);
-  query.exec();
+  traced_exec(query);
   query.next();
   if (query.value(0) != 1) {
+    cache_.clear();
     visit_first_doc();
+    return;
   }
+  // cached neighbours may have been deleted
+  invalidate_cache();
 }
 
 void AnnotationsModel::visit_first_doc() {
@@ -244,11 +452,13 @@ void AnnotationsModel::visit_prev() {
 }
 
 void AnnotationsModel::visit_next_labelled() {
-  visit_query_result("select min(id) from labelled_document where id > :doc;");
+  visit_query_result("select min(doc_id) from document_annotation_count "
+                     "where doc_id > :doc;");
 }
 
 void AnnotationsModel::visit_prev_labelled() {
-  visit_query_result("select max(id) from labelled_document where id < :doc;");
+  visit_query_result("select max(doc_id) from document_annotation_count "
+                     "where doc_id < :doc;");
 }
 
 void AnnotationsModel::visit_next_unlabelled() {
@@ -264,8 +474,10 @@ void AnnotationsModel::visit_prev_unlabelled() {
 bool AnnotationsModel::visit_query_result(const QString& query_text) {
   auto query = get_query();
   query.prepare(query_text);
-  query.bindValue(":doc", current_doc_id);
-  query.exec();
+  // relative to the document being loaded, so that successive "next" presses
+  // are not lost while it is loading
+  query.bindValue(":doc", target_doc_id_);
+  traced_exec(query);
   query.next();
   if (query.isNull(0)) {
     return false;
@@ -275,106 +487,183 @@ bool AnnotationsModel::visit_query_result(const QString& query_text) {
 }
 
 void AnnotationsModel::visit_doc(int doc_id) {
-  current_doc_id = doc_id;
-  if (doc_id == -1) {
-    fill_index_converters("");
-  } else {
-    auto query = get_query();
-    query.prepare("update app_state set last_visited_doc = :doc;");
-    query.bindValue(":doc", doc_id);
-    query.exec();
-    fill_index_converters(get_content());
+  TraceScope trace("AnnotationsModel::visit_doc");
+  // the loading thread's connection only sees committed annotations
+  commit_pending_writes();
+  target_doc_id_ = doc_id;
+  // any pending request is superseded
+  ++last_request_id_;
+  if (loader_ != nullptr && doc_id != -1) {
+    LoadedDocument doc{};
+    if (cache_.get(doc_id, doc)) {
+      show_document(doc);
+    } else {
+      loader_->request(last_request_id_, doc_id);
+    }
+    return;
   }
-  emit document_changed();
+  auto query = get_query();
+  LoadedDocument doc{};
+  load_document(query, doc_id, doc);
+  show_document(doc);
 }
 
-int AnnotationsModel::get_query_result(const QString& query_text) const {
-  auto query = get_query();
-  query.prepare(query_text);
-  query.exec();
-  query.next();
-  if (query.isNull(0)) {
-    return -1;
+void AnnotationsModel::show_loaded_document(int request_id) {
+  if (request_id != last_request_id_ || loader_ == nullptr) {
+    return;
+  }
+  LoadedDocument doc{};
+  if (!loader_->take_result(request_id, doc)) {
+    // loading thread could not read the database, eg it was locked
+    auto query = get_query();
+    load_document(query, target_doc_id_, doc);
   }
-  return query.value(0).toInt();
+  show_document(doc);
 }
 
-bool AnnotationsModel::is_positioned_on_valid_doc() const {
-  return current_doc_id != -1;
+void AnnotationsModel::store_prefetched_documents() {
+  if (loader_ == nullptr) {
+    return;
+  }
+  for (const auto& doc : loader_->take_prefetched()) {
+    if (!cache_.contains(doc.doc_id)) {
+      cache_.insert(doc);
+    }
+  }
 }
 
-int AnnotationsModel::current_doc_position() const {
+void AnnotationsModel::prefetch_neighbours() {
+  if (loader_ == nullptr || current_doc_id == -1) {
+    return;
+  }
+  QList<int> doc_ids{};
   auto query = get_query();
-  query.prepare("select count(*) from document where id < :docid;");
-  query.bindValue(":docid", current_doc_id);
-  query.exec();
-  query.next();
-  return query.value(0).toInt();
+  auto add_results = [this, &query, &doc_ids](const QString& query_text) {
+    query.prepare(query_text);
+    query.bindValue(":doc", current_doc_id);
+    if (query_text.contains(":n")) {
+      query.bindValue(":n", prefetch_count_);
+    }
+    traced_exec(query);
+    while (query.next()) {
+      auto doc_id = query.value(0).toInt();
+      if (!query.isNull(0) && !doc_ids.contains(doc_id) &&
+          !cache_.contains(doc_id)) {
+        doc_ids << doc_id;
+      }
+    }
+  };
+  add_results("select id from document where id > :doc order by id limit :n;");
+  add_results("select id from document where id < :doc "
+              "order by id desc limit :n;");
+  add_results("select min(id) from unlabelled_document where id > :doc;");
+  loader_->prefetch(doc_ids);
 }
 
-int AnnotationsModel::last_doc_id() const {
-  return get_query_result("select max(id) from document;");
+void AnnotationsModel::show_document(LoadedDocument& doc) {
+  if (loader_ != nullptr && doc.doc_id != -1) {
+    cache_.insert(doc);
+  }
+  if (doc.doc_id != current_doc_id) {
+    undo_log_.clear();
+    redo_log_.clear();
+  }
+  current_doc_id = doc.doc_id;
+  current_content_ = std::move(doc.content);
+  current_title_ = std::move(doc.title);
+  surrogate_indices_in_qstring_ = std::move(doc.surrogate_indices_in_qstring);
+  surrogate_indices_in_unicode_string_ =
+      std::move(doc.surrogate_indices_in_unicode_string);
+  current_annotations_ = std::move(doc.annotations);
+  count_current_labels();
+  navigation_state_valid_ = false;
+  if (current_doc_id != -1) {
+    auto query = get_query();
+    query.prepare("update app_state set last_visited_doc = :doc;");
+    query.bindValue(":doc", current_doc_id);
+    traced_exec(query);
+  }
+  emit document_changed();
+  prefetch_neighbours();
 }
-int AnnotationsModel::first_doc_id() const {
 
-  return get_query_result("select min(id) from document;");
-}
-int AnnotationsModel::last_unlabelled_doc_id() const {
-  auto res = get_query_result("select max(id) from unlabelled_document;");
-  return res;
+bool AnnotationsModel::is_positioned_on_valid_doc() const {
+  return current_doc_id != -1;
 }
-int AnnotationsModel::first_unlabelled_doc_id() const {
 
-  return get_query_result("select min(id) from unlabelled_document;");
+NavigationState AnnotationsModel::navigation_state() const {
+  if (navigation_state_valid_) {
+    return navigation_state_;
+  }
+  auto query = get_query();
+  NavigationState state{};
+  if (!doc_ids_.ensure_loaded(query)) {
+    return state;
+  }
+  // `exists` stops at the first matching row, using the primary keys
+  query.prepare(
+      "with current(id) as (select :doc) select "
+      "exists (select 1 from document where id > (select id from current)), "
+      "exists (select 1 from document where id < (select id from current)), "
+      "exists (select 1 from document_annotation_count "
+      "where doc_id > (select id from current)), "
+      "exists (select 1 from document_annotation_count "
+      "where doc_id < (select id from current)), "
+      "exists (select 1 from unlabelled_document "
+      "where id > (select id from current)), "
+      "exists (select 1 from unlabelled_document "
+      "where id < (select id from current));");
+  query.bindValue(":doc", current_doc_id);
+  if (!traced_exec(query) || !query.next()) {
+    return state;
+  }
+  state.doc_position = doc_ids_.position(current_doc_id);
+  state.total_n_docs = doc_ids_.size();
+  state.has_next = query.value(0).toBool();
+  state.has_prev = query.value(1).toBool();
+  state.has_next_labelled = query.value(2).toBool();
+  state.has_prev_labelled = query.value(3).toBool();
+  state.has_next_unlabelled = query.value(4).toBool();
+  state.has_prev_unlabelled = query.value(5).toBool();
+  navigation_state_ = state;
+  navigation_state_valid_ = true;
+  return state;
 }
-int AnnotationsModel::last_labelled_doc_id() const {
 
-  return get_query_result("select max(doc_id) from annotation;");
+void AnnotationsModel::invalidate_navigation_state() {
+  doc_ids_.mark_stale();
+  navigation_state_valid_ = false;
 }
-int AnnotationsModel::first_labelled_doc_id() const {
-  return get_query_result("select min(doc_id) from annotation;");
+
+int AnnotationsModel::current_doc_position() const {
+  return navigation_state().doc_position;
 }
 
 int AnnotationsModel::total_n_docs() const {
-  return get_query_result("select count(*) from document;");
+  return navigation_state().total_n_docs;
 }
 
-bool AnnotationsModel::has_next() const {
-  return current_doc_id < last_doc_id();
-}
+bool AnnotationsModel::has_next() const { return navigation_state().has_next; }
 
-bool AnnotationsModel::has_prev() const {
-  auto first = first_doc_id();
-  return (first != -1) && (current_doc_id > first);
-}
+bool AnnotationsModel::has_prev() const { return navigation_state().has_prev; }
 
 bool AnnotationsModel::has_next_labelled() const {
-  return current_doc_id < last_labelled_doc_id();
+  return navigation_state().has_next_labelled;
 }
 
 bool AnnotationsModel::has_prev_labelled() const {
-
-  auto first = first_labelled_doc_id();
-  return (first != -1) && (current_doc_id > first);
+  return navigation_state().has_prev_labelled;
 }
 
 bool AnnotationsModel::has_next_unlabelled() const {
-  return current_doc_id < last_unlabelled_doc_id();
+  return navigation_state().has_next_unlabelled;
 }
 
 bool AnnotationsModel::has_prev_unlabelled() const {
-  auto first = first_unlabelled_doc_id();
-  return (first != -1) && (current_doc_id > first);
+  return navigation_state().has_prev_unlabelled;
 }
 
 int AnnotationsModel::shortcut_to_id(const QString& shortcut) const {
-  auto query = get_query();
-  query.prepare("select id from label where shortcut_key = :key;");
-  query.bindValue(":key", shortcut);
-  query.exec();
-  if (!query.next()) {
-    return -1;
-  }
-  return query.value(0).toInt();
+  return label_cache_->shortcut_to_id(shortcut);
 }
 } // namespace labelbuddy
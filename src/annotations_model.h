@@ -1,12 +1,19 @@
 #ifndef LABELBUDDY_ANNOTATIONS_MODEL_H
 #define LABELBUDDY_ANNOTATIONS_MODEL_H
 
+#include <memory>
+
 #include <QList>
 #include <QMap>
 #include <QObject>
 #include <QSqlQuery>
 #include <QString>
+#include <QTimer>
+#include <QVector>
 
+#include "document_id_index.h"
+#include "document_loader.h"
+#include "label_cache.h"
 #include "user_roles.h"
 
 /// \file
@@ -20,12 +27,17 @@ struct LabelInfo {
   QString name;
 };
 
-struct AnnotationInfo {
-  int id;
-  int label_id;
-  int start_char;
-  int end_char;
-  QString extra_data;
+/// Position of the current document and which navigation buttons apply
+struct NavigationState {
+  /// number of documents before the current one (sorted by id)
+  int doc_position{};
+  int total_n_docs{};
+  bool has_next{};
+  bool has_prev{};
+  bool has_next_labelled{};
+  bool has_prev_labelled{};
+  bool has_next_unlabelled{};
+  bool has_prev_unlabelled{};
 };
 
 /// Model providing information to the Annotator
@@ -40,6 +52,9 @@ class AnnotationsModel : public QObject {
 public:
   AnnotationsModel(QObject* parent = nullptr);
 
+  /// Commits the pending annotation changes
+  ~AnnotationsModel() override;
+
   /// Get the `content` (text) of the current document.
 
   /// Returns the empty string
@@ -56,10 +71,11 @@ public:
   /// first annotation, emits `document_status_changed` (it changed from
   /// unlabelled to labelled)
   /// If it is its first annotation with this label emit
-  /// `document_gained_label`.
+  /// `document_gained_label`. These are decided from the current doc's
+  /// annotations kept in memory, without counting them in the database.
   int add_annotation(int label_id, int start_char, int end_char);
 
-  /// Delete annotation provided its `rowid` in the database
+  /// Delete one of the current doc's annotations provided its `rowid`
 
   /// Returns the number of deleted annotations (0 or 1)
   ///
@@ -69,20 +85,71 @@ public:
   /// `document_lost_label`.
   int delete_annotation(int annotation_id);
 
+  /// Give another label to one of the current doc's annotations.
+
+  /// The annotation is replaced by one with the same position and
+  /// `label_id`, whose `rowid` is returned (-1 if it cannot be inserted, the
+  /// annotation is then unchanged). The signals of `add_annotation` and
+  /// `delete_annotation` are emitted, and `undo` reverts both at once.
+  int relabel_annotation(int annotation_id, int label_id);
+
   bool update_annotation_extra_data(int annotation_id, const QString& new_data);
 
+  /// Undo the latest change made through the model to the current doc's
+  /// annotations.
+
+  /// Additions, deletions and changes of extra data can be undone. The
+  /// history only covers the current document: it is cleared when another
+  /// document is visited. The same signals as for `add_annotation` or
+  /// `delete_annotation` are emitted, and the annotations must then be read
+  /// again with `get_annotations_info` -- an annotation restored by undoing
+  /// its deletion gets a new `rowid`. Returns `false` if there was nothing to
+  /// undo or the change could not be reverted (eg the annotations were
+  /// modified by other means).
+  bool undo();
+
+  /// Redo the latest change reverted by `undo`.
+
+  /// Changes that have been undone are forgotten when a new change is made.
+  bool redo();
+
+  bool can_undo() const;
+  bool can_redo() const;
+
   /// Info for all labels in the database
   QMap<int, LabelInfo> get_labels_info() const;
 
   /// Info for annotations on the current document.
+
+  /// They are read from the database when the document is loaded and when
+  /// annotations are added, deleted or modified through the model. Call
+  /// `invalidate_cache` if they are modified by other means.
   QMap<int, AnnotationInfo> get_annotations_info() const;
 
   /// false when db is empty
   bool is_positioned_on_valid_doc() const;
 
+  /// Position and neighbours of the current document.
+
+  /// Computed with a single query the first time it is needed, then cached
+  /// until the current document changes, its status (labelled or unlabelled)
+  /// changes through the model, or `invalidate_navigation_state` is called.
+  /// The position and number of documents come from an in-memory index of
+  /// document ids, so they do not require counting documents.
+  NavigationState navigation_state() const;
+
+  /// Compute the navigation state again next time, eg because documents have
+  /// been imported or deleted. Also done by `invalidate_cache` and
+  /// `check_current_doc`.
+
+  /// The index of document ids is then updated: only new documents are read,
+  /// unless some have been deleted.
+  void invalidate_navigation_state();
+
   /// Current doc's position in the list of all docs sorted by id
 
-  /// Note this is not the same as the id
+  /// Note this is not the same as the id. This and the functions below read
+  /// the `navigation_state`.
   int current_doc_position() const;
 
   /// number of docs in the database
@@ -105,6 +172,31 @@ public:
   /// convert index in unicode sequence to QString (utf-16) index
   int code_point_idx_to_utf16_idx(int cp_idx) const;
 
+  /// Use a label cache shared with other components.
+
+  /// By default the model uses its own cache. The cache is not owned and must
+  /// outlive the model.
+  void set_label_cache(LabelCache* cache);
+
+  /// Load documents in a background thread.
+
+  /// When enabled, `visit_doc` (and `visit_next` etc) return immediately and
+  /// `document_changed` is emitted once the document has been fetched and its
+  /// index tables prepared; until then the model stays on the previous
+  /// document. Navigation is relative to the latest requested document, and
+  /// only the latest request is loaded: earlier ones still pending are
+  /// cancelled. Disabled by default, and for in-memory databases which
+  /// cannot be opened by a second connection.
+  ///
+  /// Recently visited documents and the neighbours of the current one (the
+  /// `prefetch_count_` previous and next documents, and the next unlabelled
+  /// document) are kept in a cache, the neighbours being loaded in the
+  /// background after each visit. Visiting a cached document is immediate.
+  void set_asynchronous_loading(bool asynchronous);
+
+  /// Whether a document is in the cache (see `set_asynchronous_loading`)
+  bool is_cached(int doc_id) const;
+
 public slots:
 
   void visit_next();
@@ -123,6 +215,24 @@ public slots:
 
   void set_database(const QString& new_database_name);
 
+  /// Drop cached documents and read the current document's annotations again.
+
+  /// Needed when annotations or documents are modified other than through
+  /// this model, eg by importing documents or deleting labels.
+  void invalidate_cache();
+
+  /// Write the pending annotation changes to the database file.
+
+  /// Changes made through the model are grouped in a transaction, so that
+  /// annotating does not wait for the disk after each key press. It is
+  /// committed `commit_delay_ms_` after the first change, when another
+  /// document or database is visited, or when this is called. It is also
+  /// registered with `set_pending_writes`, so that other code that needs a
+  /// transaction on the same connection, or other connections that write,
+  /// commit it first with `flush_pending_writes`. If the program crashes, the
+  /// changes of (at most) the last `commit_delay_ms_` are lost.
+  void commit_pending_writes();
+
 signals:
 
   /// current document changed, ie we are now visiting a different doc
@@ -134,28 +244,116 @@ signals:
   void document_gained_label(int label_id, int doc_id);
   void document_lost_label(int label_id, int doc_id);
 
+  /// An annotation of the current document was inserted or deleted;
+  /// `n_code_points` is its length
+  void annotation_added(int label_id, int n_code_points);
+  void annotation_removed(int label_id, int n_code_points);
+
+  /// emitted from the loading thread; connected to `show_loaded_document`
+  void document_loaded(int request_id);
+
+  /// emitted from the loading thread; connected to `store_prefetched_documents`
+  void documents_prefetched();
+
+private slots:
+
+  void show_loaded_document(int request_id);
+  void store_prefetched_documents();
+
 private:
   int current_doc_id = -1;
+  /// latest document passed to `visit_doc`, not necessarily loaded yet
+  int target_doc_id_ = -1;
+  QString current_content_{};
+  QString current_title_{};
+  QMap<int, AnnotationInfo> current_annotations_{};
   QString database_name;
+  LabelCache own_label_cache_{};
+  LabelCache* label_cache_ = &own_label_cache_;
 
-  QList<int> surrogate_indices_in_unicode_string_{};
-  QList<int> surrogate_indices_in_qstring_{};
+  QVector<int> surrogate_indices_in_unicode_string_{};
+  QVector<int> surrogate_indices_in_qstring_{};
 
   QSqlQuery get_query() const;
 
   /// query must return the id of a document to visit
   /// if there are no results, returns false
   bool visit_query_result(const QString& query_text);
-  int get_query_result(const QString& query_text) const;
 
-  void fill_index_converters(const QString& text);
+  /// make `doc` the current document and emit `document_changed`
+  void show_document(LoadedDocument& doc);
+
+  /// (re)create or remove the loading thread for the current database
+  void reset_loader();
+
+  /// ask the loading thread for the current doc's neighbours not in the cache
+  void prefetch_neighbours();
+
+  /// read the current doc's annotations again and update its cached copy
+  void reload_current_annotations();
+
+  /// copy the current doc's annotations to its cached copy, if any
+  void update_cached_annotations();
+
+  /// A change to the current doc's annotations, for `undo` and `redo`
+  struct AnnotationEdit {
+    enum class Kind { Add, Delete, SetExtraData };
+    Kind kind;
+    /// the annotation added or deleted, or with its new extra data
+    AnnotationInfo annotation;
+    /// only for `SetExtraData`
+    QString previous_extra_data;
+    /// undone and redone together with the edit before it in the log
+    bool continues_previous;
+  };
+
+  /// insert an annotation of the current doc, returns its rowid or -1
+  int insert_annotation(const AnnotationInfo& annotation);
+
+  /// delete an annotation of the current doc
+  bool remove_annotation(int annotation_id);
+
+  bool write_extra_data(int annotation_id, const QString& new_data);
+
+  /// perform `edit`, or revert it if `reverse`; the rowid is updated if the
+  /// annotation is inserted again
+  bool apply_edit(AnnotationEdit& edit, bool reverse);
+
+  /// move `edit` from `from` to `to` after applying it
+  bool replay_edit(QVector<AnnotationEdit>& from, QVector<AnnotationEdit>& to,
+                   bool reverse);
+
+  void record_edit(const AnnotationEdit& edit);
+
+  /// start the transaction holding changes until `commit_pending_writes`
+  void begin_write();
+
+  /// recompute `current_label_counts_` from `current_annotations_`
+  void count_current_labels();
+
+  /// number of annotations of the current doc for each label
+  QMap<int, int> current_label_counts_{};
+  QVector<AnnotationEdit> undo_log_{};
+  QVector<AnnotationEdit> redo_log_{};
+  bool write_pending_{};
+  /// connection of the pending transaction, `database_name` when it began
+  QString write_database_{};
+  QTimer commit_timer_{};
+
+  static const int commit_delay_ms_{200};
+  static const int max_undo_log_size_{500};
+
+  mutable DocumentIdIndex doc_ids_{};
+  mutable NavigationState navigation_state_{};
+  mutable bool navigation_state_valid_{};
+
+  static const int prefetch_count_{2};
 
-  int last_doc_id() const;
-  int first_doc_id() const;
-  int last_labelled_doc_id() const;
-  int first_labelled_doc_id() const;
-  int last_unlabelled_doc_id() const;
-  int first_unlabelled_doc_id() const;
+  bool asynchronous_loading_{};
+  int last_request_id_{};
+  /// the current doc, its neighbours and one recently visited doc
+  DocumentCache cache_{2 * prefetch_count_ + 3};
+  std::unique_ptr<DocumentLoadingThread> loader_{nullptr};
 };
 } // namespace labelbuddy
 
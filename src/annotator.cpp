@@ -1,13 +1,18 @@
+#include <algorithm>
 #include <cassert>
+#include <iterator>
 
 #include <QColor>
 #include <QElapsedTimer>
 #include <QFont>
 #include <QFontDatabase>
+#include <QFrame>
+#include <QHBoxLayout>
 #include <QIcon>
 #include <QItemSelectionModel>
 #include <QLabel>
 #include <QPushButton>
+#include <QScrollBar>
 #include <QSettings>
 #include <QSplitter>
 #include <QSqlQueryModel>
@@ -17,6 +22,7 @@
 #include "annotator.h"
 #include "label_list.h"
 #include "searchable_text.h"
+#include "tracing.h"
 #include "user_roles.h"
 #include "utils.h"
 
@@ -29,10 +35,23 @@ LabelChoices::LabelChoices(QWidget* parent) : QWidget(parent) {
   layout->addWidget(instruction_label);
   instruction_label->setWordWrap(true);
   this->setStyleSheet("QListView::item {background: transparent;}");
+  // in its own frame so that `extra_data_edit` is the direct child line edit
+  auto filter_frame = new QFrame();
+  layout->addWidget(filter_frame);
+  auto filter_layout = new QHBoxLayout();
+  filter_frame->setLayout(filter_layout);
+  filter_layout->setContentsMargins(0, 0, 0, 0);
+  filter_edit = new QLineEdit();
+  filter_layout->addWidget(filter_edit);
+  filter_edit->setPlaceholderText("Filter labels");
+  filter_edit->setClearButtonEnabled(true);
+  filter_model = new LabelFilterModel(this);
   labels_view = new NoDeselectAllView();
   layout->addWidget(labels_view);
   // labels_view->setSpacing(3);
   labels_view->setFocusPolicy(Qt::NoFocus);
+  // the delegate is asked for the size of one item instead of every label
+  labels_view->setUniformItemSizes(true);
   label_delegate_.reset(new LabelDelegate);
   labels_view->setItemDelegate(label_delegate_.get());
 
@@ -52,12 +71,17 @@ LabelChoices::LabelChoices(QWidget* parent) : QWidget(parent) {
                    &LabelChoices::extra_data_edited);
   QObject::connect(extra_data_edit, &QLineEdit::returnPressed, this,
                    &LabelChoices::extra_data_edit_finished);
+  QObject::connect(filter_edit, &QLineEdit::textChanged, filter_model,
+                   &LabelFilterModel::set_filter);
+  QObject::connect(filter_edit, &QLineEdit::returnPressed, this,
+                   &LabelChoices::select_first_match);
 }
 
 void LabelChoices::setModel(LabelListModel* new_model) {
   assert(new_model != nullptr);
   label_list_model = new_model;
-  labels_view->setModel(new_model);
+  filter_model->setSourceModel(new_model);
+  labels_view->setModel(filter_model);
   QObject::connect(labels_view->selectionModel(),
                    &QItemSelectionModel::selectionChanged, this,
                    &LabelChoices::on_selection_change);
@@ -66,6 +90,14 @@ void LabelChoices::setModel(LabelListModel* new_model) {
 void LabelChoices::on_selection_change() { emit selectionChanged(); }
 void LabelChoices::on_delete_button_click() { emit delete_button_clicked(); }
 
+void LabelChoices::select_first_match() {
+  if (filter_model->filter() == "" || filter_model->rowCount() == 0 ||
+      !labels_view->isEnabled()) {
+    return;
+  }
+  labels_view->setCurrentIndex(filter_model->index(0, 0));
+}
+
 QModelIndexList LabelChoices::selectedIndexes() const {
   return labels_view->selectionModel()->selectedIndexes();
 }
@@ -81,7 +113,7 @@ int LabelChoices::selected_label_id() const {
   if (selected == selected_indexes.constEnd()) {
     return -1;
   }
-  int label_id = label_list_model->data(*selected, Roles::RowIdRole).toInt();
+  int label_id = filter_model->data(*selected, Roles::RowIdRole).toInt();
   return label_id;
 }
 
@@ -97,7 +129,11 @@ void LabelChoices::set_selected_label_id(int label_id) {
   if (!model_index.isValid()) {
     return;
   }
-  labels_view->setCurrentIndex(model_index);
+  if (!filter_model->mapFromSource(model_index).isValid()) {
+    // the label is hidden by the filter
+    filter_edit->clear();
+  }
+  labels_view->setCurrentIndex(filter_model->mapFromSource(model_index));
 }
 
 void LabelChoices::set_extra_data(const QString& new_data) {
@@ -122,6 +158,27 @@ bool LabelChoices::is_label_choice_enabled() const {
   return labels_view->isEnabled();
 }
 
+namespace {
+
+/// Characters painted above and below the viewport, at least
+const int min_painted_margin{5000};
+
+/// The first of non-overlapping regions indexed by start that ends after `pos`
+
+/// Only the last region starting at or before `pos` can contain it; the
+/// following ones start after it.
+template <typename T>
+typename std::map<int, T>::const_iterator
+first_region_ending_after(const std::map<int, T>& regions, int pos) {
+  auto r_it = regions.upper_bound(pos);
+  if (r_it != regions.cbegin() && std::prev(r_it)->second.end_char > pos) {
+    --r_it;
+  }
+  return r_it;
+}
+
+} // namespace
+
 bool operator<(const AnnotationIndex& lhs, const AnnotationIndex& rhs) {
   if (lhs.start_char < rhs.start_char) {
     return true;
@@ -152,6 +209,136 @@ bool operator>=(const AnnotationIndex& lhs, const AnnotationIndex& rhs) {
   return rhs <= lhs;
 }
 
+void AnnotationStore::clear() {
+  ids_.clear();
+  label_ids_.clear();
+  start_chars_.clear();
+  end_chars_.clear();
+  extra_data_.clear();
+  positions_.clear();
+}
+
+void AnnotationStore::assign(const QMap<int, AnnotationInfo>& annotations) {
+  clear();
+  QVector<AnnotationIndex> sorted{};
+  sorted.reserve(annotations.size());
+  for (const auto& annotation : annotations) {
+    sorted << AnnotationIndex{annotation.start_char, annotation.id};
+  }
+  std::sort(sorted.begin(), sorted.end());
+  ids_.reserve(sorted.size());
+  label_ids_.reserve(sorted.size());
+  start_chars_.reserve(sorted.size());
+  end_chars_.reserve(sorted.size());
+  extra_data_.reserve(sorted.size());
+  positions_.reserve(sorted.size());
+  for (const auto& index : sorted) {
+    const auto& annotation = *annotations.constFind(index.id);
+    positions_.insert(annotation.id, ids_.size());
+    ids_ << annotation.id;
+    label_ids_ << annotation.label_id;
+    start_chars_ << annotation.start_char;
+    end_chars_ << annotation.end_char;
+    extra_data_ << annotation.extra_data;
+  }
+}
+
+void AnnotationStore::insert(const AnnotationSpan& annotation) {
+  assert(!contains(annotation.id));
+  auto position = lower_bound({annotation.start_char, annotation.id});
+  ids_.insert(position, annotation.id);
+  label_ids_.insert(position, annotation.label_id);
+  start_chars_.insert(position, annotation.start_char);
+  end_chars_.insert(position, annotation.end_char);
+  extra_data_.insert(position, annotation.extra_data);
+  update_positions(position);
+}
+
+void AnnotationStore::remove(int annotation_id) {
+  auto position = this->position(annotation_id);
+  if (position == -1) {
+    return;
+  }
+  ids_.remove(position);
+  label_ids_.remove(position);
+  start_chars_.remove(position);
+  end_chars_.remove(position);
+  extra_data_.remove(position);
+  positions_.remove(annotation_id);
+  update_positions(position);
+}
+
+void AnnotationStore::set_extra_data(int annotation_id,
+                                     const QString& extra_data) {
+  auto position = this->position(annotation_id);
+  if (position != -1) {
+    extra_data_[position] = extra_data;
+  }
+}
+
+int AnnotationStore::size() const { return ids_.size(); }
+
+bool AnnotationStore::contains(int annotation_id) const {
+  return positions_.contains(annotation_id);
+}
+
+AnnotationSpan AnnotationStore::get(int annotation_id) const {
+  auto position = this->position(annotation_id);
+  if (position == -1) {
+    assert(false);
+    return AnnotationSpan{-1, -1, 0, 0, QString()};
+  }
+  return AnnotationSpan{ids_[position], label_ids_[position],
+                        start_chars_[position], end_chars_[position],
+                        extra_data_[position]};
+}
+
+int AnnotationStore::position(int annotation_id) const {
+  return positions_.value(annotation_id, -1);
+}
+
+int AnnotationStore::lower_bound(AnnotationIndex index) const {
+  int begin{};
+  int end = size();
+  while (begin != end) {
+    auto middle = begin + (end - begin) / 2;
+    if (index_at(middle) < index) {
+      begin = middle + 1;
+    } else {
+      end = middle;
+    }
+  }
+  return begin;
+}
+
+int AnnotationStore::upper_bound(AnnotationIndex index) const {
+  int begin{};
+  int end = size();
+  while (begin != end) {
+    auto middle = begin + (end - begin) / 2;
+    if (index < index_at(middle)) {
+      end = middle;
+    } else {
+      begin = middle + 1;
+    }
+  }
+  return begin;
+}
+
+AnnotationIndex AnnotationStore::index_at(int position) const {
+  return AnnotationIndex{start_chars_[position], ids_[position]};
+}
+
+int AnnotationStore::end_char_at(int position) const {
+  return end_chars_[position];
+}
+
+void AnnotationStore::update_positions(int first_position) {
+  for (auto position = first_position; position != ids_.size(); ++position) {
+    positions_[ids_[position]] = position;
+  }
+}
+
 Annotator::Annotator(QWidget* parent) : QSplitter(parent) {
   label_choices = new LabelChoices();
   addWidget(label_choices);
@@ -192,7 +379,7 @@ Annotator::Annotator(QWidget* parent) : QSplitter(parent) {
   QObject::connect(label_choices, &LabelChoices::extra_data_edit_finished, this,
                    &Annotator::set_default_focus);
   QObject::connect(this, &Annotator::active_annotation_changed, this,
-                   &Annotator::paint_annotations);
+                   &Annotator::repaint_active_annotation);
   QObject::connect(this, &Annotator::active_annotation_changed, this,
                    &Annotator::update_label_choices_button_states);
   QObject::connect(this, &Annotator::active_annotation_changed, this,
@@ -202,6 +389,13 @@ Annotator::Annotator(QWidget* parent) : QSplitter(parent) {
   QObject::connect(text->get_text_edit(),
                    &QPlainTextEdit::cursorPositionChanged, this,
                    &Annotator::activate_cluster_at_cursor_pos);
+  QObject::connect(text, &SearchableText::matches_changed, this,
+                   &Annotator::show_painted_annotations);
+  QObject::connect(text, &SearchableText::window_changed, this,
+                   &Annotator::refresh_loaded_window);
+  QObject::connect(text->get_text_edit()->verticalScrollBar(),
+                   &QScrollBar::valueChanged, this,
+                   &Annotator::update_painted_region);
 
   setFocusProxy(text);
 }
@@ -217,24 +411,21 @@ StatusBarInfo Annotator::current_status_info() const {
   }
   StatusBarInfo status_info{};
   if (active_annotation != -1) {
-    bool is_first = active_annotation == sorted_annotations_.cbegin()->id;
-    bool is_first_in_group{};
-    for (const auto& cluster : clusters_) {
-      if (active_annotation == cluster.first_annotation.id) {
-        is_first_in_group = true;
-        break;
-      }
-    }
+    auto active = annotations.get(active_annotation);
+    bool is_first = annotations.position(active_annotation) == 0;
+    auto cluster = cluster_at_pos(active.start_char);
+    bool is_first_in_group =
+        cluster != clusters_.cend() &&
+        active_annotation == cluster->second.first_annotation.id;
     status_info.annotation_info =
         QString("%0%1 %2, %3")
             .arg(is_first_in_group ? "^" : "")
             .arg(is_first ? "^" : "")
             .arg(annotations_model->utf16_idx_to_code_point_idx(
-                annotations[active_annotation].start_char))
+                active.start_char))
             .arg(annotations_model->utf16_idx_to_code_point_idx(
-                annotations[active_annotation].end_char));
-    status_info.annotation_label =
-        labels[annotations[active_annotation].label_id].name;
+                active.end_char));
+    status_info.annotation_label = labels[active.label_id].name;
   }
   status_info.doc_info = QString("%0 annotation%1 in current doc")
                              .arg(annotations.size())
@@ -277,8 +468,10 @@ void Annotator::set_annotations_model(AnnotationsModel* new_model) {
 void Annotator::clear_annotations() {
   deactivate_active_annotation();
   text->get_text_edit()->setExtraSelections({});
+  painted_clusters_.clear();
+  painted_active_start_ = -1;
+  painted_active_end_ = -1;
   annotations.clear();
-  sorted_annotations_.clear();
   clusters_.clear();
 }
 
@@ -302,64 +495,80 @@ void Annotator::set_label_list_model(LabelListModel* new_model) {
   label_choices->setModel(new_model);
 }
 
-void Annotator::add_annotation_to_clusters(const AnnotationCursor& annotation,
-                                           std::list<Cluster>& clusters) {
+void Annotator::add_annotation_to_clusters(const AnnotationSpan& annotation,
+                                           ClusterMap& clusters) {
   Cluster new_cluster{{annotation.start_char, annotation.id},
                       {annotation.start_char, annotation.id},
                       annotation.start_char,
                       annotation.end_char};
-  QList<std::list<Cluster>::const_iterator> clusters_to_remove{};
-  for (auto c_it = clusters.cbegin(); c_it != clusters.cend(); ++c_it) {
-    if (annotation.start_char < c_it->end_char &&
-        c_it->start_char < annotation.end_char) {
-      clusters_to_remove << c_it;
-      new_cluster.first_annotation =
-          std::min(new_cluster.first_annotation, c_it->first_annotation);
-      new_cluster.last_annotation =
-          std::max(new_cluster.last_annotation, c_it->last_annotation);
-      new_cluster.start_char =
-          std::min(new_cluster.start_char, c_it->start_char);
-      new_cluster.end_char = std::max(new_cluster.end_char, c_it->end_char);
-    }
-  }
-  for (auto c_it_to_remove : clusters_to_remove) {
-    clusters.erase(c_it_to_remove);
-  }
-  clusters.push_back(new_cluster);
+  // the overlapping clusters are contiguous
+  auto c_it = first_region_ending_after(clusters, annotation.start_char);
+  while (c_it != clusters.end() &&
+         c_it->second.start_char < annotation.end_char) {
+    const auto& cluster = c_it->second;
+    new_cluster.first_annotation =
+        std::min(new_cluster.first_annotation, cluster.first_annotation);
+    new_cluster.last_annotation =
+        std::max(new_cluster.last_annotation, cluster.last_annotation);
+    new_cluster.start_char =
+        std::min(new_cluster.start_char, cluster.start_char);
+    new_cluster.end_char = std::max(new_cluster.end_char, cluster.end_char);
+    c_it = clusters.erase(c_it);
+  }
+  clusters.emplace_hint(c_it, new_cluster.start_char, new_cluster);
 }
 
 void Annotator::remove_annotation_from_clusters(
-    const AnnotationCursor& annotation, std::list<Cluster>& clusters) {
+    const AnnotationSpan& annotation, ClusterMap& clusters) {
   // find the annotation's cluster
-  auto annotation_cluster = clusters.cbegin();
-  while (annotation_cluster != clusters.cend()) {
-    if (annotation_cluster->start_char <= annotation.start_char &&
-        annotation_cluster->end_char >= annotation.end_char) {
-      break;
-    }
-    ++annotation_cluster;
+  auto annotation_cluster = clusters.upper_bound(annotation.start_char);
+  if (annotation_cluster == clusters.begin()) {
+    assert(false);
+    return;
   }
-  if (annotation_cluster == clusters.cend()) {
+  --annotation_cluster;
+  if (annotation_cluster->second.end_char < annotation.end_char) {
     assert(false);
     return;
   }
-  // remove the annotation's cluster and re-insert the other annotations it
+  // remove the annotation's cluster and re-group the other annotations it
   // contains.
-  std::list<Cluster> new_clusters{};
-  auto anno = sorted_annotations_.find(annotation_cluster->first_annotation);
-  assert(anno != sorted_annotations_.end());
-  while (*anno != annotation_cluster->last_annotation) {
-    if (anno->id != annotation.id) {
-      add_annotation_to_clusters(annotations[anno->id], new_clusters);
+  auto first =
+      annotations.position(annotation_cluster->second.first_annotation.id);
+  auto last =
+      annotations.position(annotation_cluster->second.last_annotation.id);
+  assert(first != -1);
+  assert(last != -1);
+  clusters.erase(annotation_cluster);
+  add_clusters(first, last + 1, annotation.id, clusters);
+}
+
+void Annotator::add_clusters(int begin, int end, int skipped_id,
+                             ClusterMap& clusters) const {
+  // annotations are sorted by start_char so a cluster ends at the first
+  // annotation that starts after the end of all the previous ones
+  bool has_cluster{};
+  Cluster cluster{};
+  for (auto position = begin; position != end; ++position) {
+    auto anno = annotations.index_at(position);
+    if (anno.id == skipped_id) {
+      continue;
+    }
+    auto end_char = annotations.end_char_at(position);
+    if (has_cluster && anno.start_char < cluster.end_char) {
+      cluster.last_annotation = anno;
+      cluster.end_char = std::max(cluster.end_char, end_char);
+      continue;
     }
-    ++anno;
-    assert(anno != sorted_annotations_.end());
+    if (has_cluster) {
+      clusters.emplace(cluster.start_char, cluster);
+    }
+    cluster = Cluster{anno, anno, anno.start_char, end_char};
+    has_cluster = true;
   }
-  if (anno->id != annotation.id) {
-    add_annotation_to_clusters(annotations[anno->id], new_clusters);
+  if (has_cluster) {
+    clusters.emplace(cluster.start_char, cluster);
   }
-  clusters.erase(annotation_cluster);
-  clusters.splice(clusters.cend(), new_clusters);
 }
 
 void Annotator::update_label_choices_button_states() {
@@ -379,16 +588,23 @@ void Annotator::update_label_choices_button_states() {
   }
 }
 
-std::list<Cluster>::const_iterator Annotator::cluster_at_pos(int pos) const {
-  for (auto c_it = clusters_.cbegin(); c_it != clusters_.cend(); ++c_it) {
-    if (c_it->start_char <= pos && c_it->end_char > pos) {
-      return c_it;
-    }
+ClusterMap::const_iterator Annotator::cluster_at_pos(int pos) const {
+  auto c_it = clusters_.upper_bound(pos);
+  if (c_it == clusters_.cbegin()) {
+    return clusters_.cend();
+  }
+  --c_it;
+  if (c_it->second.end_char > pos) {
+    return c_it;
   }
   return clusters_.cend();
 }
 
-void Annotator::update_nav_buttons() { nav_buttons->update_button_states(); }
+void Annotator::update_nav_buttons() {
+  // called after documents or annotations were changed by other components
+  annotations_model->invalidate_navigation_state();
+  nav_buttons->update_button_states();
+}
 
 void Annotator::reset_skip_updating_nav_buttons() {
   nav_buttons->set_skip_updating(false);
@@ -398,14 +614,14 @@ int Annotator::active_annotation_label() const {
   if (active_annotation == -1) {
     return -1;
   }
-  return annotations[active_annotation].label_id;
+  return annotations.get(active_annotation).label_id;
 }
 
 QString Annotator::active_annotation_extra_data() const {
   if (active_annotation == -1) {
     return "";
   }
-  return annotations[active_annotation].extra_data;
+  return annotations.get(active_annotation).extra_data;
 }
 
 void Annotator::deactivate_active_annotation() {
@@ -415,9 +631,10 @@ void Annotator::deactivate_active_annotation() {
   // we only set a charformat if necessary, to avoid re-wrapping long lines
   // unnecessarily when bold is not used
   if (active_anno_format_is_set_) {
-    annotations[active_annotation].cursor.setCharFormat(default_format);
+    active_anno_cursor_.setCharFormat(default_format);
     active_anno_format_is_set_ = false;
   }
+  active_anno_cursor_ = QTextCursor{};
   active_annotation = -1;
 }
 
@@ -433,24 +650,20 @@ void Annotator::activate_cluster_at_cursor_pos() {
     return;
   }
   int annotation_id{-1};
-  auto cluster = cluster_at_pos(cursor.position());
+  auto cluster = cluster_at_pos(text->to_content_position(cursor.position()));
   if (cluster != clusters_.cend()) {
     if (active_annotation == -1) {
-      annotation_id = cluster->first_annotation.id;
+      annotation_id = cluster->second.first_annotation.id;
     } else {
-      auto active = annotations[active_annotation];
-      auto active_index = AnnotationIndex{active.start_char, active.id};
-      if (active_index < cluster->first_annotation ||
-          active_index > cluster->last_annotation) {
-        annotation_id = cluster->first_annotation.id;
+      auto active_position = annotations.position(active_annotation);
+      auto active_index = annotations.index_at(active_position);
+      if (active_index < cluster->second.first_annotation ||
+          active_index > cluster->second.last_annotation) {
+        annotation_id = cluster->second.first_annotation.id;
+      } else if (active_annotation == cluster->second.last_annotation.id) {
+        annotation_id = cluster->second.first_annotation.id;
       } else {
-        auto it = sorted_annotations_.find(active_index);
-        if (it->id == cluster->last_annotation.id) {
-          annotation_id = cluster->first_annotation.id;
-        } else {
-          ++it;
-          annotation_id = it->id;
-        }
+        annotation_id = annotations.index_at(active_position + 1).id;
       }
     }
   }
@@ -472,10 +685,12 @@ void Annotator::delete_annotation(int annotation_id) {
     emit active_annotation_changed();
     return;
   }
-  auto anno = annotations[annotation_id];
+  auto anno = annotations.get(annotation_id);
   remove_annotation_from_clusters(anno, clusters_);
   annotations.remove(annotation_id);
-  sorted_annotations_.erase({anno.start_char, anno.id});
+  // the other clusters are not affected; the display is updated when
+  // active_annotation_changed is handled
+  repaint_clusters(anno.start_char, anno.end_char);
   emit active_annotation_changed();
 }
 
@@ -484,6 +699,16 @@ void Annotator::delete_active_annotation() {
   set_default_focus();
 }
 
+void Annotator::undo_annotation_change(bool redo) {
+  deactivate_active_annotation();
+  auto changed = redo ? annotations_model->redo() : annotations_model->undo();
+  if (changed) {
+    // a restored annotation has a new id: read them all again
+    update_annotations();
+  }
+  emit active_annotation_changed();
+}
+
 void Annotator::set_default_focus() { text->setFocus(); }
 
 void Annotator::update_extra_data_for_active_annotation(
@@ -494,7 +719,7 @@ void Annotator::update_extra_data_for_active_annotation(
   }
   if (annotations_model->update_annotation_extra_data(active_annotation,
                                                       new_data)) {
-    annotations[active_annotation].extra_data = new_data;
+    annotations.set_extra_data(active_annotation, new_data);
   } else {
     assert(false);
   }
@@ -506,16 +731,27 @@ void Annotator::set_label_for_selected_region() {
     return;
   }
   int label_id = label_choices->selected_label_id();
-  auto prev_label = annotations[active_annotation].label_id;
-  if (label_id == prev_label) {
+  auto active = annotations.get(active_annotation);
+  // no label is selected when the filter hides the active annotation's label
+  if (label_id == active.label_id || label_id == -1) {
     return;
   }
-  auto start = annotations[active_annotation].start_char;
-  auto end = annotations[active_annotation].end_char;
-  int prev_active = active_annotation;
-  if (add_annotation(label_id, start, end)) {
-    delete_annotation(prev_active);
+  // a single undo step restores the previous label
+  auto new_id = annotations_model->relabel_annotation(active_annotation,
+                                                     label_id);
+  if (new_id == -1) {
+    return;
   }
+  deactivate_active_annotation();
+  remove_annotation_from_clusters(active, clusters_);
+  annotations.remove(active.id);
+  AnnotationSpan relabelled{new_id, label_id, active.start_char,
+                            active.end_char, QString()};
+  annotations.insert(relabelled);
+  add_annotation_to_clusters(relabelled, clusters_);
+  repaint_clusters(active.start_char, active.end_char);
+  active_annotation = new_id;
+  emit active_annotation_changed();
 }
 
 bool Annotator::add_annotation() {
@@ -544,14 +780,10 @@ bool Annotator::add_annotation(int label_id, int start_char, int end_char) {
     emit active_annotation_changed();
     return false;
   }
-  auto annotation_cursor = text->get_text_edit()->textCursor();
-  annotation_cursor.setPosition(start_char);
-  annotation_cursor.setPosition(end_char, QTextCursor::KeepAnchor);
-  annotations[annotation_id] =
-      AnnotationCursor{annotation_id, label_id,  start_char,
-                       end_char,      QString(), annotation_cursor};
-  add_annotation_to_clusters(annotations[annotation_id], clusters_);
-  sorted_annotations_.insert({start_char, annotation_id});
+  AnnotationSpan annotation{annotation_id, label_id, start_char, end_char,
+                            QString()};
+  annotations.insert(annotation);
+  add_annotation_to_clusters(annotation, clusters_);
   auto new_cursor = text->get_text_edit()->textCursor();
   new_cursor.clearSelection();
   text->get_text_edit()->setTextCursor(new_cursor);
@@ -567,29 +799,19 @@ void Annotator::fetch_labels_info() {
     return;
   }
   labels = annotations_model->get_labels_info();
+  painted_formats_.clear();
 }
 
 void Annotator::fetch_annotations_info() {
+  TraceScope trace("Annotator::fetch_annotations_info");
   if (annotations_model == nullptr) {
     assert(false);
     return;
   }
   int prev_active{active_annotation};
   clear_annotations();
-  auto annotation_positions = annotations_model->get_annotations_info();
-  for (auto i = annotation_positions.constBegin();
-       i != annotation_positions.constEnd(); ++i) {
-    auto start = i.value().start_char;
-    auto end = i.value().end_char;
-    auto cursor = text->get_text_edit()->textCursor();
-    cursor.setPosition(start);
-    cursor.setPosition(end, QTextCursor::KeepAnchor);
-    annotations[i.value().id] =
-        AnnotationCursor{i.value().id, i.value().label_id,   start,
-                         end,          i.value().extra_data, cursor};
-    sorted_annotations_.insert({start, i.value().id});
-    add_annotation_to_clusters(annotations[i.value().id], clusters_);
-  }
+  annotations.assign(annotations_model->get_annotations_info());
+  add_clusters(0, annotations.size(), -1, clusters_);
   if (annotations.contains(prev_active)) {
     active_annotation = prev_active;
   }
@@ -600,39 +822,31 @@ int Annotator::find_next_annotation(AnnotationIndex pos, bool forward) const {
     return -1;
   }
   if (forward) {
-    auto i = sorted_annotations_.lower_bound(pos);
-    if (i != sorted_annotations_.cend()) {
-      return i->id;
-    }
-    return sorted_annotations_.cbegin()->id;
-  }
-  auto i = sorted_annotations_.crbegin();
-  while ((i != sorted_annotations_.crend()) && (*i > pos)) {
-    ++i;
-  }
-  if (i != sorted_annotations_.crend()) {
-    return i->id;
-  }
-  return (sorted_annotations_.crbegin())->id;
+    auto next = annotations.lower_bound(pos);
+    // wraps around to the first annotation
+    return annotations.index_at(next == annotations.size() ? 0 : next).id;
+  }
+  // the last annotation not after `pos`, or the last one
+  auto previous = annotations.upper_bound(pos) - 1;
+  return annotations
+      .index_at(previous == -1 ? annotations.size() - 1 : previous)
+      .id;
 }
 
 void Annotator::select_next_annotation(bool forward) {
   AnnotationIndex pos{};
   if (active_annotation != -1) {
     int offset = forward ? 1 : -1;
-    pos = {annotations[active_annotation].start_char,
+    pos = {annotations.get(active_annotation).start_char,
            active_annotation + offset};
   } else {
-    pos = {text->get_text_edit()->textCursor().position(), 0};
+    pos = {text->to_content_position(text->textCursor().position()), 0};
   }
   auto next_anno = find_next_annotation(pos, forward);
   if (next_anno == -1) {
     return;
   }
-  auto cursor = text->get_text_edit()->textCursor();
-  cursor.setPosition(annotations[next_anno].start_char);
-  text->get_text_edit()->setTextCursor(cursor);
-  text->get_text_edit()->ensureCursorVisible();
+  text->move_cursor_to(annotations.get(next_anno).start_char);
   deactivate_active_annotation();
   active_annotation = next_anno;
   emit active_annotation_changed();
@@ -642,30 +856,99 @@ QTextEdit::ExtraSelection
 Annotator::make_painted_region(int start_char, int end_char,
                                const QString& color, const QString& text_color,
                                bool underline) {
-  auto cursor = text->get_text_edit()->textCursor();
-  cursor.setPosition(start_char);
-  cursor.setPosition(end_char, QTextCursor::KeepAnchor);
+  auto cursor = text->cursor_for_range(start_char, end_char);
+
+  auto key = QString("%0 %1 %2").arg(color).arg(text_color).arg(underline);
+  auto format = painted_formats_.find(key);
+  if (format == painted_formats_.end()) {
+    QTextCharFormat new_format(default_format);
+    new_format.setBackground(QColor(color));
+    new_format.setForeground(QColor(text_color));
+    new_format.setFontUnderline(underline);
+    format = painted_formats_.insert(key, new_format);
+  }
+  return QTextEdit::ExtraSelection{cursor, format.value()};
+}
 
-  QTextCharFormat format(default_format);
-  format.setBackground(QColor(color));
-  format.setForeground(QColor(text_color));
-  format.setFontUnderline(underline);
+QPair<int, int> Annotator::visible_char_range() const {
+  auto text_edit = text->get_text_edit();
+  auto viewport = text_edit->viewport()->rect();
+  return {text->to_content_position(
+              text_edit->cursorForPosition(viewport.topLeft()).position()),
+          text->to_content_position(
+              text_edit->cursorForPosition(viewport.bottomRight())
+                  .position())};
+}
 
-  return QTextEdit::ExtraSelection{cursor, format};
+void Annotator::update_painted_region() {
+  auto visible = visible_char_range();
+  if (visible.first < painted_start_ || visible.second > painted_end_) {
+    paint_annotations();
+  }
 }
 
 void Annotator::paint_annotations() {
+  TraceScope trace("Annotator::paint_annotations");
+  auto visible = visible_char_range();
+  auto margin = std::max(visible.second - visible.first, min_painted_margin);
+  auto loaded = text->loaded_range();
+  painted_start_ = std::max(loaded.first, visible.first - margin);
+  painted_end_ = std::min(loaded.second, visible.second + margin);
+  painted_clusters_.clear();
+  paint_clusters(painted_start_, painted_end_);
+  show_painted_annotations();
+}
+
+void Annotator::refresh_loaded_window() {
+  // the active annotation's cursor is in a part of the text that has been
+  // replaced, and the new text has the default format
+  active_anno_format_is_set_ = false;
+  active_anno_cursor_ = QTextCursor{};
+  paint_annotations();
+}
+
+void Annotator::repaint_clusters(int start_char, int end_char) {
+  // the clusters painted there may have been merged, split or removed
+  auto painted = first_region_ending_after(painted_clusters_, start_char);
+  while (painted != painted_clusters_.cend() &&
+         painted->second.start_char < end_char) {
+    painted = painted_clusters_.erase(painted);
+  }
+  paint_clusters(std::max(start_char, painted_start_),
+                 std::min(end_char, painted_end_));
+}
+
+void Annotator::repaint_active_annotation() {
+  if (painted_active_start_ != -1) {
+    repaint_clusters(painted_active_start_, painted_active_end_);
+  }
+  if (active_annotation != -1) {
+    auto active = annotations.get(active_annotation);
+    repaint_clusters(active.start_char, active.end_char);
+  }
+  show_painted_annotations();
+}
+
+void Annotator::paint_clusters(int start_char, int end_char) {
+  if (start_char >= end_char) {
+    return;
+  }
   const QString dark_gray{"#606060"};
-  QList<QTextEdit::ExtraSelection> new_selections{};
   int active_start{-1};
   int active_end{-1};
   if (active_annotation != -1) {
-    active_start = annotations[active_annotation].start_char;
-    active_end = annotations[active_annotation].end_char;
-  }
-  for (const auto& cluster : clusters_) {
+    auto active = annotations.get(active_annotation);
+    active_start = active.start_char;
+    active_end = active.end_char;
+  }
+  for (auto c_it = first_region_ending_after(clusters_, start_char);
+       c_it != clusters_.cend() && c_it->second.start_char < end_char;
+       ++c_it) {
+    const auto& cluster = c_it->second;
     auto cluster_start = cluster.start_char;
     auto cluster_end = cluster.end_char;
+    PaintedCluster painted{cluster_start, cluster_end, {}};
+    auto& new_selections = painted.selections;
     if (cluster.last_annotation.id != cluster.first_annotation.id) {
       if ((cluster_start < active_start) && (active_start < cluster_end)) {
         new_selections << make_painted_region(cluster_start, active_start,
@@ -682,24 +965,41 @@ void Annotator::paint_annotations() {
     } else if (cluster.first_annotation.id != active_annotation) {
       new_selections << make_painted_region(
           cluster_start, cluster_end,
-          labels.value(annotations.value(cluster.first_annotation.id).label_id)
+          labels.value(annotations.get(cluster.first_annotation.id).label_id)
               .color);
     }
+    painted_clusters_[cluster_start] = painted;
   }
+}
+
+void Annotator::show_painted_annotations() {
+  // search matches first so that annotations are drawn over them
+  auto new_selections = text->match_highlights(painted_start_, painted_end_);
+  for (const auto& painted : painted_clusters_) {
+    new_selections.append(painted.second.selections);
+  }
+  painted_active_start_ = -1;
+  painted_active_end_ = -1;
   if (active_annotation != -1) {
-    auto anno = annotations[active_annotation];
+    auto anno = annotations.get(active_annotation);
     if (use_bold_font) {
       QTextCharFormat fmt(default_format);
       fmt.setFontWeight(QFont::Bold);
-      anno.cursor.setCharFormat(fmt);
+      if (active_anno_cursor_.isNull()) {
+        active_anno_cursor_ =
+            text->cursor_for_range(anno.start_char, anno.end_char);
+      }
+      active_anno_cursor_.setCharFormat(fmt);
       active_anno_format_is_set_ = true;
     } else if (active_anno_format_is_set_) {
-      annotations[active_annotation].cursor.setCharFormat(default_format);
+      active_anno_cursor_.setCharFormat(default_format);
       active_anno_format_is_set_ = false;
     }
     new_selections << make_painted_region(anno.start_char, anno.end_char,
                                           labels[anno.label_id].color, "black",
                                           true);
+    painted_active_start_ = anno.start_char;
+    painted_active_end_ = anno.end_char;
   }
   text->get_text_edit()->setExtraSelections(new_selections);
 }
@@ -708,7 +1008,10 @@ bool Annotator::eventFilter(QObject* object, QEvent* event) {
   if (object == text->get_text_edit()) {
     if (event->type() == QEvent::KeyPress) {
       auto key_event = static_cast<QKeyEvent*>(event);
-      if (key_event->key() == Qt::Key_Space) {
+      // the text is read-only but would still consume undo shortcuts
+      if (key_event->key() == Qt::Key_Space ||
+          key_event->matches(QKeySequence::Undo) ||
+          key_event->matches(QKeySequence::Redo)) {
         keyPressEvent(key_event);
         return true;
       }
@@ -722,6 +1025,11 @@ bool Annotator::eventFilter(QObject* object, QEvent* event) {
     mouseReleaseEvent(static_cast<QMouseEvent*>(event));
     return false;
   }
+  if (event->type() == QEvent::Resize &&
+      object == text->get_text_edit()->viewport()) {
+    update_painted_region();
+    return false;
+  }
   return QWidget::eventFilter(object, event);
 }
 
@@ -755,6 +1063,14 @@ void Annotator::keyPressEvent(QKeyEvent* event) {
     select_next_annotation(!backward);
     return;
   }
+  if (event->matches(QKeySequence::Undo)) {
+    undo_annotation_change(false);
+    return;
+  }
+  if (event->matches(QKeySequence::Redo)) {
+    undo_annotation_change(true);
+    return;
+  }
   if (!label_choices->is_label_choice_enabled()) {
     return;
   }
@@ -815,6 +1131,9 @@ void AnnotationsNavButtons::setModel(AnnotationsModel* new_model) {
   annotations_model = new_model;
   QObject::connect(annotations_model, &AnnotationsModel::document_changed, this,
                    &AnnotationsNavButtons::update_button_states);
+  QObject::connect(annotations_model,
+                   &AnnotationsModel::document_status_changed, this,
+                   &AnnotationsNavButtons::update_button_states);
   update_button_states();
 }
 
@@ -823,32 +1142,29 @@ void AnnotationsNavButtons::update_button_states() {
     assert(false);
     return;
   }
-  auto doc_position = annotations_model->current_doc_position();
-  auto total_docs = annotations_model->total_n_docs();
-  auto new_msg = QString("%0 / %1").arg(doc_position + 1).arg(total_docs);
-  if (total_docs == 0) {
+  QElapsedTimer timer{};
+  timer.start();
+  auto state = annotations_model->navigation_state();
+  auto new_msg =
+      QString("%0 / %1").arg(state.doc_position + 1).arg(state.total_n_docs);
+  if (state.total_n_docs == 0) {
     new_msg = QString("0 / 0");
   }
   current_doc_label->setText(new_msg);
   if (skip_updating_buttons_) {
     return;
   }
-  QElapsedTimer timer{};
-  timer.start();
-  next_button->setEnabled(annotations_model->has_next());
-  prev_button->setEnabled(annotations_model->has_prev());
-  next_labelled_button->setEnabled(annotations_model->has_next_labelled());
-  if (timer.elapsed() > 500)
-    return set_skip_updating(true);
-  prev_labelled_button->setEnabled(annotations_model->has_prev_labelled());
-  if (timer.elapsed() > 500)
-    return set_skip_updating(true);
-  next_unlabelled_button->setEnabled(annotations_model->has_next_unlabelled());
-  if (timer.elapsed() > 500)
-    return set_skip_updating(true);
-  prev_unlabelled_button->setEnabled(annotations_model->has_prev_unlabelled());
-  if (timer.elapsed() > 500)
-    return set_skip_updating(true);
+  next_button->setEnabled(state.has_next);
+  prev_button->setEnabled(state.has_prev);
+  next_labelled_button->setEnabled(state.has_next_labelled);
+  prev_labelled_button->setEnabled(state.has_prev_labelled);
+  next_unlabelled_button->setEnabled(state.has_next_unlabelled);
+  prev_unlabelled_button->setEnabled(state.has_prev_unlabelled);
+  // on very large databases keep all buttons enabled rather than slowing
+  // down navigation
+  if (timer.elapsed() > 500) {
+    set_skip_updating(true);
+  }
 }
 
 void AnnotationsNavButtons::set_skip_updating(bool skip) {
@@ -1,19 +1,22 @@
 #ifndef LABELBUDDY_ANNOTATOR_H
 #define LABELBUDDY_ANNOTATOR_H
 
-#include <list>
+#include <map>
 #include <memory>
-#include <set>
 
+#include <QHash>
 #include <QLabel>
 #include <QLineEdit>
 #include <QMap>
+#include <QPair>
 #include <QPushButton>
 #include <QSplitter>
 #include <QSqlQueryModel>
+#include <QVector>
 #include <QWidget>
 
 #include "annotations_model.h"
+#include "label_filter_model.h"
 #include "label_list.h"
 #include "label_list_model.h"
 #include "no_deselect_all_view.h"
@@ -56,11 +59,16 @@ private slots:
   void on_selection_change();
   void on_delete_button_click();
 
+  /// Select the first label shown, if the list has been filtered
+  void select_first_match();
+
 private:
   QLabel* instruction_label = nullptr;
   QPushButton* delete_button = nullptr;
+  QLineEdit* filter_edit = nullptr;
   NoDeselectAllView* labels_view = nullptr;
   LabelListModel* label_list_model = nullptr;
+  LabelFilterModel* filter_model = nullptr;
   std::unique_ptr<LabelDelegate> label_delegate_ = nullptr;
   QLineEdit* extra_data_edit = nullptr;
   QLabel* extra_data_label = nullptr;
@@ -101,13 +109,17 @@ signals:
   void visit_prev_unlabelled();
 };
 
-struct AnnotationCursor {
+/// An annotation of the current document (UTF-16 positions in its content)
+
+/// No `QTextCursor` is kept per annotation: the document would update every
+/// one of them on each change. Cursors are made for the painted regions and
+/// the active annotation only.
+struct AnnotationSpan {
   int id;
   int label_id;
   int start_char;
   int end_char;
   QString extra_data;
-  QTextCursor cursor;
 };
 
 struct AnnotationIndex {
@@ -122,6 +134,55 @@ bool operator>=(const AnnotationIndex& lhs, const AnnotationIndex& rhs);
 bool operator==(const AnnotationIndex& lhs, const AnnotationIndex& rhs);
 bool operator!=(const AnnotationIndex& lhs, const AnnotationIndex& rhs);
 
+/// The annotations of the current document, sorted by `{start_char, id}`.
+
+/// Each field is stored in its own array, in that order, so that sweeping the
+/// annotations (eg to group them into clusters) reads contiguous memory, and
+/// a hash gives the position of an annotation from its `id`. `assign` makes
+/// one allocation per array. `insert` and `remove` shift the annotations that
+/// follow, which is linear in the number of annotations but only happens once
+/// per user action.
+class AnnotationStore {
+public:
+  void clear();
+
+  /// Replace all the annotations
+  void assign(const QMap<int, AnnotationInfo>& annotations);
+
+  void insert(const AnnotationSpan& annotation);
+  void remove(int annotation_id);
+  void set_extra_data(int annotation_id, const QString& extra_data);
+
+  int size() const;
+  bool contains(int annotation_id) const;
+
+  /// The annotation with this `id`, which must exist
+  AnnotationSpan get(int annotation_id) const;
+
+  /// Position of an annotation in the sorted order, or -1
+  int position(int annotation_id) const;
+
+  /// Position of the first annotation that is not before `index`
+  int lower_bound(AnnotationIndex index) const;
+
+  /// Position of the first annotation that is after `index`
+  int upper_bound(AnnotationIndex index) const;
+
+  AnnotationIndex index_at(int position) const;
+  int end_char_at(int position) const;
+
+private:
+  /// Store the positions of the annotations from `first_position` on
+  void update_positions(int first_position);
+
+  QVector<int> ids_{};
+  QVector<int> label_ids_{};
+  QVector<int> start_chars_{};
+  QVector<int> end_chars_{};
+  QVector<QString> extra_data_{};
+  QHash<int, int> positions_{};
+};
+
 struct Cluster {
   AnnotationIndex first_annotation;
   AnnotationIndex last_annotation;
@@ -129,6 +190,19 @@ struct Cluster {
   int end_char;
 };
 
+/// Clusters indexed by their `start_char`
+
+/// They do not overlap so the cluster containing a position is the last one
+/// starting at or before it.
+using ClusterMap = std::map<int, Cluster>;
+
+/// The extra selections that show a cluster in the Annotator
+struct PaintedCluster {
+  int start_char;
+  int end_char;
+  QList<QTextEdit::ExtraSelection> selections;
+};
+
 struct StatusBarInfo {
   QString doc_info;
   QString annotation_info;
@@ -215,6 +289,19 @@ private slots:
   void update_label_choices_button_states();
   void reset_document();
 
+  /// Repaint if the visible text is no longer inside the painted region
+  void update_painted_region();
+
+  /// Repaint after another window of a large document has been loaded
+  void refresh_loaded_window();
+
+  /// Repaint the clusters of the previous and new active annotations
+  void repaint_active_annotation();
+
+  /// Set the text's extra selections: painted clusters, active annotation and
+  /// search matches
+  void show_painted_annotations();
+
 private:
   void clear_annotations();
   void fetch_labels_info();
@@ -223,12 +310,31 @@ private:
   make_painted_region(int start_char, int end_char, const QString& color,
                       const QString& text_color = "black",
                       bool underline = false);
+  /// Highlight the annotations in the visible part of the text
+
+  /// Only clusters that intersect the viewport, or a margin around it, are
+  /// painted; scrolling outside of that region triggers a new painting.
   void paint_annotations();
+
+  /// Recompute the painted clusters that intersect [`start_char`, `end_char`)
+
+  /// Called when annotations in that range are added or removed; the result
+  /// is displayed by `show_painted_annotations`.
+  void repaint_clusters(int start_char, int end_char);
+
+  /// Add the clusters that intersect the range to `painted_clusters_`
+  void paint_clusters(int start_char, int end_char);
+
+  /// Character positions of the top left and bottom right of the viewport
+  QPair<int, int> visible_char_range() const;
   bool add_annotation();
   bool add_annotation(int label_id, int start_char, int end_char);
   void delete_annotation(int);
+
+  /// undo (or redo) the latest change to the annotations and show the result
+  void undo_annotation_change(bool redo);
   void deactivate_active_annotation();
-  std::list<Cluster>::const_iterator cluster_at_pos(int pos) const;
+  ClusterMap::const_iterator cluster_at_pos(int pos) const;
 
   /// pos: {start_char, id}
   int find_next_annotation(AnnotationIndex pos, bool forward = true) const;
@@ -236,25 +342,34 @@ private:
   /// Update clusters with a new annotation.
 
   /// Clusters that overlap with the new annotation are merged
-  void add_annotation_to_clusters(const AnnotationCursor& annotation,
-                                  std::list<Cluster>& clusters);
+  void add_annotation_to_clusters(const AnnotationSpan& annotation,
+                                  ClusterMap& clusters);
 
   /// Remove an annotation and update the clusters
-  void remove_annotation_from_clusters(const AnnotationCursor& annotation,
-                                       std::list<Cluster>& clusters);
+
+  /// Only the annotation's cluster is rebuilt.
+  void remove_annotation_from_clusters(const AnnotationSpan& annotation,
+                                       ClusterMap& clusters);
+
+  /// Group the annotations at positions [`begin`, `end`) of `annotations`
+  /// into clusters in one sweep
+
+  /// The annotation with id `skipped_id`, if any, is left out. The range must
+  /// not overlap with the clusters already in `clusters`.
+  void add_clusters(int begin, int end, int skipped_id,
+                    ClusterMap& clusters) const;
 
   int active_annotation = -1;
   bool need_update_active_anno_{};
   bool active_anno_format_is_set_{};
+  /// selects the active annotation when its char format is set
+  QTextCursor active_anno_cursor_{};
 
   /// clusters of overlapping annotations
-  std::list<Cluster> clusters_{};
-  QMap<int, AnnotationCursor> annotations{};
+  ClusterMap clusters_{};
+  AnnotationStore annotations{};
   QMap<int, LabelInfo> labels{};
 
-  /// Sorting annotations by {start_char, id}
-  std::set<AnnotationIndex> sorted_annotations_{};
-
   QLabel* title_label;
   SearchableText* text;
   LabelChoices* label_choices;
@@ -262,6 +377,20 @@ private:
   AnnotationsNavButtons* nav_buttons = nullptr;
   QTextCharFormat default_format;
   bool use_bold_font = true;
+
+  /// Formats used by `make_painted_region`, by color, text color & underline
+  QMap<QString, QTextCharFormat> painted_formats_{};
+
+  /// Region painted by the last `paint_annotations`
+  int painted_start_{};
+  int painted_end_{};
+
+  /// Selections for the clusters in the painted region, by `start_char`
+  std::map<int, PaintedCluster> painted_clusters_{};
+
+  /// Position of the active annotation when it was last painted, or -1
+  int painted_active_start_ = -1;
+  int painted_active_end_ = -1;
 };
 
 } // namespace labelbuddy
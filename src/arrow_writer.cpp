@@ -0,0 +1,557 @@
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <utility>
+
+#include "arrow_writer.h"
+
+namespace labelbuddy {
+
+namespace {
+
+void write_le(char* dest, quint64 value, int size) {
+  for (int i = 0; i != size; ++i) {
+    dest[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+  }
+}
+
+void append_le(QByteArray& data, quint64 value, int size) {
+  auto pos = data.size();
+  data.resize(pos + size);
+  write_le(data.data() + pos, value, size);
+}
+
+void pad_to(QByteArray& data, int alignment) {
+  while (data.size() % alignment) {
+    data.append('\0');
+  }
+}
+
+/// Writes a flatbuffer from front to back.
+
+/// Objects referred to by a table or vector are written after it so that
+/// offsets (which are unsigned) point forward; vtables are written just
+/// before their table. Positions are aligned relative to the start of the
+/// buffer.
+class FlatBufferBuilder {
+public:
+  /// Writes an object at the end of the buffer and returns its position
+  using Object = std::function<int(FlatBufferBuilder&)>;
+
+  /// A table field: a scalar of `size` bytes, or an offset to `object`
+  struct Field {
+    int id;
+    int size;
+    quint64 value;
+    Object object;
+  };
+
+  static Field scalar(int id, int size, quint64 value) {
+    return Field{id, size, value, nullptr};
+  }
+
+  static Field offset(int id, Object object) {
+    return Field{id, 4, 0, std::move(object)};
+  }
+
+  /// The root offset followed by the root object, padded to 8 bytes
+  static QByteArray finish(const Object& root) {
+    FlatBufferBuilder builder{};
+    append_le(builder.data_, 0, 4);
+    builder.patch_offset(0, root(builder));
+    pad_to(builder.data_, 8);
+    return builder.data_;
+  }
+
+  int table(const QVector<Field>& fields) {
+    int n_ids{};
+    for (const auto& field : fields) {
+      n_ids = std::max(n_ids, field.id + 1);
+    }
+    pad_to(data_, 2);
+    auto vtable_pos = data_.size();
+    append_le(data_, static_cast<quint64>(4 + 2 * n_ids), 2);
+    // table size and field offsets are filled in below
+    data_.append(QByteArray(2 + 2 * n_ids, '\0'));
+    pad_to(data_, 4);
+    auto table_pos = data_.size();
+    append_le(data_, static_cast<quint64>(table_pos - vtable_pos), 4);
+    QVector<int> field_positions{};
+    for (const auto& field : fields) {
+      pad_to(data_, field.size);
+      field_positions << data_.size();
+      write_le(data_.data() + vtable_pos + 4 + 2 * field.id,
+               static_cast<quint64>(data_.size() - table_pos), 2);
+      append_le(data_, field.value, field.size);
+    }
+    write_le(data_.data() + vtable_pos + 2,
+             static_cast<quint64>(data_.size() - table_pos), 2);
+    for (int i = 0; i != fields.size(); ++i) {
+      if (fields[i].object) {
+        patch_offset(field_positions[i], fields[i].object(*this));
+      }
+    }
+    return table_pos;
+  }
+
+  int string(const QString& value) {
+    auto utf8 = value.toUtf8();
+    pad_to(data_, 4);
+    auto pos = data_.size();
+    append_le(data_, static_cast<quint64>(utf8.size()), 4);
+    data_.append(utf8);
+    data_.append('\0');
+    return pos;
+  }
+
+  int vector(const QVector<Object>& objects) {
+    pad_to(data_, 4);
+    auto pos = data_.size();
+    append_le(data_, static_cast<quint64>(objects.size()), 4);
+    data_.append(QByteArray(4 * objects.size(), '\0'));
+    for (int i = 0; i != objects.size(); ++i) {
+      patch_offset(pos + 4 + 4 * i, objects[i](*this));
+    }
+    return pos;
+  }
+
+  /// A vector of `n` structs which are 8-byte aligned, already encoded
+  int struct_vector(const QByteArray& structs, int n) {
+    while ((data_.size() + 4) % 8) {
+      data_.append('\0');
+    }
+    auto pos = data_.size();
+    append_le(data_, static_cast<quint64>(n), 4);
+    data_.append(structs);
+    return pos;
+  }
+
+private:
+  void patch_offset(int pos, int target) {
+    assert(target > pos);
+    write_le(data_.data() + pos, static_cast<quint64>(target - pos), 4);
+  }
+
+  QByteArray data_{};
+};
+
+using Object = FlatBufferBuilder::Object;
+using FB = FlatBufferBuilder;
+
+// enums and union tags from the Arrow flatbuffer definitions
+
+const quint64 metadata_version_v5{4};
+const quint64 message_header_schema{1};
+const quint64 message_header_record_batch{3};
+const quint64 type_int{2};
+const quint64 type_utf8{5};
+const quint64 type_list{12};
+const quint64 type_struct{13};
+
+const char magic[] = "ARROW1";
+const int magic_size{6};
+
+quint64 type_tag(ArrowColumn::Type type) {
+  switch (type) {
+  case ArrowColumn::Type::Int32:
+    return type_int;
+  case ArrowColumn::Type::Utf8:
+    return type_utf8;
+  case ArrowColumn::Type::List:
+    return type_list;
+  case ArrowColumn::Type::Struct:
+    return type_struct;
+  default:
+    assert(false);
+    return 0;
+  }
+}
+
+Object type_object(ArrowColumn::Type type) {
+  if (type == ArrowColumn::Type::Int32) {
+    // bitWidth, is_signed
+    return [](FB& fb) {
+      return fb.table({FB::scalar(0, 4, 32), FB::scalar(1, 1, 1)});
+    };
+  }
+  // the other types have no parameters
+  return [](FB& fb) { return fb.table({}); };
+}
+
+Object field_object(const ArrowColumn* column) {
+  return [column](FB& fb) {
+    QVector<Object> children{};
+    for (const auto& child : column->children()) {
+      children << field_object(child.get());
+    }
+    auto name = column->name();
+    // name, nullable, type type, type, children (which must not be omitted)
+    return fb.table(
+        {FB::offset(0, [name](FB& fb) { return fb.string(name); }),
+         FB::scalar(1, 1, column->is_nullable() ? 1 : 0),
+         FB::scalar(2, 1, type_tag(column->type())),
+         FB::offset(3, type_object(column->type())),
+         FB::offset(5, [children](FB& fb) { return fb.vector(children); })});
+  };
+}
+
+Object schema_object(const std::vector<const ArrowColumn*>& columns) {
+  QVector<Object> fields{};
+  for (const auto* column : columns) {
+    fields << field_object(column);
+  }
+  return [fields](FB& fb) {
+    // endianness (little), fields
+    return fb.table(
+        {FB::scalar(0, 2, 0),
+         FB::offset(1, [fields](FB& fb) { return fb.vector(fields); })});
+  };
+}
+
+Object message_object(quint64 header_type, const Object& header,
+                      qint64 body_length) {
+  return [header_type, header, body_length](FB& fb) {
+    return fb.table({FB::scalar(0, 2, metadata_version_v5),
+                     FB::scalar(1, 1, header_type), FB::offset(2, header),
+                     FB::scalar(3, 8, static_cast<quint64>(body_length))});
+  };
+}
+
+/// The nodes and buffers of a column and its children, in pre-order
+void collect_batch(const ArrowColumn& column, QByteArray& nodes,
+                   QVector<QByteArray>& validity_buffers,
+                   QVector<const QByteArray*>& buffers) {
+  append_le(nodes, static_cast<quint64>(column.length()), 8);
+  append_le(nodes, static_cast<quint64>(column.null_count()), 8);
+  // the bitmap is a copy (usually empty), stored until the batch is written
+  validity_buffers << column.validity_buffer();
+  buffers << nullptr;
+  for (const auto* buffer : column.data_buffers()) {
+    buffers << buffer;
+  }
+  for (const auto& child : column.children()) {
+    collect_batch(*child, nodes, validity_buffers, buffers);
+  }
+}
+
+int padded_size(qint64 size) {
+  return static_cast<int>((size + 7) / 8 * 8);
+}
+
+} // namespace
+
+ArrowColumn::ArrowColumn(const QString& name, bool nullable, Type type)
+    : name_{name}, nullable_{nullable}, type_{type} {}
+
+ArrowColumn::~ArrowColumn() {}
+
+const QString& ArrowColumn::name() const { return name_; }
+bool ArrowColumn::is_nullable() const { return nullable_; }
+ArrowColumn::Type ArrowColumn::type() const { return type_; }
+int ArrowColumn::length() const { return length_; }
+int ArrowColumn::null_count() const { return null_count_; }
+
+QByteArray ArrowColumn::validity_buffer() const {
+  return null_count_ ? validity_ : QByteArray{};
+}
+
+const std::vector<std::unique_ptr<ArrowColumn>>&
+ArrowColumn::children() const {
+  return children_;
+}
+
+void ArrowColumn::clear() {
+  length_ = 0;
+  null_count_ = 0;
+  validity_.resize(0);
+  for (auto& child : children_) {
+    child->clear();
+  }
+}
+
+void ArrowColumn::append_validity(bool is_valid) {
+  assert(is_valid || nullable_);
+  if (!is_valid && !null_count_) {
+    // the bitmap is only built once there is a null value
+    validity_.fill('\xff', length_ / 8);
+    if (length_ % 8) {
+      validity_.append(static_cast<char>((1 << (length_ % 8)) - 1));
+    }
+  }
+  if (!is_valid) {
+    ++null_count_;
+  }
+  if (null_count_) {
+    if (length_ % 8 == 0) {
+      validity_.append('\0');
+    }
+    if (is_valid) {
+      validity_[length_ / 8] =
+          static_cast<char>(validity_[length_ / 8] | (1 << (length_ % 8)));
+    } else {
+      validity_[length_ / 8] =
+          static_cast<char>(validity_[length_ / 8] & ~(1 << (length_ % 8)));
+    }
+  }
+  ++length_;
+}
+
+void ArrowColumn::add_child(ArrowColumn* child) {
+  children_.emplace_back(child);
+}
+
+ArrowInt32Column::ArrowInt32Column(const QString& name, bool nullable)
+    : ArrowColumn(name, nullable, Type::Int32) {}
+
+void ArrowInt32Column::append(int value) {
+  append_validity(true);
+  append_le(values_, static_cast<quint32>(value), 4);
+}
+
+void ArrowInt32Column::append_null() {
+  append_validity(false);
+  append_le(values_, 0, 4);
+}
+
+QVector<const QByteArray*> ArrowInt32Column::data_buffers() const {
+  return {&values_};
+}
+
+void ArrowInt32Column::clear() {
+  ArrowColumn::clear();
+  values_.resize(0);
+}
+
+ArrowUtf8Column::ArrowUtf8Column(const QString& name, bool nullable)
+    : ArrowColumn(name, nullable, Type::Utf8) {
+  // `resize(0)` keeps the capacity once it has been reserved
+  offsets_.reserve(1 << 12);
+  data_.reserve(1 << 16);
+  append_le(offsets_, 0, 4);
+}
+
+void ArrowUtf8Column::append(const QString& value) {
+  append_validity(true);
+  auto start = data_.size();
+  // at most 3 bytes for each utf-16 code unit
+  data_.resize(start + 3 * value.size());
+  auto* out = data_.data() + start;
+  const auto* in = value.constData();
+  const int size = value.size();
+  for (int i = 0; i != size; ++i) {
+    uint code_point = in[i].unicode();
+    if (code_point < 0x80) {
+      *out++ = static_cast<char>(code_point);
+      continue;
+    }
+    if (code_point < 0x800) {
+      *out++ = static_cast<char>(0xc0 | (code_point >> 6));
+      *out++ = static_cast<char>(0x80 | (code_point & 0x3f));
+      continue;
+    }
+    if (in[i].isSurrogate()) {
+      if (in[i].isHighSurrogate() && i + 1 != size &&
+          in[i + 1].isLowSurrogate()) {
+        code_point = QChar::surrogateToUcs4(in[i], in[i + 1]);
+        ++i;
+        *out++ = static_cast<char>(0xf0 | (code_point >> 18));
+        *out++ = static_cast<char>(0x80 | ((code_point >> 12) & 0x3f));
+        *out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+        *out++ = static_cast<char>(0x80 | (code_point & 0x3f));
+        continue;
+      }
+      code_point = QChar::ReplacementCharacter;
+    }
+    *out++ = static_cast<char>(0xe0 | (code_point >> 12));
+    *out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+    *out++ = static_cast<char>(0x80 | (code_point & 0x3f));
+  }
+  data_.resize(static_cast<int>(out - data_.data()));
+  append_offset();
+}
+
+void ArrowUtf8Column::append_utf8(const QByteArray& value) {
+  append_validity(true);
+  data_.append(value);
+  append_offset();
+}
+
+void ArrowUtf8Column::append_null() {
+  append_validity(false);
+  append_offset();
+}
+
+QVector<const QByteArray*> ArrowUtf8Column::data_buffers() const {
+  return {&offsets_, &data_};
+}
+
+void ArrowUtf8Column::clear() {
+  ArrowColumn::clear();
+  offsets_.resize(0);
+  data_.resize(0);
+  append_le(offsets_, 0, 4);
+}
+
+void ArrowUtf8Column::append_offset() {
+  append_le(offsets_, static_cast<quint64>(data_.size()), 4);
+}
+
+ArrowListColumn::ArrowListColumn(const QString& name, bool nullable,
+                                 ArrowColumn* values)
+    : ArrowColumn(name, nullable, Type::List), values_{values} {
+  add_child(values);
+  append_le(offsets_, 0, 4);
+}
+
+ArrowColumn& ArrowListColumn::values() { return *values_; }
+
+void ArrowListColumn::append() {
+  append_validity(true);
+  append_offset();
+}
+
+void ArrowListColumn::append_null() {
+  append_validity(false);
+  append_offset();
+}
+
+QVector<const QByteArray*> ArrowListColumn::data_buffers() const {
+  return {&offsets_};
+}
+
+void ArrowListColumn::clear() {
+  ArrowColumn::clear();
+  offsets_.resize(0);
+  append_le(offsets_, 0, 4);
+}
+
+void ArrowListColumn::append_offset() {
+  append_le(offsets_, static_cast<quint64>(values_->length()), 4);
+}
+
+ArrowStructColumn::ArrowStructColumn(const QString& name, bool nullable)
+    : ArrowColumn(name, nullable, Type::Struct) {}
+
+void ArrowStructColumn::append() {
+#ifndef NDEBUG
+  for (const auto& field : children()) {
+    assert(field->length() == length() + 1);
+  }
+#endif
+  append_validity(true);
+}
+
+QVector<const QByteArray*> ArrowStructColumn::data_buffers() const {
+  return {};
+}
+
+ArrowFileWriter::ArrowFileWriter(
+    QIODevice* device, const std::vector<const ArrowColumn*>& columns)
+    : device_{device}, columns_{columns} {}
+
+int ArrowFileWriter::n_record_batches() const {
+  return record_batches_.size();
+}
+
+void ArrowFileWriter::write(const QByteArray& data) {
+  device_->write(data);
+  position_ += data.size();
+}
+
+void ArrowFileWriter::write_prefix() {
+  QByteArray prefix(magic, magic_size);
+  pad_to(prefix, 8);
+  write(prefix);
+  auto metadata = FB::finish(
+      message_object(message_header_schema, schema_object(columns_), 0));
+  QByteArray message_prefix{};
+  append_le(message_prefix, 0xffffffffU, 4);
+  append_le(message_prefix, static_cast<quint64>(metadata.size()), 4);
+  write(message_prefix);
+  write(metadata);
+}
+
+void ArrowFileWriter::write_record_batch() {
+  if (columns_.empty() || columns_.front()->length() == 0) {
+    return;
+  }
+  const auto length = columns_.front()->length();
+  QByteArray nodes{};
+  QVector<QByteArray> validity_buffers{};
+  QVector<const QByteArray*> buffers{};
+  for (const auto* column : columns_) {
+    assert(column->length() == length);
+    collect_batch(*column, nodes, validity_buffers, buffers);
+  }
+  QByteArray buffer_specs{};
+  qint64 body_length{};
+  int validity_idx{};
+  for (auto& buffer : buffers) {
+    if (buffer == nullptr) {
+      buffer = &validity_buffers[validity_idx++];
+    }
+    append_le(buffer_specs, static_cast<quint64>(body_length), 8);
+    append_le(buffer_specs, static_cast<quint64>(buffer->size()), 8);
+    body_length += padded_size(buffer->size());
+  }
+  auto n_nodes = nodes.size() / 16;
+  auto n_buffers = buffers.size();
+  auto record_batch = [length, nodes, n_nodes, buffer_specs,
+                       n_buffers](FB& fb) {
+    return fb.table(
+        {FB::scalar(0, 8, static_cast<quint64>(length)),
+         FB::offset(1,
+                    [nodes, n_nodes](FB& fb) {
+                      return fb.struct_vector(nodes, n_nodes);
+                    }),
+         FB::offset(2, [buffer_specs, n_buffers](FB& fb) {
+           return fb.struct_vector(buffer_specs, n_buffers);
+         })});
+  };
+  auto metadata = FB::finish(message_object(message_header_record_batch,
+                                            record_batch, body_length));
+  record_batches_ << Block{position_, 8 + metadata.size(), body_length};
+  QByteArray message_prefix{};
+  append_le(message_prefix, 0xffffffffU, 4);
+  append_le(message_prefix, static_cast<quint64>(metadata.size()), 4);
+  write(message_prefix);
+  write(metadata);
+  const QByteArray padding(8, '\0');
+  for (const auto* buffer : buffers) {
+    write(*buffer);
+    write(padding.left(padded_size(buffer->size()) - buffer->size()));
+  }
+}
+
+void ArrowFileWriter::write_suffix() {
+  // end-of-stream marker
+  QByteArray end_of_stream{};
+  append_le(end_of_stream, 0xffffffffU, 4);
+  append_le(end_of_stream, 0, 4);
+  write(end_of_stream);
+  QByteArray blocks{};
+  for (const auto& block : record_batches_) {
+    append_le(blocks, static_cast<quint64>(block.offset), 8);
+    append_le(blocks, static_cast<quint64>(block.metadata_length), 4);
+    append_le(blocks, 0, 4);
+    append_le(blocks, static_cast<quint64>(block.body_length), 8);
+  }
+  auto n_blocks = record_batches_.size();
+  auto schema = schema_object(columns_);
+  auto footer = FB::finish([schema, blocks, n_blocks](FB& fb) {
+    // version, schema, dictionaries, record batches
+    return fb.table(
+        {FB::scalar(0, 2, metadata_version_v5), FB::offset(1, schema),
+         FB::offset(2, [](FB& fb) { return fb.struct_vector({}, 0); }),
+         FB::offset(3, [blocks, n_blocks](FB& fb) {
+           return fb.struct_vector(blocks, n_blocks);
+         })});
+  });
+  write(footer);
+  QByteArray end{};
+  append_le(end, static_cast<quint64>(footer.size()), 4);
+  end.append(magic, magic_size);
+  write(end);
+}
+
+} // namespace labelbuddy
@@ -0,0 +1,187 @@
+#ifndef LABELBUDDY_ARROW_WRITER_H
+#define LABELBUDDY_ARROW_WRITER_H
+
+#include <memory>
+#include <vector>
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QString>
+#include <QVector>
+
+/// \file
+/// Writing columns in the Arrow IPC file format (also known as Feather v2).
+
+/// Only the types needed to export documents are supported (32-bit integers,
+/// UTF-8 strings, lists and structs), nothing is dictionary-encoded and the
+/// record batch bodies are not compressed, so that readers can memory-map the
+/// file and use the columns without copying them.
+
+namespace labelbuddy {
+
+/// A column of the record batch being built.
+
+/// Values are appended to buffers in the Arrow memory layout. `clear` empties
+/// the column to build the next record batch but keeps the allocated
+/// memory, so that appending values does not allocate once the buffers have
+/// grown to the size of a batch.
+class ArrowColumn {
+public:
+  enum class Type { Int32, Utf8, List, Struct };
+
+  ArrowColumn(const QString& name, bool nullable, Type type);
+  virtual ~ArrowColumn();
+
+  const QString& name() const;
+  bool is_nullable() const;
+  Type type() const;
+
+  int length() const;
+  int null_count() const;
+
+  /// The validity bitmap, empty if there are no null values
+  QByteArray validity_buffer() const;
+
+  /// The buffers following the validity bitmap (eg offsets and data)
+  virtual QVector<const QByteArray*> data_buffers() const = 0;
+
+  /// Nested columns (the values of a list or the fields of a struct)
+  const std::vector<std::unique_ptr<ArrowColumn>>& children() const;
+
+  /// Remove all values (also from the children)
+  virtual void clear();
+
+protected:
+  void append_validity(bool is_valid);
+  void add_child(ArrowColumn* child);
+
+private:
+  QString name_;
+  bool nullable_;
+  Type type_;
+  int length_{};
+  int null_count_{};
+  QByteArray validity_{};
+  std::vector<std::unique_ptr<ArrowColumn>> children_{};
+};
+
+class ArrowInt32Column : public ArrowColumn {
+public:
+  ArrowInt32Column(const QString& name, bool nullable);
+
+  void append(int value);
+  void append_null();
+
+  QVector<const QByteArray*> data_buffers() const override;
+  void clear() override;
+
+private:
+  QByteArray values_{};
+};
+
+class ArrowUtf8Column : public ArrowColumn {
+public:
+  ArrowUtf8Column(const QString& name, bool nullable);
+
+  /// Encodes `value` directly into the data buffer.
+
+  /// Unpaired surrogates are replaced by U+FFFD as in `QString::toUtf8`.
+  void append(const QString& value);
+
+  /// Append an already encoded string
+  void append_utf8(const QByteArray& value);
+
+  void append_null();
+
+  QVector<const QByteArray*> data_buffers() const override;
+  void clear() override;
+
+private:
+  void append_offset();
+
+  QByteArray offsets_{};
+  QByteArray data_{};
+};
+
+/// A column of lists; the list items are appended to `values`.
+class ArrowListColumn : public ArrowColumn {
+public:
+  /// Takes ownership of `values`, whose name is conventionally "item"
+  ArrowListColumn(const QString& name, bool nullable, ArrowColumn* values);
+
+  ArrowColumn& values();
+
+  /// Append a list containing the items appended to `values` since the
+  /// previous list was appended
+  void append();
+
+  void append_null();
+
+  QVector<const QByteArray*> data_buffers() const override;
+  void clear() override;
+
+private:
+  void append_offset();
+
+  ArrowColumn* values_;
+  QByteArray offsets_{};
+};
+
+/// A column of structs; a value is appended to each field separately.
+class ArrowStructColumn : public ArrowColumn {
+public:
+  ArrowStructColumn(const QString& name, bool nullable);
+
+  /// Takes ownership of `field` and returns it
+  template <typename T> T* add_field(T* field) {
+    add_child(field);
+    return field;
+  }
+
+  /// Append a (non-null) struct, once a value has been appended to each field
+  void append();
+
+  QVector<const QByteArray*> data_buffers() const override;
+};
+
+/// Writes record batches of columns to an Arrow IPC file.
+
+/// The columns are not owned and must not change (apart from their content)
+/// until `write_suffix` is called. The output device must not be opened in
+/// text mode.
+class ArrowFileWriter {
+public:
+  ArrowFileWriter(QIODevice* device,
+                  const std::vector<const ArrowColumn*>& columns);
+
+  /// The magic string and the schema
+  void write_prefix();
+
+  /// Write the current content of the columns as a record batch. Nothing is
+  /// written if the columns are empty.
+  void write_record_batch();
+
+  /// The end-of-stream marker, the footer (which lists the record batches)
+  /// and the magic string
+  void write_suffix();
+
+  int n_record_batches() const;
+
+private:
+  struct Block {
+    qint64 offset;
+    int metadata_length;
+    qint64 body_length;
+  };
+
+  void write(const QByteArray& data);
+
+  QIODevice* device_;
+  std::vector<const ArrowColumn*> columns_;
+  qint64 position_{};
+  QVector<Block> record_batches_{};
+};
+
+} // namespace labelbuddy
+
+#endif
@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+#include <QPair>
+#include <QSqlQuery>
+#include <QStringList>
+#include <QVector>
+
+#include "batch_labeling.h"
+#include "database.h"
+#include "document_loader.h"
+#include "text_search.h"
+#include "tracing.h"
+#include "worker_connection.h"
+
+namespace labelbuddy {
+
+namespace {
+
+/// documents whose text is held in memory at once
+const int read_block_size{64};
+
+/// commit at least this often when documents have few matches
+const int max_docs_per_transaction{1000};
+
+} // namespace
+
+BatchLabelingResult annotate_matches_in_chunks(
+    const QSqlDatabase& database, const QString& pattern, int label_id,
+    bool all_docs, const QList<int>& doc_ids, int chunk_size,
+    const std::function<void(int)>& on_progress,
+    const std::function<bool()>& cancelled) {
+  TraceScope trace("annotate_matches_in_chunks");
+  BatchLabelingResult result{};
+  if (pattern.isEmpty()) {
+    return result;
+  }
+  QSqlQuery read_query(database);
+  QSqlQuery insert_query(database);
+  insert_query.prepare(
+      "insert or ignore into annotation (doc_id, label_id, start_char, "
+      "end_char) values (:doc, :label, :start, :end);");
+  BatchLabelingResult pending{};
+  bool in_transaction{};
+  auto commit = [&]() {
+    if (!in_transaction) {
+      return true;
+    }
+    in_transaction = false;
+    if (!traced_exec(read_query, "commit transaction;")) {
+      traced_exec(read_query, "rollback transaction;");
+      return false;
+    }
+    result.n_docs += pending.n_docs;
+    result.n_annotations += pending.n_annotations;
+    pending = BatchLabelingResult{};
+    if (on_progress) {
+      on_progress(result.n_docs);
+    }
+    return true;
+  };
+  auto last_id = std::numeric_limits<qlonglong>::min();
+  int next_idx{};
+  while (!(cancelled && cancelled())) {
+    // the texts are read before inserting, so that the read query is not
+    // active while the annotations are written
+    if (all_docs) {
+      read_query.prepare("select id, content from document_with_content "
+                         "where id > :last order by id limit :n;");
+      read_query.bindValue(":last", last_id);
+      read_query.bindValue(":n", read_block_size);
+    } else {
+      if (next_idx >= doc_ids.size()) {
+        break;
+      }
+      auto block_end = std::min(doc_ids.size(), next_idx + read_block_size);
+      QStringList ids{};
+      for (; next_idx != block_end; ++next_idx) {
+        ids << QString::number(doc_ids[next_idx]);
+      }
+      read_query.prepare(QString("select id, content from "
+                                 "document_with_content where id in (%0);")
+                             .arg(ids.join(", ")));
+    }
+    if (!traced_exec(read_query)) {
+      break;
+    }
+    QVector<QPair<int, QString>> docs{};
+    while (read_query.next()) {
+      docs << qMakePair(read_query.value(0).toInt(),
+                        content_from_sql(read_query.value(1)));
+    }
+    read_query.finish();
+    if (all_docs && docs.isEmpty()) {
+      break;
+    }
+    if (!docs.isEmpty()) {
+      last_id = docs.last().first;
+    }
+    for (const auto& doc : docs) {
+      if (cancelled && cancelled()) {
+        break;
+      }
+      LoadedDocument text{};
+      text.content = doc.second;
+      fill_surrogate_indices(text);
+      auto matches = find_matches(text.content, pattern);
+      if (!in_transaction) {
+        traced_exec(read_query, "begin transaction;");
+        in_transaction = true;
+      }
+      for (auto start : matches) {
+        insert_query.bindValue(":doc", doc.first);
+        insert_query.bindValue(":label", label_id);
+        insert_query.bindValue(":start",
+                               utf16_idx_to_code_point_idx(
+                                   text.surrogate_indices_in_qstring, start));
+        insert_query.bindValue(
+            ":end", utf16_idx_to_code_point_idx(
+                        text.surrogate_indices_in_qstring,
+                        start + pattern.size()));
+        if (!traced_exec(insert_query)) {
+          traced_exec(read_query, "rollback transaction;");
+          return result;
+        }
+        pending.n_annotations += std::max(0, insert_query.numRowsAffected());
+      }
+      ++pending.n_docs;
+      if (pending.n_annotations >= chunk_size ||
+          pending.n_docs >= max_docs_per_transaction) {
+        if (!commit()) {
+          return result;
+        }
+      }
+    }
+  }
+  commit();
+  return result;
+}
+
+BatchLabelingThread::BatchLabelingThread(
+    const QString& database_path, const QString& pattern, int label_id,
+    bool all_docs, const QList<int>& doc_ids,
+    std::function<void(int)> on_progress,
+    std::function<void(BatchLabelingResult)> on_finished)
+    : database_path_{database_path},
+      pattern_{pattern}, label_id_{label_id}, all_docs_{all_docs},
+      doc_ids_{doc_ids}, on_progress_{std::move(on_progress)},
+      on_finished_{std::move(on_finished)},
+      thread_(&BatchLabelingThread::run, this) {}
+
+BatchLabelingThread::~BatchLabelingThread() {
+  cancel();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void BatchLabelingThread::cancel() { cancel_requested_ = true; }
+
+void BatchLabelingThread::run() {
+  BatchLabelingResult result{};
+  {
+    WorkerConnection connection(database_path_, "labelbuddy_batch_labeling",
+                                WorkerConnection::Access::ReadWrite);
+    if (connection.is_open()) {
+      auto cancelled = [this]() { return cancel_requested_.load(); };
+      result = annotate_matches_in_chunks(
+          connection.database(), pattern_, label_id_, all_docs_, doc_ids_,
+          10000, on_progress_, cancelled);
+    }
+  }
+  on_finished_(result);
+}
+
+} // namespace labelbuddy
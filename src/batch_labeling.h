@@ -0,0 +1,85 @@
+#ifndef LABELBUDDY_BATCH_LABELING_H
+#define LABELBUDDY_BATCH_LABELING_H
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+#include <QList>
+#include <QSqlDatabase>
+#include <QString>
+
+/// \file
+/// Annotating all the occurrences of a pattern in many documents, possibly in
+/// a background thread.
+
+namespace labelbuddy {
+
+/// What `annotate_matches_in_chunks` did
+struct BatchLabelingResult {
+  /// documents searched, whose annotations have been committed
+  int n_docs{};
+  /// annotations inserted (existing ones are not counted)
+  int n_annotations{};
+};
+
+/// Annotate with `label_id` every occurrence of `pattern` in documents.
+
+/// Occurrences are those of `find_matches` (case-insensitive and not
+/// overlapping) and their positions are converted to unicode code points as
+/// by `utf16_idx_to_code_point_idx`. If `all_docs` is true all documents are
+/// searched and `doc_ids` is ignored. Annotations that already exist are
+/// skipped. They are inserted in transactions of about `chunk_size`
+/// annotations (the annotations of one document are always in the same
+/// transaction), or of fewer if the documents have few matches. After each
+/// commit `on_progress`, if provided, is called with the number of documents
+/// searched so far. `cancelled`, if provided, is checked regularly; what has
+/// been done before is kept. If a query fails (eg `label_id` is not a label)
+/// the current transaction is rolled back and the function stops.
+BatchLabelingResult annotate_matches_in_chunks(
+    const QSqlDatabase& database, const QString& pattern, int label_id,
+    bool all_docs, const QList<int>& doc_ids, int chunk_size = 10000,
+    const std::function<void(int)>& on_progress = nullptr,
+    const std::function<bool()>& cancelled = nullptr);
+
+/// Annotates the matches of a pattern in a background thread with its own
+/// database connection.
+
+/// The thread starts immediately (see `annotate_matches_in_chunks`).
+/// `on_progress` and `on_finished` are called *from the labeling thread*;
+/// `on_finished` is always called once, when the labeling is complete or
+/// cancelled. Models showing annotations or label counts must then read them
+/// again (eg `AnnotationsModel::invalidate_cache`).
+class BatchLabelingThread {
+public:
+  /// `database_path` is the path of the database file. It is opened in a
+  /// connection that belongs to the labeling thread.
+  BatchLabelingThread(const QString& database_path, const QString& pattern,
+                      int label_id, bool all_docs, const QList<int>& doc_ids,
+                      std::function<void(int)> on_progress,
+                      std::function<void(BatchLabelingResult)> on_finished);
+
+  /// Cancels the labeling and waits for the thread to finish
+  ~BatchLabelingThread();
+
+  /// Stop after the document being searched
+  void cancel();
+
+private:
+  void run();
+
+  QString database_path_;
+  QString pattern_;
+  int label_id_;
+  bool all_docs_;
+  QList<int> doc_ids_;
+  std::function<void(int)> on_progress_;
+  std::function<void(BatchLabelingResult)> on_finished_;
+  std::atomic<bool> cancel_requested_{};
+  // last member so that everything else is initialized when the thread starts
+  std::thread thread_;
+};
+
+} // namespace labelbuddy
+
+#endif
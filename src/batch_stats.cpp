@@ -0,0 +1,154 @@
+#include <iostream>
+
+#include <QtGlobal>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+#include "batch_stats.h"
+
+namespace labelbuddy {
+
+namespace {
+
+const char* phase_name(BatchPhase phase) {
+  switch (phase) {
+  case BatchPhase::Parse:
+    return "parse";
+  case BatchPhase::Hash:
+    return "hash";
+  case BatchPhase::Insert:
+    return "insert";
+  case BatchPhase::Commit:
+    return "commit";
+  case BatchPhase::Query:
+    return "query";
+  case BatchPhase::Serialize:
+    return "serialize";
+  }
+  return "";
+}
+
+} // namespace
+
+BatchStats::BatchStats() {
+  for (auto& phase_ns : phase_ns_) {
+    phase_ns = 0;
+  }
+  wall_timer_.start();
+}
+
+void BatchStats::add_time(BatchPhase phase,
+                          std::chrono::steady_clock::duration duration) {
+  phase_ns_[static_cast<std::size_t>(phase)] += static_cast<long long>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+}
+
+void BatchStats::add_imported(qint64 n_docs, qint64 n_annotations,
+                              qint64 n_bytes) {
+  n_imported_docs_ += n_docs;
+  n_imported_annotations_ += n_annotations;
+  n_bytes_read_ += n_bytes;
+}
+
+void BatchStats::add_exported(qint64 n_docs, qint64 n_annotations,
+                              qint64 n_bytes) {
+  n_exported_docs_ += n_docs;
+  n_exported_annotations_ += n_annotations;
+  n_bytes_written_ += n_bytes;
+}
+
+double BatchStats::seconds(BatchPhase phase) const {
+  return static_cast<double>(
+             phase_ns_[static_cast<std::size_t>(phase)].load()) /
+         1e9;
+}
+
+QJsonObject BatchStats::to_json() const {
+  auto wall_seconds = static_cast<double>(wall_timer_.nsecsElapsed()) / 1e9;
+  QJsonObject phases{};
+  for (std::size_t i = 0; i != n_phases; ++i) {
+    auto phase = static_cast<BatchPhase>(i);
+    phases[phase_name(phase)] = seconds(phase);
+  }
+  auto n_docs =
+      static_cast<double>(n_imported_docs_.load() + n_exported_docs_.load());
+  auto n_annotations = static_cast<double>(n_imported_annotations_.load() +
+                                           n_exported_annotations_.load());
+  auto n_bytes =
+      static_cast<double>(n_bytes_read_.load() + n_bytes_written_.load());
+  auto rate = [wall_seconds](double amount) {
+    return wall_seconds > 0. ? amount / wall_seconds : 0.;
+  };
+  QJsonObject stats{};
+  stats["wall_seconds"] = wall_seconds;
+  stats["phase_seconds"] = phases;
+  stats["imported_docs"] = static_cast<double>(n_imported_docs_.load());
+  stats["imported_annotations"] =
+      static_cast<double>(n_imported_annotations_.load());
+  stats["bytes_read"] = static_cast<double>(n_bytes_read_.load());
+  stats["exported_docs"] = static_cast<double>(n_exported_docs_.load());
+  stats["exported_annotations"] =
+      static_cast<double>(n_exported_annotations_.load());
+  stats["bytes_written"] = static_cast<double>(n_bytes_written_.load());
+  stats["docs_per_second"] = rate(n_docs);
+  stats["annotations_per_second"] = rate(n_annotations);
+  stats["bytes_per_second"] = rate(n_bytes);
+  auto rss = peak_rss_bytes();
+  stats["peak_rss"] = rss < 0 ? QJsonValue() : static_cast<double>(rss);
+  return stats;
+}
+
+PhaseTimer::PhaseTimer(BatchStats* stats, BatchPhase phase)
+    : stats_{stats}, phase_{phase} {
+  if (stats_ != nullptr) {
+    start_ = std::chrono::steady_clock::now();
+  }
+}
+
+PhaseTimer::~PhaseTimer() {
+  if (stats_ != nullptr) {
+    stats_->add_time(phase_, std::chrono::steady_clock::now() - start_);
+  }
+}
+
+qint64 peak_rss_bytes() {
+#ifdef Q_OS_UNIX
+  struct rusage usage {};
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return -1;
+  }
+#ifdef Q_OS_DARWIN
+  // bytes on macOS, kilobytes elsewhere
+  return static_cast<qint64>(usage.ru_maxrss);
+#else
+  return static_cast<qint64>(usage.ru_maxrss) * 1024;
+#endif
+#else
+  return -1;
+#endif
+}
+
+ConsoleProgress::ConsoleProgress(const std::string& prefix,
+                                 const std::string& suffix, int interval_ms)
+    : prefix_{prefix}, suffix_{suffix}, interval_ms_{interval_ms} {}
+
+void ConsoleProgress::update(int n) {
+  if (timer_.isValid() && timer_.elapsed() < interval_ms_) {
+    return;
+  }
+  print(n);
+  timer_.start();
+}
+
+void ConsoleProgress::finish(int n) {
+  print(n);
+  std::cout << std::endl;
+}
+
+void ConsoleProgress::print(int n) {
+  std::cout << prefix_ << n << suffix_ << "\r" << std::flush;
+}
+
+} // namespace labelbuddy
@@ -0,0 +1,101 @@
+#ifndef LABELBUDDY_BATCH_STATS_H
+#define LABELBUDDY_BATCH_STATS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include <QElapsedTimer>
+#include <QJsonObject>
+
+/// \file
+/// Timing and throughput measurements for batch imports and exports.
+
+namespace labelbuddy {
+
+/// The steps of an import or export whose duration is measured
+enum class BatchPhase { Parse = 0, Hash, Insert, Commit, Query, Serialize };
+
+/// Time spent in each phase and amount of data processed by a batch job.
+
+/// Phases can be measured in several threads at the same time (eg reading,
+/// hashing and inserting during an import), so their durations add up to
+/// more than the wall-clock time. All methods are thread-safe.
+class BatchStats {
+public:
+  BatchStats();
+
+  void add_time(BatchPhase phase, std::chrono::steady_clock::duration duration);
+  void add_imported(qint64 n_docs, qint64 n_annotations, qint64 n_bytes);
+  void add_exported(qint64 n_docs, qint64 n_annotations, qint64 n_bytes);
+
+  /// Seconds spent in `phase` so far
+  double seconds(BatchPhase phase) const;
+
+  /// Durations in seconds, counts and rates since construction.
+
+  /// Rates are computed with the wall-clock time since construction;
+  /// `peak_rss` is `null` where it is not available.
+  QJsonObject to_json() const;
+
+private:
+  static constexpr std::size_t n_phases{6};
+
+  QElapsedTimer wall_timer_{};
+  std::array<std::atomic<long long>, n_phases> phase_ns_;
+  std::atomic<long long> n_imported_docs_{};
+  std::atomic<long long> n_imported_annotations_{};
+  std::atomic<long long> n_bytes_read_{};
+  std::atomic<long long> n_exported_docs_{};
+  std::atomic<long long> n_exported_annotations_{};
+  std::atomic<long long> n_bytes_written_{};
+};
+
+/// Adds the time elapsed between its construction and destruction to a phase
+
+/// Does nothing if `stats` is `nullptr`.
+class PhaseTimer {
+public:
+  PhaseTimer(BatchStats* stats, BatchPhase phase);
+  ~PhaseTimer();
+
+  PhaseTimer(const PhaseTimer&) = delete;
+  PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+private:
+  BatchStats* stats_;
+  BatchPhase phase_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+/// Peak resident set size of the process in bytes, or -1 if unknown
+qint64 peak_rss_bytes();
+
+/// Prints "<prefix><n><suffix>" on one console line, updated in place.
+
+/// `update` is called for each document but only prints if `interval_ms` have
+/// passed since the last time, so that printing does not slow down the
+/// loops that report their progress.
+class ConsoleProgress {
+public:
+  ConsoleProgress(const std::string& prefix, const std::string& suffix,
+                  int interval_ms = 200);
+
+  void update(int n);
+
+  /// Print the final count and end the line
+  void finish(int n);
+
+private:
+  void print(int n);
+
+  std::string prefix_;
+  std::string suffix_;
+  int interval_ms_;
+  QElapsedTimer timer_{};
+};
+
+} // namespace labelbuddy
+
+#endif
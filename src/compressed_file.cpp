@@ -0,0 +1,470 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include <QByteArray>
+#include <QFileInfo>
+
+#include <zlib.h>
+
+#ifdef LABELBUDDY_USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "compressed_file.h"
+
+namespace labelbuddy {
+
+Compression compression_from_path(const QString& file_path) {
+  auto suffix = QFileInfo(file_path).suffix();
+  if (suffix == "gz") {
+    return Compression::Gzip;
+  }
+  if (suffix == "zst") {
+    return Compression::Zstd;
+  }
+  return Compression::None;
+}
+
+bool is_compression_supported(Compression compression) {
+#ifdef LABELBUDDY_USE_ZSTD
+  (void)compression;
+  return true;
+#else
+  return compression != Compression::Zstd;
+#endif
+}
+
+QString compression_suffix(Compression compression) {
+  switch (compression) {
+  case Compression::Gzip:
+    return "gz";
+  case Compression::Zstd:
+    return "zst";
+  default:
+    return "";
+  }
+}
+
+QString strip_compression_suffix(const QString& file_path) {
+  auto compression = compression_from_path(file_path);
+  if (compression == Compression::None) {
+    return file_path;
+  }
+  auto suffix_size = compression_suffix(compression).size() + 1;
+  return file_path.left(file_path.size() - suffix_size);
+}
+
+/// Streaming (de)compression between the file on disk and the device's data
+class CompressedFile::Codec {
+public:
+  virtual ~Codec() {}
+
+  /// False if the (de)compression context could not be initialized
+  virtual bool is_valid() const = 0;
+
+  /// Decompress at most `max_size` bytes from `in`; -1 on error
+  virtual qint64 decompress(QFile& in, char* out, qint64 max_size) = 0;
+
+  /// Compress `size` bytes and write the output to `out`
+  virtual bool compress(QFile& out, const char* data, qint64 size) = 0;
+
+  /// Write the end of the compressed stream
+  virtual bool finish(QFile& out) = 0;
+
+  /// When decompressing, whether the whole file has been decompressed
+  virtual bool finished() const = 0;
+
+protected:
+  static const int chunk_size_{1 << 16};
+};
+
+namespace {
+
+class GzipCodec : public CompressedFile::Codec {
+public:
+  explicit GzipCodec(bool compressing)
+      : compressing_{compressing}, output_(chunk_size_, '\0') {
+    std::memset(&stream_, 0, sizeof(stream_));
+    if (compressing_) {
+      // 15 + 16: maximum window size and gzip header
+      valid_ = deflateInit2(&stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                            15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    } else {
+      // 15 + 32: maximum window size and automatic gzip or zlib header
+      valid_ = inflateInit2(&stream_, 15 + 32) == Z_OK;
+    }
+  }
+
+  ~GzipCodec() override {
+    if (!valid_) {
+      return;
+    }
+    if (compressing_) {
+      deflateEnd(&stream_);
+    } else {
+      inflateEnd(&stream_);
+    }
+  }
+
+  bool is_valid() const override { return valid_; }
+
+  bool finished() const override { return finished_; }
+
+  qint64 decompress(QFile& in, char* out, qint64 max_size) override {
+    stream_.next_out = reinterpret_cast<Bytef*>(out);
+    stream_.avail_out = static_cast<uInt>(max_size);
+    while (stream_.avail_out != 0 && !finished_) {
+      if (stream_.avail_in == 0 && !input_ended_) {
+        input_ = in.read(chunk_size_);
+        input_ended_ = input_.isEmpty();
+        stream_.next_in = reinterpret_cast<Bytef*>(input_.data());
+        stream_.avail_in = static_cast<uInt>(input_.size());
+      }
+      auto status = inflate(&stream_, Z_NO_FLUSH);
+      if (status == Z_STREAM_END) {
+        // several gzip members can be concatenated
+        if (stream_.avail_in == 0 && (input_ended_ || in.atEnd())) {
+          finished_ = true;
+        } else if (inflateReset(&stream_) != Z_OK) {
+          return -1;
+        }
+      } else if (status == Z_BUF_ERROR) {
+        // no progress possible: the file is truncated if its end is reached
+        // before the end of the stream, otherwise more input is read at the
+        // next iteration
+        if (input_ended_) {
+          return -1;
+        }
+      } else if (status != Z_OK) {
+        return -1;
+      }
+    }
+    return max_size - static_cast<qint64>(stream_.avail_out);
+  }
+
+  bool compress(QFile& out, const char* data, qint64 size) override {
+    return deflate_to(out, data, size, Z_NO_FLUSH);
+  }
+
+  bool finish(QFile& out) override {
+    return deflate_to(out, nullptr, 0, Z_FINISH);
+  }
+
+private:
+  bool deflate_to(QFile& out, const char* data, qint64 size, int flush) {
+    stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream_.avail_in = static_cast<uInt>(size);
+    int status{};
+    do {
+      stream_.next_out = reinterpret_cast<Bytef*>(output_.data());
+      stream_.avail_out = static_cast<uInt>(output_.size());
+      status = deflate(&stream_, flush);
+      if (status == Z_STREAM_ERROR) {
+        return false;
+      }
+      auto n_bytes = output_.size() - static_cast<int>(stream_.avail_out);
+      if (out.write(output_.constData(), n_bytes) != n_bytes) {
+        return false;
+      }
+    } while (flush == Z_FINISH ? status != Z_STREAM_END
+                               : stream_.avail_out == 0);
+    return true;
+  }
+
+  bool compressing_;
+  bool valid_{};
+  bool input_ended_{};
+  bool finished_{};
+  z_stream stream_;
+  QByteArray input_{};
+  QByteArray output_;
+};
+
+#ifdef LABELBUDDY_USE_ZSTD
+
+class ZstdCodec : public CompressedFile::Codec {
+public:
+  explicit ZstdCodec(bool compressing) : output_(chunk_size_, '\0') {
+    if (compressing) {
+      cstream_ = ZSTD_createCStream();
+      valid_ = cstream_ != nullptr &&
+               !ZSTD_isError(ZSTD_initCStream(cstream_, 3));
+    } else {
+      dstream_ = ZSTD_createDStream();
+      valid_ = dstream_ != nullptr && !ZSTD_isError(ZSTD_initDStream(dstream_));
+    }
+  }
+
+  ~ZstdCodec() override {
+    ZSTD_freeCStream(cstream_);
+    ZSTD_freeDStream(dstream_);
+  }
+
+  bool is_valid() const override { return valid_; }
+
+  bool finished() const override { return finished_; }
+
+  qint64 decompress(QFile& in, char* out, qint64 max_size) override {
+    ZSTD_outBuffer out_buffer{out, static_cast<std::size_t>(max_size), 0};
+    while (out_buffer.pos < out_buffer.size && !finished_) {
+      if (in_buffer_.pos == in_buffer_.size && !input_ended_) {
+        input_ = in.read(chunk_size_);
+        input_ended_ = input_.isEmpty();
+        in_buffer_ = {input_.constData(),
+                      static_cast<std::size_t>(input_.size()), 0};
+      }
+      auto out_pos = out_buffer.pos;
+      // frames are decoded one after the other if there are several
+      auto status = ZSTD_decompressStream(dstream_, &out_buffer, &in_buffer_);
+      if (ZSTD_isError(status)) {
+        return -1;
+      }
+      if (input_ended_ && in_buffer_.pos == in_buffer_.size &&
+          out_buffer.pos == out_pos) {
+        // a non-zero status means the last frame is incomplete
+        if (!frame_complete_) {
+          return -1;
+        }
+        finished_ = true;
+      }
+      frame_complete_ = status == 0;
+    }
+    return static_cast<qint64>(out_buffer.pos);
+  }
+
+  bool compress(QFile& out, const char* data, qint64 size) override {
+    ZSTD_inBuffer in_buffer{data, static_cast<std::size_t>(size), 0};
+    while (in_buffer.pos < in_buffer.size) {
+      ZSTD_outBuffer out_buffer{output_.data(),
+                                static_cast<std::size_t>(output_.size()), 0};
+      auto status = ZSTD_compressStream(cstream_, &out_buffer, &in_buffer);
+      if (ZSTD_isError(status)) {
+        return false;
+      }
+      if (!write_output(out, out_buffer)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool finish(QFile& out) override {
+    std::size_t remaining{};
+    do {
+      ZSTD_outBuffer out_buffer{output_.data(),
+                                static_cast<std::size_t>(output_.size()), 0};
+      remaining = ZSTD_endStream(cstream_, &out_buffer);
+      if (ZSTD_isError(remaining) || !write_output(out, out_buffer)) {
+        return false;
+      }
+    } while (remaining != 0);
+    return true;
+  }
+
+private:
+  bool write_output(QFile& out, const ZSTD_outBuffer& out_buffer) {
+    auto n_bytes = static_cast<qint64>(out_buffer.pos);
+    return out.write(output_.constData(), n_bytes) == n_bytes;
+  }
+
+  ZSTD_CStream* cstream_{nullptr};
+  ZSTD_DStream* dstream_{nullptr};
+  bool valid_{};
+  bool input_ended_{};
+  bool finished_{};
+  /// the last call to `ZSTD_decompressStream` completed a frame
+  bool frame_complete_{};
+  QByteArray input_{};
+  ZSTD_inBuffer in_buffer_{nullptr, 0, 0};
+  QByteArray output_;
+};
+
+#endif
+
+std::unique_ptr<CompressedFile::Codec> make_codec(Compression compression,
+                                                  bool compressing) {
+  std::unique_ptr<CompressedFile::Codec> codec{nullptr};
+  switch (compression) {
+  case Compression::Gzip:
+    codec.reset(new GzipCodec(compressing));
+    break;
+#ifdef LABELBUDDY_USE_ZSTD
+  case Compression::Zstd:
+    codec.reset(new ZstdCodec(compressing));
+    break;
+#endif
+  default:
+    break;
+  }
+  return codec;
+}
+
+// the codecs take sizes as 32-bit integers
+const qint64 max_codec_call_size{1 << 20};
+
+} // namespace
+
+CompressedFile::CompressedFile(const QString& file_path,
+                               Compression compression, QObject* parent)
+    : QIODevice(parent), file_(file_path), compression_{compression} {}
+
+CompressedFile::~CompressedFile() { close(); }
+
+bool CompressedFile::open(OpenMode mode) {
+  if (isOpen() || (mode & ReadWrite) == ReadWrite || (mode & Append)) {
+    return false;
+  }
+  bool compressing = (mode & WriteOnly) != 0;
+  codec_ = make_codec(compression_, compressing);
+  decompression_failed_ = false;
+  if (codec_ == nullptr || !codec_->is_valid()) {
+    setErrorString("Compression format not supported.");
+    codec_.reset();
+    return false;
+  }
+  if (!file_.open(compressing ? WriteOnly : ReadOnly)) {
+    setErrorString(file_.errorString());
+    codec_.reset();
+    return false;
+  }
+  return QIODevice::open(mode);
+}
+
+void CompressedFile::close() {
+  if (!isOpen()) {
+    return;
+  }
+  if (openMode() & WriteOnly) {
+    codec_->finish(file_);
+  }
+  QIODevice::close();
+  file_.close();
+  codec_.reset();
+}
+
+bool CompressedFile::isSequential() const { return true; }
+
+bool CompressedFile::atEnd() const {
+  // the base class only knows about data that has already been decompressed
+  // nothing more can be read after a decompression error
+  return !isOpen() ||
+         (QIODevice::bytesAvailable() == 0 &&
+          (codec_ == nullptr || codec_->finished() || decompression_failed_));
+}
+
+bool CompressedFile::decompression_failed() const {
+  return decompression_failed_;
+}
+
+qint64 CompressedFile::compressed_pos() const { return file_.pos(); }
+
+qint64 CompressedFile::compressed_size() const { return file_.size(); }
+
+qint64 CompressedFile::readData(char* data, qint64 max_size) {
+  auto n_bytes = codec_->decompress(file_, data,
+                                    std::min(max_size, max_codec_call_size));
+  if (n_bytes < 0) {
+    decompression_failed_ = true;
+    setErrorString("Could not decompress file.");
+  }
+  return n_bytes;
+}
+
+qint64 CompressedFile::writeData(const char* data, qint64 size) {
+  qint64 written{};
+  while (written < size) {
+    auto n_bytes = std::min(size - written, max_codec_call_size);
+    if (!codec_->compress(file_, data + written, n_bytes)) {
+      setErrorString("Could not write compressed file.");
+      return -1;
+    }
+    written += n_bytes;
+  }
+  return written;
+}
+
+std::unique_ptr<QIODevice> make_file_device(const QString& file_path) {
+  auto compression = compression_from_path(file_path);
+  if (compression == Compression::None) {
+    return std::unique_ptr<QIODevice>{new QFile(file_path)};
+  }
+  return std::unique_ptr<QIODevice>{new CompressedFile(file_path, compression)};
+}
+
+qint64 file_device_pos(const QIODevice& device) {
+  auto compressed = qobject_cast<const CompressedFile*>(&device);
+  if (compressed != nullptr) {
+    return compressed->compressed_pos();
+  }
+  return device.pos();
+}
+
+qint64 file_device_size(const QIODevice& device) {
+  auto compressed = qobject_cast<const CompressedFile*>(&device);
+  if (compressed != nullptr) {
+    return compressed->compressed_size();
+  }
+  return device.size();
+}
+
+namespace {
+
+/// whether `data` starts with the magic number of a zstd frame
+bool is_zstd_frame(const QByteArray& data) {
+  // 0xFD2FB528, little-endian
+  return data.startsWith(QByteArray("\x28\xb5\x2f\xfd", 4));
+}
+
+} // namespace
+
+QByteArray compress_block(const QByteArray& data) {
+#ifdef LABELBUDDY_USE_ZSTD
+  QByteArray compressed{};
+  compressed.resize(static_cast<int>(
+      ZSTD_compressBound(static_cast<std::size_t>(data.size()))));
+  auto size = ZSTD_compress(
+      compressed.data(), static_cast<std::size_t>(compressed.size()),
+      data.constData(), static_cast<std::size_t>(data.size()), 3);
+  if (ZSTD_isError(size)) {
+    return QByteArray();
+  }
+  compressed.resize(static_cast<int>(size));
+  return compressed;
+#else
+  return qCompress(data);
+#endif
+}
+
+QByteArray uncompress_block(const QByteArray& data) {
+  // qCompress starts with the 32-bit size of the data, which is only the zstd
+  // magic number for a size of exactly 0x28b52ffd bytes: the zstd decoding
+  // falls back to qUncompress
+  if (!is_zstd_frame(data)) {
+    return qUncompress(data);
+  }
+#ifdef LABELBUDDY_USE_ZSTD
+  auto content_size = ZSTD_getFrameContentSize(
+      data.constData(), static_cast<std::size_t>(data.size()));
+  // frames made by `compress_block` always record their size
+  if (content_size == ZSTD_CONTENTSIZE_UNKNOWN ||
+      content_size == ZSTD_CONTENTSIZE_ERROR ||
+      content_size > static_cast<unsigned long long>(
+                         std::numeric_limits<int>::max())) {
+    return qUncompress(data);
+  }
+  QByteArray uncompressed{};
+  uncompressed.resize(static_cast<int>(content_size));
+  auto size = ZSTD_decompress(
+      uncompressed.data(), static_cast<std::size_t>(uncompressed.size()),
+      data.constData(), static_cast<std::size_t>(data.size()));
+  if (ZSTD_isError(size) || size != content_size) {
+    return qUncompress(data);
+  }
+  return uncompressed;
+#else
+  return QByteArray();
+#endif
+}
+
+} // namespace labelbuddy
@@ -0,0 +1,102 @@
+#ifndef LABELBUDDY_COMPRESSED_FILE_H
+#define LABELBUDDY_COMPRESSED_FILE_H
+
+#include <memory>
+
+#include <QByteArray>
+#include <QFile>
+#include <QIODevice>
+#include <QString>
+
+/// \file
+/// Transparent gzip and zstd compression of imported and exported files.
+
+namespace labelbuddy {
+
+enum class Compression { None, Gzip, Zstd };
+
+/// Compression indicated by the last suffix of a path (`.gz` or `.zst`)
+Compression compression_from_path(const QString& file_path);
+
+/// False for zstd if labelbuddy was built without it
+bool is_compression_supported(Compression compression);
+
+/// The suffix used for a kind of compression: "gz", "zst" or ""
+QString compression_suffix(Compression compression);
+
+/// The path without its compression suffix, if it has one.
+
+/// `docs.jsonl.gz` becomes `docs.jsonl`; other paths are returned unchanged.
+QString strip_compression_suffix(const QString& file_path);
+
+/// A sequential device that decompresses a file when reading it or compresses
+/// the data written to it.
+
+/// Opening in `ReadWrite` or `Append` mode fails. When reading, concatenated
+/// gzip members or zstd frames are decompressed as a single stream. The
+/// compressed stream is completed when the device is closed.
+class CompressedFile : public QIODevice {
+  Q_OBJECT
+
+public:
+  CompressedFile(const QString& file_path, Compression compression,
+                 QObject* parent = nullptr);
+  ~CompressedFile() override;
+
+  bool open(OpenMode mode) override;
+  void close() override;
+  bool isSequential() const override;
+  bool atEnd() const override;
+
+  /// Current position in the compressed file on disk
+  qint64 compressed_pos() const;
+
+  /// Size of the compressed file on disk
+  qint64 compressed_size() const;
+
+  /// The data could not be decompressed, eg because the file is truncated.
+
+  /// Reading then fails and `atEnd` becomes true.
+  bool decompression_failed() const;
+
+  class Codec;
+
+protected:
+  qint64 readData(char* data, qint64 max_size) override;
+  qint64 writeData(const char* data, qint64 size) override;
+
+private:
+  QFile file_;
+  Compression compression_;
+  std::unique_ptr<Codec> codec_{nullptr};
+  bool decompression_failed_{};
+};
+
+/// A `QFile`, or a `CompressedFile` if the path has a compression suffix.
+
+/// The returned device is not open.
+std::unique_ptr<QIODevice> make_file_device(const QString& file_path);
+
+/// Position in the file on disk -- in the compressed data for a
+/// `CompressedFile`.
+qint64 file_device_pos(const QIODevice& device);
+
+/// Size of the file on disk -- of the compressed data for a `CompressedFile`.
+qint64 file_device_size(const QIODevice& device);
+
+/// Compress `data` in memory, as a single block.
+
+/// The result is a zstd frame, or the output of `qCompress` (zlib) if
+/// labelbuddy was built without zstd.
+QByteArray compress_block(const QByteArray& data);
+
+/// Uncompress the result of `compress_block`.
+
+/// The format is recognized from the data. Returns a null array if it cannot
+/// be uncompressed, eg if it is a zstd frame and labelbuddy was built without
+/// zstd.
+QByteArray uncompress_block(const QByteArray& data);
+
+} // namespace labelbuddy
+
+#endif
@@ -1,4 +1,6 @@
 #include <cassert>
+#include <cstdint>
+#include <cstring>
 
 #include <QFile>
 
@@ -6,68 +8,55 @@
 
 namespace labelbuddy {
 
-CsvReader::CsvReader(QTextStream* in_stream) : in_stream_{in_stream} {
-  assert(in_stream_->device() != nullptr);
-  assert(!(in_stream_->device()->openMode() & QIODevice::Text));
-  in_stream->setCodec("UTF-8");
-}
+namespace {
 
-void CsvReader::shift_buffer() {
-  if (data_start_ == data_end_) {
-    data_start_ = 0;
-    data_end_ = 0;
-    return;
-  }
-  assert(data_end_ == data_start_ + 1);
-  buffer_[0] = buffer_[data_start_];
-  data_start_ = 0;
-  data_end_ = 1;
+/// whether one of the 4 utf-16 code units packed in `lanes` is 0
+bool has_zero_lane(std::uint64_t lanes) {
+  return ((lanes - 0x0001000100010001ULL) & ~lanes & 0x8000800080008000ULL) !=
+         0;
 }
 
-bool CsvReader::read_char() {
-  if (in_stream_->atEnd()) {
-    return false;
-  }
-  if (data_end_ == buffer_size_) {
-    shift_buffer();
-  }
-  *in_stream_ >> buffer_[data_end_];
-  ++data_end_;
-  return true;
+bool is_special_char(ushort code_unit) {
+  return code_unit == comma.unicode() || code_unit == lf.unicode() ||
+         code_unit == cr.unicode() || code_unit == dquote.unicode();
 }
 
-bool CsvReader::read_token() {
-  assert(data_size() <= 1);
-  if (!data_size()) {
-    if (!read_char()) {
-      current_char_ = '\0';
-      current_token_ = CsvToken::Empty;
-      return false;
+/// position of the first comma, quote, cr or lf in [`pos`, `end`), or `end`
+int find_special_char(const ushort* data, int pos, int end) {
+  const std::uint64_t commas{0x002c002c002c002cULL};
+  const std::uint64_t lfs{0x000a000a000a000aULL};
+  const std::uint64_t crs{0x000d000d000d000dULL};
+  const std::uint64_t dquotes{0x0022002200220022ULL};
+  while (end - pos >= 4) {
+    std::uint64_t block{};
+    std::memcpy(&block, data + pos, sizeof(block));
+    if (has_zero_lane(block ^ commas) || has_zero_lane(block ^ lfs) ||
+        has_zero_lane(block ^ crs) || has_zero_lane(block ^ dquotes)) {
+      break;
     }
+    pos += 4;
   }
-  assert(data_size() == 1);
-  current_char_ = buffer_[data_start_];
-  current_token_ = CsvToken::SingleChar;
-  ++data_start_;
-  if (!found_prefix()) {
-    return true;
+  while (pos != end && !is_special_char(data[pos])) {
+    ++pos;
   }
-  if (!read_char()) {
-    return true;
-  }
-  assert(data_size() == 1);
-  if (current_char_ == dquote && buffer_[data_start_] == dquote) {
-    current_token_ = CsvToken::Double_dquote;
-    ++data_start_;
-    return true;
-  }
-  if (current_char_ == cr && buffer_[data_start_] == lf) {
-    current_token_ = CsvToken::Crlf;
-    current_char_ = lf;
-    ++data_start_;
+  return pos;
+}
+
+} // namespace
+
+CsvReader::CsvReader(QTextStream* in_stream) : in_stream_{in_stream} {
+  assert(in_stream_->device() != nullptr);
+  assert(!(in_stream_->device()->openMode() & QIODevice::Text));
+  in_stream->setCodec("UTF-8");
+}
+
+bool CsvReader::fill_buffer() {
+  if (pos_ < buffer_.size()) {
     return true;
   }
-  return true;
+  buffer_ = in_stream_->read(block_size_);
+  pos_ = 0;
+  return !buffer_.isEmpty();
 }
 
 bool CsvReader::at_end() const { return at_data_end() || found_error_; }
@@ -80,53 +69,27 @@ bool CsvReader::at_record_end() const {
 bool CsvReader::found_error() const { return found_error_; }
 
 QString CsvReader::read_field() {
-  current_field_.resize(0);
-  quoted_ = false;
-  if (!read_token()) {
-    check_field_ending();
-    return current_field_;
-  }
-  if (current_char_ == lf || current_char_ == comma) {
-    check_field_ending();
-    return current_field_;
-
-  } else if (current_char_ == dquote) {
-    read_quoted_field();
-    return current_field_;
-  } else {
-    current_field_.append(current_char_);
-    read_unquoted_field();
-    return current_field_;
-  }
-}
-
-void CsvReader::check_field_ending() {
-  switch (current_token_) {
-  case CsvToken::Empty:
-    at_record_end_ = true;
-    found_error_ = false;
-    return;
-  case CsvToken::Crlf:
-    at_record_end_ = true;
-    found_error_ = false;
+  read_field(current_field_);
+  return current_field_;
+}
+
+void CsvReader::read_field(QString& field) {
+  field.resize(0);
+  if (!fill_buffer()) {
+    set_field_end(true);
     return;
-  case CsvToken::SingleChar:
-    if (current_char_ == comma) {
-      at_record_end_ = false;
-      found_error_ = false;
-      return;
-    } else if (current_char_ == lf) {
-      at_record_end_ = true;
-      found_error_ = false;
-      return;
-    } else {
-      set_found_error();
-      return;
-    }
-  default:
-    set_found_error();
+  }
+  if (buffer_.at(pos_) == dquote) {
+    ++pos_;
+    read_quoted_field(field);
     return;
   }
+  read_unquoted_field(field);
+}
+
+void CsvReader::set_field_end(bool is_record_end) {
+  at_record_end_ = is_record_end;
+  found_error_ = false;
 }
 
 void CsvReader::set_found_error() {
@@ -134,39 +97,83 @@ void CsvReader::set_found_error() {
   found_error_ = true;
 }
 
-void CsvReader::read_quoted_field() {
-  quoted_ = true;
-  while (read_token()) {
-    assert(current_token_ == CsvToken::Double_dquote ||
-           current_token_ == CsvToken::SingleChar);
-    if (current_char_ == dquote && current_token_ == CsvToken::SingleChar) {
-      quoted_ = false;
-      read_token();
-      check_field_ending();
-      return;
-    } else {
-      current_field_.append(current_char_);
+void CsvReader::read_field_ending() {
+  if (!fill_buffer()) {
+    set_field_end(true);
+    return;
+  }
+  auto next_char = buffer_.at(pos_);
+  ++pos_;
+  if (next_char == comma) {
+    set_field_end(false);
+    return;
+  }
+  if (next_char == lf) {
+    set_field_end(true);
+    return;
+  }
+  if (next_char == cr && fill_buffer() && buffer_.at(pos_) == lf) {
+    ++pos_;
+    set_field_end(true);
+    return;
+  }
+  set_found_error();
+}
+
+void CsvReader::read_quoted_field(QString& field) {
+  while (fill_buffer()) {
+    auto quote = buffer_.indexOf(dquote, pos_);
+    if (quote == -1) {
+      field.append(buffer_.constData() + pos_, buffer_.size() - pos_);
+      pos_ = buffer_.size();
+      continue;
+    }
+    field.append(buffer_.constData() + pos_, quote - pos_);
+    pos_ = quote + 1;
+    if (fill_buffer() && buffer_.at(pos_) == dquote) {
+      // escaped quote
+      field.append(dquote);
+      ++pos_;
+      continue;
     }
+    read_field_ending();
+    return;
   }
   // arrived at the end of stream without finding closing quote
   set_found_error();
 }
 
-void CsvReader::read_unquoted_field() {
-  quoted_ = false;
-  while (read_token()) {
-    assert(current_token_ != CsvToken::Empty);
-    if (current_char_ == dquote) {
+void CsvReader::read_unquoted_field(QString& field) {
+  while (fill_buffer()) {
+    auto special = find_special_char(buffer_.utf16(), pos_, buffer_.size());
+    field.append(buffer_.constData() + pos_, special - pos_);
+    pos_ = special;
+    if (pos_ == buffer_.size()) {
+      continue;
+    }
+    auto special_char = buffer_.at(pos_);
+    ++pos_;
+    if (special_char == dquote) {
       set_found_error();
       return;
-    } else if (current_char_ == comma || current_char_ == lf) {
-      check_field_ending();
+    }
+    if (special_char == comma) {
+      set_field_end(false);
+      return;
+    }
+    if (special_char == lf) {
+      set_field_end(true);
       return;
-    } else {
-      current_field_.append(current_char_);
     }
+    // a cr is part of the field unless it is followed by lf
+    if (fill_buffer() && buffer_.at(pos_) == lf) {
+      ++pos_;
+      set_field_end(true);
+      return;
+    }
+    field.append(cr);
   }
-  check_field_ending();
+  set_field_end(true);
 }
 
 QList<QString> CsvReader::read_record() {
@@ -182,28 +189,51 @@ QList<QString> CsvReader::read_record() {
 
 CsvMapReader::CsvMapReader(QTextStream* in_stream) : reader_{in_stream} {
   header_ = reader_.read_record();
+  fields_.resize(header_.size());
 }
 bool CsvMapReader::at_end() const { return reader_.at_end(); }
 bool CsvMapReader::found_error() const { return reader_.found_error(); }
 
 const QList<QString>& CsvMapReader::header() const { return header_; }
 
-QMap<QString, QString> CsvMapReader::read_record() {
-  QMap<QString, QString> record{};
+void CsvMapReader::read_fields() {
+  n_fields_ = 0;
   if (at_end()) {
-    return record;
+    return;
   }
-  int i{};
+  QString discarded{};
   do {
-    if (i < header_.size() && !record.contains(header_[i])) {
-      record[header_[i]] = reader_.read_field();
+    if (n_fields_ < fields_.size()) {
+      reader_.read_field(fields_[n_fields_]);
+      ++n_fields_;
     } else {
-      // discard fields beyond last header or that correspond to a duplicate
-      // column name
-      reader_.read_field();
+      // discard fields beyond last header
+      reader_.read_field(discarded);
     }
-    ++i;
   } while (!reader_.at_record_end());
+}
+
+int CsvMapReader::column_index(const QString& name) const {
+  return header_.indexOf(name);
+}
+
+bool CsvMapReader::has_field(int column) const {
+  return column >= 0 && column < n_fields_;
+}
+
+QString CsvMapReader::field(int column) const {
+  return has_field(column) ? fields_[column] : QString();
+}
+
+QMap<QString, QString> CsvMapReader::read_record() {
+  QMap<QString, QString> record{};
+  read_fields();
+  for (int i = 0; i != n_fields_; ++i) {
+    // for a duplicate column name the first one is used
+    if (!record.contains(header_[i])) {
+      record[header_[i]] = fields_[i];
+    }
+  }
   return record;
 }
 
@@ -6,6 +6,7 @@
 #include <QMap>
 #include <QString>
 #include <QTextStream>
+#include <QVector>
 
 namespace labelbuddy {
 
@@ -28,6 +29,9 @@ public:
   QList<QString> read_record();
   QString read_field();
 
+  /// Read the next field into `field`, reusing its storage
+  void read_field(QString& field);
+
   bool at_end() const;
   bool at_record_end() const;
 
@@ -39,36 +43,30 @@ private:
   bool at_record_end_{};
   bool found_error_{};
   QString current_field_{};
-  bool quoted_{};
 
-  void read_quoted_field();
-  void read_unquoted_field();
-  void check_field_ending();
-  void set_found_error();
+  void read_quoted_field(QString& field);
+  void read_unquoted_field(QString& field);
 
-  // reading tokens from the stream
+  /// read what follows a quoted field's closing quote
+  void read_field_ending();
+  void set_field_end(bool is_record_end);
+  void set_found_error();
 
-  enum class CsvToken { Empty, SingleChar, Crlf, Double_dquote };
+  // reading blocks from the stream
 
-  CsvToken current_token_{};
-  QChar current_char_{};
+  // the text is decoded in large blocks, fields are appended to by runs of
+  // characters found with `QString::indexOf` or a scan for special characters
+  // 4 utf-16 code units at a time
   QTextStream* in_stream_;
-  static constexpr int buffer_size_ = 32;
-  QChar buffer_[buffer_size_]{};
-  int data_start_{};
-  int data_end_{};
-
-  inline bool found_prefix() const {
-    return (quoted_ && current_char_ == dquote) ||
-           (!quoted_ && current_char_ == cr);
-  }
-  bool read_token();
+  static constexpr int block_size_ = 1 << 16;
+  QString buffer_{};
+  int pos_{};
+
+  /// make sure there is data at `pos_`; false if the stream is exhausted
+  bool fill_buffer();
   bool at_data_end() const {
-    return (data_start_ == data_end_) && in_stream_->atEnd();
+    return pos_ == buffer_.size() && in_stream_->atEnd();
   }
-  bool read_char();
-  void shift_buffer();
-  inline int data_size() const { return data_end_ - data_start_; }
 };
 
 /// Read records from a csv and return them as a QMap
@@ -77,6 +75,9 @@ private:
 /// record are the column names. if columns have duplicate names the first one
 /// is used. If a record has more fields than the header the extra fields are
 /// skipped.
+///
+/// To avoid building a map for each record, `read_fields` reads the next record
+/// into a vector indexed like the header, which is reused for every record.
 class CsvMapReader {
 
 public:
@@ -87,9 +88,27 @@ public:
   bool at_end() const;
   bool found_error() const;
 
+  /// Read the next record; its fields are then accessed with `field`
+  void read_fields();
+
+  /// Position of the first column with this name in the header, or -1
+  int column_index(const QString& name) const;
+
+  /// Whether the last record read by `read_fields` has a field for `column`
+
+  /// Records can be shorter than the header. Returns `false` if `column` is
+  /// -1.
+  bool has_field(int column) const;
+
+  /// A field of the last record read by `read_fields`, or a null string if it
+  /// does not have one for `column`
+  QString field(int column) const;
+
 private:
   CsvReader reader_;
   QList<QString> header_{};
+  QVector<QString> fields_{};
+  int n_fields_{};
 };
 
 /// write rfc4180 csv, excel-style (fields quoted only when necessary)
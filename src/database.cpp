@@ -1,23 +1,38 @@
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <future>
 #include <iostream>
+#include <limits>
 #include <memory>
 
+#include <QBuffer>
 #include <QCryptographicHash>
+#include <QDateTime>
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
 #include <QIODevice>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QPair>
 #include <QSettings>
 #include <QSqlError>
 #include <QSqlQuery>
 #include <QStandardPaths>
 #include <QString>
+#include <QStringList>
 #include <QXmlStreamWriter>
+#include <QtEndian>
 
 #include "database.h"
+#include "pending_writes.h"
+#include "pre_annotation.h"
+#include "tracing.h"
 #include "utils.h"
+#include "worker_connection.h"
 
 namespace labelbuddy {
 
@@ -32,9 +47,10 @@ namespace labelbuddy {
 // excel recognize utf-8; see `CsvWriter` doc.
 
 DocsReader::DocsReader(const QString& file_path, QIODevice::OpenMode mode)
-    : file(file_path) {
-  if (file.open(mode)) {
-    file_size_ = static_cast<double>(file.size());
+    : file(make_file_device(file_path)) {
+  if (file->open(mode)) {
+    // for compressed files progress is measured in the compressed data
+    file_size_ = static_cast<double>(file_device_size(*file));
   } else {
     error_code_ = ErrorCode::FileSystemError;
     error_message_ = "Could not open file.";
@@ -45,7 +61,7 @@ DocsReader::~DocsReader() {}
 
 bool DocsReader::read_next() { return false; }
 
-bool DocsReader::is_open() const { return file.isOpen(); }
+bool DocsReader::is_open() const { return file->isOpen(); }
 
 bool DocsReader::has_error() const { return error_code_ != ErrorCode::NoError; }
 ErrorCode DocsReader::error_code() const { return error_code_; }
@@ -54,31 +70,142 @@ QString DocsReader::error_message() const { return error_message_; }
 int DocsReader::progress_max() const { return progress_range_max_; }
 
 int DocsReader::current_progress() const {
-  return cast_progress_to_range(static_cast<double>(file.pos()), file_size_,
+  auto pos = is_mapped() ? mapped_pos_ : file_device_pos(*file);
+  return cast_progress_to_range(static_cast<double>(pos), file_size_,
                                 progress_range_max_);
 }
 
+qint64 DocsReader::resume_offset() const {
+  return is_mapped() ? mapped_pos_ : -1;
+}
+
+bool DocsReader::seek(qint64 offset) {
+  if (!is_mapped() || offset < mapped_pos_ || offset > mapped_size_) {
+    return false;
+  }
+  mapped_pos_ = offset;
+  return true;
+}
+
+bool DocsReader::map_file() {
+  auto mappable = qobject_cast<QFile*>(file.get());
+  if (mappable == nullptr || !mappable->isOpen()) {
+    return false;
+  }
+  auto size = mappable->size();
+  if (size == 0) {
+    return false;
+  }
+  auto data = reinterpret_cast<const char*>(mappable->map(0, size));
+  if (data == nullptr) {
+    return false;
+  }
+  QByteArray start = QByteArray::fromRawData(
+      data, static_cast<int>(std::min(size, static_cast<qint64>(4))));
+  if (start.startsWith("\xfe\xff") || start.startsWith("\xff\xfe") ||
+      start.startsWith(QByteArray("\x00\x00\xfe\xff", 4))) {
+    mappable->unmap(reinterpret_cast<uchar*>(const_cast<char*>(data)));
+    return false;
+  }
+  mapped_ = data;
+  mapped_size_ = size;
+  mapped_pos_ = start.startsWith("\xef\xbb\xbf") ? 3 : 0;
+  return true;
+}
+
+bool DocsReader::is_mapped() const { return mapped_ != nullptr; }
+
+bool DocsReader::read_mapped_line(QByteArray& line) {
+  assert(is_mapped());
+  if (mapped_pos_ >= mapped_size_) {
+    return false;
+  }
+  auto start = mapped_ + mapped_pos_;
+  auto remaining = mapped_size_ - mapped_pos_;
+  auto newline = static_cast<const char*>(
+      std::memchr(start, '\n', static_cast<std::size_t>(remaining)));
+  qint64 line_size = newline == nullptr ? remaining : newline - start;
+  mapped_pos_ += newline == nullptr ? line_size : line_size + 1;
+  // as QTextStream::readLine, "\r\n" and "\n" are line endings
+  if (line_size != 0 && start[line_size - 1] == '\r') {
+    --line_size;
+  }
+  if (line_size > std::numeric_limits<int>::max()) {
+    error_code_ = ErrorCode::CriticalParsingError;
+    error_message_ = "Line too long.";
+    return false;
+  }
+  line = QByteArray::fromRawData(start, static_cast<int>(line_size));
+  return true;
+}
+
+bool DocsReader::read_mapped_bytes(int size, QByteArray& bytes) {
+  assert(is_mapped());
+  if (mapped_pos_ >= mapped_size_) {
+    return false;
+  }
+  auto available = std::min(static_cast<qint64>(size),
+                            mapped_size_ - mapped_pos_);
+  bytes = QByteArray::fromRawData(mapped_ + mapped_pos_,
+                                  static_cast<int>(available));
+  mapped_pos_ += available;
+  return true;
+}
+
 const DocRecord* DocsReader::get_current_record() const {
   return current_record.get();
 }
 
-QFile* DocsReader::get_file() { return &file; }
+std::unique_ptr<DocRecord> DocsReader::take_current_record() {
+  return std::move(current_record);
+}
+
+QIODevice* DocsReader::get_device() { return file.get(); }
+
+void DocsReader::check_input_error() {
+  if (has_error()) {
+    return;
+  }
+  auto compressed = qobject_cast<CompressedFile*>(file.get());
+  if (compressed != nullptr && compressed->decompression_failed()) {
+    error_code_ = ErrorCode::CriticalParsingError;
+    error_message_ = "Could not decompress file: it is truncated or corrupted.";
+  }
+}
 
 void DocsReader::set_current_record(std::unique_ptr<DocRecord> new_record) {
   current_record = std::move(new_record);
 }
 
 TxtDocsReader::TxtDocsReader(const QString& file_path)
-    : DocsReader(file_path), stream(get_file()) {
+    : DocsReader(file_path), stream(get_device()) {
   stream.setCodec("UTF-8");
+  map_file();
 }
 
 bool TxtDocsReader::read_next() {
-  if (!is_open() || stream.atEnd()) {
+  if (!is_open() || has_error()) {
     return false;
   }
   std::unique_ptr<DocRecord> new_record(new DocRecord);
-  new_record->content = stream.readLine();
+  if (is_mapped()) {
+    QByteArray line{};
+    if (!read_mapped_line(line)) {
+      return false;
+    }
+    new_record->content = QString::fromUtf8(line);
+    // invalid sequences are decoded as U+FFFD and would not hash the same,
+    // nor would a BOM starting the line, which `fromUtf8` drops
+    if (!new_record->content.contains(QChar::ReplacementCharacter) &&
+        !line.startsWith("\xef\xbb\xbf")) {
+      new_record->content_utf8 = line;
+    }
+  } else {
+    if (stream.atEnd()) {
+      return false;
+    }
+    new_record->content = stream.readLine();
+  }
   set_current_record(std::move(new_record));
   return true;
 }
@@ -91,7 +218,7 @@ QString format_xml_error(const QXmlStreamReader& xml) {
 }
 
 XmlDocsReader::XmlDocsReader(const QString& file_path)
-    : DocsReader(file_path), xml(get_file()) {
+    : DocsReader(file_path), xml(get_device()) {
   if (has_error()) {
     return;
   }
@@ -101,7 +228,7 @@ XmlDocsReader::XmlDocsReader(const QString& file_path)
     error_message_ = format_xml_error(xml);
     return;
   }
-  if (xml.name() != "document_set") {
+  if (xml.name() != QLatin1String("document_set")) {
     error_code_ = ErrorCode::CriticalParsingError;
     error_message_ = "Root element is not 'document_set'";
     return;
@@ -119,7 +246,7 @@ bool XmlDocsReader::read_next() {
     }
     return false;
   }
-  if (xml.name() != "document") {
+  if (xml.name() != QLatin1String("document")) {
     error_code_ = ErrorCode::CriticalParsingError;
     error_message_ = QString("Unexpected element: %0 (line %1, column %2)")
                          .arg(xml.name().toString())
@@ -140,19 +267,19 @@ bool XmlDocsReader::read_next() {
 
 void XmlDocsReader::read_document() {
   while (xml.readNextStartElement()) {
-    if (xml.name() == "text") {
+    if (xml.name() == QLatin1String("text")) {
       read_document_text();
-    } else if (xml.name() == "utf8_text_md5_checksum") {
+    } else if (xml.name() == QLatin1String("utf8_text_md5_checksum")) {
       read_md5();
-    } else if (xml.name() == "meta") {
+    } else if (xml.name() == QLatin1String("meta")) {
       read_meta();
-    } else if (xml.name() == "id") {
+    } else if (xml.name() == QLatin1String("id")) {
       read_user_provided_id();
-    } else if (xml.name() == "short_title") {
+    } else if (xml.name() == QLatin1String("short_title")) {
       read_short_title();
-    } else if (xml.name() == "long_title") {
+    } else if (xml.name() == QLatin1String("long_title")) {
       read_long_title();
-    } else if (xml.name() == "labels") {
+    } else if (xml.name() == QLatin1String("labels")) {
       read_annotation_set();
     } else {
       xml.skipCurrentElement();
@@ -195,7 +322,7 @@ void XmlDocsReader::read_meta() {
 
 void XmlDocsReader::read_annotation_set() {
   while (xml.readNextStartElement()) {
-    if (xml.name() == "annotation") {
+    if (xml.name() == QLatin1String("annotation")) {
       read_annotation();
     } else {
       xml.skipCurrentElement();
@@ -204,44 +331,71 @@ void XmlDocsReader::read_annotation_set() {
 }
 
 void XmlDocsReader::read_annotation() {
-  QJsonArray annotation{};
+  AnnotationRecord annotation{0, 0, QString(), QString()};
   xml.readNextStartElement();
   QString msg("Unexpected element while reading annotation: %0");
-  if (xml.name() != "start_char") {
+  if (xml.name() != QLatin1String("start_char")) {
     error_code_ = ErrorCode::CriticalParsingError;
     error_message_ = msg.arg(xml.name().toString());
     return;
   }
-  annotation << xml.readElementText().toInt();
+  annotation.start_char = read_element_text_in_buffer().toInt();
   xml.readNextStartElement();
-  if (xml.name() != "end_char") {
+  if (xml.name() != QLatin1String("end_char")) {
     error_code_ = ErrorCode::CriticalParsingError;
     error_message_ = msg.arg(xml.name().toString());
     return;
   }
-  annotation << xml.readElementText().toInt();
+  annotation.end_char = read_element_text_in_buffer().toInt();
   xml.readNextStartElement();
-  if (xml.name() != "label") {
+  if (xml.name() != QLatin1String("label")) {
     error_code_ = ErrorCode::CriticalParsingError;
     error_message_ = msg.arg(xml.name().toString());
     return;
   }
-  annotation << xml.readElementText();
+  annotation.label = xml.readElementText();
   // readNextStartElement when there is no next sibling is the same as
   // skipCurrentElement: the current element becomes the end element of the
   // parent node
-  if (xml.readNextStartElement() && xml.name() == "extra_data") {
-    annotation << xml.readElementText();
+  if (xml.readNextStartElement() && xml.name() == QLatin1String("extra_data")) {
+    annotation.extra_data = xml.readElementText();
     xml.skipCurrentElement();
   }
-  new_record->annotations << annotation;
+  new_record->annotations.push_back(std::move(annotation));
+}
+
+const QString& XmlDocsReader::read_element_text_in_buffer() {
+  element_text_.clear();
+  while (!xml.atEnd()) {
+    auto token = xml.readNext();
+    if (token == QXmlStreamReader::Characters ||
+        token == QXmlStreamReader::EntityReference) {
+      // the QStringRef is appended without creating a QString
+      element_text_.append(xml.text());
+    } else if (token == QXmlStreamReader::StartElement) {
+      // as readElementText with IncludeChildElements
+      element_text_.append(xml.readElementText(
+          QXmlStreamReader::IncludeChildElements));
+    } else if (token == QXmlStreamReader::EndElement) {
+      break;
+    }
+  }
+  return element_text_;
 }
 
 CsvDocsReader::CsvDocsReader(const QString& file_path)
-    : DocsReader(file_path, QIODevice::ReadOnly), stream(get_file()),
-      csv(&stream) {
-  if ((!csv.header().contains("text")) &&
-      (!csv.header().contains("utf8_text_md5_checksum"))) {
+    : DocsReader(file_path, QIODevice::ReadOnly), stream(get_device()),
+      csv(&stream), text_column_{csv.column_index("text")},
+      md5_column_{csv.column_index("utf8_text_md5_checksum")},
+      meta_column_{csv.column_index("meta")},
+      id_column_{csv.column_index("id")},
+      short_title_column_{csv.column_index("short_title")},
+      long_title_column_{csv.column_index("long_title")},
+      start_char_column_{csv.column_index("start_char")},
+      end_char_column_{csv.column_index("end_char")},
+      label_column_{csv.column_index("label")},
+      extra_data_column_{csv.column_index("extra_data")} {
+  if (text_column_ == -1 && md5_column_ == -1) {
     error_code_ = ErrorCode::CriticalParsingError;
     error_message_ = "Missing header or neither 'text' nor "
                      "'utf8_text_md5_checksum' columns present";
@@ -252,60 +406,58 @@ bool CsvDocsReader::read_next() {
   if (has_error() || csv.at_end()) {
     return false;
   }
-  auto csv_record = csv.read_record();
+  csv.read_fields();
   if (csv.found_error()) {
     error_code_ = ErrorCode::CriticalParsingError;
     error_message_ = "CSV formatting error";
     return false;
   }
   std::unique_ptr<DocRecord> doc_record(new DocRecord);
-  if (csv_record.contains("text")) {
-    doc_record->content = csv_record["text"];
+  if (csv.has_field(text_column_)) {
+    doc_record->content = csv.field(text_column_);
   } else {
     doc_record->valid_content = false;
   }
-  doc_record->declared_md5 = csv_record.value("utf8_text_md5_checksum");
-  if (csv_record.contains("meta")) {
+  doc_record->declared_md5 = csv.field(md5_column_);
+  if (csv.has_field(meta_column_)) {
     // empty doc if cannot be parsed as json
     doc_record->metadata =
-        QJsonDocument::fromJson(csv_record.value("meta").toUtf8())
+        QJsonDocument::fromJson(csv.field(meta_column_).toUtf8())
             .toJson(QJsonDocument::Compact);
   }
-  doc_record->user_provided_id = csv_record.value("id");
-  doc_record->short_title = csv_record.value("short_title");
-  doc_record->long_title = csv_record.value("long_title");
-  read_annotation(csv_record, doc_record->annotations);
+  doc_record->user_provided_id = csv.field(id_column_);
+  doc_record->short_title = csv.field(short_title_column_);
+  doc_record->long_title = csv.field(long_title_column_);
+  read_annotation(doc_record->annotations);
   set_current_record(std::move(doc_record));
   return true;
 }
 
-void CsvDocsReader::read_annotation(const QMap<QString, QString>& csv_record,
-                                    QJsonArray& annotations) {
-  if (!(csv_record.contains("start_char") && csv_record.contains("end_char") &&
-        csv_record.contains("label"))) {
+void CsvDocsReader::read_annotation(
+    std::vector<AnnotationRecord>& annotations) {
+  if (!(csv.has_field(start_char_column_) && csv.has_field(end_char_column_) &&
+        csv.has_field(label_column_))) {
     return;
   }
-  QJsonArray annotation{};
   bool ok{true};
-  auto start_char = csv_record["start_char"].toInt(&ok);
+  auto start_field = csv.field(start_char_column_);
+  auto start_char = start_field.toInt(&ok);
   if (!ok) {
-    start_char = static_cast<int>(csv_record["start_char"].toDouble(&ok));
+    start_char = static_cast<int>(start_field.toDouble(&ok));
     if (!ok) {
       return;
     }
   }
-  auto end_char = csv_record["end_char"].toInt(&ok);
+  auto end_field = csv.field(end_char_column_);
+  auto end_char = end_field.toInt(&ok);
   if (!ok) {
-    end_char = static_cast<int>(csv_record["end_char"].toDouble(&ok));
+    end_char = static_cast<int>(end_field.toDouble(&ok));
     if (!ok) {
       return;
     }
   }
-  annotation << start_char << end_char << csv_record["label"];
-  if (csv_record.contains("extra_data")) {
-    annotation << csv_record["extra_data"];
-  }
-  annotations << annotation;
+  annotations.push_back({start_char, end_char, csv.field(label_column_),
+                         csv.field(extra_data_column_)});
 }
 
 std::unique_ptr<DocRecord> json_to_doc_record(const QJsonDocument& json) {
@@ -324,7 +476,15 @@ std::unique_ptr<DocRecord> json_to_doc_record(const QJsonObject& json) {
     record->valid_content = false;
   }
   record->declared_md5 = json["utf8_text_md5_checksum"].toString();
-  record->annotations = json["labels"].toArray();
+  const auto labels = json["labels"].toArray();
+  record->annotations.reserve(static_cast<std::size_t>(labels.size()));
+  for (const auto& label : labels) {
+    const auto annotation = label.toArray();
+    record->annotations.push_back(
+        {annotation[0].toInt(), annotation[1].toInt(),
+         annotation[2].toString(),
+         annotation.size() == 4 ? annotation[3].toString() : QString()});
+  }
   record->metadata =
       QJsonDocument(json["meta"].toObject()).toJson(QJsonDocument::Compact);
   record->user_provided_id = json["id"].toVariant().toString();
@@ -334,58 +494,180 @@ std::unique_ptr<DocRecord> json_to_doc_record(const QJsonObject& json) {
 }
 
 JsonDocsReader::JsonDocsReader(const QString& file_path)
-    : DocsReader(file_path) {
+    : DocsReader(file_path, QIODevice::ReadOnly) {
   if (has_error()) {
     return;
   }
-  QTextStream input_stream(get_file());
-  input_stream.setCodec("UTF-8");
-  auto json_doc = QJsonDocument::fromJson(input_stream.readAll().toUtf8());
-  if (!json_doc.isArray()) {
-    total_n_docs = 0;
+  fill_buffer();
+  if (buffer_.startsWith("\xef\xbb\xbf")) {
+    buffer_pos_ = 3;
+  }
+  if (!skip_whitespace() || buffer_.at(buffer_pos_) != '[') {
     error_code_ = ErrorCode::CriticalParsingError;
     error_message_ =
         "File does not contain a JSON array.\n(Note: if file is in JSONLines "
         "format, please use the filename extension '.jsonl' rather than "
         "'.json')";
-  } else {
-    all_docs = json_doc.array();
-    total_n_docs = all_docs.size();
-    current_doc = all_docs.constBegin();
+    return;
   }
+  ++buffer_pos_;
 }
 
-bool JsonDocsReader::read_next() {
-  if (total_n_docs == 0 || current_doc == all_docs.constEnd()) {
+bool JsonDocsReader::fill_buffer() {
+  auto chunk = get_device()->read(chunk_size_);
+  if (chunk.isEmpty()) {
     return false;
   }
-  set_current_record(json_to_doc_record(*current_doc));
-  ++current_doc;
-  ++n_seen;
+  // drop the consumed bytes only once they are most of the buffer, so that
+  // the remaining ones are not moved again after each element
+  if (buffer_pos_ > buffer_.size() / 2) {
+    buffer_.remove(0, buffer_pos_);
+    buffer_pos_ = 0;
+  }
+  buffer_.append(chunk);
   return true;
 }
 
-int JsonDocsReader::progress_max() const { return total_n_docs; }
+bool JsonDocsReader::skip_whitespace() {
+  while (true) {
+    while (buffer_pos_ < buffer_.size()) {
+      auto byte = buffer_.at(buffer_pos_);
+      if (byte != ' ' && byte != '\n' && byte != '\r' && byte != '\t') {
+        return true;
+      }
+      ++buffer_pos_;
+    }
+    if (!fill_buffer()) {
+      return false;
+    }
+  }
+}
+
+int JsonDocsReader::find_element_end() {
+  int depth{};
+  bool in_string{};
+  bool escaped{};
+  // relative to `buffer_pos_`, which `fill_buffer` can move
+  int pos{};
+  while (true) {
+    if (buffer_pos_ + pos == buffer_.size() && !fill_buffer()) {
+      return -1;
+    }
+    auto byte = buffer_.at(buffer_pos_ + pos);
+    if (in_string) {
+      if (escaped) {
+        escaped = false;
+      } else if (byte == '\\') {
+        escaped = true;
+      } else if (byte == '"') {
+        in_string = false;
+      }
+    } else if (byte == '"') {
+      in_string = true;
+    } else if (byte == '{' || byte == '[') {
+      ++depth;
+    } else if (byte == '}' || byte == ']') {
+      if (depth == 0) {
+        // closing bracket of the top-level array after a scalar element
+        return buffer_pos_ + pos;
+      }
+      --depth;
+      if (depth == 0) {
+        return buffer_pos_ + pos + 1;
+      }
+    } else if (byte == ',' && depth == 0) {
+      return buffer_pos_ + pos;
+    }
+    ++pos;
+  }
+}
+
+void JsonDocsReader::set_parsing_error(const QString& message) {
+  error_code_ = ErrorCode::CriticalParsingError;
+  error_message_ = QString("JSON error in document %0: %1")
+                       .arg(n_seen_ + 1)
+                       .arg(message);
+}
 
-int JsonDocsReader::current_progress() const { return n_seen; }
+bool JsonDocsReader::read_next() {
+  if (has_error() || reached_end_) {
+    return false;
+  }
+  if (!skip_whitespace()) {
+    set_parsing_error("unexpected end of file.");
+    return false;
+  }
+  if (buffer_.at(buffer_pos_) == ']') {
+    reached_end_ = true;
+    return false;
+  }
+  if (n_seen_ != 0) {
+    if (buffer_.at(buffer_pos_) != ',') {
+      set_parsing_error("missing ',' between array elements.");
+      return false;
+    }
+    ++buffer_pos_;
+    if (!skip_whitespace()) {
+      set_parsing_error("unexpected end of file.");
+      return false;
+    }
+  }
+  auto element_end = find_element_end();
+  if (element_end == -1) {
+    set_parsing_error("unexpected end of file.");
+    return false;
+  }
+  auto element = buffer_.mid(buffer_pos_, element_end - buffer_pos_);
+  // the consumed bytes are dropped by `fill_buffer`
+  buffer_pos_ = element_end;
+  QJsonParseError parse_error{};
+  if (element.startsWith('{')) {
+    auto json_doc = QJsonDocument::fromJson(element, &parse_error);
+    if (!json_doc.isObject()) {
+      set_parsing_error(parse_error.errorString());
+      return false;
+    }
+    set_current_record(json_to_doc_record(json_doc));
+  } else {
+    // not an object: still has to be valid JSON, but results in a record
+    // without content or md5, which is skipped at insertion
+    auto json_doc =
+        QJsonDocument::fromJson("[" + element + "]", &parse_error);
+    if (!json_doc.isArray()) {
+      set_parsing_error(parse_error.errorString());
+      return false;
+    }
+    set_current_record(json_to_doc_record(QJsonObject{}));
+  }
+  ++n_seen_;
+  return true;
+}
 
 JsonLinesDocsReader::JsonLinesDocsReader(const QString& file_path)
-    : DocsReader(file_path), stream(get_file()) {
+    : DocsReader(file_path), stream(get_device()) {
   stream.setCodec("UTF-8");
+  map_file();
 }
 
 bool JsonLinesDocsReader::read_next() {
   if (has_error()) {
     return false;
   }
-  QString line{};
-  while (line == "" && !stream.atEnd()) {
-    line = stream.readLine();
+  QByteArray line{};
+  if (is_mapped()) {
+    while (line.isEmpty() && read_mapped_line(line)) {
+    }
+  } else {
+    QString text_line{};
+    while (text_line == "" && !stream.atEnd()) {
+      text_line = stream.readLine();
+    }
+    line = text_line.toUtf8();
   }
-  if (line == "") {
+  if (line.isEmpty()) {
     return false;
   }
-  auto json_doc = QJsonDocument::fromJson(line.toUtf8());
+  auto json_doc = QJsonDocument::fromJson(line);
   if (!json_doc.isObject()) {
     error_code_ = ErrorCode::CriticalParsingError;
     error_message_ = "JSONLines error: could not parse line as a JSON object.";
@@ -396,232 +678,943 @@ bool JsonLinesDocsReader::read_next() {
   return true;
 }
 
-DocsWriter::DocsWriter(const QString& file_path, bool include_text,
-                       bool include_annotations, bool include_user_name,
-                       QIODevice::OpenMode mode)
-    : file(file_path), include_text_{include_text},
-      include_annotations_{include_annotations}, include_user_name_{
-                                                     include_user_name} {
-  file.open(mode);
-}
-
-DocsWriter::~DocsWriter() {}
+namespace {
 
-void DocsWriter::write_prefix() {}
-void DocsWriter::write_suffix() {}
+const char bundle_magic[] = "LBBUNDLE";
+const int bundle_magic_size{8};
+const quint32 bundle_version{1};
+const int md5_size{16};
 
-bool DocsWriter::is_open() const { return file.isOpen(); }
-bool DocsWriter::is_including_text() const { return include_text_; }
-bool DocsWriter::is_including_annotations() const {
-  return include_annotations_;
+void append_uint32(QByteArray& data, quint32 value) {
+  uchar bytes[4];
+  qToLittleEndian(value, bytes);
+  data.append(reinterpret_cast<const char*>(bytes), 4);
 }
-bool DocsWriter::is_including_user_name() const { return include_user_name_; }
 
-QFile* DocsWriter::get_file() { return &file; }
-
-void DocsWriter::add_document(const QString& md5, const QString& content,
-                              const QJsonObject& metadata,
-                              const QList<Annotation>& annotations,
-                              const QString& user_name,
-                              const QString& user_provided_id,
-                              const QString& short_title,
-                              const QString& long_title) {
-  (void)md5;
-  (void)content;
-  (void)metadata;
-  (void)annotations;
-  (void)user_name;
-  (void)user_provided_id;
-  (void)short_title;
-  (void)long_title;
+void append_bundle_field(QByteArray& data, const QByteArray& field) {
+  append_uint32(data, static_cast<quint32>(field.size()));
+  data.append(field);
 }
 
-DocsJsonLinesWriter::DocsJsonLinesWriter(const QString& file_path,
-                                         bool include_text,
-                                         bool include_annotations,
-                                         bool include_user_name)
-    : DocsWriter(file_path, include_text, include_annotations,
-                 include_user_name),
-      stream(get_file()) {
-  stream.setCodec("UTF-8");
-}
+/// Decodes the fields of a bundle record.
 
-int DocsJsonLinesWriter::get_n_docs() const { return n_docs; }
+/// Once a read goes past the end of the record `ok` returns false and the
+/// following reads return empty or 0 values.
+class BundleFields {
+public:
+  explicit BundleFields(const QByteArray& record) : record_{record} {}
 
-QTextStream& DocsJsonLinesWriter::get_stream() { return stream; }
+  bool ok() const { return ok_; }
+  bool at_end() const { return pos_ == record_.size(); }
 
-void DocsJsonLinesWriter::add_document(
-    const QString& md5, const QString& content, const QJsonObject& metadata,
-    const QList<Annotation>& annotations, const QString& user_name,
-    const QString& user_provided_id, const QString& short_title,
-    const QString& long_title) {
-  if (n_docs) {
-    stream << "\n";
-  }
-  QJsonObject doc_json{};
-  assert(md5 != "");
-  doc_json.insert("utf8_text_md5_checksum", md5);
-  doc_json.insert("meta", metadata);
-  if (user_provided_id != QString()) {
-    doc_json.insert("id", user_provided_id);
-  }
-  if (is_including_user_name() && user_name != QString()) {
-    doc_json.insert("annotation_approver", user_name);
-  }
-  if (is_including_text()) {
-    if (short_title != QString()) {
-      doc_json.insert("short_title", short_title);
+  quint32 uint32() {
+    if (!has(4)) {
+      return 0;
     }
-    if (long_title != QString()) {
-      doc_json.insert("long_title", long_title);
+    auto value = qFromLittleEndian<quint32>(
+        reinterpret_cast<const uchar*>(record_.constData() + pos_));
+    pos_ += 4;
+    return value;
+  }
+
+  QByteArray bytes(quint32 size) {
+    if (!has(size)) {
+      return {};
     }
-    assert(content != "");
-    doc_json.insert("text", content);
+    QByteArray value(record_.constData() + pos_, static_cast<int>(size));
+    pos_ += static_cast<int>(size);
+    return value;
   }
-  if (is_including_annotations()) {
-    QJsonArray all_annotations_json{};
-    for (const auto& annotation : annotations) {
-      QJsonArray annotation_json{};
-      annotation_json.append(annotation.start_char);
-      annotation_json.append(annotation.end_char);
-      assert(annotation.label_name != "");
-      annotation_json.append(annotation.label_name);
-      if (annotation.extra_data != "") {
-        annotation_json.append(annotation.extra_data);
-      }
-      all_annotations_json.append(annotation_json);
+
+  QByteArray field() { return bytes(uint32()); }
+
+  /// a field decoded from UTF-8 without an intermediate copy
+  QString string() {
+    auto size = uint32();
+    if (!has(size)) {
+      return {};
     }
-    doc_json.insert("labels", all_annotations_json);
+    auto value =
+        QString::fromUtf8(record_.constData() + pos_, static_cast<int>(size));
+    pos_ += static_cast<int>(size);
+    return value;
   }
-  stream << QString::fromUtf8(
-      QJsonDocument(doc_json).toJson(QJsonDocument::Compact));
-  ++n_docs;
-}
 
-void DocsJsonLinesWriter::write_suffix() {
-  if (n_docs) {
-    stream << "\n";
+private:
+  bool has(quint32 size) {
+    if (ok_ && size > static_cast<quint32>(record_.size() - pos_)) {
+      ok_ = false;
+    }
+    return ok_;
   }
-}
 
-DocsJsonWriter::DocsJsonWriter(const QString& file_path, bool include_text,
-                               bool include_annotations, bool include_user_name)
-    : DocsJsonLinesWriter(file_path, include_text, include_annotations,
-                          include_user_name) {}
+  const QByteArray& record_;
+  int pos_{};
+  bool ok_{true};
+};
 
-void DocsJsonWriter::add_document(const QString& md5, const QString& content,
-                                  const QJsonObject& metadata,
-                                  const QList<Annotation>& annotations,
-                                  const QString& user_name,
-                                  const QString& user_provided_id,
-                                  const QString& short_title,
-                                  const QString& long_title) {
-  if (get_n_docs()) {
-    get_stream() << ",";
+} // namespace
+
+BundleDocsReader::BundleDocsReader(const QString& file_path)
+    : DocsReader(file_path, QIODevice::ReadOnly) {
+  if (has_error()) {
+    return;
+  }
+  map_file();
+  QByteArray header{};
+  read_bytes(bundle_magic_size + 4, header);
+  if (header.size() != bundle_magic_size + 4 ||
+      !header.startsWith(QByteArray(bundle_magic, bundle_magic_size))) {
+    set_format_error("Not a labelbuddy bundle.");
+    return;
+  }
+  auto version = qFromLittleEndian<quint32>(
+      reinterpret_cast<const uchar*>(header.constData() + bundle_magic_size));
+  if (version > bundle_version) {
+    set_format_error(
+        QString("Unsupported labelbuddy bundle version: %0.").arg(version));
   }
-  DocsJsonLinesWriter::add_document(md5, content, metadata, annotations,
-                                    user_name, user_provided_id, short_title,
-                                    long_title);
 }
 
-void DocsJsonWriter::write_prefix() { get_stream() << "[\n"; }
-
-void DocsJsonWriter::write_suffix() {
-  get_stream() << (get_n_docs() ? "\n" : "") << "]\n";
+void BundleDocsReader::set_format_error(const QString& message) {
+  error_code_ = ErrorCode::CriticalParsingError;
+  error_message_ = message;
 }
 
-DocsCsvWriter::DocsCsvWriter(const QString& file_path, bool include_text,
-                             bool include_annotations, bool include_user_name)
-    : DocsWriter(file_path, include_text, include_annotations,
-                 include_user_name, QIODevice::WriteOnly),
-      stream(get_file()), csv(&stream) {}
-
-void DocsCsvWriter::write_prefix() {
-  QList<QString> header{};
-  header << "utf8_text_md5_checksum"
-         << "meta"
-         << "id";
-  if (is_including_user_name()) {
-    header << "annotation_approver";
-  }
-  if (is_including_text()) {
-    header << "short_title"
-           << "long_title"
-           << "text";
-  }
-  if (is_including_annotations()) {
-    header << "start_char"
-           << "end_char"
-           << "label"
-           << "extra_data";
+bool BundleDocsReader::read_bytes(int size, QByteArray& bytes) {
+  if (is_mapped()) {
+    return read_mapped_bytes(size, bytes);
+  }
+  bytes = get_device()->read(size);
+  while (bytes.size() < size) {
+    auto more = get_device()->read(size - bytes.size());
+    if (more.isEmpty()) {
+      break;
+    }
+    bytes.append(more);
   }
-  csv.write_record(header.constBegin(), header.constEnd());
+  return !bytes.isEmpty();
 }
 
-void DocsCsvWriter::add_document(const QString& md5, const QString& content,
-                                 const QJsonObject& metadata,
-                                 const QList<Annotation>& annotations,
-                                 const QString& user_name,
-                                 const QString& user_provided_id,
-                                 const QString& short_title,
-                                 const QString& long_title) {
-  QList<QString> record{};
-  assert(md5 != "");
-  record << md5 << QJsonDocument(metadata).toJson(QJsonDocument::Compact)
-         << user_provided_id;
-  if (is_including_user_name()) {
-    record << user_name;
+bool BundleDocsReader::read_next() {
+  if (!is_open() || has_error()) {
+    return false;
   }
-  if (is_including_text()) {
-    assert(content != "");
-    record << short_title << long_title << content;
+  QByteArray size_bytes{};
+  if (!read_bytes(4, size_bytes)) {
+    return false;
   }
-  int first_char_idx = record.size();
-  if (is_including_annotations()) {
-    record << ""
-           << ""
-           << ""
-           << "";
+  auto size = BundleFields(size_bytes).uint32();
+  if (size_bytes.size() != 4 ||
+      size > static_cast<quint32>(std::numeric_limits<int>::max())) {
+    set_format_error("Truncated or corrupted labelbuddy bundle.");
+    return false;
   }
-  if (annotations.size() == 0) {
-    csv.write_record(record.constBegin(), record.constEnd());
+  QByteArray record_bytes{};
+  read_bytes(static_cast<int>(size), record_bytes);
+  if (static_cast<quint32>(record_bytes.size()) != size) {
+    set_format_error("Truncated labelbuddy bundle.");
+    return false;
   }
-  for (const auto& anno : annotations) {
-    if (is_including_annotations()) {
-      record[first_char_idx] = QString("%0").arg(anno.start_char);
-      record[first_char_idx + 1] = QString("%0").arg(anno.end_char);
-      assert(anno.label_name != "");
-      record[first_char_idx + 2] = anno.label_name;
-      record[first_char_idx + 3] = anno.extra_data;
+  BundleFields fields(record_bytes);
+  std::unique_ptr<DocRecord> record(new DocRecord);
+  auto md5 = fields.bytes(md5_size);
+  record->content = fields.string();
+  if (record->content.isEmpty()) {
+    // exported without the text: annotations go to the document with this
+    // checksum if it is already in the database
+    record->valid_content = false;
+    record->declared_md5 = QString::fromLatin1(md5.toHex());
+  } else {
+    record->content_md5 = md5;
+  }
+  record->metadata = fields.field();
+  record->user_provided_id = fields.string();
+  record->short_title = fields.string();
+  record->long_title = fields.string();
+  // the annotation approver is not imported
+  fields.field();
+  auto n_annotations = fields.uint32();
+  for (quint32 i = 0; i != n_annotations && fields.ok(); ++i) {
+    AnnotationRecord annotation{0, 0, QString(), QString()};
+    annotation.start_char = static_cast<qint32>(fields.uint32());
+    annotation.end_char = static_cast<qint32>(fields.uint32());
+    annotation.label = fields.string();
+    annotation.extra_data = fields.string();
+    record->annotations.push_back(std::move(annotation));
+  }
+  if (!fields.ok() || !fields.at_end()) {
+    set_format_error("Corrupted labelbuddy bundle record.");
+    return false;
+  }
+  set_current_record(std::move(record));
+  return true;
+}
+
+QByteArray doc_record_md5(const DocRecord& record) {
+  if (record.valid_content) {
+    if (!record.content_md5.isEmpty()) {
+      return record.content_md5;
     }
-    csv.write_record(record.constBegin(), record.constEnd());
+    if (!record.content_utf8.isEmpty()) {
+      return QCryptographicHash::hash(record.content_utf8,
+                                      QCryptographicHash::Md5);
+    }
+    return utf8_md5(record.content);
   }
+  // bad chars are skipped. this is not inserted in db but used for lookup.
+  return QByteArray::fromHex(record.declared_md5.toUtf8());
 }
 
-DocsXmlWriter::DocsXmlWriter(const QString& file_path, bool include_text,
-                             bool include_annotations, bool include_user_name)
-    : DocsWriter(file_path, include_text, include_annotations,
-                 include_user_name),
-      xml(get_file()) {
-  xml.setCodec("UTF-8");
-  xml.setAutoFormatting(true);
+QString document_preview(const QString& content, const QString& long_title) {
+  const auto& text = long_title.isEmpty() ? content : long_title;
+  const int max_code_points{160};
+  int end{};
+  for (int i = 0; i != max_code_points && end != text.size(); ++i) {
+    // a surrogate pair is one code point, as in SQL's `substr`
+    if (text[end].isHighSurrogate() && end + 1 != text.size() &&
+        text[end + 1].isLowSurrogate()) {
+      ++end;
+    }
+    ++end;
+  }
+  auto preview = text.left(end);
+  preview.replace(QChar('\n'), QChar(' '));
+  return preview;
 }
 
-void DocsXmlWriter::write_prefix() {
-  xml.writeStartDocument();
-  xml.writeStartElement("document_set");
+int utf8_length(const QString& text) {
+  int length{};
+  for (const auto& character : text) {
+    auto code_unit = character.unicode();
+    if (code_unit < 0x80) {
+      length += 1;
+    } else if (code_unit < 0x800 || character.isSurrogate()) {
+      // each half of a surrogate pair accounts for 2 of its 4 bytes
+      length += 2;
+    } else {
+      length += 3;
+    }
+  }
+  return length;
 }
 
-void DocsXmlWriter::write_suffix() {
-  xml.writeEndElement();
-  xml.writeEndDocument();
+QByteArray utf8_md5(const QString& text) {
+  // code units encoded at a time; the buffer stays in the cache and a block
+  // can end with a whole surrogate pair
+  const int block_size{1 << 13};
+  char buffer[3 * block_size + 4];
+  QCryptographicHash hash(QCryptographicHash::Md5);
+  const auto* in = text.utf16();
+  const int size = text.size();
+  int pos{};
+  while (pos != size) {
+    auto end = std::min(size, pos + block_size);
+    if (end != size && QChar::isHighSurrogate(in[end - 1])) {
+      ++end;
+    }
+    auto* out = buffer;
+    while (pos != end) {
+      // 4 ascii code units at a time
+      if (end - pos >= 4) {
+        std::uint64_t units{};
+        std::memcpy(&units, in + pos, sizeof(units));
+        if ((units & 0xff80ff80ff80ff80ULL) == 0) {
+          for (int i = 0; i != 4; ++i) {
+            *out++ = static_cast<char>(in[pos + i]);
+          }
+          pos += 4;
+          continue;
+        }
+      }
+      uint code_point = in[pos++];
+      if (code_point < 0x80) {
+        *out++ = static_cast<char>(code_point);
+      } else if (code_point < 0x800) {
+        *out++ = static_cast<char>(0xc0 | (code_point >> 6));
+        *out++ = static_cast<char>(0x80 | (code_point & 0x3f));
+      } else if (QChar::isSurrogate(code_point)) {
+        if (!QChar::isHighSurrogate(code_point) || pos == end ||
+            !QChar::isLowSurrogate(in[pos])) {
+          // unpaired surrogate: hash exactly what toUtf8 replaces it with
+          return QCryptographicHash::hash(text.toUtf8(),
+                                          QCryptographicHash::Md5);
+        }
+        code_point = QChar::surrogateToUcs4(static_cast<ushort>(code_point),
+                                            in[pos++]);
+        *out++ = static_cast<char>(0xf0 | (code_point >> 18));
+        *out++ = static_cast<char>(0x80 | ((code_point >> 12) & 0x3f));
+        *out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+        *out++ = static_cast<char>(0x80 | (code_point & 0x3f));
+      } else {
+        *out++ = static_cast<char>(0xe0 | (code_point >> 12));
+        *out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+        *out++ = static_cast<char>(0x80 | (code_point & 0x3f));
+      }
+    }
+    hash.addData(buffer, static_cast<int>(out - buffer));
+  }
+  return hash.result();
 }
 
-void DocsXmlWriter::add_document(const QString& md5, const QString& content,
-                                 const QJsonObject& metadata,
-                                 const QList<Annotation>& annotations,
-                                 const QString& user_name,
-                                 const QString& user_provided_id,
+int n_code_points(const QString& text) {
+  int n_low_surrogates{};
+  for (const auto& character : text) {
+    if (character.isLowSurrogate()) {
+      ++n_low_surrogates;
+    }
+  }
+  return text.size() - n_low_surrogates;
+}
+
+namespace {
+
+/// metadata key of the segments made by `split_doc_record`
+const QString segment_metadata_key{"labelbuddy_segment"};
+
+/// UTF-16 positions in `text` of increasing code point positions
+
+/// Positions after the end of the text stay at the same distance from it.
+QVector<int> utf16_positions(const QString& text,
+                             const QVector<int>& code_points) {
+  QVector<int> positions{};
+  positions.reserve(code_points.size());
+  int utf16{};
+  int code_point{};
+  for (auto target : code_points) {
+    while (code_point < target && utf16 != text.size()) {
+      ++utf16;
+      // the second half of a surrogate pair is not a new code point
+      if (utf16 == text.size() || !text[utf16].isLowSurrogate()) {
+        ++code_point;
+      }
+    }
+    positions << utf16 + std::max(0, target - code_point);
+  }
+  return positions;
+}
+
+/// End of a segment of `text` starting at `start` and ending before `limit`
+
+/// After the last blank line in the second half of the segment, or else the
+/// last line break there, or else at `limit`.
+int segment_end(const QString& text, int start, int limit) {
+  if (limit >= text.size()) {
+    return text.size();
+  }
+  int line_end{-1};
+  for (int end = limit; end > start + (limit - start) / 2; --end) {
+    if (text[end - 1] == QChar('\n')) {
+      if (end - 2 >= start && text[end - 2] == QChar('\n')) {
+        return end;
+      }
+      if (line_end == -1) {
+        line_end = end;
+      }
+    }
+  }
+  return line_end != -1 ? line_end : limit;
+}
+
+} // namespace
+
+std::vector<std::unique_ptr<DocRecord>>
+split_doc_record(const DocRecord& record, const QByteArray& content_md5,
+                 int max_length) {
+  std::vector<std::unique_ptr<DocRecord>> segments{};
+  const auto& content = record.content;
+  if (max_length <= 0 || !record.valid_content ||
+      content.size() <= max_length || n_code_points(content) <= max_length) {
+    return segments;
+  }
+  // annotations as ranges of UTF-16 code units, to avoid cutting them
+  QVector<int> boundaries{};
+  for (const auto& annotation : record.annotations) {
+    boundaries << annotation.start_char << annotation.end_char;
+  }
+  std::sort(boundaries.begin(), boundaries.end());
+  boundaries.erase(std::unique(boundaries.begin(), boundaries.end()),
+                   boundaries.end());
+  auto utf16_boundaries = utf16_positions(content, boundaries);
+  auto to_utf16 = [&](int code_point) {
+    auto found =
+        std::lower_bound(boundaries.cbegin(), boundaries.cend(), code_point);
+    return std::min(
+        utf16_boundaries[static_cast<int>(found - boundaries.cbegin())],
+        content.size());
+  };
+  QVector<QPair<int, int>> spans{};
+  for (const auto& annotation : record.annotations) {
+    auto span = qMakePair(to_utf16(annotation.start_char),
+                          to_utf16(annotation.end_char));
+    if (span.first < span.second) {
+      spans << span;
+    }
+  }
+
+  // start of each segment in code units and in code points
+  QVector<int> starts{0};
+  QVector<int> code_point_starts{0};
+  int start{};
+  int code_point{};
+  while (true) {
+    auto limit = start;
+    for (int n = 0; n != max_length && limit != content.size(); ++n) {
+      ++limit;
+      if (limit != content.size() && content[limit].isLowSurrogate()) {
+        ++limit;
+      }
+    }
+    auto end = segment_end(content, start, limit);
+    // end before the annotations that would be cut or, if one starts at the
+    // start of the segment, after it
+    bool moved{true};
+    while (moved) {
+      moved = false;
+      for (const auto& span : spans) {
+        if (span.first > start && span.first < end && span.second > end) {
+          end = span.first;
+          moved = true;
+        }
+      }
+    }
+    moved = true;
+    while (moved) {
+      moved = false;
+      for (const auto& span : spans) {
+        if (span.first < end && span.second > end) {
+          end = span.second;
+          moved = true;
+        }
+      }
+    }
+    if (end == content.size()) {
+      break;
+    }
+    for (auto i = start; i != end; ++i) {
+      if (!content[i].isLowSurrogate()) {
+        ++code_point;
+      }
+    }
+    start = end;
+    starts << start;
+    code_point_starts << code_point;
+  }
+  if (starts.size() == 1) {
+    return segments;
+  }
+
+  auto metadata = QJsonDocument::fromJson(record.metadata).object();
+  auto parent_md5 = QString::fromLatin1(content_md5.toHex());
+  for (int i = 0; i != starts.size(); ++i) {
+    std::unique_ptr<DocRecord> segment(new DocRecord());
+    auto end = i + 1 != starts.size() ? starts[i + 1] : content.size();
+    segment->content = content.mid(starts[i], end - starts[i]);
+    QJsonObject segment_info{};
+    segment_info["parent_md5"] = parent_md5;
+    segment_info["index"] = i;
+    segment_info["n_segments"] = starts.size();
+    segment_info["offset"] = code_point_starts[i];
+    auto segment_metadata = metadata;
+    segment_metadata[segment_metadata_key] = segment_info;
+    segment->metadata =
+        QJsonDocument(segment_metadata).toJson(QJsonDocument::Compact);
+    segment->user_provided_id = record.user_provided_id;
+    segment->short_title = record.short_title;
+    segment->long_title = record.long_title;
+    segment->content_md5 = utf8_md5(segment->content);
+    segments.push_back(std::move(segment));
+  }
+  for (const auto& annotation : record.annotations) {
+    auto after = std::upper_bound(code_point_starts.cbegin(),
+                                  code_point_starts.cend(),
+                                  annotation.start_char);
+    auto index =
+        std::max(0, static_cast<int>(after - code_point_starts.cbegin()) - 1);
+    auto offset = code_point_starts[index];
+    segments[static_cast<std::size_t>(index)]->annotations.push_back(
+        AnnotationRecord{annotation.start_char - offset,
+                         annotation.end_char - offset, annotation.label,
+                         annotation.extra_data});
+  }
+  return segments;
+}
+
+ContentLayout get_content_layout(QSqlQuery& query, const QString& schema) {
+  query.exec(QString("SELECT name FROM %0.sqlite_master WHERE type = 'table' "
+                     "AND name IN ('document_content', "
+                     "'document_compressed_content');")
+                 .arg(schema));
+  auto layout = ContentLayout::Inline;
+  if (query.next()) {
+    layout = query.value(0).toString() == "document_content"
+                 ? ContentLayout::Separate
+                 : ContentLayout::Compressed;
+  }
+  query.finish();
+  return layout;
+}
+
+QByteArray compress_content(const QString& content) {
+  return compress_block(content.toUtf8());
+}
+
+bool content_requires_zstd(QSqlQuery& query, const QString& schema) {
+  if (get_content_layout(query, schema) != ContentLayout::Compressed) {
+    return false;
+  }
+  query.exec(QString("SELECT value FROM %0.app_state_extra "
+                     "WHERE key = 'content_compression';")
+                 .arg(schema));
+  if (query.next()) {
+    auto recorded = query.value(0).toString();
+    query.finish();
+    return recorded == "zstd";
+  }
+  // the zstd magic number, 0xFD2FB528 little-endian
+  query.exec(QString("SELECT count(*) FROM %0.document_compressed_content "
+                     "WHERE id IN (SELECT min(id) FROM "
+                     "%0.document_compressed_content UNION SELECT max(id) "
+                     "FROM %0.document_compressed_content) AND "
+                     "substr(content, 1, 4) = x'28b52ffd';")
+                 .arg(schema));
+  auto n_zstd = query.next() ? query.value(0).toInt() : 0;
+  query.finish();
+  return n_zstd != 0;
+}
+
+QString content_from_sql(const QVariant& value) {
+  if (value.type() == QVariant::ByteArray) {
+    return QString::fromUtf8(uncompress_block(value.toByteArray()));
+  }
+  return value.toString();
+}
+
+DocsReadingThread::DocsReadingThread(std::unique_ptr<DocsReader> reader,
+                                     std::size_t max_queue_size,
+                                     BatchStats* stats, int max_doc_length,
+                                     int n_hashing_threads)
+    : reader_{std::move(reader)}, max_queue_size_{max_queue_size},
+      stats_{stats}, max_doc_length_{max_doc_length},
+      n_hashing_threads_{n_hashing_threads},
+      thread_(&DocsReadingThread::run, this) {
+  for (int i = 0; i < n_hashing_threads_; ++i) {
+    hashing_threads_.emplace_back(&DocsReadingThread::run_hashing, this);
+  }
+}
+
+DocsReadingThread::~DocsReadingThread() { stop(); }
+
+void DocsReadingThread::hash_item(Item& item) const {
+  PhaseTimer timer(stats_, BatchPhase::Hash);
+  item.content_md5 = doc_record_md5(*item.record);
+  if (max_doc_length_ > 0) {
+    item.segments =
+        split_doc_record(*item.record, item.content_md5, max_doc_length_);
+  }
+  item.record->content_utf8.clear();
+  if (!item.segments.empty()) {
+    item.record.reset();
+  }
+}
+
+void DocsReadingThread::run() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_full_.wait(lock, [this] {
+        return stop_requested_ || queue_.size() < max_queue_size_;
+      });
+      if (stop_requested_) {
+        break;
+      }
+    }
+    bool has_record{};
+    {
+      PhaseTimer timer(stats_, BatchPhase::Parse);
+      has_record = reader_->read_next() && !reader_->has_error();
+    }
+    if (!has_record) {
+      reader_->check_input_error();
+      break;
+    }
+    QueuedItem queued{{reader_->take_current_record(), QByteArray{},
+                       reader_->current_progress(), reader_->resume_offset(),
+                       {}},
+                      n_hashing_threads_ == 0};
+    if (queued.is_hashed) {
+      hash_item(queued.item);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back(std::move(queued));
+    }
+    if (n_hashing_threads_ == 0) {
+      not_empty_.notify_one();
+    } else {
+      has_unhashed_.notify_one();
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = true;
+  }
+  not_empty_.notify_one();
+  has_unhashed_.notify_all();
+}
+
+void DocsReadingThread::run_hashing() {
+  while (true) {
+    QueuedItem* queued{};
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      has_unhashed_.wait(lock, [this] {
+        return finished_ || next_to_hash_ < n_popped_ + queue_.size();
+      });
+      // after `stop` the queued records are still hashed for `next`
+      if (next_to_hash_ == n_popped_ + queue_.size()) {
+        break;
+      }
+      queued = &queue_[next_to_hash_ - n_popped_];
+      ++next_to_hash_;
+    }
+    // `next` does not remove the item until it is hashed
+    hash_item(queued->item);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queued->is_hashed = true;
+    }
+    not_empty_.notify_one();
+  }
+}
+
+bool DocsReadingThread::next(Item& item) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] {
+      return queue_.empty() ? finished_ : queue_.front().is_hashed;
+    });
+    if (queue_.empty()) {
+      return false;
+    }
+    item = std::move(queue_.front().item);
+    queue_.pop_front();
+    ++n_popped_;
+  }
+  not_full_.notify_one();
+  return true;
+}
+
+void DocsReadingThread::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_requested_ = true;
+  }
+  not_full_.notify_one();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  for (auto& hashing_thread : hashing_threads_) {
+    if (hashing_thread.joinable()) {
+      hashing_thread.join();
+    }
+  }
+}
+
+const DocsReader& DocsReadingThread::reader() const { return *reader_; }
+
+DocsWriter::DocsWriter(const QString& file_path, bool include_text,
+                       bool include_annotations, bool include_user_name,
+                       QIODevice::OpenMode mode, QIODevice* device)
+    : file(device == nullptr ? make_file_device(file_path) : nullptr),
+      device_{device == nullptr ? file.get() : device},
+      include_text_{include_text}, include_annotations_{include_annotations},
+      include_user_name_{include_user_name} {
+  if (!device_->isOpen()) {
+    device_->open(mode);
+  }
+}
+
+DocsWriter::~DocsWriter() {}
+
+void DocsWriter::write_prefix() {}
+void DocsWriter::write_suffix() {}
+void DocsWriter::flush() {}
+void DocsWriter::set_output_state(OutputState state) { (void)state; }
+
+bool DocsWriter::is_open() const { return device_->isOpen(); }
+bool DocsWriter::is_including_text() const { return include_text_; }
+bool DocsWriter::is_including_annotations() const {
+  return include_annotations_;
+}
+bool DocsWriter::is_including_user_name() const { return include_user_name_; }
+
+QIODevice* DocsWriter::get_device() { return device_; }
+
+void DocsWriter::add_document(const QString& md5, const QString& content,
+                              const QJsonObject& metadata,
+                              const QList<Annotation>& annotations,
+                              const QString& user_name,
+                              const QString& user_provided_id,
+                              const QString& short_title,
+                              const QString& long_title) {
+  (void)md5;
+  (void)content;
+  (void)metadata;
+  (void)annotations;
+  (void)user_name;
+  (void)user_provided_id;
+  (void)short_title;
+  (void)long_title;
+}
+
+DocsJsonLinesWriter::DocsJsonLinesWriter(const QString& file_path,
+                                         bool include_text,
+                                         bool include_annotations,
+                                         bool include_user_name,
+                                         QIODevice* device)
+    : DocsWriter(file_path, include_text, include_annotations,
+                 include_user_name,
+                 QIODevice::WriteOnly | QIODevice::Text, device),
+      output_(get_device()) {}
+
+bool DocsJsonLinesWriter::has_written_documents() const {
+  return has_written_documents_;
+}
+
+Utf8Writer& DocsJsonLinesWriter::get_output() { return output_; }
+
+void DocsJsonLinesWriter::add_document(
+    const QString& md5, const QString& content, const QJsonObject& metadata,
+    const QList<Annotation>& annotations, const QString& user_name,
+    const QString& user_provided_id, const QString& short_title,
+    const QString& long_title) {
+  if (has_written_documents_) {
+    output_.append_raw("\n");
+  }
+  // the keys are in the (sorted) order in which `QJsonDocument` writes them
+  bool is_first_key{true};
+  auto append_key = [this, &is_first_key](const char* key) {
+    output_.append_raw(is_first_key ? "{\"" : ",\"");
+    output_.append_raw(key);
+    output_.append_raw("\":");
+    is_first_key = false;
+  };
+  if (is_including_user_name() && user_name != QString()) {
+    append_key("annotation_approver");
+    output_.append_json_string(user_name);
+  }
+  if (user_provided_id != QString()) {
+    append_key("id");
+    output_.append_json_string(user_provided_id);
+  }
+  if (is_including_annotations()) {
+    append_key("labels");
+    output_.append_raw("[");
+    bool is_first_annotation{true};
+    for (const auto& annotation : annotations) {
+      output_.append_raw(is_first_annotation ? "[" : ",[");
+      is_first_annotation = false;
+      output_.append_number(annotation.start_char);
+      output_.append_raw(",");
+      output_.append_number(annotation.end_char);
+      output_.append_raw(",");
+      assert(annotation.label_name != "");
+      output_.append_json_string(annotation.label_name);
+      if (annotation.extra_data != "") {
+        output_.append_raw(",");
+        output_.append_json_string(annotation.extra_data);
+      }
+      output_.append_raw("]");
+    }
+    output_.append_raw("]");
+  }
+  if (is_including_text() && long_title != QString()) {
+    append_key("long_title");
+    output_.append_json_string(long_title);
+  }
+  append_key("meta");
+  output_.append_raw(QJsonDocument(metadata).toJson(QJsonDocument::Compact));
+  if (is_including_text() && short_title != QString()) {
+    append_key("short_title");
+    output_.append_json_string(short_title);
+  }
+  if (is_including_text()) {
+    append_key("text");
+    assert(content != "");
+    output_.append_json_string(content);
+  }
+  append_key("utf8_text_md5_checksum");
+  assert(md5 != "");
+  output_.append_json_string(md5);
+  output_.append_raw("}");
+  has_written_documents_ = true;
+}
+
+void DocsJsonLinesWriter::write_suffix() {
+  if (has_written_documents_) {
+    output_.append_raw("\n");
+  }
+}
+
+void DocsJsonLinesWriter::flush() { output_.flush(); }
+
+void DocsJsonLinesWriter::set_output_state(OutputState state) {
+  has_written_documents_ = state == OutputState::DocumentsWritten;
+}
+
+DocsJsonWriter::DocsJsonWriter(const QString& file_path, bool include_text,
+                               bool include_annotations, bool include_user_name,
+                               QIODevice* device)
+    : DocsJsonLinesWriter(file_path, include_text, include_annotations,
+                          include_user_name, device) {}
+
+void DocsJsonWriter::add_document(const QString& md5, const QString& content,
+                                  const QJsonObject& metadata,
+                                  const QList<Annotation>& annotations,
+                                  const QString& user_name,
+                                  const QString& user_provided_id,
+                                  const QString& short_title,
+                                  const QString& long_title) {
+  if (has_written_documents()) {
+    get_output().append_raw(",");
+  }
+  DocsJsonLinesWriter::add_document(md5, content, metadata, annotations,
+                                    user_name, user_provided_id, short_title,
+                                    long_title);
+}
+
+void DocsJsonWriter::write_prefix() { get_output().append_raw("[\n"); }
+
+void DocsJsonWriter::write_suffix() {
+  get_output().append_raw(has_written_documents() ? "\n]\n" : "]\n");
+}
+
+DocsCsvWriter::DocsCsvWriter(const QString& file_path, bool include_text,
+                             bool include_annotations, bool include_user_name,
+                             QIODevice* device)
+    : DocsWriter(file_path, include_text, include_annotations,
+                 include_user_name, QIODevice::WriteOnly, device),
+      output_(get_device()) {}
+
+void DocsCsvWriter::flush() { output_.flush(); }
+
+void DocsCsvWriter::write_prefix() {
+  // same byte order mark and empty first column as `CsvWriter`
+  output_.append_raw("\xef\xbb\xbf"
+                     "ignore_this_column,utf8_text_md5_checksum,meta,id");
+  if (is_including_user_name()) {
+    output_.append_raw(",annotation_approver");
+  }
+  if (is_including_text()) {
+    output_.append_raw(",short_title,long_title,text");
+  }
+  if (is_including_annotations()) {
+    output_.append_raw(",start_char,end_char,label,extra_data");
+  }
+  output_.append_raw("\r\n");
+}
+
+void DocsCsvWriter::add_document(const QString& md5, const QString& content,
+                                 const QJsonObject& metadata,
+                                 const QList<Annotation>& annotations,
+                                 const QString& user_name,
+                                 const QString& user_provided_id,
+                                 const QString& short_title,
+                                 const QString& long_title) {
+  assert(md5 != "");
+  auto serialized_metadata =
+      QJsonDocument(metadata).toJson(QJsonDocument::Compact);
+  // the document's columns are repeated on the row of each annotation
+  auto append_document_fields = [&]() {
+    output_.append_raw(",");
+    output_.append_csv_field(md5);
+    output_.append_raw(",");
+    output_.append_csv_field(serialized_metadata);
+    output_.append_raw(",");
+    output_.append_csv_field(user_provided_id);
+    if (is_including_user_name()) {
+      output_.append_raw(",");
+      output_.append_csv_field(user_name);
+    }
+    if (is_including_text()) {
+      assert(content != "");
+      output_.append_raw(",");
+      output_.append_csv_field(short_title);
+      output_.append_raw(",");
+      output_.append_csv_field(long_title);
+      output_.append_raw(",");
+      output_.append_csv_field(content);
+    }
+  };
+  if (annotations.size() == 0) {
+    append_document_fields();
+    if (is_including_annotations()) {
+      output_.append_raw(",,,,");
+    }
+    output_.append_raw("\r\n");
+  }
+  for (const auto& anno : annotations) {
+    append_document_fields();
+    if (is_including_annotations()) {
+      output_.append_raw(",");
+      output_.append_number(anno.start_char);
+      output_.append_raw(",");
+      output_.append_number(anno.end_char);
+      output_.append_raw(",");
+      assert(anno.label_name != "");
+      output_.append_csv_field(anno.label_name);
+      output_.append_raw(",");
+      output_.append_csv_field(anno.extra_data);
+    }
+    output_.append_raw("\r\n");
+  }
+}
+
+DocsXmlWriter::DocsXmlWriter(const QString& file_path, bool include_text,
+                             bool include_annotations, bool include_user_name,
+                             QIODevice* device)
+    : DocsWriter(file_path, include_text, include_annotations,
+                 include_user_name,
+                 QIODevice::WriteOnly | QIODevice::Text, device),
+      xml(get_device()) {
+  xml.setCodec("UTF-8");
+  xml.setAutoFormatting(true);
+}
+
+void DocsXmlWriter::write_prefix() {
+  xml.writeStartDocument();
+  xml.writeStartElement("document_set");
+}
+
+void DocsXmlWriter::write_suffix() {
+  xml.writeEndElement();
+  xml.writeEndDocument();
+}
+
+void DocsXmlWriter::set_output_state(OutputState state) {
+  if (state == OutputState::Empty) {
+    return;
+  }
+  // `QXmlStreamWriter` tracks the open elements and whether the last start
+  // tag is closed but cannot be given that state, so the start is written
+  // again to a discarded buffer. After a document, the `document_set` start
+  // tag is closed and the last node is a child, as after a comment.
+  QBuffer discarded{};
+  discarded.open(QIODevice::WriteOnly);
+  xml.setDevice(&discarded);
+  write_prefix();
+  if (state == OutputState::DocumentsWritten) {
+    xml.writeComment("");
+  }
+  xml.setDevice(get_device());
+}
+
+void DocsXmlWriter::add_document(const QString& md5, const QString& content,
+                                 const QJsonObject& metadata,
+                                 const QList<Annotation>& annotations,
+                                 const QString& user_name,
+                                 const QString& user_provided_id,
                                  const QString& short_title,
                                  const QString& long_title) {
 
@@ -672,6 +1665,412 @@ void DocsXmlWriter::add_annotations(const QList<Annotation>& annotations) {
   xml.writeEndElement();
 }
 
+namespace {
+/// flush the record batch once its buffers reach this size
+const qint64 max_arrow_batch_bytes{64 << 20};
+
+void append_optional(ArrowUtf8Column& column, const QString& value) {
+  if (value == QString()) {
+    column.append_null();
+  } else {
+    column.append(value);
+  }
+}
+} // namespace
+
+DocsArrowWriter::DocsArrowWriter(const QString& file_path, bool include_text,
+                                 bool include_annotations,
+                                 bool include_user_name, QIODevice* device,
+                                 int batch_size)
+    : DocsWriter(file_path, include_text, include_annotations,
+                 include_user_name, QIODevice::WriteOnly, device),
+      batch_size_{batch_size},
+      labels_{"labels", false, new ArrowStructColumn("item", false)},
+      file_writer_{get_device(), columns()} {
+  label_struct_ = static_cast<ArrowStructColumn*>(&labels_.values());
+  start_char_ =
+      label_struct_->add_field(new ArrowInt32Column("start_char", false));
+  end_char_ =
+      label_struct_->add_field(new ArrowInt32Column("end_char", false));
+  label_name_ = label_struct_->add_field(new ArrowUtf8Column("label", false));
+  extra_data_ =
+      label_struct_->add_field(new ArrowUtf8Column("extra_data", true));
+}
+
+std::vector<const ArrowColumn*> DocsArrowWriter::columns() const {
+  std::vector<const ArrowColumn*> all_columns{&md5_, &metadata_,
+                                              &user_provided_id_};
+  if (is_including_user_name()) {
+    all_columns.push_back(&user_name_);
+  }
+  if (is_including_text()) {
+    all_columns.push_back(&short_title_);
+    all_columns.push_back(&long_title_);
+    all_columns.push_back(&content_);
+  }
+  if (is_including_annotations()) {
+    all_columns.push_back(&labels_);
+  }
+  return all_columns;
+}
+
+void DocsArrowWriter::write_prefix() { file_writer_.write_prefix(); }
+
+void DocsArrowWriter::write_suffix() {
+  file_writer_.write_record_batch();
+  file_writer_.write_suffix();
+}
+
+void DocsArrowWriter::add_document(const QString& md5, const QString& content,
+                                   const QJsonObject& metadata,
+                                   const QList<Annotation>& annotations,
+                                   const QString& user_name,
+                                   const QString& user_provided_id,
+                                   const QString& short_title,
+                                   const QString& long_title) {
+  assert(md5 != "");
+  md5_.append(md5);
+  auto metadata_json = QJsonDocument(metadata).toJson(QJsonDocument::Compact);
+  metadata_.append_utf8(metadata_json);
+  append_optional(user_provided_id_, user_provided_id);
+  // approximate, the size of the text dominates
+  batch_n_bytes_ += metadata_json.size();
+  if (is_including_user_name()) {
+    append_optional(user_name_, user_name);
+  }
+  if (is_including_text()) {
+    assert(content != "");
+    append_optional(short_title_, short_title);
+    append_optional(long_title_, long_title);
+    content_.append(content);
+    batch_n_bytes_ += content.size();
+  }
+  if (is_including_annotations()) {
+    for (const auto& annotation : annotations) {
+      start_char_->append(annotation.start_char);
+      end_char_->append(annotation.end_char);
+      assert(annotation.label_name != "");
+      label_name_->append(annotation.label_name);
+      append_optional(*extra_data_, annotation.extra_data);
+      label_struct_->append();
+    }
+    labels_.append();
+    batch_n_bytes_ += 16 * annotations.size();
+  }
+  if (md5_.length() >= batch_size_ ||
+      batch_n_bytes_ >= max_arrow_batch_bytes) {
+    file_writer_.write_record_batch();
+    batch_n_bytes_ = 0;
+    // unused columns are empty anyway
+    for (auto* column : std::vector<ArrowColumn*>{
+             &md5_, &metadata_, &user_provided_id_, &user_name_,
+             &short_title_, &long_title_, &content_, &labels_}) {
+      column->clear();
+    }
+  }
+}
+
+DocsBundleWriter::DocsBundleWriter(const QString& file_path,
+                                   bool include_text, bool include_annotations,
+                                   bool include_user_name, QIODevice* device)
+    : DocsWriter(file_path, include_text, include_annotations,
+                 include_user_name, QIODevice::WriteOnly, device) {
+  // `resize(0)` keeps the capacity once it has been reserved
+  record_.reserve(1 << 16);
+}
+
+void DocsBundleWriter::write_prefix() {
+  QByteArray header(bundle_magic, bundle_magic_size);
+  append_uint32(header, bundle_version);
+  get_device()->write(header);
+}
+
+void DocsBundleWriter::add_document(const QString& md5, const QString& content,
+                                    const QJsonObject& metadata,
+                                    const QList<Annotation>& annotations,
+                                    const QString& user_name,
+                                    const QString& user_provided_id,
+                                    const QString& short_title,
+                                    const QString& long_title) {
+  record_.resize(0);
+  // the record size is filled in at the end
+  append_uint32(record_, 0);
+  auto raw_md5 = QByteArray::fromHex(md5.toLatin1());
+  assert(raw_md5.size() == md5_size);
+  record_.append(raw_md5);
+  append_bundle_field(record_,
+                      is_including_text() ? content.toUtf8() : QByteArray());
+  append_bundle_field(record_,
+                      QJsonDocument(metadata).toJson(QJsonDocument::Compact));
+  append_bundle_field(record_, user_provided_id.toUtf8());
+  append_bundle_field(record_, is_including_text() ? short_title.toUtf8()
+                                                   : QByteArray());
+  append_bundle_field(record_,
+                      is_including_text() ? long_title.toUtf8() : QByteArray());
+  append_bundle_field(record_, is_including_user_name() ? user_name.toUtf8()
+                                                        : QByteArray());
+  if (is_including_annotations()) {
+    append_uint32(record_, static_cast<quint32>(annotations.size()));
+    for (const auto& annotation : annotations) {
+      append_uint32(record_, static_cast<quint32>(annotation.start_char));
+      append_uint32(record_, static_cast<quint32>(annotation.end_char));
+      assert(annotation.label_name != "");
+      append_bundle_field(record_, annotation.label_name.toUtf8());
+      append_bundle_field(record_, annotation.extra_data.toUtf8());
+    }
+  } else {
+    append_uint32(record_, 0);
+  }
+  qToLittleEndian(static_cast<quint32>(record_.size() - 4),
+                  reinterpret_cast<uchar*>(record_.data()));
+  get_device()->write(record_);
+}
+
+namespace {
+
+/// The SQL list `(1, 2, ...)` of `label_ids`
+QString label_id_set(const QList<int>& label_ids) {
+  QStringList ids{};
+  for (auto label_id : label_ids) {
+    ids << QString::number(label_id);
+  }
+  return QString("(%0)").arg(ids.join(", "));
+}
+
+/// Conditions on `document` selecting the documents of `filter`.
+
+/// For a `search` filter, `search_query` is set to the FTS5 query that must be
+/// bound to `:search`; if the text has no words no document is selected.
+QStringList export_filter_conditions(const ExportFilter& filter,
+                                     QString& search_query) {
+  QStringList conditions{};
+  auto label_set = label_id_set(filter.label_ids);
+  search_query = filter.docs == ExportFilter::Docs::search
+                     ? search_text_to_fts_query(filter.search_text)
+                     : QString();
+  switch (filter.docs) {
+  case ExportFilter::Docs::all:
+    break;
+  case ExportFilter::Docs::labelled:
+    conditions << "id in (select doc_id from document_annotation_count)";
+    break;
+  case ExportFilter::Docs::unlabelled:
+    conditions << "id not in (select doc_id from document_annotation_count)";
+    break;
+  case ExportFilter::Docs::has_given_label:
+    conditions << QString("id in (select doc_id from document_label_count "
+                          "where label_id in %0)")
+                      .arg(label_set);
+    break;
+  case ExportFilter::Docs::not_has_given_label:
+    conditions << QString("id not in (select doc_id from "
+                          "document_label_count where label_id in %0)")
+                      .arg(label_set);
+    break;
+  case ExportFilter::Docs::search:
+    conditions << (search_query.isEmpty()
+                       ? "0"
+                       : "id in (select rowid from document_fts "
+                         "where document_fts match :search)");
+    break;
+  }
+  if (filter.min_doc_id >= 0) {
+    conditions << QString("id >= %0").arg(filter.min_doc_id);
+  }
+  if (filter.max_doc_id >= 0) {
+    conditions << QString("id <= %0").arg(filter.max_doc_id);
+  }
+  return conditions;
+}
+
+} // namespace
+
+DocsExportCursor::DocsExportCursor(const QSqlDatabase& database,
+                                   const LabelCache& labels,
+                                   bool labelled_docs_only, bool include_text,
+                                   bool include_annotations,
+                                   BatchStats* stats, qlonglong changed_since,
+                                   bool merge_segments,
+                                   const ExportFilter& filter)
+    : labels_{&labels}, include_annotations_{include_annotations},
+      stats_{stats}, merge_segments_{merge_segments}, doc_query_(database),
+      annotation_query_(database) {
+  QStringList conditions{"1"};
+  // conditions shared with the annotations query
+  QStringList annotation_conditions{"1"};
+  if (labelled_docs_only) {
+    conditions << "id in (select doc_id from document_annotation_count)";
+  }
+  if (changed_since >= 0) {
+    conditions << QString("id in (select doc_id from document_change where "
+                          "change_seq > %0)")
+                      .arg(changed_since);
+  }
+  QString search_query{};
+  conditions << export_filter_conditions(filter, search_query);
+  if (filter.min_doc_id >= 0) {
+    annotation_conditions << QString("doc_id >= %0").arg(filter.min_doc_id);
+  }
+  if (filter.max_doc_id >= 0) {
+    annotation_conditions << QString("doc_id <= %0").arg(filter.max_doc_id);
+  }
+  if (!filter.label_ids.isEmpty()) {
+    annotation_conditions
+        << QString("label_id in %0").arg(label_id_set(filter.label_ids));
+  }
+  auto where = conditions.join(" and ");
+  if (labelled_docs_only || changed_since >= 0 ||
+      filter.docs != ExportFilter::Docs::all) {
+    // so that only the annotations of the exported documents are read, with
+    // `annotation_doc_id_idx`, rather than skipping the others in `next`
+    annotation_conditions
+        << QString("doc_id in (select id from document where %0)").arg(where);
+  }
+  auto bind_search = [&search_query](QSqlQuery& query) {
+    if (!search_query.isEmpty()) {
+      query.bindValue(":search", search_query);
+    }
+  };
+  doc_query_.prepare(
+      QString("select count(*) from document where %0;").arg(where));
+  bind_search(doc_query_);
+  is_valid_ = doc_query_.exec() && doc_query_.next();
+  total_n_docs_ = doc_query_.value(0).toInt();
+  // we only go forward; this avoids caching all results in the QSqlQuery
+  doc_query_.setForwardOnly(true);
+  if (include_text) {
+    doc_query_.prepare(
+        QString("select id, lower(hex(content_md5)), content, metadata, "
+                "user_provided_id, short_title, long_title from "
+                "document_with_content where %0 order by id;")
+            .arg(where));
+  } else {
+    doc_query_.prepare(
+        QString("select id, lower(hex(content_md5)), null, metadata, "
+                "user_provided_id, null, null from document where %0 order "
+                "by id;")
+            .arg(where));
+  }
+  bind_search(doc_query_);
+  is_valid_ = doc_query_.exec() && is_valid_;
+  if (include_annotations_) {
+    annotation_query_.setForwardOnly(true);
+    annotation_query_.prepare(
+        QString("select doc_id, label_id, start_char, end_char, extra_data "
+                "from annotation where %0 order by doc_id, rowid;")
+            .arg(annotation_conditions.join(" and ")));
+    bind_search(annotation_query_);
+    is_valid_ = annotation_query_.exec() && is_valid_;
+    annotation_available_ = annotation_query_.next();
+  }
+}
+
+int DocsExportCursor::total_n_docs() const { return total_n_docs_; }
+
+bool DocsExportCursor::is_valid() const { return is_valid_; }
+
+const ExportedDocument& DocsExportCursor::current() const { return current_; }
+
+bool DocsExportCursor::next() {
+  PhaseTimer timer(stats_, BatchPhase::Query);
+  if (!pending_.empty()) {
+    current_ = std::move(pending_.front());
+    pending_.pop_front();
+  } else if (!read_document(current_)) {
+    return false;
+  }
+  if (merge_segments_) {
+    merge_segments();
+  }
+  return true;
+}
+
+bool DocsExportCursor::read_document(ExportedDocument& doc) {
+  if (!doc_query_.next()) {
+    return false;
+  }
+  doc.id = doc_query_.value(0).toInt();
+  doc.md5 = doc_query_.value(1).toString();
+  doc.content = content_from_sql(doc_query_.value(2));
+  doc.metadata = doc_query_.value(3).toByteArray();
+  doc.user_provided_id = doc_query_.value(4).toString();
+  doc.short_title = doc_query_.value(5).toString();
+  doc.long_title = doc_query_.value(6).toString();
+  doc.annotations.clear();
+  if (include_annotations_) {
+    read_annotations(doc);
+  }
+  return true;
+}
+
+void DocsExportCursor::merge_segments() {
+  auto metadata = QJsonDocument::fromJson(current_.metadata).object();
+  auto segment_info = metadata.value(segment_metadata_key).toObject();
+  auto n_segments = segment_info.value("n_segments").toInt();
+  if (segment_info.value("index").toInt(-1) != 0 || n_segments < 2) {
+    return;
+  }
+  auto parent_md5 = segment_info.value("parent_md5").toString();
+  QList<ExportedDocument> parts{};
+  QList<int> offsets{};
+  while (parts.size() + 1 != n_segments) {
+    ExportedDocument doc{};
+    if (!pending_.empty()) {
+      doc = std::move(pending_.front());
+      pending_.pop_front();
+    } else if (!read_document(doc)) {
+      break;
+    }
+    auto info = QJsonDocument::fromJson(doc.metadata)
+                    .object()
+                    .value(segment_metadata_key)
+                    .toObject();
+    if (info.value("parent_md5").toString() != parent_md5 ||
+        info.value("index").toInt() != parts.size() + 1) {
+      pending_.push_front(std::move(doc));
+      break;
+    }
+    offsets << info.value("offset").toInt();
+    parts << std::move(doc);
+  }
+  if (parts.size() + 1 != n_segments) {
+    // some segments are not exported: they are returned as they are
+    while (!parts.isEmpty()) {
+      pending_.push_front(parts.takeLast());
+    }
+    return;
+  }
+  current_.md5 = parent_md5;
+  metadata.remove(segment_metadata_key);
+  current_.metadata = QJsonDocument(metadata).toJson(QJsonDocument::Compact);
+  for (int i = 0; i != parts.size(); ++i) {
+    current_.content += parts[i].content;
+    for (auto annotation : parts[i].annotations) {
+      annotation.start_char += offsets[i];
+      annotation.end_char += offsets[i];
+      current_.annotations << annotation;
+    }
+  }
+}
+
+void DocsExportCursor::read_annotations(ExportedDocument& doc) {
+  // skip annotations of documents that are not exported
+  while (annotation_available_ &&
+         annotation_query_.value(0).toInt() < doc.id) {
+    annotation_available_ = annotation_query_.next();
+  }
+  while (annotation_available_ &&
+         annotation_query_.value(0).toInt() == doc.id) {
+    auto label = labels_->label(annotation_query_.value(1).toInt());
+    assert(label != nullptr);
+    doc.annotations << DocsWriter::Annotation{
+        annotation_query_.value(2).toInt(), annotation_query_.value(3).toInt(),
+        label != nullptr ? label->name : QString(),
+        annotation_query_.value(4).toString()};
+    annotation_available_ = annotation_query_.next();
+  }
+}
+
 LabelRecord json_to_label_record(const QJsonValue& json) {
   LabelRecord record;
   auto json_obj = json.toObject();
@@ -690,6 +2089,9 @@ LabelRecord json_to_label_record(const QJsonValue& json) {
 }
 
 const QString DatabaseCatalog::tmp_db_name_{":LABELBUDDY_TEMPORARY_DATABASE:"};
+const QString DatabaseCatalog::import_checkpoint_key{"import_checkpoint"};
+const QString DatabaseCatalog::export_change_token_key{
+    "export_change_token"};
 
 DatabaseCatalog::DatabaseCatalog(QObject* parent) : QObject(parent) {
   open_temp_database(false);
@@ -727,6 +2129,8 @@ void RemoveConnection::cancel() { cancelled_ = true; }
 
 bool DatabaseCatalog::open_database(const QString& database_path,
                                     bool remember) {
+  TraceScope trace("DatabaseCatalog::open_database");
+  open_error_ = QString();
   QString actual_database_path{database_path == QString()
                                    ? get_default_database_path()
                                    : absolute_database_path(database_path)};
@@ -735,6 +2139,7 @@ bool DatabaseCatalog::open_database(const QString& database_path,
   }
   if (QSqlDatabase::contains(actual_database_path)) {
     current_database = actual_database_path;
+    label_cache_.set_database(current_database);
     if (remember)
       store_db_path(actual_database_path);
     return true;
@@ -746,6 +2151,8 @@ bool DatabaseCatalog::open_database(const QString& database_path,
   // ":LABELBUDDY_TEMPORARY_DATABASE:" otherwise
   auto db_name =
       actual_database_path == tmp_db_name_ ? "" : actual_database_path;
+  auto read_only =
+      open_read_only_ && is_persistent_database(actual_database_path);
   bool initialized{};
   RemoveConnection remove_con(actual_database_path);
   {
@@ -754,19 +2161,83 @@ bool DatabaseCatalog::open_database(const QString& database_path,
     // https://doc.qt.io/qt-5/qsqldatabase.html#removeDatabase
     auto db = QSqlDatabase::addDatabase("QSQLITE", actual_database_path);
     db.setDatabaseName(db_name);
-    initialized = initialize_database(db);
+    // other processes may be writing to the same file, eg an import: wait for
+    // their transactions rather than failing when the database is locked
+    db.setConnectOptions(read_only
+                             ? "QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000"
+                             : "QSQLITE_BUSY_TIMEOUT=5000");
+    initialized = initialize_database(db, read_only);
+    if (initialized) {
+      QSqlQuery query(db);
+      initialized = check_content_compression(query, read_only);
+    }
   }
   if (!initialized) {
     return false;
   }
   remove_con.cancel();
   current_database = actual_database_path;
+  label_cache_.set_database(current_database);
+  apply_pragma_profile(get_pragma_profile());
+  if (read_only) {
+    // the recovery and backfill below need to write, and are left to the
+    // writable connections
+    if (remember)
+      store_db_path(actual_database_path);
+    emit new_database_opened(actual_database_path);
+    return true;
+  }
+  if (get_app_state_extra("bulk_load_in_progress", 0).toInt()) {
+    // the program stopped during a bulk load
+    end_bulk_load();
+  }
+  if (get_app_state_extra("document_summary_backfill_pending", 0).toInt()) {
+    // migrated from schema version 4 or older, maybe in a previous run
+    auto worker_path = worker_database_path(current_database);
+    if (asynchronous_backfill_ && worker_path != "") {
+      summary_backfill_.reset(new SummaryBackfillThread(worker_path));
+    } else {
+      QSqlQuery query(QSqlDatabase::database(current_database));
+      if (backfill_document_summaries(query) != -1) {
+        query.exec("DELETE FROM app_state_extra "
+                   "WHERE key = 'document_summary_backfill_pending';");
+      }
+    }
+  }
   if (remember)
     store_db_path(actual_database_path);
   emit new_database_opened(actual_database_path);
   return true;
 }
 
+QString DatabaseCatalog::get_open_error() const { return open_error_; }
+
+bool DatabaseCatalog::check_content_compression(QSqlQuery& query,
+                                                bool read_only) {
+  if (!is_compression_supported(Compression::Zstd)) {
+    if (content_requires_zstd(query)) {
+      open_error_ = "The database requires zstd support, which this build "
+                    "of labelbuddy does not have.";
+      return false;
+    }
+    return true;
+  }
+  if (read_only || get_content_layout(query) != ContentLayout::Compressed) {
+    return true;
+  }
+  // the text written from now on is compressed with zstd; written once so
+  // that opening the database usually needs no write
+  query.exec("SELECT value FROM app_state_extra "
+             "WHERE key = 'content_compression';");
+  auto recorded = query.next() ? query.value(0).toString() : QString();
+  query.finish();
+  if (recorded == "zstd") {
+    return true;
+  }
+  return query.exec("INSERT OR REPLACE INTO app_state_extra (key, value) "
+                    "VALUES ('content_compression', 'zstd');");
+}
+
 bool DatabaseCatalog::is_persistent_database(const QString& db_path) const {
   if (db_path == tmp_db_name_ || db_path == ":memory:" || db_path == "") {
     return false;
@@ -803,10 +2274,21 @@ QString DatabaseCatalog::open_temp_database(bool load_data) {
   return tmp_db_name_;
 }
 
+LabelCache* DatabaseCatalog::get_label_cache() { return &label_cache_; }
+
 QString DatabaseCatalog::get_current_database() const {
   return current_database;
 }
 
+bool DatabaseCatalog::is_read_only() const {
+  if (current_database == QString()) {
+    return false;
+  }
+  return QSqlDatabase::database(current_database, false)
+      .connectOptions()
+      .contains("QSQLITE_OPEN_READONLY");
+}
+
 QString DatabaseCatalog::parent_directory(const QString& file_path) const {
   auto dir = QDir(file_path);
   dir.cdUp();
@@ -856,6 +2338,43 @@ void DatabaseCatalog::set_app_state_extra(const QString& key,
   }
 }
 
+namespace {
+// add the compressed variants of document formats, eg jsonl.gz for jsonl
+QStringList with_compressed_formats(const QStringList& formats) {
+  auto all_formats = formats;
+  for (auto compression : {Compression::Gzip, Compression::Zstd}) {
+    if (is_compression_supported(compression)) {
+      for (const auto& format : formats) {
+        all_formats << format + "." + compression_suffix(compression);
+      }
+    }
+  }
+  return all_formats;
+}
+
+/// suffixes of the labelbuddy databases that can be merged into another
+QStringList database_formats() {
+  return {"labelbuddy", "lb", "sqlite3", "sqlite", "db"};
+}
+
+bool is_database_path(const QString& file_path) {
+  return database_formats().contains(QFileInfo(file_path).suffix());
+}
+
+/// `document_with_content` cannot be used for an attached database: the
+/// tables in its definition would be looked up in the main database
+QString content_table_name(ContentLayout layout) {
+  switch (layout) {
+  case ContentLayout::Separate:
+    return "document_content";
+  case ContentLayout::Compressed:
+    return "document_compressed_content";
+  default:
+    return "document";
+  }
+}
+} // namespace
+
 QPair<QStringList, QString>
 DatabaseCatalog::accepted_and_default_formats(Action action,
                                               ItemKind kind) const {
@@ -863,7 +2382,11 @@ DatabaseCatalog::accepted_and_default_formats(Action action,
   case Action::Import:
     switch (kind) {
     case ItemKind::Document:
-      return {{"txt", "json", "jsonl", "xml", "csv"}, "txt"};
+      // databases are merged rather than read, and are never compressed
+      return {with_compressed_formats(
+                  {"txt", "json", "jsonl", "xml", "csv", "lbb"})
+                  << database_formats(),
+              "txt"};
     case ItemKind::Label:
       return {{"txt", "json", "jsonl", "xml", "csv"}, "txt"};
     default:
@@ -873,7 +2396,10 @@ DatabaseCatalog::accepted_and_default_formats(Action action,
   case Action::Export:
     switch (kind) {
     case ItemKind::Document:
-      return {{"json", "jsonl", "xml", "csv"}, "json"};
+      // arrow files are not compressed, so that they can be memory-mapped
+      return {with_compressed_formats({"json", "jsonl", "xml", "csv", "lbb"})
+                  << "arrow",
+              "json"};
     case ItemKind::Label:
       return {{"json", "jsonl", "xml", "csv"}, "json"};
     default:
@@ -893,6 +2419,12 @@ DatabaseCatalog::file_extension_error_message(const QString& file_path,
   auto valid_and_default = accepted_and_default_formats(action, kind);
   QFileInfo info(file_path);
   auto suffix = info.suffix();
+  auto compression = compression_from_path(file_path);
+  if (compression != Compression::None) {
+    suffix = QString("%0.%1")
+                 .arg(QFileInfo(strip_compression_suffix(file_path)).suffix())
+                 .arg(suffix);
+  }
   QString error_msg{};
   if (valid_and_default.first.contains(suffix)) {
     return error_msg;
@@ -912,18 +2444,100 @@ DatabaseCatalog::file_extension_error_message(const QString& file_path,
   return error_msg;
 }
 
-int DatabaseCatalog::insert_doc_record(const DocRecord& record,
-                                       QSqlQuery& query) {
-  QByteArray hash{};
-  if (record.valid_content) {
-    query.prepare("insert into document (content, content_md5, metadata, "
-                  "user_provided_id, short_title, long_title) "
-                  "values (:content, :md5, :extra, :id, :st, :lt);");
-    query.bindValue(":content", record.content);
+void KnownMd5Filter::load(QSqlQuery& query) {
+  sorted_.clear();
+  added_.clear();
+  traced_exec(query, "select content_md5 from document;");
+  while (query.next()) {
+    sorted_.push_back(key(query.value(0).toByteArray()));
+  }
+  query.finish();
+  std::sort(sorted_.begin(), sorted_.end());
+}
+
+void KnownMd5Filter::insert(const QByteArray& md5) {
+  added_.insert(key(md5));
+  // merged in proportion to the vector's size so that sorting is amortized
+  if (added_.size() > std::max(std::size_t{1024}, sorted_.size() / 8)) {
+    auto middle = sorted_.insert(sorted_.end(), added_.begin(), added_.end());
+    std::sort(middle, sorted_.end());
+    std::inplace_merge(sorted_.begin(), middle, sorted_.end());
+    added_.clear();
+  }
+}
+
+bool KnownMd5Filter::may_contain(const QByteArray& md5) const {
+  auto md5_key = key(md5);
+  return added_.count(md5_key) != 0 ||
+         std::binary_search(sorted_.begin(), sorted_.end(), md5_key);
+}
+
+quint64 KnownMd5Filter::key(const QByteArray& md5) {
+  quint64 result{};
+  for (int i = 0; i != std::min(8, md5.size()); ++i) {
+    result = (result << 8) | static_cast<quint8>(md5[i]);
+  }
+  return result;
+}
+
+ImportSession::ImportSession(const QSqlDatabase& database,
+                             KnownMd5Filter* known_docs)
+    : insert_doc(database), insert_content(database), insert_label(database),
+      select_label_id(database), insert_annotation(database),
+      select_doc_id(database), known_docs{known_docs} {
+  layout = get_content_layout(insert_doc);
+  if (layout != ContentLayout::Inline) {
+    insert_doc.prepare(
+        "insert into document (content_md5, metadata, user_provided_id, "
+        "short_title, long_title, preview, content_length, n_code_points) "
+        "values (:md5, :extra, :id, :st, :lt, :preview, :clength, :ncp);");
+    insert_content.prepare(
+        QString("insert into %0 (id, content) values (:id, :content);")
+            .arg(layout == ContentLayout::Separate
+                     ? "document_content"
+                     : "document_compressed_content"));
+  } else {
+    insert_doc.prepare(
+        "insert into document (content, content_md5, metadata, "
+        "user_provided_id, short_title, long_title, preview, content_length, "
+        "n_code_points) values (:content, :md5, :extra, :id, :st, :lt, "
+        ":preview, :clength, :ncp);");
+  }
+  select_doc_id.prepare("select id from document where content_md5 = :md5;");
+  insert_label.prepare(
+      "insert into label (name, color) values (:name, :color);");
+  select_label_id.prepare("select id from label where name = :lname;");
+  // 'or ignore' so that one duplicate or invalid annotation does not stop the
+  // rest of the batch
+  insert_annotation.prepare(
+      "insert or ignore into annotation (doc_id, label_id, start_char, "
+      "end_char, extra_data) values (:docid, :labelid, :schar, :echar, "
+      ":extra);");
+}
+
+bool DatabaseCatalog::insert_doc_record(const DocRecord& record,
+                                        const QByteArray& content_md5,
+                                        ImportSession& session) {
+  assert(session.known_docs != nullptr);
+  auto find_doc_id = [&session, &content_md5]() {
+    auto& select = session.select_doc_id;
+    select.bindValue(":md5", content_md5);
+    int found{-1};
+    if (traced_exec(select) && select.next()) {
+      found = select.value(0).toInt();
+    }
+    select.finish();
+    return found;
+  };
+  int doc_id{session.known_docs->may_contain(content_md5) ? find_doc_id()
+                                                          : -1};
+  if (doc_id == -1 && record.valid_content) {
+    auto& query = session.insert_doc;
+    if (session.layout == ContentLayout::Inline) {
+      query.bindValue(":content", record.content);
+    }
     query.bindValue(":extra", record.metadata);
-    hash = QCryptographicHash::hash(record.content.toUtf8(),
-                                    QCryptographicHash::Md5);
-    query.bindValue(":md5", hash);
+    query.bindValue(":md5", content_md5);
     query.bindValue(":id", record.user_provided_id != QString()
                                ? record.user_provided_id
                                : QVariant());
@@ -931,60 +2545,233 @@ int DatabaseCatalog::insert_doc_record(const DocRecord& record,
                                                            : QVariant());
     query.bindValue(":lt", record.long_title != QString() ? record.long_title
                                                           : QVariant());
-    query.exec();
-  } else {
-    if (record.declared_md5 == QString()) {
-      return 0;
+    query.bindValue(":preview",
+                    document_preview(record.content, record.long_title));
+    query.bindValue(":clength", utf8_length(record.content));
+    query.bindValue(":ncp", n_code_points(record.content));
+    auto inserted = traced_exec(query);
+    if (inserted) {
+      doc_id = query.lastInsertId().toInt();
+      session.known_docs->insert(content_md5);
+    } else {
+      // the filter does not know documents inserted by other means since it
+      // was loaded, eg by merging a database
+      doc_id = find_doc_id();
+      if (doc_id == -1) {
+        return false;
+      }
+    }
+    if (inserted && session.layout != ContentLayout::Inline) {
+      session.insert_content.bindValue(":id", doc_id);
+      // the md5 is that of the uncompressed text, so that duplicates are
+      // still found
+      session.insert_content.bindValue(
+          ":content", session.layout == ContentLayout::Compressed
+                          ? QVariant(compress_content(record.content))
+                          : QVariant(record.content));
+      if (!traced_exec(session.insert_content)) {
+        // a row without its content would not be in `document_with_content`
+        // but would still be counted, and prevent importing it again
+        QSqlQuery delete_doc(QSqlDatabase::database(current_database));
+        delete_doc.prepare("delete from document where id = :id;");
+        delete_doc.bindValue(":id", doc_id);
+        traced_exec(delete_doc);
+        // staying in the filter only costs a lookup if it is seen again
+        return false;
+      }
+    }
+    if (inserted) {
+      ++session.n_inserted_docs;
     }
-    // bad chars are skipped. this is not inserted in db but used for lookup.
-    hash = QByteArray::fromHex(record.declared_md5.toUtf8());
   }
-  if (record.annotations.size() == 0) {
-    return 0;
+  // if the document was already in the database (or only its md5 was given)
+  // the new annotations are attached to the existing row
+  if (doc_id == -1 || record.annotations.empty()) {
+    return true;
   }
-  query.prepare("select id from document where content_md5 = :md5;");
-  query.bindValue(":md5", hash);
-  query.exec();
-  if (!query.next()) {
-    return 0;
+  insert_doc_annotations(doc_id, record.annotations, session);
+  return true;
+}
+
+void DatabaseCatalog::insert_doc_annotations(
+    int doc_id, const std::vector<AnnotationRecord>& annotations,
+    ImportSession& session) {
+  // the QSQLITE driver executes a batch row by row anyway, and only reports
+  // the rows affected by the last one
+  auto& query = session.insert_annotation;
+  query.bindValue(":docid", doc_id);
+  for (const auto& annotation : annotations) {
+    auto label_id = get_label_id_for_import(annotation.label, session);
+    if (label_id == -1) {
+      // bad annotation (eg empty label)
+      continue;
+    }
+    query.bindValue(":labelid", label_id);
+    query.bindValue(":schar", annotation.start_char);
+    query.bindValue(":echar", annotation.end_char);
+    query.bindValue(":extra", annotation.extra_data.isEmpty()
+                                  ? QVariant(QVariant::String)
+                                  : QVariant(annotation.extra_data));
+    if (query.exec()) {
+      session.n_inserted_annotations += std::max(0, query.numRowsAffected());
+    }
+  }
+}
+
+int DatabaseCatalog::get_label_id_for_import(const QString& label_name,
+                                             ImportSession& session) {
+  auto cached = session.label_ids.constFind(label_name);
+  if (cached != session.label_ids.constEnd()) {
+    return cached.value();
+  }
+  auto existing_id = label_cache_.name_to_id(label_name);
+  if (existing_id != -1) {
+    session.label_ids[label_name] = existing_id;
+    return existing_id;
+  }
+  session.insert_label.bindValue(":name", label_name);
+  session.insert_label.bindValue(":color", suggest_label_color(color_index));
+  if (session.insert_label.exec()) {
+    ++color_index;
   }
-  auto doc_id = query.value(0).toInt();
-  return insert_doc_annotations(doc_id, record.annotations, query);
+  int label_id{-1};
+  session.select_label_id.bindValue(":lname", label_name);
+  session.select_label_id.exec();
+  if (session.select_label_id.next()) {
+    label_id = session.select_label_id.value(0).toInt();
+  }
+  session.select_label_id.finish();
+  session.label_ids[label_name] = label_id;
+  return label_id;
 }
 
-int DatabaseCatalog::insert_doc_annotations(int doc_id,
-                                            const QJsonArray& annotations,
-                                            QSqlQuery& query) {
-  int n_annotations{};
-  for (const auto& annotation : annotations) {
-    auto annotation_array = annotation.toArray();
-    insert_label(query, annotation_array[2].toString());
-    query.prepare("select id from label where name = :lname;");
-    query.bindValue(":lname", annotation_array[2].toString());
-    query.exec();
-    if (!query.next()) {
-      // bad annotation (eg empty label)
-      continue;
+namespace {
+
+/// commit the pre-annotations at least this often
+const int pre_annotation_docs_per_transaction{500};
+
+} // namespace
+
+PreAnnotationResult DatabaseCatalog::pre_annotate_documents(
+    const PreAnnotationOptions& options, const ExportFilter& filter,
+    const std::function<void(int)>& on_progress) {
+  TraceScope trace("pre_annotate_documents");
+  flush_pending_writes(current_database);
+  auto database = QSqlDatabase::database(current_database);
+  QSqlQuery query(database);
+  if (filter.docs == ExportFilter::Docs::search &&
+      !create_search_index(query)) {
+    return {0, 0, ErrorCode::FileSystemError,
+            "Could not create the full-text index."};
+  }
+  PreAnnotationPool pool(options.command, std::max(1, options.n_processes));
+  if (!pool.start()) {
+    return {0, 0, ErrorCode::FileSystemError, pool.error_message()};
+  }
+  auto batch_size = std::max(1, options.batch_size);
+  QString search_query{};
+  auto conditions = export_filter_conditions(filter, search_query);
+  conditions.prepend("id > :last");
+  auto read_sql = QString("select id, content from document_with_content "
+                          "where %0 order by id limit :n;")
+                      .arg(conditions.join(" and "));
+  ImportSession session(database, nullptr);
+
+  PreAnnotationResult result{0, 0, ErrorCode::NoError, ""};
+  // sizes of the batches sent to the pool, oldest first
+  std::deque<int> pending_batch_sizes{};
+  int n_uncommitted_docs{};
+  bool in_transaction{};
+  auto commit = [&]() {
+    if (!in_transaction) {
+      return;
     }
-    auto label_id = query.value(0).toInt();
-    query.prepare(
-        "insert into annotation (doc_id, label_id, start_char, end_char, "
-        "extra_data) values (:docid, :labelid, :schar, :echar, :extra);");
-    query.bindValue(":docid", doc_id);
-    query.bindValue(":labelid", label_id);
-    query.bindValue(":schar", annotation_array[0].toInt());
-    query.bindValue(":echar", annotation_array[1].toInt());
-    if (annotation_array.size() == 4) {
-      auto extra = annotation_array[3].toString();
-      query.bindValue(":extra", extra != "" ? extra : QVariant());
-    } else {
-      query.bindValue(":extra", QVariant());
+    in_transaction = false;
+    if (!traced_exec(query, "commit transaction;")) {
+      traced_exec(query, "rollback transaction;");
+      session.n_inserted_annotations = 0;
+      result.error_code = ErrorCode::DatabaseError;
+      result.error_message = "Could not commit the pre-annotations.";
+      return;
     }
-    if (query.exec()) {
-      ++n_annotations;
+    result.n_docs += n_uncommitted_docs;
+    n_uncommitted_docs = 0;
+    result.n_annotations += session.n_inserted_annotations;
+    session.n_inserted_annotations = 0;
+    if (on_progress) {
+      on_progress(result.n_docs);
+    }
+  };
+  auto last_id = std::numeric_limits<qlonglong>::min();
+  bool docs_left{true};
+  std::vector<PredictedAnnotations> predicted{};
+  while (result.error_code == ErrorCode::NoError) {
+    // the next batches are read while the processes annotate theirs
+    while (docs_left && pool.can_submit()) {
+      query.prepare(read_sql);
+      query.bindValue(":last", last_id);
+      query.bindValue(":n", batch_size);
+      if (!search_query.isEmpty()) {
+        query.bindValue(":search", search_query);
+      }
+      if (!traced_exec(query)) {
+        result.error_code = ErrorCode::FileSystemError;
+        result.error_message = "Could not read the documents to pre-annotate.";
+        break;
+      }
+      QVector<QPair<int, QString>> docs{};
+      while (query.next()) {
+        docs << qMakePair(query.value(0).toInt(),
+                          content_from_sql(query.value(1)));
+      }
+      query.finish();
+      docs_left = docs.size() == batch_size;
+      if (docs.isEmpty()) {
+        break;
+      }
+      last_id = docs.last().first;
+      pending_batch_sizes.push_back(docs.size());
+      if (!pool.submit(docs)) {
+        result.error_code = ErrorCode::FileSystemError;
+        result.error_message = pool.error_message();
+        break;
+      }
+    }
+    if (result.error_code != ErrorCode::NoError || pool.n_pending() == 0) {
+      break;
+    }
+    auto n_batch_docs = pending_batch_sizes.front();
+    pending_batch_sizes.pop_front();
+    if (!pool.take_result(predicted)) {
+      result.error_code = ErrorCode::CriticalParsingError;
+      result.error_message = pool.error_message();
+      break;
+    }
+    if (!in_transaction) {
+      traced_exec(query, "begin transaction;");
+      in_transaction = true;
+    }
+    for (const auto& doc : predicted) {
+      if (!doc.annotations.empty()) {
+        insert_doc_annotations(doc.doc_id, doc.annotations, session);
+      }
+    }
+    n_uncommitted_docs += n_batch_docs;
+    if (n_uncommitted_docs >= pre_annotation_docs_per_transaction) {
+      commit();
     }
   }
-  return n_annotations;
+  // what was received before an error is kept
+  auto error_code = result.error_code;
+  auto error_message = result.error_message;
+  commit();
+  if (error_code != ErrorCode::NoError) {
+    result.error_code = error_code;
+    result.error_message = error_message;
+  }
+  // labels may have been created
+  label_cache_.invalidate();
+  return result;
 }
 
 void DatabaseCatalog::insert_label(QSqlQuery& query, const QString& label_name,
@@ -1020,7 +2807,7 @@ void DatabaseCatalog::insert_label(QSqlQuery& query, const QString& label_name,
 std::unique_ptr<DocsReader>
 DatabaseCatalog::get_docs_reader(const QString& file_path) const {
   std::unique_ptr<DocsReader> reader;
-  auto suffix = QFileInfo(file_path).suffix();
+  auto suffix = QFileInfo(strip_compression_suffix(file_path)).suffix();
   if (suffix == "xml") {
     reader.reset(new XmlDocsReader(file_path));
   } else if (suffix == "json") {
@@ -1029,59 +2816,521 @@ DatabaseCatalog::get_docs_reader(const QString& file_path) const {
     reader.reset(new JsonLinesDocsReader(file_path));
   } else if (suffix == "csv") {
     reader.reset(new CsvDocsReader(file_path));
+  } else if (suffix == "lbb") {
+    reader.reset(new BundleDocsReader(file_path));
   } else {
     reader.reset(new TxtDocsReader(file_path));
   }
   return reader;
 }
 
-ImportDocsResult DatabaseCatalog::import_documents(const QString& file_path,
-                                                   QProgressDialog* progress) {
-  QSqlQuery query(QSqlDatabase::database(current_database));
-  query.exec("select count(*) from document;");
+const QList<PragmaProfile>& pragma_profiles() {
+  // synchronous = normal is safe in WAL mode: a power loss can lose the last
+  // transactions but not corrupt the database
+  static const QList<PragmaProfile> profiles{
+      {"default", "delete", "full", -2000, 0, "default", 4096},
+      {"fast", "wal", "normal", -65536, 268435456, "memory", 4096},
+      {"bulk", "wal", "normal", -262144, 1073741824, "memory", 8192}};
+  return profiles;
+}
+
+bool find_pragma_profile(const QString& name, PragmaProfile& profile) {
+  for (const auto& known_profile : pragma_profiles()) {
+    if (known_profile.name == name) {
+      profile = known_profile;
+      return true;
+    }
+  }
+  return false;
+}
+
+namespace {
+
+bool exec_pragma_profile(QSqlQuery& query, const PragmaProfile& profile) {
+  bool success{true};
+  if (profile.journal_mode != QString()) {
+    success *= query.exec(
+        QString("PRAGMA journal_mode = %0;").arg(profile.journal_mode));
+  }
+  if (profile.synchronous != QString()) {
+    success *= query.exec(
+        QString("PRAGMA synchronous = %0;").arg(profile.synchronous));
+  }
+  success *=
+      query.exec(QString("PRAGMA cache_size = %0;").arg(profile.cache_size));
+  success *=
+      query.exec(QString("PRAGMA mmap_size = %0;").arg(profile.mmap_size));
+  success *=
+      query.exec(QString("PRAGMA temp_store = %0;").arg(profile.temp_store));
+  query.finish();
+  return success;
+}
+
+/// Vacuum the database, setting its page size first.
+void vacuum_with_page_size(QSqlQuery& query, int page_size) {
+  query.exec("PRAGMA journal_mode;");
   query.next();
-  auto n_before = query.value(0).toInt();
+  auto journal_mode = query.value(0).toString();
+  query.finish();
+  // the page size cannot be changed in WAL mode
+  if (journal_mode == "wal") {
+    query.exec("PRAGMA journal_mode = delete;");
+  }
+  query.exec(QString("PRAGMA page_size = %0;").arg(page_size));
+  // converts databases created without it
+  query.exec("PRAGMA auto_vacuum = INCREMENTAL;");
+  query.exec("VACUUM;");
+  if (journal_mode == "wal") {
+    query.exec("PRAGMA journal_mode = wal;");
+  }
+  query.finish();
+}
+
+/// Applies the connection settings of the "bulk" pragma profile until it is
+/// destroyed, then restores those of the database's own profile.
+
+/// The journal mode, stored in the database file, is left as it is.
+class BulkPragmaScope {
+public:
+  explicit BulkPragmaScope(DatabaseCatalog& catalog) : catalog_(catalog) {
+    catalog_.apply_pragma_profile("bulk", true);
+  }
+  ~BulkPragmaScope() {
+    catalog_.apply_pragma_profile(catalog_.get_pragma_profile(), true);
+  }
+
+private:
+  DatabaseCatalog& catalog_;
+};
+
+/// What identifies an imported file in an import checkpoint
+QJsonObject import_checkpoint_file_info(const QString& file_path) {
+  QFileInfo info(file_path);
+  QJsonObject file_info{};
+  file_info["file"] = info.absoluteFilePath();
+  file_info["size"] = static_cast<double>(info.size());
+  file_info["modified"] =
+      static_cast<double>(info.lastModified().toMSecsSinceEpoch());
+  return file_info;
+}
+
+} // namespace
+
+ImportDocsResult DatabaseCatalog::import_documents(const QString& file_path,
+                                                   QProgressDialog* progress,
+                                                   int checkpoint_interval) {
+  TraceScope trace("DatabaseCatalog::import_documents");
+  // the annotations being edited are committed before the import's transactions
+  flush_pending_writes(current_database);
+  BulkPragmaScope bulk_pragmas(*this);
+  auto prepared = prepare_import(file_path, checkpoint_interval);
+  KnownMd5Filter known_docs{};
+  if (prepared.reading_thread != nullptr) {
+    QSqlQuery query(QSqlDatabase::database(current_database));
+    known_docs.load(query);
+  }
+  return run_import(prepared, progress, checkpoint_interval, known_docs);
+}
+
+QList<ImportDocsResult>
+DatabaseCatalog::import_documents(const QStringList& file_paths, int n_threads,
+                                  int checkpoint_interval) {
+  TraceScope trace("DatabaseCatalog::import_documents");
+  flush_pending_writes(current_database);
+  BulkPragmaScope bulk_pragmas(*this);
+  // the files after the one being inserted are read ahead with larger queues
+  // so that their reading threads keep working meanwhile
+  const std::size_t read_ahead_queue_size{1 << 14};
+  std::deque<PreparedImport> pending{};
+  QList<ImportDocsResult> results{};
+  // read once for all the files rather than by each of their sessions
+  KnownMd5Filter known_docs{};
+  {
+    QSqlQuery query(QSqlDatabase::database(current_database));
+    known_docs.load(query);
+  }
+  int n_prepared{};
+  for (int i = 0; i != file_paths.size(); ++i) {
+    while (n_prepared != file_paths.size() &&
+           n_prepared < i + std::max(1, n_threads)) {
+      pending.push_back(prepare_import(
+          file_paths[n_prepared], checkpoint_interval,
+          n_prepared == i ? std::size_t{256} : read_ahead_queue_size));
+      ++n_prepared;
+    }
+    results << run_import(pending.front(), nullptr, checkpoint_interval,
+                          known_docs);
+    pending.pop_front();
+  }
+  return results;
+}
+
+DatabaseCatalog::PreparedImport
+DatabaseCatalog::prepare_import(const QString& file_path,
+                                int checkpoint_interval,
+                                std::size_t max_queue_size) {
+  PreparedImport prepared{};
+  if (is_database_path(file_path)) {
+    prepared.source_database = file_path;
+    return prepared;
+  }
   auto reader = get_docs_reader(file_path);
   if (reader->has_error()) {
-    return {0, 0, reader->error_code(), reader->error_message()};
+    prepared.error_code = reader->error_code();
+    prepared.error_message = reader->error_message();
+    return prepared;
+  }
+  prepared.progress_max = reader->progress_max();
+  prepared.checkpoint = import_checkpoint_file_info(file_path);
+  if (checkpoint_interval > 0) {
+    const auto stored =
+        QJsonDocument::fromJson(
+            get_app_state_extra(import_checkpoint_key, QString())
+                .toString()
+                .toUtf8())
+            .object();
+    const auto& checkpoint = prepared.checkpoint;
+    if (stored.value("file") == checkpoint.value("file") &&
+        stored.value("size") == checkpoint.value("size") &&
+        stored.value("modified") == checkpoint.value("modified")) {
+      prepared.has_checkpoint = true;
+      prepared.n_docs_read = stored.value("n_docs").toInt();
+      auto offset = static_cast<qint64>(stored.value("offset").toDouble(-1));
+      prepared.n_docs_to_skip = reader->seek(offset) ? 0 : prepared.n_docs_read;
+      prepared.resume_message =
+          QString("Resuming import of %0 after document %1")
+              .arg(file_path)
+              .arg(prepared.n_docs_read);
+    }
+  }
+  // parsing and hashing happen in the reading thread (or its hashing
+  // threads), insertion in this one
+  prepared.reading_thread.reset(new DocsReadingThread(
+      std::move(reader), max_queue_size, batch_stats_,
+      max_imported_doc_length_, n_hashing_threads_));
+  return prepared;
+}
+
+ImportDocsResult DatabaseCatalog::run_import(PreparedImport& prepared,
+                                             QProgressDialog* progress,
+                                             int checkpoint_interval,
+                                             KnownMd5Filter& known_docs) {
+  if (prepared.source_database != QString()) {
+    return merge_database(prepared.source_database, progress);
   }
+  if (prepared.reading_thread == nullptr) {
+    return {0, 0, prepared.error_code, prepared.error_message};
+  }
+  QSqlQuery query(QSqlDatabase::database(current_database));
   if (progress != nullptr) {
-    progress->setMaximum(reader->progress_max() + 1);
+    progress->setMaximum(prepared.progress_max + 1);
   }
+  if (prepared.resume_message != QString()) {
+    if (progress != nullptr) {
+      progress->setLabelText(prepared.resume_message + "...");
+    } else {
+      std::cout << prepared.resume_message.toStdString() << std::endl;
+    }
+  }
+  auto& checkpoint = prepared.checkpoint;
+  auto& n_docs_read = prepared.n_docs_read;
+  auto& n_docs_to_skip = prepared.n_docs_to_skip;
+  auto& has_checkpoint = prepared.has_checkpoint;
+  auto& reading_thread = *prepared.reading_thread;
   bool cancelled{};
   query.exec("begin transaction;");
+  ImportSession session(QSqlDatabase::database(current_database),
+                        &known_docs);
+  DocsReadingThread::Item item{};
+  int n_in_transaction{};
+  int n_failed_docs{};
+  // rows inserted in the transactions already committed
+  int n_docs{};
   int n_annotations{};
-  int n_docs_read{};
+  auto count_committed = [&session, &n_docs, &n_annotations]() {
+    n_docs += session.n_inserted_docs;
+    n_annotations += session.n_inserted_annotations;
+    session.n_inserted_docs = 0;
+    session.n_inserted_annotations = 0;
+  };
+  ConsoleProgress console_progress("Read ", " documents");
   std::cout << std::endl;
-  while (reader->read_next()) {
+  while (reading_thread.next(item)) {
     if (progress != nullptr && progress->wasCanceled()) {
       cancelled = true;
       break;
     }
-    if (reader->has_error()) {
-      break;
+    if (n_docs_to_skip > 0) {
+      // already imported before the checkpoint
+      --n_docs_to_skip;
+      continue;
     }
     ++n_docs_read;
-    std::cout << "Read " << n_docs_read << " documents\r" << std::flush;
-    n_annotations += insert_doc_record(*(reader->get_current_record()), query);
+    console_progress.update(n_docs_read);
+    {
+      PhaseTimer timer(batch_stats_, BatchPhase::Insert);
+      if (item.record != nullptr &&
+          !insert_doc_record(*item.record, item.content_md5, session)) {
+        ++n_failed_docs;
+      }
+      for (const auto& segment : item.segments) {
+        if (!insert_doc_record(*segment, segment->content_md5, session)) {
+          ++n_failed_docs;
+        }
+      }
+    }
     if (progress != nullptr) {
-      progress->setValue(reader->current_progress());
+      progress->setValue(item.progress);
+    }
+    if (checkpoint_interval > 0 && ++n_in_transaction == checkpoint_interval) {
+      checkpoint["n_docs"] = n_docs_read;
+      checkpoint["offset"] = static_cast<double>(item.resume_offset);
+      set_app_state_extra(
+          import_checkpoint_key,
+          QString::fromUtf8(
+              QJsonDocument(checkpoint).toJson(QJsonDocument::Compact)));
+      {
+        PhaseTimer timer(batch_stats_, BatchPhase::Commit);
+        if (query.exec("commit transaction;")) {
+          count_committed();
+        }
+      }
+      query.exec("begin transaction;");
+      has_checkpoint = true;
+      n_in_transaction = 0;
     }
   }
-  std::cout << std::endl;
-  if (cancelled || reader->has_error()) {
+  reading_thread.stop();
+  console_progress.finish(n_docs_read);
+  const auto& finished_reader = reading_thread.reader();
+  if (cancelled || finished_reader.has_error()) {
+    // with checkpoints, only the documents since the last one are lost
     query.exec("rollback transaction");
   } else {
-    query.exec("commit transaction");
+    if (has_checkpoint) {
+      query.prepare("delete from app_state_extra where key = :key;");
+      query.bindValue(":key", import_checkpoint_key);
+      query.exec();
+    }
+    PhaseTimer timer(batch_stats_, BatchPhase::Commit);
+    if (query.exec("commit transaction")) {
+      count_committed();
+    }
   }
-  query.exec("select count(*) from document;");
+  label_cache_.invalidate();
+  if (progress != nullptr) {
+    progress->setValue(progress->maximum());
+  }
+  if (n_failed_docs != 0 && !finished_reader.has_error() && !cancelled) {
+    return {n_docs, n_annotations, ErrorCode::DatabaseError,
+            QString("%0 documents could not be inserted.").arg(n_failed_docs)};
+  }
+  return {n_docs, n_annotations, finished_reader.error_code(),
+          finished_reader.error_message()};
+}
+
+ImportDocsResult DatabaseCatalog::merge_database(const QString& source_path,
+                                                 QProgressDialog* progress) {
+  TraceScope trace("DatabaseCatalog::merge_database");
+  QFileInfo source_info(source_path);
+  // attaching a missing file would create an empty database
+  if (!source_info.isFile()) {
+    return {0, 0, ErrorCode::FileSystemError, "Could not open file."};
+  }
+  auto database = QSqlDatabase::database(current_database);
+  if (QFileInfo(database.databaseName()).canonicalFilePath() ==
+      source_info.canonicalFilePath()) {
+    return {0, 0, ErrorCode::CriticalParsingError,
+            "Cannot merge a database into itself."};
+  }
+  QSqlQuery query(database);
+  // must be done outside of a transaction
+  query.prepare("attach database :path as merge_source;");
+  query.bindValue(":path", source_info.absoluteFilePath());
+  if (!traced_exec(query)) {
+    return {0, 0, ErrorCode::FileSystemError, "Could not open database."};
+  }
+  auto detach = [&query](ErrorCode code, const QString& message) {
+    query.exec("detach database merge_source;");
+    return ImportDocsResult{0, 0, code, message};
+  };
+  query.exec("pragma merge_source.application_id;");
+  if (!query.next() || query.value(0).toInt() != -14315518) {
+    return detach(ErrorCode::CriticalParsingError,
+                  "Not a labelbuddy database.");
+  }
+  query.exec("pragma merge_source.user_version;");
   query.next();
-  auto n_after = query.value(0).toInt();
+  auto source_version = query.value(0).toInt();
+  if (source_version > 7) {
+    return detach(ErrorCode::CriticalParsingError,
+                  "The database was created by a more recent version of "
+                  "labelbuddy.");
+  }
+  if (source_version < 7) {
+    // migrations are only applied to the main database
+    return detach(ErrorCode::CriticalParsingError,
+                  "The database was created by an older version of "
+                  "labelbuddy. Open it once with this version to update it, "
+                  "then merge it again.");
+  }
+  auto source_layout = get_content_layout(query, "merge_source");
+  auto target_layout = get_content_layout(query);
+  if (!is_compression_supported(Compression::Zstd) &&
+      content_requires_zstd(query, "merge_source")) {
+    return detach(ErrorCode::DatabaseError,
+                  "The database requires zstd support, which this build of "
+                  "labelbuddy does not have.");
+  }
+  if (progress != nullptr) {
+    progress->setMaximum(4);
+  }
+  query.exec("select coalesce(max(id), 0) from document;");
+  query.next();
+  auto last_id_before = query.value(0).toLongLong();
+  int n_docs{};
+  int n_annotations{};
+
+  query.exec("begin transaction;");
+  // new labels are added after the existing ones, in the source's order; a
+  // shortcut key already used in the target is dropped
+  bool ok = traced_exec(
+      query, "insert or ignore into main.label (name, color, shortcut_key) "
+             "select name, color, case when shortcut_key in (select "
+             "shortcut_key from main.label where shortcut_key is not null) "
+             "then null else shortcut_key end from merge_source.label order "
+             "by display_order is null, display_order, id;");
+  if (progress != nullptr) {
+    progress->setValue(1);
+  }
+  const QString doc_columns{"content_md5, preview, content_length, "
+                            "n_code_points, metadata, user_provided_id, "
+                            "long_title, short_title"};
+  const QString source_doc_columns{
+      "source.content_md5, source.preview, source.content_length, "
+      "source.n_code_points, source.metadata, source.user_provided_id, "
+      "source.long_title, source.short_title"};
+  if (ok && target_layout != ContentLayout::Inline) {
+    // the text is inserted by `merge_attached_content`
+    ok = traced_exec(
+        query, QString("insert or ignore into main.document (%0) select %1 "
+                       "from merge_source.document as source order by "
+                       "source.id;")
+                   .arg(doc_columns, source_doc_columns));
+    n_docs = query.numRowsAffected();
+  } else if (ok && source_layout != ContentLayout::Compressed) {
+    ok = traced_exec(
+        query, QString("insert or ignore into main.document (%0, content) "
+                       "select %1, stored.content from merge_source.document "
+                       "as source join merge_source.%2 as stored on "
+                       "stored.id = source.id order by source.id;")
+                   .arg(doc_columns, source_doc_columns,
+                        content_table_name(source_layout)));
+    n_docs = query.numRowsAffected();
+  } else if (ok) {
+    // the text must be uncompressed, which SQLite cannot do
+    KnownMd5Filter known_docs{};
+    known_docs.load(query);
+    ImportSession session(database, &known_docs);
+    ok = traced_exec(
+        query, "select source.content_md5, source.metadata, "
+               "source.user_provided_id, source.short_title, "
+               "source.long_title, stored.content from merge_source.document "
+               "as source join merge_source.document_compressed_content as "
+               "stored on stored.id = source.id order by source.id;");
+    DocRecord record{};
+    while (ok && query.next()) {
+      record.metadata = query.value(1).toByteArray();
+      record.user_provided_id = query.value(2).toString();
+      record.short_title = query.value(3).toString();
+      record.long_title = query.value(4).toString();
+      record.content = content_from_sql(query.value(5));
+      // the transaction is rolled back if one of them cannot be inserted
+      ok = insert_doc_record(record, query.value(0).toByteArray(), session);
+    }
+    query.finish();
+    n_docs = session.n_inserted_docs;
+  }
+  if (progress != nullptr) {
+    progress->setValue(2);
+  }
+  if (ok && target_layout != ContentLayout::Inline) {
+    ok = merge_attached_content(query, source_layout, target_layout,
+                                last_id_before);
+  }
+  if (progress != nullptr) {
+    progress->setValue(3);
+  }
+  if (ok) {
+    ok = traced_exec(
+        query,
+        "insert or ignore into main.annotation (doc_id, label_id, "
+        "start_char, end_char, extra_data) select doc.id, label.id, "
+        "source.start_char, source.end_char, source.extra_data from "
+        "merge_source.annotation as source join merge_source.document as "
+        "source_doc on source_doc.id = source.doc_id join main.document as "
+        "doc on doc.content_md5 = source_doc.content_md5 join "
+        "merge_source.label as source_label on source_label.id = "
+        "source.label_id join main.label as label on label.name = "
+        "source_label.name order by doc.id, source.rowid;");
+    n_annotations = query.numRowsAffected();
+  }
+  auto cancelled = progress != nullptr && progress->wasCanceled();
+  if (!ok || cancelled) {
+    query.exec("rollback transaction;");
+    label_cache_.invalidate();
+    return detach(ok ? ErrorCode::NoError : ErrorCode::DatabaseError,
+                  ok ? QString() : QString("Could not merge the database."));
+  }
+  {
+    PhaseTimer timer(batch_stats_, BatchPhase::Commit);
+    query.exec("commit transaction;");
+  }
+  query.exec("detach database merge_source;");
+  label_cache_.invalidate();
   if (progress != nullptr) {
     progress->setValue(progress->maximum());
   }
-  return {n_after - n_before, n_annotations, reader->error_code(),
-          reader->error_message()};
+  return {n_docs, n_annotations, ErrorCode::NoError, QString()};
+}
+
+bool DatabaseCatalog::merge_attached_content(QSqlQuery& query,
+                                             ContentLayout source_layout,
+                                             ContentLayout target_layout,
+                                             qlonglong last_id_before) {
+  auto select = QString("select doc.id, stored.content from main.document "
+                        "as doc join merge_source.document as source on "
+                        "source.content_md5 = doc.content_md5 join "
+                        "merge_source.%0 as stored on stored.id = source.id "
+                        "where doc.id > :last order by doc.id")
+                    .arg(content_table_name(source_layout));
+  auto target_table = content_table_name(target_layout);
+  bool source_compressed = source_layout == ContentLayout::Compressed;
+  bool target_compressed = target_layout == ContentLayout::Compressed;
+  if (source_compressed == target_compressed) {
+    // the stored values can be copied as they are
+    query.prepare(QString("insert into main.%0 (id, content) %1;")
+                      .arg(target_table, select));
+    query.bindValue(":last", last_id_before);
+    return traced_exec(query);
+  }
+  QSqlQuery insert(QSqlDatabase::database(current_database));
+  insert.prepare(QString("insert into main.%0 (id, content) values (:id, "
+                         ":content);")
+                     .arg(target_table));
+  query.prepare(select + ";");
+  query.bindValue(":last", last_id_before);
+  bool ok = traced_exec(query);
+  while (ok && query.next()) {
+    auto content = content_from_sql(query.value(1));
+    insert.bindValue(":id", query.value(0));
+    insert.bindValue(":content", target_compressed
+                                     ? QVariant(compress_content(content))
+                                     : QVariant(content));
+    ok = traced_exec(insert);
+  }
+  query.finish();
+  return ok;
 }
 
 QPair<QJsonArray, QPair<ErrorCode, QString>>
@@ -1205,6 +3454,7 @@ QPair<QJsonArray, QPair<ErrorCode, QString>> read_txt_labels(QFile& file) {
 }
 
 ImportLabelsResult DatabaseCatalog::import_labels(const QString& file_path) {
+  flush_pending_writes(current_database);
   QSqlQuery query(QSqlDatabase::database(current_database));
   query.exec("select count(*) from label;");
   query.next();
@@ -1220,6 +3470,7 @@ ImportLabelsResult DatabaseCatalog::import_labels(const QString& file_path) {
                  label_record.shortcut_key);
   }
   query.exec("commit transaction;");
+  label_cache_.invalidate();
   query.exec("select count(*) from label;");
   query.next();
   auto n_after = query.value(0).toInt();
@@ -1229,74 +3480,229 @@ ImportLabelsResult DatabaseCatalog::import_labels(const QString& file_path) {
 std::unique_ptr<DocsWriter>
 DatabaseCatalog::get_docs_writer(const QString& file_path, bool include_text,
                                  bool include_annotations,
-                                 bool include_user_name) const {
+                                 bool include_user_name,
+                                 QIODevice* device) const {
 
-  auto suffix = QFileInfo(file_path).suffix();
+  auto suffix = QFileInfo(strip_compression_suffix(file_path)).suffix();
   std::unique_ptr<DocsWriter> writer{nullptr};
   if (suffix == "xml") {
     writer.reset(new DocsXmlWriter(file_path, include_text, include_annotations,
-                                   include_user_name));
+                                   include_user_name, device));
   } else if (suffix == "csv") {
     writer.reset(new DocsCsvWriter(file_path, include_text, include_annotations,
-                                   include_user_name));
+                                   include_user_name, device));
+  } else if (suffix == "lbb") {
+    writer.reset(new DocsBundleWriter(file_path, include_text,
+                                      include_annotations, include_user_name,
+                                      device));
+  } else if (suffix == "arrow") {
+    writer.reset(new DocsArrowWriter(file_path, include_text,
+                                     include_annotations, include_user_name,
+                                     device));
   } else if (suffix == "jsonl") {
-    writer.reset(new DocsJsonLinesWriter(
-        file_path, include_text, include_annotations, include_user_name));
+    writer.reset(new DocsJsonLinesWriter(file_path, include_text,
+                                         include_annotations,
+                                         include_user_name, device));
   } else {
     writer.reset(new DocsJsonWriter(file_path, include_text,
-                                    include_annotations, include_user_name));
+                                    include_annotations, include_user_name,
+                                    device));
   }
   return writer;
 }
 
+namespace {
+void write_exported_document(DocsWriter& writer, const ExportedDocument& doc,
+                             const QString& user_name) {
+  writer.add_document(doc.md5, doc.content,
+                      QJsonDocument::fromJson(doc.metadata).object(),
+                      doc.annotations, user_name, doc.user_provided_id,
+                      doc.short_title, doc.long_title);
+}
+} // namespace
+
+QString export_shard_path(const QString& file_path, int shard_index) {
+  // the shard number goes before the compression suffix if there is one
+  auto compression = compression_from_path(file_path);
+  QFileInfo info(strip_compression_suffix(file_path));
+  auto name = QString("%0-%1").arg(info.completeBaseName()).arg(
+      shard_index, 5, 10, QChar('0'));
+  if (info.suffix() != "") {
+    name += "." + info.suffix();
+  }
+  if (compression != Compression::None) {
+    name += "." + compression_suffix(compression);
+  }
+  return info.dir().filePath(name);
+}
+
+DocsShardWritingThread::DocsShardWritingThread(
+    std::unique_ptr<DocsWriter> writer, const QString& user_name,
+    std::size_t max_queue_size, BatchStats* stats)
+    : writer_{std::move(writer)}, user_name_{user_name},
+      max_queue_size_{max_queue_size}, stats_{stats},
+      thread_(&DocsShardWritingThread::run, this) {}
+
+DocsShardWritingThread::~DocsShardWritingThread() { finish(); }
+
+void DocsShardWritingThread::run() {
+  writer_->write_prefix();
+  while (true) {
+    ExportedDocument doc{};
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_empty_.wait(lock,
+                      [this] { return finish_requested_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        break;
+      }
+      doc = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    not_full_.notify_one();
+    PhaseTimer timer(stats_, BatchPhase::Serialize);
+    write_exported_document(*writer_, doc, user_name_);
+  }
+  writer_->write_suffix();
+  // close the file from this thread before `finish` returns
+  writer_.reset();
+}
+
+void DocsShardWritingThread::add(const ExportedDocument& doc) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this] { return queue_.size() < max_queue_size_; });
+    queue_.push_back(doc);
+  }
+  not_empty_.notify_one();
+}
+
+void DocsShardWritingThread::finish() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finish_requested_ = true;
+  }
+  not_empty_.notify_one();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+QByteArray DatabaseCatalog::serialize_docs_batch(
+    const QString& file_path, bool include_text, bool include_annotations,
+    const QString& user_name, const QList<ExportedDocument>& docs,
+    bool is_first_batch) const {
+  QBuffer buffer{};
+  auto writer = get_docs_writer(file_path, include_text, include_annotations,
+                                user_name != "", &buffer);
+  if (is_first_batch) {
+    writer->write_prefix();
+  } else {
+    writer->set_output_state(DocsWriter::OutputState::DocumentsWritten);
+  }
+  for (const auto& doc : docs) {
+    write_exported_document(*writer, doc, user_name);
+  }
+  writer->flush();
+  return buffer.data();
+}
+
+QByteArray DatabaseCatalog::serialize_docs_suffix(const QString& file_path,
+                                                  bool include_text,
+                                                  bool include_annotations,
+                                                  const QString& user_name,
+                                                  int n_docs) const {
+  QBuffer buffer{};
+  auto writer = get_docs_writer(file_path, include_text, include_annotations,
+                                user_name != "", &buffer);
+  if (n_docs) {
+    writer->set_output_state(DocsWriter::OutputState::DocumentsWritten);
+  } else {
+    // with no documents the prefix may not be complete until the suffix is
+    // written (eg an empty XML element), so the whole output is made here
+    writer->write_prefix();
+  }
+  writer->write_suffix();
+  writer->flush();
+  return buffer.data();
+}
+
 ExportDocsResult DatabaseCatalog::export_documents(const QString& file_path,
                                                    bool labelled_docs_only,
                                                    bool include_text,
                                                    bool include_annotations,
                                                    const QString& user_name,
-                                                   QProgressDialog* progress) {
+                                                   QProgressDialog* progress,
+                                                   int n_threads,
+                                                   int shard_size,
+                                                   qlonglong changed_since,
+                                                   const ExportFilter& filter) {
+  TraceScope trace("DatabaseCatalog::export_documents");
+  // the export threads' connections only see committed annotations
+  flush_pending_writes(current_database);
+  // the labels may have been modified through another connection or model
+  label_cache_.invalidate();
+  if (filter.docs == ExportFilter::Docs::search) {
+    QSqlQuery query(QSqlDatabase::database(current_database));
+    if (!create_search_index(query)) {
+      return {0, 0, ErrorCode::FileSystemError,
+              QString("Could not create the search index.")};
+    }
+  }
+  DocsExportCursor cursor(QSqlDatabase::database(current_database),
+                          label_cache_, labelled_docs_only, include_text,
+                          include_annotations, batch_stats_, changed_since,
+                          merge_exported_segments_, filter);
+  if (!cursor.is_valid()) {
+    return {0, 0, ErrorCode::FileSystemError,
+            QString("Could not read the documents to export.")};
+  }
+  if (shard_size > 0) {
+    return export_documents_in_shards(file_path, cursor, include_text,
+                                      include_annotations, user_name, progress,
+                                      n_threads, shard_size);
+  }
+  // the footer of an arrow file lists the offsets of all the record batches,
+  // so the output cannot be made by concatenating independent chunks
+  auto is_arrow =
+      QFileInfo(strip_compression_suffix(file_path)).suffix() == "arrow";
+  if (n_threads > 1 && !is_arrow) {
+    return export_documents_in_parallel(file_path, cursor, include_text,
+                                        include_annotations, user_name,
+                                        progress, n_threads);
+  }
   bool include_user_name = user_name != "";
   auto writer = get_docs_writer(file_path, include_text, include_annotations,
                                 include_user_name);
   if (!writer->is_open()) {
     return {0, 0, ErrorCode::FileSystemError, QString("Could not open file.")};
   }
-
-  QSqlQuery query(QSqlDatabase::database(current_database));
-  int total_n_docs{};
-  if (labelled_docs_only) {
-    query.exec("select count(*) from labelled_document;");
-    query.next();
-    total_n_docs = query.value(0).toInt();
-    query.exec("select id from labelled_document order by id;");
-  } else {
-    query.exec("select count(*) from document;");
-    query.next();
-    total_n_docs = query.value(0).toInt();
-    query.exec("select id from document order by id;");
-  }
   if (progress != nullptr) {
-    progress->setMaximum(total_n_docs + 1);
+    progress->setMaximum(cursor.total_n_docs() + 1);
   }
 
   int n_docs{};
   int n_annotations{};
   writer->write_prefix();
+  ConsoleProgress console_progress("Exported ", " documents.");
   std::cout << std::endl;
-  while (query.next()) {
+  while (cursor.next()) {
     if (progress != nullptr && progress->wasCanceled()) {
       break;
     }
     ++n_docs;
-    auto doc_id = query.value(0).toInt();
-    n_annotations += write_doc(*writer, doc_id, include_text,
-                               include_annotations, user_name);
+    const auto& doc = cursor.current();
+    {
+      PhaseTimer timer(batch_stats_, BatchPhase::Serialize);
+      write_exported_document(*writer, doc, user_name);
+    }
+    n_annotations += doc.annotations.size();
     if (progress != nullptr) {
       progress->setValue(n_docs);
     }
-    std::cout << "Exported " << n_docs << " documents.\r" << std::flush;
+    console_progress.update(n_docs);
   }
-  std::cout << std::endl;
+  console_progress.finish(n_docs);
   writer->write_suffix();
   if (progress != nullptr) {
     progress->setValue(progress->maximum());
@@ -1304,53 +3710,152 @@ ExportDocsResult DatabaseCatalog::export_documents(const QString& file_path,
   return {n_docs, n_annotations, ErrorCode::NoError, ""};
 }
 
-int DatabaseCatalog::write_doc(DocsWriter& writer, int doc_id,
-                               bool include_text, bool include_annotations,
-                               const QString& user_name) {
-  QSqlQuery doc_query(QSqlDatabase::database(current_database));
+qlonglong DatabaseCatalog::get_change_token() const {
+  QSqlQuery query(QSqlDatabase::database(current_database));
+  query.exec("select coalesce(max(change_seq), 0) from document_change;");
+  query.next();
+  return query.value(0).toLongLong();
+}
 
-  if (include_text) {
-    doc_query.prepare("select lower(hex(content_md5)) as md5, content, "
-                      "metadata, user_provided_id, "
-                      "short_title, long_title from document where id = :doc;");
-  } else {
-    doc_query.prepare(
-        "select lower(hex(content_md5)) as md5, null as content, metadata, "
-        "user_provided_id, null as short_title, null as long_title "
-        "from document where id = :doc;");
-  }
-  doc_query.bindValue(":doc", doc_id);
-  doc_query.exec();
-  doc_query.next();
-  auto metadata =
-      QJsonDocument::fromJson(doc_query.value("metadata").toByteArray())
-          .object();
+ExportDocsResult DatabaseCatalog::export_documents_in_shards(
+    const QString& file_path, DocsExportCursor& cursor, bool include_text,
+    bool include_annotations, const QString& user_name,
+    QProgressDialog* progress, int n_threads, int shard_size) {
+  // the cursor is read in this thread while each shard is written by its own
+  // thread; at most `n_threads` shards are being written at the same time.
+  if (progress != nullptr) {
+    progress->setMaximum(cursor.total_n_docs() + 1);
+  }
+  const auto max_writing = static_cast<std::size_t>(std::max(n_threads, 1));
+  std::deque<std::unique_ptr<DocsShardWritingThread>> shards{};
+  int n_docs{};
+  int n_annotations{};
+  int n_shards{};
+  int n_docs_in_shard{};
+  ConsoleProgress console_progress("Exported ", " documents.");
+  bool has_next = cursor.next();
+  // an empty export still produces one (empty) shard
+  while (n_shards == 0 || has_next) {
+    if (progress != nullptr && progress->wasCanceled()) {
+      break;
+    }
+    if (shards.empty() || n_docs_in_shard == shard_size) {
+      // `finish` is called when the oldest writing thread is destroyed
+      while (shards.size() >= max_writing) {
+        shards.pop_front();
+      }
+      auto writer = get_docs_writer(export_shard_path(file_path, n_shards),
+                                    include_text, include_annotations,
+                                    user_name != "");
+      if (!writer->is_open()) {
+        return {n_docs, n_annotations, ErrorCode::FileSystemError,
+                QString("Could not open file.")};
+      }
+      shards.emplace_back(new DocsShardWritingThread(std::move(writer),
+                                                     user_name, 256,
+                                                     batch_stats_));
+      ++n_shards;
+      n_docs_in_shard = 0;
+    }
+    if (!has_next) {
+      break;
+    }
+    const auto& doc = cursor.current();
+    shards.back()->add(doc);
+    ++n_docs;
+    ++n_docs_in_shard;
+    n_annotations += doc.annotations.size();
+    if (progress != nullptr) {
+      progress->setValue(n_docs);
+    }
+    console_progress.update(n_docs);
+    has_next = cursor.next();
+  }
+  shards.clear();
+  console_progress.finish(n_docs);
+  if (progress != nullptr) {
+    progress->setValue(progress->maximum());
+  }
+  return {n_docs, n_annotations, ErrorCode::NoError, ""};
+}
+
+ExportDocsResult DatabaseCatalog::export_documents_in_parallel(
+    const QString& file_path, DocsExportCursor& cursor, bool include_text,
+    bool include_annotations, const QString& user_name,
+    QProgressDialog* progress, int n_threads) {
+  // the cursor is only used by this thread; workers receive copies of the
+  // documents and serialize them with their own writer into a buffer. Buffers
+  // are written to the file in the order in which batches were created.
+  auto file = make_file_device(file_path);
+  if (!file->open(QIODevice::WriteOnly)) {
+    return {0, 0, ErrorCode::FileSystemError, QString("Could not open file.")};
+  }
+  if (progress != nullptr) {
+    progress->setMaximum(cursor.total_n_docs() + 1);
+  }
+  const int batch_size{256};
+  const auto max_pending = static_cast<std::size_t>(2 * n_threads);
+  struct PendingBatch {
+    int n_docs;
+    int n_annotations;
+    std::future<QByteArray> data;
+  };
+  std::deque<PendingBatch> pending{};
+  int n_docs{};
   int n_annotations{};
-  QList<DocsWriter::Annotation> annotations{};
-  if (include_annotations) {
-    QSqlQuery annotations_query(QSqlDatabase::database(current_database));
-    annotations_query.prepare(
-        "select label.name as label_name, start_char, end_char, extra_data "
-        "from annotation inner join label on annotation.label_id = label.id "
-        "where annotation.doc_id = :doc order by annotation.rowid;");
-    annotations_query.bindValue(":doc", doc_id);
-    annotations_query.exec();
-    while (annotations_query.next()) {
-      annotations << DocsWriter::Annotation{
-          annotations_query.value("start_char").toInt(),
-          annotations_query.value("end_char").toInt(),
-          annotations_query.value("label_name").toString(),
-          annotations_query.value("extra_data").toString()};
-      ++n_annotations;
-    }
-  }
-  writer.add_document(doc_query.value("md5").toString(),
-                      doc_query.value("content").toString(), metadata,
-                      annotations, user_name,
-                      doc_query.value("user_provided_id").toString(),
-                      doc_query.value("short_title").toString(),
-                      doc_query.value("long_title").toString());
-  return n_annotations;
+  int n_batches{};
+  bool canceled{};
+  ConsoleProgress console_progress("Exported ", " documents.");
+
+  auto write_oldest_batch = [&]() {
+    auto& batch = pending.front();
+    file->write(batch.data.get());
+    n_docs += batch.n_docs;
+    n_annotations += batch.n_annotations;
+    pending.pop_front();
+    if (progress != nullptr) {
+      progress->setValue(n_docs);
+    }
+    console_progress.update(n_docs);
+  };
+
+  std::cout << std::endl;
+  while (!canceled) {
+    QList<ExportedDocument> docs{};
+    int batch_n_annotations{};
+    while (docs.size() < batch_size && cursor.next()) {
+      docs << cursor.current();
+      batch_n_annotations += cursor.current().annotations.size();
+    }
+    if (docs.isEmpty()) {
+      break;
+    }
+    bool is_first_batch = n_batches == 0;
+    ++n_batches;
+    pending.push_back(
+        {docs.size(), batch_n_annotations,
+         std::async(std::launch::async, [=]() {
+           PhaseTimer timer(batch_stats_, BatchPhase::Serialize);
+           return serialize_docs_batch(file_path, include_text,
+                                       include_annotations, user_name, docs,
+                                       is_first_batch);
+         })});
+    while (pending.size() >= max_pending) {
+      write_oldest_batch();
+    }
+    canceled = progress != nullptr && progress->wasCanceled();
+  }
+  while (!pending.empty()) {
+    write_oldest_batch();
+  }
+  console_progress.finish(n_docs);
+  // if no batch was written the prefix is included in the suffix's output
+  file->write(serialize_docs_suffix(file_path, include_text,
+                                   include_annotations, user_name, n_docs));
+  if (progress != nullptr) {
+    progress->setValue(progress->maximum());
+  }
+  return {n_docs, n_annotations, ErrorCode::NoError, ""};
 }
 
 ExportLabelsResult DatabaseCatalog::export_labels(const QString& file_path) {
@@ -1462,21 +3967,126 @@ DatabaseCatalog::write_labels_to_csv(const QJsonArray& labels,
   return {labels.size(), ErrorCode::NoError, ""};
 }
 
+namespace {
+
+/// Build the filter described by the `export_*` options (printing an error
+/// and returning false if a label does not exist)
+bool batch_export_filter(DatabaseCatalog& catalog, const BatchOptions& options,
+                         ExportFilter& filter) {
+  static const QMap<QString, ExportFilter::Docs> doc_filters{
+      {"", ExportFilter::Docs::all},
+      {"labelled", ExportFilter::Docs::labelled},
+      {"unlabelled", ExportFilter::Docs::unlabelled},
+      {"has-label", ExportFilter::Docs::has_given_label},
+      {"not-has-label", ExportFilter::Docs::not_has_given_label},
+      {"search", ExportFilter::Docs::search}};
+  if (!doc_filters.contains(options.export_doc_filter)) {
+    std::cerr << "Unknown document filter: "
+              << options.export_doc_filter.toStdString() << std::endl;
+    return false;
+  }
+  filter.docs = doc_filters.value(options.export_doc_filter);
+  // the labels may have been imported by this batch
+  auto label_cache = catalog.get_label_cache();
+  label_cache->invalidate();
+  for (const auto& name : options.export_label_names) {
+    auto label_id = label_cache->name_to_id(name);
+    if (label_id == -1) {
+      std::cerr << "No such label: " << name.toStdString() << std::endl;
+      return false;
+    }
+    filter.label_ids << label_id;
+  }
+  filter.search_text = options.export_search_text;
+  filter.min_doc_id = options.export_min_doc_id;
+  filter.max_doc_id = options.export_max_doc_id;
+  return true;
+}
+
+/// `app_state_extra` key of the change token for exports with these filters.
+
+/// Unfiltered exports use `export_change_token_key`; the others get one
+/// token per filter, so that a filtered export does not advance the token of
+/// the documents it left out.
+QString filtered_change_token_key(const BatchOptions& options,
+                                  bool labelled_docs_only) {
+  QJsonObject description{};
+  if (labelled_docs_only) {
+    description["labelled_only"] = true;
+  }
+  if (options.export_doc_filter != QString()) {
+    description["docs"] = options.export_doc_filter;
+  }
+  if (!options.export_label_names.isEmpty()) {
+    description["labels"] =
+        QJsonArray::fromStringList(options.export_label_names);
+  }
+  if (options.export_doc_filter == "search") {
+    description["search"] = options.export_search_text;
+  }
+  if (options.export_min_doc_id >= 0) {
+    description["min_id"] = options.export_min_doc_id;
+  }
+  if (options.export_max_doc_id >= 0) {
+    description["max_id"] = options.export_max_doc_id;
+  }
+  if (description.isEmpty()) {
+    return DatabaseCatalog::export_change_token_key;
+  }
+  return QString("%0:%1").arg(
+      DatabaseCatalog::export_change_token_key,
+      QString::fromUtf8(
+          QJsonDocument(description).toJson(QJsonDocument::Compact)));
+}
+
+} // namespace
+
 int batch_import_export(
     const QString& db_path, const QList<QString>& labels_files,
     const QList<QString>& docs_files, const QString& export_labels_file,
     const QString& export_docs_file, bool labelled_docs_only, bool include_text,
-    bool include_annotations, const QString& user_name, bool vacuum) {
+    bool include_annotations, const QString& user_name, bool vacuum,
+    const BatchOptions& options) {
+  if (options.read_only &&
+      (!labels_files.isEmpty() || !docs_files.isEmpty() || vacuum ||
+       options.pragma_profile != QString() ||
+       options.pre_annotate_command != QString())) {
+    std::cerr << "A database opened read-only can only be exported"
+              << std::endl;
+    return 1;
+  }
   DatabaseCatalog catalog{};
+  catalog.set_open_read_only(options.read_only);
+  if (options.compress_content) {
+    catalog.set_new_database_content_layout(ContentLayout::Compressed);
+  } else if (options.separate_content) {
+    catalog.set_new_database_content_layout(ContentLayout::Separate);
+  }
   if (!catalog.open_database(db_path, false)) {
     std::cerr << "Could not open database: " << db_path.toStdString()
               << std::endl;
+    if (catalog.get_open_error() != QString()) {
+      std::cerr << catalog.get_open_error().toStdString() << std::endl;
+    }
+    return 1;
+  }
+  if (options.pragma_profile != QString() &&
+      !catalog.set_pragma_profile(options.pragma_profile)) {
+    std::cerr << "Unknown pragma profile: "
+              << options.pragma_profile.toStdString() << std::endl;
     return 1;
   }
   if (vacuum) {
     catalog.vacuum_db();
     return 0;
   }
+  BatchStats stats{};
+  if (options.stats_format == "json") {
+    catalog.set_batch_stats(&stats);
+  }
+  catalog.set_max_imported_doc_length(options.import_max_doc_length);
+  catalog.set_n_hashing_threads(options.n_hashing_threads);
+  catalog.set_merge_exported_segments(options.export_merge_segments);
   int errors{};
   QString error_msg{};
   for (const auto& l_file : labels_files) {
@@ -1493,20 +4103,59 @@ int batch_import_export(
       std::cerr << error_msg.toStdString() << std::endl;
     }
   }
+  if (options.bulk_load && !docs_files.isEmpty() &&
+      !catalog.begin_bulk_load()) {
+    std::cerr << "Could not start bulk load" << std::endl;
+    return 1;
+  }
+  QStringList valid_docs_files{};
   for (const auto& d_file : docs_files) {
     error_msg = catalog.file_extension_error_message(
         d_file, DatabaseCatalog::Action::Import,
-        DatabaseCatalog::ItemKind::Document, false);
-    if (error_msg == QString()) {
-      auto res = catalog.import_documents(d_file);
-      if (res.error_code != ErrorCode::NoError) {
-        errors = 1;
-      }
+        DatabaseCatalog::ItemKind::Document, false);
+    if (error_msg == QString()) {
+      valid_docs_files << d_file;
     } else {
       errors = 1;
       std::cerr << error_msg.toStdString() << std::endl;
     }
   }
+  auto import_results =
+      catalog.import_documents(valid_docs_files, options.n_import_threads,
+                               options.import_checkpoint_interval);
+  for (int i = 0; i != import_results.size(); ++i) {
+    const auto& res = import_results[i];
+    if (res.error_code != ErrorCode::NoError) {
+      errors = 1;
+    }
+    stats.add_imported(res.n_docs, res.n_annotations,
+                       QFileInfo(valid_docs_files[i]).size());
+  }
+  if (options.bulk_load && !docs_files.isEmpty() && !catalog.end_bulk_load()) {
+    std::cerr << "Could not rebuild indexes after bulk load" << std::endl;
+    errors = 1;
+  }
+  if (options.pre_annotate_command != QString()) {
+    ExportFilter filter{};
+    if (!batch_export_filter(catalog, options, filter)) {
+      return 1;
+    }
+    PreAnnotationOptions pre_annotation{};
+    pre_annotation.command = options.pre_annotate_command;
+    pre_annotation.batch_size = options.pre_annotate_batch_size;
+    pre_annotation.n_processes = options.pre_annotate_n_processes;
+    ConsoleProgress console_progress("Pre-annotated ", " documents.");
+    auto res = catalog.pre_annotate_documents(
+        pre_annotation, filter,
+        [&console_progress](int n_docs) { console_progress.update(n_docs); });
+    console_progress.finish(res.n_docs);
+    std::cout << "Inserted " << res.n_annotations << " annotations."
+              << std::endl;
+    if (res.error_code != ErrorCode::NoError) {
+      std::cerr << res.error_message.toStdString() << std::endl;
+      errors = 1;
+    }
+  }
   if (export_labels_file != QString()) {
     error_msg = catalog.file_extension_error_message(
         export_labels_file, DatabaseCatalog::Action::Export,
@@ -1528,22 +4177,140 @@ int batch_import_export(
       std::cerr << error_msg.toStdString() << std::endl;
       // still exported, so don't count it as an error
     }
-    auto res =
-        catalog.export_documents(export_docs_file, labelled_docs_only,
-                                 include_text, include_annotations, user_name);
+    auto token_key = filtered_change_token_key(options, labelled_docs_only);
+    qlonglong changed_since{-1};
+    if (options.export_since == "last") {
+      changed_since = catalog.get_app_state_extra(token_key, 0).toLongLong();
+    } else if (options.export_since != QString()) {
+      changed_since = options.export_since.toLongLong();
+    }
+    ExportFilter filter{};
+    if (!batch_export_filter(catalog, options, filter)) {
+      return 1;
+    }
+    // read before exporting so that changes made meanwhile are not missed
+    auto change_token = catalog.get_change_token();
+    auto res = catalog.export_documents(
+        export_docs_file, labelled_docs_only, include_text, include_annotations,
+        user_name, nullptr, options.n_export_threads, options.export_shard_size,
+        changed_since, filter);
     if (res.error_code != ErrorCode::NoError) {
       errors = 1;
+    } else {
+      if (!options.read_only) {
+        catalog.set_app_state_extra(token_key, change_token);
+      }
+      std::cout << "Change token: " << change_token << std::endl;
+    }
+    qint64 n_bytes{};
+    if (options.export_shard_size > 0) {
+      auto n_shards = std::max(1, (res.n_docs + options.export_shard_size - 1) /
+                                      options.export_shard_size);
+      for (int i = 0; i != n_shards; ++i) {
+        n_bytes += QFileInfo(export_shard_path(export_docs_file, i)).size();
+      }
+    } else {
+      n_bytes = QFileInfo(export_docs_file).size();
     }
+    stats.add_exported(res.n_docs, res.n_annotations, n_bytes);
+  }
+  if (options.stats_format == "json") {
+    std::cout << QJsonDocument(stats.to_json())
+                     .toJson(QJsonDocument::Compact)
+                     .toStdString()
+              << std::endl;
   }
   return errors;
 }
 
+void DatabaseCatalog::set_batch_stats(BatchStats* stats) {
+  batch_stats_ = stats;
+}
+
+void DatabaseCatalog::set_max_imported_doc_length(int max_length) {
+  max_imported_doc_length_ = max_length;
+}
+
+void DatabaseCatalog::set_n_hashing_threads(int n_threads) {
+  n_hashing_threads_ = n_threads;
+}
+
+void DatabaseCatalog::set_merge_exported_segments(bool merge) {
+  merge_exported_segments_ = merge;
+}
+
+void DatabaseCatalog::set_open_read_only(bool read_only) {
+  open_read_only_ = read_only;
+}
+
+void DatabaseCatalog::set_asynchronous_backfill(bool asynchronous) {
+  asynchronous_backfill_ = asynchronous;
+}
+
+void DatabaseCatalog::set_new_database_content_layout(ContentLayout layout) {
+  new_database_content_layout_ = layout;
+}
+
 void DatabaseCatalog::vacuum_db() {
+  flush_pending_writes(current_database);
   QSqlQuery query(QSqlDatabase::database(current_database));
-  query.exec("VACUUM;");
+  PragmaProfile profile{};
+  find_pragma_profile(get_pragma_profile(), profile);
+  vacuum_with_page_size(query, profile.page_size);
+}
+
+bool DatabaseCatalog::set_pragma_profile(const QString& name) {
+  flush_pending_writes(current_database);
+  PragmaProfile profile{};
+  if (!find_pragma_profile(name, profile)) {
+    return false;
+  }
+  set_app_state_extra("pragma_profile", name);
+  QSqlQuery query(QSqlDatabase::database(current_database));
+  query.exec("select count(*) from document;");
+  query.next();
+  auto n_docs = query.value(0).toInt();
+  query.finish();
+  if (n_docs == 0) {
+    // cheap for an empty database, and the only way to change the page size
+    vacuum_with_page_size(query, profile.page_size);
+  }
+  return exec_pragma_profile(query, profile);
+}
+
+QString DatabaseCatalog::get_pragma_profile() const {
+  PragmaProfile profile{};
+  auto name = get_app_state_extra("pragma_profile", "default").toString();
+  return find_pragma_profile(name, profile) ? name : "default";
+}
+
+bool DatabaseCatalog::apply_pragma_profile(const QString& name,
+                                           bool connection_only) {
+  PragmaProfile profile{};
+  if (!find_pragma_profile(name, profile)) {
+    return false;
+  }
+  QSqlQuery query(QSqlDatabase::database(current_database));
+  if (is_read_only() || connection_only) {
+    // the journal mode is stored in the file; the other pragmas only affect
+    // this connection
+    profile.journal_mode = QString();
+  }
+  if (connection_only) {
+    query.exec("PRAGMA journal_mode;");
+    query.next();
+    // with a rollback journal, synchronous = normal can corrupt the database
+    // on a power loss
+    if (query.value(0).toString() != "wal") {
+      profile.synchronous = QString();
+    }
+    query.finish();
+  }
+  return exec_pragma_profile(query, profile);
 }
 
-bool DatabaseCatalog::initialize_database(QSqlDatabase& database) {
+bool DatabaseCatalog::initialize_database(QSqlDatabase& database,
+                                          bool read_only) {
   if (!database.open()) {
     return false;
   }
@@ -1558,7 +4325,7 @@ bool DatabaseCatalog::initialize_database(QSqlDatabase& database) {
   // first 4 bytes of the md5 checksum of "labelbuddy" (ascii-encoded) read as a
   // big-endian signed int
   int32_t application_id = -14315518;
-  int32_t user_version = 2;
+  int32_t user_version = 7;
 
   // db existed before (schema has been modified if schema version != 0)
   if (sqlite_schema_version != 0) {
@@ -1570,19 +4337,61 @@ bool DatabaseCatalog::initialize_database(QSqlDatabase& database) {
     }
     query.exec("PRAGMA user_version;");
     query.next();
-    if (query.value(0).toInt() != user_version) {
+    auto db_user_version = query.value(0).toInt();
+    // created by a more recent version of labelbuddy, or too old
+    if (db_user_version > user_version || db_user_version < 2) {
       return false;
     }
+    if (read_only) {
+      // cannot be migrated
+      return db_user_version == user_version &&
+             query.exec("PRAGMA foreign_keys = ON;");
+    }
     // already contains a labelbuddy db
     // check it is not readonly
-    if (!query.exec("PRAGMA application_id = -14315518;")) {
+    if (db_user_version == user_version) {
+      // no write is needed to open an up-to-date database, so avoid the cost
+      // of a write transaction (journal and sync) on every startup. Taking
+      // the write lock writes nothing but fails with SQLITE_READONLY if the
+      // file cannot be written; if another connection holds it (SQLITE_BUSY)
+      // the file is writable and there is no need to wait.
+      query.exec("PRAGMA busy_timeout;");
+      query.next();
+      auto busy_timeout = query.value(0).toInt();
+      query.exec("PRAGMA busy_timeout = 0;");
+      auto locked = query.exec("BEGIN IMMEDIATE;");
+      auto busy = !locked && query.lastError().nativeErrorCode() == "5";
+      if (locked) {
+        query.exec("ROLLBACK;");
+      }
+      query.exec(QString("PRAGMA busy_timeout = %0;").arg(busy_timeout));
+      if (!locked && !busy) {
+        return false;
+      }
+      // the rollback journal is created next to the file at the first write,
+      // which the lock does not test: writes would then fail silently
+      QFileInfo info(database.databaseName());
+      if (!QFileInfo(info.absolutePath()).isWritable()) {
+        return false;
+      }
+    } else if (!query.exec("PRAGMA application_id = -14315518;")) {
       return false;
     }
-    return (query.exec("PRAGMA foreign_keys = ON;"));
+    if (!query.exec("PRAGMA foreign_keys = ON;")) {
+      return false;
+    }
+    return db_user_version == user_version ||
+           migrate_database(query, db_user_version);
+  }
+  if (read_only) {
+    // an empty file, not a labelbuddy database yet
+    return false;
   }
   if (!query.exec("PRAGMA foreign_keys = ON;")) {
     return false;
   }
+  // only possible before the first table is created
+  query.exec("PRAGMA auto_vacuum = INCREMENTAL;");
   return create_tables(query);
 }
 
@@ -1590,20 +4399,36 @@ bool DatabaseCatalog::create_tables(QSqlQuery& query) {
   query.exec("BEGIN TRANSACTION;");
   bool success{true};
   success *= query.exec("PRAGMA application_id = -14315518;");
-  success *= query.exec("PRAGMA user_version = 2;");
-
-  success *=
-      query.exec("CREATE TABLE IF NOT EXISTS document (id INTEGER PRIMARY KEY, "
-                 "content_md5 BLOB UNIQUE NOT NULL, "
-                 "content TEXT NOT NULL, metadata BLOB, "
-                 "user_provided_id TEXT DEFAULT NULL, "
-                 "long_title TEXT DEFAULT NULL, short_title TEXT DEFAULT NULL, "
-                 "CHECK (content != ''), CHECK (length(content_md5 = 128)));");
-  // for some reason the auto index created for the primary key is not treated
-  // as a covering index in 'count(*) from document where id < xxx' but this is:
-  success *= query.exec("CREATE INDEX IF NOT EXISTS document_id_idx ON "
-                        "document(id);");
+  success *= query.exec("PRAGMA user_version = 7;");
 
+  auto layout = new_database_content_layout_;
+  bool inline_content = layout == ContentLayout::Inline;
+  // the summary columns come before `content`, which is often stored in
+  // overflow pages
+  success *= query.exec(
+      QString("CREATE TABLE IF NOT EXISTS document (id INTEGER PRIMARY KEY, "
+              "content_md5 BLOB UNIQUE NOT NULL, "
+              "preview TEXT DEFAULT NULL, "
+              "content_length INTEGER DEFAULT NULL, "
+              "n_code_points INTEGER DEFAULT NULL, "
+              "%0metadata BLOB, "
+              "user_provided_id TEXT DEFAULT NULL, "
+              "long_title TEXT DEFAULT NULL, short_title TEXT DEFAULT NULL, "
+              "%1CHECK (length(content_md5 = 128)));")
+          .arg(inline_content ? "content TEXT NOT NULL, " : "",
+               inline_content ? "CHECK (content != ''), " : ""));
+  if (layout == ContentLayout::Separate) {
+    success *= query.exec(
+        "CREATE TABLE IF NOT EXISTS document_content (id INTEGER PRIMARY KEY "
+        "REFERENCES document(id) ON DELETE CASCADE, content TEXT NOT NULL, "
+        "CHECK (content != ''));");
+  } else if (layout == ContentLayout::Compressed) {
+    success *= query.exec(
+        "CREATE TABLE IF NOT EXISTS document_compressed_content (id INTEGER "
+        "PRIMARY KEY REFERENCES document(id) ON DELETE CASCADE, content BLOB "
+        "NOT NULL, CHECK (length(content) > 0));");
+  }
+  success *= create_content_view(query, layout);
   success *= query.exec(
       "CREATE TABLE IF NOT EXISTS label(id INTEGER PRIMARY KEY, name "
       "TEXT UNIQUE NOT NULL, color TEXT NOT NULL DEFAULT '#FFA000', "
@@ -1622,11 +4447,7 @@ bool DatabaseCatalog::create_tables(QSqlQuery& query) {
       "UNIQUE (doc_id, start_char, end_char, label_id) "
       "CHECK (start_char < end_char)); ");
 
-  success *= query.exec(" CREATE INDEX IF NOT EXISTS annotation_doc_id_idx ON "
-                        "annotation(doc_id);");
-
-  success *= query.exec("CREATE INDEX IF NOT EXISTS annotation_label_id_idx ON "
-                        "annotation(label_id);");
+  success *= create_secondary_indexes(query);
 
   success *= query.exec(
       "CREATE TABLE IF NOT EXISTS app_state (last_visited_doc INTEGER "
@@ -1647,20 +4468,559 @@ bool DatabaseCatalog::create_tables(QSqlQuery& query) {
   query.prepare("INSERT INTO database_info "
                 "(database_schema_version, "
                 "created_by_labelbuddy_version) "
-                "SELECT 2, :lbv "
+                "SELECT 7, :lbv "
                 "WHERE NOT EXISTS (SELECT * FROM database_info);");
   query.bindValue(":lbv", get_version());
   success *= query.exec();
 
-  // In experiments with many documents the subqueries below seemed much
-  // faster than a left join and slightly faster than using 'where not exists'.
+  success *= create_annotation_count_schema(query);
+  success *= create_label_count_schema(query);
+  success *= create_change_tracking_schema(query);
+  if (success) {
+    query.exec("COMMIT;");
+    return true;
+  }
+  query.exec("ROLLBACK;");
+  return false;
+}
+
+bool DatabaseCatalog::create_secondary_indexes(QSqlQuery& query) {
+  bool success{true};
+  // for some reason the auto index created for the primary key is not treated
+  // as a covering index in 'count(*) from document where id < xxx' but this is:
+  success *= query.exec("CREATE INDEX IF NOT EXISTS document_id_idx ON "
+                        "document(id);");
+
+  success *= query.exec(" CREATE INDEX IF NOT EXISTS annotation_doc_id_idx ON "
+                        "annotation(doc_id);");
+
+  success *= query.exec("CREATE INDEX IF NOT EXISTS annotation_label_id_idx ON "
+                        "annotation(label_id);");
+  return success;
+}
+
+bool DatabaseCatalog::begin_bulk_load() {
+  flush_pending_writes(current_database);
+  QSqlQuery query(QSqlDatabase::database(current_database));
+  query.exec("BEGIN TRANSACTION;");
+  bool success{true};
+  for (const auto& index : {"document_id_idx", "annotation_doc_id_idx",
+                            "annotation_label_id_idx"}) {
+    success *= query.exec(QString("DROP INDEX IF EXISTS %0;").arg(index));
+  }
+  for (const auto& trigger :
+       {"annotation_count_after_insert", "annotation_count_after_delete",
+        "annotation_count_after_update", "label_count_after_annotation_insert",
+        "label_count_after_annotation_delete",
+        "label_count_after_annotation_update",
+        "document_label_count_after_insert",
+        "document_label_count_after_delete",
+        "document_change_after_annotation_insert",
+        "document_change_after_annotation_delete",
+        "document_change_after_annotation_update"}) {
+    success *= query.exec(QString("DROP TRIGGER IF EXISTS %0;").arg(trigger));
+  }
+  // the drop and this flag are committed together, so that `open_database`
+  // can finish the bulk load if it is interrupted
+  set_app_state_extra("bulk_load_in_progress", 1);
+  if (success) {
+    query.exec("COMMIT;");
+    return true;
+  }
+  query.exec("ROLLBACK;");
+  return false;
+}
+
+bool DatabaseCatalog::end_bulk_load() {
+  flush_pending_writes(current_database);
+  QSqlQuery query(QSqlDatabase::database(current_database));
+  query.exec("BEGIN TRANSACTION;");
+  bool success{true};
+  // the counts are computed again from the annotation table
+  success *= query.exec("DELETE FROM document_annotation_count;");
+  success *= query.exec("DELETE FROM document_label_count;");
+  success *= query.exec("DELETE FROM label_document_count;");
+  success *= create_annotation_count_schema(query);
+  success *= create_label_count_schema(query);
+  // which documents got new annotations is not known, so all the labelled
+  // ones count as changed
+  success *= query.exec(
+      "INSERT OR REPLACE INTO document_change (doc_id, change_seq) SELECT "
+      "doc_id, (SELECT coalesce(max(change_seq), 0) + 1 FROM document_change) "
+      "FROM document_annotation_count;");
+  success *= create_change_tracking_schema(query);
+  success *= create_secondary_indexes(query);
+  success *= query.exec(
+      "DELETE FROM app_state_extra WHERE key = 'bulk_load_in_progress';");
+  if (success) {
+    query.exec("COMMIT;");
+    label_cache_.invalidate();
+    return true;
+  }
+  query.exec("ROLLBACK;");
+  return false;
+}
+
+bool DatabaseCatalog::create_annotation_count_schema(QSqlQuery& query) {
+  bool success{true};
+  // only documents that have annotations have a row
+  success *= query.exec(
+      "CREATE TABLE IF NOT EXISTS document_annotation_count (doc_id INTEGER "
+      "PRIMARY KEY REFERENCES document(id) ON DELETE CASCADE, "
+      "n_annotations INTEGER NOT NULL); ");
+
+  success *= query.exec(
+      "INSERT OR IGNORE INTO document_annotation_count (doc_id, n_annotations) "
+      "SELECT doc_id, count(*) FROM annotation GROUP BY doc_id; ");
+
+  // upsert (ON CONFLICT DO UPDATE) is only available from sqlite 3.24
+  success *= query.exec(
+      "CREATE TRIGGER IF NOT EXISTS annotation_count_after_insert AFTER INSERT "
+      "ON annotation BEGIN "
+      "INSERT OR IGNORE INTO document_annotation_count (doc_id, n_annotations) "
+      "VALUES (new.doc_id, 0); "
+      "UPDATE document_annotation_count SET n_annotations = n_annotations + 1 "
+      "WHERE doc_id = new.doc_id; END; ");
+
   success *= query.exec(
-      "CREATE VIEW IF NOT EXISTS unlabelled_document AS SELECT * FROM "
-      "document WHERE id NOT IN (SELECT distinct doc_id FROM annotation); ");
+      "CREATE TRIGGER IF NOT EXISTS annotation_count_after_delete AFTER DELETE "
+      "ON annotation BEGIN "
+      "UPDATE document_annotation_count SET n_annotations = n_annotations - 1 "
+      "WHERE doc_id = old.doc_id; "
+      "DELETE FROM document_annotation_count WHERE doc_id = old.doc_id "
+      "AND n_annotations <= 0; END; ");
 
   success *= query.exec(
-      "CREATE VIEW IF NOT EXISTS labelled_document AS SELECT * "
-      "FROM document WHERE id IN (SELECT distinct doc_id FROM annotation); ");
+      "CREATE TRIGGER IF NOT EXISTS annotation_count_after_update AFTER UPDATE "
+      "OF doc_id ON annotation WHEN new.doc_id != old.doc_id BEGIN "
+      "UPDATE document_annotation_count SET n_annotations = n_annotations - 1 "
+      "WHERE doc_id = old.doc_id; "
+      "DELETE FROM document_annotation_count WHERE doc_id = old.doc_id "
+      "AND n_annotations <= 0; "
+      "INSERT OR IGNORE INTO document_annotation_count (doc_id, n_annotations) "
+      "VALUES (new.doc_id, 0); "
+      "UPDATE document_annotation_count SET n_annotations = n_annotations + 1 "
+      "WHERE doc_id = new.doc_id; END; ");
+
+  // lookups in the primary key of document_annotation_count rather than
+  // selecting distinct doc ids in annotation
+  success *= query.exec("DROP VIEW IF EXISTS unlabelled_document; ");
+  success *= query.exec(
+      "CREATE VIEW unlabelled_document AS SELECT * FROM document WHERE id "
+      "NOT IN (SELECT doc_id FROM document_annotation_count); ");
+
+  success *= query.exec("DROP VIEW IF EXISTS labelled_document; ");
+  success *= query.exec(
+      "CREATE VIEW labelled_document AS SELECT * FROM document WHERE id "
+      "IN (SELECT doc_id FROM document_annotation_count); ");
+  return success;
+}
+
+bool DatabaseCatalog::create_change_tracking_schema(QSqlQuery& query) {
+  bool success{true};
+  success *= query.exec(
+      "CREATE TABLE IF NOT EXISTS document_change (doc_id INTEGER PRIMARY "
+      "KEY, change_seq INTEGER NOT NULL); ");
+  success *= query.exec("CREATE INDEX IF NOT EXISTS document_change_seq_idx "
+                        "ON document_change(change_seq); ");
+  success *= query.exec(
+      "INSERT OR IGNORE INTO document_change (doc_id, change_seq) "
+      "SELECT doc_id, 1 FROM document_annotation_count; ");
+  // a scalar subquery so that max() is read from the end of
+  // document_change_seq_idx
+  const QString next_seq{
+      "coalesce((SELECT max(change_seq) FROM document_change), 0) + 1"};
+  success *= query.exec(
+      QString("CREATE TRIGGER IF NOT EXISTS "
+              "document_change_after_annotation_insert AFTER INSERT ON "
+              "annotation BEGIN INSERT OR REPLACE INTO document_change "
+              "(doc_id, change_seq) VALUES (new.doc_id, %0); END; ")
+          .arg(next_seq));
+  success *= query.exec(
+      QString("CREATE TRIGGER IF NOT EXISTS "
+              "document_change_after_annotation_delete AFTER DELETE ON "
+              "annotation BEGIN INSERT OR REPLACE INTO document_change "
+              "(doc_id, change_seq) VALUES (old.doc_id, %0); END; ")
+          .arg(next_seq));
+  success *= query.exec(
+      QString("CREATE TRIGGER IF NOT EXISTS "
+              "document_change_after_annotation_update AFTER UPDATE ON "
+              "annotation BEGIN INSERT OR REPLACE INTO document_change "
+              "(doc_id, change_seq) VALUES (old.doc_id, %0); "
+              "INSERT OR REPLACE INTO document_change (doc_id, change_seq) "
+              "VALUES (new.doc_id, %0); END; ")
+          .arg(next_seq));
+  // deletions are not reported by exports: the rows of deleted documents are
+  // removed, after those added when their annotations are deleted by the
+  // foreign key's cascade (which happens before `AFTER` triggers run), except
+  // the one holding the largest number
+  success *= query.exec(
+      "CREATE TRIGGER IF NOT EXISTS document_change_after_document_delete "
+      "AFTER DELETE ON document BEGIN DELETE FROM document_change WHERE "
+      "doc_id = old.id AND change_seq < (SELECT max(change_seq) FROM "
+      "document_change); END; ");
+  return success;
+}
+
+bool DatabaseCatalog::create_label_count_schema(QSqlQuery& query) {
+  bool success{true};
+  // one row for each label present in a document
+  success *= query.exec(
+      "CREATE TABLE IF NOT EXISTS document_label_count (label_id INTEGER NOT "
+      "NULL REFERENCES label(id) ON DELETE CASCADE, doc_id INTEGER NOT NULL "
+      "REFERENCES document(id) ON DELETE CASCADE, n_annotations INTEGER NOT "
+      "NULL, PRIMARY KEY (label_id, doc_id)) WITHOUT ROWID; ");
+
+  success *=
+      query.exec("CREATE INDEX IF NOT EXISTS document_label_count_doc_id_idx "
+                 "ON document_label_count(doc_id);");
+
+  // one row for each label present in at least one document
+  success *= query.exec(
+      "CREATE TABLE IF NOT EXISTS label_document_count (label_id INTEGER "
+      "PRIMARY KEY REFERENCES label(id) ON DELETE CASCADE, "
+      "n_docs INTEGER NOT NULL); ");
+
+  success *= query.exec(
+      "INSERT OR IGNORE INTO document_label_count "
+      "(label_id, doc_id, n_annotations) SELECT label_id, doc_id, count(*) "
+      "FROM annotation GROUP BY label_id, doc_id; ");
+
+  success *= query.exec(
+      "INSERT OR IGNORE INTO label_document_count (label_id, n_docs) "
+      "SELECT label_id, count(*) FROM document_label_count "
+      "GROUP BY label_id; ");
+
+  success *= query.exec(
+      "CREATE TRIGGER IF NOT EXISTS label_count_after_annotation_insert AFTER "
+      "INSERT ON annotation BEGIN "
+      "INSERT OR IGNORE INTO document_label_count "
+      "(label_id, doc_id, n_annotations) VALUES (new.label_id, new.doc_id, 0); "
+      "UPDATE document_label_count SET n_annotations = n_annotations + 1 "
+      "WHERE label_id = new.label_id AND doc_id = new.doc_id; END; ");
+
+  success *= query.exec(
+      "CREATE TRIGGER IF NOT EXISTS label_count_after_annotation_delete AFTER "
+      "DELETE ON annotation BEGIN "
+      "UPDATE document_label_count SET n_annotations = n_annotations - 1 "
+      "WHERE label_id = old.label_id AND doc_id = old.doc_id; "
+      "DELETE FROM document_label_count WHERE label_id = old.label_id "
+      "AND doc_id = old.doc_id AND n_annotations <= 0; END; ");
+
+  success *= query.exec(
+      "CREATE TRIGGER IF NOT EXISTS label_count_after_annotation_update AFTER "
+      "UPDATE OF doc_id, label_id ON annotation WHEN new.doc_id != old.doc_id "
+      "OR new.label_id != old.label_id BEGIN "
+      "UPDATE document_label_count SET n_annotations = n_annotations - 1 "
+      "WHERE label_id = old.label_id AND doc_id = old.doc_id; "
+      "DELETE FROM document_label_count WHERE label_id = old.label_id "
+      "AND doc_id = old.doc_id AND n_annotations <= 0; "
+      "INSERT OR IGNORE INTO document_label_count "
+      "(label_id, doc_id, n_annotations) VALUES (new.label_id, new.doc_id, 0); "
+      "UPDATE document_label_count SET n_annotations = n_annotations + 1 "
+      "WHERE label_id = new.label_id AND doc_id = new.doc_id; END; ");
+
+  success *= query.exec(
+      "CREATE TRIGGER IF NOT EXISTS document_label_count_after_insert AFTER "
+      "INSERT ON document_label_count BEGIN "
+      "INSERT OR IGNORE INTO label_document_count (label_id, n_docs) "
+      "VALUES (new.label_id, 0); "
+      "UPDATE label_document_count SET n_docs = n_docs + 1 "
+      "WHERE label_id = new.label_id; END; ");
+
+  success *= query.exec(
+      "CREATE TRIGGER IF NOT EXISTS document_label_count_after_delete AFTER "
+      "DELETE ON document_label_count BEGIN "
+      "UPDATE label_document_count SET n_docs = n_docs - 1 "
+      "WHERE label_id = old.label_id; "
+      "DELETE FROM label_document_count WHERE label_id = old.label_id "
+      "AND n_docs <= 0; END; ");
+  return success;
+}
+
+bool DatabaseCatalog::create_content_view(QSqlQuery& query,
+                                          ContentLayout layout) {
+  if (layout == ContentLayout::Inline) {
+    return query.exec("CREATE VIEW IF NOT EXISTS document_with_content AS "
+                      "SELECT * FROM document;");
+  }
+  return query.exec(
+      QString("CREATE VIEW IF NOT EXISTS document_with_content AS SELECT "
+              "document.*, stored.content AS content FROM document JOIN %0 "
+              "AS stored ON stored.id = document.id;")
+          .arg(layout == ContentLayout::Separate
+                   ? "document_content"
+                   : "document_compressed_content"));
+}
+
+bool DatabaseCatalog::add_document_summary_columns(QSqlQuery& query) {
+  bool success{true};
+  QStringList existing_columns{};
+  success *= query.exec("PRAGMA table_info(document);");
+  while (query.next()) {
+    existing_columns << query.value(1).toString();
+  }
+  const QList<QPair<QString, QString>> columns{{"preview", "TEXT"},
+                                               {"content_length", "INTEGER"},
+                                               {"n_code_points", "INTEGER"}};
+  for (const auto& column : columns) {
+    if (!existing_columns.contains(column.first)) {
+      success *= query.exec(
+          QString("ALTER TABLE document ADD COLUMN %0 %1 DEFAULT NULL;")
+              .arg(column.first, column.second));
+    }
+  }
+  // the existing documents are summarized when the database is opened, in
+  // smaller transactions than the migration
+  success *= query.exec("INSERT OR REPLACE INTO app_state_extra (key, value) "
+                        "VALUES ('document_summary_backfill_pending', 1);");
+  return success;
+}
+
+bool DatabaseCatalog::migrate_database(QSqlQuery& query, int from_version) {
+  query.exec("BEGIN TRANSACTION;");
+  bool success{true};
+  if (from_version < 3) {
+    success *= create_annotation_count_schema(query);
+  }
+  if (from_version < 4) {
+    success *= create_label_count_schema(query);
+  }
+  if (from_version < 5) {
+    success *= add_document_summary_columns(query);
+  }
+  if (from_version < 6) {
+    success *= create_content_view(query, ContentLayout::Inline);
+  }
+  if (from_version < 7) {
+    success *= create_change_tracking_schema(query);
+  }
+  success *= query.exec(
+      "UPDATE database_info SET database_schema_version = 7; ");
+  success *= query.exec("PRAGMA user_version = 7;");
+  if (success) {
+    query.exec("COMMIT;");
+    return true;
+  }
+  query.exec("ROLLBACK;");
+  return false;
+}
+
+int incremental_vacuum(QSqlQuery& query, int max_pages_per_transaction,
+                       const std::function<bool()>& cancelled) {
+  query.exec("PRAGMA auto_vacuum;");
+  query.next();
+  auto auto_vacuum = query.value(0).toInt();
+  query.finish();
+  // 2 is INCREMENTAL
+  if (auto_vacuum != 2) {
+    return 0;
+  }
+  int n_freed{};
+  while (!(cancelled && cancelled())) {
+    query.exec("PRAGMA freelist_count;");
+    query.next();
+    auto n_pages = std::min(query.value(0).toInt(), max_pages_per_transaction);
+    query.finish();
+    if (n_pages <= 0) {
+      break;
+    }
+    query.exec("begin transaction;");
+    query.prepare("PRAGMA incremental_vacuum(1);");
+    // each step of the statement frees one page, and QSqlQuery only steps
+    // once for a statement that does not return columns
+    int i{};
+    while (i != n_pages && query.exec()) {
+      ++i;
+    }
+    if (!query.exec("commit transaction;") || i == 0) {
+      query.exec("rollback transaction;");
+      break;
+    }
+    n_freed += i;
+  }
+  return n_freed;
+}
+
+int backfill_document_summaries(QSqlQuery& query, int chunk_size,
+                                const std::function<bool()>& cancelled) {
+  TraceScope trace("backfill_document_summaries");
+  if (get_content_layout(query) != ContentLayout::Inline) {
+    // only created by versions that fill the summaries at import
+    return 0;
+  }
+  int n_updated{};
+  auto last_id = std::numeric_limits<qlonglong>::min();
+  while (!(cancelled && cancelled())) {
+    // chunks are ranges of ids, found without scanning the documents before
+    query.prepare("select max(id) from (select id from document "
+                  "where id > :last order by id limit :n);");
+    query.bindValue(":last", last_id);
+    query.bindValue(":n", chunk_size);
+    if (!traced_exec(query) || !query.next()) {
+      return -1;
+    }
+    if (query.isNull(0)) {
+      break;
+    }
+    auto chunk_last_id = query.value(0).toLongLong();
+    query.finish();
+    query.exec("begin transaction;");
+    // same values as `document_preview`, `utf8_length` and `n_code_points`
+    query.prepare(
+        "update document set preview = replace(substr(coalesce(long_title, "
+        "content), 1, 160), char(10), ' '), "
+        "content_length = length(cast(content as blob)), "
+        "n_code_points = length(content) "
+        "where id > :last and id <= :chunklast and preview is null;");
+    query.bindValue(":last", last_id);
+    query.bindValue(":chunklast", chunk_last_id);
+    if (!traced_exec(query)) {
+      query.exec("rollback transaction;");
+      return -1;
+    }
+    auto n_rows = query.numRowsAffected();
+    if (!query.exec("commit transaction;")) {
+      query.exec("rollback transaction;");
+      return -1;
+    }
+    n_updated += std::max(0, n_rows);
+    last_id = chunk_last_id;
+  }
+  return n_updated;
+}
+
+namespace {
+
+bool create_inline_content_fts_triggers(QSqlQuery& query) {
+  bool success{true};
+  success *= query.exec(
+      "CREATE TRIGGER IF NOT EXISTS document_fts_after_insert AFTER INSERT "
+      "ON document BEGIN "
+      "INSERT INTO document_fts (rowid, content, long_title, user_provided_id) "
+      "VALUES (new.id, new.content, new.long_title, new.user_provided_id); "
+      "END; ");
+
+  success *= query.exec(
+      "CREATE TRIGGER IF NOT EXISTS document_fts_after_delete AFTER DELETE "
+      "ON document BEGIN "
+      "INSERT INTO document_fts (document_fts, rowid, content, long_title, "
+      "user_provided_id) VALUES ('delete', old.id, old.content, "
+      "old.long_title, old.user_provided_id); END; ");
+
+  success *= query.exec(
+      "CREATE TRIGGER IF NOT EXISTS document_fts_after_update AFTER UPDATE OF "
+      "content, long_title, user_provided_id ON document BEGIN "
+      "INSERT INTO document_fts (document_fts, rowid, content, long_title, "
+      "user_provided_id) VALUES ('delete', old.id, old.content, "
+      "old.long_title, old.user_provided_id); "
+      "INSERT INTO document_fts (rowid, content, long_title, user_provided_id) "
+      "VALUES (new.id, new.content, new.long_title, new.user_provided_id); "
+      "END; ");
+  return success;
+}
+
+bool create_separate_content_fts_triggers(QSqlQuery& query) {
+  bool success{true};
+  // the document row is inserted first, then its content
+  success *= query.exec(
+      "CREATE TRIGGER IF NOT EXISTS document_fts_after_insert AFTER INSERT "
+      "ON document_content BEGIN "
+      "INSERT INTO document_fts (rowid, content, long_title, user_provided_id) "
+      "SELECT new.id, new.content, long_title, user_provided_id "
+      "FROM document WHERE id = new.id; END; ");
+
+  // before the content is removed by the foreign key's ON DELETE CASCADE
+  success *= query.exec(
+      "CREATE TRIGGER IF NOT EXISTS document_fts_before_delete BEFORE DELETE "
+      "ON document BEGIN "
+      "INSERT INTO document_fts (document_fts, rowid, content, long_title, "
+      "user_provided_id) SELECT 'delete', old.id, content, old.long_title, "
+      "old.user_provided_id FROM document_content WHERE id = old.id; END; ");
+
+  success *= query.exec(
+      "CREATE TRIGGER IF NOT EXISTS document_fts_after_update AFTER UPDATE OF "
+      "long_title, user_provided_id ON document BEGIN "
+      "INSERT INTO document_fts (document_fts, rowid, content, long_title, "
+      "user_provided_id) SELECT 'delete', old.id, content, old.long_title, "
+      "old.user_provided_id FROM document_content WHERE id = old.id; "
+      "INSERT INTO document_fts (rowid, content, long_title, user_provided_id) "
+      "SELECT new.id, content, new.long_title, new.user_provided_id "
+      "FROM document_content WHERE id = new.id; END; ");
+
+  success *= query.exec(
+      "CREATE TRIGGER IF NOT EXISTS document_content_fts_after_update AFTER "
+      "UPDATE OF content ON document_content BEGIN "
+      "INSERT INTO document_fts (document_fts, rowid, content, long_title, "
+      "user_provided_id) SELECT 'delete', old.id, old.content, long_title, "
+      "user_provided_id FROM document WHERE id = old.id; "
+      "INSERT INTO document_fts (rowid, content, long_title, user_provided_id) "
+      "SELECT new.id, new.content, long_title, user_provided_id "
+      "FROM document WHERE id = new.id; END; ");
+  return success;
+}
+
+} // namespace
+
+namespace {
+
+/// documents added to the full-text index between progress reports
+const int search_index_batch_size{2000};
+
+} // namespace
+
+bool create_search_index(QSqlQuery& query,
+                         const std::function<void(int)>& on_progress) {
+  query.exec("SELECT count(*) FROM sqlite_master WHERE type = 'table' "
+             "AND name = 'document_fts';");
+  query.next();
+  if (query.value(0).toInt() != 0) {
+    return true;
+  }
+  auto layout = get_content_layout(query);
+  if (layout == ContentLayout::Compressed) {
+    // FTS5 cannot read the compressed text
+    return false;
+  }
+  query.exec("BEGIN TRANSACTION;");
+  bool success{true};
+  // external content table: the text is not stored twice
+  success *= query.exec(
+      "CREATE VIRTUAL TABLE document_fts USING fts5(content, long_title, "
+      "user_provided_id, content = 'document_with_content', "
+      "content_rowid = 'id'); ");
+  success *= layout == ContentLayout::Separate
+                 ? create_separate_content_fts_triggers(query)
+                 : create_inline_content_fts_triggers(query);
+
+  // the same as the 'rebuild' command for the new, empty index, but the
+  // progress can be reported between batches
+  qlonglong last_id{-1};
+  int n_indexed{};
+  while (success) {
+    query.prepare("SELECT max(id) FROM (SELECT id FROM document "
+                  "WHERE id > :last ORDER BY id LIMIT :n);");
+    query.bindValue(":last", last_id);
+    query.bindValue(":n", search_index_batch_size);
+    success = traced_exec(query) && query.next();
+    if (!success || query.isNull(0)) {
+      break;
+    }
+    auto end_id = query.value(0).toLongLong();
+    query.prepare("INSERT INTO document_fts (rowid, content, long_title, "
+                  "user_provided_id) SELECT id, content, long_title, "
+                  "user_provided_id FROM document_with_content "
+                  "WHERE id > :last AND id <= :end;");
+    query.bindValue(":last", last_id);
+    query.bindValue(":end", end_id);
+    success = traced_exec(query);
+    n_indexed += std::max(0, query.numRowsAffected());
+    last_id = end_id;
+    if (success && on_progress) {
+      on_progress(n_indexed);
+    }
+  }
+  query.finish();
   if (success) {
     query.exec("COMMIT;");
     return true;
@@ -1669,4 +5029,26 @@ bool DatabaseCatalog::create_tables(QSqlQuery& query) {
   return false;
 }
 
+bool is_search_supported(QSqlQuery& query) {
+  return get_content_layout(query) != ContentLayout::Compressed;
+}
+
+QString search_text_to_fts_query(const QString& text) {
+  auto simplified = text.simplified();
+  if (simplified.isEmpty()) {
+    return QString();
+  }
+  QStringList terms{};
+  for (auto word : simplified.split(' ')) {
+    bool is_prefix{};
+    if (word.size() > 1 && word.endsWith('*')) {
+      word.chop(1);
+      is_prefix = true;
+    }
+    word.replace('"', "\"\"");
+    terms << QString("\"%0\"%1").arg(word, is_prefix ? "*" : "");
+  }
+  return terms.join(' ');
+}
+
 } // namespace labelbuddy
@@ -1,40 +1,86 @@
 #ifndef LABELBUDDY_DATABASE_H
 #define LABELBUDDY_DATABASE_H
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 
 #include <QByteArray>
 #include <QFile>
+#include <QHash>
 #include <QJsonArray>
+#include <QJsonObject>
+#include <QList>
 #include <QMap>
 #include <QObject>
 #include <QProgressDialog>
 #include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QString>
+#include <QStringList>
 #include <QTextStream>
 #include <QVariant>
 #include <QXmlStreamReader>
 #include <QXmlStreamWriter>
 
+#include "arrow_writer.h"
+#include "batch_stats.h"
+#include "compressed_file.h"
 #include "csv.h"
+#include "label_cache.h"
+#include "summary_backfill.h"
+#include "utf8_writer.h"
 
 /// \file
 /// Utilities for manipulating databases.
 
 namespace labelbuddy {
 
-enum class ErrorCode { NoError = 0, CriticalParsingError, FileSystemError };
+enum class ErrorCode {
+  NoError = 0,
+  CriticalParsingError,
+  FileSystemError,
+  DatabaseError
+};
+
+/// An annotation read from a documents file
+struct AnnotationRecord {
+  int start_char;
+  int end_char;
+  QString label;
+  /// empty if the annotation has no extra data
+  QString extra_data;
+};
 
+/// A document read from a file, moved from the reader to the inserting code.
 struct DocRecord {
+  DocRecord() = default;
+  DocRecord(const DocRecord&) = delete;
+  DocRecord& operator=(const DocRecord&) = delete;
+  DocRecord(DocRecord&&) = default;
+  DocRecord& operator=(DocRecord&&) = default;
+
   QString content{};
   QByteArray metadata{};
   QString user_provided_id{};
   QString declared_md5{};
-  QJsonArray annotations{};
+  std::vector<AnnotationRecord> annotations{};
   bool valid_content = true;
   QString short_title{};
   QString long_title{};
+  /// md5 of the UTF-8 encoded `content`, if the reader already knows it (it
+  /// is then not computed again); otherwise empty
+  QByteArray content_md5{};
+  /// `content` as UTF-8, if the reader decoded it from exactly these bytes;
+  /// otherwise empty. It is hashed instead of encoding `content` again, and
+  /// may refer to the reader's memory-mapped file, so it must not be used
+  /// once the reader is gone (`DocsReadingThread` clears it after hashing).
+  QByteArray content_utf8{};
 };
 
 class DocsReader {
@@ -49,22 +95,79 @@ public:
   QString error_message() const;
   virtual bool read_next();
   const DocRecord* get_current_record() const;
+  /// Transfer ownership of the current record to the caller
+  std::unique_ptr<DocRecord> take_current_record();
   virtual int progress_max() const;
   virtual int current_progress() const;
 
+  /// Byte offset just after the last record read, or -1.
+
+  /// If it is not -1, a new reader for the same file can continue from there
+  /// with `seek`. Only readers of memory-mapped files know the exact position
+  /// of a record: the txt, jsonl and bundle readers of uncompressed files that
+  /// can be mapped. The others read through a stream, which reads ahead (and
+  /// for compressed files, the offset in the file is not one in the text);
+  /// resuming them skips the records already read instead.
+  virtual qint64 resume_offset() const;
+
+  /// Continue reading from an offset returned by `resume_offset`.
+
+  /// Must be called before reading any record. Returns `false` (and does
+  /// nothing) if the reader cannot seek or the offset is out of range.
+  virtual bool seek(qint64 offset);
+
+  /// Set the error if reading stopped because the input is corrupted.
+
+  /// A compressed file that cannot be decompressed (eg it is truncated) looks
+  /// like the end of the file to the reader; call this once `read_next`
+  /// returned `false` to tell both apart.
+  void check_input_error();
+
 protected:
-  QFile* get_file();
+  /// The input file, or a decompressing device for `.gz` and `.zst` files
+  QIODevice* get_device();
   void set_current_record(std::unique_ptr<DocRecord>);
+
+  /// Map the input file in memory to read it with `read_mapped_line`.
+
+  /// Returns `false` if it cannot be mapped -- it is compressed, empty, too
+  /// large for the address space, or starts with a utf-16 or utf-32 BOM (which
+  /// `QTextStream` handles). Then the device must be read as usual. A utf-8
+  /// BOM is skipped.
+  bool map_file();
+  bool is_mapped() const;
+
+  /// Next line of the mapped file, without the line ending.
+
+  /// `line` refers to the mapped memory, which stays valid as long as the
+  /// reader exists; the line is not copied. Returns `false` at the end of the
+  /// file, or (setting the error) if the line is too long for a QByteArray.
+  bool read_mapped_line(QByteArray& line);
+
+  /// Next `size` bytes of the mapped file, or fewer at its end.
+
+  /// As for `read_mapped_line` the data is not copied. Returns `false` at the
+  /// end of the file.
+  bool read_mapped_bytes(int size, QByteArray& bytes);
+
   static const int progress_range_max_{1000};
   ErrorCode error_code_ = ErrorCode::NoError;
   QString error_message_{};
 
 private:
-  QFile file;
+  std::unique_ptr<QIODevice> file;
   std::unique_ptr<DocRecord> current_record{nullptr};
   double file_size_{};
+  const char* mapped_{nullptr};
+  qint64 mapped_size_{};
+  qint64 mapped_pos_{};
 };
 
+/// Reads one document per line.
+
+/// The file is memory-mapped when possible, and each line is found with
+/// `memchr` and decoded from utf-8 once; the md5 checksum is computed from
+/// the mapped bytes.
 class TxtDocsReader : public DocsReader {
 
 public:
@@ -72,6 +175,7 @@ public:
   bool read_next() override;
 
 private:
+  // used when the file cannot be mapped
   QTextStream stream;
 };
 
@@ -94,7 +198,15 @@ private:
   void read_user_provided_id();
   void read_short_title();
   void read_long_title();
+
+  /// Text of the current element, which is then finished.
+
+  /// Kept in `element_text_`, whose memory is reused from one element to the
+  /// next, for values that are only parsed (the annotations' positions).
+  const QString& read_element_text_in_buffer();
+
   std::unique_ptr<DocRecord> new_record{};
+  QString element_text_{};
 };
 
 class CsvDocsReader : public DocsReader {
@@ -105,29 +217,61 @@ public:
 private:
   QTextStream stream;
   CsvMapReader csv;
-  void read_annotation(const QMap<QString, QString>& csv_record,
-                       QJsonArray& annotations);
+  // positions of the columns in the header, -1 if absent
+  int text_column_;
+  int md5_column_;
+  int meta_column_;
+  int id_column_;
+  int short_title_column_;
+  int long_title_column_;
+  int start_char_column_;
+  int end_char_column_;
+  int label_column_;
+  int extra_data_column_;
+  void read_annotation(std::vector<AnnotationRecord>& annotations);
 };
 
 std::unique_ptr<DocRecord> json_to_doc_record(const QJsonDocument&);
 std::unique_ptr<DocRecord> json_to_doc_record(const QJsonValue&);
 std::unique_ptr<DocRecord> json_to_doc_record(const QJsonObject&);
 
+/// Reads a JSON array of documents one element at a time.
+
+/// The file is read in chunks and each top-level element of the array is cut
+/// out by tracking the nesting depth (ignoring brackets inside strings), then
+/// parsed on its own. The whole file is therefore never loaded in memory and
+/// progress is reported from the byte offset like the other readers.
 class JsonDocsReader : public DocsReader {
 
 public:
   JsonDocsReader(const QString& file_path);
   bool read_next() override;
-  int progress_max() const override;
-  int current_progress() const override;
 
 private:
-  QJsonArray all_docs;
-  QJsonArray::const_iterator current_doc;
-  int total_n_docs;
-  int n_seen{};
+  QByteArray buffer_{};
+  int buffer_pos_{};
+  int n_seen_{};
+  bool reached_end_{};
+  static const int chunk_size_{1 << 16};
+
+  /// Append the next chunk of the file to the buffer; false at end of file
+
+  /// The bytes before `buffer_pos_` may be removed first, moving it.
+  bool fill_buffer();
+
+  /// Advance to the next non-whitespace byte; false at end of file
+  bool skip_whitespace();
+
+  /// Find the end of the element starting at `buffer_pos_`; -1 if truncated
+  int find_element_end();
+
+  void set_parsing_error(const QString& message);
 };
 
+/// Reads one JSON document per line, skipping empty lines.
+
+/// When the file is memory-mapped, lines are parsed directly from the mapped
+/// utf-8 data.
 class JsonLinesDocsReader : public DocsReader {
 
 public:
@@ -135,9 +279,156 @@ public:
   bool read_next() override;
 
 private:
+  // used when the file cannot be mapped
   QTextStream stream;
 };
 
+/// Reads a labelbuddy bundle (see `DocsBundleWriter`).
+
+/// The file is memory-mapped when possible. Each record is decoded directly
+/// from its length-prefixed fields: there is no parsing and the md5 checksum
+/// stored with the text is not computed again.
+class BundleDocsReader : public DocsReader {
+
+public:
+  BundleDocsReader(const QString& file_path);
+  bool read_next() override;
+
+private:
+  /// The next `size` bytes, from the mapped file or the device
+  bool read_bytes(int size, QByteArray& bytes);
+  void set_format_error(const QString& message);
+};
+
+/// The md5 checksum used to identify a document record in the database.
+
+/// This is the md5 of the UTF-8 encoded content (`content_utf8` if it is
+/// set) if the record has a valid content, otherwise the md5 provided in the
+/// file (converted from hex). Empty if there is neither.
+QByteArray doc_record_md5(const DocRecord& record);
+
+/// Beginning of a document as shown in the document list.
+
+/// The first 160 code points of `long_title`, or of `content` if it is empty,
+/// with newlines replaced by spaces. This is stored in the `preview` column
+/// and is the same as the SQL expression used by `backfill_document_summaries`.
+QString document_preview(const QString& content, const QString& long_title);
+
+/// Number of bytes in the UTF-8 encoding of `text`, without encoding it
+int utf8_length(const QString& text);
+
+/// md5 of the UTF-8 encoding of `text`, the same as hashing `text.toUtf8()`.
+
+/// The text is encoded and hashed in small blocks, so that a large document
+/// is not copied into a UTF-8 buffer of its own size before being hashed.
+QByteArray utf8_md5(const QString& text);
+
+/// Number of unicode code points in `text` (surrogate pairs count as one)
+int n_code_points(const QString& text);
+
+/// Split a document longer than `max_length` characters into segments.
+
+/// Returns no segments if the content is invalid or not longer than
+/// `max_length` unicode code points. Otherwise each segment ends, if possible,
+/// after a blank line or else a line break in the second half of its
+/// `max_length` characters, and is only made shorter or longer so as not to
+/// cut an annotation in two. The annotations are given to the segment in
+/// which they start, with positions relative to its start. Segments have the
+/// document's user-provided id and titles, its metadata plus a
+/// `labelbuddy_segment` object with the document's md5 (`parent_md5`, in
+/// hexadecimal), the segment's position (`index`), the number of segments
+/// (`n_segments`) and the position of its first character in the document
+/// (`offset`), and their `content_md5` is set. `content_md5` is the md5 of the
+/// whole document.
+std::vector<std::unique_ptr<DocRecord>>
+split_doc_record(const DocRecord& record, const QByteArray& content_md5,
+                 int max_length);
+
+/// Reads and hashes documents in a background thread for `import_documents`.
+
+/// The reader runs in its own thread and pushes the parsed records, with their
+/// md5 checksum already computed, into a bounded queue. The calling thread pops
+/// them with `next` and inserts them in the database, so database access and
+/// the progress dialog stay in the thread that owns them while parsing and
+/// hashing the next documents happen in parallel.
+///
+/// By default the reading thread also hashes the records (and splits them if
+/// needed). With a pool of hashing threads it only parses, and queued records
+/// are hashed by the first free hashing thread; `next` still returns them in
+/// the file's order, which `resume_offset` and the progress rely on.
+class DocsReadingThread {
+public:
+  struct Item {
+    std::unique_ptr<DocRecord> record;
+    QByteArray content_md5;
+    int progress;
+    /// the reader's `resume_offset` after reading this record
+    qint64 resume_offset;
+    /// if the document was split by `split_doc_record`, its segments, which
+    /// replace `record` (it is then `nullptr`)
+    std::vector<std::unique_ptr<DocRecord>> segments;
+  };
+
+  /// Starts reading immediately. `reader` should not have an error.
+
+  /// If `stats` is provided the time spent parsing and hashing is added to it.
+  /// If `max_doc_length` is greater than 0, documents longer than that are
+  /// split into segments (see `split_doc_record`). If `n_hashing_threads` is
+  /// greater than 0, that many threads hash the records instead of the
+  /// reading thread.
+  DocsReadingThread(std::unique_ptr<DocsReader> reader,
+                    std::size_t max_queue_size = 256,
+                    BatchStats* stats = nullptr, int max_doc_length = 0,
+                    int n_hashing_threads = 0);
+
+  /// Stops the reading thread and waits for it to finish
+  ~DocsReadingThread();
+
+  /// Wait for the next record; returns false when there are no more records
+  bool next(Item& item);
+
+  /// Ask the reading thread to stop and wait for it to finish.
+
+  /// After this, the remaining queued records are still returned by `next`.
+  void stop();
+
+  /// The reader; its error status can be checked once `next` has returned
+  /// false or after `stop`.
+  const DocsReader& reader() const;
+
+private:
+  struct QueuedItem {
+    Item item;
+    bool is_hashed;
+  };
+
+  void run();
+  void run_hashing();
+  void hash_item(Item& item) const;
+
+  std::unique_ptr<DocsReader> reader_;
+  std::size_t max_queue_size_;
+  BatchStats* stats_;
+  int max_doc_length_;
+  int n_hashing_threads_;
+  /// references to the items stay valid while other items are added and
+  /// removed, so they are hashed without holding the lock
+  std::deque<QueuedItem> queue_{};
+  /// number of items returned by `next` so far
+  std::size_t n_popped_{};
+  /// position, counting the popped items, of the next item to hash
+  std::size_t next_to_hash_{};
+  bool finished_{};
+  bool stop_requested_{};
+  std::mutex mutex_{};
+  std::condition_variable not_empty_{};
+  std::condition_variable not_full_{};
+  std::condition_variable has_unhashed_{};
+  std::vector<std::thread> hashing_threads_{};
+  // last member so that everything else is initialized when the thread starts
+  std::thread thread_;
+};
+
 class DocsWriter {
 public:
   struct Annotation {
@@ -147,9 +438,14 @@ public:
     QString extra_data;
   };
 
+  /// If `device` is not `nullptr` the output is written to it (it is opened
+  /// with `mode` if necessary) instead of the file, and `file_path` is unused.
+  /// The device is not owned by the writer. Otherwise, if `file_path` ends
+  /// with `.gz` or `.zst` the output is compressed.
   DocsWriter(const QString& file_path, bool include_text,
              bool include_annotations, bool include_user_name,
-             QIODevice::OpenMode mode = QIODevice::WriteOnly | QIODevice::Text);
+             QIODevice::OpenMode mode = QIODevice::WriteOnly | QIODevice::Text,
+             QIODevice* device = nullptr);
   virtual ~DocsWriter();
 
   /// after constructing the file should be open and is_open should return true
@@ -171,20 +467,42 @@ public:
   /// at the end of the output file
   virtual void write_suffix();
 
+  /// write any buffered data to the output device
+  virtual void flush();
+
+  /// How much of an output has been written, see `set_output_state`
+  enum class OutputState { Empty, PrefixWritten, DocumentsWritten };
+
+  /// Continue an output whose start was written by another writer.
+
+  /// Nothing is written: the writer behaves as if it had written the prefix
+  /// (and some documents for `DocumentsWritten`) so that what it writes next
+  /// can be appended to that start. Must be called before anything else is
+  /// written. Not supported by `DocsArrowWriter`, whose footer depends on the
+  /// whole file.
+  virtual void set_output_state(OutputState state);
+
 protected:
-  QFile* get_file();
+  QIODevice* get_device();
 
 private:
-  QFile file;
+  std::unique_ptr<QIODevice> file{nullptr};
+  QIODevice* device_;
   bool include_text_;
   bool include_annotations_;
   bool include_user_name_;
 };
 
+/// Writes one JSON object per line.
+
+/// Each record is built directly as UTF-8 by a `Utf8Writer`, with the keys in
+/// the order used by `QJsonDocument`, so no `QJsonObject` is made for the
+/// document (only the metadata is serialized by `QJsonDocument`).
 class DocsJsonLinesWriter : public DocsWriter {
 public:
   DocsJsonLinesWriter(const QString& file_path, bool include_text,
-                      bool include_annotations, bool include_user_name);
+                      bool include_annotations, bool include_user_name,
+                      QIODevice* device = nullptr);
   void add_document(const QString& md5, const QString& content,
                     const QJsonObject& metadata,
                     const QList<Annotation>& annotations,
@@ -193,20 +511,23 @@ public:
                     const QString& long_title) override;
 
   void write_suffix() override;
+  void flush() override;
+  void set_output_state(OutputState state) override;
 
 protected:
-  int get_n_docs() const;
-  QTextStream& get_stream();
+  bool has_written_documents() const;
+  Utf8Writer& get_output();
 
 private:
-  QTextStream stream;
-  int n_docs{};
+  Utf8Writer output_;
+  bool has_written_documents_{};
 };
 
 class DocsJsonWriter : public DocsJsonLinesWriter {
 public:
   DocsJsonWriter(const QString& file_path, bool include_text,
-                 bool include_annotations, bool include_user_name);
+                 bool include_annotations, bool include_user_name,
+                 QIODevice* device = nullptr);
 
   void add_document(const QString& md5, const QString& content,
                     const QJsonObject& metadata,
@@ -218,10 +539,14 @@ public:
   void write_suffix() override;
 };
 
+/// Writes one row per annotation, in the format of `CsvWriter`.
+
+/// As for `DocsJsonLinesWriter` the rows are built directly as UTF-8.
 class DocsCsvWriter : public DocsWriter {
 public:
   DocsCsvWriter(const QString& file_path, bool include_text,
-                bool include_annotations, bool include_user_name);
+                bool include_annotations, bool include_user_name,
+                QIODevice* device = nullptr);
   void add_document(const QString& md5, const QString& content,
                     const QJsonObject& metadata,
                     const QList<Annotation>& annotations,
@@ -229,16 +554,17 @@ public:
                     const QString& short_title,
                     const QString& long_title) override;
   void write_prefix() override;
+  void flush() override;
 
 private:
-  QTextStream stream;
-  CsvWriter csv;
+  Utf8Writer output_;
 };
 
 class DocsXmlWriter : public DocsWriter {
 public:
   DocsXmlWriter(const QString& file_path, bool include_text,
-                bool include_annotations, bool include_user_name);
+                bool include_annotations, bool include_user_name,
+                QIODevice* device = nullptr);
   void add_document(const QString& md5, const QString& content,
                     const QJsonObject& metadata,
                     const QList<Annotation>& annotations,
@@ -247,6 +573,7 @@ public:
                     const QString& long_title) override;
   void write_prefix() override;
   void write_suffix() override;
+  void set_output_state(OutputState state) override;
 
 private:
   QXmlStreamWriter xml;
@@ -254,6 +581,186 @@ private:
   void add_annotations(const QList<Annotation>& annotations);
 };
 
+/// Writes documents in the Arrow IPC file format.
+
+/// Each document is a row. The string columns have the names of the JSON
+/// keys; "meta" contains the metadata as a JSON string and "labels" is a
+/// list of structs (start_char, end_char, label, extra_data). Empty optional
+/// strings are null. Rows are written in record batches of at most
+/// `batch_size` documents, or fewer if they are longer than about 64 MiB.
+class DocsArrowWriter : public DocsWriter {
+public:
+  DocsArrowWriter(const QString& file_path, bool include_text,
+                  bool include_annotations, bool include_user_name,
+                  QIODevice* device = nullptr, int batch_size = 4096);
+  void add_document(const QString& md5, const QString& content,
+                    const QJsonObject& metadata,
+                    const QList<Annotation>& annotations,
+                    const QString& user_name, const QString& user_provided_id,
+                    const QString& short_title,
+                    const QString& long_title) override;
+  void write_prefix() override;
+  void write_suffix() override;
+
+private:
+  std::vector<const ArrowColumn*> columns() const;
+
+  int batch_size_;
+  qint64 batch_n_bytes_{};
+  ArrowUtf8Column md5_{"utf8_text_md5_checksum", false};
+  ArrowUtf8Column metadata_{"meta", false};
+  ArrowUtf8Column user_provided_id_{"id", true};
+  ArrowUtf8Column user_name_{"annotation_approver", true};
+  ArrowUtf8Column short_title_{"short_title", true};
+  ArrowUtf8Column long_title_{"long_title", true};
+  ArrowUtf8Column content_{"text", false};
+  ArrowListColumn labels_;
+  ArrowStructColumn* label_struct_;
+  ArrowInt32Column* start_char_;
+  ArrowInt32Column* end_char_;
+  ArrowUtf8Column* label_name_;
+  ArrowUtf8Column* extra_data_;
+  ArrowFileWriter file_writer_;
+};
+
+/// Writes documents in the labelbuddy bundle format, for moving them to
+/// another labelbuddy database.
+
+/// The file starts with "LBBUNDLE" and a 32-bit version number (currently
+/// 1), followed by one record per document. All integers are little-endian.
+/// A record is its size (uint32) followed by:
+/// - the raw md5 checksum of the UTF-8 text (16 bytes)
+/// - the text, metadata (JSON), id, short title, long title and annotation
+///   approver, each as a uint32 size and UTF-8 bytes (the text is empty if
+///   it is not exported)
+/// - the number of annotations (uint32), then for each its start and end
+///   (int32, in unicode code points), label name and extra data (as above).
+class DocsBundleWriter : public DocsWriter {
+public:
+  DocsBundleWriter(const QString& file_path, bool include_text,
+                   bool include_annotations, bool include_user_name,
+                   QIODevice* device = nullptr);
+  void add_document(const QString& md5, const QString& content,
+                    const QJsonObject& metadata,
+                    const QList<Annotation>& annotations,
+                    const QString& user_name, const QString& user_provided_id,
+                    const QString& short_title,
+                    const QString& long_title) override;
+  void write_prefix() override;
+
+private:
+  QByteArray record_{};
+};
+
+/// Path of the shard `shard_index` of a sharded export to `file_path`
+
+/// `dir/out.jsonl` becomes `dir/out-00003.jsonl` for the fourth shard.
+QString export_shard_path(const QString& file_path, int shard_index);
+
+/// A document read from the database by `DocsExportCursor`
+struct ExportedDocument {
+  int id;
+  QString md5;
+  QString content;
+  QByteArray metadata;
+  QString user_provided_id;
+  QString short_title;
+  QString long_title;
+  QList<DocsWriter::Annotation> annotations;
+};
+
+/// Selection of the documents and annotations to export.
+
+/// The default value selects everything. The document filters are the same
+/// as those of `DocListModel::DocFilter`, with a set of labels instead of a
+/// single one. The conditions are added to the statements of
+/// `DocsExportCursor`, so documents outside of `min_doc_id`, `max_doc_id` are
+/// not read.
+struct ExportFilter {
+  enum class Docs {
+    all,
+    labelled,
+    unlabelled,
+    has_given_label,
+    not_has_given_label,
+    search
+  };
+  Docs docs = Docs::all;
+  /// if not empty, only the annotations with these labels are exported.
+  /// `has_given_label` and `not_has_given_label` select the documents with at
+  /// least one (and no) annotation with one of these labels.
+  QList<int> label_ids{};
+  /// for `search`, the text to search for (see `search_text_to_fts_query`)
+  QString search_text{};
+  /// if not negative, only documents with a greater or equal `id`
+  int min_doc_id = -1;
+  /// if not negative, only documents with a smaller or equal `id`
+  int max_doc_id = -1;
+};
+
+/// Reads the documents to export and their annotations in a single pass.
+
+/// Only two statements are executed: one over the documents ordered by `id`
+/// and one over the annotations ordered by `doc_id` (which can use
+/// `annotation_doc_id_idx`). The annotation cursor is advanced together with
+/// the document cursor so each document is obtained with its annotations
+/// without running queries for each document.
+class DocsExportCursor {
+public:
+  /// If `stats` is provided the time spent in `next` is added to it. If
+  /// `changed_since` is not negative, only documents whose `document_change`
+  /// number is greater are returned.
+  ///
+  /// If `merge_segments` is true, the segments made by `split_doc_record` are
+  /// returned as the document they were split from when all of them follow
+  /// each other in the exported documents: the content is concatenated, the
+  /// annotations are moved back to positions in the whole document, and the
+  /// md5 and metadata are those of the original document.
+  ///
+  /// `filter` restricts the documents and annotations further. A `search`
+  /// filter needs the full-text index (see `create_search_index`).
+  DocsExportCursor(const QSqlDatabase& database, const LabelCache& labels,
+                   bool labelled_docs_only, bool include_text,
+                   bool include_annotations, BatchStats* stats = nullptr,
+                   qlonglong changed_since = -1, bool merge_segments = false,
+                   const ExportFilter& filter = ExportFilter{});
+
+  /// Number of documents the cursor will go through
+  int total_n_docs() const;
+
+  /// Whether the statements could be executed
+  bool is_valid() const;
+
+  /// Move to the next document; returns false when there are no more
+  bool next();
+
+  /// The current document (valid after `next` returned true)
+  const ExportedDocument& current() const;
+
+private:
+  /// Read the next row of the documents query; returns false at the end
+  bool read_document(ExportedDocument& doc);
+  void read_annotations(ExportedDocument& doc);
+
+  /// If `current_` is the first segment of a document, merge the next ones
+
+  /// Documents read that do not belong to a complete series of segments are
+  /// kept in `pending_` to be returned next.
+  void merge_segments();
+
+  const LabelCache* labels_;
+  bool include_annotations_;
+  BatchStats* stats_;
+  bool merge_segments_;
+  int total_n_docs_{};
+  bool is_valid_{};
+  QSqlQuery doc_query_;
+  QSqlQuery annotation_query_;
+  bool annotation_available_{};
+  ExportedDocument current_{};
+  std::deque<ExportedDocument> pending_{};
+};
+
 struct LabelRecord {
   QString name;
   QString color;
@@ -267,6 +774,68 @@ struct ImportDocsResult {
   QString error_message;
 };
 
+/// Writes one shard of a sharded export in its own thread.
+
+/// Documents pushed with `add` go through a bounded queue to a thread that
+/// writes them with `writer`, between its prefix and suffix, so each shard is a
+/// complete file.
+class DocsShardWritingThread {
+public:
+  /// Starts the writing thread immediately. `writer` should be open.
+
+  /// If `stats` is provided the time spent serializing documents is added to
+  /// it.
+  DocsShardWritingThread(std::unique_ptr<DocsWriter> writer,
+                         const QString& user_name,
+                         std::size_t max_queue_size = 256,
+                         BatchStats* stats = nullptr);
+
+  /// Calls `finish`
+  ~DocsShardWritingThread();
+
+  /// Queue a document, waiting if the queue is full
+  void add(const ExportedDocument& doc);
+
+  /// Write the remaining documents and the suffix, close the file and wait for
+  /// the thread to finish.
+  void finish();
+
+private:
+  void run();
+
+  std::unique_ptr<DocsWriter> writer_;
+  QString user_name_;
+  std::size_t max_queue_size_;
+  BatchStats* stats_;
+  std::deque<ExportedDocument> queue_{};
+  bool finish_requested_{};
+  std::mutex mutex_{};
+  std::condition_variable not_empty_{};
+  std::condition_variable not_full_{};
+  // last member so that everything else is initialized when the thread starts
+  std::thread thread_;
+};
+
+/// Settings of `DatabaseCatalog::pre_annotate_documents`
+struct PreAnnotationOptions {
+  /// shell command running the model (see `PreAnnotationPool`)
+  QString command{};
+  /// number of documents sent to the command at once
+  int batch_size = 64;
+  /// number of processes running the command, each working on one batch
+  int n_processes = 1;
+};
+
+/// What `DatabaseCatalog::pre_annotate_documents` did
+struct PreAnnotationResult {
+  /// documents sent to the command whose annotations have been committed
+  int n_docs;
+  /// annotations inserted (existing ones are not counted)
+  int n_annotations;
+  ErrorCode error_code;
+  QString error_message;
+};
+
 struct ExportDocsResult {
   int n_docs;
   int n_annotations;
@@ -304,6 +873,135 @@ QPair<QJsonArray, QPair<ErrorCode, QString>> read_xml_labels(QFile& file);
 
 QPair<QJsonArray, QPair<ErrorCode, QString>> read_txt_labels(QFile& file);
 
+/// Where the text of documents is stored.
+
+/// With `Inline` (the default) it is the `content` column of `document`.
+/// With `Separate`, `document` only has the small columns and the text is in
+/// `document_content(id, content)`, so that scanning documents (for
+/// navigation, counts or the document list) does not bring the text's pages
+/// into the page cache. The layout is chosen when the database is created.
+/// `Compressed` is like `Separate` but the table is
+/// `document_compressed_content(id, content)` and `content` is a blob holding
+/// the UTF-8 text compressed with `compress_content`, which makes the
+/// database several times smaller. The full-text index cannot read
+/// compressed text, so `create_search_index` fails for such databases.
+/// In all cases the `document_with_content` view has all the columns of
+/// `document` plus `content`, and is what readers of the text use, decoding
+/// the `content` values with `content_from_sql`.
+enum class ContentLayout { Inline, Separate, Compressed };
+
+/// Layout of the database `query` is connected to
+
+/// or, if `schema` is given, of the database attached with that name.
+ContentLayout get_content_layout(QSqlQuery& query,
+                                 const QString& schema = "main");
+
+/// Value stored in `document_compressed_content` for `content`
+QByteArray compress_content(const QString& content);
+
+/// Whether reading the compressed text of a database needs zstd.
+
+/// Builds with zstd write zstd frames and record it in `app_state_extra`
+/// ('content_compression'). Databases written before it was recorded have
+/// their first and last stored texts inspected instead. Always false for the
+/// other layouts.
+bool content_requires_zstd(QSqlQuery& query, const QString& schema = "main");
+
+/// Text of a document from a `content` value of `document_with_content`.
+
+/// Compressed text is returned by SQLite as a blob and is uncompressed;
+/// otherwise the value is the text itself. Text that cannot be uncompressed
+/// is empty: databases whose text this build cannot read are not opened (see
+/// `content_requires_zstd`).
+QString content_from_sql(const QVariant& value);
+
+/// The md5 checksums of the documents in a database, kept compactly.
+
+/// Only the first 8 bytes of each checksum are stored: those read by `load`
+/// in a sorted vector, and those added since in a set that is merged into it
+/// as it grows. `may_contain` has no false negatives but can have (rare) false
+/// positives, so a possible match is confirmed with the `content_md5` index,
+/// while a document that is certainly new is inserted without a lookup.
+class KnownMd5Filter {
+public:
+  /// Read the checksums of all the documents in the database
+  void load(QSqlQuery& query);
+
+  void insert(const QByteArray& md5);
+
+  bool may_contain(const QByteArray& md5) const;
+
+private:
+  static quint64 key(const QByteArray& md5);
+
+  std::vector<quint64> sorted_{};
+  std::unordered_set<quint64> added_{};
+};
+
+/// Prepared statements used to insert documents, labels and annotations.
+
+/// Created once per `import_documents` call so that each statement is compiled
+/// by SQLite only once and then reused (re-binding its values) for every
+/// record, instead of being prepared again for each document and annotation.
+///
+/// `label_ids` maps label names to their `id` so that the label table is only
+/// queried the first time a label is seen during the import; -1 marks names
+/// that cannot be inserted (eg empty).
+///
+/// `n_inserted_docs` and `n_inserted_annotations` count the rows inserted by
+/// the session; the caller resets them when it commits, so that they are not
+/// counted with a transaction that is rolled back.
+struct ImportSession {
+  /// `known_docs` holds the documents already in the database and is updated
+  /// by `insert_doc_record`, so that duplicates (most documents when a corpus
+  /// is imported again) are recognized without a failing insert. It can be
+  /// shared by the sessions of several files, and be `nullptr` if no
+  /// documents will be inserted, only annotations.
+  ImportSession(const QSqlDatabase& database, KnownMd5Filter* known_docs);
+  ContentLayout layout{};
+  QSqlQuery insert_doc;
+  /// only used with `ContentLayout::Separate` or `ContentLayout::Compressed`
+  QSqlQuery insert_content;
+  QSqlQuery insert_label;
+  QSqlQuery select_label_id;
+  QSqlQuery insert_annotation;
+  /// `id` of the document with a `content_md5`
+  QSqlQuery select_doc_id;
+  QHash<QString, int> label_ids{};
+  KnownMd5Filter* known_docs;
+  int n_inserted_docs{};
+  int n_inserted_annotations{};
+};
+
+/// SQLite settings trading durability and memory for speed.
+
+/// The values are those accepted by the pragmas of the same names. Apart from
+/// `journal_mode` and `page_size`, which are stored in the database file,
+/// pragmas only affect the connection that sets them.
+struct PragmaProfile {
+  QString name;
+  QString journal_mode;
+  QString synchronous;
+  /// pages if positive, KiB if negative
+  int cache_size;
+  qint64 mmap_size;
+  QString temp_store;
+  /// only changed when the database is vacuumed, see `vacuum_db`
+  int page_size;
+};
+
+/// The available profiles.
+
+/// - "default": SQLite's defaults -- rollback journal, synchronous writes.
+/// - "fast": write-ahead log, so that readers are not blocked by a writer,
+///   with a larger cache and memory-mapped reads.
+/// - "bulk": as "fast" with a much larger cache and larger pages; its
+///   connection settings are used temporarily during imports.
+const QList<PragmaProfile>& pragma_profiles();
+
+/// Find a profile by name; returns `false` if there is none with this name.
+bool find_pragma_profile(const QString& name, PragmaProfile& profile);
+
 /// remove a connection from the qt databases
 
 /// unless `cancel` is called, removes the connection from qt database list when
@@ -349,9 +1047,18 @@ public:
   ///
   /// If remember is true, stores the path in QSettings for next execution of
   /// the program.
+  ///
+  /// A database with compressed zstd text is not opened if labelbuddy was
+  /// built without zstd; `get_open_error` then explains why.
   bool open_database(const QString& database_path = QString(),
                      bool remember = true);
 
+  /// Why the last call to `open_database` failed, if it is known.
+
+  /// Empty if the last one succeeded or failed for other reasons, which are
+  /// not detailed.
+  QString get_open_error() const;
+
   /// Open the temporary database.
 
   /// Only one is opened per execution of the program; if we call this function
@@ -383,8 +1090,58 @@ public:
   /// Imports documents in .json, .jsonl, .csv, .xml or .txt format
 
   /// If `progress` is not `nullptr`, used to display current progress.
+  ///
+  /// If `file_path` is another labelbuddy database (.labelbuddy, .lb,
+  /// .sqlite3, .sqlite or .db), it is merged into the current one with
+  /// `merge_database` instead of being read document by document.
+  ///
+  /// By default the whole file is imported in one transaction, and nothing is
+  /// inserted if the import is cancelled or fails. If `checkpoint_interval` is
+  /// greater than 0, the transaction is instead committed every
+  /// `checkpoint_interval` documents, together with a checkpoint stored in
+  /// `app_state_extra` (see `import_checkpoint_key`). Documents committed
+  /// before a cancellation, error or crash are kept, and importing the same,
+  /// unmodified file again with checkpoints continues after the last
+  /// checkpoint -- seeking directly to its byte offset when the reader
+  /// supports it, otherwise skipping the documents already imported without
+  /// inserting them. The checkpoint is removed once the file has been fully
+  /// imported. The database holds at most one checkpoint, for the last
+  /// interrupted import.
   ImportDocsResult import_documents(const QString& file_path,
-                                    QProgressDialog* progress = nullptr);
+                                    QProgressDialog* progress = nullptr,
+                                    int checkpoint_interval = 0);
+
+  /// Imports several files, reading up to `n_threads` of them at a time.
+
+  /// Documents are parsed and hashed by one thread per file, for the file
+  /// being inserted and the next `n_threads - 1` ones, while they are inserted
+  /// one file after the other through the current connection. The result is
+  /// therefore the same as importing the files one by one in this order: ids
+  /// follow the files' order, then the documents' order in each file. Files
+  /// read ahead can hold many parsed documents in memory until their turn
+  /// comes. Returns the result for each file, in order; `checkpoint_interval`
+  /// is used as in the single-file `import_documents`.
+  QList<ImportDocsResult> import_documents(const QStringList& file_paths,
+                                           int n_threads,
+                                           int checkpoint_interval = 0);
+
+  /// `app_state_extra` key of the checkpoint of an interrupted import
+
+  /// The value is a JSON object with the imported file's absolute path
+  /// (`file`), size and modification time in ms since epoch (`size` and
+  /// `modified`, used to check it has not changed), the number of documents
+  /// read from it so far (`n_docs`) and the corresponding `resume_offset`
+  /// (`offset`).
+  static const QString import_checkpoint_key;
+
+  /// `app_state_extra` key of the change token (see `get_change_token`) read
+  /// before the last successful export of `batch_import_export`
+
+  /// This is the key for exports without filters. Exports restricted to some
+  /// documents or labels store their token under this key followed by `:` and
+  /// a JSON description of their filters, so that `--since last` continues
+  /// from the previous export with the same filters.
+  static const QString export_change_token_key;
 
   /// Imports labels in .txt, .csv or .json format
 
@@ -402,12 +1159,56 @@ public:
   /// \param user_name value for the `annotation_approver` key. If an empty
   /// string this key won't be added.
   /// \param progress if not `nullptr`, used to display the export progress
+  /// \param n_threads if greater than 1, documents are serialized in batches
+  /// by this many worker threads. Batches are written in order so the output
+  /// is identical to the one produced with a single thread (`.arrow` files
+  /// are always serialized by one thread). For sharded exports, the number of
+  /// shards that can be written at the same time.
+  /// \param shard_size if greater than 0, the output is split into files
+  /// containing at most this many documents, named after `file_path` with a
+  /// shard number: `out.jsonl` becomes `out-00000.jsonl`, `out-00001.jsonl`
+  /// etc. Each shard is a valid file in the same format.
+  /// \param changed_since if not negative, only documents whose annotations
+  /// changed after this change token (see `get_change_token`) are exported.
+  /// \param filter restricts the exported documents and annotations (see
+  /// `ExportFilter`). The full-text index is created if needed by a `search`
+  /// filter.
   ExportDocsResult export_documents(const QString& file_path,
                                     bool labelled_docs_only = true,
                                     bool include_text = true,
                                     bool include_annotations = true,
                                     const QString& user_name = "",
-                                    QProgressDialog* progress = nullptr);
+                                    QProgressDialog* progress = nullptr,
+                                    int n_threads = 1, int shard_size = 0,
+                                    qlonglong changed_since = -1,
+                                    const ExportFilter& filter = {});
+
+  /// Annotate documents with the predictions of an external model.
+
+  /// The documents selected by `filter` (whose labels only select documents)
+  /// are read in order of `id`, in batches of `options.batch_size`, and sent
+  /// to `options.n_processes` processes running `options.command` (see
+  /// `PreAnnotationPool` for the protocol). The next batches are read and
+  /// sent while the processes work, and the annotations they return are
+  /// inserted with the batched statement of imports: missing labels are
+  /// created and annotations that already exist are ignored. Annotations are
+  /// committed every few hundred documents, after which `on_progress`, if
+  /// provided, is called with the number of documents annotated so far. If
+  /// the command fails or gives an invalid answer, the annotations received
+  /// before are kept and an error is returned.
+  PreAnnotationResult
+  pre_annotate_documents(const PreAnnotationOptions& options,
+                         const ExportFilter& filter = {},
+                         const std::function<void(int)>& on_progress = nullptr);
+
+  /// Sequence number of the latest change to annotations.
+
+  /// Each insertion, modification or deletion of an annotation records a new,
+  /// larger number for the document in `document_change`. Exporting with
+  /// `changed_since` set to the token returned before a previous export
+  /// writes the documents modified since then (a document modified while
+  /// that export was running may be exported twice, but is never missed).
+  qlonglong get_change_token() const;
 
   /// Exports labels to a .json or .csv file.
   ExportLabelsResult export_labels(const QString& file_path);
@@ -434,8 +1235,120 @@ public:
   void set_app_state_extra(const QString& key, const QVariant& value);
 
   /// execute SQLite's VACUUM
+
+  /// The database's page size is set to the one of its pragma profile first,
+  /// and databases created before incremental vacuuming was enabled are
+  /// converted to `auto_vacuum = INCREMENTAL` (see `incremental_vacuum`).
   void vacuum_db();
 
+  /// Measure the following imports and exports in `stats`.
+
+  /// The time spent in each phase (parse, hash, insert, commit, query,
+  /// serialize) is added to `stats`, which must outlive the imports and
+  /// exports; `nullptr` (the default) disables the measurements.
+  void set_batch_stats(BatchStats* stats);
+
+  /// Split the documents of the following imports into segments.
+
+  /// Documents longer than `max_length` characters are imported as several
+  /// documents (see `split_doc_record`); 0 (the default) disables splitting.
+  void set_max_imported_doc_length(int max_length);
+
+  /// Hash the documents of the following imports in a pool of threads.
+
+  /// With `n_threads` greater than 0, each file's records are hashed (and
+  /// split) by that many threads while its reading thread parses the next
+  /// ones; 0 (the default) leaves hashing to the reading thread.
+  void set_n_hashing_threads(int n_threads);
+
+  /// Merge the segments of split documents in the following exports.
+
+  /// See `DocsExportCursor`. Disabled by default.
+  void set_merge_exported_segments(bool merge);
+
+  /// Open the databases of the following `open_database` calls read-only.
+
+  /// Read-only connections cannot modify the database, so they do not create,
+  /// check or migrate tables, and opening fails if the file does not exist or
+  /// has an older schema. They see the changes that other connections (possibly
+  /// in other processes, eg an ongoing import) commit meanwhile, and are not
+  /// blocked by a writer when the database uses the write-ahead log -- only
+  /// if its pragma profile is "fast" or "bulk", as imports do not change the
+  /// journal mode (see `apply_pragma_profile`). As the connection is named
+  /// after the file, a database that is already open keeps the mode it was
+  /// opened with. The temporary database is always writable. Disabled by
+  /// default.
+  void set_open_read_only(bool read_only);
+
+  /// Whether the current database was opened read-only
+  bool is_read_only() const;
+
+  /// Fill the document summaries of migrated databases in the background.
+
+  /// Databases migrated from schema version 4 or older need their `preview`,
+  /// `content_length` and `n_code_points` columns filled, which reads all the
+  /// documents (see `backfill_document_summaries`). With this option
+  /// `open_database` leaves it to a `SummaryBackfillThread`, which is
+  /// cancelled when it is replaced by the backfill of another database or
+  /// when the catalog is destroyed; until it is done the previews are
+  /// computed when they are read. In-memory databases, and all databases
+  /// when it is disabled (the default), are filled before `open_database`
+  /// returns.
+  void set_asynchronous_backfill(bool asynchronous);
+
+  /// Layout of the databases created by the following `open_database` calls.
+
+  /// Existing databases keep the layout they were created with. The default
+  /// is `ContentLayout::Inline`.
+  void set_new_database_content_layout(ContentLayout layout);
+
+  /// Apply a pragma profile to the current database and remember it.
+
+  /// The profile name is stored in `app_state_extra` and the profile is
+  /// applied again each time the database is opened. If the database has no
+  /// documents yet it is vacuumed to set the profile's page size. Returns
+  /// `false` if there is no profile with this name.
+  bool set_pragma_profile(const QString& name);
+
+  /// The profile chosen with `set_pragma_profile`, "default" if none was.
+  QString get_pragma_profile() const;
+
+  /// Prepare the current database for importing many documents.
+
+  /// Drops the secondary indexes on `document` and `annotation` and the
+  /// triggers maintaining the annotation and label counts and the change
+  /// tracking (see `get_change_token`), so that inserting
+  /// a document does not update them row by row. The indexes enforcing
+  /// uniqueness (`content_md5` and the annotations' `UNIQUE` constraint) are
+  /// kept, as are foreign keys, which only need the primary keys. Documents
+  /// are inserted in file order with increasing ids, so the indexes on doc ids
+  /// grow at the end. `end_bulk_load` must be called after the imports; if the
+  /// program stops before, it is called when the database is opened again.
+  /// Returns `false` (changing nothing) if the database could not be modified.
+  bool begin_bulk_load();
+
+  /// Rebuild the indexes and counts dropped by `begin_bulk_load`.
+
+  /// The counts are computed from the `annotation` table and the indexes are
+  /// built in one pass each, which is much faster than maintaining them during
+  /// an import into an empty database.
+  bool end_bulk_load();
+
+  /// Apply a pragma profile to the current database without remembering it.
+
+  /// With `connection_only`, the journal mode is not changed, nor the
+  /// synchronous setting unless the database is in WAL mode: only the
+  /// settings of this connection are, which is how imports switch temporarily
+  /// to the "bulk" profile. Returns `false` if there is no profile with this
+  /// name.
+  bool apply_pragma_profile(const QString& name, bool connection_only = false);
+
+  /// Cache of the current database's labels.
+
+  /// It follows the current database and is invalidated when labels are
+  /// imported; the models share it so label lookups do not need SQL.
+  LabelCache* get_label_cache();
+
 signals:
   /// emitted after opening a connection to a database for the first time
   void new_database_opened(const QString& database_name);
@@ -452,9 +1365,62 @@ private:
   bool is_persistent_database(const QString& db_path) const;
 
   /// Check database, set foreign_keys pragma, create tables if necessary
-  bool initialize_database(QSqlDatabase& database);
+
+  /// If `read_only`, the database must already exist and have the current
+  /// schema, and nothing is written.
+  bool initialize_database(QSqlDatabase& database, bool read_only = false);
   bool create_tables(QSqlQuery& query);
 
+  /// Check that this build can read the compressed text of a database.
+
+  /// Sets `open_error_` if it cannot. With zstd, records in a writable
+  /// database that its text may be zstd frames (see `content_requires_zstd`).
+  bool check_content_compression(QSqlQuery& query, bool read_only);
+
+  /// Table counting each document's annotations, kept up to date by triggers,
+  /// and the `labelled_document` and `unlabelled_document` views that use it.
+
+  /// Added in schema version 3. Existing annotations are counted so this is
+  /// also used to migrate a version 2 database.
+  bool create_annotation_count_schema(QSqlQuery& query);
+
+  /// Indexes that are not needed to enforce constraints, see `begin_bulk_load`
+  bool create_secondary_indexes(QSqlQuery& query);
+
+  /// Tables counting annotations for each (label, document) pair and
+  /// documents for each label, kept up to date by triggers.
+
+  /// Added in schema version 4. Also used to migrate older databases.
+  bool create_label_count_schema(QSqlQuery& query);
+
+  /// The `document_change` table recording the last change to each
+  /// document's annotations, kept up to date by triggers.
+
+  /// Added in schema version 7. Documents that already have annotations are
+  /// given the change number 1, so that exporting changes since 0 exports all
+  /// of them. The rows of deleted documents are removed by a trigger, except
+  /// the one with the largest number, from which the next one is computed, so
+  /// that it never decreases. Deleted documents are thus not reported.
+  bool create_change_tracking_schema(QSqlQuery& query);
+
+  /// The `document_with_content` view (see `ContentLayout`).
+
+  /// Added in schema version 6, when it is also created for older databases,
+  /// which all have the inline layout.
+  bool create_content_view(QSqlQuery& query, ContentLayout layout);
+
+  /// `preview`, `content_length` and `n_code_points` columns of `document`.
+
+  /// Added in schema version 5. In new databases they are created with the
+  /// table, before `content`, so that reading them does not go through the
+  /// content's overflow pages; this adds them (at the end) to older ones, if
+  /// they do not have them already, and schedules the backfill that
+  /// `open_database` runs (see `set_asynchronous_backfill`).
+  bool add_document_summary_columns(QSqlQuery& query);
+
+  /// Upgrade a database with an older `user_version` to the current schema
+  bool migrate_database(QSqlQuery& query, int from_version);
+
   /// Last used database if it is found in QSettings and exists else ""
   QString get_default_database_path() const;
 
@@ -464,24 +1430,122 @@ private:
   /// return a reader appropriate for the filename extension
   std::unique_ptr<DocsReader> get_docs_reader(const QString& file_path) const;
 
+  /// A file whose documents are being read and hashed for `run_import`.
+  struct PreparedImport {
+    /// `nullptr` if the file could not be opened
+    std::unique_ptr<DocsReadingThread> reading_thread{nullptr};
+    ErrorCode error_code = ErrorCode::NoError;
+    QString error_message{};
+    int progress_max{};
+    /// see `import_checkpoint_key`
+    QJsonObject checkpoint{};
+    int n_docs_read{};
+    /// documents to skip when resuming from a checkpoint without an offset
+    int n_docs_to_skip{};
+    bool has_checkpoint{};
+    /// if not empty, the import resumes from a checkpoint; shown in the
+    /// progress dialog, or printed without one
+    QString resume_message{};
+    /// if not empty, the database to merge instead of reading a file
+    QString source_database{};
+  };
+
+  /// Open a file, find its checkpoint and start its reading thread
+  PreparedImport prepare_import(const QString& file_path,
+                                int checkpoint_interval,
+                                std::size_t max_queue_size = 256);
+
+  /// Insert the documents of a prepared file
+
+  /// `known_docs` is loaded once by `import_documents` and updated with the
+  /// documents inserted from each file.
+  ImportDocsResult run_import(PreparedImport& prepared,
+                              QProgressDialog* progress,
+                              int checkpoint_interval,
+                              KnownMd5Filter& known_docs);
+
+  /// Copy the documents, labels and annotations of another database.
+
+  /// The source is attached to the current connection and copied with a few
+  /// `insert ... select` statements, in one transaction: documents whose
+  /// `content_md5` is already present are skipped, labels are matched by
+  /// name (new ones keep their color, and their shortcut key if it is not
+  /// used yet) and annotations are added to the matching documents and
+  /// labels. Only the text needs to be decoded and encoded again, document by
+  /// document, when exactly one of the databases stores compressed text.
+  /// The source must have the current schema (ie have been opened with this
+  /// version of labelbuddy); checkpoints are not used.
+  ImportDocsResult merge_database(const QString& source_path,
+                                  QProgressDialog* progress);
+
+  /// Insert the text of the documents merged from the attached source, whose
+  /// ids are greater than `last_id_before`, in the separate content table.
+  bool merge_attached_content(QSqlQuery& query, ContentLayout source_layout,
+                              ContentLayout target_layout,
+                              qlonglong last_id_before);
+
   /// return a writer appropriate for the filename extension
-  std::unique_ptr<DocsWriter> get_docs_writer(const QString& file_path,
-                                              bool include_text,
-                                              bool include_annotations,
-                                              bool include_user_name) const;
 
+  /// If `device` is not `nullptr` the writer outputs to it rather than to
+  /// `file_path`, which is then only used to choose the format.
+  std::unique_ptr<DocsWriter>
+  get_docs_writer(const QString& file_path, bool include_text,
+                  bool include_annotations, bool include_user_name,
+                  QIODevice* device = nullptr) const;
+
+  ExportDocsResult export_documents_in_shards(
+      const QString& file_path, DocsExportCursor& cursor, bool include_text,
+      bool include_annotations, const QString& user_name,
+      QProgressDialog* progress, int n_threads, int shard_size);
+
+  ExportDocsResult export_documents_in_parallel(
+      const QString& file_path, DocsExportCursor& cursor, bool include_text,
+      bool include_annotations, const QString& user_name,
+      QProgressDialog* progress, int n_threads);
+
+  /// Serialize a batch of documents exactly as a single writer would.
+
+  /// If `is_first_batch` the output starts with the format's prefix. Otherwise
+  /// it contains only what the writer outputs for these documents when they
+  /// follow other documents in the same file.
+  QByteArray serialize_docs_batch(const QString& file_path, bool include_text,
+                                  bool include_annotations,
+                                  const QString& user_name,
+                                  const QList<ExportedDocument>& docs,
+                                  bool is_first_batch) const;
+
+  /// What a writer outputs at the end of the file after writing `n_docs`.
+  QByteArray serialize_docs_suffix(const QString& file_path, bool include_text,
+                                   bool include_annotations,
+                                   const QString& user_name, int n_docs) const;
 
-  int insert_doc_record(const DocRecord& record, QSqlQuery& query);
-  int insert_doc_annotations(int doc_id, const QJsonArray& annotations,
-                             QSqlQuery& query);
+
+  /// Insert a document and its annotations.
+
+  /// Returns false if the document could not be stored; its row is then
+  /// removed so that no document is left without its content.
+  bool insert_doc_record(const DocRecord& record,
+                         const QByteArray& content_md5,
+                         ImportSession& session);
+
+  /// Insert all the annotations of a document.
+
+  /// Annotations that are already in the database or are invalid are ignored;
+  /// the others are added to `session.n_inserted_annotations`.
+  void insert_doc_annotations(int doc_id,
+                              const std::vector<AnnotationRecord>& annotations,
+                              ImportSession& session);
+
+  /// Label `id` for a label name, inserting the label if necessary.
+
+  /// Returns -1 if the label does not exist and cannot be inserted.
+  int get_label_id_for_import(const QString& label_name,
+                              ImportSession& session);
 
   void insert_label(QSqlQuery& query, const QString& label_name,
                     const QString& color = QString(),
                     const QString& shortcut_key = QString());
 
-  int write_doc(DocsWriter& writer, int doc_id, bool include_text,
-                bool include_annotations, const QString& user_name);
-
   ExportLabelsResult write_labels_to_json(const QJsonArray& labels,
                                           const QString& file_path);
   ExportLabelsResult write_labels_to_json_lines(const QJsonArray& labels,
@@ -493,14 +1557,138 @@ private:
 
   int color_index{};
   bool tmp_db_data_loaded_{};
+  LabelCache label_cache_{};
+  BatchStats* batch_stats_ = nullptr;
+  int max_imported_doc_length_{};
+  int n_hashing_threads_{};
+  bool merge_exported_segments_{};
+  ContentLayout new_database_content_layout_{ContentLayout::Inline};
+  bool open_read_only_{};
+  QString open_error_{};
+  bool asynchronous_backfill_{};
+  std::unique_ptr<SummaryBackfillThread> summary_backfill_{};
   static const QString tmp_db_name_;
 };
 
+/// Settings for `batch_import_export`
+struct BatchOptions {
+  /// number of threads used to serialize exported documents
+  int n_export_threads = 1;
+  /// number of imported documents files that are read at the same time
+  int n_import_threads = 1;
+  /// number of threads hashing the documents of each imported file (see
+  /// `DatabaseCatalog::set_n_hashing_threads`)
+  int n_hashing_threads = 0;
+  /// if "json", print a `BatchStats` report on the last line of the output
+  QString stats_format{};
+  /// if greater than 0, split exported documents into files of this size
+  int export_shard_size = 0;
+  /// if greater than 0, commit imported documents in chunks of this size and
+  /// resume interrupted imports (see `DatabaseCatalog::import_documents`)
+  int import_checkpoint_interval = 0;
+  /// if greater than 0, imported documents longer than this are split into
+  /// segments (see `split_doc_record`)
+  int import_max_doc_length = 0;
+  /// if true, exported segments are merged (see `DocsExportCursor`)
+  bool export_merge_segments = false;
+  /// if not empty, the pragma profile to set for the database
+  QString pragma_profile{};
+  /// if not empty, only export documents whose annotations changed after this
+  /// change token, or after the previous batch export if it is "last" (see
+  /// `DatabaseCatalog::get_change_token`)
+  QString export_since{};
+  /// if not empty, one of "labelled", "unlabelled", "has-label",
+  /// "not-has-label" or "search" (see `ExportFilter::Docs`)
+  QString export_doc_filter{};
+  /// names of the labels of the `ExportFilter`
+  QStringList export_label_names{};
+  /// text searched by the "search" filter
+  QString export_search_text{};
+  /// `ExportFilter::min_doc_id` and `ExportFilter::max_doc_id`
+  int export_min_doc_id = -1;
+  int export_max_doc_id = -1;
+  /// if true, imports are done between `begin_bulk_load` and `end_bulk_load`
+  bool bulk_load = false;
+  /// if true and the database does not exist yet, it is created with
+  /// `ContentLayout::Separate`
+  bool separate_content = false;
+  /// if true and the database does not exist yet, it is created with
+  /// `ContentLayout::Compressed` (this takes precedence over
+  /// `separate_content`)
+  bool compress_content = false;
+  /// if true, the database is opened read-only and only exports are possible
+  /// (see `DatabaseCatalog::set_open_read_only`)
+  bool read_only = false;
+  /// if not empty, documents are pre-annotated with this command after the
+  /// imports (see `DatabaseCatalog::pre_annotate_documents`); they are
+  /// selected by the same filter as the exported documents
+  QString pre_annotate_command{};
+  /// `PreAnnotationOptions::batch_size` and `PreAnnotationOptions::n_processes`
+  int pre_annotate_batch_size = 64;
+  int pre_annotate_n_processes = 1;
+};
+
+/// Create the full-text index of documents if it does not exist yet.
+
+/// `document_fts` is an FTS5 table over the `content`, `long_title` and
+/// `user_provided_id` columns of `document_with_content`, kept up to date by
+/// triggers on `document` (and `document_content`, see `ContentLayout`). It
+/// is built the first time a search is performed rather than when the
+/// database is created, so that databases that are never searched do not pay
+/// for it. Returns `false` if it could not be created, eg if SQLite was built
+/// without FTS5, the database is read-only or its layout is
+/// `ContentLayout::Compressed`.
+///
+/// The documents are indexed in batches, in a single transaction; after each
+/// batch `on_progress` (if provided) is called with the number of documents
+/// indexed so far.
+bool create_search_index(QSqlQuery& query,
+                         const std::function<void(int)>& on_progress = {});
+
+/// Whether the documents of a database can be searched.
+
+/// False if its layout is `ContentLayout::Compressed`, which the full-text
+/// index cannot read. SQLite may still lack FTS5, which is only known when
+/// the index is created.
+bool is_search_supported(QSqlQuery& query);
+
+/// Give the database's free pages back to the file system, a few at a time.
+
+/// Only possible for databases with `auto_vacuum = INCREMENTAL`, which is the
+/// case of databases created by this version of labelbuddy and of older ones
+/// once they have been vacuumed with `vacuum_db`. Unlike `VACUUM` this does
+/// not rewrite the database, so it does not need extra disk space. Pages are
+/// freed in transactions of at most `max_pages_per_transaction` pages so that
+/// other connections are not blocked for long. `cancelled`, if provided, is
+/// checked between transactions. Returns the number of freed pages.
+int incremental_vacuum(QSqlQuery& query, int max_pages_per_transaction = 1000,
+                       const std::function<bool()>& cancelled = nullptr);
+
+/// Fill the `preview`, `content_length` and `n_code_points` columns of
+/// documents inserted before they existed.
+
+/// Documents are updated in order of `id`, in transactions of `chunk_size`
+/// documents, and only those with a `NULL` preview are modified, so an
+/// interrupted backfill can be run again. `cancelled`, if provided, is
+/// checked between transactions. Returns the number of updated documents, or
+/// -1 if a query failed.
+int backfill_document_summaries(
+    QSqlQuery& query, int chunk_size = 1000,
+    const std::function<bool()>& cancelled = nullptr);
+
+/// An FTS5 query matching documents containing all the words in `text`.
+
+/// Each word is quoted so that FTS5 operators and punctuation in `text` have
+/// no special meaning, except for a trailing `*` which makes it a prefix
+/// query. Returns an empty string if `text` contains no words.
+QString search_text_to_fts_query(const QString& text);
+
 /// Perform import, export, or vacuum operations without the GUI.
 
 /// Returns 0 if there were no errors and 1 otherwise. Starts by importing
-/// labels, then docs, then exporting labels, then exporting docs. If vacuum is
-/// `true`, executes `VACUUM` and does not consider any of the other operations.
+/// labels, then docs, then pre-annotating docs, then exporting labels, then
+/// exporting docs. If vacuum is `true`, executes `VACUUM` and does not
+/// consider any of the other operations.
 ///
 /// If one of the import files doesn't have a recognized extension it is
 /// skipped to avoid inserting incorrect data in the database.
@@ -508,11 +1696,15 @@ private:
 /// printed, but the export is still performed in a default format (json) and it
 /// is not considered an error -- this function can still return 0 if there were
 /// no other errors.
+///
+/// `options` holds the settings that only affect how the work is done, not
+/// what is imported or exported, except for `export_since`.
 int batch_import_export(
     const QString& db_path, const QList<QString>& labels_files,
     const QList<QString>& docs_files, const QString& export_labels_file,
     const QString& export_docs_file, bool labelled_docs_only, bool include_text,
-    bool include_annotations, const QString& user_name, bool vacuum);
+    bool include_annotations, const QString& user_name, bool vacuum,
+    const BatchOptions& options = BatchOptions{});
 
 } // namespace labelbuddy
 
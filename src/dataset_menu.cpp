@@ -1,5 +1,6 @@
 #include <cassert>
 
+#include <QHeaderView>
 #include <QSettings>
 
 #include "dataset_menu.h"
@@ -12,9 +13,17 @@
 namespace labelbuddy {
 DatasetMenu::DatasetMenu(QWidget* parent) : QSplitter(parent) {
 
+  // the label list and its statistics share the left side
+  labels_splitter = new QSplitter(Qt::Vertical);
+  addWidget(labels_splitter);
   label_list = new LabelList();
-  addWidget(label_list);
+  labels_splitter->addWidget(label_list);
   scale_margin(*label_list, Side::Right);
+  label_stats_view = new QTableView();
+  labels_splitter->addWidget(label_stats_view);
+  label_stats_view->setSelectionMode(QAbstractItemView::NoSelection);
+  label_stats_view->verticalHeader()->hide();
+  label_stats_view->horizontalHeader()->setStretchLastSection(true);
 
   doc_list = new DocList();
   addWidget(doc_list);
@@ -24,6 +33,10 @@ DatasetMenu::DatasetMenu(QWidget* parent) : QSplitter(parent) {
   if (settings.contains("DatasetMenu/state")) {
     restoreState(settings.value("DatasetMenu/state").toByteArray());
   }
+  if (settings.contains("DatasetMenu/labels_state")) {
+    labels_splitter->restoreState(
+        settings.value("DatasetMenu/labels_state").toByteArray());
+  }
 
   QObject::connect(doc_list, &DocList::visit_doc_requested, this,
                    &DatasetMenu::visit_doc_requested);
@@ -63,11 +76,36 @@ void DatasetMenu::set_label_list_model(LabelListModel* new_model) {
   }
 }
 
+void DatasetMenu::set_label_stats_model(LabelStatsModel* new_model) {
+  assert(new_model != nullptr);
+  label_stats_model = new_model;
+  label_stats_view->setModel(new_model);
+  // the model resets when the database changes, and may have deferred the
+  // statistics
+  QObject::connect(label_stats_model, &LabelStatsModel::modelReset, this,
+                   &DatasetMenu::refresh_label_stats_if_visible,
+                   Qt::QueuedConnection);
+}
+
+void DatasetMenu::refresh_label_stats_if_visible() {
+  if (label_stats_model != nullptr && isVisible()) {
+    label_stats_model->refresh_stats_if_outdated();
+  }
+}
+
+void DatasetMenu::showEvent(QShowEvent* event) {
+  if (label_stats_model != nullptr) {
+    label_stats_model->refresh_stats_if_outdated();
+  }
+  QSplitter::showEvent(event);
+}
+
 int DatasetMenu::n_selected_docs() const { return doc_list->n_selected_docs(); }
 
 void DatasetMenu::store_state() {
   QSettings settings("labelbuddy", "labelbuddy");
   settings.setValue("DatasetMenu/state", saveState());
+  settings.setValue("DatasetMenu/labels_state", labels_splitter->saveState());
 }
 
 } // namespace labelbuddy
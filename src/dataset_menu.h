@@ -2,12 +2,15 @@
 #define LABELBUDDY_DATASET_MENU_H
 
 #include <QCloseEvent>
+#include <QShowEvent>
 #include <QSplitter>
+#include <QTableView>
 
 #include "doc_list.h"
 #include "doc_list_model.h"
 #include "label_list.h"
 #include "label_list_model.h"
+#include "label_stats_model.h"
 
 /// \file
 /// Implementation of the Dataset tab
@@ -23,21 +26,32 @@ public:
   DatasetMenu(QWidget* parent = nullptr);
   void set_doc_list_model(DocListModel*);
   void set_label_list_model(LabelListModel*);
+  /// Model of the statistics table shown below the label list
+  void set_label_stats_model(LabelStatsModel*);
   int n_selected_docs() const;
 
 public slots:
   void store_state();
 
+protected:
+  void showEvent(QShowEvent* event) override;
+
+private slots:
+  void refresh_label_stats_if_visible();
+
 signals:
   /// User asked to annotate doc with `id` (in the db) `doc_id`
   void visit_doc_requested(int doc_id);
   void n_selected_docs_changed(int n_docs);
 
 private:
+  QSplitter* labels_splitter;
   LabelList* label_list;
+  QTableView* label_stats_view;
   DocList* doc_list;
   LabelListModel* label_list_model = nullptr;
   DocListModel* doc_list_model = nullptr;
+  LabelStatsModel* label_stats_model = nullptr;
 };
 } // namespace labelbuddy
 #endif
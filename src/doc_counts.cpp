@@ -0,0 +1,74 @@
+#include <utility>
+
+#include <QVariant>
+
+#include "database.h"
+#include "doc_counts.h"
+#include "tracing.h"
+#include "worker_connection.h"
+
+namespace labelbuddy {
+
+bool compute_doc_counts(QSqlQuery& query, const QString& search_query,
+                        DocCounts& counts) {
+  TraceScope trace("compute_doc_counts");
+  if (!traced_exec(query, "select count(*) from document;") || !query.next()) {
+    return false;
+  }
+  counts.n_docs = query.value(0).toInt();
+  if (!traced_exec(query, "select count(*) from document_annotation_count;") ||
+      !query.next()) {
+    return false;
+  }
+  counts.n_labelled_docs = query.value(0).toInt();
+  query.finish();
+  counts.n_search_results = 0;
+  counts.search_available = true;
+  if (search_query.isEmpty()) {
+    return true;
+  }
+  counts.search_available = create_search_index(query);
+  if (!counts.search_available) {
+    return true;
+  }
+  query.prepare("select count(*) from document_fts "
+                "where document_fts match :search;");
+  query.bindValue(":search", search_query);
+  // an invalid FTS query matches no documents
+  if (traced_exec(query) && query.next()) {
+    counts.n_search_results = query.value(0).toInt();
+  }
+  return true;
+}
+
+DocCountsThread::DocCountsThread(
+    const QString& database_path, bool read_only, const QString& search_query,
+    std::function<void(bool, DocCounts)> on_finished)
+    : database_path_{database_path}, read_only_{read_only},
+      search_query_{search_query}, on_finished_{std::move(on_finished)},
+      thread_(&DocCountsThread::run, this) {}
+
+DocCountsThread::~DocCountsThread() {
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void DocCountsThread::run() {
+  bool ok{};
+  DocCounts counts{};
+  {
+    // building the search index needs to write
+    WorkerConnection connection(database_path_, "labelbuddy_doc_counts",
+                                read_only_
+                                    ? WorkerConnection::Access::ReadOnly
+                                    : WorkerConnection::Access::ReadWrite);
+    if (connection.is_open()) {
+      QSqlQuery query(connection.database());
+      ok = compute_doc_counts(query, search_query_, counts);
+    }
+  }
+  on_finished_(ok, counts);
+}
+
+} // namespace labelbuddy
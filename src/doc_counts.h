@@ -0,0 +1,66 @@
+#ifndef LABELBUDDY_DOC_COUNTS_H
+#define LABELBUDDY_DOC_COUNTS_H
+
+#include <functional>
+#include <thread>
+
+#include <QSqlQuery>
+#include <QString>
+
+/// \file
+/// Numbers of documents shown in the Dataset tab, possibly computed in a
+/// background thread.
+
+namespace labelbuddy {
+
+/// Numbers of documents in the database and matching the current search
+struct DocCounts {
+  int n_docs{};
+  /// documents with at least one annotation
+  int n_labelled_docs{};
+  /// documents matching the search query, 0 if there is none
+  int n_search_results{};
+  /// false if the search needed the full-text index and it could not be built
+  bool search_available{true};
+};
+
+/// Count the documents, the labelled ones and those matching `search_query`.
+
+/// `search_query` is an FTS5 query (see `search_text_to_fts_query`). If it is
+/// not empty the full-text index is built first when it does not exist yet
+/// (see `create_search_index`), which reads all the documents. Returns
+/// `false` if the documents could not be counted.
+bool compute_doc_counts(QSqlQuery& query, const QString& search_query,
+                        DocCounts& counts);
+
+/// Computes the document counts in a background thread with its own database
+/// connection.
+
+/// The thread starts immediately. `on_finished` is called once *from the
+/// counting thread* with the result of `compute_doc_counts`. The queries
+/// cannot be interrupted, so the destructor waits until they are done.
+class DocCountsThread {
+public:
+  /// `database_path` is the path of the database file. With `read_only` it
+  /// is opened read-only, and the search index is only used if it exists.
+  DocCountsThread(const QString& database_path, bool read_only,
+                  const QString& search_query,
+                  std::function<void(bool, DocCounts)> on_finished);
+
+  /// Waits for the thread to finish
+  ~DocCountsThread();
+
+private:
+  void run();
+
+  QString database_path_;
+  bool read_only_;
+  QString search_query_;
+  std::function<void(bool, DocCounts)> on_finished_;
+  // last member so that everything else is initialized when the thread starts
+  std::thread thread_;
+};
+
+} // namespace labelbuddy
+
+#endif
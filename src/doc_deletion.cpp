@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <utility>
+
+#include <QSqlError>
+#include <QStringList>
+
+#include "database.h"
+#include "doc_deletion.h"
+#include "worker_connection.h"
+
+namespace labelbuddy {
+
+namespace {
+
+QString deletion_error(const QSqlQuery& query) {
+  // SQLITE_BUSY, after the busy timeout
+  if (query.lastError().nativeErrorCode() == "5") {
+    return "The database was locked by another connection.";
+  }
+  return query.lastError().text();
+}
+
+} // namespace
+
+DeletionResult
+delete_docs_in_chunks(QSqlQuery& query, bool all_docs,
+                      const QList<int>& doc_ids, int chunk_size,
+                      const std::function<void(int)>& on_progress,
+                      const std::function<bool()>& cancelled) {
+  DeletionResult result{0, QString()};
+  auto& n_deleted = result.n_deleted;
+  int chunk_start{};
+  while (all_docs || chunk_start < doc_ids.size()) {
+    if (cancelled && cancelled()) {
+      break;
+    }
+    QString statement{};
+    if (all_docs) {
+      // does not need SQLITE_ENABLE_UPDATE_DELETE_LIMIT
+      statement = QString("delete from document where id in (select id from "
+                          "document order by id limit %0);")
+                      .arg(chunk_size);
+    } else {
+      // ids are integers so they can be formatted in the statement, which
+      // gives the number of deleted rows directly
+      auto chunk_end = std::min(doc_ids.size(), chunk_start + chunk_size);
+      QStringList ids{};
+      for (int i = chunk_start; i != chunk_end; ++i) {
+        ids << QString::number(doc_ids[i]);
+      }
+      chunk_start = chunk_end;
+      statement =
+          QString("delete from document where id in (%0);").arg(ids.join(", "));
+    }
+    query.exec("begin transaction;");
+    if (!query.exec(statement)) {
+      result.error_message = deletion_error(query);
+      query.exec("rollback transaction;");
+      break;
+    }
+    auto n_in_chunk = query.numRowsAffected();
+    if (!query.exec("commit transaction;")) {
+      result.error_message = deletion_error(query);
+      query.exec("rollback transaction;");
+      break;
+    }
+    n_deleted += n_in_chunk;
+    if (on_progress) {
+      on_progress(n_deleted);
+    }
+    if (all_docs && n_in_chunk == 0) {
+      break;
+    }
+  }
+  return result;
+}
+
+DocDeletionThread::DocDeletionThread(
+    const QString& database_path, bool all_docs, const QList<int>& doc_ids,
+    std::function<void(int)> on_progress,
+    std::function<void(DeletionResult)> on_finished)
+    : database_path_{database_path},
+      all_docs_{all_docs}, doc_ids_{doc_ids},
+      on_progress_{std::move(on_progress)},
+      on_finished_{std::move(on_finished)},
+      thread_(&DocDeletionThread::run, this) {}
+
+DocDeletionThread::~DocDeletionThread() {
+  cancel();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void DocDeletionThread::cancel() { cancel_requested_ = true; }
+
+void DocDeletionThread::run() {
+  DeletionResult result{0, "Could not open the database."};
+  {
+    WorkerConnection connection(database_path_, "labelbuddy_document_deletion",
+                                WorkerConnection::Access::ReadWrite);
+    if (connection.is_open()) {
+      QSqlQuery query(connection.database());
+      auto cancelled = [this]() { return cancel_requested_.load(); };
+      result = delete_docs_in_chunks(query, all_docs_, doc_ids_, 1000,
+                                     on_progress_, cancelled);
+      // give back the space used by the deleted documents
+      incremental_vacuum(query, 1000, cancelled);
+    }
+  }
+  on_finished_(std::move(result));
+}
+
+} // namespace labelbuddy
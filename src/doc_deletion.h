@@ -0,0 +1,80 @@
+#ifndef LABELBUDDY_DOC_DELETION_H
+#define LABELBUDDY_DOC_DELETION_H
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+#include <QList>
+#include <QSqlQuery>
+#include <QString>
+
+/// \file
+/// Deleting documents in bounded transactions, possibly in a background
+/// thread.
+
+namespace labelbuddy {
+
+struct DeletionResult {
+  int n_deleted;
+  /// why the deletion stopped before the last chunk; empty if it did not, or
+  /// if it was cancelled
+  QString error_message;
+};
+
+/// Delete documents, committing a transaction every `chunk_size` documents.
+
+/// If `all_docs` is true all documents are deleted and `doc_ids` is ignored.
+/// Their annotations are removed by the foreign key's `ON DELETE CASCADE`, so
+/// foreign keys must be enabled for the connection. After each chunk is
+/// committed `on_progress`, if provided, is called with the number of
+/// documents deleted so far. `cancelled`, if provided, is checked before each
+/// chunk; chunks already committed are not rolled back. If a query fails,
+/// eg because another connection kept the database locked for longer than the
+/// busy timeout, its chunk is rolled back and the function stops with an
+/// error message. The documents of the previous chunks stay deleted.
+DeletionResult
+delete_docs_in_chunks(QSqlQuery& query, bool all_docs,
+                      const QList<int>& doc_ids, int chunk_size = 1000,
+                      const std::function<void(int)>& on_progress = nullptr,
+                      const std::function<bool()>& cancelled = nullptr);
+
+/// Deletes documents in a background thread with its own database connection.
+
+/// The thread starts deleting immediately (see `delete_docs_in_chunks`), then
+/// frees the pages that are no longer used (see `incremental_vacuum`).
+/// `on_progress` is called *from the deletion thread* with the number of
+/// documents deleted so far, and `on_finished` with the result; it is always
+/// called once, after the last chunk, when deletion is complete, cancelled or
+/// has failed.
+class DocDeletionThread {
+public:
+  /// `database_path` is the path of the database file. It is opened in a
+  /// connection that belongs to the deletion thread.
+  DocDeletionThread(const QString& database_path, bool all_docs,
+                    const QList<int>& doc_ids,
+                    std::function<void(int)> on_progress,
+                    std::function<void(DeletionResult)> on_finished);
+
+  /// Cancels the deletion and waits for the thread to finish
+  ~DocDeletionThread();
+
+  /// Stop after the chunk being deleted
+  void cancel();
+
+private:
+  void run();
+
+  QString database_path_;
+  bool all_docs_;
+  QList<int> doc_ids_;
+  std::function<void(int)> on_progress_;
+  std::function<void(DeletionResult)> on_finished_;
+  std::atomic<bool> cancel_requested_{};
+  // last member so that everything else is initialized when the thread starts
+  std::thread thread_;
+};
+
+} // namespace labelbuddy
+
+#endif
@@ -38,6 +38,10 @@ DocListButtons::DocListButtons(QWidget* parent) : QFrame(parent) {
   filter_choice_ = new QComboBox();
   filters_layout->addWidget(filter_choice_);
   filters_layout->addStretch();
+  search_box_ = new QLineEdit();
+  search_box_->setPlaceholderText("Search documents");
+  search_box_->setClearButtonEnabled(true);
+  filters_layout->addWidget(search_box_);
 
   first_page_button = new QPushButton(
       QIcon::fromTheme("go-first", QIcon(":data/icons/go-first.png")), "");
@@ -84,9 +88,14 @@ void DocListButtons::add_connections() {
   QObject::connect(annotate_button, &QPushButton::clicked, this,
                    &DocListButtons::visit_doc);
 
+  QObject::connect(search_box_, &QLineEdit::returnPressed, this,
+                   &DocListButtons::search_documents);
+  QObject::connect(search_box_, &QLineEdit::textChanged, this,
+                   &DocListButtons::stop_search_if_empty);
+
   void (QComboBox::*combobox_activated)(int) = &QComboBox::activated;
   QObject::connect(filter_choice_, combobox_activated, this,
-                   &DocListButtons::update_filter);
+                   &DocListButtons::filter_choice_activated);
   // note above could be simplified: QOverload<int>::of(&QComboBox::activated)
   // but QOverload introduced in qt 5.7 and xenial comes with 5.5
 }
@@ -108,6 +117,10 @@ void DocListButtons::fill_filter_choice() {
       -1, static_cast<int>(DocListModel::DocFilter::unlabelled)));
   filter_choice_->addItem("Documents without labels", var);
   auto label_names = model->get_label_names();
+  label_names_.clear();
+  for (const auto& label_info : label_names) {
+    label_names_[label_info.second] = label_info.first;
+  }
   if (label_names.size()) {
     filter_choice_->insertSeparator(filter_choice_->count());
   }
@@ -137,6 +150,9 @@ void DocListButtons::fill_filter_choice() {
   case DocListModel::DocFilter::unlabelled:
     filter_choice_->setCurrentIndex(2);
     break;
+  case DocListModel::DocFilter::search:
+    filter_choice_->setCurrentIndex(0);
+    break;
   case DocListModel::DocFilter::has_given_label:
   case DocListModel::DocFilter::not_has_given_label:
     var.setValue(
@@ -153,13 +169,51 @@ void DocListButtons::fill_filter_choice() {
     filter_choice_->setCurrentIndex(0);
     break;
   }
+  update_filter_counts();
   update_filter();
 }
 
+void DocListButtons::update_filter_counts() {
+  if (model == nullptr || label_names_.isEmpty()) {
+    return;
+  }
+  auto counts = model->get_label_doc_counts();
+  auto total = model->total_n_docs(DocListModel::DocFilter::all);
+  for (int i = 0; i != filter_choice_->count(); ++i) {
+    auto data = filter_choice_->itemData(i);
+    if (!data.isValid()) {
+      // separator
+      continue;
+    }
+    auto filter_info = data.value<QPair<int, int>>();
+    auto filter = static_cast<DocListModel::DocFilter>(filter_info.second);
+    auto n_docs = counts.value(filter_info.first, 0);
+    auto name = label_names_.value(filter_info.first);
+    if (filter == DocListModel::DocFilter::has_given_label) {
+      filter_choice_->setItemText(i, QString("%0 (%1)").arg(name).arg(n_docs));
+    } else if (filter == DocListModel::DocFilter::not_has_given_label) {
+      filter_choice_->setItemText(
+          i, QString("NOT  %0 (%1)").arg(name).arg(total - n_docs));
+    }
+  }
+}
+
 void DocListButtons::after_database_change() {
   current_filter = DocListModel::DocFilter::all;
   current_label_id = -1;
+  search_text_.clear();
+  search_box_->clear();
   offset = 0;
+  update_search_box_state();
+}
+
+void DocListButtons::update_search_box_state() {
+  // told before a search is attempted rather than when it fails
+  auto supported = model == nullptr || model->is_search_supported();
+  search_box_->setEnabled(supported);
+  search_box_->setPlaceholderText(
+      supported ? "Search documents"
+                : "Search unavailable: the text is stored compressed");
 }
 
 void DocListButtons::go_to_next_page() {
@@ -168,7 +222,7 @@ void DocListButtons::go_to_next_page() {
     return;
   }
   int total = model->total_n_docs(current_filter, current_label_id);
-  if (offset + page_size >= total) {
+  if (page_size <= 0 || offset + page_size >= total) {
     return;
   }
   offset += page_size;
@@ -192,8 +246,12 @@ void DocListButtons::go_to_last_page() {
     assert(false);
     return;
   }
+  if (page_size <= 0) {
+    return;
+  }
   int total = model->total_n_docs(current_filter, current_label_id);
-  offset = total - total % page_size;
+  // if total is a multiple of page_size the last page is full
+  offset = std::max(0, total - 1) / page_size * page_size;
   emit doc_filter_changed(current_filter, current_label_id, page_size, offset);
 }
 
@@ -210,14 +268,14 @@ void DocListButtons::update_after_data_change() {
   int total = model->total_n_docs(current_filter, current_label_id);
   int prev_offset = offset;
   offset = std::max(0, std::min(total - 1, offset));
-  offset = offset - offset % page_size;
+  offset = page_size > 0 ? offset - offset % page_size : 0;
   if (prev_offset != offset) {
     emit doc_filter_changed(current_filter, current_label_id, page_size,
                             offset);
   }
   update_button_states();
   assert(offset >= 0);
-  assert(!(offset % page_size));
+  assert(page_size <= 0 || !(offset % page_size));
   assert(total == 0 || offset < total);
 }
 
@@ -228,7 +286,7 @@ void DocListButtons::update_button_states() {
   }
 
   int total = model->total_n_docs(current_filter, current_label_id);
-  int end = offset + model->rowCount();
+  int end = offset + model->n_page_rows();
   assert(total == 0 || offset < total);
   assert(end <= total);
 
@@ -269,9 +327,14 @@ void DocListButtons::update_top_row_buttons(int n_selected, int n_rows,
 void DocListButtons::update_filter() {
   auto prev_filter = current_filter;
   auto prev_label_id = current_label_id;
-  auto data = filter_choice_->currentData().value<QPair<int, int>>();
-  current_label_id = data.first;
-  current_filter = static_cast<DocListModel::DocFilter>(data.second);
+  if (!search_text_.isEmpty()) {
+    current_label_id = -1;
+    current_filter = DocListModel::DocFilter::search;
+  } else {
+    auto data = filter_choice_->currentData().value<QPair<int, int>>();
+    current_label_id = data.first;
+    current_filter = static_cast<DocListModel::DocFilter>(data.second);
+  }
   if ((current_label_id != prev_label_id) || (current_filter != prev_filter)) {
     offset = 0;
     emit doc_filter_changed(current_filter, current_label_id, page_size,
@@ -279,9 +342,72 @@ void DocListButtons::update_filter() {
   }
 }
 
+void DocListButtons::filter_choice_activated() {
+  search_text_.clear();
+  search_box_->clear();
+  update_filter();
+}
+
+void DocListButtons::search_documents() {
+  if (model == nullptr) {
+    assert(false);
+    return;
+  }
+  auto text = search_box_->text().simplified();
+  if (text.isEmpty()) {
+    search_text_.clear();
+    update_filter();
+    return;
+  }
+  bool available{};
+  {
+    // only shown if the index is built here and it takes a while
+    QProgressDialog progress("Building the search index...", QString(), 0, 0,
+                             this);
+    progress.setWindowModality(Qt::WindowModal);
+    available = model->set_search_text(text, &progress);
+  }
+  if (!available) {
+    warn_search_unavailable();
+  }
+  search_text_ = text;
+  current_filter = DocListModel::DocFilter::search;
+  current_label_id = -1;
+  offset = 0;
+  // the filter may be unchanged but the result set is a new one
+  emit doc_filter_changed(current_filter, current_label_id, page_size, offset);
+}
+
+void DocListButtons::warn_search_unavailable() {
+  if (model != nullptr && !model->is_search_supported()) {
+    QMessageBox::warning(this, "labelbuddy",
+                         "Full-text search is not available for this "
+                         "database because it stores its text compressed.",
+                         QMessageBox::Ok);
+    return;
+  }
+  QMessageBox::warning(this, "labelbuddy",
+                       "Could not create the search index. Full-text "
+                       "search requires SQLite with the FTS5 extension "
+                       "and a database that is not read-only.",
+                       QMessageBox::Ok);
+}
+
+void DocListButtons::stop_search_if_empty(const QString& text) {
+  if (text.isEmpty() && !search_text_.isEmpty()) {
+    search_documents();
+  }
+}
+
 void DocListButtons::setModel(DocListModel* new_model) {
   assert(new_model != nullptr);
   model = new_model;
+  page_size = model->default_page_size();
+  // a single page is scrolled through instead
+  for (auto button : {first_page_button, prev_page_button, next_page_button,
+                      last_page_button}) {
+    button->setVisible(page_size > 0);
+  }
   QObject::connect(this, &DocListButtons::doc_filter_changed, model,
                    &DocListModel::adjust_query);
   QObject::connect(model, &DocListModel::modelReset, this,
@@ -290,8 +416,17 @@ void DocListButtons::setModel(DocListModel* new_model) {
                    &DocListButtons::after_database_change);
   QObject::connect(model, &DocListModel::labels_changed, this,
                    &DocListButtons::fill_filter_choice);
+  QObject::connect(model, &DocListModel::label_doc_counts_changed, this,
+                   &DocListButtons::update_filter_counts);
+  QObject::connect(model, &DocListModel::docs_deleted, this,
+                   &DocListButtons::update_filter_counts);
+  QObject::connect(model, &DocListModel::counts_updated, this,
+                   &DocListButtons::update_filter_counts);
+  QObject::connect(model, &DocListModel::search_index_unavailable, this,
+                   &DocListButtons::warn_search_unavailable);
   fill_filter_choice();
   update_button_states();
+  update_search_box_state();
 }
 
 DocList::DocList(QWidget* parent) : QFrame(parent) {
@@ -305,6 +440,8 @@ DocList::DocList(QWidget* parent) : QFrame(parent) {
   doc_view = new QListView();
   layout->addWidget(doc_view);
   doc_view->setSelectionMode(QAbstractItemView::ExtendedSelection);
+  // rows are one line each: the view does not need to measure all of them
+  doc_view->setUniformItemSizes(true);
 
   QObject::connect(buttons_frame, &DocListButtons::select_all, doc_view,
                    &QListView::selectAll);
@@ -332,6 +469,10 @@ void DocList::setModel(DocListModel* new_model) {
                    &DocList::update_select_delete_buttons);
   QObject::connect(model, &DocListModel::modelReset, this,
                    &DocList::update_select_delete_buttons);
+  // after `set_database` has returned, when the model may have deferred
+  // reading the page
+  QObject::connect(model, &DocListModel::database_changed, this,
+                   &DocList::refresh_model_if_visible, Qt::QueuedConnection);
   update_select_delete_buttons();
 }
 
@@ -339,6 +480,12 @@ int DocList::n_selected_docs() const {
   return doc_view->selectionModel()->selectedIndexes().size();
 }
 
+void DocList::refresh_model_if_visible() {
+  if (model != nullptr && isVisible()) {
+    model->refresh_current_query_if_outdated();
+  }
+}
+
 void DocList::showEvent(QShowEvent* event) {
   if (model != nullptr) {
     model->refresh_current_query_if_outdated();
@@ -368,15 +515,10 @@ void DocList::delete_all_docs() {
   {
     QProgressDialog progress("Deleting documents...", "Stop", 0, 0, this);
     progress.setWindowModality(Qt::WindowModal);
-    progress.setMinimumDuration(2000);
     n_deleted = model->delete_all_docs(&progress);
   }
   doc_view->reset();
-  QMessageBox::information(this, "labelbuddy",
-                           QString("Deleted %0 document%1")
-                               .arg(n_deleted)
-                               .arg(n_deleted > 1 ? "s" : ""),
-                           QMessageBox::Ok);
+  report_deletion(n_deleted);
 }
 
 void DocList::delete_selected_rows() {
@@ -394,18 +536,31 @@ void DocList::delete_selected_rows() {
   if (resp != QMessageBox::Ok) {
     return;
   }
-  int n_before = model->total_n_docs(DocListModel::DocFilter::all);
-  model->delete_docs(selected);
-  int n_after = model->total_n_docs(DocListModel::DocFilter::all);
-  int n_deleted = n_before - n_after;
-  QMessageBox::information(this, "labelbuddy",
-                           QString("Deleted %0 document%1")
-                               .arg(n_deleted)
-                               .arg(n_deleted > 1 ? "s" : ""),
-                           QMessageBox::Ok);
+  int n_deleted{};
+  {
+    QProgressDialog progress("Deleting documents...", "Stop", 0, 0, this);
+    progress.setWindowModality(Qt::WindowModal);
+    n_deleted = model->delete_docs(selected, &progress);
+  }
+  report_deletion(n_deleted);
   doc_view->reset();
 }
 
+void DocList::report_deletion(int n_deleted) {
+  auto msg = QString("Deleted %0 document%1")
+                 .arg(n_deleted)
+                 .arg(n_deleted > 1 ? "s" : "");
+  auto error = model->deletion_error();
+  if (error != QString()) {
+    QMessageBox::warning(
+        this, "labelbuddy",
+        QString("%0, then the deletion stopped:\n%1").arg(msg).arg(error),
+        QMessageBox::Ok);
+    return;
+  }
+  QMessageBox::information(this, "labelbuddy", msg, QMessageBox::Ok);
+}
+
 void DocList::visit_doc(const QModelIndex& index) {
   if (model == nullptr) {
     assert(false);
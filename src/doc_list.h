@@ -4,7 +4,9 @@
 #include <QComboBox>
 #include <QFrame>
 #include <QLabel>
+#include <QLineEdit>
 #include <QListView>
+#include <QMap>
 #include <QPushButton>
 #include <QShowEvent>
 #include <QSqlDatabase>
@@ -48,9 +50,15 @@ private slots:
   /// the items' `itemData` is a pair (label id, doc filter)
   void fill_filter_choice();
 
+  /// show the number of matching documents next to each label filter
+  void update_filter_counts();
+
   /// reset filter and offset when database changes
   void after_database_change();
 
+  /// disable the search box if the database's documents cannot be searched
+  void update_search_box_state();
+
   void update_button_states();
 
   /// adjust offset and button states when model data changes
@@ -65,10 +73,27 @@ private slots:
   void go_to_first_page();
 
   /// adjust doc filter when combobox selection changes
+
+  /// while a search is active the search filter is kept
   void update_filter();
 
+  /// leave search mode and apply the filter chosen in the combobox
+  void filter_choice_activated();
+
+  /// show documents matching the text in the search box, or stop searching
+  /// if it is empty
+  void search_documents();
+
+  /// tell the user that the search index could not be built
+  void warn_search_unavailable();
+
+  /// stop searching when the search box is cleared
+  void stop_search_if_empty(const QString& text);
+
 private:
   int offset = 0;
+  /// 0 if all the matching documents are in one page, see
+  /// `DocListModel::set_default_page_size`
   int page_size = 100;
   DocListModel::DocFilter current_filter = DocListModel::DocFilter::all;
   // label used to either include or exclude docs
@@ -87,6 +112,11 @@ private:
   QPushButton* last_page_button = nullptr;
 
   QComboBox* filter_choice_ = nullptr;
+  /// label names indexed by `id`, used to set the filter items' text
+  QMap<int, QString> label_names_{};
+  QLineEdit* search_box_ = nullptr;
+  /// text of the current search, empty if not searching
+  QString search_text_{};
 
   void add_connections();
 };
@@ -115,6 +145,8 @@ private slots:
   /// get the doc's id and emit `visit_doc_requested`
   void visit_doc(const QModelIndex& = QModelIndex());
   void update_select_delete_buttons();
+  /// if the list is visible, read the page if it is outdated or deferred
+  void refresh_model_if_visible();
 
 signals:
 
@@ -122,6 +154,10 @@ signals:
   void n_selected_docs_changed(int n_docs);
 
 private:
+  /// tell the user how many documents were deleted, and why the deletion
+  /// stopped if it failed
+  void report_deletion(int n_deleted);
+
   DocListButtons* buttons_frame;
   QListView* doc_view;
   DocListModel* model = nullptr;
@@ -1,14 +1,33 @@
+#include <algorithm>
 #include <cassert>
+#include <functional>
+#include <utility>
 
+#include <QEventLoop>
 #include <QSqlDatabase>
 #include <QSqlError>
 
+#include "database.h"
 #include "doc_list_model.h"
+#include "pending_writes.h"
+#include "tracing.h"
 #include "user_roles.h"
+#include "worker_connection.h"
 
 namespace labelbuddy {
 
-DocListModel::DocListModel(QObject* parent) : QSqlQueryModel(parent) {}
+DocListModel::DocListModel(QObject* parent) : QAbstractTableModel(parent) {
+  QObject::connect(this, &DocListModel::deletion_thread_progressed, this,
+                   &DocListModel::store_deletion_progress,
+                   Qt::QueuedConnection);
+  QObject::connect(this, &DocListModel::deletion_thread_finished, this,
+                   &DocListModel::finish_deletion, Qt::QueuedConnection);
+  QObject::connect(this, &DocListModel::counts_computed, this,
+                   &DocListModel::show_counts, Qt::QueuedConnection);
+}
+
+// the thread must be stopped before the members it uses are destroyed
+DocListModel::~DocListModel() { counts_thread_.reset(); }
 
 QSqlQuery DocListModel::get_query() const {
   return QSqlQuery(QSqlDatabase::database(database_name));
@@ -16,29 +35,113 @@ QSqlQuery DocListModel::get_query() const {
 
 void DocListModel::set_database(const QString& new_database_name) {
   assert(QSqlDatabase::contains(new_database_name));
+  if (is_deleting_) {
+    // wait for the current chunk, then report what was deleted
+    deletion_thread_.reset();
+    finish_deletion(deletion_id_, n_deleted_, deletion_error_);
+  }
   database_name = new_database_name;
   doc_filter = DocFilter::all;
   filter_label_id_ = -1;
-  limit = 100;
+  search_query_ = QString();
+  n_search_results_ = 0;
+  limit = default_page_size_;
   offset = 0;
+  page_first_id_ = -1;
+  page_last_id_ = -1;
   emit database_changed();
-  refresh_current_query();
+  if (start_counting()) {
+    // nothing from the previous database is shown until the counts arrive
+    n_docs_ = 0;
+    n_labelled_docs_ = 0;
+    page_pending_ = !deferred_loading_;
+    beginResetModel();
+    rows_.clear();
+    n_page_rows_ = 0;
+    result_set_outdated_ = deferred_loading_;
+    endResetModel();
+  } else if (deferred_loading_) {
+    // counted when the list is first shown
+    n_docs_ = -1;
+    n_labelled_docs_ = -1;
+    beginResetModel();
+    rows_.clear();
+    n_page_rows_ = 0;
+    result_set_outdated_ = true;
+    endResetModel();
+  } else {
+    refresh_current_query();
+  }
   emit labels_changed();
 }
 
 QVariant DocListModel::data(const QModelIndex& index, int role) const {
+  if (!index.isValid() || index.row() >= rows_.size()) {
+    return QVariant{};
+  }
+  const auto& row = rows_[index.row()];
   if (role == Roles::RowIdRole) {
     if (index.column() != 0) {
       assert(false);
       return QVariant{};
     }
-    return QSqlQueryModel::data(index.sibling(index.row(), 1), Qt::DisplayRole);
+    return row.id;
+  }
+  if (role != Qt::DisplayRole && role != Qt::EditRole) {
+    return QVariant{};
+  }
+  if (index.column() == 0) {
+    return row.head;
+  }
+  return row.id;
+}
+
+int DocListModel::rowCount(const QModelIndex& parent) const {
+  return parent.isValid() ? 0 : rows_.size();
+}
+
+int DocListModel::columnCount(const QModelIndex& parent) const {
+  return parent.isValid() ? 0 : 2;
+}
+
+bool DocListModel::canFetchMore(const QModelIndex& parent) const {
+  return !parent.isValid() && rows_.size() < n_page_rows_;
+}
+
+void DocListModel::fetchMore(const QModelIndex& parent) {
+  if (!canFetchMore(parent)) {
+    return;
+  }
+  TraceScope trace("DocListModel::fetchMore");
+  auto new_rows = read_next_rows();
+  if (new_rows.isEmpty()) {
+    // documents were deleted since the page was computed
+    n_page_rows_ = rows_.size();
+    return;
   }
-  return QSqlQueryModel::data(index, role);
+  beginInsertRows(QModelIndex(), rows_.size(),
+                  rows_.size() + new_rows.size() - 1);
+  rows_ << new_rows;
+  endInsertRows();
+}
+
+int DocListModel::n_page_rows() const { return n_page_rows_; }
+
+QList<int> DocListModel::current_doc_ids() const {
+  auto query = get_query();
+  query.setForwardOnly(true);
+  query.prepare(filtered_query_text("id", "1", "order by id") + ";");
+  bind_filter_values(query);
+  traced_exec(query);
+  QList<int> doc_ids{};
+  while (query.next()) {
+    doc_ids << query.value(0).toInt();
+  }
+  return doc_ids;
 }
 
 Qt::ItemFlags DocListModel::flags(const QModelIndex& index) const {
-  auto default_flags = QSqlQueryModel::flags(index);
+  auto default_flags = QAbstractTableModel::flags(index);
   if (index.column() == 0) {
     return default_flags;
   }
@@ -47,7 +150,7 @@ Qt::ItemFlags DocListModel::flags(const QModelIndex& index) const {
 
 QList<QPair<QString, int>> DocListModel::get_label_names() const {
   auto query = get_query();
-  query.exec("select name, id from sorted_label;");
+  traced_exec(query, "select name, id from sorted_label;");
   QList<QPair<QString, int>> result{};
   while (query.next()) {
     result << QPair<QString, int>{query.value(0).toString(),
@@ -58,166 +161,499 @@ QList<QPair<QString, int>> DocListModel::get_label_names() const {
 
 void DocListModel::adjust_query(DocFilter new_doc_filter, int filter_label_id,
                                 int new_limit, int new_offset) {
+  TraceScope trace("DocListModel::adjust_query");
+  if (counts_thread_ != nullptr) {
+    // the page is read once the counts are known, see `show_counts`
+    doc_filter = new_doc_filter;
+    filter_label_id_ = filter_label_id;
+    limit = new_limit;
+    offset = new_offset;
+    page_first_id_ = -1;
+    page_last_id_ = -1;
+    page_pending_ = true;
+    return;
+  }
+  bool can_seek = !result_set_outdated_ && page_first_id_ != -1 &&
+                  new_limit > 0 && new_doc_filter == doc_filter &&
+                  filter_label_id == filter_label_id_ && new_limit == limit;
+
+  // locate the requested page without scanning the rows before it when
+  // possible; rows are selected in `order` then sorted by id
+  QString seek{"1"};
+  QString order{"asc"};
+  int bound_id{-1};
+  int sql_limit{new_limit > 0 ? new_limit : -1};
+  int sql_offset{};
+  if (new_offset == 0) {
+    // first page: there is nothing to skip
+  } else if (can_seek && new_offset == offset + limit) {
+    seek = "id > :boundid";
+    bound_id = page_last_id_;
+  } else if (can_seek && new_offset == offset - limit) {
+    seek = "id < :boundid";
+    bound_id = page_first_id_;
+    order = "desc";
+  } else {
+    auto n_after = total_n_docs(new_doc_filter, filter_label_id) - new_offset;
+    // the last page (eg `DocListButtons::go_to_last_page`) is read from the
+    // end without skipping any rows
+    if (new_limit > 0 && n_after <= new_offset) {
+      order = "desc";
+      sql_limit = std::max(0, std::min(new_limit, n_after));
+      sql_offset = std::max(0, n_after - new_limit);
+    } else {
+      sql_offset = new_offset;
+    }
+  }
+
   limit = new_limit;
   offset = new_offset;
   doc_filter = new_doc_filter;
   filter_label_id_ = filter_label_id;
   result_set_outdated_ = false;
 
+  // only the ids are read here, so the documents' content is not loaded for
+  // the rows that are skipped
   auto query = get_query();
-  switch (new_doc_filter) {
+  query.prepare(
+      QString("select count(*), min(id), max(id) from (%0);")
+          .arg(filtered_query_text(
+              "id", seek,
+              QString("order by id %0 limit :lim offset :off").arg(order))));
+  bind_filter_values(query);
+  if (bound_id != -1) {
+    query.bindValue(":boundid", bound_id);
+  }
+  query.bindValue(":lim", sql_limit);
+  query.bindValue(":off", sql_offset);
+  traced_exec(query);
+  assert(query.isActive());
+
+  beginResetModel();
+  rows_.clear();
+  n_page_rows_ = query.next() ? query.value(0).toInt() : 0;
+  page_first_id_ = n_page_rows_ ? query.value(1).toInt() : -1;
+  page_last_id_ = n_page_rows_ ? query.value(2).toInt() : -1;
+  query.finish();
+  rows_ = read_next_rows();
+  endResetModel();
+}
+
+QString DocListModel::filtered_query_text(const QString& columns,
+                                         const QString& seek,
+                                         const QString& suffix) const {
+  QString table{"document"};
+  QString condition{"1"};
+  switch (doc_filter) {
   case DocFilter::all:
-    query.prepare("select replace(substr(coalesce(long_title, content), "
-                  "1, 160), char(10), ' ') as head, id "
-                  "from document order by id limit :lim offset :off;");
     break;
   case DocFilter::labelled:
-    query.prepare("select replace(substr(coalesce(long_title, content), "
-                  "1, 160), char(10), ' ') as head, id "
-                  "from labelled_document order by id limit :lim offset :off;");
+    table = "labelled_document";
     break;
   case DocFilter::unlabelled:
-    query.prepare(
-        "select replace(substr(coalesce(long_title, content), 1, 160), "
-        "char(10), ' ') as head, id "
-        "from unlabelled_document order by id limit :lim offset :off;");
+    table = "unlabelled_document";
     break;
   case DocFilter::has_given_label:
-    query.prepare(
-        "select replace(substr(coalesce(long_title, content), 1, 160), "
-        "char(10), ' ') as head, id "
-        "from document where id in (select distinct doc_id from annotation "
-        "where label_id = :labelid) order by id limit :lim offset :off;");
-    query.bindValue(":labelid", filter_label_id);
+    condition = "id in (select doc_id from document_label_count "
+                "where label_id = :labelid)";
     break;
   case DocFilter::not_has_given_label:
-    query.prepare(
-        "select replace(substr(coalesce(long_title, content), 1, 160), "
-        "char(10), ' ') as head, id "
-        "from document where id not in (select distinct doc_id from annotation "
-        "where label_id = :labelid) order by id limit :lim offset :off;");
-    query.bindValue(":labelid", filter_label_id);
+    condition = "id not in (select doc_id from document_label_count "
+                "where label_id = :labelid)";
+    break;
+  case DocFilter::search:
+    condition = search_query_.isEmpty()
+                    ? "0"
+                    : "id in (select rowid from document_fts "
+                      "where document_fts match :search)";
     break;
   }
+  return QString("select %0 from %1 as filtered where (%2) and (%3) %4")
+      .arg(columns, table, condition, seek, suffix);
+}
 
-  query.bindValue(":lim", new_limit);
-  query.bindValue(":off", new_offset);
-  query.exec();
-  assert(query.isActive());
-  setQuery(query);
+void DocListModel::bind_filter_values(QSqlQuery& query) const {
+  if (doc_filter == DocFilter::has_given_label ||
+      doc_filter == DocFilter::not_has_given_label) {
+    query.bindValue(":labelid", filter_label_id_);
+  }
+  if (doc_filter == DocFilter::search && !search_query_.isEmpty()) {
+    query.bindValue(":search", search_query_);
+  }
+}
+
+QVector<DocListModel::Row> DocListModel::read_next_rows() const {
+  QVector<Row> rows{};
+  auto n_rows = n_page_rows_ - rows_.size();
+  if (n_rows > fetch_block_size_) {
+    n_rows = fetch_block_size_;
+  }
+  if (n_rows <= 0 || page_first_id_ == -1) {
+    return rows;
+  }
+  auto query = get_query();
+  // the page's rows all have ids in [page_first_id_, page_last_id_]. The
+  // preview is computed only for documents inserted without one, eg by other
+  // programs.
+  query.prepare(
+      filtered_query_text("coalesce(preview, (select replace(substr(coalesce("
+                          "c.long_title, c.content), 1, 160), char(10), ' ') "
+                          "from document_with_content as c "
+                          "where c.id = filtered.id)), id",
+                          "id >= :start and id <= :end",
+                          "order by id limit :n") +
+      ";");
+  bind_filter_values(query);
+  query.bindValue(":start",
+                  rows_.isEmpty() ? page_first_id_ : rows_.last().id + 1);
+  query.bindValue(":end", page_last_id_);
+  query.bindValue(":n", n_rows);
+  traced_exec(query);
+  rows.reserve(n_rows);
+  while (query.next()) {
+    rows << Row{query.value(1).toInt(), query.value(0).toString()};
+  }
+  return rows;
 }
 
 int DocListModel::total_n_docs(DocFilter doc_filter, int filter_label_id) {
   auto query = get_query();
   switch (doc_filter) {
   case DocFilter::labelled:
-    return n_labelled_docs_;
+    return n_labelled_docs();
   case DocFilter::unlabelled:
-    return total_n_docs_no_filter() - n_labelled_docs_;
+    return total_n_docs_no_filter() - n_labelled_docs();
   case DocFilter::has_given_label:
-    query.prepare("select count (*) from (select distinct doc_id from "
-                  "annotation where label_id = :labelid)");
-    query.bindValue(":labelid", filter_label_id);
-    query.exec();
-    query.next();
-    return query.value(0).toInt();
+    return n_docs_with_label(filter_label_id);
   case DocFilter::not_has_given_label:
-    query.prepare("select count (*) from (select distinct doc_id from "
-                  "annotation where label_id = :labelid)");
-    query.bindValue(":labelid", filter_label_id);
-    query.exec();
-    query.next();
-    return total_n_docs_no_filter() - query.value(0).toInt();
+    return total_n_docs_no_filter() - n_docs_with_label(filter_label_id);
+  case DocFilter::search:
+    return n_search_results_;
   default:
     return total_n_docs_no_filter();
   }
 }
 
-int DocListModel::total_n_docs_no_filter() {
+int DocListModel::n_docs_with_label(int label_id) const {
   auto query = get_query();
-  query.exec("select count(*) from document;");
-  query.next();
+  query.prepare("select n_docs from label_document_count "
+                "where label_id = :labelid;");
+  query.bindValue(":labelid", label_id);
+  traced_exec(query);
+  if (!query.next()) {
+    return 0;
+  }
   return query.value(0).toInt();
 }
 
-void DocListModel::refresh_n_labelled_docs() {
+bool DocListModel::set_search_text(const QString& text,
+                                   QProgressDialog* progress) {
+  search_query_ = search_text_to_fts_query(text);
+  // a new search is a different result set: do not seek from the current page
+  page_first_id_ = -1;
+  page_last_id_ = -1;
+  if (start_counting()) {
+    // the index is built by the counting thread
+    return true;
+  }
+  // the index is built in a transaction of this connection
+  flush_pending_writes(database_name);
+  auto query = get_query();
+  std::function<void(int)> on_progress{};
+  if (progress != nullptr && !search_query_.isEmpty()) {
+    progress->setMaximum(total_n_docs_no_filter() + 1);
+    on_progress = [progress](int n_indexed) { progress->setValue(n_indexed); };
+  }
+  auto available = create_search_index(query, on_progress);
+  if (progress != nullptr) {
+    progress->setValue(progress->maximum());
+  }
+  if (!available) {
+    search_query_ = QString();
+  }
+  refresh_n_search_results();
+  return available;
+}
+
+bool DocListModel::is_search_supported() const {
+  auto query = get_query();
+  return labelbuddy::is_search_supported(query);
+}
+
+void DocListModel::refresh_n_search_results() {
+  if (search_query_.isEmpty()) {
+    n_search_results_ = 0;
+    return;
+  }
   auto query = get_query();
-  query.exec("select count (*) from "
-             "(select distinct doc_id from annotation);");
+  query.prepare("select count(*) from document_fts "
+                "where document_fts match :search;");
+  query.bindValue(":search", search_query_);
+  traced_exec(query);
   query.next();
-  n_labelled_docs_ = query.value(0).toInt();
+  n_search_results_ = query.value(0).toInt();
 }
 
-int DocListModel::delete_docs(const QModelIndexList& indices) {
+QMap<int, int> DocListModel::get_label_doc_counts() const {
   auto query = get_query();
-  query.exec("begin transaction;");
-  query.prepare("delete from document where id = ?");
-  QVariantList ids;
+  traced_exec(query, "select label_id, n_docs from label_document_count;");
+  QMap<int, int> counts{};
+  while (query.next()) {
+    counts[query.value(0).toInt()] = query.value(1).toInt();
+  }
+  return counts;
+}
+
+int DocListModel::total_n_docs_no_filter() {
+  if (asynchronous_counts_ && worker_database_path(database_name) != "") {
+    // counted by `start_counting`
+    return n_docs_;
+  }
+  // only the documents added by an import or removed by a deletion change
+  // it, and both refresh the query
+  if (n_docs_ == -1) {
+    auto query = get_query();
+    traced_exec(query, "select count(*) from document;");
+    query.next();
+    n_docs_ = query.value(0).toInt();
+  }
+  return n_docs_;
+}
+
+int DocListModel::n_labelled_docs() {
+  if (n_labelled_docs_ == -1) {
+    auto query = get_query();
+    traced_exec(query, "select count(*) from document_annotation_count;");
+    query.next();
+    n_labelled_docs_ = query.value(0).toInt();
+  }
+  return n_labelled_docs_;
+}
+
+int DocListModel::delete_docs(const QModelIndexList& indices,
+                              QProgressDialog* progress) {
+  QList<int> ids{};
   QVariant rowid;
   for (const QModelIndex& index : indices) {
     rowid = data(index, Roles::RowIdRole);
     if (rowid != QVariant()) {
-      ids << rowid;
+      ids << rowid.toInt();
     } else {
       assert(false);
     }
   }
-  query.addBindValue(ids);
-  query.execBatch();
-  query.exec("commit transaction;");
-  refresh_current_query();
-  emit docs_deleted();
-  return query.numRowsAffected();
+  if (progress != nullptr) {
+    progress->setMaximum(ids.size() + 1);
+  }
+  start_deleting_docs(ids);
+  return wait_for_deletion(progress);
 }
 
 int DocListModel::delete_all_docs(QProgressDialog* progress) {
-  auto query = get_query();
-  int n_deleted{};
-  auto total = total_n_docs(DocListModel::DocFilter::all) + 1;
   if (progress != nullptr) {
-    progress->setMaximum(total);
+    progress->setMaximum(total_n_docs(DocListModel::DocFilter::all) + 1);
   }
-  bool cancelled{};
-  query.exec("begin transaction;");
-  query.exec("delete from annotation;");
-  do {
+  start_deleting_all_docs();
+  return wait_for_deletion(progress);
+}
+
+int DocListModel::wait_for_deletion(QProgressDialog* progress) {
+  if (is_deleting_) {
+    QEventLoop loop{};
+    QObject::connect(this, &DocListModel::deletion_finished, &loop,
+                     &QEventLoop::quit);
+    QMetaObject::Connection progress_connection{};
+    QMetaObject::Connection cancel_connection{};
     if (progress != nullptr) {
-      progress->setValue(n_deleted);
-      if (progress->wasCanceled()) {
-        cancelled = true;
-        break;
-      }
+      progress_connection =
+          QObject::connect(this, &DocListModel::deletion_progress, progress,
+                           &QProgressDialog::setValue);
+      cancel_connection =
+          QObject::connect(progress, &QProgressDialog::canceled, this,
+                           &DocListModel::cancel_deletion);
+      // shown before the loop rather than after its minimum duration: when
+      // it is modal the window gets no input meanwhile
+      progress->show();
     }
-    query.exec("delete from document limit 1000;");
-    n_deleted += query.numRowsAffected();
-    if (query.lastError().type() == QSqlError::StatementError) {
-      // sqlite not compiled with SQLITE_ENABLE_UPDATE_DELETE_LIMIT
-      // delete all in one go
-      cancelled = !query.exec("delete from document;");
-      n_deleted = query.numRowsAffected();
-      break;
+    loop.exec();
+    QObject::disconnect(progress_connection);
+    QObject::disconnect(cancel_connection);
+  }
+  if (progress != nullptr) {
+    progress->setValue(progress->maximum());
+  }
+  return n_deleted_;
+}
+
+void DocListModel::start_deleting_docs(const QList<int>& doc_ids) {
+  start_deletion(false, doc_ids);
+}
+
+void DocListModel::start_deleting_all_docs() { start_deletion(true, {}); }
+
+bool DocListModel::is_deleting() const { return is_deleting_; }
+
+void DocListModel::set_deferred_loading(bool deferred) {
+  deferred_loading_ = deferred;
+}
+
+void DocListModel::set_default_page_size(int page_size) {
+  default_page_size_ = page_size;
+}
+
+int DocListModel::default_page_size() const { return default_page_size_; }
+
+void DocListModel::set_asynchronous_counts(bool asynchronous) {
+  asynchronous_counts_ = asynchronous;
+}
+
+bool DocListModel::is_counting() const { return counts_thread_ != nullptr; }
+
+bool DocListModel::start_counting() {
+  ++counts_generation_;
+  changed_during_counting_ = false;
+  // results of the previous counting are ignored
+  counts_thread_.reset();
+  if (!asynchronous_counts_) {
+    return false;
+  }
+  auto database_path = worker_database_path(database_name);
+  if (database_path == "") {
+    return false;
+  }
+  auto read_only = QSqlDatabase::database(database_name, false)
+                       .connectOptions()
+                       .contains("QSQLITE_OPEN_READONLY");
+  if (!search_query_.isEmpty() && !read_only) {
+    // the counting thread may build the search index, which needs to write
+    flush_pending_writes(database_name);
+  }
+  auto generation = counts_generation_;
+  auto on_finished = [this, generation](bool ok, DocCounts counts) {
+    {
+      std::lock_guard<std::mutex> lock(counts_mutex_);
+      counts_result_generation_ = generation;
+      counts_result_ok_ = ok;
+      counts_result_ = std::move(counts);
     }
-    if (query.lastError().type() != QSqlError::NoError) {
-      cancelled = true;
-      break;
+    emit counts_computed(generation);
+  };
+  counts_thread_.reset(new DocCountsThread(database_path, read_only,
+                                           search_query_, on_finished));
+  return true;
+}
+
+void DocListModel::show_counts(int generation) {
+  if (generation != counts_generation_) {
+    return;
+  }
+  bool ok{};
+  DocCounts counts{};
+  {
+    std::lock_guard<std::mutex> lock(counts_mutex_);
+    if (counts_result_generation_ != generation) {
+      return;
     }
-  } while (query.numRowsAffected());
-  if (cancelled) {
-    n_deleted = 0;
-    query.exec("rollback transaction;");
+    ok = counts_result_ok_;
+    counts = counts_result_;
+    counts_result_generation_ = -1;
+  }
+  counts_thread_.reset();
+  if (ok) {
+    n_docs_ = counts.n_docs;
+    n_labelled_docs_ = counts.n_labelled_docs;
+    n_search_results_ = counts.n_search_results;
+  }
+  if (!counts.search_available) {
+    search_query_ = QString();
+  }
+  if (changed_during_counting_) {
+    // the counts may have missed these changes
+    start_counting();
   } else {
-    query.exec("commit transaction;");
+    if (page_pending_) {
+      page_pending_ = false;
+      adjust_query(doc_filter, filter_label_id_, limit, offset);
+    }
+    emit counts_updated();
   }
-  if (progress != nullptr) {
-    progress->setValue(total);
+  if (!counts.search_available) {
+    // last, as the warning shown for it can run a local event loop
+    emit search_index_unavailable();
   }
+}
+
+void DocListModel::start_deletion(bool all_docs, const QList<int>& doc_ids) {
+  if (is_deleting_) {
+    return;
+  }
+  is_deleting_ = true;
+  n_deleted_ = 0;
+  deletion_error_ = QString();
+  auto deletion_id = ++deletion_id_;
+  // the deletion's transactions need the write lock, or are on this
+  // connection for in-memory databases
+  flush_pending_writes(database_name);
+  auto database_path = worker_database_path(database_name);
+  if (database_path == "") {
+    auto query = get_query();
+    auto result = delete_docs_in_chunks(
+        query, all_docs, doc_ids, 1000,
+        [this, deletion_id](int n) { store_deletion_progress(deletion_id, n); },
+        nullptr);
+    finish_deletion(deletion_id, result.n_deleted, result.error_message);
+    return;
+  }
+  // the thread's callbacks are queued to this object's thread
+  deletion_thread_.reset(new DocDeletionThread(
+      database_path, all_docs, doc_ids,
+      [this, deletion_id](int n) {
+        emit deletion_thread_progressed(deletion_id, n);
+      },
+      [this, deletion_id](DeletionResult result) {
+        emit deletion_thread_finished(deletion_id, result.n_deleted,
+                                      result.error_message);
+      }));
+}
+
+QString DocListModel::deletion_error() const { return deletion_error_; }
+
+void DocListModel::cancel_deletion() {
+  if (deletion_thread_ != nullptr) {
+    deletion_thread_->cancel();
+  }
+}
+
+void DocListModel::store_deletion_progress(int deletion_id, int n_deleted) {
+  if (deletion_id != deletion_id_ || !is_deleting_) {
+    return;
+  }
+  n_deleted_ = n_deleted;
+  emit deletion_progress(n_deleted);
+}
+
+void DocListModel::finish_deletion(int deletion_id, int n_deleted,
+                                   const QString& error_message) {
+  if (deletion_id != deletion_id_ || !is_deleting_) {
+    return;
+  }
+  deletion_thread_.reset();
+  is_deleting_ = false;
+  n_deleted_ = n_deleted;
+  deletion_error_ = error_message;
   refresh_current_query();
   emit docs_deleted();
-  return n_deleted;
+  emit deletion_finished(n_deleted);
 }
 
 void DocListModel::refresh_current_query() {
-  refresh_n_labelled_docs();
+  if (start_counting()) {
+    page_pending_ = true;
+    return;
+  }
+  n_docs_ = -1;
+  n_labelled_docs_ = -1;
+  refresh_n_search_results();
   adjust_query(doc_filter, filter_label_id_, limit, offset);
 }
 
@@ -225,6 +661,13 @@ void DocListModel::document_status_changed(DocumentStatus new_status) {
   if (doc_filter != DocFilter::all) {
     result_set_outdated_ = true;
   }
+  if (counts_thread_ != nullptr) {
+    changed_during_counting_ = true;
+  }
+  if (n_labelled_docs_ == -1) {
+    // not counted yet: the count will include this change
+    return;
+  }
   if (new_status == DocumentStatus::Labelled) {
     ++n_labelled_docs_;
   } else {
@@ -239,6 +682,7 @@ void DocListModel::document_gained_label(int label_id, int doc_id) {
       filter_label_id_ == label_id) {
     result_set_outdated_ = true;
   }
+  emit label_doc_counts_changed();
 }
 
 void DocListModel::document_lost_label(int label_id, int doc_id) {
@@ -248,6 +692,7 @@ void DocListModel::document_lost_label(int label_id, int doc_id) {
       filter_label_id_ == label_id) {
     result_set_outdated_ = true;
   }
+  emit label_doc_counts_changed();
 }
 
 void DocListModel::refresh_current_query_if_outdated() {
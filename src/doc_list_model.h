@@ -1,12 +1,20 @@
 #ifndef LABELBUDDY_DOC_LIST_MODEL_H
 #define LABELBUDDY_DOC_LIST_MODEL_H
 
+#include <memory>
+#include <mutex>
+
+#include <QAbstractTableModel>
+#include <QList>
+#include <QMap>
 #include <QPair>
 #include <QProgressDialog>
 #include <QSqlQuery>
-#include <QSqlQueryModel>
+#include <QVector>
 #include <QWidget>
 
+#include "doc_counts.h"
+#include "doc_deletion.h"
 #include "user_roles.h"
 
 /// \file
@@ -15,19 +23,32 @@
 namespace labelbuddy {
 
 /// Interface providing information about documents in the database.
-class DocListModel : public QSqlQueryModel {
+
+/// The model shows one page of the documents matching the current filter,
+/// in 2 columns: the beginning of the document (or its long title) and its
+/// `id`. The rows of a page are read from the database in blocks, when the
+/// view asks for them with `fetchMore` (eg when it is scrolled to the end of
+/// the rows fetched so far), so a page can be large -- `adjust_query` with a
+/// `limit` of 0 shows all the matching documents.
+///
+/// With `set_asynchronous_counts`, the documents are counted (and the search
+/// index is built) in a background thread; the page is read once the counts
+/// are known, so that they always agree with it.
+class DocListModel : public QAbstractTableModel {
 
   Q_OBJECT
 
 public:
   DocListModel(QObject* parent = nullptr);
+  ~DocListModel() override;
 
   enum class DocFilter {
     all,
     labelled,
     unlabelled,
     has_given_label,
-    not_has_given_label
+    not_has_given_label,
+    search
   };
 
   /// Number of documents in the database matching the filter params
@@ -37,24 +58,137 @@ public:
   /// data for a document. `Roles::RowIdRole` can be used to get the doc's `id`
   QVariant data(const QModelIndex& index, int role) const override;
 
+  /// Number of rows fetched so far in the current page
+  int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+
+  int columnCount(const QModelIndex& parent = QModelIndex()) const override;
+
+  /// Whether some rows of the current page have not been fetched yet
+  bool canFetchMore(const QModelIndex& parent) const override;
+
+  /// Read the next block of rows in the current page
+  void fetchMore(const QModelIndex& parent) override;
+
+  /// Number of rows in the current page, including those not fetched yet
+  int n_page_rows() const;
+
+  /// `id`s of all the documents matching the current filter, sorted
+
+  /// Not limited to the current page, eg to annotate the matches of a pattern
+  /// in these documents (see `BatchLabelingThread`).
+  QList<int> current_doc_ids() const;
+
   /// Items in the second (hidden) column that contains id cannot be selected.
   Qt::ItemFlags flags(const QModelIndex& index) const override;
 
   /// label names in the database sorted by id, used to filter docs
   QList<QPair<QString, int>> get_label_names() const;
 
+  /// Number of documents containing each label, indexed by label `id`.
+
+  /// Labels that are not used in any document are absent from the map. The
+  /// counts are read from the `label_document_count` table, which is kept up
+  /// to date by triggers, so this does not scan the annotations.
+  QMap<int, int> get_label_doc_counts() const;
+
+  /// Set the text of the `search` filter.
+
+  /// Documents match if their content, long title or user-provided id
+  /// contain all the words in `text` (see `search_text_to_fts_query`). The
+  /// full-text index is built when it is first needed. Returns `false` if it
+  /// could not be built, in which case no documents match. With asynchronous
+  /// counts the matches are counted in the background and this returns
+  /// `true`; `search_index_unavailable` is emitted if the index could not be
+  /// built. Otherwise the index is built on this thread and its progress is
+  /// shown by `progress`, if provided.
+  bool set_search_text(const QString& text,
+                       QProgressDialog* progress = nullptr);
+
+  /// False if the current database's layout cannot have a full-text index
+
+  /// (see `labelbuddy::is_search_supported`)
+  bool is_search_supported() const;
+
   /// Delete specified docs, reset query and emit `docs_deleted`
-  int delete_docs(const QModelIndexList& indices);
+
+  /// Starts the deletion with `start_deleting_docs` and waits for it in a
+  /// local event loop, so the window is still repainted. If `progress` is
+  /// not `nullptr` it is shown before the loop starts, displays the number of
+  /// deleted documents and its cancel button stops the deletion; documents
+  /// deleted before are not restored. It should be modal, so that the user
+  /// cannot use the window while the documents are being deleted.
+  /// Returns the number of deleted documents.
+  int delete_docs(const QModelIndexList& indices,
+                  QProgressDialog* progress = nullptr);
 
   /// Delete all docs, reset query and emit `docs_deleted`
+
+  /// As `delete_docs`, with `start_deleting_all_docs`.
   int delete_all_docs(QProgressDialog* progress = nullptr);
 
+  /// Start deleting documents in chunked transactions.
+
+  /// For databases stored in a file this happens in a background thread with
+  /// its own connection; `deletion_progress` is emitted after each chunk.
+  /// In-memory databases cannot be shared with another connection so their
+  /// documents are deleted right away. When the deletion is done the query
+  /// is reset, and `docs_deleted` then `deletion_finished` are emitted, once.
+  /// Does nothing if a deletion is already in progress.
+  void start_deleting_docs(const QList<int>& doc_ids);
+
+  /// As `start_deleting_docs`, for all documents
+  void start_deleting_all_docs();
+
+  /// Why the last deletion stopped before deleting all the documents.
+
+  /// Empty if it did not or if it was cancelled. The documents deleted before
+  /// it stopped are counted by `deletion_finished`.
+  QString deletion_error() const;
+
+  bool is_deleting() const;
+
+  /// Do not read the first page when the database changes, only the counts.
+
+  /// The page is then read by `refresh_current_query_if_outdated`, ie when
+  /// the list is shown, so opening a database does not wait for a view that
+  /// is not visible.
+  void set_deferred_loading(bool deferred);
+
+  /// Number of documents in a page after the database changes.
+
+  /// 0 or less means one page holding all the matching documents, whose rows
+  /// are fetched as the view is scrolled; the Dataset tab then has no page
+  /// navigation. The default is 100, so that `setModel` of a `DocList` should
+  /// be called after this.
+  void set_default_page_size(int page_size);
+  int default_page_size() const;
+
+  /// Count the documents in a background thread.
+
+  /// Counting all the documents, or the matches of a search, takes a while
+  /// for large databases. Until the counts arrive the previous ones (and the
+  /// previous page) are shown, and `adjust_query` only records the requested
+  /// page; `counts_updated` is emitted when they are known. In-memory
+  /// databases are still counted right away.
+  void set_asynchronous_counts(bool asynchronous);
+
+  /// Whether the documents are being counted in the background
+  bool is_counting() const;
+
 public slots:
 
   /// Change database
   void set_database(const QString& new_database_name);
 
   /// Set current query and reset model.
+
+  /// When moving to the next or previous page with the same filter, the page
+  /// is found from the first or last `id` of the current page (keyset
+  /// pagination) rather than by skipping `offset` rows. Other pages are
+  /// counted from the start or the end of the result set, whichever is closer.
+  /// Only the ids of the page's rows are read then; the first block of rows
+  /// is fetched and the others are fetched on demand. If `limit` is 0 or
+  /// less, the page contains all the documents after `offset`.
   void adjust_query(DocFilter doc_filter = DocFilter::all,
                     int filter_label_id = -1, int limit = 100, int offset = 0);
 
@@ -68,25 +202,119 @@ public slots:
   /// called before showing the view; filtered doc list updates are lazy
   void refresh_current_query_if_outdated();
 
+  /// Stop the deletion in progress after the current chunk
+  void cancel_deletion();
+
 signals:
 
   void docs_deleted();
   void labels_changed();
   void database_changed();
 
+  /// A document gained its first annotation with a label or lost its last one
+  void label_doc_counts_changed();
+
+  /// The counts computed in the background are available
+  void counts_updated();
+
+  /// The full-text index needed by the search could not be built
+  void search_index_unavailable();
+
+  /// Emitted from the counting thread; connected to `show_counts`
+  void counts_computed(int generation);
+
+  /// Number of documents deleted so far by the deletion in progress
+  void deletion_progress(int n_deleted);
+  void deletion_finished(int n_deleted);
+
+  /// Emitted from the deletion thread; connected to `store_deletion_progress`
+  /// and `finish_deletion` with queued connections.
+  void deletion_thread_progressed(int deletion_id, int n_deleted);
+  void deletion_thread_finished(int deletion_id, int n_deleted,
+                                QString error_message);
+
+private slots:
+  void store_deletion_progress(int deletion_id, int n_deleted);
+  void finish_deletion(int deletion_id, int n_deleted,
+                       const QString& error_message);
+  void show_counts(int generation);
+
 private:
+  struct Row {
+    int id;
+    QString head;
+  };
+
   QSqlQuery get_query() const;
-  void refresh_n_labelled_docs();
+
+  /// `select <columns> from <matching docs> as filtered where <seek> <suffix>`
+  QString filtered_query_text(const QString& columns, const QString& seek,
+                              const QString& suffix) const;
+
+  /// bind the current filter's parameters, if any, to a query prepared with
+  /// `filtered_query_text`
+  void bind_filter_values(QSqlQuery& query) const;
+
+  /// read the next block of rows of the current page, after those in `rows_`
+  QVector<Row> read_next_rows() const;
+  void start_deletion(bool all_docs, const QList<int>& doc_ids);
+  int wait_for_deletion(QProgressDialog* progress);
+  /// Number of documents with annotations, counted if it is not known.
+  int n_labelled_docs();
   int total_n_docs_no_filter();
+  int n_docs_with_label(int label_id) const;
+  void refresh_n_search_results();
+
+  /// Start counting the documents in the background.
+
+  /// Returns `false` (without starting anything) if the counts are not
+  /// asynchronous or the database cannot be opened by another connection.
+  bool start_counting();
 
   DocFilter doc_filter = DocFilter::all;
   int filter_label_id_ = -1;
   int offset = 0;
   int limit = 100;
+  int default_page_size_ = 100;
+  /// `id` of the first and last documents in the current page, -1 if empty
+  int page_first_id_ = -1;
+  int page_last_id_ = -1;
+  int n_page_rows_{};
+  QVector<Row> rows_{};
+  static const int fetch_block_size_{256};
   QString database_name;
   bool result_set_outdated_{};
+  bool deferred_loading_{};
+
+  /// -1 if it must be counted again, which is done when it is needed
+  int n_labelled_docs_{-1};
+  /// FTS5 query used by the `search` filter
+  QString search_query_{};
+  int n_search_results_{};
+
+  bool asynchronous_counts_{};
+  /// counted by the thread with asynchronous counts; otherwise -1 if it must
+  /// be counted again, which is done when it is needed
+  int n_docs_{-1};
+  std::unique_ptr<DocCountsThread> counts_thread_{nullptr};
+  /// identifies the latest counting; older results are discarded
+  int counts_generation_{};
+  /// documents gained or lost annotations while they were being counted
+  bool changed_during_counting_{};
+  /// the page must be read once the counts arrive
+  bool page_pending_{};
+  std::mutex counts_mutex_{};
+  int counts_result_generation_{-1};
+  bool counts_result_ok_{};
+  DocCounts counts_result_{};
 
-  int n_labelled_docs_{};
+  /// incremented for each deletion so that signals from a previous deletion
+  /// thread are ignored
+  int deletion_id_{};
+  bool is_deleting_{};
+  int n_deleted_{};
+  QString deletion_error_{};
+  std::unique_ptr<DocDeletionThread> deletion_thread_{nullptr};
 };
 } // namespace labelbuddy
 #endif // LABELBUDDY_DOC_LIST_MODEL_H
@@ -0,0 +1,88 @@
+#include <algorithm>
+
+#include <QVariant>
+
+#include "document_id_index.h"
+#include "tracing.h"
+
+namespace labelbuddy {
+
+void DocumentIdIndex::clear() {
+  ids_.clear();
+  loaded_ = false;
+  stale_ = false;
+}
+
+void DocumentIdIndex::mark_stale() { stale_ = true; }
+
+bool DocumentIdIndex::ensure_loaded(QSqlQuery& query) {
+  if (loaded_ && !stale_) {
+    return true;
+  }
+  return update(query);
+}
+
+bool DocumentIdIndex::update(QSqlQuery& query) {
+  TraceScope trace("DocumentIdIndex::update");
+  stale_ = false;
+  if (!loaded_) {
+    return reload(query);
+  }
+  // new documents are appended to the table
+  query.prepare("select id from document where id > :last order by id;");
+  query.bindValue(":last", ids_.isEmpty() ? -1 : ids_.last());
+  if (!traced_exec(query)) {
+    clear();
+    return false;
+  }
+  while (query.next()) {
+    ids_ << query.value(0).toInt();
+  }
+  query.finish();
+  if (!traced_exec(query, "select count(*) from document;") ||
+      !query.next()) {
+    clear();
+    return false;
+  }
+  auto n_docs = query.value(0).toInt();
+  query.finish();
+  if (n_docs == ids_.size()) {
+    return true;
+  }
+  // some documents were deleted (and their ids maybe reused)
+  return reload(query);
+}
+
+bool DocumentIdIndex::reload(QSqlQuery& query) {
+  clear();
+  if (!traced_exec(query, "select count(*) from document;") ||
+      !query.next()) {
+    return false;
+  }
+  ids_.reserve(query.value(0).toInt());
+  query.finish();
+  query.setForwardOnly(true);
+  auto success = traced_exec(query, "select id from document order by id;");
+  if (success) {
+    while (query.next()) {
+      ids_ << query.value(0).toInt();
+    }
+  }
+  query.finish();
+  query.setForwardOnly(false);
+  if (!success) {
+    ids_.clear();
+    return false;
+  }
+  loaded_ = true;
+  return true;
+}
+
+int DocumentIdIndex::position(int doc_id) const {
+  return static_cast<int>(std::lower_bound(ids_.cbegin(), ids_.cend(), doc_id) -
+                          ids_.cbegin());
+}
+
+int DocumentIdIndex::size() const { return ids_.size(); }
+
+} // namespace labelbuddy
@@ -0,0 +1,54 @@
+#ifndef LABELBUDDY_DOCUMENT_ID_INDEX_H
+#define LABELBUDDY_DOCUMENT_ID_INDEX_H
+
+#include <QSqlQuery>
+#include <QVector>
+
+/// \file
+/// In-memory index of document ids, giving the position of a document.
+
+namespace labelbuddy {
+
+/// Sorted ids of all the documents in a database.
+
+/// Counting the documents before the current one in the database takes time
+/// proportional to the number of documents; once the ids are loaded, finding
+/// a position is a binary search. The ids are read once, then `update` only
+/// reads the documents added since (which get ids greater than existing
+/// ones). Deletions are detected by comparing the number of documents, in
+/// which case all the ids are read again.
+class DocumentIdIndex {
+public:
+  /// Forget all ids: the next `update` reads them again
+  void clear();
+
+  /// Make the next `ensure_loaded` call `update`
+
+  /// To be called when documents may have been added or deleted.
+  void mark_stale();
+
+  /// Call `update` if the ids were never loaded or have been marked stale
+  bool ensure_loaded(QSqlQuery& query);
+
+  /// Synchronize the ids with the database.
+
+  /// Returns `false` if a query fails, in which case the index is empty.
+  bool update(QSqlQuery& query);
+
+  /// Number of documents with an id smaller than `doc_id`
+  int position(int doc_id) const;
+
+  /// Number of documents
+  int size() const;
+
+private:
+  bool reload(QSqlQuery& query);
+
+  QVector<int> ids_{};
+  bool loaded_{};
+  bool stale_{};
+};
+
+} // namespace labelbuddy
+
+#endif
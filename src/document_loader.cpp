@@ -0,0 +1,314 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include <QVariant>
+
+#include "database.h"
+#include "document_loader.h"
+#include "tracing.h"
+#include "worker_connection.h"
+
+namespace labelbuddy {
+
+namespace {
+
+/// number of surrogate pairs starting strictly before `idx`
+int n_surrogates_before(const QVector<int>& surrogate_indices, int idx) {
+  if (surrogate_indices.isEmpty()) {
+    return 0;
+  }
+  return static_cast<int>(std::lower_bound(surrogate_indices.cbegin(),
+                                           surrogate_indices.cend(), idx) -
+                          surrogate_indices.cbegin());
+}
+
+bool is_surrogate(ushort code_unit) { return (code_unit & 0xf800) == 0xd800; }
+
+/// whether any of the 4 utf-16 code units packed in `block` is a surrogate
+bool has_surrogate(std::uint64_t block) {
+  // a lane is 0 where the code unit is in [0xd800, 0xdfff]
+  auto lanes = (block & 0xf800f800f800f800ULL) ^ 0xd800d800d800d800ULL;
+  return ((lanes - 0x0001000100010001ULL) & ~lanes & 0x8000800080008000ULL) !=
+         0;
+}
+
+/// position of the first surrogate in [`pos`, `end`), or `end`
+int find_surrogate(const ushort* data, int pos, int end) {
+  while (end - pos >= 4) {
+    std::uint64_t block{};
+    std::memcpy(&block, data + pos, sizeof(block));
+    if (has_surrogate(block)) {
+      for (int i = 0; i != 4; ++i) {
+        if (is_surrogate(data[pos + i])) {
+          return pos + i;
+        }
+      }
+    }
+    pos += 4;
+  }
+  while (pos != end && !is_surrogate(data[pos])) {
+    ++pos;
+  }
+  return pos;
+}
+
+} // namespace
+
+int code_point_idx_to_utf16_idx(
+    const QVector<int>& surrogate_indices_in_unicode, int cp_idx) {
+  assert(cp_idx >= 0);
+  return cp_idx + n_surrogates_before(surrogate_indices_in_unicode, cp_idx);
+}
+
+int utf16_idx_to_code_point_idx(
+    const QVector<int>& surrogate_indices_in_qstring, int utf16_idx) {
+  assert(utf16_idx >= 0);
+  return utf16_idx -
+         n_surrogates_before(surrogate_indices_in_qstring, utf16_idx);
+}
+
+bool fill_surrogate_indices(LoadedDocument& doc,
+                            const std::function<bool()>& cancelled) {
+  doc.surrogate_indices_in_qstring.clear();
+  doc.surrogate_indices_in_unicode_string.clear();
+  const int check_interval{1 << 16};
+  const auto* data = doc.content.utf16();
+  const int size = doc.content.size();
+  // low surrogates are not counted as code points
+  int n_low_surrogates{};
+  for (int block_start = 0; block_start < size;
+       block_start += check_interval) {
+    if (cancelled && cancelled()) {
+      return false;
+    }
+    auto block_end = std::min(size, block_start + check_interval);
+    auto q_pos = find_surrogate(data, block_start, block_end);
+    while (q_pos != block_end) {
+      if (QChar::isHighSurrogate(data[q_pos])) {
+        doc.surrogate_indices_in_qstring << q_pos;
+        doc.surrogate_indices_in_unicode_string << q_pos - n_low_surrogates;
+      } else {
+        ++n_low_surrogates;
+      }
+      q_pos = find_surrogate(data, q_pos + 1, block_end);
+    }
+  }
+  return true;
+}
+
+bool load_document(QSqlQuery& query, int doc_id, LoadedDocument& doc,
+                   const std::function<bool()>& cancelled) {
+  TraceScope trace("load_document");
+  doc = LoadedDocument{};
+  doc.doc_id = doc_id;
+  if (doc_id == -1) {
+    return true;
+  }
+  query.prepare("select content, coalesce(short_title, '') from "
+                "document_with_content where id = :docid ;");
+  query.bindValue(":docid", doc_id);
+  if (!traced_exec(query)) {
+    return false;
+  }
+  if (query.next()) {
+    doc.content = content_from_sql(query.value(0));
+    doc.title = query.value(1).toString();
+  }
+  // release the read lock before the (possibly long) index preparation
+  query.finish();
+  if (!fill_surrogate_indices(doc, cancelled)) {
+    return false;
+  }
+  return load_annotations(query, doc);
+}
+
+bool load_annotations(QSqlQuery& query, LoadedDocument& doc) {
+  doc.annotations.clear();
+  if (doc.doc_id == -1) {
+    return true;
+  }
+  query.prepare("select rowid, label_id, start_char, end_char, extra_data from "
+                "annotation where doc_id = :doc order by rowid;");
+  query.bindValue(":doc", doc.doc_id);
+  if (!traced_exec(query)) {
+    return false;
+  }
+  const auto& surrogates = doc.surrogate_indices_in_unicode_string;
+  while (query.next()) {
+    doc.annotations[query.value(0).toInt()] = AnnotationInfo{
+        query.value(0).toInt(), query.value(1).toInt(),
+        code_point_idx_to_utf16_idx(surrogates, query.value(2).toInt()),
+        code_point_idx_to_utf16_idx(surrogates, query.value(3).toInt()),
+        query.value(4).toString()};
+  }
+  query.finish();
+  return true;
+}
+
+DocumentCache::DocumentCache(int capacity) : capacity_{capacity} {}
+
+bool DocumentCache::contains(int doc_id) const {
+  for (const auto& doc : documents_) {
+    if (doc.doc_id == doc_id) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool DocumentCache::get(int doc_id, LoadedDocument& doc) {
+  for (auto it = documents_.begin(); it != documents_.end(); ++it) {
+    if (it->doc_id == doc_id) {
+      documents_.splice(documents_.begin(), documents_, it);
+      doc = documents_.front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void DocumentCache::insert(const LoadedDocument& doc) {
+  remove(doc.doc_id);
+  documents_.push_front(doc);
+  while (static_cast<int>(documents_.size()) > capacity_) {
+    documents_.pop_back();
+  }
+}
+
+void DocumentCache::remove(int doc_id) {
+  documents_.remove_if(
+      [doc_id](const LoadedDocument& doc) { return doc.doc_id == doc_id; });
+}
+
+void DocumentCache::clear() { documents_.clear(); }
+
+DocumentLoadingThread::DocumentLoadingThread(
+    const QString& database_path, std::function<void(int)> on_loaded,
+    std::function<void()> on_prefetched)
+    : database_path_{database_path},
+      on_loaded_{std::move(on_loaded)},
+      on_prefetched_{std::move(on_prefetched)},
+      thread_(&DocumentLoadingThread::run, this) {}
+
+DocumentLoadingThread::~DocumentLoadingThread() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_requested_ = true;
+    // cancels the document being loaded, if any
+    latest_request_id_ = -2;
+  }
+  has_request_.notify_one();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void DocumentLoadingThread::request(int request_id, int doc_id) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    assert(request_id > latest_request_id_);
+    latest_request_id_ = request_id;
+    pending_doc_id_ = doc_id;
+    has_pending_request_ = true;
+  }
+  has_request_.notify_one();
+}
+
+bool DocumentLoadingThread::take_result(int request_id, LoadedDocument& doc) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (result_request_id_ != request_id || !result_ok_) {
+    return false;
+  }
+  doc = std::move(result_);
+  result_request_id_ = -1;
+  return true;
+}
+
+void DocumentLoadingThread::prefetch(const QList<int>& doc_ids) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    prefetch_queue_.assign(doc_ids.cbegin(), doc_ids.cend());
+    prefetched_.clear();
+    ++prefetch_generation_;
+  }
+  has_request_.notify_one();
+}
+
+QList<LoadedDocument> DocumentLoadingThread::take_prefetched() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  QList<LoadedDocument> prefetched{};
+  prefetched.swap(prefetched_);
+  return prefetched;
+}
+
+void DocumentLoadingThread::run() {
+  {
+    WorkerConnection connection(database_path_, "labelbuddy_document_loader",
+                                WorkerConnection::Access::ReadOnly);
+    auto opened = connection.is_open();
+    QSqlQuery query(connection.database());
+    while (true) {
+      int request_id{};
+      int doc_id{};
+      bool is_prefetch{};
+      int prefetch_generation{};
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        has_request_.wait(lock, [this] {
+          return stop_requested_ || has_pending_request_ ||
+                 !prefetch_queue_.empty();
+        });
+        if (stop_requested_) {
+          break;
+        }
+        request_id = latest_request_id_;
+        // requests have priority over prefetching
+        if (has_pending_request_) {
+          doc_id = pending_doc_id_;
+          has_pending_request_ = false;
+        } else {
+          doc_id = prefetch_queue_.front();
+          prefetch_queue_.pop_front();
+          is_prefetch = true;
+          prefetch_generation = prefetch_generation_;
+        }
+      }
+      // a new request also interrupts prefetching
+      auto cancelled = [this, request_id]() {
+        return latest_request_id_ != request_id;
+      };
+      LoadedDocument doc{};
+      auto ok = opened && load_document(query, doc_id, doc, cancelled);
+      if (is_prefetch) {
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (!ok || cancelled() ||
+              prefetch_generation != prefetch_generation_) {
+            continue;
+          }
+          prefetched_ << std::move(doc);
+        }
+        if (on_prefetched_) {
+          on_prefetched_();
+        }
+        continue;
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cancelled()) {
+          // a newer request is waiting
+          continue;
+        }
+        result_request_id_ = request_id;
+        result_ok_ = ok;
+        result_ = std::move(doc);
+      }
+      on_loaded_(request_id);
+    }
+  }
+}
+
+} // namespace labelbuddy
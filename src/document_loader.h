@@ -0,0 +1,170 @@
+#ifndef LABELBUDDY_DOCUMENT_LOADER_H
+#define LABELBUDDY_DOCUMENT_LOADER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+
+#include <QList>
+#include <QMap>
+#include <QSqlQuery>
+#include <QString>
+#include <QVector>
+
+/// \file
+/// Loading documents for the Annotator, possibly in a background thread.
+
+namespace labelbuddy {
+
+struct AnnotationInfo {
+  int id;
+  int label_id;
+  int start_char;
+  int end_char;
+  QString extra_data;
+};
+
+/// What the `AnnotationsModel` needs to display a document.
+struct LoadedDocument {
+  int doc_id = -1;
+  QString content{};
+  QString title{};
+
+  /// Positions of surrogate pairs, used to convert between QString (utf-16)
+  /// and unicode code point indices. Both are sorted.
+  QVector<int> surrogate_indices_in_qstring{};
+  QVector<int> surrogate_indices_in_unicode_string{};
+
+  /// Annotations indexed by `rowid`, with positions as QString indices
+  QMap<int, AnnotationInfo> annotations{};
+};
+
+/// convert index in unicode sequence to QString (utf-16) index
+
+/// O(log n) in the number of surrogate pairs, and O(1) if there are none.
+int code_point_idx_to_utf16_idx(
+    const QVector<int>& surrogate_indices_in_unicode, int cp_idx);
+
+/// QString (utf-16) index to index in unicode sequence
+
+/// O(log n) in the number of surrogate pairs, and O(1) if there are none.
+int utf16_idx_to_code_point_idx(
+    const QVector<int>& surrogate_indices_in_qstring, int utf16_idx);
+
+/// Fill the surrogate indices of `doc` from its content.
+
+/// The text is scanned 4 utf-16 code units at a time, so texts without (or
+/// with few) characters outside of the Basic Multilingual Plane are handled
+/// quickly. `cancelled`, if provided, is checked regularly; if it returns
+/// `true` the function stops and returns `false`.
+bool fill_surrogate_indices(LoadedDocument& doc,
+                            const std::function<bool()>& cancelled = nullptr);
+
+/// Read the annotations of `doc` from the database; its surrogate indices must
+/// be filled. Returns `false` if the query failed.
+bool load_annotations(QSqlQuery& query, LoadedDocument& doc);
+
+/// Fetch a document and its annotations and prepare its index tables.
+
+/// If there is no document with this `id`, or `doc_id` is -1, the content is
+/// empty. Returns `false` if a query failed or the loading was cancelled
+/// (see `fill_surrogate_indices`).
+bool load_document(QSqlQuery& query, int doc_id, LoadedDocument& doc,
+                   const std::function<bool()>& cancelled = nullptr);
+
+/// A few recently visited or prefetched documents, least recently used ones
+/// are dropped first.
+class DocumentCache {
+public:
+  explicit DocumentCache(int capacity);
+
+  bool contains(int doc_id) const;
+
+  /// If the document is cached copy it into `doc`, mark it as the most
+  /// recently used and return `true`.
+  bool get(int doc_id, LoadedDocument& doc);
+
+  /// Add or replace a document
+  void insert(const LoadedDocument& doc);
+
+  void remove(int doc_id);
+
+  void clear();
+
+private:
+  int capacity_;
+  // most recently used first; the cache is small so lookups are linear
+  std::list<LoadedDocument> documents_{};
+};
+
+/// Loads documents in a background thread with its own database connection.
+
+/// Only the latest request matters: a new request replaces the pending one
+/// and cancels the one being loaded, so that pressing "next" many times in a
+/// row only loads the last document. When a document is ready `on_loaded` is
+/// called *from the loading thread* with the request's number; the result is
+/// then retrieved with `take_result`.
+///
+/// When there is no request to handle the thread loads the documents passed
+/// to `prefetch`, and calls `on_prefetched` (also from the loading thread)
+/// each time one is ready.
+class DocumentLoadingThread {
+public:
+  /// `database_path` is the path of the database file. It is opened
+  /// read-only in a connection that belongs to the loading thread.
+  DocumentLoadingThread(const QString& database_path,
+                        std::function<void(int)> on_loaded,
+                        std::function<void()> on_prefetched = nullptr);
+
+  /// Cancels the current request and waits for the thread to finish
+  ~DocumentLoadingThread();
+
+  /// Ask for a document. `request_id` must be greater than that of previous
+  /// requests.
+  void request(int request_id, int doc_id);
+
+  /// Retrieve the document loaded for `request_id`.
+
+  /// Returns `false` if it is not available -- it has been superseded by a
+  /// newer request, or loading failed (eg because the database was locked).
+  bool take_result(int request_id, LoadedDocument& doc);
+
+  /// Load these documents when idle, replacing previous prefetch requests.
+
+  /// Documents prefetched for previous calls and not retrieved yet are
+  /// discarded.
+  void prefetch(const QList<int>& doc_ids);
+
+  /// Documents prefetched since the last call
+  QList<LoadedDocument> take_prefetched();
+
+private:
+  void run();
+
+  QString database_path_;
+  std::function<void(int)> on_loaded_;
+  std::function<void()> on_prefetched_;
+  int pending_doc_id_ = -1;
+  bool has_pending_request_{};
+  bool stop_requested_{};
+  int result_request_id_ = -1;
+  bool result_ok_{};
+  LoadedDocument result_{};
+  std::deque<int> prefetch_queue_{};
+  int prefetch_generation_{};
+  QList<LoadedDocument> prefetched_{};
+  // checked by the loading thread to abandon a request that is superseded
+  std::atomic<int> latest_request_id_{-1};
+  std::mutex mutex_{};
+  std::condition_variable has_request_{};
+  // last member so that everything else is initialized when the thread starts
+  std::thread thread_;
+};
+
+} // namespace labelbuddy
+
+#endif
@@ -247,9 +247,11 @@ void ImportExportMenu::import_documents() {
   auto start_dir = suggest_dir(DirRole::import_documents);
   auto file_path = QFileDialog::getOpenFileName(
       this, "Docs & annotations file", start_dir,
-      "labelbuddy documents (*.txt *.json *.jsonl *.csv *.xml);; Text files "
-      "(*.txt);; JSON files (*.json);; JSONLines files (*.jsonl);; "
-      "CSV files (*.csv);; XML files (*.xml);; All files (*)");
+      "labelbuddy documents (*.txt *.json *.jsonl *.csv *.xml *.lbb "
+      "*.labelbuddy *.lb *.sqlite3 *.sqlite *.db);; Text files (*.txt);; "
+      "JSON files (*.json);; JSONLines files (*.jsonl);; CSV files (*.csv);; "
+      "XML files (*.xml);; labelbuddy bundles (*.lbb);; labelbuddy databases "
+      "(*.labelbuddy *.lb *.sqlite3 *.sqlite *.db);; All files (*)");
   if (file_path == QString()) {
     return;
   }
@@ -295,9 +297,10 @@ void ImportExportMenu::export_documents() {
   auto start_dir = suggest_dir(DirRole::export_documents);
   auto file_path = QFileDialog::getSaveFileName(
       this, "Docs & annotations file", start_dir,
-      "labelbuddy documents (*.json *.jsonl *.csv *.xml);;"
+      "labelbuddy documents (*.json *.jsonl *.csv *.xml *.lbb *.arrow);;"
       " JSON files (*.json);; JSONLines files (*.jsonl);; "
-      "CSV files (*.csv);; XML files (*.xml);; All files (*)");
+      "CSV files (*.csv);; XML files (*.xml);; labelbuddy bundles (*.lbb);; "
+      "Arrow files (*.arrow);; All files (*)");
   if (file_path == QString()) {
     return;
   }
@@ -0,0 +1,75 @@
+#include <QSqlDatabase>
+#include <QSqlQuery>
+
+#include "label_cache.h"
+#include "tracing.h"
+
+namespace labelbuddy {
+
+LabelCache::LabelCache(QObject* parent) : QObject(parent) {}
+
+QString LabelCache::get_database() const { return database_name_; }
+
+int LabelCache::version() const { return version_; }
+
+void LabelCache::set_database(const QString& new_database_name) {
+  database_name_ = new_database_name;
+  invalidate();
+}
+
+void LabelCache::invalidate() {
+  loaded_ = false;
+  ++version_;
+}
+
+void LabelCache::load() const {
+  if (loaded_) {
+    return;
+  }
+  sorted_labels_.clear();
+  id_to_position_.clear();
+  name_to_id_.clear();
+  shortcut_to_id_.clear();
+  loaded_ = true;
+  if (!QSqlDatabase::contains(database_name_)) {
+    return;
+  }
+  QSqlQuery query(QSqlDatabase::database(database_name_));
+  traced_exec(query, "select id, name, color, shortcut_key from sorted_label;");
+  while (query.next()) {
+    CachedLabel label{query.value(0).toInt(), query.value(1).toString(),
+                      query.value(2).toString(), query.value(3).toString()};
+    id_to_position_[label.id] = sorted_labels_.size();
+    name_to_id_[label.name] = label.id;
+    if (label.shortcut_key != QString()) {
+      shortcut_to_id_[label.shortcut_key] = label.id;
+    }
+    sorted_labels_ << label;
+  }
+}
+
+const QList<CachedLabel>& LabelCache::sorted_labels() const {
+  load();
+  return sorted_labels_;
+}
+
+const CachedLabel* LabelCache::label(int label_id) const {
+  load();
+  auto position = id_to_position_.constFind(label_id);
+  if (position == id_to_position_.constEnd()) {
+    return nullptr;
+  }
+  return &sorted_labels_.at(position.value());
+}
+
+int LabelCache::name_to_id(const QString& name) const {
+  load();
+  return name_to_id_.value(name, -1);
+}
+
+int LabelCache::shortcut_to_id(const QString& shortcut) const {
+  load();
+  return shortcut_to_id_.value(shortcut, -1);
+}
+
+} // namespace labelbuddy
@@ -0,0 +1,75 @@
+#ifndef LABELBUDDY_LABEL_CACHE_H
+#define LABELBUDDY_LABEL_CACHE_H
+
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QString>
+
+/// \file
+/// In-memory copy of the label table
+
+namespace labelbuddy {
+
+struct CachedLabel {
+  int id;
+  QString name;
+  QString color;
+  QString shortcut_key;
+};
+
+/// In-memory copy of the label table of one database.
+
+/// The labels are loaded (with a single query) the first time they are needed
+/// after construction, after changing the database or after `invalidate`.
+/// Lookups by id, name or shortcut key are then answered without SQL.
+///
+/// Whatever modifies the labels must call `invalidate` (eg through the
+/// `labels_changed` signals). `version` is incremented each time the cache is
+/// invalidated so users can tell if information they derived from it is
+/// outdated.
+class LabelCache : public QObject {
+  Q_OBJECT
+
+public:
+  LabelCache(QObject* parent = nullptr);
+
+  QString get_database() const;
+
+  int version() const;
+
+  /// All labels, in display order
+  const QList<CachedLabel>& sorted_labels() const;
+
+  /// The label with the given `id` or `nullptr` if it does not exist
+  const CachedLabel* label(int label_id) const;
+
+  /// -1 if no label has this name
+  int name_to_id(const QString& name) const;
+
+  /// -1 if no label has this shortcut key
+  int shortcut_to_id(const QString& shortcut) const;
+
+public slots:
+
+  /// Set the database and invalidate the cache
+  void set_database(const QString& new_database_name);
+
+  /// Mark the cache as outdated; labels are reloaded on the next lookup
+  void invalidate();
+
+private:
+  void load() const;
+
+  QString database_name_{};
+  int version_{};
+  mutable bool loaded_{};
+  mutable QList<CachedLabel> sorted_labels_{};
+  mutable QHash<int, int> id_to_position_{};
+  mutable QHash<QString, int> name_to_id_{};
+  mutable QHash<QString, int> shortcut_to_id_{};
+};
+
+} // namespace labelbuddy
+
+#endif
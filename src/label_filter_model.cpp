@@ -0,0 +1,175 @@
+#include <cassert>
+
+#include "label_filter_model.h"
+#include "label_list_model.h"
+#include "user_roles.h"
+
+namespace labelbuddy {
+
+namespace {
+
+quint64 trigram_key(const QChar* chars) {
+  return (static_cast<quint64>(chars[0].unicode()) << 32) |
+         (static_cast<quint64>(chars[1].unicode()) << 16) |
+         static_cast<quint64>(chars[2].unicode());
+}
+
+/// whether the characters of `pattern` appear in `name` in the same order
+bool is_subsequence(const QString& pattern, const QString& name) {
+  int pos{};
+  for (auto c : name) {
+    if (c == pattern[pos] && ++pos == pattern.size()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+void LabelNameIndex::build(const QList<CachedLabel>& labels) {
+  ids_.clear();
+  folded_names_.clear();
+  trigrams_.clear();
+  ids_.reserve(labels.size());
+  folded_names_.reserve(labels.size());
+  for (const auto& label : labels) {
+    auto position = ids_.size();
+    ids_ << label.id;
+    folded_names_ << label.name.toCaseFolded();
+    const auto& name = folded_names_.last();
+    for (int i = 0; i + 3 <= name.size(); ++i) {
+      auto& positions = trigrams_[trigram_key(name.constData() + i)];
+      // a trigram can occur several times in the same name
+      if (positions.isEmpty() || positions.last() != position) {
+        positions << position;
+      }
+    }
+  }
+}
+
+QVector<int> LabelNameIndex::candidates(const QString& folded_pattern) const {
+  if (folded_pattern.size() < 3) {
+    QVector<int> all(ids_.size());
+    for (int i = 0; i != all.size(); ++i) {
+      all[i] = i;
+    }
+    return all;
+  }
+  const QVector<int>* rarest = nullptr;
+  for (int i = 0; i + 3 <= folded_pattern.size(); ++i) {
+    auto positions =
+        trigrams_.constFind(trigram_key(folded_pattern.constData() + i));
+    if (positions == trigrams_.constEnd()) {
+      return QVector<int>{};
+    }
+    if (rarest == nullptr || positions.value().size() < rarest->size()) {
+      rarest = &positions.value();
+    }
+  }
+  assert(rarest != nullptr);
+  return *rarest;
+}
+
+QHash<int, int> LabelNameIndex::match(const QString& pattern) const {
+  QHash<int, int> ranks{};
+  if (pattern.isEmpty()) {
+    for (auto label_id : ids_) {
+      ranks[label_id] = 0;
+    }
+    return ranks;
+  }
+  auto folded = pattern.toCaseFolded();
+  for (auto position : candidates(folded)) {
+    auto found = folded_names_[position].indexOf(folded);
+    if (found != -1) {
+      ranks[ids_[position]] = found == 0 ? 0 : 1;
+    }
+  }
+  if (!ranks.isEmpty()) {
+    return ranks;
+  }
+  for (int position = 0; position != ids_.size(); ++position) {
+    if (is_subsequence(folded, folded_names_[position])) {
+      ranks[ids_[position]] = 2;
+    }
+  }
+  return ranks;
+}
+
+LabelFilterModel::LabelFilterModel(QObject* parent)
+    : QSortFilterProxyModel(parent) {
+  // the ranks only change with the pattern
+  setDynamicSortFilter(false);
+}
+
+void LabelFilterModel::setSourceModel(QAbstractItemModel* source) {
+  assert(source == nullptr || dynamic_cast<LabelListModel*>(source));
+  QObject::disconnect(source_reset_connection_);
+  QSortFilterProxyModel::setSourceModel(source);
+  if (source != nullptr) {
+    source_reset_connection_ =
+        QObject::connect(source, &QAbstractItemModel::modelReset, this,
+                         &LabelFilterModel::refresh_filter);
+  }
+  refresh_filter();
+}
+
+QString LabelFilterModel::filter() const { return pattern_; }
+
+const LabelCache* LabelFilterModel::label_cache() const {
+  auto source = static_cast<const LabelListModel*>(sourceModel());
+  return source != nullptr ? source->get_label_cache() : nullptr;
+}
+
+void LabelFilterModel::set_filter(const QString& pattern) {
+  if (pattern == pattern_) {
+    return;
+  }
+  pattern_ = pattern;
+  refresh_filter();
+}
+
+void LabelFilterModel::refresh_filter() {
+  ranks_.clear();
+  auto cache = label_cache();
+  if (pattern_ != "" && cache != nullptr) {
+    if (cache != indexed_cache_ ||
+        cache->version() != indexed_cache_version_) {
+      index_.build(cache->sorted_labels());
+      indexed_cache_ = cache;
+      indexed_cache_version_ = cache->version();
+    }
+    ranks_ = index_.match(pattern_);
+    // rows that have not been fetched yet would never be shown
+    while (sourceModel()->canFetchMore(QModelIndex())) {
+      sourceModel()->fetchMore(QModelIndex());
+    }
+  }
+  invalidate();
+  sort(pattern_ == "" ? -1 : 0);
+}
+
+bool LabelFilterModel::filterAcceptsRow(
+    int source_row, const QModelIndex& source_parent) const {
+  if (pattern_ == "") {
+    return true;
+  }
+  auto label_id = sourceModel()
+                      ->index(source_row, 0, source_parent)
+                      .data(Roles::RowIdRole)
+                      .toInt();
+  return ranks_.contains(label_id);
+}
+
+bool LabelFilterModel::lessThan(const QModelIndex& source_left,
+                                const QModelIndex& source_right) const {
+  auto left_rank = ranks_.value(source_left.data(Roles::RowIdRole).toInt());
+  auto right_rank = ranks_.value(source_right.data(Roles::RowIdRole).toInt());
+  if (left_rank != right_rank) {
+    return left_rank < right_rank;
+  }
+  return source_left.row() < source_right.row();
+}
+
+} // namespace labelbuddy
@@ -0,0 +1,93 @@
+#ifndef LABELBUDDY_LABEL_FILTER_MODEL_H
+#define LABELBUDDY_LABEL_FILTER_MODEL_H
+
+#include <QHash>
+#include <QList>
+#include <QSortFilterProxyModel>
+#include <QString>
+#include <QVector>
+
+#include "label_cache.h"
+
+/// \file
+/// Incremental search in the list of labels.
+
+namespace labelbuddy {
+
+/// In-memory index of label names for searching large label sets.
+
+/// Names are compared case-insensitively (case-folded). A trigram index
+/// gives the candidate names for patterns of 3 characters or more, so that
+/// typing in a list of many thousands of labels does not compare the pattern
+/// with every name.
+class LabelNameIndex {
+public:
+  void build(const QList<CachedLabel>& labels);
+
+  /// Rank of the labels matching `pattern`, by label `id`.
+
+  /// 0 if the name starts with the pattern, 1 if it contains it elsewhere.
+  /// Only if no name contains the pattern, labels whose name contains the
+  /// characters of the pattern in the same order (eg "neop" for "neoplasm of
+  /// prostate" or "nplsm") are returned with rank 2. Every label has rank 0
+  /// if `pattern` is empty.
+  QHash<int, int> match(const QString& pattern) const;
+
+private:
+  /// positions in `ids_` of the names that contain at least one occurrence
+  /// of the pattern's rarest trigram, or all positions
+  QVector<int> candidates(const QString& folded_pattern) const;
+
+  QVector<int> ids_{};
+  QVector<QString> folded_names_{};
+  /// increasing positions in `ids_` of the names containing each trigram
+  QHash<quint64, QVector<int>> trigrams_{};
+};
+
+/// Proxy model that only shows the labels matching a filter pattern.
+
+/// With an empty pattern all labels are shown in the source model's order.
+/// Otherwise the matching labels (see `LabelNameIndex::match`) are sorted by
+/// rank then in the source order. The names are read from the label cache
+/// of the `LabelListModel` used as source, and indexed again when the cache
+/// is invalidated.
+class LabelFilterModel : public QSortFilterProxyModel {
+  Q_OBJECT
+
+public:
+  LabelFilterModel(QObject* parent = nullptr);
+
+  /// `source` must be a `LabelListModel`
+  void setSourceModel(QAbstractItemModel* source) override;
+
+  QString filter() const;
+
+public slots:
+
+  void set_filter(const QString& pattern);
+
+protected:
+  bool filterAcceptsRow(int source_row,
+                        const QModelIndex& source_parent) const override;
+  bool lessThan(const QModelIndex& source_left,
+                const QModelIndex& source_right) const override;
+
+private slots:
+
+  /// Apply the pattern again, eg after labels have been added or renamed
+  void refresh_filter();
+
+private:
+  const LabelCache* label_cache() const;
+
+  QString pattern_{};
+  LabelNameIndex index_{};
+  int indexed_cache_version_{-1};
+  const LabelCache* indexed_cache_ = nullptr;
+  QHash<int, int> ranks_{};
+  QMetaObject::Connection source_reset_connection_{};
+};
+
+} // namespace labelbuddy
+
+#endif
@@ -1,13 +1,14 @@
 #include <cassert>
-#include <list>
 #include <memory>
 
 #include <QColor>
 #include <QMimeData>
+#include <QSet>
 #include <QSqlDatabase>
 #include <QSqlError>
 
 #include "label_list_model.h"
+#include "pending_writes.h"
 #include "user_roles.h"
 #include "utils.h"
 
@@ -15,9 +16,19 @@ namespace labelbuddy {
 
 LabelListModel::LabelListModel(QObject* parent) : QSqlQueryModel(parent) {}
 
+void LabelListModel::set_label_cache(LabelCache* cache) {
+  assert(cache != nullptr);
+  label_cache_ = cache;
+}
+
+const LabelCache* LabelListModel::get_label_cache() const {
+  return label_cache_;
+}
+
 void LabelListModel::set_database(const QString& new_database_name) {
   assert(QSqlDatabase::contains(new_database_name));
   database_name = new_database_name;
+  label_cache_->set_database(database_name);
   setQuery(select_query_text, QSqlDatabase::database(database_name));
 }
 
@@ -45,24 +56,16 @@ QVariant LabelListModel::data(const QModelIndex& index, int role) const {
     return QSqlQueryModel::data(index.sibling(index.row(), 1), Qt::DisplayRole);
   }
   if (role == Roles::ShortcutKeyRole) {
-    auto label_id = data(index, Roles::RowIdRole).toInt();
-    auto query = get_query();
-    query.prepare("select shortcut_key from label where id = :labelid;");
-    query.bindValue(":labelid", label_id);
-    query.exec();
-    query.next();
-    return query.value(0).toString();
+    auto label = label_cache_->label(data(index, Roles::RowIdRole).toInt());
+    return label != nullptr ? label->shortcut_key : QString();
   }
   if (role == Qt::BackgroundRole) {
-    auto label_id = data(index, Roles::RowIdRole).toInt();
-    auto query = get_query();
-    query.prepare("select color from label where id = :labelid;");
-    query.bindValue(":labelid", label_id);
-    query.exec();
-    query.next();
-    auto color = query.value(0).toString();
-    assert(color != "");
-    return QColor(color);
+    auto label = label_cache_->label(data(index, Roles::RowIdRole).toInt());
+    if (label == nullptr) {
+      return QVariant{};
+    }
+    assert(label->color != "");
+    return QColor(label->color);
   }
   return QSqlQueryModel::data(index, role);
 }
@@ -138,52 +141,92 @@ bool LabelListModel::dropMimeData(const QMimeData* data, Qt::DropAction action,
     stream >> label_id;
     moved_labels << label_id;
   }
-  std::list<int> all_labels{};
-  get_reordered_labels_into(moved_labels, row, all_labels);
-  assert(all_labels.size() == static_cast<size_t>(rowCount()));
-  assert (set_compare(all_labels, get_label_ids(*this)));
-  update_labels_order(all_labels);
+  update_labels_order(reordered_label_keys(moved_labels, row));
   return true;
 }
 
-void LabelListModel::get_reordered_labels_into(
-    const QList<int>& moved_labels, int row, std::list<int>& all_labels) const {
+QList<QPair<int, qlonglong>>
+LabelListModel::reordered_label_keys(const QList<int>& moved_labels,
+                                     int row) const {
   auto query = get_query();
-  query.exec("select id from sorted_label;");
-  auto insert_pos = all_labels.cend();
+  query.exec("select id, display_order from sorted_label;");
+  QSet<int> moved{};
+  for (auto label_id : moved_labels) {
+    moved.insert(label_id);
+  }
+  // (id, display_order) of the labels that are not moved, and where the
+  // moved ones are inserted among them
+  QList<QPair<int, QVariant>> others{};
+  int insert_pos{-1};
+  int n_labels{};
   while (query.next()) {
-    auto it = all_labels.insert(all_labels.cend(), query.value(0).toInt());
-    if (all_labels.size() == static_cast<size_t>(row + 1)) {
-      insert_pos = it;
+    if (n_labels++ == row) {
+      insert_pos = others.size();
+    }
+    auto label_id = query.value(0).toInt();
+    if (!moved.contains(label_id)) {
+      others << qMakePair(label_id, query.value(1));
     }
   }
-  assert((insert_pos == all_labels.cend()) == (row == -1 || row == rowCount()));
-  auto it = all_labels.cbegin();
-  while (it != all_labels.cend()) {
-    if (moved_labels.contains(*it)) {
-      if (insert_pos == it) {
-        ++insert_pos;
+  if (insert_pos == -1) {
+    insert_pos = others.size();
+  }
+  const qlonglong step{label_order_step};
+  auto n_moved = static_cast<qlonglong>(moved_labels.size());
+  auto has_key = [&others](int pos) {
+    return pos >= 0 && pos < others.size() && !others[pos].second.isNull();
+  };
+  // neighbours in the new order; a missing one leaves as much room as needed
+  auto prev_exists = insert_pos > 0;
+  auto next_exists = insert_pos < others.size();
+  if ((prev_exists || next_exists) &&
+      (!prev_exists || has_key(insert_pos - 1)) &&
+      (!next_exists || has_key(insert_pos))) {
+    auto lower = prev_exists ? others[insert_pos - 1].second.toLongLong()
+                             : others[insert_pos].second.toLongLong() -
+                                   (n_moved + 1) * step;
+    auto upper = next_exists ? others[insert_pos].second.toLongLong()
+                             : lower + (n_moved + 1) * step;
+    if (upper - lower > n_moved) {
+      QList<QPair<int, qlonglong>> keys{};
+      for (qlonglong i = 0; i != n_moved; ++i) {
+        keys << qMakePair(moved_labels[static_cast<int>(i)],
+                          lower + (upper - lower) * (i + 1) / (n_moved + 1));
       }
-      it = all_labels.erase(it);
-    } else {
-      ++it;
+      return keys;
     }
   }
-  all_labels.insert(insert_pos, moved_labels.constBegin(),
-                    moved_labels.constEnd());
+  // no room between the neighbours (or labels without a key): renumber all
+  QList<int> all_labels{};
+  for (const auto& label : others) {
+    all_labels << label.first;
+  }
+  for (int i = 0; i != moved_labels.size(); ++i) {
+    all_labels.insert(insert_pos + i, moved_labels[i]);
+  }
+  QList<QPair<int, qlonglong>> keys{};
+  for (int i = 0; i != all_labels.size(); ++i) {
+    keys << qMakePair(all_labels[i], (i + 1) * step);
+  }
+  return keys;
 }
 
-void LabelListModel::update_labels_order(const std::list<int>& labels) {
+void LabelListModel::update_labels_order(
+    const QList<QPair<int, qlonglong>>& keys) {
+  QVariantList ids{};
+  QVariantList positions{};
+  for (const auto& key : keys) {
+    ids << key.first;
+    positions << key.second;
+  }
+  // not nested in the annotations model's transaction
+  flush_pending_writes(database_name);
   auto query = get_query();
-  int new_pos = 0;
   query.exec("begin transaction;");
-  for (auto label_id : labels) {
-    query.prepare("update label set display_order = :pos where id = :id;");
-    query.bindValue(":pos", new_pos);
-    query.bindValue(":id", label_id);
-    query.exec();
-    ++new_pos;
-  }
+  query.prepare("update label set display_order = :pos where id = :id;");
+  query.bindValue(":pos", positions);
+  query.bindValue(":id", ids);
+  query.execBatch();
   query.exec("end transaction;");
   refresh_current_query();
   emit labels_order_changed();
@@ -212,6 +255,7 @@ int LabelListModel::total_n_labels() const {
 }
 
 int LabelListModel::delete_labels(const QModelIndexList& indices) {
+  flush_pending_writes(database_name);
   auto query = get_query();
   query.exec("begin transaction;");
   query.prepare("delete from label where id = ?");
@@ -233,6 +277,7 @@ int LabelListModel::delete_labels(const QModelIndexList& indices) {
 }
 
 void LabelListModel::refresh_current_query() {
+  label_cache_->invalidate();
   setQuery(select_query_text, QSqlDatabase::database(database_name));
 }
 
@@ -252,6 +297,7 @@ void LabelListModel::set_label_color(const QModelIndex& index,
   query.bindValue(":labelid", label_id.toInt());
   query.exec();
   assert(query.numRowsAffected() == 1);
+  label_cache_->invalidate();
   emit dataChanged(index, index, {Qt::BackgroundRole});
   emit labels_changed();
 }
@@ -268,16 +314,8 @@ bool LabelListModel::is_valid_shortcut(const QString& shortcut,
   if (!re.match(shortcut).hasMatch()) {
     return false;
   }
-  auto query = get_query();
-  query.prepare("select id from label where shortcut_key = :shortcut "
-                "and id != :labelid;");
-  query.bindValue(":shortcut", shortcut);
-  query.bindValue(":labelid", label_id);
-  query.exec();
-  if (query.next()) {
-    return false;
-  }
-  return true;
+  auto owner = label_cache_->shortcut_to_id(shortcut);
+  return owner == -1 || owner == label_id;
 }
 
 void LabelListModel::set_label_shortcut(const QModelIndex& index,
@@ -301,6 +339,7 @@ void LabelListModel::set_label_shortcut(const QModelIndex& index,
   // https://sqlite.org/rescode.html#constraint
   assert(query.numRowsAffected() == 1 ||
          query.lastError().nativeErrorCode() == "19");
+  label_cache_->invalidate();
   emit dataChanged(index, index, {Qt::DisplayRole});
   emit labels_changed();
 }
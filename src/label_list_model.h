@@ -3,9 +3,12 @@
 
 #include <memory>
 
+#include <QList>
+#include <QPair>
 #include <QSqlQuery>
 #include <QSqlQueryModel>
 
+#include "label_cache.h"
 #include "utils.h"
 
 /// \file
@@ -57,6 +60,15 @@ public:
 
   int add_label(const QString& name);
 
+  /// Use a label cache shared with other components.
+
+  /// By default the model uses its own cache. The cache is not owned and must
+  /// outlive the model.
+  void set_label_cache(LabelCache* cache);
+
+  /// The cache used by the model (its own or the shared one)
+  const LabelCache* get_label_cache() const;
+
 public slots:
 
   /// Set the current database
@@ -93,13 +105,25 @@ private:
 
   bool is_valid_shortcut(const QString& shortcut, int label_id) const;
 
-  /// `all_labels` is an empty list to be filled with label ids in the new order
-  void get_reordered_labels_into(const QList<int>& moved_labels, int row,
-                                 std::list<int>& all_labels) const;
+  /// New `display_order` of the labels when `moved_labels` are dropped at
+  /// `row` (-1 for the end), as (id, display_order) pairs.
+
+  /// Keys are sparse (`label_order_step` apart), so that usually only the
+  /// moved labels need a key between those of their new neighbours. All the
+  /// labels are renumbered when there is no room left or a neighbour has no
+  /// key, eg it was added after the last reordering.
+  QList<QPair<int, qlonglong>>
+  reordered_label_keys(const QList<int>& moved_labels, int row) const;
+
+  /// Write the new keys in one transaction, reset query and emit
+  /// `labels_order_changed`
+  void update_labels_order(const QList<QPair<int, qlonglong>>& keys);
 
-  void update_labels_order(const std::list<int>& labels);
+  static constexpr int label_order_step{1024};
 
   QString database_name;
+  LabelCache own_label_cache_{};
+  LabelCache* label_cache_ = &own_label_cache_;
   const QString select_query_text = ("select name, id from sorted_label;");
   QRegularExpression re = shortcut_key_pattern(true);
 };
@@ -0,0 +1,126 @@
+#include <limits>
+#include <utility>
+
+#include <QSet>
+#include <QVariant>
+
+#include "label_stats.h"
+#include "tracing.h"
+#include "worker_connection.h"
+
+namespace labelbuddy {
+
+namespace {
+
+/// documents whose annotations are read by one statement
+const int docs_per_block{2000};
+
+/// annotations read between two checks of `cancelled`
+const int check_interval{1 << 16};
+
+} // namespace
+
+double LabelStats::mean_length() const {
+  if (n_annotations == 0) {
+    return 0.;
+  }
+  return static_cast<double>(total_length) /
+         static_cast<double>(n_annotations);
+}
+
+bool compute_label_stats(QSqlQuery& query, QHash<int, LabelStats>& stats,
+                         const std::function<bool()>& cancelled) {
+  TraceScope trace("compute_label_stats");
+  stats.clear();
+  auto last_doc = std::numeric_limits<qlonglong>::min();
+  // labels already counted for the current document
+  QSet<int> doc_labels{};
+  qlonglong current_doc{};
+  int n_read{};
+  while (true) {
+    if (cancelled && cancelled()) {
+      return false;
+    }
+    // the last document of the block, if it is not the last one
+    query.prepare("select id from document where id > :last order by id "
+                  "limit 1 offset :offset;");
+    query.bindValue(":last", last_doc);
+    query.bindValue(":offset", docs_per_block - 1);
+    if (!traced_exec(query)) {
+      return false;
+    }
+    auto is_last_block = !query.next();
+    auto block_end =
+        is_last_block ? std::numeric_limits<qlonglong>::max()
+                      : query.value(0).toLongLong();
+    query.finish();
+    query.prepare("select doc_id, label_id, end_char - start_char from "
+                  "annotation where doc_id > :last and doc_id <= :end "
+                  "order by doc_id;");
+    query.bindValue(":last", last_doc);
+    query.bindValue(":end", block_end);
+    if (!traced_exec(query)) {
+      return false;
+    }
+    while (query.next()) {
+      if (++n_read == check_interval) {
+        n_read = 0;
+        if (cancelled && cancelled()) {
+          query.finish();
+          return false;
+        }
+      }
+      auto doc_id = query.value(0).toLongLong();
+      auto label_id = query.value(1).toInt();
+      auto& label_stats = stats[label_id];
+      ++label_stats.n_annotations;
+      label_stats.total_length += query.value(2).toLongLong();
+      if (doc_id != current_doc) {
+        current_doc = doc_id;
+        doc_labels.clear();
+      }
+      if (!doc_labels.contains(label_id)) {
+        doc_labels.insert(label_id);
+        ++label_stats.n_docs;
+      }
+    }
+    query.finish();
+    if (is_last_block) {
+      return true;
+    }
+    last_doc = block_end;
+  }
+}
+
+LabelStatsThread::LabelStatsThread(
+    const QString& database_path,
+    std::function<void(bool, QHash<int, LabelStats>)> on_finished)
+    : database_path_{database_path},
+      on_finished_{std::move(on_finished)},
+      thread_(&LabelStatsThread::run, this) {}
+
+LabelStatsThread::~LabelStatsThread() {
+  cancel();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void LabelStatsThread::cancel() { cancel_requested_ = true; }
+
+void LabelStatsThread::run() {
+  bool ok{};
+  QHash<int, LabelStats> stats{};
+  {
+    WorkerConnection connection(database_path_, "labelbuddy_label_stats",
+                                WorkerConnection::Access::ReadOnly);
+    if (connection.is_open()) {
+      QSqlQuery query(connection.database());
+      auto cancelled = [this]() { return cancel_requested_.load(); };
+      ok = compute_label_stats(query, stats, cancelled);
+    }
+  }
+  on_finished_(ok, std::move(stats));
+}
+
+} // namespace labelbuddy
@@ -0,0 +1,74 @@
+#ifndef LABELBUDDY_LABEL_STATS_H
+#define LABELBUDDY_LABEL_STATS_H
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+#include <QHash>
+#include <QSqlQuery>
+#include <QString>
+
+/// \file
+/// Per-label statistics computed in one pass over the annotations, possibly
+/// in a background thread.
+
+namespace labelbuddy {
+
+/// Aggregates of the annotations of one label
+struct LabelStats {
+  qlonglong n_annotations{};
+  /// documents with at least one annotation with this label
+  qlonglong n_docs{};
+  /// sum of the annotations' lengths, in unicode code points
+  qlonglong total_length{};
+
+  /// Mean annotation length, 0 if there are no annotations
+  double mean_length() const;
+};
+
+/// Compute the statistics of every label that has annotations, by label `id`.
+
+/// Each annotation is read once, in `doc_id` order and through the
+/// `(doc_id, start_char, end_char, label_id)` unique index, which covers the
+/// query and is much smaller than the table. Documents are read in blocks,
+/// each with its own statement, so that the read lock is released regularly
+/// on large databases: a document modified during the pass may be counted in
+/// its old or new state. `cancelled`, if provided, is checked between blocks
+/// and regularly within a block. Returns `false` if a query fails or the pass
+/// is cancelled; `stats` is then incomplete.
+bool compute_label_stats(QSqlQuery& query, QHash<int, LabelStats>& stats,
+                         const std::function<bool()>& cancelled = nullptr);
+
+/// Computes the label statistics in a background thread with its own
+/// database connection.
+
+/// The thread starts immediately. `on_finished` is called once *from the
+/// statistics thread* with the result of `compute_label_stats`, including
+/// when it is cancelled (the first argument is then `false`).
+class LabelStatsThread {
+public:
+  /// `database_path` is the path of the database file. It is opened
+  /// read-only in a connection that belongs to the statistics thread.
+  LabelStatsThread(const QString& database_path,
+                   std::function<void(bool, QHash<int, LabelStats>)>
+                       on_finished);
+
+  /// Cancels the computation and waits for the thread to finish
+  ~LabelStatsThread();
+
+  void cancel();
+
+private:
+  void run();
+
+  QString database_path_;
+  std::function<void(bool, QHash<int, LabelStats>)> on_finished_;
+  std::atomic<bool> cancel_requested_{};
+  // last member so that everything else is initialized when the thread starts
+  std::thread thread_;
+};
+
+} // namespace labelbuddy
+
+#endif
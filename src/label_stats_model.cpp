@@ -0,0 +1,256 @@
+#include <cassert>
+#include <utility>
+
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QVariant>
+
+#include "label_stats_model.h"
+#include "tracing.h"
+#include "user_roles.h"
+#include "worker_connection.h"
+
+namespace labelbuddy {
+
+LabelStatsModel::LabelStatsModel(QObject* parent)
+    : QAbstractTableModel(parent) {
+  QObject::connect(this, &LabelStatsModel::stats_computed, this,
+                   &LabelStatsModel::show_computed_stats,
+                   Qt::QueuedConnection);
+}
+
+// the thread must be stopped before the members it uses are destroyed
+LabelStatsModel::~LabelStatsModel() { thread_.reset(); }
+
+int LabelStatsModel::rowCount(const QModelIndex& parent) const {
+  if (parent.isValid()) {
+    return 0;
+  }
+  return labels_.size();
+}
+
+int LabelStatsModel::columnCount(const QModelIndex& parent) const {
+  if (parent.isValid()) {
+    return 0;
+  }
+  return 4;
+}
+
+QVariant LabelStatsModel::data(const QModelIndex& index, int role) const {
+  if (!index.isValid() || index.row() >= labels_.size()) {
+    return QVariant{};
+  }
+  const auto& label = labels_[index.row()];
+  if (role == Roles::RowIdRole) {
+    return label.first;
+  }
+  if (role == Qt::TextAlignmentRole && index.column() != Column::Name) {
+    return static_cast<int>(Qt::AlignRight | Qt::AlignVCenter);
+  }
+  if (role != Qt::DisplayRole) {
+    return QVariant{};
+  }
+  auto stats = label_stats(label.first);
+  switch (index.column()) {
+  case Column::Name:
+    return label.second;
+  case Column::Annotations:
+    return stats.n_annotations;
+  case Column::Documents:
+    return stats.n_docs;
+  case Column::MeanLength:
+    return QString::number(stats.mean_length(), 'f', 1);
+  default:
+    return QVariant{};
+  }
+}
+
+QVariant LabelStatsModel::headerData(int section, Qt::Orientation orientation,
+                                     int role) const {
+  if (orientation != Qt::Horizontal || role != Qt::DisplayRole) {
+    return QAbstractTableModel::headerData(section, orientation, role);
+  }
+  switch (section) {
+  case Column::Name:
+    return QString("Label");
+  case Column::Annotations:
+    return QString("Annotations");
+  case Column::Documents:
+    return QString("Documents");
+  case Column::MeanLength:
+    return QString("Mean length");
+  default:
+    return QVariant{};
+  }
+}
+
+LabelStats LabelStatsModel::label_stats(int label_id) const {
+  return stats_.value(label_id);
+}
+
+bool LabelStatsModel::is_computing() const { return thread_ != nullptr; }
+
+void LabelStatsModel::set_asynchronous(bool asynchronous) {
+  asynchronous_ = asynchronous;
+}
+
+void LabelStatsModel::set_deferred_loading(bool deferred) {
+  deferred_loading_ = deferred;
+}
+
+void LabelStatsModel::set_database(const QString& new_database_name) {
+  assert(QSqlDatabase::contains(new_database_name));
+  database_name_ = new_database_name;
+  stats_.clear();
+  if (!deferred_loading_) {
+    refresh_stats();
+    return;
+  }
+  // results of a computation for the previous database are ignored
+  ++generation_;
+  thread_.reset();
+  stats_outdated_ = true;
+  refresh_labels();
+}
+
+void LabelStatsModel::refresh_labels() {
+  beginResetModel();
+  labels_.clear();
+  if (database_name_ != "") {
+    QSqlQuery query(QSqlDatabase::database(database_name_));
+    traced_exec(query, "select id, name from sorted_label;");
+    while (query.next()) {
+      labels_ << qMakePair(query.value(0).toInt(), query.value(1).toString());
+    }
+  }
+  endResetModel();
+}
+
+void LabelStatsModel::refresh_stats() {
+  refresh_labels();
+  start_computation();
+}
+
+void LabelStatsModel::refresh_stats_if_outdated() {
+  if (stats_outdated_) {
+    start_computation();
+  }
+}
+
+void LabelStatsModel::start_computation() {
+  ++generation_;
+  stats_outdated_ = false;
+  changed_during_computation_ = false;
+  // results of the previous computation are ignored
+  thread_.reset();
+  if (database_name_ == "") {
+    return;
+  }
+  auto database_path = worker_database_path(database_name_);
+  if (!asynchronous_ || database_path == "") {
+    QSqlQuery query(QSqlDatabase::database(database_name_));
+    QHash<int, LabelStats> stats{};
+    if (compute_label_stats(query, stats)) {
+      stats_ = std::move(stats);
+    }
+    if (!labels_.isEmpty()) {
+      emit dataChanged(index(0, Column::Annotations),
+                       index(labels_.size() - 1, Column::MeanLength));
+    }
+    emit stats_updated();
+    return;
+  }
+  auto generation = generation_;
+  auto on_finished = [this, generation](bool ok,
+                                        QHash<int, LabelStats> stats) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      result_generation_ = generation;
+      result_ok_ = ok;
+      result_ = std::move(stats);
+    }
+    emit stats_computed(generation);
+  };
+  thread_.reset(new LabelStatsThread(database_path, on_finished));
+}
+
+void LabelStatsModel::show_computed_stats(int generation) {
+  if (generation != generation_) {
+    return;
+  }
+  bool ok{};
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (result_generation_ != generation) {
+      return;
+    }
+    ok = result_ok_;
+    if (ok) {
+      stats_ = std::move(result_);
+    }
+    result_ = QHash<int, LabelStats>{};
+    result_generation_ = -1;
+  }
+  thread_.reset();
+  if (!ok) {
+    return;
+  }
+  if (!labels_.isEmpty()) {
+    emit dataChanged(index(0, Column::Annotations),
+                     index(labels_.size() - 1, Column::MeanLength));
+  }
+  if (changed_during_computation_) {
+    // the pass may have missed these changes
+    start_computation();
+    return;
+  }
+  emit stats_updated();
+}
+
+void LabelStatsModel::label_stats_changed(int label_id) {
+  if (thread_ != nullptr) {
+    changed_during_computation_ = true;
+  }
+  for (int row = 0; row != labels_.size(); ++row) {
+    if (labels_[row].first == label_id) {
+      emit dataChanged(index(row, Column::Annotations),
+                       index(row, Column::MeanLength));
+      return;
+    }
+  }
+}
+
+void LabelStatsModel::document_gained_label(int label_id, int doc_id) {
+  (void)doc_id;
+  ++stats_[label_id].n_docs;
+  label_stats_changed(label_id);
+}
+
+void LabelStatsModel::document_lost_label(int label_id, int doc_id) {
+  (void)doc_id;
+  auto stats = stats_.find(label_id);
+  if (stats == stats_.end()) {
+    return;
+  }
+  --stats.value().n_docs;
+  label_stats_changed(label_id);
+}
+
+void LabelStatsModel::annotation_added(int label_id, int n_code_points) {
+  auto& stats = stats_[label_id];
+  ++stats.n_annotations;
+  stats.total_length += n_code_points;
+  label_stats_changed(label_id);
+}
+
+void LabelStatsModel::annotation_removed(int label_id, int n_code_points) {
+  auto stats = stats_.find(label_id);
+  if (stats == stats_.end()) {
+    return;
+  }
+  --stats.value().n_annotations;
+  stats.value().total_length -= n_code_points;
+  label_stats_changed(label_id);
+}
+
+} // namespace labelbuddy
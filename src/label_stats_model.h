@@ -0,0 +1,122 @@
+#ifndef LABELBUDDY_LABEL_STATS_MODEL_H
+#define LABELBUDDY_LABEL_STATS_MODEL_H
+
+#include <memory>
+#include <mutex>
+
+#include <QAbstractTableModel>
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QString>
+
+#include "label_stats.h"
+
+/// \file
+/// Table of label statistics shown in the Dataset tab.
+
+namespace labelbuddy {
+
+/// Number of annotations, of documents and mean annotation length per label.
+
+/// The labels are listed in the same order as in the label list. The
+/// statistics are computed by `compute_label_stats` in a background thread
+/// (or directly for in-memory databases, which cannot be opened by another
+/// connection) when `refresh_stats` is called, and the previous values are
+/// shown until the computation finishes. Changes made through the
+/// `AnnotationsModel` are applied to the current values as they are signalled,
+/// without reading the database. The background pass only sees committed
+/// annotations.
+class LabelStatsModel : public QAbstractTableModel {
+  Q_OBJECT
+
+public:
+  enum Column { Name = 0, Annotations, Documents, MeanLength };
+
+  LabelStatsModel(QObject* parent = nullptr);
+  ~LabelStatsModel() override;
+
+  int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+  int columnCount(const QModelIndex& parent = QModelIndex()) const override;
+
+  /// Besides Qt roles, `Roles::RowIdRole` gives the label's `id`
+  QVariant data(const QModelIndex& index, int role) const override;
+
+  QVariant headerData(int section, Qt::Orientation orientation,
+                      int role) const override;
+
+  /// Statistics currently shown for a label (zeros if it has none)
+  LabelStats label_stats(int label_id) const;
+
+  /// Whether a background computation is running
+  bool is_computing() const;
+
+  /// Run the statistics pass in the current thread even for databases stored
+  /// in a file. Mostly useful for testing.
+  void set_asynchronous(bool asynchronous);
+
+  /// Only read the labels when the database changes.
+
+  /// The statistics are then computed by `refresh_stats_if_outdated`, ie when
+  /// they are shown, so opening a database does not start a pass over all
+  /// the annotations for a view that is not visible.
+  void set_deferred_loading(bool deferred);
+
+public slots:
+
+  void set_database(const QString& new_database_name);
+
+  /// Read the label names and order again, keeping the statistics
+  void refresh_labels();
+
+  /// Read the labels and compute all the statistics again
+  void refresh_stats();
+
+  /// Compute the statistics if they were deferred by `set_database`
+  void refresh_stats_if_outdated();
+
+  void document_gained_label(int label_id, int doc_id);
+  void document_lost_label(int label_id, int doc_id);
+  void annotation_added(int label_id, int n_code_points);
+  void annotation_removed(int label_id, int n_code_points);
+
+signals:
+
+  /// emitted from the statistics thread; connected to `show_computed_stats`
+  void stats_computed(int generation);
+
+  /// A computation started by `refresh_stats` has finished
+  void stats_updated();
+
+private slots:
+
+  void show_computed_stats(int generation);
+
+private:
+  void start_computation();
+  void label_stats_changed(int label_id);
+
+  QString database_name_{};
+  bool asynchronous_{true};
+  bool deferred_loading_{};
+  /// the statistics have not been computed since the database changed
+  bool stats_outdated_{};
+  /// (id, name) of each label, in the label list order
+  QList<QPair<int, QString>> labels_{};
+  QHash<int, LabelStats> stats_{};
+
+  std::unique_ptr<LabelStatsThread> thread_{};
+  /// identifies the latest computation; older results are discarded
+  int generation_{};
+  /// annotations changed while the statistics were being computed
+  bool changed_during_computation_{};
+
+  std::mutex mutex_{};
+  int result_generation_{-1};
+  bool result_ok_{};
+  QHash<int, LabelStats> result_{};
+};
+
+} // namespace labelbuddy
+
+#endif
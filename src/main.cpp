@@ -9,6 +9,7 @@
 
 #include "database.h"
 #include "main_window.h"
+#include "tracing.h"
 #include "utils.h"
 
 int main(int argc, char* argv[]) {
@@ -27,24 +28,150 @@ int main(int argc, char* argv[]) {
   const QString export_docs_file = parser.value("export-docs");
   QString db_path = (args.length() == 0) ? QString() : args[0];
 
+  if (!labelbuddy::enable_tracing_from_environment()) {
+    std::cerr << "LABELBUDDY_TRACE must be 'summary' or 'chrome'" << std::endl;
+    return 1;
+  }
+  if (parser.isSet("trace")) {
+    labelbuddy::TraceFormat trace_format{};
+    if (!labelbuddy::parse_trace_format(parser.value("trace"), trace_format)) {
+      std::cerr << "--trace must be 'summary' or 'chrome'" << std::endl;
+      return 1;
+    }
+    labelbuddy::enable_tracing(trace_format, parser.value("trace-output"));
+  }
+
   if (labels_files.length() || docs_files.length() ||
       (export_labels_file != QString()) || (export_docs_file != QString()) ||
-      parser.isSet("vacuum")) {
+      parser.isSet("vacuum") || parser.isSet("pragma-profile") ||
+      parser.isSet("pre-annotate")) {
     if (db_path == QString()) {
       std::cerr << "Specify database path explicitly to import / export "
-                << "labels and documents or vacuum db" << std::endl;
+                << "labels and documents, pre-annotate documents, vacuum db "
+                << "or set its pragma profile" << std::endl;
+      return 1;
+    }
+    labelbuddy::BatchOptions options{};
+    bool is_int{};
+    options.n_export_threads = parser.value("export-threads").toInt(&is_int);
+    if (!is_int || options.n_export_threads < 1) {
+      std::cerr << "--export-threads must be a positive integer" << std::endl;
+      return 1;
+    }
+    options.export_shard_size = parser.value("shard-size").toInt(&is_int);
+    if (!is_int || options.export_shard_size < 0) {
+      std::cerr << "--shard-size must be a non-negative integer" << std::endl;
+      return 1;
+    }
+    options.import_checkpoint_interval =
+        parser.value("import-checkpoint").toInt(&is_int);
+    if (!is_int || options.import_checkpoint_interval < 0) {
+      std::cerr << "--import-checkpoint must be a non-negative integer"
+                << std::endl;
+      return 1;
+    }
+    options.import_max_doc_length =
+        parser.value("split-docs").toInt(&is_int);
+    if (!is_int || options.import_max_doc_length < 0) {
+      std::cerr << "--split-docs must be a non-negative integer" << std::endl;
+      return 1;
+    }
+    options.export_merge_segments = parser.isSet("merge-segments");
+    options.n_import_threads = parser.value("import-threads").toInt(&is_int);
+    if (!is_int || options.n_import_threads < 1) {
+      std::cerr << "--import-threads must be a positive integer" << std::endl;
       return 1;
     }
-    return labelbuddy::batch_import_export(
+    options.n_hashing_threads = parser.value("hash-threads").toInt(&is_int);
+    if (!is_int || options.n_hashing_threads < 0) {
+      std::cerr << "--hash-threads must be a non-negative integer"
+                << std::endl;
+      return 1;
+    }
+    options.stats_format = parser.value("stats");
+    if (parser.isSet("stats") && options.stats_format != "json") {
+      std::cerr << "--stats must be 'json'" << std::endl;
+      return 1;
+    }
+    options.pragma_profile = parser.value("pragma-profile");
+    options.bulk_load = parser.isSet("bulk-load");
+    options.separate_content = parser.isSet("separate-content");
+    options.compress_content = parser.isSet("compress-content");
+    options.read_only = parser.isSet("read-only");
+    options.export_since = parser.value("since");
+    if (parser.isSet("since") && options.export_since != "last") {
+      auto since = options.export_since.toLongLong(&is_int);
+      if (!is_int || since < 0) {
+        std::cerr << "--since must be a non-negative integer or 'last'"
+                  << std::endl;
+        return 1;
+      }
+    }
+    options.export_doc_filter = parser.value("doc-filter");
+    options.export_label_names = parser.values("label");
+    options.export_search_text = parser.value("search");
+    auto label_filter = options.export_doc_filter == "has-label" ||
+                        options.export_doc_filter == "not-has-label";
+    if (label_filter && options.export_label_names.isEmpty()) {
+      std::cerr << "--doc-filter " << options.export_doc_filter.toStdString()
+                << " needs at least one --label" << std::endl;
+      return 1;
+    }
+    if ((options.export_doc_filter == "search") != parser.isSet("search")) {
+      std::cerr << "--search must be used with --doc-filter search"
+                << std::endl;
+      return 1;
+    }
+    if (parser.isSet("min-doc-id")) {
+      options.export_min_doc_id = parser.value("min-doc-id").toInt(&is_int);
+      if (!is_int || options.export_min_doc_id < 0) {
+        std::cerr << "--min-doc-id must be a non-negative integer"
+                  << std::endl;
+        return 1;
+      }
+    }
+    if (parser.isSet("max-doc-id")) {
+      options.export_max_doc_id = parser.value("max-doc-id").toInt(&is_int);
+      if (!is_int || options.export_max_doc_id < 0) {
+        std::cerr << "--max-doc-id must be a non-negative integer"
+                  << std::endl;
+        return 1;
+      }
+    }
+    options.pre_annotate_command = parser.value("pre-annotate");
+    options.pre_annotate_batch_size =
+        parser.value("pre-annotate-batch-size").toInt(&is_int);
+    if (!is_int || options.pre_annotate_batch_size < 1) {
+      std::cerr << "--pre-annotate-batch-size must be a positive integer"
+                << std::endl;
+      return 1;
+    }
+    options.pre_annotate_n_processes =
+        parser.value("pre-annotate-jobs").toInt(&is_int);
+    if (!is_int || options.pre_annotate_n_processes < 1) {
+      std::cerr << "--pre-annotate-jobs must be a positive integer"
+                << std::endl;
+      return 1;
+    }
+    auto status = labelbuddy::batch_import_export(
         db_path, labels_files, docs_files, export_labels_file, export_docs_file,
         parser.isSet("labelled-only"), !parser.isSet("no-text"),
         !parser.isSet("no-annotations"), parser.value("approver"),
-        parser.isSet("vacuum"));
+        parser.isSet("vacuum"), options);
+    labelbuddy::write_trace();
+    return status;
   }
 
+  if (parser.isSet("read-only")) {
+    std::cerr << "--read-only can only be used with --export-labels or "
+              << "--export-docs" << std::endl;
+    return 1;
+  }
   std::unique_ptr<labelbuddy::LabelBuddy> label_buddy(
       new labelbuddy::LabelBuddy(nullptr, db_path, parser.isSet("demo")));
   app.setWindowIcon(QIcon(":/data/icons/LB.png"));
   label_buddy->show();
-  return app.exec();
+  auto status = app.exec();
+  labelbuddy::write_trace();
+  return status;
 }
@@ -33,6 +33,10 @@ void LabelBuddy::warn_failed_to_open_db(const QString& database_path) {
   assert(!QSqlDatabase::contains(database_path));
   QString db_msg(
       database_path != QString() ? QString(":\n%0").arg(database_path) : "");
+  auto reason = database_catalog.get_open_error();
+  if (reason != QString()) {
+    db_msg += QString("\n%0").arg(reason);
+  }
   QMessageBox::critical(this, "labelbuddy",
                         QString("Could not open database%0").arg(db_msg),
                         QMessageBox::Ok);
@@ -52,13 +56,25 @@ LabelBuddy::LabelBuddy(QWidget* parent, const QString& database_path,
   notebook->addTab(import_export_menu, "&Import / Export");
 
   doc_model = new DocListModel(this);
+  // the Dataset tab's contents are only queried once it is shown
+  doc_model->set_deferred_loading(true);
+  doc_model->set_asynchronous_counts(true);
+  // one list of all the matching documents, read as it is scrolled
+  doc_model->set_default_page_size(0);
   doc_model->set_database(database_catalog.get_current_database());
   label_model = new LabelListModel(this);
   label_model->set_database(database_catalog.get_current_database());
+  label_stats_model = new LabelStatsModel(this);
+  label_stats_model->set_deferred_loading(true);
+  label_stats_model->set_database(database_catalog.get_current_database());
   annotations_model = new AnnotationsModel(this);
+  annotations_model->set_asynchronous_loading(true);
   annotations_model->set_database(database_catalog.get_current_database());
+  label_model->set_label_cache(database_catalog.get_label_cache());
+  annotations_model->set_label_cache(database_catalog.get_label_cache());
   dataset_menu->set_doc_list_model(doc_model);
   dataset_menu->set_label_list_model(label_model);
+  dataset_menu->set_label_stats_model(label_stats_model);
   annotator->set_annotations_model(annotations_model);
   annotator->set_label_list_model(label_model);
 
@@ -69,6 +85,7 @@ LabelBuddy::LabelBuddy(QWidget* parent, const QString& database_path,
   add_connections();
   add_welcome_label();
 
+  database_catalog.set_asynchronous_backfill(true);
   bool opened{};
   if (start_from_temp_db) {
     database_catalog.open_temp_database();
@@ -96,6 +113,9 @@ void LabelBuddy::add_connections() {
 
   QObject::connect(doc_model, &DocListModel::docs_deleted, annotations_model,
                    &AnnotationsModel::check_current_doc);
+  // before the annotator reads the annotations again
+  QObject::connect(label_model, &LabelListModel::labels_changed,
+                   annotations_model, &AnnotationsModel::invalidate_cache);
   QObject::connect(label_model, &LabelListModel::labels_changed, annotator,
                    &Annotator::update_annotations);
   QObject::connect(label_model, &LabelListModel::labels_changed, annotator,
@@ -115,6 +135,25 @@ void LabelBuddy::add_connections() {
   QObject::connect(annotations_model, &AnnotationsModel::document_lost_label,
                    doc_model, &DocListModel::document_lost_label);
 
+  QObject::connect(annotations_model, &AnnotationsModel::document_gained_label,
+                   label_stats_model, &LabelStatsModel::document_gained_label);
+  QObject::connect(annotations_model, &AnnotationsModel::document_lost_label,
+                   label_stats_model, &LabelStatsModel::document_lost_label);
+  QObject::connect(annotations_model, &AnnotationsModel::annotation_added,
+                   label_stats_model, &LabelStatsModel::annotation_added);
+  QObject::connect(annotations_model, &AnnotationsModel::annotation_removed,
+                   label_stats_model, &LabelStatsModel::annotation_removed);
+  QObject::connect(label_model, &LabelListModel::labels_changed,
+                   label_stats_model, &LabelStatsModel::refresh_labels);
+  QObject::connect(label_model, &LabelListModel::labels_order_changed,
+                   label_stats_model, &LabelStatsModel::refresh_labels);
+  QObject::connect(import_export_menu, &ImportExportMenu::labels_added,
+                   label_stats_model, &LabelStatsModel::refresh_labels);
+  QObject::connect(import_export_menu, &ImportExportMenu::documents_added,
+                   label_stats_model, &LabelStatsModel::refresh_stats);
+  QObject::connect(doc_model, &DocListModel::docs_deleted, label_stats_model,
+                   &LabelStatsModel::refresh_stats);
+
   QObject::connect(import_export_menu, &ImportExportMenu::documents_added,
                    doc_model, &DocListModel::refresh_current_query);
   QObject::connect(import_export_menu, &ImportExportMenu::labels_added,
@@ -137,6 +176,8 @@ void LabelBuddy::add_connections() {
                    &DocListModel::set_database);
   QObject::connect(this, &LabelBuddy::database_changed, label_model,
                    &LabelListModel::set_database);
+  QObject::connect(this, &LabelBuddy::database_changed, label_stats_model,
+                   &LabelStatsModel::set_database);
   QObject::connect(this, &LabelBuddy::database_changed, annotations_model,
                    &AnnotationsModel::set_database);
   QObject::connect(this, &LabelBuddy::database_changed, import_export_menu,
@@ -146,6 +187,12 @@ void LabelBuddy::add_connections() {
                    &DatasetMenu::store_state, Qt::DirectConnection);
   QObject::connect(this, &LabelBuddy::about_to_close, annotator,
                    &Annotator::store_state, Qt::DirectConnection);
+  QObject::connect(this, &LabelBuddy::about_to_close, annotations_model,
+                   &AnnotationsModel::commit_pending_writes,
+                   Qt::DirectConnection);
+  // the other tabs modify the database with their own transactions
+  QObject::connect(notebook, &QTabWidget::currentChanged, annotations_model,
+                   &AnnotationsModel::commit_pending_writes);
 
   QObject::connect(this, &LabelBuddy::database_changed, this,
                    &LabelBuddy::update_status_bar);
@@ -153,6 +200,8 @@ void LabelBuddy::add_connections() {
                    &LabelBuddy::update_window_title);
   QObject::connect(doc_model, &DocListModel::docs_deleted, this,
                    &LabelBuddy::update_status_bar);
+  QObject::connect(doc_model, &DocListModel::counts_updated, this,
+                   &LabelBuddy::update_status_bar);
   QObject::connect(label_model, &LabelListModel::labels_deleted, this,
                    &LabelBuddy::update_status_bar);
   QObject::connect(import_export_menu, &ImportExportMenu::documents_added, this,
@@ -17,6 +17,7 @@
 #include "doc_list_model.h"
 #include "import_export_menu.h"
 #include "label_list_model.h"
+#include "label_stats_model.h"
 
 /// \file
 /// Main window, containing the menu bar and Annotate, Dataset, I/E tabs.
@@ -112,6 +113,7 @@ private slots:
 private:
   DocListModel* doc_model;
   LabelListModel* label_model;
+  LabelStatsModel* label_stats_model;
   AnnotationsModel* annotations_model;
   QTabWidget* notebook;
   Annotator* annotator;
@@ -0,0 +1,39 @@
+#include <utility>
+
+#include <QHash>
+
+#include "pending_writes.h"
+
+namespace labelbuddy {
+
+namespace {
+
+QHash<QString, std::function<void()>>& registered_commits() {
+  static QHash<QString, std::function<void()>> commits{};
+  return commits;
+}
+
+} // namespace
+
+void set_pending_writes(const QString& connection_name,
+                        std::function<void()> commit) {
+  registered_commits()[connection_name] = std::move(commit);
+}
+
+void clear_pending_writes(const QString& connection_name) {
+  registered_commits().remove(connection_name);
+}
+
+bool flush_pending_writes(const QString& connection_name) {
+  auto& commits = registered_commits();
+  auto commit = commits.constFind(connection_name);
+  if (commit == commits.constEnd()) {
+    return true;
+  }
+  // copied: `commit` is removed from the table when it succeeds
+  auto commit_function = commit.value();
+  commit_function();
+  return !commits.contains(connection_name);
+}
+
+} // namespace labelbuddy
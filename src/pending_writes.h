@@ -0,0 +1,39 @@
+#ifndef LABELBUDDY_PENDING_WRITES_H
+#define LABELBUDDY_PENDING_WRITES_H
+
+#include <functional>
+
+#include <QString>
+
+/// \file
+/// Writes held in an open transaction of a connection, and committed before
+/// anything else needs that connection's transactions or the write lock.
+
+namespace labelbuddy {
+
+/// Register the function committing the transaction held on a connection.
+
+/// The annotations model groups its changes in a transaction of the GUI's
+/// connection (see `AnnotationsModel::commit_pending_writes`). While it is
+/// open, a transaction started by other code on the same connection would
+/// fail or be committed with it, and other connections cannot write. So
+/// whatever starts a transaction on that connection, or a job that writes
+/// with its own connection, first calls `flush_pending_writes`, which calls
+/// `commit`. `commit` must call `clear_pending_writes` once the transaction
+/// is committed. There is at most one for each connection; these functions
+/// are only used from the thread that owns the connection.
+void set_pending_writes(const QString& connection_name,
+                        std::function<void()> commit);
+
+/// Forget the function registered with `set_pending_writes`
+void clear_pending_writes(const QString& connection_name);
+
+/// Commit the transaction held on a connection, if there is one.
+
+/// Returns `false` if it is still open afterwards, eg because another
+/// connection kept the database locked for longer than the busy timeout.
+bool flush_pending_writes(const QString& connection_name);
+
+} // namespace labelbuddy
+
+#endif
@@ -0,0 +1,184 @@
+#include <cassert>
+#include <utility>
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QStringList>
+
+#include "pre_annotation.h"
+#include "tracing.h"
+
+namespace labelbuddy {
+
+namespace {
+
+/// how long the processes are given to exit once their input is closed
+const int exit_timeout_ms{30000};
+
+} // namespace
+
+PreAnnotationPool::PreAnnotationPool(const QString& command, int n_processes)
+    : command_{command}, n_processes_{n_processes} {
+  assert(n_processes_ > 0);
+}
+
+PreAnnotationPool::~PreAnnotationPool() {
+  for (auto& process : processes_) {
+    if (process->state() == QProcess::NotRunning) {
+      continue;
+    }
+    // the command's input ends, which should make it exit
+    process->closeWriteChannel();
+    if (!process->waitForFinished(exit_timeout_ms)) {
+      process->kill();
+      process->waitForFinished();
+    }
+  }
+}
+
+bool PreAnnotationPool::start() {
+  TraceScope trace("PreAnnotationPool::start");
+  for (int i = 0; i != n_processes_; ++i) {
+    std::unique_ptr<QProcess> process(new QProcess);
+    process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+#ifdef Q_OS_WIN
+    // passed as is so that cmd.exe, not QProcess, handles the quoting
+    process->setNativeArguments(QString("/c %0").arg(command_));
+    process->start("cmd.exe", QStringList{});
+#else
+    process->start("/bin/sh", QStringList{"-c", command_});
+#endif
+    auto started = process->waitForStarted(-1);
+    processes_.push_back(std::move(process));
+    if (!started) {
+      error_message_ = QString("Could not start the pre-annotation command: %0")
+                           .arg(processes_.back()->errorString());
+      return false;
+    }
+  }
+  return true;
+}
+
+bool PreAnnotationPool::can_submit() const {
+  return n_pending() < n_processes_;
+}
+
+int PreAnnotationPool::n_pending() const {
+  return static_cast<int>(pending_.size());
+}
+
+bool PreAnnotationPool::submit(const QVector<QPair<int, QString>>& docs) {
+  assert(can_submit());
+  assert(static_cast<int>(processes_.size()) == n_processes_);
+  TraceScope trace("PreAnnotationPool::submit");
+  // batches are taken in the order they were submitted, so the process
+  // freed by `take_result` is always the next one in this rotation
+  auto& process = *processes_[static_cast<std::size_t>(next_process_)];
+  Batch batch{};
+  batch.process_index = next_process_;
+  next_process_ = (next_process_ + 1) % n_processes_;
+  QJsonArray docs_json{};
+  for (const auto& doc : docs) {
+    QJsonObject doc_json{};
+    doc_json["id"] = doc.first;
+    doc_json["text"] = doc.second;
+    docs_json.append(doc_json);
+    batch.doc_lengths.insert(doc.first, n_code_points(doc.second));
+  }
+  pending_.push_back(std::move(batch));
+  // compact JSON has no line breaks, as they are escaped in strings
+  auto line = QJsonDocument(docs_json).toJson(QJsonDocument::Compact);
+  line.append('\n');
+  auto written = process.write(line) == line.size();
+  // without an event loop the data is only sent by the `waitFor` functions,
+  // which write one chunk at a time
+  while (written && process.bytesToWrite() > 0) {
+    written = process.waitForBytesWritten(-1);
+  }
+  if (!written) {
+    error_message_ =
+        QString("Could not write to the pre-annotation command: %0")
+            .arg(process.errorString());
+  }
+  return written;
+}
+
+bool PreAnnotationPool::read_line(QProcess& process, QByteArray& line) {
+  while (!process.canReadLine()) {
+    if (!process.waitForReadyRead(-1)) {
+      if (process.bytesAvailable() > 0) {
+        // the last line, not terminated before the process exited
+        line = process.readAll();
+        return true;
+      }
+      error_message_ =
+          process.state() == QProcess::NotRunning
+              ? QString("The pre-annotation command exited before answering.")
+              : QString("Could not read the pre-annotation command's "
+                        "answer: %0")
+                    .arg(process.errorString());
+      return false;
+    }
+  }
+  line = process.readLine();
+  return true;
+}
+
+bool PreAnnotationPool::take_result(
+    std::vector<PredictedAnnotations>& result) {
+  assert(!pending_.empty());
+  TraceScope trace("PreAnnotationPool::take_result");
+  result.clear();
+  auto batch = std::move(pending_.front());
+  pending_.pop_front();
+  QByteArray line{};
+  if (!read_line(*processes_[static_cast<std::size_t>(batch.process_index)],
+                 line)) {
+    return false;
+  }
+  QJsonParseError parse_error{};
+  auto answer = QJsonDocument::fromJson(line, &parse_error);
+  if (!answer.isArray()) {
+    error_message_ =
+        QString("The answer of the pre-annotation command is not a JSON "
+                "array: %0")
+            .arg(parse_error.error == QJsonParseError::NoError
+                     ? QString("unexpected value")
+                     : parse_error.errorString());
+    return false;
+  }
+  const auto docs_json = answer.array();
+  result.reserve(static_cast<std::size_t>(docs_json.size()));
+  for (const auto& doc_value : docs_json) {
+    const auto doc_json = doc_value.toObject();
+    auto doc_length = batch.doc_lengths.constFind(doc_json["id"].toInt(-1));
+    if (doc_length == batch.doc_lengths.constEnd()) {
+      continue;
+    }
+    PredictedAnnotations predicted{};
+    predicted.doc_id = doc_length.key();
+    const auto labels = doc_json["labels"].toArray();
+    predicted.annotations.reserve(static_cast<std::size_t>(labels.size()));
+    for (const auto& label : labels) {
+      const auto annotation = label.toArray();
+      auto start_char = annotation[0].toInt(-1);
+      auto end_char = annotation[1].toInt(-1);
+      auto label_name = annotation[2].toString();
+      if (start_char < 0 || end_char <= start_char ||
+          end_char > doc_length.value() || label_name.isEmpty()) {
+        continue;
+      }
+      predicted.annotations.push_back(
+          {start_char, end_char, label_name,
+           annotation.size() == 4 ? annotation[3].toString() : QString()});
+    }
+    result.push_back(std::move(predicted));
+  }
+  return true;
+}
+
+QString PreAnnotationPool::error_message() const { return error_message_; }
+
+} // namespace labelbuddy
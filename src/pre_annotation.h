@@ -0,0 +1,106 @@
+#ifndef LABELBUDDY_PRE_ANNOTATION_H
+#define LABELBUDDY_PRE_ANNOTATION_H
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <QHash>
+#include <QPair>
+#include <QProcess>
+#include <QString>
+#include <QVector>
+
+#include "database.h"
+
+/// \file
+/// Running an external model over batches of documents to pre-annotate them.
+
+namespace labelbuddy {
+
+/// Annotations predicted by the pre-annotation command for one document
+struct PredictedAnnotations {
+  int doc_id;
+  std::vector<AnnotationRecord> annotations;
+};
+
+/// Sends batches of documents to processes running a model and reads the
+/// annotations they predict.
+
+/// `command` is run by the shell (`/bin/sh -c`, or `cmd /c` on Windows)
+/// `n_processes` times. Each process handles one batch at a time, so up to
+/// `n_processes` batches are annotated concurrently, and the model can be
+/// loaded once per process rather than once per batch.
+///
+/// A batch is written to the standard input of a process as one line holding
+/// a JSON array of `{"id": <document id>, "text": <document text>}` objects.
+/// The process answers with one line on its standard output, holding a JSON
+/// array of `{"id": <document id>, "labels": [[<start>, <end>, <label>], ...]}`
+/// objects. As in imported documents, positions are offsets in unicode code
+/// points, `end` is excluded and an optional fourth element is the
+/// annotation's extra data. Documents may be left out of the answer; ids that
+/// were not in the batch and annotations outside of the text are ignored. The
+/// processes' standard error is forwarded to labelbuddy's.
+///
+/// Results are returned in the order in which the batches were submitted.
+/// Processes are driven from the calling thread with the blocking `QProcess`
+/// functions, so no event loop is needed.
+class PreAnnotationPool {
+public:
+  PreAnnotationPool(const QString& command, int n_processes);
+
+  /// Closes the processes' standard input and waits for them to exit
+  ~PreAnnotationPool();
+
+  PreAnnotationPool(const PreAnnotationPool&) = delete;
+  PreAnnotationPool& operator=(const PreAnnotationPool&) = delete;
+
+  /// Start the processes.
+
+  /// Returns false (see `error_message`) if one of them could not be started.
+  bool start();
+
+  /// Whether a process is idle, ie fewer than `n_processes` batches are
+  /// pending
+  bool can_submit() const;
+
+  /// Number of submitted batches whose result has not been taken yet
+  int n_pending() const;
+
+  /// Send a batch of (id, text) pairs to the next idle process.
+
+  /// Must only be called if `can_submit` is true. Returns false if the batch
+  /// could not be written, eg because the process exited.
+  bool submit(const QVector<QPair<int, QString>>& docs);
+
+  /// Wait for the result of the oldest pending batch.
+
+  /// Returns false if the process exited before answering or its answer is
+  /// not a JSON array; the batch is no longer pending in either case.
+  bool take_result(std::vector<PredictedAnnotations>& result);
+
+  /// Description of the last error
+  QString error_message() const;
+
+private:
+  struct Batch {
+    int process_index;
+    /// length in code points of each document of the batch
+    QHash<int, int> doc_lengths;
+  };
+
+  /// Read one line from `process`, waiting as long as necessary
+  bool read_line(QProcess& process, QByteArray& line);
+
+  QString command_;
+  int n_processes_;
+  std::vector<std::unique_ptr<QProcess>> processes_{};
+  /// batches of the busy processes, oldest first
+  std::deque<Batch> pending_{};
+  int next_process_{};
+  QString error_message_{};
+};
+
+} // namespace labelbuddy
+
+#endif
@@ -1,4 +1,7 @@
+#include <algorithm>
+
 #include <QAbstractSlider>
+#include <QColor>
 #include <QAction>
 #include <QEvent>
 #include <QHBoxLayout>
@@ -11,7 +14,9 @@
 #include <QPoint>
 #include <QPushButton>
 #include <QScrollBar>
+#include <QSignalBlocker>
 #include <QStyle>
+#include <QTextBlock>
 #include <QTextDocument>
 #include <QVBoxLayout>
 #include <QWidget>
@@ -20,6 +25,35 @@
 
 namespace labelbuddy {
 
+namespace {
+
+/// characters searched for a line break when choosing a window boundary
+const int max_line_search{1 << 12};
+
+/// position close after `position` where a window can start or end
+
+/// Preferably the start of a line, and never inside a surrogate pair.
+int window_boundary(const QString& content, int position) {
+  if (position <= 0) {
+    return 0;
+  }
+  if (position >= content.size()) {
+    return content.size();
+  }
+  auto search_end = std::min(content.size(), position + max_line_search);
+  for (auto i = position - 1; i < search_end; ++i) {
+    if (content[i] == QChar('\n')) {
+      return i + 1;
+    }
+  }
+  if (content[position].isLowSurrogate()) {
+    return position + 1;
+  }
+  return position;
+}
+
+} // namespace
+
 SearchableText::SearchableText(QWidget* parent) : QWidget(parent) {
   QVBoxLayout* top_layout = new QVBoxLayout();
   setLayout(top_layout);
@@ -45,6 +79,8 @@ SearchableText::SearchableText(QWidget* parent) : QWidget(parent) {
   search_bar_layout->addWidget(find_prev_button);
   find_next_button = new QPushButton();
   search_bar_layout->addWidget(find_next_button);
+  match_count_label = new QLabel();
+  search_bar_layout->addWidget(match_count_label);
   find_prev_button->setIcon(
       QIcon::fromTheme("go-up", QIcon(":data/icons/go-up.png")));
   find_next_button->setIcon(
@@ -62,18 +98,127 @@ SearchableText::SearchableText(QWidget* parent) : QWidget(parent) {
                    &SearchableText::search_backward);
   QObject::connect(search_box, &QLineEdit::textChanged, this,
                    &SearchableText::update_search_button_states);
+  QObject::connect(search_box, &QLineEdit::textChanged, this,
+                   &SearchableText::update_matches);
+  QObject::connect(this, &SearchableText::matches_found, this,
+                   &SearchableText::store_matches, Qt::QueuedConnection);
 
   QObject::connect(text_edit, &QPlainTextEdit::selectionChanged, this,
                    &SearchableText::set_cursor_position);
+  QObject::connect(text_edit->verticalScrollBar(), &QScrollBar::valueChanged,
+                   this, &SearchableText::follow_scroll);
   update_search_button_states();
 }
 
 void SearchableText::fill(const QString& content) {
-  text_edit->setPlainText(content);
+  content_ = content;
+  window_start_ = 0;
+  window_end_ = is_large_document() ? window_boundary(content_, window_size_)
+                                    : content_.size();
+  text_edit->setPlainText(content_.left(window_end_));
   text_edit->setProperty("readOnly", true);
+  update_matches();
   this->setFocus();
 }
 
+void SearchableText::set_large_document_size(int min_size, int window_size) {
+  large_document_size_ = min_size;
+  window_size_ = window_size;
+}
+
+bool SearchableText::is_large_document() const {
+  return content_.size() > large_document_size_;
+}
+
+QPair<int, int> SearchableText::loaded_range() const {
+  return {window_start_, window_end_};
+}
+
+int SearchableText::to_content_position(int text_edit_position) const {
+  return window_start_ + text_edit_position;
+}
+
+int SearchableText::to_text_edit_position(int content_position) const {
+  return std::max(0, std::min(content_position, window_end_) - window_start_);
+}
+
+QTextCursor SearchableText::cursor_for_range(int start, int end) const {
+  QTextCursor cursor(text_edit->document());
+  cursor.setPosition(to_text_edit_position(start));
+  cursor.setPosition(to_text_edit_position(end), QTextCursor::KeepAnchor);
+  return cursor;
+}
+
+void SearchableText::move_cursor_to(int position) {
+  ensure_loaded(position, position);
+  text_edit->setTextCursor(cursor_for_range(position, position));
+  text_edit->ensureCursorVisible();
+}
+
+void SearchableText::ensure_loaded(int start, int end) {
+  if (!is_large_document()) {
+    return;
+  }
+  if (start < window_start_ || end > window_end_) {
+    load_window(start);
+  }
+}
+
+void SearchableText::load_window(int position) {
+  auto start = std::max(
+      0, std::min(position - window_size_ / 2, content_.size() - window_size_));
+  start = window_boundary(content_, start);
+  auto end = window_boundary(content_, start + window_size_);
+  if (start == window_start_ && end == window_end_) {
+    return;
+  }
+  auto cursor = text_edit->textCursor();
+  auto anchor = to_content_position(cursor.anchor());
+  auto cursor_position = to_content_position(cursor.position());
+  auto top = to_content_position(
+      text_edit->cursorForPosition(text_edit->viewport()->rect().topLeft())
+          .position());
+  loading_window_ = true;
+  {
+    // the selection does not change in the content, only in the text edit
+    QSignalBlocker blocker(text_edit);
+    window_start_ = start;
+    window_end_ = end;
+    text_edit->setPlainText(content_.mid(start, end - start));
+    auto new_cursor = cursor_for_range(anchor, cursor_position);
+    text_edit->setTextCursor(new_cursor);
+    auto top_block =
+        text_edit->document()->findBlock(to_text_edit_position(top));
+    text_edit->verticalScrollBar()->setValue(top_block.blockNumber());
+  }
+  loading_window_ = false;
+  last_match = text_edit->textCursor();
+  emit window_changed();
+}
+
+void SearchableText::follow_scroll() {
+  auto scroll_bar = text_edit->verticalScrollBar();
+  auto value = scroll_bar->value();
+  auto scrolled_down = value > scroll_value_;
+  scroll_value_ = value;
+  if (loading_window_ || !is_large_document()) {
+    return;
+  }
+  // only in the scrolling direction, in case the window is not much taller
+  // than the viewport
+  auto near_start = !scrolled_down && window_start_ > 0 &&
+                    value <= scroll_bar->minimum() + scroll_bar->pageStep();
+  auto near_end = scrolled_down && window_end_ < content_.size() &&
+                  value >= scroll_bar->maximum() - scroll_bar->pageStep();
+  if (!near_start && !near_end) {
+    return;
+  }
+  // the top of the viewport ends up in the middle of the new window
+  load_window(to_content_position(
+      text_edit->cursorForPosition(text_edit->viewport()->rect().topLeft())
+          .position()));
+}
+
 void SearchableText::update_search_button_states() {
   auto has_pattern = search_box->text() != QString();
   find_next_button->setEnabled(has_pattern);
@@ -98,6 +243,10 @@ void SearchableText::search(QTextDocument::FindFlags flags) {
     last_match =
         (flags & QTextDocument::FindBackward) ? bottom_right : top_left;
   }
+  if (matches_ready_ && matches_pattern_ == pattern) {
+    select_indexed_match(flags);
+    return;
+  }
   auto found = document->find(pattern, last_match, flags);
   if (found.isNull()) {
     auto new_cursor = text_edit->textCursor();
@@ -114,8 +263,119 @@ void SearchableText::search(QTextDocument::FindFlags flags) {
   }
 }
 
+void SearchableText::select_indexed_match(QTextDocument::FindFlags flags) {
+  if (matches_.isEmpty()) {
+    return;
+  }
+  int match_idx{};
+  if (flags & QTextDocument::FindBackward) {
+    // the last match starting before the selection, or the last one
+    auto match =
+        std::lower_bound(matches_.cbegin(), matches_.cend(),
+                         to_content_position(last_match.selectionStart()));
+    match_idx = match == matches_.cbegin()
+                    ? matches_.size() - 1
+                    : static_cast<int>(match - matches_.cbegin()) - 1;
+  } else {
+    // the first match starting after the selection, or the first one
+    auto match =
+        std::lower_bound(matches_.cbegin(), matches_.cend(),
+                         to_content_position(last_match.selectionEnd()));
+    match_idx = match == matches_.cend()
+                    ? 0
+                    : static_cast<int>(match - matches_.cbegin());
+  }
+  auto match_end = matches_[match_idx] + matches_pattern_.size();
+  ensure_loaded(matches_[match_idx], match_end);
+  last_match = cursor_for_range(matches_[match_idx], match_end);
+  text_edit->setTextCursor(last_match);
+  current_match_ = match_idx;
+  update_match_count_label();
+}
+
+int SearchableText::n_matches() const {
+  return matches_ready_ ? matches_.size() : -1;
+}
+
+QList<QTextEdit::ExtraSelection>
+SearchableText::match_highlights(int start, int end) const {
+  QList<QTextEdit::ExtraSelection> highlights{};
+  if (!matches_ready_ || matches_.isEmpty()) {
+    return highlights;
+  }
+  QTextCharFormat format{};
+  format.setBackground(QColor("#fff176"));
+  auto match_size = matches_pattern_.size();
+  // only the loaded part of the content can be highlighted
+  start = std::max(start, window_start_);
+  end = std::min(end, window_end_);
+  // matches do not overlap, earlier ones end before `start`
+  for (auto match = std::lower_bound(matches_.cbegin(), matches_.cend(),
+                                     start - match_size + 1);
+       match != matches_.cend() && *match < end; ++match) {
+    highlights << QTextEdit::ExtraSelection{
+        cursor_for_range(*match, *match + match_size), format};
+  }
+  return highlights;
+}
+
+void SearchableText::update_matches() {
+  ++last_match_request_id_;
+  matches_pattern_ = search_box->text();
+  matches_.clear();
+  current_match_ = -1;
+  matches_ready_ = matches_pattern_.isEmpty();
+  if (!matches_ready_) {
+    if (match_finder_ == nullptr) {
+      auto on_found = [this](int request_id) {
+        emit matches_found(request_id);
+      };
+      match_finder_.reset(new MatchFindingThread(on_found));
+    }
+    match_finder_->request(last_match_request_id_, content_, matches_pattern_);
+  }
+  update_match_count_label();
+  emit matches_changed();
+}
+
+void SearchableText::store_matches(int request_id) {
+  if (request_id != last_match_request_id_ || match_finder_ == nullptr) {
+    return;
+  }
+  if (!match_finder_->take_result(request_id, matches_)) {
+    return;
+  }
+  matches_ready_ = true;
+  update_match_count_label();
+  emit matches_changed();
+}
+
+void SearchableText::update_match_count_label() {
+  if (matches_pattern_.isEmpty()) {
+    match_count_label->setText("");
+    return;
+  }
+  if (!matches_ready_) {
+    match_count_label->setText("...");
+    return;
+  }
+  if (current_match_ != -1) {
+    match_count_label->setText(
+        QString("%0 of %1").arg(current_match_ + 1).arg(matches_.size()));
+    return;
+  }
+  match_count_label->setText(QString("%0 match%1")
+                                 .arg(matches_.size())
+                                 .arg(matches_.size() != 1 ? "es" : ""));
+}
+
 void SearchableText::set_cursor_position() {
   last_match = text_edit->textCursor();
+  // `select_indexed_match` sets the current match after moving the cursor
+  if (current_match_ != -1) {
+    current_match_ = -1;
+    update_match_count_label();
+  }
 }
 
 void SearchableText::swap_pos_anchor(QTextCursor& cursor) const {
@@ -284,12 +544,14 @@ void SearchableText::handle_nav_event(QKeyEvent* event) {
   }
   if (event->key() == Qt::Key_End ||
       event->matches(QKeySequence::MoveToEndOfDocument)) {
+    ensure_loaded(content_.size(), content_.size());
     text_edit->verticalScrollBar()->triggerAction(
         QAbstractSlider::SliderToMaximum);
     return;
   }
   if (event->key() == Qt::Key_Home ||
       event->matches(QKeySequence::MoveToStartOfDocument)) {
+    ensure_loaded(0, 0);
     text_edit->verticalScrollBar()->triggerAction(
         QAbstractSlider::SliderToMinimum);
     return;
@@ -388,6 +650,7 @@ QLineEdit* SearchableText::get_search_box() { return search_box; }
 
 QList<int> SearchableText::current_selection() const {
   QTextCursor cursor = text_edit->textCursor();
-  return QList<int>{cursor.selectionStart(), cursor.selectionEnd()};
+  return QList<int>{to_content_position(cursor.selectionStart()),
+                    to_content_position(cursor.selectionEnd())};
 }
 } // namespace labelbuddy
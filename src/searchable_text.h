@@ -1,14 +1,21 @@
 #ifndef LABELBUDDY_SEARCHABLE_TEXT_H
 #define LABELBUDDY_SEARCHABLE_TEXT_H
 
+#include <memory>
+
 #include <QEvent>
 #include <QKeyEvent>
+#include <QLabel>
 #include <QLineEdit>
+#include <QPair>
 #include <QPlainTextEdit>
 #include <QPushButton>
 #include <QTextCursor>
+#include <QTextEdit>
+#include <QVector>
 #include <QWidget>
 
+#include "text_search.h"
 #include "utils.h"
 
 /// \file
@@ -17,20 +24,57 @@
 namespace labelbuddy {
 
 /// read-only plain text display with a search bar and some custom key bindings.
+
+/// Large documents (see `set_large_document_size`) are not laid out at once:
+/// the text edit only holds a window of the content around the cursor, and
+/// another window is loaded when scrolling reaches the end of the current one
+/// or when moving to a position outside of it. Positions in the text edit are
+/// then offsets from the start of the window; the functions taking or
+/// returning positions in the content convert them.
 class SearchableText : public QWidget {
 
   Q_OBJECT
 
 public:
+  /// default minimum size, in UTF-16 code units, of a large document
+  static constexpr int default_large_document_size{1 << 22};
+
+  /// default size of the window loaded for large documents
+  static constexpr int default_window_size{1 << 20};
+
   SearchableText(QWidget* parent = nullptr);
 
   void fill(const QString& content);
 
+  /// Content sizes above which only a window of `window_size` is loaded
+
+  /// Takes effect when the text is filled again.
+  void set_large_document_size(int min_size, int window_size);
+
   /// start and end character positions for the currently selected text.
 
-  /// returns `{start, end}`
+  /// returns `{start, end}`, positions in the whole content
   QList<int> current_selection() const;
 
+  /// `{start, end}` of the part of the content loaded in the text edit
+  QPair<int, int> loaded_range() const;
+
+  /// Position in the content of a position in the text edit
+  int to_content_position(int text_edit_position) const;
+
+  /// Position in the text edit of a position in the content
+
+  /// Positions outside of the loaded range are clamped to its boundaries.
+  int to_text_edit_position(int content_position) const;
+
+  /// Cursor selecting [`start`, `end`) in the content, clamped to the window
+  QTextCursor cursor_for_range(int start, int end) const;
+
+  /// Put the cursor at `position` in the content and make it visible
+
+  /// Loads another window first if `position` is not in the current one.
+  void move_cursor_to(int position);
+
   /// The QPlainTextEdit's textCursor
   QTextCursor textCursor() const;
 
@@ -40,6 +84,29 @@ public:
   /// Get a pointer to the child search line
   QLineEdit* get_search_box();
 
+  /// Number of matches for the search box's text, -1 while they are counted
+
+  /// The matches are found in a background thread each time the text or the
+  /// pattern changes; until then searching uses `QTextDocument::find`.
+  int n_matches() const;
+
+  /// Selections highlighting the matches that intersect [`start`, `end`)
+
+  /// The text edit's extra selections are managed by the `Annotator`, which
+  /// adds these to the ones showing the annotations.
+  QList<QTextEdit::ExtraSelection> match_highlights(int start, int end) const;
+
+signals:
+
+  /// The matches are ready, or have been cleared
+  void matches_changed();
+
+  /// Another part of a large document has been loaded in the text edit
+  void window_changed();
+
+  /// Emitted from the search thread, handled asynchronously by `this`
+  void matches_found(int request_id);
+
 public slots:
 
   void search(QTextDocument::FindFlags flags = QTextDocument::FindFlags());
@@ -58,15 +125,58 @@ private slots:
   /// enable next/prev buttons iff search box is not empty
   void update_search_button_states();
 
+  /// start finding the matches of the search box's text
+  void update_matches();
+
+  /// retrieve the result of the search thread
+  void store_matches(int request_id);
+
+  /// load another window when scrolling close to the end of the current one
+  void follow_scroll();
+
 private:
   QPlainTextEdit* text_edit;
   QLineEdit* search_box;
   QPushButton* find_prev_button;
   QPushButton* find_next_button;
+  QLabel* match_count_label;
 
   QTextCursor last_match;
   QTextDocument::FindFlags current_search_flags;
 
+  /// select the next match in the index, starting from `last_match`
+  void select_indexed_match(QTextDocument::FindFlags flags);
+
+  /// show "N of M" or the number of matches
+  void update_match_count_label();
+
+  /// whether only a window of the content is loaded
+  bool is_large_document() const;
+
+  /// load the window around `position` if [`start`, `end`) is not loaded
+  void ensure_loaded(int start, int end);
+
+  /// load the window around `position` in the content
+
+  /// The selection and the top of the viewport are kept where they are in
+  /// the content if they are in the new window.
+  void load_window(int position);
+
+  QString content_{};
+  int large_document_size_{default_large_document_size};
+  int window_size_{default_window_size};
+  int window_start_{};
+  int window_end_{};
+  bool loading_window_{};
+  /// vertical scroll bar value when `follow_scroll` was last called
+  int scroll_value_{};
+  QString matches_pattern_{};
+  QVector<int> matches_{};
+  bool matches_ready_{};
+  /// position in `matches_` of the selected match, or -1
+  int current_match_ = -1;
+  int last_match_request_id_{};
+
   /// swap the cursor's position and anchor
   void swap_pos_anchor(QTextCursor& cursor) const;
   void handle_nav_event(QKeyEvent* event);
@@ -117,6 +227,10 @@ private:
 private slots:
 
   void extend_selection(QTextCursor::MoveOperation move_op, SelectionSide side);
+
+private:
+  /// started the first time a pattern is entered
+  std::unique_ptr<MatchFindingThread> match_finder_{nullptr};
 };
 } // namespace labelbuddy
 
@@ -0,0 +1,45 @@
+#include <utility>
+
+#include <QSqlQuery>
+
+#include "database.h"
+#include "summary_backfill.h"
+#include "worker_connection.h"
+
+namespace labelbuddy {
+
+SummaryBackfillThread::SummaryBackfillThread(
+    const QString& database_path, std::function<void(int)> on_finished)
+    : database_path_{database_path}, on_finished_{std::move(on_finished)},
+      thread_(&SummaryBackfillThread::run, this) {}
+
+SummaryBackfillThread::~SummaryBackfillThread() {
+  cancel();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void SummaryBackfillThread::cancel() { cancel_requested_ = true; }
+
+void SummaryBackfillThread::run() {
+  int n_updated{-1};
+  {
+    WorkerConnection connection(database_path_, "labelbuddy_summary_backfill",
+                                WorkerConnection::Access::ReadWrite);
+    if (connection.is_open()) {
+      QSqlQuery query(connection.database());
+      auto cancelled = [this]() { return cancel_requested_.load(); };
+      n_updated = backfill_document_summaries(query, 1000, cancelled);
+      if (n_updated != -1 && !cancelled()) {
+        query.exec("DELETE FROM app_state_extra "
+                   "WHERE key = 'document_summary_backfill_pending';");
+      }
+    }
+  }
+  if (on_finished_) {
+    on_finished_(n_updated);
+  }
+}
+
+} // namespace labelbuddy
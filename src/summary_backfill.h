@@ -0,0 +1,50 @@
+#ifndef LABELBUDDY_SUMMARY_BACKFILL_H
+#define LABELBUDDY_SUMMARY_BACKFILL_H
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+#include <QString>
+
+/// \file
+/// Filling the document summaries of migrated databases in a background
+/// thread.
+
+namespace labelbuddy {
+
+/// Fills the document summaries in a background thread with its own database
+/// connection.
+
+/// The thread starts immediately and runs `backfill_document_summaries`.
+/// Unless it is cancelled or a query fails, it then removes the
+/// `document_summary_backfill_pending` flag from `app_state_extra`; otherwise
+/// the flag stays and the backfill continues the next time the database is
+/// opened. `on_finished`, if provided, is called once *from the backfill
+/// thread* with the number of updated documents, or -1 if a query failed.
+class SummaryBackfillThread {
+public:
+  /// `database_path` is the path of the database file. It is opened in a
+  /// connection that belongs to the backfill thread.
+  SummaryBackfillThread(const QString& database_path,
+                        std::function<void(int)> on_finished = nullptr);
+
+  /// Cancels the backfill and waits for the thread to finish
+  ~SummaryBackfillThread();
+
+  /// Stop after the chunk being updated
+  void cancel();
+
+private:
+  void run();
+
+  QString database_path_;
+  std::function<void(int)> on_finished_;
+  std::atomic<bool> cancel_requested_{};
+  // last member so that everything else is initialized when the thread starts
+  std::thread thread_;
+};
+
+} // namespace labelbuddy
+
+#endif
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+#include <QStringMatcher>
+
+#include "text_search.h"
+
+namespace labelbuddy {
+
+QVector<int> find_matches(const QString& text, const QString& pattern,
+                          const std::function<bool()>& cancelled) {
+  QVector<int> matches{};
+  if (pattern.isEmpty()) {
+    return matches;
+  }
+  QStringMatcher matcher(pattern, Qt::CaseInsensitive);
+  const int chunk_size{1 << 20};
+  const int size = text.size();
+  const int pattern_size = pattern.size();
+  int pos{};
+  for (int chunk_start = 0; chunk_start < size; chunk_start += chunk_size) {
+    if (cancelled && cancelled()) {
+      return matches;
+    }
+    // matches starting in this chunk end at most `pattern_size - 1` after it
+    auto chunk_end = std::min(size, chunk_start + chunk_size);
+    auto limit = std::min(size, chunk_end + pattern_size - 1);
+    while (true) {
+      auto match = matcher.indexIn(text.constData(), limit, pos);
+      if (match == -1) {
+        break;
+      }
+      matches << match;
+      pos = match + pattern_size;
+    }
+    pos = std::max(pos, chunk_end);
+  }
+  return matches;
+}
+
+MatchFindingThread::MatchFindingThread(std::function<void(int)> on_found)
+    : on_found_{std::move(on_found)}, thread_(&MatchFindingThread::run, this) {}
+
+MatchFindingThread::~MatchFindingThread() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_requested_ = true;
+    // cancels the search in progress, if any
+    latest_request_id_ = -2;
+  }
+  has_request_.notify_one();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void MatchFindingThread::request(int request_id, const QString& text,
+                                 const QString& pattern) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    assert(request_id > latest_request_id_);
+    latest_request_id_ = request_id;
+    // implicitly shared: the text is not copied
+    pending_text_ = text;
+    pending_pattern_ = pattern;
+    has_pending_request_ = true;
+  }
+  has_request_.notify_one();
+}
+
+bool MatchFindingThread::take_result(int request_id, QVector<int>& matches) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (result_request_id_ != request_id) {
+    return false;
+  }
+  matches = std::move(result_);
+  result_request_id_ = -1;
+  return true;
+}
+
+void MatchFindingThread::run() {
+  while (true) {
+    int request_id{};
+    QString text{};
+    QString pattern{};
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      has_request_.wait(
+          lock, [this] { return stop_requested_ || has_pending_request_; });
+      if (stop_requested_) {
+        break;
+      }
+      request_id = latest_request_id_;
+      text = std::move(pending_text_);
+      pattern = std::move(pending_pattern_);
+      pending_text_ = QString();
+      pending_pattern_ = QString();
+      has_pending_request_ = false;
+    }
+    auto cancelled = [this, request_id]() {
+      return latest_request_id_ != request_id;
+    };
+    auto matches = find_matches(text, pattern, cancelled);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (cancelled()) {
+        // a newer request is waiting
+        continue;
+      }
+      result_request_id_ = request_id;
+      result_ = std::move(matches);
+    }
+    on_found_(request_id);
+  }
+}
+
+} // namespace labelbuddy
@@ -0,0 +1,70 @@
+#ifndef LABELBUDDY_TEXT_SEARCH_H
+#define LABELBUDDY_TEXT_SEARCH_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include <QString>
+#include <QVector>
+
+/// \file
+/// Finding all the occurrences of a pattern in a document's text.
+
+namespace labelbuddy {
+
+/// Start positions of case-insensitive matches of `pattern`, sorted
+
+/// Matches do not overlap: they are the ones successive forward searches with
+/// `QTextDocument::find` (without flags) would find from the start of the
+/// text. Returns an empty vector if `pattern` is empty.
+/// `cancelled`, if provided, is checked regularly; if it returns `true` the
+/// search stops and the matches found so far are returned.
+QVector<int> find_matches(const QString& text, const QString& pattern,
+                          const std::function<bool()>& cancelled = nullptr);
+
+/// Builds the match index of a text in a background thread.
+
+/// As for `DocumentLoadingThread`, only the latest request matters: a new one
+/// cancels the search in progress. When the matches are ready `on_found` is
+/// called *from the search thread* with the request's number; the result is
+/// then retrieved with `take_result`.
+class MatchFindingThread {
+public:
+  explicit MatchFindingThread(std::function<void(int)> on_found);
+
+  /// Cancels the current search and waits for the thread to finish
+  ~MatchFindingThread();
+
+  /// Ask for the matches of `pattern` in `text`. `request_id` must be greater
+  /// than that of previous requests.
+  void request(int request_id, const QString& text, const QString& pattern);
+
+  /// Retrieve the matches found for `request_id`.
+
+  /// Returns `false` if they are not available because a newer request has
+  /// been made.
+  bool take_result(int request_id, QVector<int>& matches);
+
+private:
+  void run();
+
+  std::function<void(int)> on_found_;
+  QString pending_text_{};
+  QString pending_pattern_{};
+  bool has_pending_request_{};
+  bool stop_requested_{};
+  int result_request_id_ = -1;
+  QVector<int> result_{};
+  std::atomic<int> latest_request_id_{-1};
+  std::mutex mutex_{};
+  std::condition_variable has_request_{};
+  // last member so that everything else is initialized when the thread starts
+  std::thread thread_;
+};
+
+} // namespace labelbuddy
+
+#endif
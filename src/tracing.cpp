@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+
+#include "tracing.h"
+
+namespace labelbuddy {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct TraceEvent {
+  QString name;
+  bool is_sql;
+  Clock::time_point start;
+  Clock::duration duration;
+  int thread;
+};
+
+struct TraceTotal {
+  bool is_sql{};
+  long long count{};
+  Clock::duration total{};
+  Clock::duration max{};
+};
+
+/// State shared by all threads; `enabled` is checked without the mutex so
+/// that tracing costs nothing when it is disabled.
+struct Tracer {
+  std::atomic<bool> enabled{false};
+  TraceFormat format = TraceFormat::None;
+  QString output_path{};
+  Clock::time_point origin{};
+  std::mutex mutex{};
+  // only kept for the chrome format; bounded so a long session does not
+  // exhaust the memory
+  std::vector<TraceEvent> events{};
+  QHash<QString, TraceTotal> totals{};
+};
+
+const std::size_t max_events{1 << 20};
+
+Tracer& tracer() {
+  static Tracer instance{};
+  return instance;
+}
+
+/// Small sequential ids, easier to read in a trace than native thread ids
+int current_thread_number() {
+  static std::atomic<int> next_number{1};
+  thread_local int number = next_number++;
+  return number;
+}
+
+void record(const QString& name, bool is_sql, Clock::time_point start,
+            Clock::time_point end) {
+  auto& state = tracer();
+  auto duration = end - start;
+  std::lock_guard<std::mutex> lock(state.mutex);
+  auto& total = state.totals[name];
+  total.is_sql = is_sql;
+  ++total.count;
+  total.total += duration;
+  total.max = std::max(total.max, duration);
+  if (state.format == TraceFormat::Chrome && state.events.size() < max_events) {
+    state.events.push_back(
+        {name, is_sql, start, duration, current_thread_number()});
+  }
+}
+
+double to_ms(Clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+double to_us(Clock::duration duration) {
+  return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+QByteArray format_summary(const Tracer& state) {
+  auto names = state.totals.keys();
+  std::sort(names.begin(), names.end(),
+            [&state](const QString& first, const QString& second) {
+              return state.totals[first].total > state.totals[second].total;
+            });
+  QString summary{};
+  QTextStream out(&summary);
+  out << QString("%1 %2 %3 %4  %5  %6\n")
+             .arg("count", 9)
+             .arg("total ms", 11)
+             .arg("mean ms", 10)
+             .arg("max ms", 10)
+             .arg("kind", -5)
+             .arg("name");
+  for (const auto& name : names) {
+    const auto& total = state.totals[name];
+    auto total_ms = to_ms(total.total);
+    out << QString("%1 %2 %3 %4  %5  %6\n")
+               .arg(total.count, 9)
+               .arg(total_ms, 11, 'f', 3)
+               .arg(total_ms / static_cast<double>(total.count), 10, 'f', 3)
+               .arg(to_ms(total.max), 10, 'f', 3)
+               .arg(total.is_sql ? "sql" : "scope", -5)
+               .arg(QString(name).replace('\n', ' ').simplified());
+  }
+  out.flush();
+  return summary.toUtf8();
+}
+
+QByteArray format_chrome_trace(const Tracer& state) {
+  QJsonArray events{};
+  auto pid = static_cast<double>(QCoreApplication::applicationPid());
+  for (const auto& event : state.events) {
+    QJsonObject json{};
+    json["name"] = event.name;
+    json["cat"] = event.is_sql ? "sql" : "scope";
+    json["ph"] = "X";
+    json["ts"] = to_us(event.start - state.origin);
+    json["dur"] = to_us(event.duration);
+    json["pid"] = pid;
+    json["tid"] = event.thread;
+    events << json;
+  }
+  QJsonObject trace{};
+  trace["traceEvents"] = events;
+  trace["displayTimeUnit"] = "ms";
+  return QJsonDocument(trace).toJson(QJsonDocument::Compact);
+}
+
+} // namespace
+
+bool parse_trace_format(const QString& name, TraceFormat& format) {
+  if (name == "summary") {
+    format = TraceFormat::Summary;
+    return true;
+  }
+  if (name == "chrome") {
+    format = TraceFormat::Chrome;
+    return true;
+  }
+  return false;
+}
+
+void enable_tracing(TraceFormat format, const QString& output_path) {
+  auto& state = tracer();
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.format = format;
+    state.output_path = output_path;
+    state.origin = Clock::now();
+    state.events.clear();
+    state.totals.clear();
+  }
+  state.enabled = format != TraceFormat::None;
+}
+
+bool enable_tracing_from_environment() {
+  auto name = QString::fromUtf8(qgetenv("LABELBUDDY_TRACE"));
+  if (name.isEmpty()) {
+    return true;
+  }
+  TraceFormat format{};
+  if (!parse_trace_format(name, format)) {
+    return false;
+  }
+  enable_tracing(format,
+                 QString::fromUtf8(qgetenv("LABELBUDDY_TRACE_OUTPUT")));
+  return true;
+}
+
+bool is_tracing_enabled() { return tracer().enabled; }
+
+bool write_trace() {
+  auto& state = tracer();
+  if (!state.enabled) {
+    return true;
+  }
+  QByteArray output{};
+  QString output_path{};
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    output = state.format == TraceFormat::Chrome ? format_chrome_trace(state)
+                                                 : format_summary(state);
+    output_path = state.output_path;
+    if (output_path.isEmpty() && state.format == TraceFormat::Chrome) {
+      output_path = "labelbuddy_trace.json";
+    }
+  }
+  if (output_path.isEmpty()) {
+    std::fwrite(output.constData(), 1, static_cast<std::size_t>(output.size()),
+                stderr);
+    return true;
+  }
+  QFile file(output_path);
+  return file.open(QIODevice::WriteOnly) && file.write(output) == output.size();
+}
+
+TraceScope::TraceScope(const char* name)
+    : name_{name}, enabled_{is_tracing_enabled()} {
+  if (enabled_) {
+    start_ = Clock::now();
+  }
+}
+
+TraceScope::~TraceScope() {
+  if (enabled_) {
+    record(QString::fromLatin1(name_), false, start_, Clock::now());
+  }
+}
+
+bool traced_exec(QSqlQuery& query) {
+  if (!is_tracing_enabled()) {
+    return query.exec();
+  }
+  auto start = Clock::now();
+  auto result = query.exec();
+  record(query.lastQuery(), true, start, Clock::now());
+  return result;
+}
+
+bool traced_exec(QSqlQuery& query, const QString& sql) {
+  if (!is_tracing_enabled()) {
+    return query.exec(sql);
+  }
+  auto start = Clock::now();
+  auto result = query.exec(sql);
+  record(sql, true, start, Clock::now());
+  return result;
+}
+
+} // namespace labelbuddy
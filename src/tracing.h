@@ -0,0 +1,73 @@
+#ifndef LABELBUDDY_TRACING_H
+#define LABELBUDDY_TRACING_H
+
+#include <chrono>
+
+#include <QSqlQuery>
+#include <QString>
+
+/// \file
+/// Optional recording of the time spent in SQL statements and code sections.
+
+namespace labelbuddy {
+
+enum class TraceFormat {
+  None,
+  /// a table with the count and total time of each statement and scope
+  Summary,
+  /// a JSON file in the Chrome Trace Event format, which can be opened in
+  /// chrome://tracing or https://ui.perfetto.dev
+  Chrome
+};
+
+/// Parse "summary" or "chrome"; returns `false` for other names
+bool parse_trace_format(const QString& name, TraceFormat& format);
+
+/// Start recording.
+
+/// `write_trace` then writes the recorded events to `output_path`, or if it
+/// is empty to the standard error (summary) or `labelbuddy_trace.json`
+/// (chrome).
+void enable_tracing(TraceFormat format, const QString& output_path = QString());
+
+/// Call `enable_tracing` if the `LABELBUDDY_TRACE` environment variable is
+/// set to a format name, with the `LABELBUDDY_TRACE_OUTPUT` variable as the
+/// output path. Returns `false` if the format is not valid.
+bool enable_tracing_from_environment();
+
+bool is_tracing_enabled();
+
+/// Write what has been recorded since `enable_tracing`.
+
+/// Called before the program exits; does nothing if tracing is not enabled.
+/// Returns `false` if the output could not be written.
+bool write_trace();
+
+/// Records the time between its construction and destruction, if tracing is
+/// enabled. `name` must be a string literal (or outlive the program).
+class TraceScope {
+public:
+  explicit TraceScope(const char* name);
+  ~TraceScope();
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+  const char* name_;
+  bool enabled_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+/// `query.exec()`, recording the statement's duration if tracing is enabled.
+
+/// Statements are identified by their text (`query.lastQuery()`), so a
+/// prepared statement executed with different bound values is counted as one.
+bool traced_exec(QSqlQuery& query);
+
+/// `query.exec(sql)`, recording the statement's duration
+bool traced_exec(QSqlQuery& query, const QString& sql);
+
+} // namespace labelbuddy
+
+#endif
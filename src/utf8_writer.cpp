@@ -0,0 +1,213 @@
+#include <cassert>
+
+#include "utf8_writer.h"
+
+namespace labelbuddy {
+
+namespace {
+
+char hex_digit(uint value) {
+  return static_cast<char>(value < 10 ? '0' + value : 'a' + value - 10);
+}
+
+char* append_unicode_escape(char* out, uint code_unit) {
+  *out++ = '\\';
+  *out++ = 'u';
+  for (int shift = 12; shift >= 0; shift -= 4) {
+    *out++ = hex_digit((code_unit >> shift) & 0xf);
+  }
+  return out;
+}
+
+/// letter of the 2-character escape sequence of a character that must be
+/// escaped in JSON strings, or 0 if it is written as `\u00XX`
+char json_escape_letter(uint unit) {
+  switch (unit) {
+  case '"':
+    return '"';
+  case '\\':
+    return '\\';
+  case '\b':
+    return 'b';
+  case '\f':
+    return 'f';
+  case '\n':
+    return 'n';
+  case '\r':
+    return 'r';
+  case '\t':
+    return 't';
+  default:
+    return 0;
+  }
+}
+
+bool needs_csv_quotes(char c) {
+  return c == '"' || c == ',' || c == '\r' || c == '\n';
+}
+
+} // namespace
+
+Utf8Writer::Utf8Writer(QIODevice* device, int block_size)
+    : device_{device}, block_size_{block_size} {
+  assert(device_ != nullptr);
+  // a reserved capacity is kept when the buffer is emptied
+  buffer_.reserve(block_size_);
+}
+
+Utf8Writer::~Utf8Writer() { flush(); }
+
+void Utf8Writer::append_raw(const char* data) {
+  buffer_.append(data);
+  write_if_full();
+}
+
+void Utf8Writer::append_raw(const QByteArray& data) {
+  buffer_.append(data);
+  write_if_full();
+}
+
+void Utf8Writer::append_number(qlonglong value) {
+  char digits[24];
+  auto end = digits + sizeof(digits);
+  auto start = end;
+  auto magnitude = static_cast<qulonglong>(value);
+  if (value < 0) {
+    magnitude = ~magnitude + 1;
+  }
+  do {
+    *--start = static_cast<char>('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude != 0);
+  if (value < 0) {
+    *--start = '-';
+  }
+  buffer_.append(start, static_cast<int>(end - start));
+  write_if_full();
+}
+
+void Utf8Writer::append_text(const QString& text) {
+  append_encoded(text, Escape::None);
+}
+
+void Utf8Writer::append_json_string(const QString& text) {
+  buffer_.append('"');
+  append_encoded(text, Escape::Json);
+  buffer_.append('"');
+  write_if_full();
+}
+
+void Utf8Writer::append_csv_field(const QString& text) {
+  bool quoted{};
+  for (auto c : text) {
+    auto unit = c.unicode();
+    if (unit < 0x80 && needs_csv_quotes(static_cast<char>(unit))) {
+      quoted = true;
+      break;
+    }
+  }
+  if (quoted) {
+    buffer_.append('"');
+  }
+  append_encoded(text, quoted ? Escape::Csv : Escape::None);
+  if (quoted) {
+    buffer_.append('"');
+  }
+  write_if_full();
+}
+
+void Utf8Writer::append_csv_field(const QByteArray& utf8) {
+  bool quoted{};
+  for (auto c : utf8) {
+    if (needs_csv_quotes(c)) {
+      quoted = true;
+      break;
+    }
+  }
+  if (!quoted) {
+    buffer_.append(utf8);
+  } else {
+    buffer_.append('"');
+    for (auto c : utf8) {
+      if (c == '"') {
+        buffer_.append('"');
+      }
+      buffer_.append(c);
+    }
+    buffer_.append('"');
+  }
+  write_if_full();
+}
+
+void Utf8Writer::flush() {
+  if (buffer_.isEmpty()) {
+    return;
+  }
+  device_->write(buffer_);
+  buffer_.resize(0);
+}
+
+void Utf8Writer::write_if_full() {
+  if (buffer_.size() >= block_size_) {
+    flush();
+  }
+}
+
+void Utf8Writer::append_encoded(const QString& text, Escape escape) {
+  // long texts are encoded in chunks so the buffer does not grow much larger
+  // than the text's encoding
+  const int chunk_size{1 << 16};
+  auto src = text.utf16();
+  auto end = src + text.size();
+  while (src != end) {
+    auto chunk_end = end - src > chunk_size ? src + chunk_size : end;
+    auto old_size = buffer_.size();
+    // the longest output for one code unit is a `\u` escape (6 bytes); the
+    // last unit of the chunk can begin a surrogate pair (4 bytes)
+    buffer_.resize(old_size + 6 * static_cast<int>(chunk_end - src) + 4);
+    auto out = buffer_.data() + old_size;
+    while (src < chunk_end) {
+      uint unit = *src++;
+      if (unit < 0x80) {
+        if (escape == Escape::Json &&
+            (unit < 0x20 || unit == '"' || unit == '\\')) {
+          auto letter = json_escape_letter(unit);
+          if (letter != 0) {
+            *out++ = '\\';
+            *out++ = letter;
+          } else {
+            out = append_unicode_escape(out, unit);
+          }
+          continue;
+        }
+        if (escape == Escape::Csv && unit == '"') {
+          *out++ = '"';
+        }
+        *out++ = static_cast<char>(unit);
+      } else if (unit < 0x800) {
+        *out++ = static_cast<char>(0xc0 | (unit >> 6));
+        *out++ = static_cast<char>(0x80 | (unit & 0x3f));
+      } else if (!QChar::isSurrogate(unit)) {
+        *out++ = static_cast<char>(0xe0 | (unit >> 12));
+        *out++ = static_cast<char>(0x80 | ((unit >> 6) & 0x3f));
+        *out++ = static_cast<char>(0x80 | (unit & 0x3f));
+      } else if (QChar::isHighSurrogate(unit) && src != end &&
+                 QChar::isLowSurrogate(*src)) {
+        auto code_point =
+            QChar::surrogateToUcs4(static_cast<ushort>(unit), *src++);
+        *out++ = static_cast<char>(0xf0 | (code_point >> 18));
+        *out++ = static_cast<char>(0x80 | ((code_point >> 12) & 0x3f));
+        *out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+        *out++ = static_cast<char>(0x80 | (code_point & 0x3f));
+      } else if (escape == Escape::Json) {
+        out = append_unicode_escape(out, unit);
+      } else {
+        *out++ = '?';
+      }
+    }
+    buffer_.resize(static_cast<int>(out - buffer_.data()));
+    write_if_full();
+  }
+}
+
+} // namespace labelbuddy
@@ -0,0 +1,70 @@
+#ifndef LABELBUDDY_UTF8_WRITER_H
+#define LABELBUDDY_UTF8_WRITER_H
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QString>
+
+/// \file
+/// Buffered output of UTF-8 text, with the JSON and CSV escaping of exports.
+
+namespace labelbuddy {
+
+/// Encodes text to UTF-8 directly into a reusable buffer.
+
+/// The buffer is written to the device in blocks of about `block_size` bytes
+/// (and by `flush`), instead of the small chunks written by `QTextStream`,
+/// and no temporary `QByteArray` is made for each string. Strings are escaped
+/// as `QJsonDocument` and `CsvWriter` do, so the output is the same as theirs.
+/// Code units of unpaired surrogates are written as "?" (as by
+/// `QString::toUtf8`), or as a `\u` escape in JSON strings.
+class Utf8Writer {
+public:
+  /// `device` is not owned by the writer and must outlive it
+  Utf8Writer(QIODevice* device, int block_size = 1 << 20);
+
+  /// Calls `flush`
+  ~Utf8Writer();
+
+  Utf8Writer(const Utf8Writer&) = delete;
+  Utf8Writer& operator=(const Utf8Writer&) = delete;
+
+  /// Append bytes that are already UTF-8, without escaping them
+  void append_raw(const char* data);
+  void append_raw(const QByteArray& data);
+
+  /// Append the decimal representation of `value`
+  void append_number(qlonglong value);
+
+  /// Append `text` encoded as UTF-8, without escaping it
+  void append_text(const QString& text);
+
+  /// Append `text` as a JSON string, including the quotes
+  void append_json_string(const QString& text);
+
+  /// Append `text` as a CSV field, quoted if it contains `"`, `,` or a line
+  /// break
+  void append_csv_field(const QString& text);
+
+  /// Same as the `QString` overload for a field that is already UTF-8
+  void append_csv_field(const QByteArray& utf8);
+
+  /// Write the buffered bytes to the device
+  void flush();
+
+private:
+  enum class Escape { None, Json, Csv };
+
+  void append_encoded(const QString& text, Escape escape);
+
+  /// Write the buffer if it has reached `block_size_`
+  void write_if_full();
+
+  QIODevice* device_;
+  int block_size_;
+  QByteArray buffer_{};
+};
+
+} // namespace labelbuddy
+
+#endif
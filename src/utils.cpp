@@ -76,6 +76,96 @@ void prepare_parser(QCommandLineParser& parser) {
       {"approver", "User or 'annotations approver' name", "name", ""});
   parser.addOption(
       {"vacuum", "Repack database into minimal amount of disk space."});
+  parser.addOption({"export-threads",
+                    "Number of threads used to serialize exported documents.",
+                    "n", "1"});
+  parser.addOption(
+      {"shard-size",
+       "Split exported documents into files containing at most n documents.",
+       "n", "0"});
+  parser.addOption({"import-checkpoint",
+                    "Commit imported documents every n documents and resume "
+                    "interrupted imports.",
+                    "n", "0"});
+  parser.addOption({"pragma-profile",
+                    "SQLite settings to use for the database: 'default', "
+                    "'fast' or 'bulk'.",
+                    "profile"});
+  parser.addOption({"bulk-load",
+                    "Rebuild indexes once after importing documents instead "
+                    "of updating them for each document."});
+  parser.addOption({"import-threads",
+                    "Number of imported documents files that are read at the "
+                    "same time.",
+                    "n", "1"});
+  parser.addOption({"hash-threads",
+                    "Number of threads computing the checksums of each "
+                    "imported documents file, or 0 to compute them in the "
+                    "thread that reads it.",
+                    "n", "0"});
+  parser.addOption({"stats",
+                    "Print timings and throughput of the import and export "
+                    "in this format ('json').",
+                    "format"});
+  parser.addOption({"trace",
+                    "Record the time spent in SQL statements and in some "
+                    "functions, and write it on exit in this format: "
+                    "'summary' or 'chrome'.",
+                    "format"});
+  parser.addOption({"trace-output",
+                    "File to which --trace writes its output.", "file"});
+  parser.addOption({"separate-content",
+                    "When creating a new database, store the documents' text "
+                    "in a separate table."});
+  parser.addOption({"compress-content",
+                    "When creating a new database, store the documents' text "
+                    "compressed, in a separate table."});
+  parser.addOption({"split-docs",
+                    "Import documents longer than n characters as several "
+                    "documents, split preferably at blank lines.",
+                    "n", "0"});
+  parser.addOption({"merge-segments",
+                    "Export the documents split by --split-docs as the "
+                    "original documents."});
+  parser.addOption({"read-only",
+                    "Open the database read-only, so that it can be exported "
+                    "while another process imports documents into it."});
+  parser.addOption({"since",
+                    "Only export documents whose annotations changed after "
+                    "this change token (printed by each export), or after "
+                    "the previous export if it is 'last'.",
+                    "token"});
+  parser.addOption({"doc-filter",
+                    "Only export documents matching a filter: 'labelled', "
+                    "'unlabelled', 'has-label', 'not-has-label' (a label "
+                    "given with --label) or 'search' (the --search text).",
+                    "filter"});
+  parser.addOption({"label",
+                    "Only export annotations with this label (can be "
+                    "repeated); also the labels of --doc-filter.",
+                    "label name"});
+  parser.addOption(
+      {"search", "Text searched by --doc-filter 'search'.", "text"});
+  parser.addOption({"min-doc-id",
+                    "Only export documents whose id is greater or equal.",
+                    "id"});
+  parser.addOption({"max-doc-id",
+                    "Only export documents whose id is smaller or equal.",
+                    "id"});
+  parser.addOption({"pre-annotate",
+                    "Annotate documents with a model run by this command, "
+                    "which reads batches of documents as JSON lines and "
+                    "answers with their annotations. The documents are "
+                    "selected as for --export-docs.",
+                    "command"});
+  parser.addOption({"pre-annotate-batch-size",
+                    "Number of documents sent to the --pre-annotate command "
+                    "at once.",
+                    "n", "64"});
+  parser.addOption({"pre-annotate-jobs",
+                    "Number of --pre-annotate processes running at the same "
+                    "time.",
+                    "n", "1"});
 }
 
 QRegularExpression shortcut_key_pattern(bool accept_empty) {
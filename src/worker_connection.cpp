@@ -0,0 +1,51 @@
+#include <QSqlQuery>
+
+#include "worker_connection.h"
+
+namespace labelbuddy {
+
+QString worker_database_path(const QString& connection_name) {
+  if (!QSqlDatabase::contains(connection_name)) {
+    return QString();
+  }
+  auto database_path =
+      QSqlDatabase::database(connection_name, false).databaseName();
+  if (database_path == ":memory:") {
+    return QString();
+  }
+  return database_path;
+}
+
+WorkerConnection::WorkerConnection(const QString& database_path,
+                                   const QString& name_prefix, Access access)
+    : connection_name_{
+          QString("%0_%1").arg(name_prefix).arg(
+              reinterpret_cast<quintptr>(this))} {
+  database_ = QSqlDatabase::addDatabase("QSQLITE", connection_name_);
+  database_.setDatabaseName(database_path);
+  if (access == Access::ReadOnly) {
+    database_.setConnectOptions(
+        "QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=1000");
+    database_.open();
+    return;
+  }
+  // readers in other connections can hold the lock briefly
+  database_.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+  if (database_.open()) {
+    QSqlQuery query(database_);
+    query.exec("PRAGMA foreign_keys = ON;");
+  }
+}
+
+WorkerConnection::~WorkerConnection() {
+  database_.close();
+  // the connection must not be in use anymore when it is removed
+  database_ = QSqlDatabase{};
+  QSqlDatabase::removeDatabase(connection_name_);
+}
+
+bool WorkerConnection::is_open() const { return database_.isOpen(); }
+
+const QSqlDatabase& WorkerConnection::database() const { return database_; }
+
+} // namespace labelbuddy
@@ -0,0 +1,56 @@
+#ifndef LABELBUDDY_WORKER_CONNECTION_H
+#define LABELBUDDY_WORKER_CONNECTION_H
+
+#include <QSqlDatabase>
+#include <QString>
+
+/// \file
+/// Database connections owned by background threads.
+
+namespace labelbuddy {
+
+/// Path with which other connections can open the database of a connection.
+
+/// This is the database file's path, or an empty string for the temporary and
+/// in-memory databases, which only exist in their own connection: work on
+/// those has to be done in the thread that owns that connection.
+QString worker_database_path(const QString& connection_name);
+
+/// A connection to a database file, for the thread that creates it.
+
+/// A Qt connection can only be used by the thread that created it, so the
+/// models' connections (named after the file path) cannot be shared with the
+/// background jobs. Each job thread creates its own with this class, which
+/// gives it a name that no other connection uses, applies the options the
+/// jobs need, and removes it when it is destroyed. Queries using it must be
+/// destroyed first, like `database()`'s copies.
+class WorkerConnection {
+public:
+  enum class Access {
+    /// opened with `QSQLITE_OPEN_READONLY`, waits up to 1 s for a writer
+    ReadOnly,
+    /// foreign keys are enforced (deletions cascade), waits up to 5 s for
+    /// other connections
+    ReadWrite
+  };
+
+  /// `name_prefix` identifies the job in the connection name
+  WorkerConnection(const QString& database_path, const QString& name_prefix,
+                   Access access);
+  ~WorkerConnection();
+
+  WorkerConnection(const WorkerConnection&) = delete;
+  WorkerConnection& operator=(const WorkerConnection&) = delete;
+
+  bool is_open() const;
+
+  const QSqlDatabase& database() const;
+
+private:
+  QString connection_name_;
+  QSqlDatabase database_;
+};
+
+} // namespace labelbuddy
+
+#endif
@@ -5,6 +5,7 @@
 
 #include "test_annotations_model.h"
 #include "test_annotator.h"
+#include "test_compressed_file.h"
 #include "test_database.h"
 #include "test_dataset_menu.h"
 #include "test_doc_list.h"
@@ -16,6 +17,15 @@
 #include "test_utils.h"
 #include "test_import_export_menu.h"
 #include "test_csv.h"
+#include "test_label_cache.h"
+#include "test_tracing.h"
+#include "test_batch_labeling.h"
+#include "test_arrow_writer.h"
+#include "test_label_stats.h"
+#include "test_label_filter_model.h"
+#include "test_worker_connection.h"
+#include "test_utf8_writer.h"
+#include "test_pre_annotation.h"
 
 int main(int argc, char* argv[]) {
   QTemporaryDir tmp_dir{};
@@ -38,5 +48,15 @@ int main(int argc, char* argv[]) {
   status |= QTest::qExec(new labelbuddy::TestLabelList, argc, argv);
   status |= QTest::qExec(new labelbuddy::TestImportExportMenu, argc, argv);
   status |= QTest::qExec(new labelbuddy::TestCsv, argc, argv);
+  status |= QTest::qExec(new labelbuddy::TestLabelCache, argc, argv);
+  status |= QTest::qExec(new labelbuddy::TestCompressedFile, argc, argv);
+  status |= QTest::qExec(new labelbuddy::TestTracing, argc, argv);
+  status |= QTest::qExec(new labelbuddy::TestBatchLabeling, argc, argv);
+  status |= QTest::qExec(new labelbuddy::TestArrowWriter, argc, argv);
+  status |= QTest::qExec(new labelbuddy::TestLabelStats, argc, argv);
+  status |= QTest::qExec(new labelbuddy::TestLabelFilterModel, argc, argv);
+  status |= QTest::qExec(new labelbuddy::TestWorkerConnection, argc, argv);
+  status |= QTest::qExec(new labelbuddy::TestUtf8Writer, argc, argv);
+  status |= QTest::qExec(new labelbuddy::TestPreAnnotation, argc, argv);
   return status;
 }
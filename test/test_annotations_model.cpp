@@ -1,10 +1,12 @@
 #include <QCryptographicHash>
+#include <QSignalSpy>
 #include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QTemporaryDir>
 
 #include "annotations_model.h"
 #include "database.h"
+#include "document_loader.h"
 #include "test_annotations_model.h"
 #include "testing_utils.h"
 
@@ -35,6 +37,113 @@ void TestAnnotationsModel::test_add_and_delete_annotations() {
   QCOMPARE(annotations[3].end_char, 12);
 }
 
+void TestAnnotationsModel::test_undo_redo() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  AnnotationsModel model{};
+  model.set_database(db_name);
+  int n_status_changes{};
+  QObject::connect(
+      &model, &AnnotationsModel::document_status_changed,
+      [&n_status_changes](DocumentStatus) { ++n_status_changes; });
+  QSignalSpy lost_spy(&model, SIGNAL(document_lost_label(int, int)));
+  QVERIFY(!model.can_undo());
+  QVERIFY(!model.undo());
+  auto first = model.add_annotation(1, 0, 2);
+  model.add_annotation(1, 3, 5);
+  QCOMPARE(n_status_changes, 1);
+  QVERIFY(model.update_annotation_extra_data(first, "extra"));
+  model.delete_annotation(first);
+  QCOMPARE(model.get_annotations_info().size(), 1);
+
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  auto n_annotations = [&query]() {
+    query.exec("select count(*) from annotation where doc_id = 1;");
+    query.next();
+    return query.value(0).toInt();
+  };
+  // the deleted annotation comes back with its extra data but a new id
+  QVERIFY(model.undo());
+  QCOMPARE(n_annotations(), 2);
+  auto annotations = model.get_annotations_info();
+  QVERIFY(!annotations.contains(first));
+  auto restored = annotations.lastKey();
+  QCOMPARE(annotations[restored].extra_data, QString("extra"));
+  QCOMPARE(annotations[restored].start_char, 0);
+  // which is the one the earlier changes refer to
+  QVERIFY(model.undo());
+  QCOMPARE(model.get_annotations_info()[restored].extra_data, QString());
+  QVERIFY(model.undo());
+  QVERIFY(model.undo());
+  QCOMPARE(n_annotations(), 0);
+  QCOMPARE(n_status_changes, 2);
+  QCOMPARE(lost_spy.size(), 1);
+  QVERIFY(!model.can_undo());
+
+  QVERIFY(model.redo());
+  QVERIFY(model.redo());
+  QCOMPARE(n_annotations(), 2);
+  QCOMPARE(n_status_changes, 3);
+  QVERIFY(model.can_redo());
+  // a new change forgets what has been undone
+  model.add_annotation(2, 6, 8);
+  QVERIFY(!model.can_redo());
+  QVERIFY(model.can_undo());
+  // changing the label is undone in one step
+  auto relabelled = model.add_annotation(1, 10, 12);
+  auto new_label = model.relabel_annotation(relabelled, 2);
+  QVERIFY(new_label != -1);
+  QCOMPARE(model.get_annotations_info()[new_label].label_id, 2);
+  QVERIFY(model.undo());
+  annotations = model.get_annotations_info();
+  QVERIFY(!annotations.contains(new_label));
+  QCOMPARE(annotations[annotations.lastKey()].label_id, 1);
+  QCOMPARE(annotations[annotations.lastKey()].start_char, 10);
+  QVERIFY(model.redo());
+  annotations = model.get_annotations_info();
+  QCOMPARE(annotations[annotations.lastKey()].label_id, 2);
+  QCOMPARE(annotations.size(), 4);
+  // and the history belongs to the current document
+  model.visit_next();
+  QVERIFY(!model.can_undo());
+}
+
+void TestAnnotationsModel::test_write_batching() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  AnnotationsModel model{};
+  model.set_database(db_name);
+  {
+    auto other = QSqlDatabase::addDatabase("QSQLITE", "other_connection");
+    other.setDatabaseName(db_name);
+    QVERIFY(other.open());
+    QSqlQuery query(other);
+    auto n_committed = [&query]() {
+      query.exec("select count(*) from annotation;");
+      query.next();
+      auto n = query.value(0).toInt();
+      query.finish();
+      return n;
+    };
+    model.add_annotation(1, 0, 2);
+    model.add_annotation(2, 3, 5);
+    // the model's own connection sees the changes
+    QCOMPARE(model.get_annotations_info().size(), 2);
+    QCOMPARE(n_committed(), 0);
+    model.commit_pending_writes();
+    QCOMPARE(n_committed(), 2);
+    // committed shortly after the first change
+    model.add_annotation(3, 6, 8);
+    QCOMPARE(n_committed(), 2);
+    QTRY_COMPARE(n_committed(), 3);
+    // or when visiting another document
+    model.add_annotation(3, 9, 12);
+    model.visit_next();
+    QCOMPARE(n_committed(), 4);
+  }
+  QSqlDatabase::removeDatabase("other_connection");
+}
+
 void TestAnnotationsModel::test_navigation() {
   QTemporaryDir tmp_dir{};
   auto db_name = prepare_db(tmp_dir);
@@ -76,6 +185,89 @@ void TestAnnotationsModel::test_navigation() {
   QCOMPARE(model.get_content(), QString(""));
 }
 
+void TestAnnotationsModel::test_navigation_state() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  AnnotationsModel model{};
+  model.set_database(db_name);
+  auto state = model.navigation_state();
+  QCOMPARE(state.doc_position, 0);
+  QCOMPARE(state.total_n_docs, 6);
+  QVERIFY(state.has_next && !state.has_prev);
+  QVERIFY(!state.has_next_labelled && !state.has_prev_labelled);
+  QVERIFY(state.has_next_unlabelled && !state.has_prev_unlabelled);
+
+  // the status change is seen immediately
+  model.add_annotation(1, 0, 2);
+  model.visit_next();
+  model.visit_next();
+  state = model.navigation_state();
+  QCOMPARE(state.doc_position, 2);
+  QVERIFY(state.has_prev_labelled && !state.has_next_labelled);
+  QVERIFY(state.has_prev_unlabelled && state.has_next_unlabelled);
+  QCOMPARE(model.has_prev_labelled(), true);
+
+  // other changes are not, until the state is invalidated
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  query.exec("insert into annotation (doc_id, label_id, start_char, end_char) "
+             "values (6, 1, 0, 2);");
+  query.exec("delete from document where id = 1;");
+  QVERIFY(!model.has_next_labelled());
+  QCOMPARE(model.total_n_docs(), 6);
+  model.invalidate_navigation_state();
+  state = model.navigation_state();
+  QVERIFY(state.has_next_labelled && !state.has_prev_labelled);
+  QCOMPARE(state.doc_position, 1);
+  QCOMPARE(state.total_n_docs, 5);
+
+  model.visit_next_unlabelled();
+  model.visit_next_unlabelled();
+  state = model.navigation_state();
+  QCOMPARE(state.doc_position, 3);
+  QVERIFY(!state.has_next_unlabelled && state.has_next_labelled);
+  QVERIFY(state.has_next && state.has_prev);
+
+  query.exec("delete from document;");
+  model.check_current_doc();
+  state = model.navigation_state();
+  QCOMPARE(state.total_n_docs, 0);
+  QVERIFY(!state.has_next && !state.has_prev && !state.has_next_unlabelled);
+}
+
+void TestAnnotationsModel::test_document_position() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  AnnotationsModel model{};
+  model.set_database(db_name);
+  model.visit_doc(4);
+  QCOMPARE(model.current_doc_position(), 3);
+  QCOMPARE(model.total_n_docs(), 6);
+
+  // new documents are appended
+  add_many_docs(db_name);
+  model.check_current_doc();
+  QCOMPARE(model.current_doc_position(), 3);
+  QCOMPARE(model.total_n_docs(), 366);
+  model.visit_doc(366);
+  QCOMPARE(model.current_doc_position(), 365);
+
+  // ids of deleted documents can be reused
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  query.exec("delete from document where id in (2, 365, 366);");
+  query.exec("insert into document (id, content, content_md5) "
+             "values (365, 'new doc', x'00');");
+  model.visit_doc(365);
+  model.invalidate_navigation_state();
+  QCOMPARE(model.current_doc_position(), 363);
+  QCOMPARE(model.total_n_docs(), 364);
+  QVERIFY(!model.has_next());
+
+  // the index is read again for a new database
+  query.exec("delete from document where id > 3;");
+  model.set_database(db_name);
+  QCOMPARE(model.total_n_docs(), 2);
+}
+
 void TestAnnotationsModel::test_surrogate_pairs() {
   QTemporaryDir tmp_dir{};
   DatabaseCatalog catalog{};
@@ -139,4 +331,150 @@ void TestAnnotationsModel::test_surrogate_pairs() {
   QCOMPARE(model.utf16_idx_to_code_point_idx(2), 2);
 }
 
+void TestAnnotationsModel::test_asynchronous_loading() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  {
+    QSqlQuery query(QSqlDatabase::database(db_name));
+    LoadedDocument doc{};
+    QVERIFY(!load_document(query, 1, doc, []() { return true; }));
+    QVERIFY(load_document(query, 1, doc));
+    QVERIFY(doc.content.startsWith("document 0"));
+    QVERIFY(load_document(query, 1000, doc));
+    QCOMPARE(doc.content, QString());
+  }
+
+  AnnotationsModel model{};
+  model.set_asynchronous_loading(true);
+  model.set_database(db_name);
+  QTRY_VERIFY(model.is_positioned_on_valid_doc());
+  QVERIFY(model.get_content().startsWith("document 0"));
+
+  QSignalSpy spy(&model, SIGNAL(document_changed()));
+  model.visit_next();
+  model.visit_next();
+  model.visit_next();
+  // requests are relative to the latest one, and earlier ones may be skipped
+  QTRY_COMPARE(model.current_doc_position(), 3);
+  QVERIFY(spy.size() >= 1);
+  QVERIFY(spy.size() <= 3);
+  QVERIFY(model.get_content().startsWith("document 3"));
+  model.add_annotation(1, 0, 2);
+  QCOMPARE(model.get_annotations_info().size(), 1);
+
+  model.visit_prev();
+  model.visit_doc(6);
+  QTRY_COMPARE(model.current_doc_position(), 5);
+  QVERIFY(model.get_content().startsWith("document 5"));
+}
+
+void TestAnnotationsModel::test_index_conversion() {
+  // surrogate pairs at various offsets around the 4-code-unit blocks
+  QString pair("\U0001d11e");
+  QStringList contents{"",
+                       "abc",
+                       pair,
+                       "abc" + pair + "defgh" + pair + pair + "ij",
+                       "abcd" + pair + "efg" + pair,
+                       "ab" + QString(QChar(0xd800)),
+                       pair.repeated(9)};
+  for (const auto& content : contents) {
+    LoadedDocument doc{};
+    doc.content = content;
+    QVERIFY(fill_surrogate_indices(doc));
+    QVector<int> expected_qstring{};
+    QVector<int> expected_unicode{};
+    QVector<int> utf16_to_cp{};
+    QVector<int> cp_to_utf16{};
+    int cp_idx{};
+    for (int i = 0; i != content.size(); ++i) {
+      utf16_to_cp << cp_idx;
+      if (content[i].isLowSurrogate()) {
+        continue;
+      }
+      if (content[i].isHighSurrogate()) {
+        expected_qstring << i;
+        expected_unicode << cp_idx;
+      }
+      cp_to_utf16 << i;
+      ++cp_idx;
+    }
+    QCOMPARE(doc.surrogate_indices_in_qstring, expected_qstring);
+    QCOMPARE(doc.surrogate_indices_in_unicode_string, expected_unicode);
+    for (int i = 0; i != utf16_to_cp.size(); ++i) {
+      QCOMPARE(
+          utf16_idx_to_code_point_idx(doc.surrogate_indices_in_qstring, i),
+          utf16_to_cp[i]);
+    }
+    for (int i = 0; i != cp_to_utf16.size(); ++i) {
+      QCOMPARE(code_point_idx_to_utf16_idx(
+                   doc.surrogate_indices_in_unicode_string, i),
+               cp_to_utf16[i]);
+    }
+  }
+
+  LoadedDocument doc{};
+  doc.content = pair;
+  QVERIFY(!fill_surrogate_indices(doc, []() { return true; }));
+}
+
+void TestAnnotationsModel::test_document_cache() {
+  DocumentCache cache{2};
+  LoadedDocument doc{};
+  for (int doc_id : {1, 2}) {
+    doc.doc_id = doc_id;
+    doc.content = QString("doc %0").arg(doc_id);
+    cache.insert(doc);
+  }
+  QVERIFY(cache.get(1, doc));
+  QCOMPARE(doc.content, QString("doc 1"));
+  // 2 is now the least recently used
+  doc.doc_id = 3;
+  cache.insert(doc);
+  QVERIFY(cache.contains(1));
+  QVERIFY(!cache.contains(2));
+  QVERIFY(cache.contains(3));
+  cache.remove(3);
+  QVERIFY(!cache.get(3, doc));
+  cache.clear();
+  QVERIFY(!cache.contains(1));
+}
+
+void TestAnnotationsModel::test_prefetching() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  AnnotationsModel model{};
+  model.set_asynchronous_loading(true);
+  model.set_database(db_name);
+  QTRY_VERIFY(model.is_positioned_on_valid_doc());
+  // next documents and the next unlabelled one are loaded in the background
+  QTRY_VERIFY(model.is_cached(2) && model.is_cached(3));
+
+  // cached documents are shown immediately
+  model.visit_next();
+  QCOMPARE(model.current_doc_position(), 1);
+  QVERIFY(model.get_content().startsWith("document 1"));
+  QTRY_VERIFY(model.is_cached(4));
+
+  // annotations added through the model update the cached document
+  model.add_annotation(1, 0, 2);
+  model.visit_prev();
+  QCOMPARE(model.current_doc_position(), 0);
+  model.visit_next();
+  QCOMPARE(model.current_doc_position(), 1);
+  QCOMPARE(model.get_annotations_info().size(), 1);
+
+  // other modifications require invalidating the cache
+  QTRY_VERIFY(model.is_cached(3));
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  query.exec("insert into annotation (doc_id, label_id, start_char, end_char) "
+             "values (3, 1, 0, 2);");
+  model.invalidate_cache();
+  QVERIFY(!model.is_cached(1));
+  QTRY_VERIFY(model.is_cached(3));
+  model.visit_next();
+  QCOMPARE(model.current_doc_position(), 2);
+  QCOMPARE(model.get_annotations_info().size(), 1);
+}
+
 } // namespace labelbuddy
@@ -8,8 +8,16 @@ namespace labelbuddy {
     Q_OBJECT
   private slots:
     void test_add_and_delete_annotations();
+    void test_undo_redo();
+    void test_write_batching();
     void test_navigation();
+    void test_navigation_state();
+    void test_document_position();
     void test_surrogate_pairs();
+    void test_index_conversion();
+    void test_asynchronous_loading();
+    void test_document_cache();
+    void test_prefetching();
   };
 }
 #endif
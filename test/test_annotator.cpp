@@ -1,4 +1,8 @@
+#include <algorithm>
+
+#include <QCryptographicHash>
 #include <QItemSelectionModel>
+#include <QScrollBar>
 #include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QTemporaryDir>
@@ -10,6 +14,23 @@
 #include "testing_utils.h"
 
 namespace labelbuddy {
+
+namespace {
+
+/// positions and colors of the text's extra selections, sorted
+QList<QPair<QPair<int, int>, QString>> painted_spans(QPlainTextEdit* te) {
+  QList<QPair<QPair<int, int>, QString>> spans{};
+  for (const auto& selection : te->extraSelections()) {
+    spans << qMakePair(qMakePair(selection.cursor.selectionStart(),
+                                 selection.cursor.selectionEnd()),
+                       selection.format.background().color().name());
+  }
+  std::sort(spans.begin(), spans.end());
+  return spans;
+}
+
+} // namespace
+
 void TestAnnotator::test_annotator() {
   QTemporaryDir tmp_dir{};
   auto db_name = prepare_db(tmp_dir);
@@ -119,6 +140,160 @@ void TestAnnotator::test_overlapping_annotations() {
            QString("label: Resumption of the session"));
 }
 
+void TestAnnotator::test_clusters() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  query.exec("insert into annotation (doc_id, label_id, start_char, end_char) "
+             "values (1, 1, 0, 5), (1, 2, 3, 8), (1, 3, 7, 10), "
+             "(1, 1, 12, 15), (1, 1, 20, 25), (1, 2, 22, 23), (1, 3, 25, 27);");
+  AnnotationsModel annotations_model{};
+  annotations_model.set_database(db_name);
+  LabelListModel labels_model{};
+  labels_model.set_database(db_name);
+  Annotator annotator{};
+  annotator.set_annotations_model(&annotations_model);
+  annotator.set_label_list_model(&labels_model);
+  auto te = annotator.findChild<SearchableText*>()->get_text_edit();
+  // [0, 10), [12, 15), [20, 25), [25, 27)
+  QCOMPARE(te->extraSelections().size(), 4);
+
+  auto cursor = te->textCursor();
+  cursor.setPosition(13);
+  te->setTextCursor(cursor);
+  QCOMPARE(annotator.current_status_info().annotation_info,
+           QString("^ 12, 15"));
+  QCOMPARE(te->extraSelections().size(), 4);
+  QTest::keyClick(&annotator, Qt::Key_Backspace);
+  QCOMPARE(annotator.active_annotation_label(), -1);
+  QCOMPARE(te->extraSelections().size(), 3);
+
+  cursor.setPosition(22);
+  te->setTextCursor(cursor);
+  QCOMPARE(annotator.current_status_info().annotation_info,
+           QString("^ 20, 25"));
+  QTest::keyClick(&annotator, Qt::Key_Backspace);
+  // [0, 10), [22, 23), [25, 27)
+  QCOMPARE(te->extraSelections().size(), 3);
+  cursor.setPosition(21);
+  te->setTextCursor(cursor);
+  QCOMPARE(annotator.active_annotation_label(), -1);
+  cursor.setPosition(22);
+  te->setTextCursor(cursor);
+  QCOMPARE(annotator.current_status_info().annotation_info,
+           QString("^ 22, 23"));
+
+  cursor.setPosition(9);
+  te->setTextCursor(cursor);
+  QCOMPARE(annotator.current_status_info().annotation_info,
+           QString("^^ 0, 5"));
+  QTest::keyClick(&annotator, Qt::Key_Backspace);
+  // the cluster now starts at the second annotation
+  cursor.setPosition(1);
+  te->setTextCursor(cursor);
+  QCOMPARE(annotator.active_annotation_label(), -1);
+  cursor.setPosition(4);
+  te->setTextCursor(cursor);
+  QCOMPARE(annotator.active_annotation_label(), 2);
+  QCOMPARE(annotator.current_status_info().annotation_info,
+           QString("^^ 3, 8"));
+}
+
+void TestAnnotator::test_painted_region() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  QString content{};
+  for (int i = 0; i != 5000; ++i) {
+    content.append(QString("line %0\n").arg(i, 4, 10, QChar('0')));
+  }
+  query.prepare("insert into document(content, content_md5) values (?, ?);");
+  query.bindValue(0, content);
+  query.bindValue(1, QCryptographicHash::hash(content.toUtf8(),
+                                              QCryptographicHash::Md5));
+  query.exec();
+  auto doc_id = query.lastInsertId().toInt();
+  auto end = content.size();
+  query.prepare("insert into annotation (doc_id, label_id, start_char, "
+                "end_char) values (:doc, 1, 0, 4), (:doc, 2, :start, :end);");
+  query.bindValue(":doc", doc_id);
+  query.bindValue(":start", end - 5);
+  query.bindValue(":end", end - 1);
+  query.exec();
+  AnnotationsModel annotations_model{};
+  annotations_model.set_database(db_name);
+  LabelListModel labels_model{};
+  labels_model.set_database(db_name);
+  Annotator annotator{};
+  annotator.set_annotations_model(&annotations_model);
+  annotator.set_label_list_model(&labels_model);
+  annotator.resize(600, 400);
+  annotator.show();
+  annotations_model.visit_doc(doc_id);
+  auto te = annotator.findChild<SearchableText*>()->get_text_edit();
+
+  // only the annotation at the top is painted
+  auto selections = te->extraSelections();
+  QCOMPARE(selections.size(), 1);
+  QCOMPARE(selections[0].cursor.selectionStart(), 0);
+
+  auto scroll_bar = te->verticalScrollBar();
+  scroll_bar->setValue(scroll_bar->maximum());
+  selections = te->extraSelections();
+  QCOMPARE(selections.size(), 1);
+  QCOMPARE(selections[0].cursor.selectionStart(), end - 5);
+
+  scroll_bar->setValue(0);
+  selections = te->extraSelections();
+  QCOMPARE(selections.size(), 1);
+  QCOMPARE(selections[0].cursor.selectionStart(), 0);
+}
+
+void TestAnnotator::test_incremental_painting() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  AnnotationsModel annotations_model{};
+  annotations_model.set_database(db_name);
+  LabelListModel labels_model{};
+  labels_model.set_database(db_name);
+  Annotator annotator{};
+  annotator.set_annotations_model(&annotations_model);
+  annotator.set_label_list_model(&labels_model);
+  auto te = annotator.findChild<SearchableText*>()->get_text_edit();
+  QList<QPair<int, int>> new_annotations{{0, 5}, {8, 12}, {3, 9}, {20, 22}};
+  for (const auto& new_annotation : new_annotations) {
+    auto cursor = te->textCursor();
+    cursor.setPosition(new_annotation.first);
+    cursor.setPosition(new_annotation.second, QTextCursor::KeepAnchor);
+    te->setTextCursor(cursor);
+    QTest::keyClicks(&annotator, "p");
+    // painted incrementally, then from scratch
+    auto painted = painted_spans(te);
+    annotator.update_annotations();
+    QCOMPARE(painted_spans(te), painted);
+  }
+  QCOMPARE(annotations_model.get_annotations_info().size(), 4);
+  // [0, 12) in gray and the active annotation [20, 22)
+  QCOMPARE(te->extraSelections().size(), 2);
+
+  while (annotations_model.get_annotations_info().size() != 0) {
+    auto cursor = te->textCursor();
+    cursor.setPosition(21);
+    te->setTextCursor(cursor);
+    cursor.setPosition(1);
+    te->setTextCursor(cursor);
+    if (annotator.active_annotation_label() == -1) {
+      cursor.setPosition(21);
+      te->setTextCursor(cursor);
+    }
+    QTest::keyClick(&annotator, Qt::Key_Backspace);
+    auto painted = painted_spans(te);
+    annotator.update_annotations();
+    QCOMPARE(painted_spans(te), painted);
+  }
+  QCOMPARE(te->extraSelections().size(), 0);
+}
+
 void TestAnnotator::test_extra_data_annotations() {
   QTemporaryDir tmp_dir{};
   auto db_name = prepare_db(tmp_dir);
@@ -144,4 +319,51 @@ void TestAnnotator::test_extra_data_annotations() {
   QTest::keyClick(te, Qt::Key_Escape);
   QCOMPARE(ed->text(), QString(""));
 }
+
+void TestAnnotator::test_annotation_store() {
+  AnnotationStore store{};
+  QCOMPARE(store.size(), 0);
+  QCOMPARE(store.lower_bound({0, 0}), 0);
+  QMap<int, AnnotationInfo> infos{};
+  infos[7] = AnnotationInfo{7, 1, 10, 12, QString()};
+  infos[3] = AnnotationInfo{3, 2, 10, 20, QString("extra")};
+  infos[5] = AnnotationInfo{5, 1, 2, 4, QString()};
+  store.assign(infos);
+  QCOMPARE(store.size(), 3);
+  // sorted by start then id
+  QCOMPARE(store.index_at(0).id, 5);
+  QCOMPARE(store.index_at(1).id, 3);
+  QCOMPARE(store.index_at(2).id, 7);
+  QCOMPARE(store.position(7), 2);
+  QCOMPARE(store.end_char_at(1), 20);
+  QCOMPARE(store.get(3).label_id, 2);
+  QCOMPARE(store.get(3).extra_data, QString("extra"));
+  QVERIFY(!store.contains(4));
+  QCOMPARE(store.position(4), -1);
+
+  QCOMPARE(store.lower_bound({10, 3}), 1);
+  QCOMPARE(store.upper_bound({10, 3}), 2);
+  QCOMPARE(store.lower_bound({10, 4}), 2);
+  QCOMPARE(store.upper_bound({1, 0}), 0);
+  QCOMPARE(store.lower_bound({30, 0}), 3);
+
+  store.insert(AnnotationSpan{4, 2, 10, 11, QString()});
+  QCOMPARE(store.size(), 4);
+  QCOMPARE(store.position(4), 2);
+  QCOMPARE(store.position(7), 3);
+  store.set_extra_data(4, "new");
+  QCOMPARE(store.get(4).extra_data, QString("new"));
+
+  store.remove(5);
+  QVERIFY(!store.contains(5));
+  QCOMPARE(store.position(3), 0);
+  QCOMPARE(store.position(4), 1);
+  QCOMPARE(store.position(7), 2);
+  store.remove(5);
+  QCOMPARE(store.size(), 3);
+
+  store.clear();
+  QCOMPARE(store.size(), 0);
+  QVERIFY(!store.contains(3));
+}
 } // namespace labelbuddy
@@ -9,7 +9,11 @@ class TestAnnotator : public QObject {
 private slots:
   void test_annotator();
   void test_overlapping_annotations();
+  void test_clusters();
+  void test_painted_region();
+  void test_incremental_painting();
   void test_extra_data_annotations();
+  void test_annotation_store();
 };
 } // namespace labelbuddy
 #endif
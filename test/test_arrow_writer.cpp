@@ -0,0 +1,239 @@
+#include <QBuffer>
+#include <QByteArray>
+#include <QJsonObject>
+#include <QList>
+#include <QStringList>
+#include <QtEndian>
+
+#include "arrow_writer.h"
+#include "database.h"
+#include "test_arrow_writer.h"
+
+namespace labelbuddy {
+
+namespace {
+
+template <typename T> T read_le(const QByteArray& data, int pos) {
+  return qFromLittleEndian<T>(
+      reinterpret_cast<const uchar*>(data.constData() + pos));
+}
+
+/// Just enough of a flatbuffer table reader to check the written metadata
+class Table {
+public:
+  Table(const QByteArray& data, int pos) : data_{data}, pos_{pos} {
+    vtable_ = pos - read_le<qint32>(data, pos);
+    vtable_size_ = read_le<quint16>(data, vtable_);
+  }
+
+  static Table root(const QByteArray& data) {
+    return Table(data, static_cast<int>(read_le<quint32>(data, 0)));
+  }
+
+  template <typename T> T scalar(int id) const {
+    auto pos = field_pos(id);
+    return pos ? read_le<T>(data_, pos) : T{};
+  }
+
+  Table table(int id) const { return Table(data_, target(field_pos(id))); }
+
+  QString string(int id) const {
+    auto pos = target(field_pos(id));
+    return QString::fromUtf8(data_.mid(pos + 4, read_le<qint32>(data_, pos)));
+  }
+
+  QList<Table> tables(int id) const {
+    auto pos = target(field_pos(id));
+    QList<Table> all{};
+    for (int i = 0; i != read_le<qint32>(data_, pos); ++i) {
+      all << Table(data_, target(pos + 4 + 4 * i));
+    }
+    return all;
+  }
+
+  /// The 64-bit integers of a vector of structs
+  QList<qint64> struct_values(int id, int struct_size) const {
+    auto pos = target(field_pos(id));
+    QList<qint64> values{};
+    auto n = read_le<qint32>(data_, pos) * struct_size / 8;
+    for (int i = 0; i != n; ++i) {
+      values << read_le<qint64>(data_, pos + 4 + 8 * i);
+    }
+    return values;
+  }
+
+private:
+  int field_pos(int id) const {
+    if (4 + 2 * id >= vtable_size_) {
+      return 0;
+    }
+    auto offset = read_le<quint16>(data_, vtable_ + 4 + 2 * id);
+    return offset ? pos_ + offset : 0;
+  }
+
+  int target(int pos) const {
+    return pos + static_cast<int>(read_le<quint32>(data_, pos));
+  }
+
+  QByteArray data_;
+  int pos_;
+  int vtable_;
+  int vtable_size_;
+};
+
+Table footer(const QByteArray& file) {
+  auto footer_size = read_le<qint32>(file, file.size() - 10);
+  return Table::root(file.mid(file.size() - 10 - footer_size, footer_size));
+}
+
+QStringList field_names(const Table& schema) {
+  QStringList names{};
+  for (const auto& field : schema.tables(1)) {
+    names << field.string(0);
+  }
+  return names;
+}
+
+/// Record batch messages listed in the footer: (offset, metadata length,
+/// body length)
+QList<QList<qint64>> record_batch_blocks(const QByteArray& file) {
+  auto values = footer(file).struct_values(3, 24);
+  QList<QList<qint64>> blocks{};
+  for (int i = 0; i + 2 < values.size(); i += 3) {
+    // the metadata length is a 32-bit integer followed by padding
+    blocks << QList<qint64>{values[i], values[i + 1] & 0xffffffff,
+                            values[i + 2]};
+  }
+  return blocks;
+}
+
+} // namespace
+
+void TestArrowWriter::test_file_structure() {
+  ArrowUtf8Column column("name", true);
+  QBuffer buffer{};
+  buffer.open(QIODevice::WriteOnly);
+  ArrowFileWriter writer(&buffer, {&column});
+  writer.write_prefix();
+  writer.write_record_batch();
+  QCOMPARE(writer.n_record_batches(), 0);
+  column.append("a");
+  writer.write_record_batch();
+  writer.write_suffix();
+  QCOMPARE(writer.n_record_batches(), 1);
+
+  auto file = buffer.data();
+  QVERIFY(file.startsWith(QByteArray("ARROW1\0\0", 8)));
+  QVERIFY(file.endsWith("ARROW1"));
+  // schema message
+  QCOMPARE(read_le<quint32>(file, 8), 0xffffffffU);
+  auto schema_message =
+      Table::root(file.mid(16, read_le<qint32>(file, 12)));
+  QCOMPARE(schema_message.scalar<qint16>(0), qint16{4});
+  QCOMPARE(schema_message.scalar<quint8>(1), quint8{1});
+  QCOMPARE(field_names(schema_message.table(2)), QStringList{"name"});
+
+  auto footer_table = footer(file);
+  QCOMPARE(field_names(footer_table.table(1)), QStringList{"name"});
+  auto blocks = record_batch_blocks(file);
+  QCOMPARE(blocks.size(), 1);
+  QCOMPARE(blocks[0][0] % 8, qint64{0});
+  QCOMPARE(blocks[0][1] % 8, qint64{0});
+  auto offset = static_cast<int>(blocks[0][0]);
+  QCOMPARE(read_le<quint32>(file, offset), 0xffffffffU);
+  QCOMPARE(static_cast<qint64>(read_le<qint32>(file, offset + 4)),
+           blocks[0][1] - 8);
+  // end-of-stream marker before the footer
+  auto end = static_cast<int>(blocks[0][0] + blocks[0][1] + blocks[0][2]);
+  QCOMPARE(read_le<quint32>(file, end), 0xffffffffU);
+  QCOMPARE(read_le<quint32>(file, end + 4), 0U);
+}
+
+void TestArrowWriter::test_columns() {
+  ArrowUtf8Column text("text", true);
+  ArrowListColumn lists("lists", false, new ArrowInt32Column("item", false));
+  auto& items = static_cast<ArrowInt32Column&>(lists.values());
+  text.append(QString::fromUtf8("a\xc3\xa9\xf0\x9f\x98\x80"));
+  text.append_null();
+  text.append("");
+  items.append(3);
+  items.append(-1);
+  lists.append();
+  lists.append();
+  items.append(7);
+  lists.append();
+  QCOMPARE(text.length(), 3);
+  QCOMPARE(text.null_count(), 1);
+  QCOMPARE(text.validity_buffer(), QByteArray("\x05", 1));
+  auto text_buffers = text.data_buffers();
+  QCOMPARE(text_buffers.size(), 2);
+  QCOMPARE(*text_buffers[0],
+           QByteArray("\0\0\0\0\x07\0\0\0\x07\0\0\0\x07\0\0\0", 16));
+  QCOMPARE(*text_buffers[1], QByteArray("a\xc3\xa9\xf0\x9f\x98\x80"));
+  // an unpaired surrogate is replaced
+  ArrowUtf8Column replaced("replaced", false);
+  replaced.append(QString(QChar(0xd800)));
+  QCOMPARE(*replaced.data_buffers()[1], QByteArray("\xef\xbf\xbd"));
+
+  QCOMPARE(lists.null_count(), 0);
+  QCOMPARE(lists.validity_buffer(), QByteArray());
+  QCOMPARE(*lists.data_buffers()[0],
+           QByteArray("\0\0\0\0\x02\0\0\0\x02\0\0\0\x03\0\0\0", 16));
+  QCOMPARE(*items.data_buffers()[0],
+           QByteArray("\x03\0\0\0\xff\xff\xff\xff\x07\0\0\0", 12));
+
+  lists.clear();
+  QCOMPARE(lists.length(), 0);
+  QCOMPARE(items.length(), 0);
+  QCOMPARE(*lists.data_buffers()[0], QByteArray("\0\0\0\0", 4));
+  text.clear();
+  text.append("b");
+  QCOMPARE(text.null_count(), 0);
+  QCOMPARE(*text.data_buffers()[1], QByteArray("b"));
+}
+
+void TestArrowWriter::test_docs_writer() {
+  QBuffer buffer{};
+  {
+    DocsArrowWriter writer("docs.arrow", true, true, false, &buffer, 2);
+    QVERIFY(writer.is_open());
+    writer.write_prefix();
+    for (int i = 0; i != 3; ++i) {
+      writer.add_document(
+          QString("md5%0").arg(i), QString("text of doc %0").arg(i),
+          QJsonObject{{"doc", i}}, {{0, 4, "label", i ? "" : "extra"}}, "",
+          i ? "" : "id0", "", "");
+    }
+    writer.write_suffix();
+  }
+  auto file = buffer.data();
+  QCOMPARE(field_names(footer(file).table(1)),
+           (QStringList{"utf8_text_md5_checksum", "meta", "id",
+                        "short_title", "long_title", "text", "labels"}));
+  auto blocks = record_batch_blocks(file);
+  QCOMPARE(blocks.size(), 2);
+  QList<qint64> lengths{};
+  for (const auto& block : blocks) {
+    auto message =
+        Table::root(file.mid(static_cast<int>(block[0] + 8),
+                             static_cast<int>(block[1] - 8)));
+    QCOMPARE(message.scalar<quint8>(1), quint8{3});
+    QCOMPARE(message.scalar<qint64>(3), block[2]);
+    lengths << message.table(2).scalar<qint64>(0);
+  }
+  QCOMPARE(lengths, (QList<qint64>{2, 1}));
+  QVERIFY(file.contains("text of doc 0text of doc 1"));
+  QVERIFY(file.contains("{\"doc\":2}"));
+
+  QBuffer no_text_buffer{};
+  DocsArrowWriter no_text("docs.arrow", false, false, true, &no_text_buffer);
+  no_text.write_prefix();
+  no_text.write_suffix();
+  auto no_text_file = no_text_buffer.data();
+  QCOMPARE(field_names(footer(no_text_file).table(1)),
+           (QStringList{"utf8_text_md5_checksum", "meta", "id",
+                        "annotation_approver"}));
+  QCOMPARE(record_batch_blocks(no_text_file).size(), 0);
+}
+
+} // namespace labelbuddy
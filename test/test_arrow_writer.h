@@ -0,0 +1,17 @@
+#ifndef LABELBUDDY_TEST_ARROW_WRITER_H
+#define LABELBUDDY_TEST_ARROW_WRITER_H
+
+#include <QTest>
+
+namespace labelbuddy {
+
+class TestArrowWriter : public QObject {
+  Q_OBJECT
+private slots:
+  void test_file_structure();
+  void test_columns();
+  void test_docs_writer();
+};
+} // namespace labelbuddy
+
+#endif
@@ -0,0 +1,120 @@
+#include <atomic>
+
+#include <QCryptographicHash>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QTemporaryDir>
+
+#include "batch_labeling.h"
+#include "test_batch_labeling.h"
+#include "testing_utils.h"
+
+namespace labelbuddy {
+
+void TestBatchLabeling::test_annotate_matches() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  auto db = QSqlDatabase::database(db_name);
+  QSqlQuery query(db);
+  auto n_annotations = [&query]() {
+    query.exec("select count(*) from annotation;");
+    query.next();
+    return query.value(0).toInt();
+  };
+
+  QList<int> progress{};
+  auto on_progress = [&progress](int n_docs) { progress << n_docs; };
+  auto result =
+      annotate_matches_in_chunks(db, "The", 1, true, {}, 4, on_progress);
+  QCOMPARE(result.n_docs, 6);
+  QCOMPARE(result.n_annotations, 15);
+  QCOMPARE(n_annotations(), 15);
+  // committed after the documents that reach the chunk size, then at the end
+  QCOMPARE(progress, (QList<int>{2, 6}));
+  // the annotated text is the pattern, with any case
+  query.exec("select substr(content, start_char + 1, end_char - start_char) "
+             "from annotation join document_with_content "
+             "on annotation.doc_id = document_with_content.id;");
+  while (query.next()) {
+    QCOMPARE(query.value(0).toString().toLower(), QString("the"));
+  }
+  // the counts are maintained by the triggers
+  query.exec("select n_docs from label_document_count where label_id = 1;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 2);
+
+  // existing annotations are skipped
+  result = annotate_matches_in_chunks(db, "the", 1, true, {});
+  QCOMPARE(result.n_docs, 6);
+  QCOMPARE(result.n_annotations, 0);
+
+  // only the given documents are searched
+  result = annotate_matches_in_chunks(db, "sessão", 2, false, {1, 2, 1000});
+  QCOMPARE(result.n_docs, 2);
+  QCOMPARE(result.n_annotations, 2);
+  QCOMPARE(n_annotations(), 17);
+
+  // a label that does not exist
+  result = annotate_matches_in_chunks(db, "sessão", 1000, true, {});
+  QCOMPARE(result.n_annotations, 0);
+  QCOMPARE(n_annotations(), 17);
+
+  result = annotate_matches_in_chunks(db, "sessão", 3, true, {}, 10000,
+                                      nullptr, []() { return true; });
+  QCOMPARE(result.n_docs, 0);
+  result = annotate_matches_in_chunks(db, "", 3, true, {});
+  QCOMPARE(result.n_docs, 0);
+  QCOMPARE(n_annotations(), 17);
+}
+
+void TestBatchLabeling::test_surrogate_pairs() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  auto db = QSqlDatabase::database(db_name);
+  QSqlQuery query(db);
+  query.exec("delete from document;");
+  QString pair("\U0001d11e");
+  auto content = pair + "ab" + pair + "AB";
+  query.prepare("insert into document (content, content_md5) values "
+                "(:content, :md5);");
+  query.bindValue(":content", content);
+  query.bindValue(":md5", QCryptographicHash::hash(content.toUtf8(),
+                                                   QCryptographicHash::Md5));
+  QVERIFY(query.exec());
+
+  auto result = annotate_matches_in_chunks(db, "ab", 1, true, {});
+  QCOMPARE(result.n_annotations, 2);
+  query.exec("select start_char, end_char from annotation order by rowid;");
+  QVERIFY(query.next());
+  QCOMPARE(query.value(0).toInt(), 1);
+  QCOMPARE(query.value(1).toInt(), 3);
+  QVERIFY(query.next());
+  QCOMPARE(query.value(0).toInt(), 4);
+  QCOMPARE(query.value(1).toInt(), 6);
+}
+
+void TestBatchLabeling::test_batch_labeling_thread() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  std::atomic<int> n_progress_calls{};
+  std::atomic<bool> finished{};
+  std::atomic<int> n_found{};
+  {
+    BatchLabelingThread thread(
+        db_name, "the", 1, true, {},
+        [&n_progress_calls](int) { ++n_progress_calls; },
+        [&finished, &n_found](BatchLabelingResult result) {
+          n_found = result.n_annotations;
+          finished = true;
+        });
+    QTRY_VERIFY(finished.load());
+  }
+  QCOMPARE(n_found.load(), 15);
+  QVERIFY(n_progress_calls.load() >= 1);
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  query.exec("select count(*) from annotation;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 15);
+}
+
+} // namespace labelbuddy
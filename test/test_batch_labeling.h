@@ -0,0 +1,17 @@
+#ifndef LABELBUDDY_TEST_BATCH_LABELING_H
+#define LABELBUDDY_TEST_BATCH_LABELING_H
+
+#include <QTest>
+
+namespace labelbuddy {
+
+class TestBatchLabeling : public QObject {
+  Q_OBJECT
+private slots:
+  void test_annotate_matches();
+  void test_surrogate_pairs();
+  void test_batch_labeling_thread();
+};
+} // namespace labelbuddy
+
+#endif
@@ -0,0 +1,153 @@
+#include <QByteArray>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+#include "compressed_file.h"
+#include "test_compressed_file.h"
+
+namespace labelbuddy {
+
+namespace {
+QByteArray example_data() {
+  QByteArray data{};
+  // larger than the chunks used by the codecs
+  for (int i = 0; i != 20000; ++i) {
+    data.append(QString("line %0 of the example data\n").arg(i).toUtf8());
+  }
+  return data;
+}
+
+void write_compressed(const QString& file_path, const QByteArray& data) {
+  CompressedFile file(file_path, compression_from_path(file_path));
+  QVERIFY(file.open(QIODevice::WriteOnly));
+  QCOMPARE(file.write(data), static_cast<qint64>(data.size()));
+}
+} // namespace
+
+void TestCompressedFile::test_compression_suffix() {
+  QVERIFY(compression_from_path("a/docs.jsonl.gz") == Compression::Gzip);
+  QVERIFY(compression_from_path("docs.jsonl.zst") == Compression::Zstd);
+  QVERIFY(compression_from_path("docs.jsonl") == Compression::None);
+  QCOMPARE(strip_compression_suffix("a/docs.jsonl.gz"),
+           QString("a/docs.jsonl"));
+  QCOMPARE(strip_compression_suffix("docs.jsonl"), QString("docs.jsonl"));
+  QVERIFY(is_compression_supported(Compression::Gzip));
+  auto device = make_file_device("docs.json");
+  QVERIFY(qobject_cast<CompressedFile*>(device.get()) == nullptr);
+  device = make_file_device("docs.json.gz");
+  QVERIFY(qobject_cast<CompressedFile*>(device.get()) != nullptr);
+}
+
+void TestCompressedFile::test_round_trip_data() {
+  QTest::addColumn<QString>("file_name");
+  QTest::newRow("gzip") << QString("data.txt.gz");
+  if (is_compression_supported(Compression::Zstd)) {
+    QTest::newRow("zstd") << QString("data.txt.zst");
+  }
+}
+
+void TestCompressedFile::test_round_trip() {
+  QFETCH(QString, file_name);
+  QTemporaryDir tmp_dir{};
+  auto file_path = tmp_dir.filePath(file_name);
+  auto data = example_data();
+  write_compressed(file_path, data);
+  QVERIFY(QFile(file_path).size() < data.size() / 4);
+
+  CompressedFile file(file_path, compression_from_path(file_path));
+  QVERIFY(file.open(QIODevice::ReadOnly));
+  QVERIFY(file.isSequential());
+  QVERIFY(!file.atEnd());
+  QCOMPARE(file.compressed_size(), QFile(file_path).size());
+  // read in pieces so that several calls to the codec are needed
+  QByteArray read_data{};
+  while (!file.atEnd()) {
+    auto chunk = file.read(1000);
+    QVERIFY(file.compressed_pos() <= file.compressed_size());
+    read_data.append(chunk);
+  }
+  QCOMPARE(read_data, data);
+  QCOMPARE(file.compressed_pos(), file.compressed_size());
+
+  // cannot read and write at the same time
+  CompressedFile read_write(file_path, compression_from_path(file_path));
+  QVERIFY(!read_write.open(QIODevice::ReadWrite));
+}
+
+void TestCompressedFile::test_concatenated_gzip_members() {
+  QTemporaryDir tmp_dir{};
+  auto first = tmp_dir.filePath("first.gz");
+  auto second = tmp_dir.filePath("second.gz");
+  write_compressed(first, "first part\n");
+  write_compressed(second, "second part\n");
+  QFile first_f(first);
+  first_f.open(QIODevice::ReadOnly);
+  QFile second_f(second);
+  second_f.open(QIODevice::ReadOnly);
+  auto concatenated = tmp_dir.filePath("concatenated.gz");
+  QFile out(concatenated);
+  out.open(QIODevice::WriteOnly);
+  out.write(first_f.readAll());
+  out.write(second_f.readAll());
+  out.close();
+
+  CompressedFile file(concatenated, Compression::Gzip);
+  QVERIFY(file.open(QIODevice::ReadOnly));
+  QCOMPARE(file.readAll(), QByteArray("first part\nsecond part\n"));
+}
+
+void TestCompressedFile::test_truncated_file_data() { test_round_trip_data(); }
+
+void TestCompressedFile::test_truncated_file() {
+  QFETCH(QString, file_name);
+  QTemporaryDir tmp_dir{};
+  auto file_path = tmp_dir.filePath(file_name);
+  auto data = example_data();
+  write_compressed(file_path, data);
+  QFile on_disk(file_path);
+  QVERIFY(on_disk.resize(on_disk.size() / 2));
+
+  CompressedFile file(file_path, compression_from_path(file_path));
+  QVERIFY(file.open(QIODevice::ReadOnly));
+  QByteArray read_data{};
+  while (!file.atEnd()) {
+    read_data.append(file.read(1000));
+  }
+  QVERIFY(file.decompression_failed());
+  QVERIFY(read_data.size() < data.size());
+  QVERIFY(data.startsWith(read_data));
+}
+
+void TestCompressedFile::test_text_stream() {
+  QTemporaryDir tmp_dir{};
+  auto file_path = tmp_dir.filePath("lines.txt.gz");
+  {
+    auto device = make_file_device(file_path);
+    QVERIFY(device->open(QIODevice::WriteOnly | QIODevice::Text));
+    QTextStream out(device.get());
+    out.setCodec("UTF-8");
+    out << QString::fromUtf8(u8"maçã\n") << "second line\n";
+  }
+  auto device = make_file_device(file_path);
+  QVERIFY(device->open(QIODevice::ReadOnly | QIODevice::Text));
+  QTextStream in(device.get());
+  in.setCodec("UTF-8");
+  QCOMPARE(in.readLine(), QString::fromUtf8(u8"maçã"));
+  QCOMPARE(in.readLine(), QString("second line"));
+  QVERIFY(in.atEnd());
+  QCOMPARE(file_device_pos(*device), file_device_size(*device));
+}
+
+void TestCompressedFile::test_compress_block() {
+  auto data = example_data();
+  auto compressed = compress_block(data);
+  QVERIFY(compressed.size() < data.size() / 4);
+  QCOMPARE(uncompress_block(compressed), data);
+  // data compressed by a build without zstd can always be read
+  QCOMPARE(uncompress_block(qCompress(data)), data);
+  // a small size followed by data that is not a zlib stream
+  QVERIFY(uncompress_block(QByteArray("\0\0\0\x10not zlib", 12)).isNull());
+}
+
+} // namespace labelbuddy
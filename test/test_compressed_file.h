@@ -0,0 +1,22 @@
+#ifndef LABELBUDDY_TEST_COMPRESSED_FILE_H
+#define LABELBUDDY_TEST_COMPRESSED_FILE_H
+
+#include <QTest>
+
+namespace labelbuddy {
+
+class TestCompressedFile : public QObject {
+  Q_OBJECT
+private slots:
+  void test_compression_suffix();
+  void test_round_trip_data();
+  void test_round_trip();
+  void test_concatenated_gzip_members();
+  void test_truncated_file_data();
+  void test_truncated_file();
+  void test_text_stream();
+  void test_compress_block();
+};
+} // namespace labelbuddy
+
+#endif
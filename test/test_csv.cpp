@@ -1,3 +1,4 @@
+#include <QBuffer>
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
@@ -85,6 +86,64 @@ void TestCsv::test_read_write_csv() {
   compare_files(out_file_path, reference_file);
 }
 
+void TestCsv::test_read_long_fields() {
+  // fields longer than the reader's blocks, with quotes and line breaks
+  // around the block boundaries
+  auto long_field = QString("abc").repeated(30000);
+  auto quoted = QString("a\"b\r\nc").repeated(20000);
+  auto escaped = quoted;
+  escaped.replace("\"", "\"\"");
+  auto csv_text = QString("x,y\r\n%0,\"%1\"\r\n\"%1\",%0\r\nlast,a\rb")
+                      .arg(long_field)
+                      .arg(escaped);
+  auto bytes = csv_text.toUtf8();
+  QBuffer buffer(&bytes);
+  buffer.open(QIODevice::ReadOnly);
+  QTextStream stream(&buffer);
+  CsvReader reader(&stream);
+  QCOMPARE(reader.read_record(), (QList<QString>{"x", "y"}));
+  QCOMPARE(reader.read_record(), (QList<QString>{long_field, quoted}));
+  QCOMPARE(reader.read_record(), (QList<QString>{quoted, long_field}));
+  QCOMPARE(reader.read_record(), (QList<QString>{"last", "a\rb"}));
+  QVERIFY(reader.at_end());
+  QVERIFY(!reader.found_error());
+}
+
+void TestCsv::test_map_reader_fields() {
+  QByteArray bytes{"text,id,text,meta\n"
+                   "first,1,ignored,{}\n"
+                   "second,2\n"
+                   "third,3,x,y,extra\n"};
+  QBuffer buffer(&bytes);
+  buffer.open(QIODevice::ReadOnly);
+  QTextStream stream(&buffer);
+  CsvMapReader reader(&stream);
+  QCOMPARE(reader.column_index("text"), 0);
+  QCOMPARE(reader.column_index("meta"), 3);
+  QCOMPARE(reader.column_index("label"), -1);
+  auto meta = reader.column_index("meta");
+
+  reader.read_fields();
+  QCOMPARE(reader.field(0), QString("first"));
+  QCOMPARE(reader.field(1), QString("1"));
+  QVERIFY(reader.has_field(meta));
+  QCOMPARE(reader.field(meta), QString("{}"));
+  QVERIFY(!reader.has_field(-1));
+  QVERIFY(reader.field(-1).isNull());
+
+  reader.read_fields();
+  QCOMPARE(reader.field(0), QString("second"));
+  QVERIFY(!reader.has_field(meta));
+  QVERIFY(reader.field(meta).isNull());
+
+  auto record = reader.read_record();
+  QCOMPARE(record.size(), 3);
+  QCOMPARE(record["text"], QString("third"));
+  QCOMPARE(record["meta"], QString("y"));
+  QVERIFY(reader.at_end());
+  QVERIFY(!reader.found_error());
+}
+
 void compare_files(const QString& file_a, const QString& file_b) {
   QFile fa(file_a);
   fa.open(QIODevice::ReadOnly);
@@ -10,6 +10,8 @@ class TestCsv : public QObject {
 private slots:
   void test_read_write_csv();
   void test_read_write_csv_data();
+  void test_read_long_fields();
+  void test_map_reader_fields();
 };
 
 void compare_files(const QString& file_a, const QString& file_b);
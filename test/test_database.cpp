@@ -1,4 +1,10 @@
+#include <future>
+
+#include <QCryptographicHash>
+#include <QDateTime>
 #include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QSettings>
@@ -9,7 +15,10 @@
 #include <QXmlStreamReader>
 
 #include "csv.h"
+#include "document_loader.h"
+#include "summary_backfill.h"
 #include "test_database.h"
+#include "testing_utils.h"
 
 namespace labelbuddy {
 
@@ -40,8 +49,13 @@ void TestDatabase::test_open_database() {
   auto file_path = tmp_dir.filePath("db.sqlite");
   catalog.open_database(file_path);
   auto db = QSqlDatabase::database(file_path);
-  QStringList expected{"document",  "label",           "annotation",
-                       "app_state", "app_state_extra", "database_info"};
+  QStringList expected{"document",        "label",
+                       "annotation",      "app_state",
+                       "app_state_extra", "database_info",
+                       "document_annotation_count",
+                       "document_label_count",
+                       "label_document_count",
+                       "document_change"};
   QCOMPARE(db.tables(), expected);
   QCOMPARE(catalog.get_current_database(), file_path);
 
@@ -124,6 +138,22 @@ void TestDatabase::test_open_database_errors() {
   QVERIFY(!QSqlDatabase::contains(bad_db_path));
   db_path = catalog.get_current_database();
   QCOMPARE(db_path, file_path);
+
+  // an up-to-date database that cannot be written
+  auto read_only_path = tmp_dir.filePath("read_only.labelbuddy");
+  {
+    DatabaseCatalog other_catalog{};
+    QVERIFY(other_catalog.open_database(read_only_path, false));
+  }
+  QSqlDatabase::removeDatabase(read_only_path);
+  QFile(read_only_path).setPermissions(QFileDevice::ReadOwner);
+  if (QFileInfo(read_only_path).isWritable()) {
+    QSKIP("file permissions are not enforced (running as root?)");
+  }
+  opened = catalog.open_database(read_only_path, false);
+  QVERIFY(!opened);
+  QVERIFY(!QSqlDatabase::contains(read_only_path));
+  QCOMPARE(catalog.get_current_database(), file_path);
 }
 
 void TestDatabase::test_last_opened_database() {
@@ -921,4 +951,1787 @@ void TestDatabase::test_import_errors() {
   QCOMPARE(query.value(0).toInt(), 0);
 }
 
+void TestDatabase::test_json_docs_reader() {
+  QTemporaryDir tmp_dir{};
+  auto file_path = tmp_dir.filePath("docs.json");
+  {
+    QFile file(file_path);
+    file.open(QIODevice::WriteOnly);
+    file.write("\xef\xbb\xbf [ {\"text\": \"a ] } [ \\\" , b\", \"meta\": "
+               "{\"x\": [1, {\"y\": 2}]}},\n 3,\n{\"text\": \"c\"} ]");
+  }
+  JsonDocsReader reader(file_path);
+  QVERIFY(!reader.has_error());
+  QVERIFY(reader.read_next());
+  QCOMPARE(reader.get_current_record()->content, QString("a ] } [ \" , b"));
+  QCOMPARE(reader.get_current_record()->metadata,
+           QByteArray("{\"x\":[1,{\"y\":2}]}"));
+  QVERIFY(reader.read_next());
+  QVERIFY(!reader.get_current_record()->valid_content);
+  QVERIFY(reader.read_next());
+  QCOMPARE(reader.get_current_record()->content, QString("c"));
+  QVERIFY(!reader.read_next());
+  QVERIFY(!reader.has_error());
+  QCOMPARE(reader.current_progress(), reader.progress_max());
+
+  auto truncated_path = tmp_dir.filePath("truncated.json");
+  {
+    QFile file(truncated_path);
+    file.open(QIODevice::WriteOnly);
+    file.write("[{\"text\": \"a\"}, {\"text\": \"b");
+  }
+  JsonDocsReader truncated_reader(truncated_path);
+  QVERIFY(truncated_reader.read_next());
+  QVERIFY(!truncated_reader.read_next());
+  QCOMPARE(static_cast<int>(truncated_reader.error_code()),
+           static_cast<int>(ErrorCode::CriticalParsingError));
+}
+
+void TestDatabase::test_mapped_line_readers() {
+  QTemporaryDir tmp_dir{};
+  auto txt_path = tmp_dir.filePath("docs.txt");
+  {
+    QFile file(txt_path);
+    file.open(QIODevice::WriteOnly);
+    file.write("\xef\xbb\xbfma\xc3\xa7\xc3\xa3\r\n\nb\r\nlast");
+  }
+  TxtDocsReader txt_reader(txt_path);
+  QStringList contents{};
+  while (txt_reader.read_next()) {
+    contents << txt_reader.get_current_record()->content;
+  }
+  QVERIFY(!txt_reader.has_error());
+  QCOMPARE(contents, QStringList({"maçã", "", "b", "last"}));
+  QCOMPARE(txt_reader.current_progress(), txt_reader.progress_max());
+
+  // the mapped bytes are hashed, unless they are not valid utf-8 or start
+  // with a BOM (eg concatenated files)
+  auto invalid_path = tmp_dir.filePath("invalid.txt");
+  {
+    QFile file(invalid_path);
+    file.open(QIODevice::WriteOnly);
+    file.write("ma\xc3\xa7\xc3\xa3\na\xff\xc3" "b\n\xef\xbb\xbf" "c\n");
+  }
+  TxtDocsReader invalid_reader(invalid_path);
+  QList<bool> has_utf8{};
+  while (invalid_reader.read_next()) {
+    const auto& record = *invalid_reader.get_current_record();
+    has_utf8 << !record.content_utf8.isEmpty();
+    QCOMPARE(doc_record_md5(record),
+             QCryptographicHash::hash(record.content.toUtf8(),
+                                      QCryptographicHash::Md5));
+  }
+  QCOMPARE(has_utf8, QList<bool>({true, false, false}));
+
+  // utf-16 files are not mapped but read with QTextStream
+  auto utf16_path = tmp_dir.filePath("utf16.txt");
+  {
+    QFile file(utf16_path);
+    file.open(QIODevice::WriteOnly);
+    QTextStream out(&file);
+    out.setCodec("UTF-16LE");
+    out.setGenerateByteOrderMark(true);
+    out << "maçã\nb\n";
+  }
+  TxtDocsReader utf16_reader(utf16_path);
+  contents.clear();
+  while (utf16_reader.read_next()) {
+    contents << utf16_reader.get_current_record()->content;
+  }
+  QCOMPARE(contents, QStringList({"maçã", "b"}));
+
+  auto jsonl_path = tmp_dir.filePath("docs.jsonl");
+  {
+    QFile file(jsonl_path);
+    file.open(QIODevice::WriteOnly);
+    file.write("\xef\xbb\xbf{\"text\": \"ma\xc3\xa7\xc3\xa3\"}\r\n\n\n"
+               "{\"text\": \"b\", \"meta\": {\"x\": 1}}\r\n{\"text\": \"c\"}");
+  }
+  JsonLinesDocsReader jsonl_reader(jsonl_path);
+  QVERIFY(jsonl_reader.read_next());
+  QCOMPARE(jsonl_reader.get_current_record()->content, QString("maçã"));
+  QVERIFY(jsonl_reader.read_next());
+  QCOMPARE(jsonl_reader.get_current_record()->content, QString("b"));
+  QCOMPARE(jsonl_reader.get_current_record()->metadata,
+           QByteArray("{\"x\":1}"));
+  QVERIFY(jsonl_reader.read_next());
+  QCOMPARE(jsonl_reader.get_current_record()->content, QString("c"));
+  QVERIFY(!jsonl_reader.read_next());
+  QVERIFY(!jsonl_reader.has_error());
+  QCOMPARE(jsonl_reader.current_progress(), jsonl_reader.progress_max());
+}
+
+void TestDatabase::test_docs_reading_thread() {
+  std::unique_ptr<DocsReader> reader(
+      new JsonDocsReader(":test/data/test_documents.json"));
+  DocsReadingThread reading_thread(std::move(reader), 1);
+  DocsReadingThread::Item item{};
+  int n_docs{};
+  while (reading_thread.next(item)) {
+    QCOMPARE(item.content_md5,
+             QCryptographicHash::hash(item.record->content.toUtf8(),
+                                      QCryptographicHash::Md5));
+    ++n_docs;
+  }
+  QCOMPARE(n_docs, 6);
+  QVERIFY(!reading_thread.reader().has_error());
+
+  std::unique_ptr<DocsReader> other_reader(
+      new JsonDocsReader(":test/data/test_documents.json"));
+  DocsReadingThread stopped_thread(std::move(other_reader), 1);
+  QVERIFY(stopped_thread.next(item));
+  stopped_thread.stop();
+  n_docs = 1;
+  while (stopped_thread.next(item)) {
+    ++n_docs;
+  }
+  QVERIFY(n_docs < 6);
+
+  // with a pool of hashing threads the records keep the file's order
+  std::unique_ptr<DocsReader> serial_reader(
+      new JsonDocsReader(":test/data/test_documents.json"));
+  std::unique_ptr<DocsReader> pool_reader(
+      new JsonDocsReader(":test/data/test_documents.json"));
+  DocsReadingThread serial_thread(std::move(serial_reader), 2);
+  DocsReadingThread pool_thread(std::move(pool_reader), 4, nullptr, 0, 3);
+  DocsReadingThread::Item pool_item{};
+  n_docs = 0;
+  while (serial_thread.next(item)) {
+    QVERIFY(pool_thread.next(pool_item));
+    QCOMPARE(pool_item.content_md5, item.content_md5);
+    QCOMPARE(pool_item.resume_offset, item.resume_offset);
+    QCOMPARE(pool_item.record->content, item.record->content);
+    ++n_docs;
+  }
+  QVERIFY(!pool_thread.next(pool_item));
+  QCOMPARE(n_docs, 6);
+
+  std::unique_ptr<DocsReader> stopped_pool_reader(
+      new JsonDocsReader(":test/data/test_documents.json"));
+  DocsReadingThread stopped_pool_thread(std::move(stopped_pool_reader), 2,
+                                        nullptr, 0, 2);
+  QVERIFY(stopped_pool_thread.next(item));
+  stopped_pool_thread.stop();
+  n_docs = 1;
+  while (stopped_pool_thread.next(item)) {
+    QCOMPARE(item.content_md5,
+             QCryptographicHash::hash(item.record->content.toUtf8(),
+                                      QCryptographicHash::Md5));
+    ++n_docs;
+  }
+  QVERIFY(n_docs < 6);
+}
+
+void TestDatabase::test_import_annotations_batch() {
+  QTemporaryDir tmp_dir{};
+  auto file_path = tmp_dir.filePath("docs.jsonl");
+  {
+    QFile file(file_path);
+    file.open(QIODevice::WriteOnly);
+    file.write("{\"text\": \"abcdef\", \"labels\": [[0, 1, \"a\"], [0, 1, "
+               "\"a\"], [1, 2, \"\"], [2, 1, \"b\"], [1, 3, \"b\", \"x\"]]}\n"
+               "{\"text\": \"ghi\", \"labels\": [[0, 2, \"b\"]]}\n");
+  }
+  DatabaseCatalog catalog{};
+  auto res = catalog.import_documents(file_path);
+  QCOMPARE(res.n_docs, 2);
+  QCOMPARE(res.n_annotations, 3);
+  QSqlQuery query(QSqlDatabase::database(catalog.get_current_database()));
+  query.exec("select count(*) from label;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 2);
+  query.exec("select extra_data from annotation where start_char = 1;");
+  query.next();
+  QCOMPARE(query.value(0).toString(), QString("x"));
+
+  // importing again only adds the annotations that were not there
+  res = catalog.import_documents(file_path);
+  QCOMPARE(res.n_docs, 0);
+  QCOMPARE(res.n_annotations, 0);
+
+  // duplicates within a file and of existing documents get the new
+  // annotations
+  {
+    QFile file(file_path);
+    file.open(QIODevice::WriteOnly);
+    file.write("{\"text\": \"ghi\", \"labels\": [[1, 2, \"b\"]]}\n"
+               "{\"text\": \"jkl\"}\n"
+               "{\"text\": \"jkl\", \"labels\": [[0, 1, \"a\"]]}\n");
+  }
+  res = catalog.import_documents(file_path);
+  QCOMPARE(res.n_docs, 1);
+  QCOMPARE(res.n_annotations, 2);
+  query.exec("select count(*) from document;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 3);
+
+  // documents that cannot be inserted are reported and not counted
+  query.exec("create temp trigger reject_doc before insert on document "
+             "when new.content_length = 4 begin select raise(abort, "
+             "'rejected'); end;");
+  {
+    QFile file(file_path);
+    file.open(QIODevice::WriteOnly);
+    file.write("{\"text\": \"mnop\", \"labels\": [[0, 1, \"a\"]]}\n"
+               "{\"text\": \"qrs\", \"labels\": [[0, 1, \"a\"]]}\n");
+  }
+  res = catalog.import_documents(file_path);
+  QCOMPARE(res.n_docs, 1);
+  QCOMPARE(res.n_annotations, 1);
+  QCOMPARE(static_cast<int>(res.error_code),
+           static_cast<int>(ErrorCode::DatabaseError));
+  QCOMPARE(res.error_message, QString("1 documents could not be inserted."));
+}
+
+void TestDatabase::test_import_checkpoints() {
+  QTemporaryDir tmp_dir{};
+  auto valid_path = tmp_dir.filePath("valid.jsonl");
+  auto invalid_path = tmp_dir.filePath("invalid.jsonl");
+  QByteArray docs("{\"text\": \"a\"}\n{\"text\": \"b\"}\n{\"text\": \"c\"}\n"
+                  "{\"text\": \"d\"}\n{\"text\": \"e\"}\n");
+  {
+    QFile file(valid_path);
+    file.open(QIODevice::WriteOnly);
+    file.write(docs);
+    QFile invalid_file(invalid_path);
+    invalid_file.open(QIODevice::WriteOnly);
+    invalid_file.write(docs + "not json\n");
+  }
+  DatabaseCatalog catalog{};
+  catalog.open_database(tmp_dir.filePath("db.sqlite"));
+  QSqlQuery query(QSqlDatabase::database(catalog.get_current_database()));
+  const auto& key = DatabaseCatalog::import_checkpoint_key;
+  auto get_checkpoint = [&catalog, &key]() {
+    return QJsonDocument::fromJson(
+               catalog.get_app_state_extra(key, QString()).toString().toUtf8())
+        .object();
+  };
+  auto set_checkpoint = [&catalog, &key](const QJsonObject& checkpoint) {
+    catalog.set_app_state_extra(
+        key, QString::fromUtf8(QJsonDocument(checkpoint).toJson()));
+  };
+
+  // without checkpoints nothing is kept
+  auto res = catalog.import_documents(invalid_path);
+  QCOMPARE(res.n_docs, 0);
+
+  // the last chunk is rolled back, the committed ones are kept
+  res = catalog.import_documents(invalid_path, nullptr, 2);
+  QCOMPARE(static_cast<int>(res.error_code),
+           static_cast<int>(ErrorCode::CriticalParsingError));
+  QCOMPARE(res.n_docs, 4);
+  auto checkpoint = get_checkpoint();
+  QCOMPARE(checkpoint["file"].toString(),
+           QFileInfo(invalid_path).absoluteFilePath());
+  QCOMPARE(checkpoint["size"].toDouble(),
+           static_cast<double>(QFileInfo(invalid_path).size()));
+  QCOMPARE(checkpoint["n_docs"].toInt(), 4);
+  QCOMPARE(checkpoint["offset"].toDouble(), 4. * 14.);
+
+  // resuming starts after the 4 documents already imported
+  QFileInfo valid_info(valid_path);
+  checkpoint["file"] = valid_info.absoluteFilePath();
+  checkpoint["size"] = static_cast<double>(valid_info.size());
+  checkpoint["modified"] =
+      static_cast<double>(valid_info.lastModified().toMSecsSinceEpoch());
+  query.exec("delete from document;");
+  set_checkpoint(checkpoint);
+  res = catalog.import_documents(valid_path, nullptr, 2);
+  QCOMPARE(static_cast<int>(res.error_code),
+           static_cast<int>(ErrorCode::NoError));
+  QCOMPARE(res.n_docs, 1);
+  query.exec("select content from document;");
+  QVERIFY(query.next());
+  QCOMPARE(query.value(0).toString(), QString("e"));
+  query.finish();
+  // a complete import removes the checkpoint
+  QVERIFY(get_checkpoint().isEmpty());
+
+  // without an offset the documents before the checkpoint are skipped
+  checkpoint["offset"] = -1;
+  query.exec("delete from document;");
+  set_checkpoint(checkpoint);
+  res = catalog.import_documents(valid_path, nullptr, 2);
+  QCOMPARE(res.n_docs, 1);
+
+  // checkpoints of other files are ignored
+  query.exec("delete from document;");
+  set_checkpoint(checkpoint);
+  res = catalog.import_documents(invalid_path, nullptr, 10);
+  QCOMPARE(res.n_docs, 0);
+  res = catalog.import_documents(valid_path);
+  QCOMPARE(res.n_docs, 5);
+  QCOMPARE(get_checkpoint()["n_docs"].toInt(), 4);
+}
+
+void TestDatabase::test_import_multiple_files() {
+  QTemporaryDir tmp_dir{};
+  QStringList file_paths{};
+  for (int i = 0; i != 4; ++i) {
+    file_paths << tmp_dir.filePath(QString("docs_%0.jsonl").arg(i));
+    QFile file(file_paths.back());
+    file.open(QIODevice::WriteOnly);
+    for (int j = 0; j != 50; ++j) {
+      // the last document of each file is also the first of the next one
+      file.write(QString("{\"text\": \"doc %0\"}\n")
+                     .arg(i * 49 + j)
+                     .toUtf8());
+    }
+  }
+  file_paths.insert(2, tmp_dir.filePath("missing.jsonl"));
+  auto get_docs = [](const QString& db_name) {
+    QSqlQuery query(QSqlDatabase::database(db_name));
+    query.exec("select id, content from document order by id;");
+    QList<QPair<int, QString>> docs{};
+    while (query.next()) {
+      docs << QPair<int, QString>{query.value(0).toInt(),
+                                  query.value(1).toString()};
+    }
+    return docs;
+  };
+  DatabaseCatalog catalog{};
+  catalog.open_database(tmp_dir.filePath("sequential.sqlite"));
+  auto sequential = catalog.import_documents(file_paths, 1);
+  auto sequential_docs = get_docs(catalog.get_current_database());
+  catalog.open_database(tmp_dir.filePath("parallel.sqlite"));
+  auto parallel = catalog.import_documents(file_paths, 3);
+  auto parallel_docs = get_docs(catalog.get_current_database());
+
+  QCOMPARE(sequential_docs.size(), 4 * 49 + 1);
+  QCOMPARE(parallel_docs, sequential_docs);
+  QCOMPARE(parallel_docs[50].second, QString("doc 50"));
+  QCOMPARE(parallel.size(), 5);
+  QCOMPARE(parallel[0].n_docs, 50);
+  QCOMPARE(parallel[1].n_docs, 49);
+  QCOMPARE(static_cast<int>(parallel[2].error_code),
+           static_cast<int>(ErrorCode::FileSystemError));
+  QCOMPARE(parallel[3].n_docs, 49);
+  QCOMPARE(parallel[4].n_docs, 49);
+  for (int i = 0; i != 5; ++i) {
+    QCOMPARE(parallel[i].n_docs, sequential[i].n_docs);
+  }
+}
+
+void TestDatabase::test_batch_stats() {
+  QTemporaryDir tmp_dir{};
+  auto docs_file = tmp_dir.filePath("docs.json");
+  QFile::copy(":test/data/test_documents.json", docs_file);
+  BatchStats stats{};
+  DatabaseCatalog catalog{};
+  catalog.open_database(tmp_dir.filePath("db.sqlite"));
+  catalog.set_batch_stats(&stats);
+  catalog.import_documents(docs_file);
+  for (auto phase : {BatchPhase::Parse, BatchPhase::Hash, BatchPhase::Insert,
+                     BatchPhase::Commit}) {
+    QVERIFY(stats.seconds(phase) > 0.);
+  }
+  QCOMPARE(stats.seconds(BatchPhase::Query), 0.);
+  for (int n_threads : {1, 2}) {
+    catalog.export_documents(tmp_dir.filePath("out.jsonl"), false, true, true,
+                             "", nullptr, n_threads);
+  }
+  catalog.export_documents(tmp_dir.filePath("out.jsonl"), false, true, true,
+                           "", nullptr, 1, 4);
+  QVERIFY(stats.seconds(BatchPhase::Query) > 0.);
+  QVERIFY(stats.seconds(BatchPhase::Serialize) > 0.);
+
+  stats.add_imported(6, 2, 100);
+  stats.add_exported(6, 2, 50);
+  auto json = stats.to_json();
+  QVERIFY(json["wall_seconds"].toDouble() > 0.);
+  auto phases = json["phase_seconds"].toObject();
+  QCOMPARE(phases.size(), 6);
+  QCOMPARE(phases["parse"].toDouble(), stats.seconds(BatchPhase::Parse));
+  QCOMPARE(json["imported_docs"].toInt(), 6);
+  QCOMPARE(json["bytes_written"].toInt(), 50);
+  QVERIFY(json["docs_per_second"].toDouble() > 0.);
+  QVERIFY(json.contains("peak_rss"));
+#ifdef Q_OS_UNIX
+  QVERIFY(json["peak_rss"].toDouble() > 0.);
+#endif
+
+  // measurements stop when the stats are unset
+  catalog.set_batch_stats(nullptr);
+  auto parse_seconds = stats.seconds(BatchPhase::Parse);
+  catalog.import_documents(docs_file);
+  QCOMPARE(stats.seconds(BatchPhase::Parse), parse_seconds);
+}
+
+void TestDatabase::test_pragma_profiles() {
+  QTemporaryDir tmp_dir{};
+  auto db_path = tmp_dir.filePath("db.sqlite");
+  auto pragma = [](const QString& db_name, const QString& name) {
+    QSqlQuery query(QSqlDatabase::database(db_name));
+    query.exec(QString("PRAGMA %0;").arg(name));
+    query.next();
+    return query.value(0);
+  };
+  {
+    DatabaseCatalog catalog{};
+    catalog.open_database(db_path);
+    QCOMPARE(catalog.get_pragma_profile(), QString("default"));
+    QCOMPARE(pragma(db_path, "journal_mode").toString(), QString("delete"));
+    QVERIFY(!catalog.set_pragma_profile("unknown"));
+    QCOMPARE(catalog.get_pragma_profile(), QString("default"));
+
+    // the database is empty so the page size is also changed
+    QVERIFY(catalog.set_pragma_profile("bulk"));
+    QCOMPARE(pragma(db_path, "page_size").toInt(), 8192);
+    QVERIFY(catalog.set_pragma_profile("fast"));
+    QCOMPARE(catalog.get_pragma_profile(), QString("fast"));
+    QCOMPARE(pragma(db_path, "journal_mode").toString(), QString("wal"));
+    QCOMPARE(pragma(db_path, "synchronous").toInt(), 1);
+    QCOMPARE(pragma(db_path, "cache_size").toInt(), -65536);
+
+    // the bulk settings are only used during the import
+    catalog.import_documents(":test/data/test_documents.json");
+    QCOMPARE(pragma(db_path, "cache_size").toInt(), -65536);
+    QCOMPARE(pragma(db_path, "page_size").toInt(), 8192);
+    catalog.vacuum_db();
+    QCOMPARE(pragma(db_path, "page_size").toInt(), 4096);
+    QCOMPARE(pragma(db_path, "journal_mode").toString(), QString("wal"));
+  }
+  QSqlDatabase::removeDatabase(db_path);
+
+  // the profile is applied again when the database is opened
+  DatabaseCatalog catalog{};
+  catalog.open_database(db_path);
+  QCOMPARE(catalog.get_pragma_profile(), QString("fast"));
+  QCOMPARE(pragma(db_path, "synchronous").toInt(), 1);
+  QCOMPARE(pragma(db_path, "cache_size").toInt(), -65536);
+  QVERIFY(catalog.set_pragma_profile("default"));
+  QCOMPARE(pragma(db_path, "journal_mode").toString(), QString("delete"));
+  QCOMPARE(pragma(db_path, "synchronous").toInt(), 2);
+
+  // an import does not change the database file's journal mode
+  catalog.import_documents(":test/data/test_documents.json");
+  QCOMPARE(pragma(db_path, "journal_mode").toString(), QString("delete"));
+  QCOMPARE(pragma(db_path, "synchronous").toInt(), 2);
+  QCOMPARE(pragma(db_path, "cache_size").toInt(), -2000);
+}
+
+void TestDatabase::test_incremental_vacuum() {
+  QTemporaryDir tmp_dir{};
+  auto db_path = tmp_dir.filePath("db.sqlite");
+  DatabaseCatalog catalog{};
+  catalog.open_database(db_path);
+  QSqlQuery query(QSqlDatabase::database(db_path));
+  auto pragma = [&query](const QString& name) {
+    query.exec(QString("PRAGMA %0;").arg(name));
+    query.next();
+    auto value = query.value(0).toInt();
+    query.finish();
+    return value;
+  };
+  QCOMPARE(pragma("auto_vacuum"), 2);
+  query.exec("begin transaction;");
+  query.prepare("insert into document (content, content_md5) values "
+                "(:content, :md5);");
+  for (int i = 0; i != 200; ++i) {
+    auto content = QString("document %0 ").arg(i).repeated(200);
+    query.bindValue(":content", content);
+    query.bindValue(":md5", QCryptographicHash::hash(content.toUtf8(),
+                                                     QCryptographicHash::Md5));
+    query.exec();
+  }
+  query.exec("commit transaction;");
+  auto size = QFileInfo(db_path).size();
+  query.exec("delete from document;");
+  auto n_free = pragma("freelist_count");
+  QVERIFY(n_free > 20);
+  QCOMPARE(incremental_vacuum(query, 10), n_free);
+  QCOMPARE(pragma("freelist_count"), 0);
+  QVERIFY(QFileInfo(db_path).size() < size);
+
+  // databases created without incremental vacuum are converted by vacuum_db
+  query.exec("PRAGMA auto_vacuum = NONE;");
+  query.exec("VACUUM;");
+  QCOMPARE(pragma("auto_vacuum"), 0);
+  QCOMPARE(incremental_vacuum(query), 0);
+  catalog.vacuum_db();
+  QCOMPARE(pragma("auto_vacuum"), 2);
+}
+
+void TestDatabase::test_parallel_export_data() {
+  QTest::addColumn<QString>("suffix");
+  QTest::addColumn<bool>("labelled_only");
+  for (const auto& suffix : {"json", "jsonl", "csv", "xml", "arrow", "lbb"}) {
+    QTest::newRow(QString("%0_all").arg(suffix).toUtf8())
+        << QString(suffix) << false;
+    // annotations are deleted so no document is exported
+    QTest::newRow(QString("%0_empty").arg(suffix).toUtf8())
+        << QString(suffix) << true;
+  }
+}
+
+void TestDatabase::test_parallel_export() {
+  QFETCH(QString, suffix);
+  QFETCH(bool, labelled_only);
+  QTemporaryDir tmp_dir{};
+  DatabaseCatalog catalog{};
+  catalog.open_database(tmp_dir.filePath("db.sqlite"));
+  catalog.import_documents(":test/data/test_documents.json");
+  add_many_docs(catalog.get_current_database());
+  if (labelled_only) {
+    QSqlQuery query(QSqlDatabase::database(catalog.get_current_database()));
+    query.exec("delete from annotation;");
+  }
+
+  auto serial_file = tmp_dir.filePath(QString("serial.%0").arg(suffix));
+  auto parallel_file = tmp_dir.filePath(QString("parallel.%0").arg(suffix));
+  auto serial_res = catalog.export_documents(serial_file, labelled_only, true,
+                                             true, "someone", nullptr, 1);
+  auto parallel_res = catalog.export_documents(
+      parallel_file, labelled_only, true, true, "someone", nullptr, 3);
+  QCOMPARE(parallel_res.n_docs, serial_res.n_docs);
+  QCOMPARE(parallel_res.n_annotations, serial_res.n_annotations);
+  QCOMPARE(parallel_res.n_docs, labelled_only ? 0 : 366);
+
+  QFile serial_f(serial_file);
+  serial_f.open(QIODevice::ReadOnly);
+  QFile parallel_f(parallel_file);
+  parallel_f.open(QIODevice::ReadOnly);
+  QCOMPARE(parallel_f.readAll(), serial_f.readAll());
+}
+
+void TestDatabase::test_sharded_export_data() {
+  QTest::addColumn<QString>("suffix");
+  for (const auto& suffix : {"json", "jsonl", "csv", "xml", "lbb"}) {
+    QTest::newRow(suffix) << QString(suffix);
+  }
+}
+
+void TestDatabase::test_sharded_export() {
+  QFETCH(QString, suffix);
+  QTemporaryDir tmp_dir{};
+  DatabaseCatalog catalog{};
+  catalog.open_database(tmp_dir.filePath("db.sqlite"));
+  catalog.import_documents(":test/data/test_documents.json");
+  add_many_docs(catalog.get_current_database());
+
+  auto out_file = tmp_dir.filePath(QString("out.%0").arg(suffix));
+  auto res = catalog.export_documents(out_file, false, true, true, "", nullptr,
+                                      2, 100);
+  QCOMPARE(res.n_docs, 366);
+  QCOMPARE(export_shard_path(out_file, 3),
+           tmp_dir.filePath(QString("out-00003.%0").arg(suffix)));
+  QVERIFY(!QFile::exists(out_file));
+  QVERIFY(!QFile::exists(export_shard_path(out_file, 4)));
+
+  // each shard can be imported on its own
+  int n_imported{};
+  for (int i = 0; i != 4; ++i) {
+    DatabaseCatalog shard_catalog{};
+    shard_catalog.open_database(tmp_dir.filePath(QString("shard_%0").arg(i)));
+    auto import_res =
+        shard_catalog.import_documents(export_shard_path(out_file, i));
+    QCOMPARE(static_cast<int>(import_res.error_code),
+             static_cast<int>(ErrorCode::NoError));
+    QCOMPARE(import_res.n_docs, i == 3 ? 66 : 100);
+    n_imported += import_res.n_docs;
+  }
+  QCOMPARE(n_imported, res.n_docs);
+}
+
+void TestDatabase::test_compressed_import_export_data() {
+  QTest::addColumn<QString>("suffix");
+  QTest::addColumn<int>("n_threads");
+  for (const auto& suffix :
+       {"json.gz", "jsonl.gz", "csv.gz", "xml.gz", "lbb.gz"}) {
+    QTest::newRow(QString("%0_serial").arg(suffix).toUtf8())
+        << QString(suffix) << 1;
+    QTest::newRow(QString("%0_parallel").arg(suffix).toUtf8())
+        << QString(suffix) << 2;
+  }
+}
+
+void TestDatabase::test_compressed_import_export() {
+  QFETCH(QString, suffix);
+  QFETCH(int, n_threads);
+  QTemporaryDir tmp_dir{};
+  DatabaseCatalog catalog{};
+  catalog.open_database(tmp_dir.filePath("db.sqlite"));
+  auto file_path = tmp_dir.filePath(QString("docs.%0").arg(suffix));
+  QCOMPARE(catalog.file_extension_error_message(
+               file_path, DatabaseCatalog::Action::Export,
+               DatabaseCatalog::ItemKind::Document, false),
+           QString());
+  QVERIFY(catalog.file_extension_error_message(
+              file_path, DatabaseCatalog::Action::Import,
+              DatabaseCatalog::ItemKind::Label, false) != QString());
+
+  catalog.import_documents(":test/data/test_documents.json");
+  add_many_docs(catalog.get_current_database());
+  auto export_res = catalog.export_documents(file_path, false, true, true, "",
+                                             nullptr, n_threads);
+  QCOMPARE(export_res.n_docs, 366);
+  // not the plain text
+  QFile compressed_f(file_path);
+  compressed_f.open(QIODevice::ReadOnly);
+  QVERIFY(!compressed_f.readAll().contains("content of document"));
+
+  DatabaseCatalog import_catalog{};
+  import_catalog.open_database(tmp_dir.filePath("imported.sqlite"));
+  auto import_res = import_catalog.import_documents(file_path);
+  QCOMPARE(static_cast<int>(import_res.error_code),
+           static_cast<int>(ErrorCode::NoError));
+  QCOMPARE(import_res.n_docs, 366);
+  QCOMPARE(import_res.n_annotations, export_res.n_annotations);
+}
+
+void TestDatabase::test_truncated_compressed_import() {
+  QTemporaryDir tmp_dir{};
+  DatabaseCatalog catalog{};
+  catalog.open_database(tmp_dir.filePath("db.sqlite"));
+  catalog.import_documents(":test/data/test_documents.json");
+  add_many_docs(catalog.get_current_database());
+  auto file_path = tmp_dir.filePath("docs.jsonl.gz");
+  catalog.export_documents(file_path, false, true, true, "");
+  QFile compressed_f(file_path);
+  QVERIFY(compressed_f.resize(compressed_f.size() / 2));
+
+  // not the silent import of the first half of the file
+  DatabaseCatalog import_catalog{};
+  import_catalog.open_database(tmp_dir.filePath("imported.sqlite"));
+  auto import_res = import_catalog.import_documents(file_path);
+  QCOMPARE(static_cast<int>(import_res.error_code),
+           static_cast<int>(ErrorCode::CriticalParsingError));
+}
+
+void TestDatabase::test_bundle() {
+  QTemporaryDir tmp_dir{};
+  DatabaseCatalog catalog{};
+  catalog.open_database(tmp_dir.filePath("db.sqlite"));
+  catalog.import_documents(":test/data/test_documents.json");
+  add_many_docs(catalog.get_current_database());
+  auto json_file = tmp_dir.filePath("docs.jsonl");
+  catalog.export_documents(json_file, false, true, true, "");
+  auto bundle_file = tmp_dir.filePath("docs.lbb");
+  auto export_res =
+      catalog.export_documents(bundle_file, false, true, true, "someone");
+  QFile bundle_f(bundle_file);
+  bundle_f.open(QIODevice::ReadOnly);
+  auto bundle = bundle_f.readAll();
+  bundle_f.close();
+  QVERIFY(bundle.startsWith(QByteArray("LBBUNDLE\x01\0\0\0", 12)));
+
+  // the documents are the same after going through the bundle
+  DatabaseCatalog import_catalog{};
+  import_catalog.open_database(tmp_dir.filePath("imported.sqlite"));
+  auto import_res = import_catalog.import_documents(bundle_file);
+  QCOMPARE(static_cast<int>(import_res.error_code),
+           static_cast<int>(ErrorCode::NoError));
+  QCOMPARE(import_res.n_docs, export_res.n_docs);
+  QCOMPARE(import_res.n_annotations, export_res.n_annotations);
+  auto reexported_file = tmp_dir.filePath("reexported.jsonl");
+  import_catalog.export_documents(reexported_file, false, true, true, "");
+  QFile json_f(json_file);
+  json_f.open(QIODevice::ReadOnly);
+  QFile reexported_f(reexported_file);
+  reexported_f.open(QIODevice::ReadOnly);
+  QCOMPARE(reexported_f.readAll(), json_f.readAll());
+
+  // without the text, annotations are added to the documents with the same
+  // checksum
+  auto annotations_file = tmp_dir.filePath("annotations.lbb");
+  catalog.export_documents(annotations_file, true, false, true, "");
+  QSqlQuery query(
+      QSqlDatabase::database(import_catalog.get_current_database()));
+  query.exec("delete from annotation;");
+  import_res = import_catalog.import_documents(annotations_file);
+  QCOMPARE(import_res.n_docs, 0);
+  QCOMPARE(import_res.n_annotations, export_res.n_annotations);
+
+  // truncated and corrupted files
+  QList<QByteArray> bad_data{bundle.left(bundle.size() - 1),
+                             QByteArray("LBBUNDLE\x02\0\0\0", 12),
+                             QByteArray("not a bundle"),
+                             bundle.left(12) + QByteArray("\x04\0\0\0abcd", 8)};
+  for (const auto& data : bad_data) {
+    auto bad_file = tmp_dir.filePath("bad.lbb");
+    QFile bad_f(bad_file);
+    bad_f.open(QIODevice::WriteOnly);
+    bad_f.write(data);
+    bad_f.close();
+    DatabaseCatalog bad_catalog{};
+    bad_catalog.open_database(tmp_dir.filePath("bad.sqlite"));
+    auto bad_res = bad_catalog.import_documents(bad_file);
+    QCOMPARE(static_cast<int>(bad_res.error_code),
+             static_cast<int>(ErrorCode::CriticalParsingError));
+  }
+}
+
+void TestDatabase::test_xml_annotations() {
+  QTemporaryDir tmp_dir{};
+  auto docs_file = tmp_dir.filePath("docs.xml");
+  {
+    QFile file(docs_file);
+    file.open(QIODevice::WriteOnly);
+    // positions split by a comment or given as character references are
+    // read like readElementText would
+    file.write(
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<document_set>"
+        "<document><text>some text here</text><labels>"
+        "<annotation><start_char>1</start_char><end_char>4</end_char>"
+        "<label>a</label></annotation>"
+        "<annotation><start_char> 1<!-- x -->0</start_char>"
+        "<end_char>&#49;&#50;</end_char><label>b</label>"
+        "<extra_data>extra &amp; data</extra_data></annotation>"
+        "</labels></document></document_set>\n");
+  }
+  DatabaseCatalog catalog{};
+  auto db_path = tmp_dir.filePath("db.sqlite");
+  catalog.open_database(db_path);
+  auto res = catalog.import_documents(docs_file);
+  QCOMPARE(static_cast<int>(res.error_code),
+           static_cast<int>(ErrorCode::NoError));
+  QCOMPARE(res.n_annotations, 2);
+  QSqlQuery query(QSqlDatabase::database(db_path));
+  query.exec("select start_char, end_char, label.name, extra_data from "
+             "annotation join label on annotation.label_id = label.id order "
+             "by start_char;");
+  QVERIFY(query.next());
+  QCOMPARE(query.value(0).toInt(), 1);
+  QCOMPARE(query.value(1).toInt(), 4);
+  QCOMPARE(query.value(2).toString(), QString("a"));
+  QVERIFY(query.value(3).isNull());
+  QVERIFY(query.next());
+  QCOMPARE(query.value(0).toInt(), 10);
+  QCOMPARE(query.value(1).toInt(), 12);
+  QCOMPARE(query.value(2).toString(), QString("b"));
+  QCOMPARE(query.value(3).toString(), QString("extra & data"));
+}
+
+void TestDatabase::test_merge_database() {
+  QTemporaryDir tmp_dir{};
+  QList<ContentLayout> layouts{ContentLayout::Inline, ContentLayout::Separate,
+                               ContentLayout::Compressed};
+  int n_dbs{};
+  auto new_db_path = [&tmp_dir, &n_dbs]() {
+    return tmp_dir.filePath(QString("db_%0.sqlite").arg(n_dbs++));
+  };
+  auto read_file = [](const QString& file_path) {
+    QFile file(file_path);
+    file.open(QIODevice::ReadOnly);
+    return file.readAll();
+  };
+  for (auto source_layout : layouts) {
+    DatabaseCatalog source{};
+    source.set_new_database_content_layout(source_layout);
+    auto source_path = new_db_path();
+    source.open_database(source_path);
+    source.import_documents(":test/data/test_documents.json");
+    source.import_labels(":test/data/test_labels.json");
+    QSqlQuery source_query(QSqlDatabase::database(source_path));
+    source_query.exec(
+        "insert into label (name, shortcut_key) values ('source only', 'x');");
+    auto source_label = source_query.lastInsertId().toInt();
+    source_query.exec(
+        QString("insert into annotation (doc_id, label_id, start_char, "
+                "end_char, extra_data) values (1, 1, 0, 2, null), (1, 2, 3, "
+                "5, 'note'), (3, %0, 0, 1, null);")
+            .arg(source_label));
+    auto exported_file = tmp_dir.filePath("source.jsonl");
+    auto export_res =
+        source.export_documents(exported_file, false, true, true, "");
+    QCOMPARE(export_res.n_annotations, 3);
+    for (auto target_layout : layouts) {
+      DatabaseCatalog target{};
+      target.set_new_database_content_layout(target_layout);
+      auto target_path = new_db_path();
+      target.open_database(target_path);
+      // existing labels have other ids and keep their shortcut key
+      QSqlQuery query(QSqlDatabase::database(target_path));
+      query.exec("insert into label (name, shortcut_key) values ('other', "
+                 "'x');");
+      target.import_labels(":test/data/test_labels.json");
+      auto res = target.import_documents(source_path);
+      QCOMPARE(static_cast<int>(res.error_code),
+               static_cast<int>(ErrorCode::NoError));
+      QCOMPARE(res.n_docs, export_res.n_docs);
+      QCOMPARE(res.n_annotations, export_res.n_annotations);
+      QCOMPARE(get_content_layout(query), target_layout);
+      query.exec("select name from label where shortcut_key = 'x';");
+      query.next();
+      QCOMPARE(query.value(0).toString(), QString("other"));
+      query.exec(
+          "select shortcut_key from label where name = 'source only';");
+      QVERIFY(query.next());
+      QVERIFY(query.value(0).isNull());
+      auto merged_file = tmp_dir.filePath("merged.jsonl");
+      target.export_documents(merged_file, false, true, true, "");
+      QCOMPARE(read_file(merged_file), read_file(exported_file));
+
+      // merging again adds nothing; deleted annotations are copied again
+      res = target.import_documents(source_path);
+      QCOMPARE(res.n_docs, 0);
+      QCOMPARE(res.n_annotations, 0);
+      query.exec("delete from annotation where rowid % 2 = 0;");
+      auto n_deleted = query.numRowsAffected();
+      res = target.import_documents(source_path);
+      QCOMPARE(res.n_docs, 0);
+      QCOMPARE(res.n_annotations, n_deleted);
+    }
+  }
+
+  DatabaseCatalog catalog{};
+  auto db_path = new_db_path();
+  catalog.open_database(db_path);
+  auto res = catalog.import_documents(db_path);
+  QCOMPARE(static_cast<int>(res.error_code),
+           static_cast<int>(ErrorCode::CriticalParsingError));
+  res = catalog.import_documents(tmp_dir.filePath("missing.sqlite"));
+  QCOMPARE(static_cast<int>(res.error_code),
+           static_cast<int>(ErrorCode::FileSystemError));
+  QVERIFY(!QFile::exists(tmp_dir.filePath("missing.sqlite")));
+  auto not_labelbuddy = new_db_path();
+  {
+    auto db = QSqlDatabase::addDatabase("QSQLITE", "not_labelbuddy");
+    db.setDatabaseName(not_labelbuddy);
+    db.open();
+    QSqlQuery query(db);
+    query.exec("create table document (id integer primary key);");
+  }
+  QSqlDatabase::removeDatabase("not_labelbuddy");
+  res = catalog.import_documents(not_labelbuddy);
+  QCOMPARE(static_cast<int>(res.error_code),
+           static_cast<int>(ErrorCode::CriticalParsingError));
+  QCOMPARE(res.n_docs, 0);
+}
+
+namespace {
+QList<QPair<int, int>> annotation_counts(const QString& db_name) {
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  query.exec("select doc_id, n_annotations from document_annotation_count "
+             "order by doc_id;");
+  QList<QPair<int, int>> counts{};
+  while (query.next()) {
+    counts << QPair<int, int>{query.value(0).toInt(), query.value(1).toInt()};
+  }
+  return counts;
+}
+} // namespace
+
+void TestDatabase::test_annotation_count() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  QCOMPARE(annotation_counts(db_name), (QList<QPair<int, int>>{}));
+  query.exec("insert into annotation (doc_id, label_id, start_char, end_char) "
+             "values (1, 1, 0, 2), (1, 2, 3, 5), (3, 1, 0, 1);");
+  QCOMPARE(annotation_counts(db_name),
+           (QList<QPair<int, int>>{{1, 2}, {3, 1}}));
+  // ignored insert does not change the count
+  query.exec("insert or ignore into annotation (doc_id, label_id, start_char, "
+             "end_char) values (1, 1, 0, 2);");
+  QCOMPARE(annotation_counts(db_name),
+           (QList<QPair<int, int>>{{1, 2}, {3, 1}}));
+  query.exec("update annotation set doc_id = 4 where doc_id = 3;");
+  QCOMPARE(annotation_counts(db_name),
+           (QList<QPair<int, int>>{{1, 2}, {4, 1}}));
+  query.exec("delete from annotation where doc_id = 1 and label_id = 2;");
+  QCOMPARE(annotation_counts(db_name),
+           (QList<QPair<int, int>>{{1, 1}, {4, 1}}));
+  query.exec("delete from document where id = 4;");
+  QCOMPARE(annotation_counts(db_name), (QList<QPair<int, int>>{{1, 1}}));
+  query.exec("select id from labelled_document;");
+  QVERIFY(query.next());
+  QCOMPARE(query.value(0).toInt(), 1);
+  QVERIFY(!query.next());
+  query.exec("select count(*) from unlabelled_document;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 4);
+  query.exec("delete from label where id = 1;");
+  QCOMPARE(annotation_counts(db_name), (QList<QPair<int, int>>{}));
+}
+
+namespace {
+QList<QList<int>> label_counts(const QString& db_name) {
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  query.exec("select label_id, doc_id, n_annotations from "
+             "document_label_count order by label_id, doc_id;");
+  QList<QList<int>> counts{};
+  while (query.next()) {
+    counts << QList<int>{query.value(0).toInt(), query.value(1).toInt(),
+                         query.value(2).toInt()};
+  }
+  return counts;
+}
+
+QList<QPair<int, int>> label_doc_counts(const QString& db_name) {
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  query.exec("select label_id, n_docs from label_document_count "
+             "order by label_id;");
+  QList<QPair<int, int>> counts{};
+  while (query.next()) {
+    counts << QPair<int, int>{query.value(0).toInt(), query.value(1).toInt()};
+  }
+  return counts;
+}
+
+void drop_label_count_schema(QSqlQuery& query) {
+  QVERIFY(query.exec("drop trigger label_count_after_annotation_insert;"));
+  QVERIFY(query.exec("drop trigger label_count_after_annotation_delete;"));
+  QVERIFY(query.exec("drop trigger label_count_after_annotation_update;"));
+  QVERIFY(query.exec("drop trigger document_label_count_after_insert;"));
+  QVERIFY(query.exec("drop trigger document_label_count_after_delete;"));
+  QVERIFY(query.exec("drop table label_document_count;"));
+  QVERIFY(query.exec("drop table document_label_count;"));
+}
+
+void check_label_counts_match_annotations(const QString& db_name) {
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  query.exec("select label_id, doc_id, count(*) from annotation group by "
+             "label_id, doc_id order by label_id, doc_id;");
+  QList<QList<int>> expected{};
+  while (query.next()) {
+    expected << QList<int>{query.value(0).toInt(), query.value(1).toInt(),
+                           query.value(2).toInt()};
+  }
+  QCOMPARE(label_counts(db_name), expected);
+  query.exec("select label_id, count(distinct doc_id) from annotation "
+             "group by label_id order by label_id;");
+  QList<QPair<int, int>> expected_docs{};
+  while (query.next()) {
+    expected_docs << QPair<int, int>{query.value(0).toInt(),
+                                     query.value(1).toInt()};
+  }
+  QCOMPARE(label_doc_counts(db_name), expected_docs);
+}
+} // namespace
+
+void TestDatabase::test_label_count() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  QCOMPARE(label_counts(db_name), (QList<QList<int>>{}));
+  query.exec("insert into annotation (doc_id, label_id, start_char, end_char) "
+             "values (1, 1, 0, 2), (1, 1, 3, 5), (1, 2, 6, 7), (3, 1, 0, 1);");
+  QCOMPARE(label_counts(db_name),
+           (QList<QList<int>>{{1, 1, 2}, {1, 3, 1}, {2, 1, 1}}));
+  QCOMPARE(label_doc_counts(db_name), (QList<QPair<int, int>>{{1, 2}, {2, 1}}));
+  query.exec("update annotation set label_id = 2 where doc_id = 3;");
+  QCOMPARE(label_counts(db_name),
+           (QList<QList<int>>{{1, 1, 2}, {2, 1, 1}, {2, 3, 1}}));
+  QCOMPARE(label_doc_counts(db_name), (QList<QPair<int, int>>{{1, 1}, {2, 2}}));
+  query.exec("update annotation set doc_id = 4 where doc_id = 1 "
+             "and label_id = 1 and start_char = 0;");
+  QCOMPARE(label_counts(db_name),
+           (QList<QList<int>>{{1, 1, 1}, {1, 4, 1}, {2, 1, 1}, {2, 3, 1}}));
+  QCOMPARE(label_doc_counts(db_name), (QList<QPair<int, int>>{{1, 2}, {2, 2}}));
+  query.exec("delete from annotation where doc_id = 1 and label_id = 1;");
+  QCOMPARE(label_counts(db_name),
+           (QList<QList<int>>{{1, 4, 1}, {2, 1, 1}, {2, 3, 1}}));
+  query.exec("delete from document where id = 3;");
+  QCOMPARE(label_doc_counts(db_name), (QList<QPair<int, int>>{{1, 1}, {2, 1}}));
+  query.exec("delete from label where id = 2;");
+  QCOMPARE(label_counts(db_name), (QList<QList<int>>{{1, 4, 1}}));
+  QCOMPARE(label_doc_counts(db_name), (QList<QPair<int, int>>{{1, 1}}));
+  check_label_counts_match_annotations(db_name);
+}
+
+void TestDatabase::test_bulk_load() {
+  QTemporaryDir tmp_dir{};
+  auto db_path = tmp_dir.filePath("db.sqlite");
+  auto docs_path = tmp_dir.filePath("docs.jsonl");
+  {
+    QFile file(docs_path);
+    file.open(QIODevice::WriteOnly);
+    file.write("{\"text\": \"abc\", \"labels\": [[0, 1, \"a\"], [1, 2, "
+               "\"b\"]]}\n{\"text\": \"def\"}\n{\"text\": \"ghi\", "
+               "\"labels\": [[0, 2, \"a\"]]}\n{\"text\": \"jkl\", "
+               "\"labels\": [[0, 1, \"b\"], [0, 1, \"b\"]]}\n");
+  }
+  auto n_schema_items = [&db_path](const QString& type) {
+    QSqlQuery query(QSqlDatabase::database(db_path));
+    query.exec(QString("select count(*) from sqlite_master where type = '%0' "
+                       "and sql is not null;")
+                   .arg(type));
+    query.next();
+    return query.value(0).toInt();
+  };
+  auto n_labelled_docs = [&db_path]() {
+    QSqlQuery query(QSqlDatabase::database(db_path));
+    query.exec("select count(*) from labelled_document;");
+    query.next();
+    return query.value(0).toInt();
+  };
+  int n_indexes{};
+  int n_triggers{};
+  {
+    DatabaseCatalog catalog{};
+    catalog.open_database(db_path);
+    n_indexes = n_schema_items("index");
+    n_triggers = n_schema_items("trigger");
+    QVERIFY(catalog.begin_bulk_load());
+    QCOMPARE(n_schema_items("index"), n_indexes - 3);
+    QCOMPARE(n_schema_items("trigger"), n_triggers - 11);
+    auto res = catalog.import_documents(docs_path);
+    QCOMPARE(res.n_docs, 4);
+    QCOMPARE(res.n_annotations, 4);
+    // duplicates are still detected
+    res = catalog.import_documents(docs_path);
+    QCOMPARE(res.n_docs, 0);
+    QCOMPARE(res.n_annotations, 0);
+    QVERIFY(catalog.end_bulk_load());
+    QCOMPARE(n_schema_items("index"), n_indexes);
+    QCOMPARE(n_schema_items("trigger"), n_triggers);
+    check_label_counts_match_annotations(db_path);
+    QCOMPARE(n_labelled_docs(), 3);
+
+    // interrupted bulk load
+    QVERIFY(catalog.begin_bulk_load());
+    QSqlQuery query(QSqlDatabase::database(db_path));
+    query.exec("delete from annotation where doc_id = 1;");
+  }
+  QSqlDatabase::removeDatabase(db_path);
+  DatabaseCatalog catalog{};
+  catalog.open_database(db_path);
+  QCOMPARE(n_schema_items("index"), n_indexes);
+  QCOMPARE(n_schema_items("trigger"), n_triggers);
+  check_label_counts_match_annotations(db_path);
+  QCOMPARE(n_labelled_docs(), 2);
+}
+
+void TestDatabase::test_migrate_from_version_2() {
+  QTemporaryDir tmp_dir{};
+  auto db_path = tmp_dir.filePath("db.sqlite");
+  {
+    DatabaseCatalog catalog{};
+    catalog.open_database(db_path);
+    catalog.import_documents(":test/data/test_documents.json");
+    catalog.import_labels(":test/data/test_labels.json");
+    // turn it back into a version 2 database
+    QSqlQuery query(QSqlDatabase::database(db_path));
+    drop_label_count_schema(query);
+    QVERIFY(query.exec("drop trigger annotation_count_after_insert;"));
+    QVERIFY(query.exec("drop trigger annotation_count_after_delete;"));
+    QVERIFY(query.exec("drop trigger annotation_count_after_update;"));
+    QVERIFY(query.exec("drop view labelled_document;"));
+    QVERIFY(query.exec("drop view unlabelled_document;"));
+    QVERIFY(query.exec("drop table document_annotation_count;"));
+    QVERIFY(query.exec(
+        "CREATE VIEW unlabelled_document AS SELECT * FROM "
+        "document WHERE id NOT IN (SELECT distinct doc_id FROM annotation);"));
+    QVERIFY(query.exec(
+        "CREATE VIEW labelled_document AS SELECT * "
+        "FROM document WHERE id IN (SELECT distinct doc_id FROM annotation);"));
+    QVERIFY(
+        query.exec("update database_info set database_schema_version = 2;"));
+    QVERIFY(query.exec("PRAGMA user_version = 2;"));
+    QVERIFY(query.exec(
+        "insert into annotation (doc_id, label_id, start_char, end_char) "
+        "values (1, 1, 0, 2), (1, 2, 3, 5), (3, 1, 0, 1);"));
+  }
+  cleanup();
+  {
+    DatabaseCatalog catalog{};
+    QVERIFY(catalog.open_database(db_path));
+    QSqlQuery query(QSqlDatabase::database(db_path));
+    query.exec("PRAGMA user_version;");
+    query.next();
+    QCOMPARE(query.value(0).toInt(), 7);
+    query.exec("select database_schema_version from database_info;");
+    query.next();
+    QCOMPARE(query.value(0).toInt(), 7);
+    check_label_counts_match_annotations(db_path);
+    query.exec("select count(*), sum(n_annotations) from "
+               "document_annotation_count;");
+    query.next();
+    auto n_labelled = query.value(0).toInt();
+    auto n_annotations = query.value(1).toInt();
+    query.exec("select count(distinct doc_id), count(*) from annotation;");
+    query.next();
+    QCOMPARE(n_labelled, 2);
+    QCOMPARE(n_labelled, query.value(0).toInt());
+    QCOMPARE(n_annotations, query.value(1).toInt());
+    // pretend it was created by a more recent version
+    query.exec("PRAGMA user_version = 8;");
+  }
+  cleanup();
+  DatabaseCatalog catalog{};
+  QVERIFY(!catalog.open_database(db_path));
+}
+
+void TestDatabase::test_migrate_from_version_3() {
+  QTemporaryDir tmp_dir{};
+  auto db_path = tmp_dir.filePath("db.sqlite");
+  {
+    DatabaseCatalog catalog{};
+    catalog.open_database(db_path);
+    catalog.import_documents(":test/data/test_documents.json");
+    catalog.import_labels(":test/data/test_labels.json");
+    // turn it back into a version 3 database
+    QSqlQuery query(QSqlDatabase::database(db_path));
+    drop_label_count_schema(query);
+    QVERIFY(
+        query.exec("update database_info set database_schema_version = 3;"));
+    QVERIFY(query.exec("PRAGMA user_version = 3;"));
+    QVERIFY(query.exec(
+        "insert into annotation (doc_id, label_id, start_char, end_char) "
+        "values (1, 1, 0, 2), (1, 1, 3, 5), (1, 2, 6, 7), (3, 1, 0, 1);"));
+  }
+  cleanup();
+  DatabaseCatalog catalog{};
+  QVERIFY(catalog.open_database(db_path));
+  QSqlQuery query(QSqlDatabase::database(db_path));
+  query.exec("PRAGMA user_version;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 7);
+  QCOMPARE(label_doc_counts(db_path), (QList<QPair<int, int>>{{1, 2}, {2, 1}}));
+  check_label_counts_match_annotations(db_path);
+  // the triggers have been created
+  query.exec("delete from annotation where label_id = 2;");
+  QCOMPARE(label_doc_counts(db_path), (QList<QPair<int, int>>{{1, 2}}));
+}
+
+void TestDatabase::test_migrate_from_version_4() {
+  QTemporaryDir tmp_dir{};
+  auto db_path = tmp_dir.filePath("db.sqlite");
+  {
+    DatabaseCatalog catalog{};
+    catalog.open_database(db_path);
+    catalog.import_documents(":test/data/test_documents.json");
+    // turn it back into a version 4 database; the columns stay but have not
+    // been filled
+    QSqlQuery query(QSqlDatabase::database(db_path));
+    QVERIFY(query.exec("update document set preview = null, "
+                       "content_length = null, n_code_points = null;"));
+    QVERIFY(query.exec("drop view document_with_content;"));
+    QVERIFY(
+        query.exec("update database_info set database_schema_version = 4;"));
+    QVERIFY(query.exec("PRAGMA user_version = 4;"));
+  }
+  cleanup();
+  DatabaseCatalog catalog{};
+  QVERIFY(catalog.open_database(db_path));
+  QSqlQuery query(QSqlDatabase::database(db_path));
+  query.exec("PRAGMA user_version;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 7);
+  query.exec("select count(*) from document where preview is null;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 0);
+  query.exec("select count(*) from document_with_content;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 6);
+  QCOMPARE(catalog.get_app_state_extra("document_summary_backfill_pending", 0)
+               .toInt(),
+           0);
+}
+
+void TestDatabase::test_migrate_from_version_6() {
+  QTemporaryDir tmp_dir{};
+  auto db_path = tmp_dir.filePath("db.sqlite");
+  {
+    DatabaseCatalog catalog{};
+    catalog.open_database(db_path);
+    catalog.import_documents(":test/data/test_documents.json");
+    catalog.import_labels(":test/data/test_labels.json");
+    // turn it back into a version 6 database
+    QSqlQuery query(QSqlDatabase::database(db_path));
+    for (const auto& trigger : {"document_change_after_annotation_insert",
+                                "document_change_after_annotation_delete",
+                                "document_change_after_annotation_update"}) {
+      QVERIFY(query.exec(QString("drop trigger %0;").arg(trigger)));
+    }
+    QVERIFY(query.exec("drop table document_change;"));
+    QVERIFY(query.exec(
+        "insert into annotation (doc_id, label_id, start_char, end_char) "
+        "values (1, 1, 0, 2), (1, 2, 3, 5), (3, 1, 0, 1);"));
+    QVERIFY(
+        query.exec("update database_info set database_schema_version = 6;"));
+    QVERIFY(query.exec("PRAGMA user_version = 6;"));
+  }
+  cleanup();
+  DatabaseCatalog catalog{};
+  QVERIFY(catalog.open_database(db_path));
+  QSqlQuery query(QSqlDatabase::database(db_path));
+  query.exec("PRAGMA user_version;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 7);
+  // documents labelled before the migration count as changed once
+  QCOMPARE(catalog.get_change_token(), 1LL);
+  query.exec("select count(*) from document_change;");
+  query.next();
+  auto n_changed = query.value(0).toInt();
+  QCOMPARE(n_changed, 2);
+  auto out_file = tmp_dir.filePath("out.jsonl");
+  QCOMPARE(catalog.export_documents(out_file, true, true, true, "", nullptr, 1,
+                                    0, 0)
+               .n_docs,
+           n_changed);
+}
+
+void TestDatabase::test_change_tracking() {
+  QTemporaryDir tmp_dir{};
+  auto db_path = prepare_db(tmp_dir);
+  DatabaseCatalog catalog{};
+  catalog.open_database(db_path);
+  QCOMPARE(catalog.get_change_token(), 0LL);
+  QSqlQuery query(QSqlDatabase::database(db_path));
+  query.exec("insert into annotation (doc_id, label_id, start_char, end_char) "
+             "values (1, 1, 0, 2), (3, 1, 0, 1);");
+  auto out_file = tmp_dir.filePath("out.jsonl");
+  auto export_changes = [&](qlonglong since, bool labelled_only) {
+    return catalog
+        .export_documents(out_file, labelled_only, true, true, "", nullptr, 1,
+                          0, since)
+        .n_docs;
+  };
+  auto token = catalog.get_change_token();
+  QVERIFY(token > 0);
+  QCOMPARE(export_changes(0, true), catalog.export_documents(out_file).n_docs);
+  QCOMPARE(export_changes(token, false), 0);
+
+  // insertions, modifications and deletions are all changes
+  query.exec("insert into annotation (doc_id, label_id, start_char, end_char) "
+             "values (5, 1, 0, 1);");
+  QCOMPARE(export_changes(token, false), 1);
+  token = catalog.get_change_token();
+  query.exec("update annotation set extra_data = 'x' where doc_id = 5;");
+  query.exec("select min(doc_id) from annotation where doc_id != 5;");
+  query.next();
+  auto other_doc = query.value(0).toInt();
+  query.exec(QString("delete from annotation where doc_id = %0;")
+                 .arg(other_doc));
+  QCOMPARE(export_changes(token, false), 2);
+  // without annotations the document is no longer labelled
+  QCOMPARE(export_changes(token, true), 1);
+  token = catalog.get_change_token();
+
+  // deleting a document does not make the next numbers smaller
+  query.exec("delete from document where id = 5;");
+  QVERIFY(catalog.get_change_token() > token);
+  // but the rows of other deleted documents are removed
+  query.exec(QString("delete from document where id = %0;").arg(other_doc));
+  query.exec(QString("select count(*) from document_change where doc_id = %0;")
+                 .arg(other_doc));
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 0);
+
+  // after a bulk load all labelled documents count as changed
+  token = catalog.get_change_token();
+  QVERIFY(catalog.begin_bulk_load());
+  catalog.import_documents(":test/data/test_documents.json");
+  QVERIFY(catalog.end_bulk_load());
+  QCOMPARE(export_changes(token, true),
+           catalog.export_documents(out_file).n_docs);
+  token = catalog.get_change_token();
+  query.exec("insert into annotation (doc_id, label_id, start_char, end_char) "
+             "values (1, 1, 5, 6);");
+  QCOMPARE(export_changes(token, false), 1);
+
+  // the batch export records the token for `--since last`
+  BatchOptions options{};
+  options.export_since = "last";
+  token = catalog.get_change_token();
+  QCOMPARE(batch_import_export(db_path, {}, {}, "", out_file, false, true,
+                               true, "", false, options),
+           0);
+  QCOMPARE(catalog.get_app_state_extra(DatabaseCatalog::export_change_token_key,
+                                       -1)
+               .toLongLong(),
+           token);
+  query.exec("update annotation set extra_data = 'y' where doc_id = 1;");
+  QCOMPARE(batch_import_export(db_path, {}, {}, "", out_file, false, true,
+                               true, "", false, options),
+           0);
+  QFile out(out_file);
+  out.open(QIODevice::ReadOnly);
+  QCOMPARE(out.readAll().count('\n'), 1);
+  out.close();
+
+  // filtered exports have their own token
+  token = catalog.get_change_token();
+  query.exec("update annotation set extra_data = 'z' where doc_id = 1;");
+  options.export_doc_filter = "unlabelled";
+  QCOMPARE(batch_import_export(db_path, {}, {}, "", out_file, false, true,
+                               true, "", false, options),
+           0);
+  QCOMPARE(catalog.get_app_state_extra(DatabaseCatalog::export_change_token_key,
+                                       -1)
+               .toLongLong(),
+           token);
+  options.export_doc_filter = "";
+  QCOMPARE(batch_import_export(db_path, {}, {}, "", out_file, false, true,
+                               true, "", false, options),
+           0);
+  out.open(QIODevice::ReadOnly);
+  QCOMPARE(out.readAll().count('\n'), 1);
+}
+
+void TestDatabase::test_document_summaries() {
+  QString text{"a\nb"};
+  text += QChar(0xd83d);
+  text += QChar(0xde00);
+  text += QString(200, QChar(0xe9));
+  auto preview = document_preview(text, "");
+  QCOMPARE(n_code_points(preview), 160);
+  QVERIFY(preview.startsWith("a b"));
+  QCOMPARE(preview.size(), 161);
+  QCOMPARE(document_preview(text, "title"), QString("title"));
+  QCOMPARE(utf8_length(text), text.toUtf8().size());
+  QCOMPARE(n_code_points(text), 204);
+
+  QTemporaryDir tmp_dir{};
+  auto db_path = tmp_dir.filePath("db.sqlite");
+  DatabaseCatalog catalog{};
+  catalog.open_database(db_path);
+  catalog.import_documents(":test/data/test_documents.json");
+  QSqlQuery query(QSqlDatabase::database(db_path));
+  // the values computed at import time are those of the backfill
+  auto n_mismatches = [&query]() {
+    query.exec("select count(*) from document where preview is not "
+               "replace(substr(coalesce(long_title, content), 1, 160), "
+               "char(10), ' ') or content_length is not "
+               "length(cast(content as blob)) or n_code_points is not "
+               "length(content);");
+    query.next();
+    return query.value(0).toInt();
+  };
+  QCOMPARE(n_mismatches(), 0);
+  query.exec("update document set preview = null, content_length = null, "
+             "n_code_points = null where id > 1;");
+  QVERIFY(n_mismatches() > 0);
+  QCOMPARE(backfill_document_summaries(query, 2), 5);
+  QCOMPARE(n_mismatches(), 0);
+  QCOMPARE(backfill_document_summaries(query, 2), 0);
+}
+
+void TestDatabase::test_summary_backfill_thread() {
+  QTemporaryDir tmp_dir{};
+  auto db_path = tmp_dir.filePath("db.sqlite");
+  DatabaseCatalog catalog{};
+  catalog.open_database(db_path);
+  catalog.import_documents(":test/data/test_documents.json");
+  QSqlQuery query(QSqlDatabase::database(db_path));
+  query.exec("update document set preview = null, content_length = null, "
+             "n_code_points = null;");
+  catalog.set_app_state_extra("document_summary_backfill_pending", 1);
+  std::promise<int> n_updated{};
+  {
+    SummaryBackfillThread backfill(
+        db_path, [&n_updated](int n) { n_updated.set_value(n); });
+    auto result = n_updated.get_future();
+    QCOMPARE(result.get(), 6);
+  }
+  query.exec("select count(*) from document where preview is null;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 0);
+  QCOMPARE(catalog.get_app_state_extra("document_summary_backfill_pending", 0)
+               .toInt(),
+           0);
+}
+
+void TestDatabase::test_utf8_md5() {
+  auto md5 = [](const QString& text) {
+    return QCryptographicHash::hash(text.toUtf8(), QCryptographicHash::Md5);
+  };
+  QString pair{};
+  pair += QChar(0xd83d);
+  pair += QChar(0xde00);
+  QStringList texts{"", "abc", "abcdefgh\n", QString("caf") + QChar(0xe9),
+                    QString(3, QChar(0x4e2d)) + "x", pair};
+  // longer than a block, with a surrogate pair around each block boundary
+  QString long_text{};
+  for (int i = 0; i != 5000; ++i) {
+    long_text += QString("ab") + QChar(0xe9) + pair;
+  }
+  texts << long_text << QString(8191, QChar('a')) + pair
+        << QString(8190, QChar('a')) + pair + "b";
+  // unpaired surrogates
+  texts << QString("a") + QChar(0xd83d) + "b" << QString("a") + QChar(0xde00)
+        << QString("a") + QChar(0xd83d)
+        << QString(8191, QChar('a')) + QChar(0xd83d);
+  for (const auto& text : texts) {
+    QCOMPARE(utf8_md5(text), md5(text));
+  }
+}
+
+void TestDatabase::test_known_md5_filter() {
+  QTemporaryDir tmp_dir{};
+  auto db_path = tmp_dir.filePath("db.sqlite");
+  DatabaseCatalog catalog{};
+  catalog.open_database(db_path);
+  catalog.import_documents(":test/data/test_documents.json");
+  QSqlQuery query(QSqlDatabase::database(db_path));
+  KnownMd5Filter filter{};
+  filter.load(query);
+  query.exec("select content_md5 from document;");
+  int n_docs{};
+  while (query.next()) {
+    QVERIFY(filter.may_contain(query.value(0).toByteArray()));
+    ++n_docs;
+  }
+  QCOMPARE(n_docs, 6);
+  auto md5 = [](int i) {
+    return QCryptographicHash::hash(QByteArray::number(i),
+                                    QCryptographicHash::Md5);
+  };
+  QVERIFY(!filter.may_contain(md5(0)));
+  // enough to be merged into the sorted checksums several times
+  for (int i = 0; i != 5000; ++i) {
+    filter.insert(md5(i));
+  }
+  for (int i = 0; i != 5000; ++i) {
+    QVERIFY(filter.may_contain(md5(i)));
+  }
+  QVERIFY(!filter.may_contain(md5(5000)));
+}
+
+void TestDatabase::test_separate_content() {
+  QTemporaryDir tmp_dir{};
+  QStringList exported{};
+  for (auto layout : {ContentLayout::Inline, ContentLayout::Separate,
+                      ContentLayout::Compressed}) {
+    auto db_path =
+        tmp_dir.filePath(QString("db_%0.sqlite").arg(exported.size()));
+    DatabaseCatalog catalog{};
+    catalog.set_new_database_content_layout(layout);
+    QVERIFY(catalog.open_database(db_path));
+    catalog.import_documents(":test/data/test_documents.json");
+    catalog.import_labels(":test/data/test_labels.json");
+    QSqlQuery query(QSqlDatabase::database(db_path));
+    QCOMPARE(get_content_layout(query), layout);
+    QCOMPARE(QSqlDatabase::database(db_path).tables().contains(
+                 "document_content"),
+             layout == ContentLayout::Separate);
+    // the same documents are read back
+    auto out_file =
+        tmp_dir.filePath(QString("%0.jsonl").arg(exported.size()));
+    catalog.export_documents(out_file, false, true, true, "");
+    QFile file(out_file);
+    file.open(QIODevice::ReadOnly);
+    exported << QString::fromUtf8(file.readAll());
+    LoadedDocument doc{};
+    QVERIFY(load_document(query, 1, doc));
+    QVERIFY(doc.content.startsWith("document 0\n"));
+
+    if (layout == ContentLayout::Compressed) {
+      query.exec("select typeof(content) from document_with_content;");
+      while (query.next()) {
+        QCOMPARE(query.value(0).toString(), QString("blob"));
+      }
+      QVERIFY(!is_search_supported(query));
+      QVERIFY(!create_search_index(query));
+      // a build without zstd can open the databases it compressed
+      QCOMPARE(content_requires_zstd(query),
+               is_compression_supported(Compression::Zstd));
+      QVERIFY(query.exec("delete from document where id = 1;"));
+      query.exec("select count(*) from document_compressed_content;");
+      query.next();
+      QCOMPARE(query.value(0).toInt(), 5);
+      continue;
+    }
+    QVERIFY(is_search_supported(query));
+    int n_indexed{};
+    QVERIFY(create_search_index(
+        query, [&n_indexed](int n_done) { n_indexed = n_done; }));
+    QCOMPARE(n_indexed, 6);
+    query.exec("select count(*) from document_fts "
+               "where document_fts match 'session';");
+    query.next();
+    auto n_matches = query.value(0).toInt();
+    QVERIFY(n_matches > 0);
+    query.exec("select min(rowid) from document_fts "
+               "where document_fts match 'session';");
+    query.next();
+    auto doc_id = query.value(0).toInt();
+    query.prepare("delete from document where id = :id;");
+    query.bindValue(":id", doc_id);
+    QVERIFY(query.exec());
+    query.exec("select count(*) from document_fts "
+               "where document_fts match 'session';");
+    query.next();
+    QCOMPARE(query.value(0).toInt(), n_matches - 1);
+    query.exec("select count(*) from document_with_content;");
+    query.next();
+    QCOMPARE(query.value(0).toInt(), 5);
+  }
+  QCOMPARE(exported[1], exported[0]);
+  // including the md5 checksums, computed before compression
+  QCOMPARE(exported[2], exported[0]);
+
+  // the layout is only chosen when the database is created
+  DatabaseCatalog catalog{};
+  catalog.set_new_database_content_layout(ContentLayout::Separate);
+  QVERIFY(catalog.open_database(tmp_dir.filePath("db_0.sqlite")));
+  QSqlQuery query(QSqlDatabase::database(catalog.get_current_database()));
+  QCOMPARE(get_content_layout(query), ContentLayout::Inline);
+}
+
+namespace {
+
+/// 15 code points, the first of which is a surrogate pair
+QString long_doc_text() {
+  return QString("%0%1b\n\ncd\nefghijkl").arg(QChar(0xd83d)).arg(QChar(0xde00));
+}
+
+} // namespace
+
+void TestDatabase::test_split_doc_record() {
+  DocRecord record{};
+  record.content = long_doc_text();
+  record.metadata = "{\"source\":\"x\"}";
+  record.user_provided_id = "doc";
+  record.annotations = {{0, 2, "a", ""}, {9, 11, "b", "extra"}};
+  auto md5 = utf8_md5(record.content);
+  QVERIFY(split_doc_record(record, md5, 15).empty());
+  QVERIFY(split_doc_record(record, md5, 0).empty());
+
+  auto segments = split_doc_record(record, md5, 6);
+  QCOMPARE(static_cast<int>(segments.size()), 3);
+  // after the blank line, then before the annotation that would be cut
+  QCOMPARE(segments[0]->content, record.content.left(5));
+  QCOMPARE(segments[1]->content, QString("cd\nef"));
+  QCOMPARE(segments[2]->content, QString("ghijkl"));
+  QList<int> offsets{0, 4, 9};
+  for (int i = 0; i != 3; ++i) {
+    const auto& segment = *segments[static_cast<std::size_t>(i)];
+    QCOMPARE(segment.content_md5, utf8_md5(segment.content));
+    QCOMPARE(segment.user_provided_id, QString("doc"));
+    auto metadata = QJsonDocument::fromJson(segment.metadata).object();
+    QCOMPARE(metadata["source"].toString(), QString("x"));
+    auto info = metadata["labelbuddy_segment"].toObject();
+    QCOMPARE(info["parent_md5"].toString(), QString(md5.toHex()));
+    QCOMPARE(info["index"].toInt(), i);
+    QCOMPARE(info["n_segments"].toInt(), 3);
+    QCOMPARE(info["offset"].toInt(), offsets[i]);
+  }
+  QCOMPARE(static_cast<int>(segments[0]->annotations.size()), 1);
+  QCOMPARE(segments[0]->annotations[0].end_char, 2);
+  QVERIFY(segments[1]->annotations.empty());
+  QCOMPARE(static_cast<int>(segments[2]->annotations.size()), 1);
+  QCOMPARE(segments[2]->annotations[0].start_char, 0);
+  QCOMPARE(segments[2]->annotations[0].end_char, 2);
+  QCOMPARE(segments[2]->annotations[0].extra_data, QString("extra"));
+}
+
+void TestDatabase::test_split_import_and_merge() {
+  QTemporaryDir tmp_dir{};
+  auto file_path = tmp_dir.filePath("docs.jsonl");
+  {
+    QJsonObject doc{};
+    doc["text"] = long_doc_text();
+    doc["meta"] = QJsonObject{{"source", "x"}};
+    doc["labels"] = QJsonArray{QJsonArray{0, 2, "a"}, QJsonArray{9, 11, "b"}};
+    QFile file(file_path);
+    file.open(QIODevice::WriteOnly);
+    file.write(QJsonDocument(doc).toJson(QJsonDocument::Compact));
+    file.write("\n{\"text\": \"short\"}\n");
+  }
+  DatabaseCatalog catalog{};
+  catalog.open_database(tmp_dir.filePath("db.sqlite"));
+  catalog.set_max_imported_doc_length(6);
+  auto res = catalog.import_documents(file_path);
+  QCOMPARE(res.n_docs, 4);
+  QCOMPARE(res.n_annotations, 2);
+  // importing again finds the same segments
+  res = catalog.import_documents(file_path);
+  QCOMPARE(res.n_docs, 0);
+
+  auto out_file = tmp_dir.filePath("out.jsonl");
+  QCOMPARE(catalog.export_documents(out_file, false).n_docs, 4);
+  catalog.set_merge_exported_segments(true);
+  QCOMPARE(catalog.export_documents(out_file, false).n_docs, 2);
+  QFile file(out_file);
+  file.open(QIODevice::ReadOnly);
+  auto merged = QJsonDocument::fromJson(file.readLine()).object();
+  QCOMPARE(merged["text"].toString(), long_doc_text());
+  QCOMPARE(merged["utf8_text_md5_checksum"].toString(),
+           QString(utf8_md5(long_doc_text()).toHex()));
+  QCOMPARE(merged["meta"].toObject(), (QJsonObject{{"source", "x"}}));
+  QCOMPARE(merged["labels"].toArray(),
+           (QJsonArray{QJsonArray{0, 2, "a"}, QJsonArray{9, 11, "b"}}));
+  QCOMPARE(QJsonDocument::fromJson(file.readLine()).object().value("text"),
+           QJsonValue("short"));
+
+  // only the labelled segments: they are exported separately
+  QCOMPARE(catalog.export_documents(out_file, true).n_docs, 2);
+}
+
+void TestDatabase::test_read_only_database() {
+  QTemporaryDir tmp_dir{};
+  auto db_path = tmp_dir.filePath("db.sqlite");
+  auto out_file = tmp_dir.filePath("docs.jsonl");
+  {
+    DatabaseCatalog catalog{};
+    catalog.set_open_read_only(true);
+    // the database is not created
+    QVERIFY(!catalog.open_database(db_path, false));
+    QVERIFY(!QFileInfo(db_path).exists());
+  }
+  int n_docs{};
+  {
+    DatabaseCatalog catalog{};
+    QVERIFY(catalog.open_database(db_path, false));
+    QVERIFY(!catalog.is_read_only());
+    QVERIFY(catalog.set_pragma_profile("fast"));
+    n_docs = catalog.import_documents(":test/data/test_documents.json").n_docs;
+    catalog.import_labels(":test/data/test_labels.json");
+  }
+  QSqlDatabase::removeDatabase(db_path);
+  QVERIFY(n_docs > 0);
+
+  DatabaseCatalog catalog{};
+  catalog.set_open_read_only(true);
+  QVERIFY(catalog.open_database(db_path, false));
+  QVERIFY(catalog.is_read_only());
+  QSqlQuery query(QSqlDatabase::database(db_path));
+  QVERIFY(!query.exec("insert into label (name) values ('read only');"));
+  auto n_labels = [&query]() {
+    query.exec("select count(*) from label;");
+    query.next();
+    auto count = query.value(0).toInt();
+    query.finish();
+    return count;
+  };
+  auto initial_n_labels = n_labels();
+  QCOMPARE(catalog.export_documents(out_file, false).n_docs, n_docs);
+  {
+    auto writer = QSqlDatabase::addDatabase("QSQLITE", "writer");
+    writer.setDatabaseName(db_path);
+    QVERIFY(writer.open());
+    QSqlQuery write_query(writer);
+    QVERIFY(write_query.exec("begin transaction;"));
+    QVERIFY(
+        write_query.exec("insert into label (name) values ('new label');"));
+    // in WAL mode the reader is not blocked by the write transaction
+    QCOMPARE(n_labels(), initial_n_labels);
+    QCOMPARE(catalog.export_documents(out_file, false).n_docs, n_docs);
+    QVERIFY(write_query.exec("commit transaction;"));
+    QCOMPARE(n_labels(), initial_n_labels + 1);
+  }
+  QSqlDatabase::removeDatabase("writer");
+
+  BatchOptions options{};
+  options.read_only = true;
+  auto res =
+      batch_import_export(db_path, {}, {":test/data/test_documents.json"}, "",
+                          "", false, true, true, "", false, options);
+  QCOMPARE(res, 1);
+  res = batch_import_export(db_path, {}, {}, "", out_file, false, true, true,
+                            "", false, options);
+  QCOMPARE(res, 0);
+}
+
+void TestDatabase::test_export_filter() {
+  QTemporaryDir tmp_dir{};
+  auto db_path = prepare_db(tmp_dir);
+  DatabaseCatalog catalog{};
+  QVERIFY(catalog.open_database(db_path));
+  QSqlQuery query(QSqlDatabase::database(db_path));
+  QVERIFY(
+      query.exec("insert into annotation (doc_id, label_id, start_char, "
+                 "end_char) values (1, 1, 0, 2), (1, 2, 3, 5), (3, 1, 0, 1), "
+                 "(4, 2, 0, 1);"));
+  auto out_file = tmp_dir.filePath("out.jsonl");
+  auto export_filtered = [&](const ExportFilter& filter) {
+    auto res = catalog.export_documents(out_file, false, true, true, "",
+                                        nullptr, 1, 0, -1, filter);
+    return qMakePair(res.n_docs, res.n_annotations);
+  };
+  ExportFilter filter{};
+  QCOMPARE(export_filtered(filter), qMakePair(6, 4));
+  filter.docs = ExportFilter::Docs::labelled;
+  QCOMPARE(export_filtered(filter), qMakePair(3, 4));
+  filter.docs = ExportFilter::Docs::unlabelled;
+  QCOMPARE(export_filtered(filter), qMakePair(3, 0));
+
+  // only the annotations with the chosen labels are exported
+  filter.docs = ExportFilter::Docs::has_given_label;
+  filter.label_ids = {1};
+  QCOMPARE(export_filtered(filter), qMakePair(2, 2));
+  filter.docs = ExportFilter::Docs::not_has_given_label;
+  QCOMPARE(export_filtered(filter), qMakePair(4, 0));
+  filter.label_ids = {1, 2};
+  QCOMPARE(export_filtered(filter), qMakePair(3, 0));
+  filter.docs = ExportFilter::Docs::all;
+  filter.label_ids = {2};
+  QCOMPARE(export_filtered(filter), qMakePair(6, 2));
+
+  // the id range applies to documents and annotations
+  filter.label_ids.clear();
+  filter.min_doc_id = 2;
+  filter.max_doc_id = 4;
+  QCOMPARE(export_filtered(filter), qMakePair(3, 2));
+  QFile file(out_file);
+  QVERIFY(file.open(QIODevice::ReadOnly));
+  QCOMPARE(QJsonDocument::fromJson(file.readLine())
+               .object()
+               .value("text")
+               .toString()
+               .left(10),
+           QString("document 1"));
+  file.close();
+  filter.min_doc_id = -1;
+  filter.max_doc_id = -1;
+
+  filter.docs = ExportFilter::Docs::search;
+  filter.search_text = "Resumption";
+  QCOMPARE(export_filtered(filter), qMakePair(1, 0));
+  filter.search_text = "";
+  QCOMPARE(export_filtered(filter), qMakePair(0, 0));
+
+  BatchOptions options{};
+  options.export_doc_filter = "has-label";
+  options.export_label_names = QStringList{"label: Reinício da sessão"};
+  options.export_max_doc_id = 2;
+  QCOMPARE(batch_import_export(db_path, {}, {}, "", out_file, false, true,
+                               true, "", false, options),
+           0);
+  QVERIFY(file.open(QIODevice::ReadOnly));
+  auto doc = QJsonDocument::fromJson(file.readLine()).object();
+  QCOMPARE(doc.value("labels").toArray().size(), 1);
+  QVERIFY(file.readLine().isEmpty());
+  file.close();
+  options.export_label_names = QStringList{"no such label"};
+  QCOMPARE(batch_import_export(db_path, {}, {}, "", out_file, false, true,
+                               true, "", false, options),
+           1);
+}
+
+void TestDatabase::test_import_into_existing_database() {
+  QTemporaryDir tmp_dir{};
+  auto db_path = prepare_db(tmp_dir);
+  DatabaseCatalog catalog{};
+  QVERIFY(catalog.open_database(db_path));
+  QSqlQuery query(QSqlDatabase::database(db_path));
+  query.exec("select content from document_with_content where id = 1;");
+  QVERIFY(query.next());
+  auto first_text = query.value(0).toString();
+  query.finish();
+
+  // documents already in the database are recognized by their md5
+  auto res = catalog.import_documents(":test/data/test_documents.json");
+  QCOMPARE(res.n_docs, 0);
+
+  auto docs_file = tmp_dir.filePath("docs.jsonl");
+  {
+    QFile file(docs_file);
+    file.open(QIODevice::WriteOnly | QIODevice::Text);
+    QJsonObject known{};
+    known["text"] = first_text;
+    known["labels"] = QJsonArray{QJsonArray{0, 1, "new label"}};
+    QJsonObject new_doc{};
+    new_doc["text"] = "a new document";
+    for (const auto& doc : {known, new_doc}) {
+      file.write(QJsonDocument(doc).toJson(QJsonDocument::Compact));
+      file.write("\n");
+    }
+  }
+  res = catalog.import_documents(docs_file);
+  QCOMPARE(res.n_docs, 1);
+  QCOMPARE(res.n_annotations, 1);
+  query.exec("select id, content from document_with_content order by id "
+             "desc limit 1;");
+  QVERIFY(query.next());
+  QCOMPARE(query.value(0).toInt(), 7);
+  QCOMPARE(query.value(1).toString(), QString("a new document"));
+  query.exec("select doc_id from annotation;");
+  QVERIFY(query.next());
+  QCOMPARE(query.value(0).toInt(), 1);
+}
+
 } // namespace labelbuddy
@@ -24,6 +24,43 @@ private slots:
   void test_batch_import_export();
   void test_import_errors_data();
   void test_import_errors();
+  void test_json_docs_reader();
+  void test_mapped_line_readers();
+  void test_docs_reading_thread();
+  void test_import_annotations_batch();
+  void test_import_checkpoints();
+  void test_import_multiple_files();
+  void test_batch_stats();
+  void test_pragma_profiles();
+  void test_incremental_vacuum();
+  void test_parallel_export_data();
+  void test_parallel_export();
+  void test_sharded_export_data();
+  void test_sharded_export();
+  void test_compressed_import_export_data();
+  void test_compressed_import_export();
+  void test_truncated_compressed_import();
+  void test_bundle();
+  void test_xml_annotations();
+  void test_merge_database();
+  void test_annotation_count();
+  void test_label_count();
+  void test_bulk_load();
+  void test_migrate_from_version_2();
+  void test_migrate_from_version_3();
+  void test_migrate_from_version_4();
+  void test_migrate_from_version_6();
+  void test_change_tracking();
+  void test_document_summaries();
+  void test_summary_backfill_thread();
+  void test_utf8_md5();
+  void test_known_md5_filter();
+  void test_separate_content();
+  void test_split_doc_record();
+  void test_split_import_and_merge();
+  void test_read_only_database();
+  void test_export_filter();
+  void test_import_into_existing_database();
 
   void cleanup();
 
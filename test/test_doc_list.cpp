@@ -193,6 +193,36 @@ void TestDocList::test_navigation() {
   QCOMPARE(label->text(), QString("1 - 100 / 366"));
 }
 
+void TestDocList::test_single_page() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  add_annotations(db_name);
+  add_many_docs(db_name);
+  DocListModel doc_model{};
+  doc_model.set_default_page_size(0);
+  doc_model.set_database(db_name);
+  DocList doc_list{};
+  doc_list.setModel(&doc_model);
+
+  auto buttons = doc_list.findChildren<QPushButton*>();
+  for (int i = 4; i != 8; ++i) {
+    QVERIFY(buttons[i]->isHidden());
+  }
+  QLabel* label = doc_list.findChildren<QLabel*>().back();
+  QCOMPARE(label->text(), QString("1 - 366 / 366"));
+  // the rows are fetched in blocks as the view is scrolled
+  QCOMPARE(doc_model.rowCount(), 256);
+  QVERIFY(doc_model.canFetchMore(QModelIndex()));
+  doc_model.fetchMore(QModelIndex());
+  QCOMPARE(doc_model.rowCount(), 366);
+
+  auto filter_box = doc_list.findChild<QComboBox*>();
+  filter_box->setCurrentIndex(2);
+  filter_box->activated(2);
+  QCOMPARE(label->text(), QString("1 - 365 / 365"));
+  QCOMPARE(doc_model.n_page_rows(), 365);
+}
+
 void TestDocList::test_filters() {
   QTemporaryDir tmp_dir{};
   auto db_name = prepare_db(tmp_dir);
@@ -232,13 +262,15 @@ void TestDocList::test_filters() {
   filter_box->setCurrentIndex(5);
   filter_box->activated(5);
   QCOMPARE(filter_box->currentText(),
-           QString("label: Resumption of the session"));
+           QString("label: Resumption of the session (0)"));
   QCOMPARE(doc_model.rowCount(), 0);
 
   // not label 1
   filter_box->setCurrentIndex(8);
   filter_box->activated(8);
   QCOMPARE(doc_model.rowCount(), 5);
+  QVERIFY(filter_box->currentText().endsWith(" (5)"));
+  QVERIFY(filter_box->itemText(4).endsWith(" (1)"));
 
   filter_box->setCurrentIndex(10);
   filter_box->activated(10);
@@ -257,6 +289,9 @@ void TestDocList::test_filters() {
   doc_model.document_lost_label(1, 1);
   doc_list.show();
   QCOMPARE(doc_model.rowCount(), 6);
+  // counts updated when the document lost its label
+  QVERIFY(filter_box->itemText(4).endsWith(" (0)"));
+  QVERIFY(filter_box->itemText(7).endsWith(" (6)"));
 
   auto new_db = tmp_dir.filePath("db1");
   { DatabaseCatalog().open_database(new_db); }
@@ -14,6 +14,7 @@ private slots:
   void test_delete_all_docs();
   void test_visit_document();
   void test_navigation();
+  void test_single_page();
   void test_filters();
 };
 
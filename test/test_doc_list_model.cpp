@@ -1,7 +1,10 @@
+#include <QSignalSpy>
 #include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QTemporaryDir>
 
+#include "database.h"
+#include "doc_deletion.h"
 #include "doc_list_model.h"
 #include "test_doc_list_model.h"
 #include "testing_utils.h"
@@ -26,6 +29,85 @@ void TestDocListModel::test_delete_docs() {
   QCOMPARE(query.value(0).toInt(), 4);
 }
 
+void TestDocListModel::test_delete_docs_in_chunks() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  add_annotations(db_name);
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  QList<int> progress{};
+  auto on_progress = [&progress](int n_deleted) { progress << n_deleted; };
+  auto result =
+      delete_docs_in_chunks(query, false, {1, 3, 4, 40}, 2, on_progress);
+  QCOMPARE(result.n_deleted, 3);
+  QCOMPARE(result.error_message, QString());
+  QCOMPARE(progress, (QList<int>{2, 3}));
+  query.exec("select count(*) from annotation where doc_id = 1;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 0);
+
+  // chunks committed before cancelling are kept
+  progress.clear();
+  auto cancelled = [&progress]() { return !progress.empty(); };
+  result = delete_docs_in_chunks(query, true, {}, 2, on_progress, cancelled);
+  QCOMPARE(result.n_deleted, 2);
+  QCOMPARE(result.error_message, QString());
+  query.exec("select id from document;");
+  QVERIFY(query.next());
+  QCOMPARE(query.value(0).toInt(), 6);
+  QVERIFY(!query.next());
+
+  // a deletion that cannot get the write lock is reported
+  {
+    auto other = QSqlDatabase::addDatabase("QSQLITE", "locking_connection");
+    other.setDatabaseName(QSqlDatabase::database(db_name).databaseName());
+    QVERIFY(other.open());
+    QSqlQuery lock(other);
+    QVERIFY(lock.exec("begin immediate;"));
+    query.exec("pragma busy_timeout = 0;");
+    result = delete_docs_in_chunks(query, true, {});
+    QCOMPARE(result.n_deleted, 0);
+    QCOMPARE(result.error_message,
+             QString("The database was locked by another connection."));
+    lock.exec("rollback;");
+  }
+  QSqlDatabase::removeDatabase("locking_connection");
+}
+
+void TestDocListModel::test_background_deletion() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  add_annotations(db_name);
+  add_many_docs(db_name);
+  DocListModel model{};
+  model.set_database(db_name);
+  auto n_docs = model.total_n_docs();
+  QCOMPARE(n_docs, 366);
+  QSignalSpy deleted_spy(&model, SIGNAL(docs_deleted()));
+  QSignalSpy progress_spy(&model, SIGNAL(deletion_progress(int)));
+  QSignalSpy finished_spy(&model, SIGNAL(deletion_finished(int)));
+  model.start_deleting_all_docs();
+  QVERIFY(model.is_deleting());
+  // ignored while the first deletion is in progress
+  model.start_deleting_docs({1});
+  QVERIFY(finished_spy.wait());
+  QVERIFY(!model.is_deleting());
+  QCOMPARE(finished_spy.size(), 1);
+  QCOMPARE(finished_spy[0][0].toInt(), n_docs);
+  QCOMPARE(deleted_spy.size(), 1);
+  QVERIFY(!progress_spy.isEmpty());
+  QCOMPARE(progress_spy.back()[0].toInt(), n_docs);
+  QCOMPARE(model.total_n_docs(), 0);
+  QCOMPARE(model.rowCount(), 0);
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  query.exec("select count(*) from annotation;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 0);
+  // the deletion thread gives back the free pages
+  query.exec("PRAGMA freelist_count;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 0);
+}
+
 void TestDocListModel::test_filters() {
   QTemporaryDir tmp_dir{};
   auto db_name = prepare_db(tmp_dir);
@@ -39,6 +121,10 @@ void TestDocListModel::test_filters() {
   QCOMPARE(model.rowCount(), 5);
   QCOMPARE(model.data(model.index(0, 0), Roles::RowIdRole).toInt(), 2);
   QCOMPARE(model.data(model.index(1, 0), Roles::RowIdRole).toInt(), 3);
+  // not only those of the current page
+  model.adjust_query(DocListModel::DocFilter::unlabelled, -1, 2);
+  QCOMPARE(model.rowCount(), 2);
+  QCOMPARE(model.current_doc_ids(), (QList<int>{2, 3, 4, 5, 6}));
   model.adjust_query(DocListModel::DocFilter::all);
   QCOMPARE(model.rowCount(), 6);
   QCOMPARE(model.data(model.index(3, 0), Roles::RowIdRole).toInt(), 4);
@@ -71,4 +157,223 @@ void TestDocListModel::test_updating_results() {
 
 }
 
+void TestDocListModel::test_deferred_loading() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  add_annotations(db_name);
+  DocListModel model{};
+  model.set_deferred_loading(true);
+  model.set_database(db_name);
+  QCOMPARE(model.rowCount(), 0);
+  QCOMPARE(model.total_n_docs(DocListModel::DocFilter::labelled), 1);
+  model.refresh_current_query_if_outdated();
+  QCOMPARE(model.rowCount(), 6);
+  QCOMPARE(model.data(model.index(0, 0), Roles::RowIdRole).toInt(), 1);
+}
+
+void TestDocListModel::test_pagination() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  add_many_docs(db_name);
+  add_annotations(db_name);
+  DocListModel model{};
+  model.set_database(db_name);
+  auto first_id = [&model]() {
+    return model.data(model.index(0, 0), Roles::RowIdRole).toInt();
+  };
+  auto last_id = [&model]() {
+    return model.data(model.index(model.rowCount() - 1, 0), Roles::RowIdRole)
+        .toInt();
+  };
+  auto filter = DocListModel::DocFilter::all;
+  // next pages are found from the last id of the current page
+  model.adjust_query(filter, -1, 100, 100);
+  QCOMPARE(first_id(), 101);
+  model.adjust_query(filter, -1, 100, 200);
+  QCOMPARE(first_id(), 201);
+  QCOMPARE(last_id(), 300);
+  // previous page from the first id
+  model.adjust_query(filter, -1, 100, 100);
+  QCOMPARE(model.rowCount(), 100);
+  QCOMPARE(first_id(), 101);
+  QCOMPARE(last_id(), 200);
+  // last page counted from the end
+  model.adjust_query(filter, -1, 100, 300);
+  QCOMPARE(model.rowCount(), 66);
+  QCOMPARE(first_id(), 301);
+  QCOMPARE(last_id(), 366);
+  model.adjust_query(filter, -1, 100, 400);
+  QCOMPARE(model.rowCount(), 0);
+  model.adjust_query(filter, -1, 100, 0);
+  QCOMPARE(first_id(), 1);
+
+  // document 1 is labelled
+  filter = DocListModel::DocFilter::unlabelled;
+  model.adjust_query(filter, -1, 100, 0);
+  QCOMPARE(first_id(), 2);
+  model.adjust_query(filter, -1, 100, 100);
+  QCOMPARE(first_id(), 102);
+  model.adjust_query(filter, -1, 100, 300);
+  QCOMPARE(model.rowCount(), 65);
+  QCOMPARE(first_id(), 302);
+  model.adjust_query(filter, -1, 100, 200);
+  QCOMPARE(first_id(), 202);
+  QCOMPARE(last_id(), 301);
+
+  // after deleting docs the current page is computed again from its offset
+  QList<QModelIndex> indices{model.index(0, 0), model.index(1, 0)};
+  model.delete_docs(indices);
+  QCOMPARE(first_id(), 204);
+  QCOMPARE(model.rowCount(), 100);
+}
+
+void TestDocListModel::test_fetch_more() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  add_many_docs(db_name);
+  add_annotations(db_name);
+  DocListModel model{};
+  model.set_database(db_name);
+  auto last_id = [&model]() {
+    return model.data(model.index(model.rowCount() - 1, 0), Roles::RowIdRole)
+        .toInt();
+  };
+  // no limit: all the documents, fetched in blocks
+  auto filter = DocListModel::DocFilter::all;
+  model.adjust_query(filter, -1, 0, 0);
+  QCOMPARE(model.n_page_rows(), 366);
+  QCOMPARE(model.rowCount(), 256);
+  QVERIFY(model.canFetchMore(QModelIndex()));
+  QSignalSpy spy(&model, SIGNAL(rowsInserted(QModelIndex, int, int)));
+  model.fetchMore(QModelIndex());
+  QCOMPARE(spy.count(), 1);
+  QCOMPARE(spy[0].at(1).toInt(), 256);
+  QCOMPARE(spy[0].at(2).toInt(), 365);
+  QCOMPARE(model.rowCount(), 366);
+  QCOMPARE(last_id(), 366);
+  QVERIFY(!model.canFetchMore(QModelIndex()));
+  QVERIFY(model.data(model.index(300, 0), Qt::DisplayRole)
+              .toString()
+              .startsWith("content of document"));
+  QCOMPARE(model.data(model.index(300, 1), Qt::DisplayRole).toInt(), 301);
+
+  // fetching stops at the end of the page
+  filter = DocListModel::DocFilter::unlabelled;
+  model.adjust_query(filter, -1, 300, 0);
+  QCOMPARE(model.n_page_rows(), 300);
+  QCOMPARE(model.rowCount(), 256);
+  model.fetchMore(QModelIndex());
+  QCOMPARE(model.rowCount(), 300);
+  QCOMPARE(last_id(), 301);
+  QVERIFY(!model.canFetchMore(QModelIndex()));
+  model.adjust_query(filter, -1, 0, 300);
+  QCOMPARE(model.rowCount(), 65);
+  QCOMPARE(model.data(model.index(0, 0), Roles::RowIdRole).toInt(), 302);
+
+  // documents deleted before the rest of the page is fetched
+  model.adjust_query(filter, -1, 0, 0);
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  query.exec("delete from document where id > 200;");
+  model.fetchMore(QModelIndex());
+  QCOMPARE(model.rowCount(), 256);
+  QVERIFY(!model.canFetchMore(QModelIndex()));
+}
+
+void TestDocListModel::test_search() {
+  QCOMPARE(search_text_to_fts_query("  "), QString());
+  QCOMPARE(search_text_to_fts_query(" the  Sess* \"x"),
+           QString("\"the\" \"Sess\"* \"\"\"x\""));
+
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  add_many_docs(db_name);
+  DocListModel model{};
+  model.set_database(db_name);
+  if (!model.set_search_text("content")) {
+    QSKIP("SQLite built without FTS5");
+  }
+  auto filter = DocListModel::DocFilter::search;
+  QCOMPARE(model.total_n_docs(filter), 360);
+  model.adjust_query(filter, -1, 100, 0);
+  QCOMPARE(model.rowCount(), 100);
+  QCOMPARE(model.data(model.index(0, 0), Roles::RowIdRole).toInt(), 7);
+  model.adjust_query(filter, -1, 100, 300);
+  QCOMPARE(model.rowCount(), 60);
+  QCOMPARE(model.data(model.index(59, 0), Roles::RowIdRole).toInt(), 366);
+
+  // a new search starts again from its first page
+  model.set_search_text("sess*");
+  QCOMPARE(model.total_n_docs(filter), 3);
+  model.adjust_query(filter, -1, 100, 0);
+  QCOMPARE(model.rowCount(), 3);
+  QCOMPARE(model.data(model.index(1, 0), Roles::RowIdRole).toInt(), 2);
+
+  // all words must be present; titles and user-provided ids are searched
+  model.set_search_text("Parliament session");
+  QCOMPARE(model.total_n_docs(filter), 1);
+  model.set_search_text("doc-1-long-title");
+  QCOMPARE(model.total_n_docs(filter), 1);
+  model.set_search_text("\"unbalanced");
+  QCOMPARE(model.total_n_docs(filter), 0);
+  model.set_search_text("");
+  model.adjust_query(filter, -1, 100, 0);
+  QCOMPARE(model.rowCount(), 0);
+
+  // the index follows changes to the documents
+  model.set_search_text("Parliament");
+  model.adjust_query(filter, -1, 100, 0);
+  QCOMPARE(model.rowCount(), 1);
+  model.delete_docs({model.index(0, 0)});
+  QCOMPARE(model.total_n_docs(filter), 0);
+  QCOMPARE(model.rowCount(), 0);
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  query.exec("insert into document (content, content_md5) values "
+             "('the European Parliament', x'aa');");
+  model.refresh_current_query();
+  QCOMPARE(model.rowCount(), 1);
+}
+
+void TestDocListModel::test_asynchronous_counts() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  add_many_docs(db_name);
+  add_annotations(db_name);
+  DocListModel model{};
+  model.set_asynchronous_counts(true);
+  QSignalSpy counts_spy(&model, SIGNAL(counts_updated()));
+  model.set_database(db_name);
+  QVERIFY(model.is_counting());
+  QCOMPARE(model.rowCount(), 0);
+  // requested pages are read with the counts
+  model.adjust_query(DocListModel::DocFilter::unlabelled, -1, 100, 100);
+  QCOMPARE(model.rowCount(), 0);
+  QVERIFY(counts_spy.wait());
+  QVERIFY(!model.is_counting());
+  QCOMPARE(model.total_n_docs(), 366);
+  QCOMPARE(model.total_n_docs(DocListModel::DocFilter::labelled), 1);
+  QCOMPARE(model.rowCount(), 100);
+  QCOMPARE(model.data(model.index(0, 0), Roles::RowIdRole).toInt(), 102);
+
+  // the search index is built and the matches counted in the background
+  QSignalSpy unavailable_spy(&model, SIGNAL(search_index_unavailable()));
+  QVERIFY(model.set_search_text("sess*"));
+  auto filter = DocListModel::DocFilter::search;
+  model.adjust_query(filter, -1, 100, 0);
+  QVERIFY(counts_spy.wait());
+  if (!unavailable_spy.isEmpty()) {
+    QSKIP("SQLite built without FTS5");
+  }
+  QCOMPARE(model.total_n_docs(filter), 3);
+  QCOMPARE(model.rowCount(), 3);
+  QCOMPARE(model.data(model.index(1, 0), Roles::RowIdRole).toInt(), 2);
+
+  // a deletion is followed by new counts
+  model.delete_docs({model.index(0, 0)});
+  // they may have arrived in the deletion's event loop
+  QTRY_VERIFY(!model.is_counting());
+  QCOMPARE(model.total_n_docs(filter), 2);
+  QCOMPARE(model.total_n_docs(), 365);
+  QCOMPARE(model.rowCount(), 2);
+}
+
 } // namespace labelbuddy
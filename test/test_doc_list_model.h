@@ -8,8 +8,15 @@ namespace labelbuddy {
     Q_OBJECT
   private slots:
     void test_delete_docs();
+    void test_delete_docs_in_chunks();
+    void test_background_deletion();
     void test_filters();
     void test_updating_results();
+    void test_deferred_loading();
+    void test_pagination();
+    void test_fetch_more();
+    void test_search();
+    void test_asynchronous_counts();
   };
 }
 #endif
@@ -0,0 +1,33 @@
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QTemporaryDir>
+
+#include "label_cache.h"
+#include "test_label_cache.h"
+#include "testing_utils.h"
+
+namespace labelbuddy {
+
+void TestLabelCache::test_label_cache() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  LabelCache cache{};
+  cache.set_database(db_name);
+  auto version = cache.version();
+  QCOMPARE(cache.sorted_labels().size(), 3);
+  auto first_id = cache.sorted_labels()[0].id;
+  QVERIFY(cache.label(first_id) != nullptr);
+  QCOMPARE(cache.name_to_id(cache.label(first_id)->name), first_id);
+  QCOMPARE(cache.name_to_id("does not exist"), -1);
+  QVERIFY(cache.label(1000) == nullptr);
+
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  query.exec("update label set shortcut_key = 'z' where id = 2;");
+  // not seen until invalidated
+  QCOMPARE(cache.shortcut_to_id("z"), -1);
+  cache.invalidate();
+  QCOMPARE(cache.shortcut_to_id("z"), 2);
+  QCOMPARE(cache.label(2)->shortcut_key, QString("z"));
+  QVERIFY(cache.version() != version);
+}
+} // namespace labelbuddy
@@ -0,0 +1,15 @@
+#ifndef LABELBUDDY_TEST_LABEL_CACHE_H
+#define LABELBUDDY_TEST_LABEL_CACHE_H
+
+#include <QTest>
+
+namespace labelbuddy {
+
+class TestLabelCache : public QObject {
+  Q_OBJECT
+private slots:
+  void test_label_cache();
+};
+} // namespace labelbuddy
+
+#endif
@@ -0,0 +1,72 @@
+#include <QTemporaryDir>
+
+#include "label_filter_model.h"
+#include "label_list_model.h"
+#include "test_label_filter_model.h"
+#include "testing_utils.h"
+#include "user_roles.h"
+
+namespace labelbuddy {
+
+namespace {
+
+QList<int> shown_ids(const LabelFilterModel& model) {
+  QList<int> ids{};
+  for (int i = 0; i != model.rowCount(); ++i) {
+    ids << model.data(model.index(i, 0), Roles::RowIdRole).toInt();
+  }
+  return ids;
+}
+
+} // namespace
+
+void TestLabelFilterModel::test_label_name_index() {
+  LabelNameIndex index{};
+  index.build({{1, "Neoplasm of prostate", "", ""},
+               {2, "Prostatitis", "", ""},
+               {3, "Lung neoplasm", "", ""},
+               {4, "Ab", "", ""}});
+  QCOMPARE(index.match("").size(), 4);
+  auto ranks = index.match("neo");
+  QCOMPARE(ranks.size(), 2);
+  QCOMPARE(ranks.value(1), 0);
+  QCOMPARE(ranks.value(3), 1);
+  // case-insensitive, and patterns shorter than a trigram
+  ranks = index.match("PROSTAT");
+  QCOMPARE(ranks.size(), 2);
+  QCOMPARE(ranks.value(2), 0);
+  QCOMPARE(ranks.value(1), 1);
+  ranks = index.match("a");
+  QCOMPARE(ranks.size(), 4);
+  QCOMPARE(ranks.value(4), 0);
+  // the characters in order when no name contains the pattern
+  ranks = index.match("nplsm");
+  QCOMPARE(ranks.size(), 2);
+  QCOMPARE(ranks.value(1), 2);
+  QCOMPARE(ranks.value(3), 2);
+  QVERIFY(index.match("xyz").isEmpty());
+  QVERIFY(index.match("mslpn").isEmpty());
+}
+
+void TestLabelFilterModel::test_label_filter_model() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  LabelListModel labels{};
+  labels.set_database(db_name);
+  LabelFilterModel model{};
+  model.setSourceModel(&labels);
+  QCOMPARE(shown_ids(model), (QList<int>{1, 2, 3}));
+  model.set_filter("sess");
+  QCOMPARE(shown_ids(model), (QList<int>{1, 2}));
+  model.set_filter("label: r");
+  QCOMPARE(shown_ids(model), (QList<int>{1, 2}));
+  // prefix matches first
+  labels.add_label("session");
+  QCOMPARE(shown_ids(model), (QList<int>{1, 2}));
+  model.set_filter("session");
+  QCOMPARE(shown_ids(model), (QList<int>{4, 2}));
+  model.set_filter("");
+  QCOMPARE(shown_ids(model), (QList<int>{1, 2, 3, 4}));
+}
+
+} // namespace labelbuddy
@@ -0,0 +1,16 @@
+#ifndef LABELBUDDY_TEST_LABEL_FILTER_MODEL_H
+#define LABELBUDDY_TEST_LABEL_FILTER_MODEL_H
+
+#include <QTest>
+
+namespace labelbuddy {
+
+class TestLabelFilterModel : public QObject {
+  Q_OBJECT
+private slots:
+  void test_label_name_index();
+  void test_label_filter_model();
+};
+} // namespace labelbuddy
+
+#endif
@@ -202,6 +202,55 @@ void TestLabelListModel::test_mime_drop() {
   QCOMPARE(get_label_ids(model), expected);
 }
 
+void TestLabelListModel::test_sparse_label_order() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  LabelListModel model{};
+  model.set_database(db_name);
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  auto keys = [&query]() {
+    QList<qlonglong> result{};
+    query.exec("select display_order from label order by id;");
+    while (query.next()) {
+      result << query.value(0).toLongLong();
+    }
+    return result;
+  };
+  auto drop = [&model](int from_row, int to_row) {
+    std::unique_ptr<QMimeData> encoded{
+        model.mimeData({model.index(from_row, 0)})};
+    model.dropMimeData(encoded.get(), Qt::MoveAction, to_row, 0,
+                       QModelIndex());
+  };
+  // the labels have no key yet: all are numbered
+  drop(0, -1);
+  QCOMPARE(get_label_ids(model), (QList<int>{2, 3, 1}));
+  QCOMPARE(keys(), (QList<qlonglong>{3072, 1024, 2048}));
+  // then only the moved label gets a key between its neighbours
+  drop(2, 1);
+  QCOMPARE(get_label_ids(model), (QList<int>{2, 1, 3}));
+  QCOMPARE(keys(), (QList<qlonglong>{1536, 1024, 2048}));
+  drop(2, 0);
+  QCOMPARE(get_label_ids(model), (QList<int>{3, 2, 1}));
+  QCOMPARE(keys(), (QList<qlonglong>{1536, 1024, 0}));
+  drop(0, -1);
+  QCOMPARE(get_label_ids(model), (QList<int>{2, 1, 3}));
+  QCOMPARE(keys(), (QList<qlonglong>{1536, 1024, 2560}));
+
+  // no room left between 2 and 1
+  query.exec("update label set display_order = 1025 where id = 1;");
+  model.refresh_current_query();
+  drop(2, 1);
+  QCOMPARE(get_label_ids(model), (QList<int>{2, 3, 1}));
+  QCOMPARE(keys(), (QList<qlonglong>{3072, 1024, 2048}));
+
+  // a new label without a key
+  model.add_label("new label");
+  drop(0, 3);
+  QCOMPARE(get_label_ids(model), (QList<int>{3, 1, 2, 4}));
+  QCOMPARE(keys(), (QList<qlonglong>{2048, 3072, 1024, 4096}));
+}
+
 QList<QString> get_label_names(const LabelListModel& model) {
   QList<QString> result{};
   for (int i = 0; i != model.rowCount(); ++i) {
@@ -17,6 +17,7 @@ private slots:
   void test_getdata_data();
   void test_add_label();
   void test_mime_drop();
+  void test_sparse_label_order();
 };
 
 QList<QString> get_label_names(const LabelListModel& model);
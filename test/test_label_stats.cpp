@@ -0,0 +1,150 @@
+#include <atomic>
+
+#include <QCryptographicHash>
+#include <QSignalSpy>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QTemporaryDir>
+
+#include "label_stats.h"
+#include "label_stats_model.h"
+#include "test_label_stats.h"
+#include "testing_utils.h"
+#include "user_roles.h"
+
+namespace labelbuddy {
+
+namespace {
+
+/// adds enough documents for several blocks and annotates some of them
+void add_annotated_docs(const QString& db_name) {
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  query.exec("begin transaction;");
+  for (int i = 0; i != 2500; ++i) {
+    query.prepare(
+        "insert into document (content, content_md5) values (:content, :md5);");
+    auto content = QString("document %0").arg(i);
+    query.bindValue(":content", content);
+    query.bindValue(":md5", QCryptographicHash::hash(content.toUtf8(),
+                                                     QCryptographicHash::Md5));
+    query.exec();
+  }
+  query.exec("commit;");
+  query.exec("insert into annotation (doc_id, label_id, start_char, end_char) "
+             "values (1, 1, 0, 1), (1, 1, 2, 5), (2, 1, 0, 2), (2, 2, 0, 5), "
+             "(2000, 3, 0, 4), (2001, 3, 1, 3), (2506, 3, 0, 6);");
+}
+
+} // namespace
+
+void TestLabelStats::test_compute_label_stats() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  add_annotated_docs(db_name);
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  QHash<int, LabelStats> stats{};
+  QVERIFY(compute_label_stats(query, stats));
+  QCOMPARE(stats.size(), 3);
+  QCOMPARE(stats[1].n_annotations, 3LL);
+  QCOMPARE(stats[1].n_docs, 2LL);
+  QCOMPARE(stats[1].total_length, 6LL);
+  QCOMPARE(stats[1].mean_length(), 2.);
+  QCOMPARE(stats[2].n_annotations, 1LL);
+  QCOMPARE(stats[2].n_docs, 1LL);
+  QCOMPARE(stats[2].total_length, 5LL);
+  // documents on both sides of a block boundary, and in the last block
+  QCOMPARE(stats[3].n_annotations, 3LL);
+  QCOMPARE(stats[3].n_docs, 3LL);
+  QCOMPARE(stats[3].total_length, 12LL);
+  QCOMPARE(LabelStats{}.mean_length(), 0.);
+
+  QVERIFY(!compute_label_stats(query, stats, []() { return true; }));
+  query.exec("delete from annotation;");
+  QVERIFY(compute_label_stats(query, stats));
+  QVERIFY(stats.isEmpty());
+}
+
+void TestLabelStats::test_label_stats_thread() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  add_annotated_docs(db_name);
+  std::atomic<bool> finished{};
+  std::atomic<bool> succeeded{};
+  std::atomic<qlonglong> n_annotations{};
+  {
+    LabelStatsThread thread(
+        db_name, [&](bool ok, QHash<int, LabelStats> stats) {
+          succeeded = ok;
+          n_annotations = stats.value(3).n_annotations;
+          finished = true;
+        });
+    QTRY_VERIFY(finished.load());
+  }
+  QVERIFY(succeeded.load());
+  QCOMPARE(n_annotations.load(), 3LL);
+}
+
+void TestLabelStats::test_label_stats_model() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  add_annotated_docs(db_name);
+  LabelStatsModel model{};
+  QSignalSpy spy(&model, SIGNAL(stats_updated()));
+  model.set_database(db_name);
+  QCOMPARE(model.rowCount(), 3);
+  QCOMPARE(model.columnCount(), 4);
+  QTRY_COMPARE(spy.count(), 1);
+  QVERIFY(!model.is_computing());
+  QCOMPARE(model.data(model.index(0, 0), Roles::RowIdRole).toInt(), 1);
+  QCOMPARE(
+      model.data(model.index(0, LabelStatsModel::Annotations)).toLongLong(),
+      3LL);
+  QCOMPARE(model.data(model.index(0, LabelStatsModel::Documents)).toLongLong(),
+           2LL);
+  QCOMPARE(model.data(model.index(0, LabelStatsModel::MeanLength)).toString(),
+           QString("2.0"));
+
+  // changes signalled by the annotations model
+  model.annotation_added(2, 3);
+  model.annotation_added(2, 4);
+  model.document_gained_label(2, 3);
+  QCOMPARE(model.label_stats(2).n_annotations, 3LL);
+  QCOMPARE(model.label_stats(2).n_docs, 2LL);
+  QCOMPARE(model.label_stats(2).mean_length(), 4.);
+  model.annotation_removed(2, 4);
+  model.annotation_removed(2, 3);
+  model.document_lost_label(2, 3);
+  QCOMPARE(model.label_stats(2).n_annotations, 1LL);
+  QCOMPARE(model.label_stats(2).n_docs, 1LL);
+
+  // in the current thread
+  model.set_asynchronous(false);
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  query.exec("delete from annotation where label_id = 3;");
+  model.refresh_stats();
+  QCOMPARE(spy.count(), 2);
+  QCOMPARE(model.label_stats(3).n_annotations, 0LL);
+  QCOMPARE(model.label_stats(1).n_annotations, 3LL);
+}
+
+void TestLabelStats::test_deferred_label_stats() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  add_annotated_docs(db_name);
+  LabelStatsModel model{};
+  model.set_asynchronous(false);
+  model.set_deferred_loading(true);
+  QSignalSpy spy(&model, SIGNAL(stats_updated()));
+  model.set_database(db_name);
+  QCOMPARE(model.rowCount(), 3);
+  QCOMPARE(spy.count(), 0);
+  QCOMPARE(model.label_stats(1).n_annotations, 0LL);
+  model.refresh_stats_if_outdated();
+  QCOMPARE(spy.count(), 1);
+  QCOMPARE(model.label_stats(1).n_annotations, 3LL);
+  // already up to date
+  model.refresh_stats_if_outdated();
+  QCOMPARE(spy.count(), 1);
+}
+
+} // namespace labelbuddy
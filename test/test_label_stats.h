@@ -0,0 +1,18 @@
+#ifndef LABELBUDDY_TEST_LABEL_STATS_H
+#define LABELBUDDY_TEST_LABEL_STATS_H
+
+#include <QTest>
+
+namespace labelbuddy {
+
+class TestLabelStats : public QObject {
+  Q_OBJECT
+private slots:
+  void test_compute_label_stats();
+  void test_label_stats_thread();
+  void test_label_stats_model();
+  void test_deferred_label_stats();
+};
+} // namespace labelbuddy
+
+#endif
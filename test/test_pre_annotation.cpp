@@ -0,0 +1,197 @@
+#include <QFile>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+#include "database.h"
+#include "pre_annotation.h"
+#include "test_pre_annotation.h"
+
+namespace labelbuddy {
+
+namespace {
+
+/// replaces the text of each document in the request with one annotation of
+/// the first 5 characters
+const char* annotate_start_of_docs{
+    "sed -e 's/\"text\":\"[^\"]*\"/\"labels\":[[0,5,\"pre\"]]/g'"};
+
+/// write a shell script and return the command running it
+QString write_script(QTemporaryDir& tmp_dir, const QString& name,
+                     const QString& script) {
+  auto file_path = tmp_dir.filePath(name);
+  QFile file(file_path);
+  file.open(QIODevice::WriteOnly | QIODevice::Text);
+  QTextStream stream(&file);
+  stream << script;
+  return QString("sh '%0'").arg(file_path);
+}
+
+/// answers each line of its input with `annotate_start_of_docs`
+QString model_command(QTemporaryDir& tmp_dir) {
+  return write_script(tmp_dir, "model.sh",
+                      QString("while IFS= read -r line; do\n"
+                              "  printf '%s\\n' \"$line\" | %0\n"
+                              "done\n")
+                          .arg(annotate_start_of_docs));
+}
+
+/// a database with 5 documents, whose texts are at least 5 characters long
+QString prepare_pre_annotation_db(QTemporaryDir& tmp_dir,
+                                  DatabaseCatalog& catalog) {
+  auto docs_file = tmp_dir.filePath("docs.jsonl");
+  {
+    QFile file(docs_file);
+    file.open(QIODevice::WriteOnly | QIODevice::Text);
+    QTextStream stream(&file);
+    for (const auto& text :
+         {"alpha one", "beta two", "gamma three", "delta four", "epsilon"}) {
+      stream << QString("{\"text\": \"%0\"}\n").arg(text);
+    }
+  }
+  auto db_path = tmp_dir.filePath("db.sqlite");
+  catalog.open_database(db_path);
+  catalog.import_documents(docs_file);
+  return db_path;
+}
+
+} // namespace
+
+void TestPreAnnotation::test_pre_annotation_pool() {
+#ifdef Q_OS_WIN
+  QSKIP("The test commands are shell scripts");
+#endif
+  QTemporaryDir tmp_dir{};
+  // also answers for a document that was not in the batch
+  auto command = write_script(
+      tmp_dir, "model.sh",
+      QString("while IFS= read -r line; do\n"
+              "  printf '%s\\n' \"$line\" | %0 "
+              "| sed -e 's/]$/,{\"id\":1000,\"labels\":[[0,1,\"pre\"]]}]/'\n"
+              "done\n")
+          .arg(annotate_start_of_docs));
+  PreAnnotationPool pool(command, 2);
+  QVERIFY(pool.start());
+  QVERIFY(pool.can_submit());
+  QVERIFY(pool.submit({qMakePair(3, QString("hello world")),
+                       qMakePair(7, QString("hi"))}));
+  QCOMPARE(pool.n_pending(), 1);
+  QVERIFY(pool.submit({qMakePair(8, QString("héllo"))}));
+  QCOMPARE(pool.n_pending(), 2);
+  QVERIFY(!pool.can_submit());
+
+  // results come in the order of the batches
+  std::vector<PredictedAnnotations> result{};
+  QVERIFY(pool.take_result(result));
+  QCOMPARE(pool.n_pending(), 1);
+  QCOMPARE(static_cast<int>(result.size()), 2);
+  QCOMPARE(result[0].doc_id, 3);
+  QCOMPARE(static_cast<int>(result[0].annotations.size()), 1);
+  QCOMPARE(result[0].annotations[0].start_char, 0);
+  QCOMPARE(result[0].annotations[0].end_char, 5);
+  QCOMPARE(result[0].annotations[0].label, QString("pre"));
+  // the annotation ends after the text
+  QCOMPARE(result[1].doc_id, 7);
+  QVERIFY(result[1].annotations.empty());
+
+  QVERIFY(pool.take_result(result));
+  QCOMPARE(pool.n_pending(), 0);
+  QCOMPARE(static_cast<int>(result.size()), 1);
+  QCOMPARE(result[0].doc_id, 8);
+  QCOMPARE(static_cast<int>(result[0].annotations.size()), 1);
+
+  // the process that answered first is used again
+  QVERIFY(pool.submit({qMakePair(9, QString("hello again"))}));
+  QVERIFY(pool.take_result(result));
+  QCOMPARE(result[0].doc_id, 9);
+}
+
+void TestPreAnnotation::test_pre_annotate_documents() {
+#ifdef Q_OS_WIN
+  QSKIP("The test commands are shell scripts");
+#endif
+  QTemporaryDir tmp_dir{};
+  DatabaseCatalog catalog{};
+  auto db_path = prepare_pre_annotation_db(tmp_dir, catalog);
+  PreAnnotationOptions options{};
+  options.command = model_command(tmp_dir);
+  options.batch_size = 2;
+  options.n_processes = 2;
+  QList<int> progress{};
+  auto on_progress = [&progress](int n_docs) { progress << n_docs; };
+  auto result = catalog.pre_annotate_documents(options, {}, on_progress);
+  QCOMPARE(static_cast<int>(result.error_code),
+           static_cast<int>(ErrorCode::NoError));
+  QCOMPARE(result.n_docs, 5);
+  QCOMPARE(result.n_annotations, 5);
+  QCOMPARE(progress, (QList<int>{5}));
+  // the label is created
+  QSqlQuery query(QSqlDatabase::database(db_path));
+  query.exec("select count(*) from annotation join label "
+             "on annotation.label_id = label.id where label.name = 'pre';");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 5);
+  QVERIFY(catalog.get_label_cache()->name_to_id("pre") != -1);
+
+  // existing annotations are not counted
+  result = catalog.pre_annotate_documents(options);
+  QCOMPARE(result.n_docs, 5);
+  QCOMPARE(result.n_annotations, 0);
+
+  // only the selected documents are sent
+  query.exec("delete from annotation where doc_id in (2, 4);");
+  ExportFilter filter{};
+  filter.docs = ExportFilter::Docs::unlabelled;
+  result = catalog.pre_annotate_documents(options, filter);
+  QCOMPARE(result.n_docs, 2);
+  QCOMPARE(result.n_annotations, 2);
+  filter.docs = ExportFilter::Docs::all;
+  filter.min_doc_id = 10;
+  result = catalog.pre_annotate_documents(options, filter);
+  QCOMPARE(static_cast<int>(result.error_code),
+           static_cast<int>(ErrorCode::NoError));
+  QCOMPARE(result.n_docs, 0);
+}
+
+void TestPreAnnotation::test_pre_annotation_errors() {
+#ifdef Q_OS_WIN
+  QSKIP("The test commands are shell scripts");
+#endif
+  QTemporaryDir tmp_dir{};
+  DatabaseCatalog catalog{};
+  auto db_path = prepare_pre_annotation_db(tmp_dir, catalog);
+  PreAnnotationOptions options{};
+  options.batch_size = 2;
+
+  options.command = "exit 0";
+  auto result = catalog.pre_annotate_documents(options);
+  QVERIFY(result.error_code != ErrorCode::NoError);
+  QCOMPARE(result.n_docs, 0);
+
+  // the command does not exit, so its input can be written
+  options.command = "echo nope; cat > /dev/null";
+  result = catalog.pre_annotate_documents(options);
+  QCOMPARE(static_cast<int>(result.error_code),
+           static_cast<int>(ErrorCode::CriticalParsingError));
+  QCOMPARE(result.n_annotations, 0);
+
+  // the annotations received before the error are kept
+  options.command = write_script(
+      tmp_dir, "model.sh",
+      QString("read -r line\n"
+              "printf '%s\\n' \"$line\" | %0\n"
+              "while read -r line; do echo nope; done\n")
+          .arg(annotate_start_of_docs));
+  result = catalog.pre_annotate_documents(options);
+  QCOMPARE(static_cast<int>(result.error_code),
+           static_cast<int>(ErrorCode::CriticalParsingError));
+  QCOMPARE(result.n_docs, 2);
+  QCOMPARE(result.n_annotations, 2);
+  QSqlQuery query(QSqlDatabase::database(db_path));
+  query.exec("select count(*) from annotation;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 2);
+}
+
+} // namespace labelbuddy
@@ -0,0 +1,17 @@
+#ifndef LABELBUDDY_TEST_PRE_ANNOTATION_H
+#define LABELBUDDY_TEST_PRE_ANNOTATION_H
+
+#include <QTest>
+
+namespace labelbuddy {
+
+class TestPreAnnotation : public QObject {
+  Q_OBJECT
+private slots:
+  void test_pre_annotation_pool();
+  void test_pre_annotate_documents();
+  void test_pre_annotation_errors();
+};
+} // namespace labelbuddy
+
+#endif
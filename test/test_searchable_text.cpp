@@ -3,6 +3,7 @@
 #include "testing_utils.h"
 
 #include "searchable_text.h"
+#include "text_search.h"
 #include "test_searchable_text.h"
 
 namespace labelbuddy {
@@ -51,6 +52,53 @@ void TestSearchableText::test_search() {
   QCOMPARE(cursor.selectedText(), QString("3"));
 }
 
+void TestSearchableText::test_match_index() {
+  QCOMPARE(find_matches("aaaaa", "aa"), (QVector<int>{0, 2}));
+  QCOMPARE(find_matches(u8"Maçã maçã MAÇÃ", u8"maçã"),
+           (QVector<int>{0, 5, 10}));
+  QCOMPARE(find_matches("abc", ""), QVector<int>{});
+  QCOMPARE(find_matches("abc", "abcd"), QVector<int>{});
+  QString long_text = QString("x").repeated((1 << 20) - 2) + "abcabc";
+  QCOMPARE(find_matches(long_text, "abc"),
+           (QVector<int>{(1 << 20) - 2, (1 << 20) + 1}));
+  QCOMPARE(find_matches(long_text, "abc", []() { return true; }),
+           QVector<int>{});
+
+  SearchableText text{};
+  text.show();
+  auto content = example_doc();
+  text.fill(content);
+  auto search_box = text.findChild<QLineEdit*>();
+  auto te = text.findChild<QPlainTextEdit*>();
+  search_box->setText(u8"maçã");
+  QTRY_COMPARE(text.n_matches(), 3);
+  QCOMPARE(text.match_highlights(0, content.size()).size(), 3);
+  auto first = content.indexOf(u8"maçã");
+  QCOMPARE(text.match_highlights(0, first).size(), 0);
+  QCOMPARE(text.match_highlights(0, first + 1).size(), 1);
+  QCOMPARE(text.match_highlights(first + 3, first + 4).size(), 1);
+
+  text.search_forward();
+  auto cursor = te->textCursor();
+  QCOMPARE(cursor.selectionStart(), first);
+  QCOMPARE(cursor.selectedText(), QString(u8"maçã"));
+  auto label = text.findChild<QLabel*>();
+  QCOMPARE(label->text(), QString("1 of 3"));
+  text.search_backward();
+  cursor = te->textCursor();
+  QCOMPARE(cursor.selectionStart(), content.indexOf(u8"maçã3"));
+  QCOMPARE(label->text(), QString("3 of 3"));
+  text.search_forward();
+  QCOMPARE(te->textCursor().selectionStart(), first);
+
+  search_box->setText("not in the text");
+  QTRY_COMPARE(text.n_matches(), 0);
+  QCOMPARE(label->text(), QString("0 matches"));
+  search_box->setText("");
+  QCOMPARE(text.n_matches(), 0);
+  QCOMPARE(label->text(), QString(""));
+}
+
 void TestSearchableText::test_cycle_pos() {
   SearchableText text{};
   text.show();
@@ -119,4 +167,46 @@ void TestSearchableText::test_shortcuts() {
   QCOMPARE(te->textCursor().selectedText(), QString("Line 150"));
 }
 
+void TestSearchableText::test_large_document() {
+  SearchableText text{};
+  text.set_large_document_size(5000, 3000);
+  text.show();
+  QString content{};
+  for (int i = 0; i != 1000; ++i) {
+    content += QString("line %0 abc\n").arg(i, 4, 10, QChar('0'));
+  }
+  text.fill(content);
+  auto te = text.get_text_edit();
+  // windows start and end after a line break
+  QCOMPARE(text.loaded_range(), qMakePair(0, 3010));
+  QCOMPARE(te->toPlainText(), content.left(3010));
+  QCOMPARE(text.to_text_edit_position(10000), 3010);
+
+  QSignalSpy spy(&text, SIGNAL(window_changed()));
+  text.move_cursor_to(10000);
+  QCOMPARE(spy.count(), 1);
+  auto loaded = text.loaded_range();
+  QCOMPARE(loaded, qMakePair(8512, 11522));
+  QCOMPARE(te->toPlainText(),
+           content.mid(loaded.first, loaded.second - loaded.first));
+  QCOMPARE(text.current_selection(), (QList<int>{10000, 10000}));
+  QCOMPARE(te->textCursor().position(), 10000 - 8512);
+  QCOMPARE(text.to_content_position(0), 8512);
+  QCOMPARE(text.to_text_edit_position(0), 0);
+
+  auto search_box = text.get_search_box();
+  search_box->setText("line 0010");
+  QTRY_COMPARE(text.n_matches(), 1);
+  QCOMPARE(text.match_highlights(0, content.size()).size(), 0);
+  text.search_forward();
+  QCOMPARE(spy.count(), 2);
+  QCOMPARE(text.loaded_range(), qMakePair(0, 3010));
+  QCOMPARE(text.current_selection(), (QList<int>{140, 149}));
+  QCOMPARE(te->textCursor().selectedText(), QString("line 0010"));
+  QCOMPARE(text.match_highlights(0, content.size()).size(), 1);
+
+  QTest::keyClick(te, Qt::Key_End);
+  QCOMPARE(text.loaded_range().second, content.size());
+}
+
 } // namespace labelbuddy
@@ -10,8 +10,10 @@ class TestSearchableText : public QObject {
 
 private slots:
   void test_search();
+  void test_match_index();
   void test_cycle_pos();
   void test_shortcuts();
+  void test_large_document();
 };
 
 } // namespace labelbuddy
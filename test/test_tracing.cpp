@@ -0,0 +1,88 @@
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QTemporaryDir>
+
+#include "test_tracing.h"
+#include "testing_utils.h"
+#include "tracing.h"
+
+namespace labelbuddy {
+
+void TestTracing::cleanup() { enable_tracing(TraceFormat::None); }
+
+void TestTracing::test_summary() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  // nothing is recorded before tracing is enabled
+  QVERIFY(!is_tracing_enabled());
+  QVERIFY(traced_exec(query, "select count(*) from label;"));
+  QVERIFY(write_trace());
+
+  auto output_path = tmp_dir.filePath("summary.txt");
+  enable_tracing(TraceFormat::Summary, output_path);
+  QVERIFY(is_tracing_enabled());
+  query.prepare("select id from document where id = :id;");
+  for (int i = 0; i != 3; ++i) {
+    query.bindValue(":id", i);
+    QVERIFY(traced_exec(query));
+  }
+  QVERIFY(!traced_exec(query, "select * from does_not_exist;"));
+  { TraceScope scope("test scope"); }
+  QVERIFY(write_trace());
+
+  QFile file(output_path);
+  QVERIFY(file.open(QIODevice::ReadOnly));
+  auto lines = QString::fromUtf8(file.readAll()).split('\n');
+  QVERIFY(lines[0].contains("total ms"));
+  // header, 3 entries and the final newline
+  QCOMPARE(lines.size(), 5);
+  bool found_prepared{};
+  for (const auto& line : lines) {
+    if (line.endsWith("select id from document where id = :id;")) {
+      found_prepared = true;
+      QCOMPARE(line.simplified().split(' ')[0], QString("3"));
+      QVERIFY(line.contains(" sql "));
+    }
+  }
+  QVERIFY(found_prepared);
+  QVERIFY(lines.filter("select * from does_not_exist;").size() == 1);
+  QVERIFY(lines.filter("scope  test scope").size() == 1);
+}
+
+void TestTracing::test_chrome_trace() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  QSqlQuery query(QSqlDatabase::database(db_name));
+  auto output_path = tmp_dir.filePath("trace.json");
+  enable_tracing(TraceFormat::Chrome, output_path);
+  {
+    TraceScope scope("outer");
+    traced_exec(query, "select count(*) from document;");
+  }
+  QVERIFY(write_trace());
+
+  QFile file(output_path);
+  QVERIFY(file.open(QIODevice::ReadOnly));
+  auto events = QJsonDocument::fromJson(file.readAll())
+                    .object()["traceEvents"]
+                    .toArray();
+  QCOMPARE(events.size(), 2);
+  auto sql = events[0].toObject();
+  auto outer = events[1].toObject();
+  QCOMPARE(sql["name"].toString(), QString("select count(*) from document;"));
+  QCOMPARE(sql["cat"].toString(), QString("sql"));
+  QCOMPARE(outer["name"].toString(), QString("outer"));
+  QCOMPARE(outer["ph"].toString(), QString("X"));
+  // the statement is nested in the scope
+  QVERIFY(outer["ts"].toDouble() <= sql["ts"].toDouble());
+  QVERIFY(outer["ts"].toDouble() + outer["dur"].toDouble() >=
+          sql["ts"].toDouble() + sql["dur"].toDouble());
+  QCOMPARE(outer["tid"].toInt(), sql["tid"].toInt());
+}
+
+} // namespace labelbuddy
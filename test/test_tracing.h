@@ -0,0 +1,18 @@
+#ifndef LABELBUDDY_TEST_TRACING_H
+#define LABELBUDDY_TEST_TRACING_H
+
+#include <QTest>
+
+namespace labelbuddy {
+
+class TestTracing : public QObject {
+  Q_OBJECT
+private slots:
+  void test_summary();
+  void test_chrome_trace();
+
+  void cleanup();
+};
+} // namespace labelbuddy
+
+#endif
@@ -0,0 +1,100 @@
+#include <limits>
+
+#include <QBuffer>
+#include <QJsonArray>
+#include <QJsonDocument>
+
+#include "test_utf8_writer.h"
+#include "utf8_writer.h"
+
+namespace labelbuddy {
+
+void TestUtf8Writer::test_json_string_data() {
+  QTest::addColumn<QString>("text");
+  QTest::newRow("empty") << QString();
+  QTest::newRow("ascii") << QString("hello, world");
+  QTest::newRow("escaped")
+      << QString("a\"b\\c/d\n\r\t\b\f\x01\x1f\x7f") + QChar(0);
+  QTest::newRow("non-ascii") << QString::fromUtf8("é€ 𝄞 αβγ");
+  QTest::newRow("unpaired surrogates")
+      << QString("a") + QChar(0xd834) + QString("b") + QChar(0xdd1e);
+  // a surrogate pair across the boundary of the chunks that are encoded
+  QTest::newRow("long") << QString((1 << 16) - 1, 'x') +
+                               QString::fromUtf8("𝄞") + QString(10, '"');
+}
+
+void TestUtf8Writer::test_json_string() {
+  QFETCH(QString, text);
+  QBuffer buffer{};
+  buffer.open(QIODevice::WriteOnly);
+  {
+    Utf8Writer output(&buffer);
+    output.append_raw("[");
+    output.append_json_string(text);
+    output.append_raw("]");
+  }
+  QCOMPARE(buffer.data(),
+           QJsonDocument(QJsonArray{text}).toJson(QJsonDocument::Compact));
+}
+
+void TestUtf8Writer::test_text_and_numbers() {
+  QBuffer buffer{};
+  buffer.open(QIODevice::WriteOnly);
+  auto text = QString::fromUtf8("é€ 𝄞 \"x\"");
+  {
+    Utf8Writer output(&buffer);
+    output.append_text(text);
+    output.append_number(0);
+    output.append_raw(" ");
+    output.append_number(-42);
+    output.append_raw(" ");
+    output.append_number(std::numeric_limits<qlonglong>::min());
+    output.append_raw(" ");
+    output.append_number(std::numeric_limits<qlonglong>::max());
+    output.append_text(QString("a") + QChar(0xdc00));
+  }
+  QCOMPARE(buffer.data(),
+           text.toUtf8() + "0 -42 -9223372036854775808 9223372036854775807a?");
+}
+
+void TestUtf8Writer::test_csv_field() {
+  QBuffer buffer{};
+  buffer.open(QIODevice::WriteOnly);
+  {
+    Utf8Writer output(&buffer);
+    output.append_csv_field(QString::fromUtf8("plain é"));
+    output.append_raw("|");
+    output.append_csv_field(QString("a,b"));
+    output.append_raw("|");
+    output.append_csv_field(QString("say \"hi\"\r\n"));
+    output.append_raw("|");
+    output.append_csv_field(QByteArray("{\"k\":1}"));
+    output.append_raw("|");
+    output.append_csv_field(QByteArray("{}"));
+  }
+  QCOMPARE(buffer.data(), QString::fromUtf8("plain é|\"a,b\"|\"say \"\"hi\"\""
+                                            "\r\n\"|\"{\"\"k\"\":1}\"|{}")
+                              .toUtf8());
+}
+
+void TestUtf8Writer::test_buffering() {
+  QBuffer buffer{};
+  buffer.open(QIODevice::WriteOnly);
+  {
+    Utf8Writer output(&buffer, 8);
+    output.append_raw("1234");
+    QCOMPARE(buffer.size(), 0LL);
+    output.append_text("5678");
+    QCOMPARE(buffer.data(), QByteArray("12345678"));
+    output.append_raw("9");
+    QCOMPARE(buffer.size(), 8LL);
+    output.flush();
+    QCOMPARE(buffer.data(), QByteArray("123456789"));
+    output.flush();
+    output.append_raw("0");
+  }
+  // the writer is flushed when it is destroyed
+  QCOMPARE(buffer.data(), QByteArray("1234567890"));
+}
+
+} // namespace labelbuddy
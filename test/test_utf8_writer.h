@@ -0,0 +1,19 @@
+#ifndef LABELBUDDY_TEST_UTF8_WRITER_H
+#define LABELBUDDY_TEST_UTF8_WRITER_H
+
+#include <QTest>
+
+namespace labelbuddy {
+
+class TestUtf8Writer : public QObject {
+  Q_OBJECT
+private slots:
+  void test_json_string();
+  void test_json_string_data();
+  void test_text_and_numbers();
+  void test_csv_field();
+  void test_buffering();
+};
+} // namespace labelbuddy
+
+#endif
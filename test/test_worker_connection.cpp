@@ -0,0 +1,76 @@
+#include <thread>
+
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QTemporaryDir>
+
+#include "database.h"
+#include "test_worker_connection.h"
+#include "testing_utils.h"
+#include "worker_connection.h"
+
+namespace labelbuddy {
+
+void TestWorkerConnection::test_worker_database_path() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  QCOMPARE(worker_database_path(db_name),
+           QSqlDatabase::database(db_name).databaseName());
+  QVERIFY(worker_database_path(db_name) != "");
+
+  // only their own connection can use these
+  DatabaseCatalog catalog{};
+  catalog.open_temp_database();
+  QCOMPARE(worker_database_path(catalog.get_current_database()), QString());
+  {
+    auto db = QSqlDatabase::addDatabase("QSQLITE", "in_memory");
+    db.setDatabaseName(":memory:");
+  }
+  QCOMPARE(worker_database_path("in_memory"), QString());
+  QSqlDatabase::removeDatabase("in_memory");
+  QCOMPARE(worker_database_path("no_such_connection"), QString());
+}
+
+void TestWorkerConnection::test_worker_connection() {
+  QTemporaryDir tmp_dir{};
+  auto db_name = prepare_db(tmp_dir);
+  add_annotations(db_name);
+  auto database_path = worker_database_path(db_name);
+  auto n_connections = QSqlDatabase::connectionNames().size();
+  {
+    WorkerConnection reader(database_path, "test_reader",
+                            WorkerConnection::Access::ReadOnly);
+    QVERIFY(reader.is_open());
+    QCOMPARE(QSqlDatabase::connectionNames().size(), n_connections + 1);
+    QSqlQuery query(reader.database());
+    QVERIFY(query.exec("select count(*) from annotation;"));
+    QVERIFY(query.next());
+    QVERIFY(query.value(0).toInt() > 0);
+    query.finish();
+    QVERIFY(!query.exec("delete from document;"));
+  }
+  QCOMPARE(QSqlDatabase::connectionNames().size(), n_connections);
+
+  // used from the thread that creates it, like the background jobs
+  int n_annotations{-1};
+  std::thread writer_thread([&database_path, &n_annotations]() {
+    WorkerConnection writer(database_path, "test_writer",
+                            WorkerConnection::Access::ReadWrite);
+    QSqlQuery query(writer.database());
+    // foreign keys are enforced, so the annotations are deleted too
+    query.exec("delete from document;");
+    query.exec("select count(*) from annotation;");
+    if (query.next()) {
+      n_annotations = query.value(0).toInt();
+    }
+  });
+  writer_thread.join();
+  QCOMPARE(n_annotations, 0);
+  QCOMPARE(QSqlDatabase::connectionNames().size(), n_connections);
+
+  WorkerConnection missing(tmp_dir.filePath("does_not_exist.sqlite"),
+                           "test_missing", WorkerConnection::Access::ReadOnly);
+  QVERIFY(!missing.is_open());
+}
+
+} // namespace labelbuddy
@@ -0,0 +1,16 @@
+#ifndef LABELBUDDY_TEST_WORKER_CONNECTION_H
+#define LABELBUDDY_TEST_WORKER_CONNECTION_H
+
+#include <QTest>
+
+namespace labelbuddy {
+
+class TestWorkerConnection : public QObject {
+  Q_OBJECT
+private slots:
+  void test_worker_database_path();
+  void test_worker_connection();
+};
+} // namespace labelbuddy
+
+#endif